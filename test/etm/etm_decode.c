@@ -0,0 +1,1098 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "etm_decode.h"
+
+#define ETM_READ_BLOCK (4 << 20)
+
+/*
+ * --print-input output goes straight to stdout, so the records decoded
+ * before it are pushed through the sink first to keep the order.
+ */
+#define debug(state, ...)						\
+	do {								\
+		if ((state)->print_input && !(state)->eof) {		\
+			etm_flush(state);				\
+			printf(__VA_ARGS__);				\
+		}							\
+	} while (0)
+
+static const char *mode_name[] = { "Jazelle", "Thumb", "ARM" };
+
+void etm_flush(struct etm_state *state)
+{
+	if (state->rec_count)
+		state->sink(state->sink_ctx, state->rec, state->rec_count);
+	state->rec_count = 0;
+	state->sink(state->sink_ctx, NULL, 0);
+}
+
+/*
+ * Once the input has ended the packet being decoded is dropped, the way
+ * etm used to exit() from inside get_byte(): later records go nowhere.
+ */
+static struct etm_record *emit(struct etm_state *state, int type)
+{
+	struct etm_record *r;
+
+	if (state->eof)
+		return &state->discard;
+	if (state->rec_count == state->rec_size) {
+		state->sink(state->sink_ctx, state->rec, state->rec_count);
+		state->rec_count = 0;
+	}
+	r = &state->rec[state->rec_count++];
+	state->rec_total++;
+	r->type = type;
+	r->flags = state->sync > 0 ? ETM_REC_F_SYNC : 0;
+	r->mode = state->mode;
+	r->aux = 0;
+	r->addr = 0;
+	r->valid = state->iaddr_valid;
+	r->value = 0;
+	r->value2 = 0;
+	r->context = state->contextid;
+	r->timestamp = state->timestamp;
+	return r;
+}
+
+void etm_spec_start(struct etm_state *state, struct etm_spec *spec)
+{
+	spec->isync_rec = ETM_SPEC_NONE;
+	spec->context_rec = ETM_SPEC_NONE;
+	spec->wait_rec = ETM_SPEC_NONE;
+	state->spec = spec;
+	state->sync = 1;
+}
+
+void etm_spec_free(struct etm_spec *spec)
+{
+	free(spec->ts);
+	free(spec->daddr);
+	memset(spec, 0, sizeof(*spec));
+}
+
+static void spec_mask_change(struct etm_spec *spec, struct etm_mask_change **changes,
+			     size_t *count, size_t *size, size_t rec, uint64_t mask)
+{
+	struct etm_mask_change *c;
+
+	if (*count == *size) {
+		*size = *size ? *size * 2 : 16;
+		c = realloc(*changes, *size * sizeof(*c));
+		if (!c) {
+			spec->failed = true;
+			*count = 0;
+			return;
+		}
+		*changes = c;
+	}
+	(*changes)[*count].rec = rec;
+	(*changes)[*count].mask = mask;
+	(*count)++;
+}
+
+/* the last record emitted is the one that depends on the new mask */
+static void spec_timestamp(struct etm_state *state, uint64_t known)
+{
+	struct etm_spec *spec = state->spec;
+
+	if (!spec || state->eof || (spec->ts_known | known) == spec->ts_known)
+		return;
+	spec->ts_known |= known;
+	spec_mask_change(spec, &spec->ts, &spec->ts_count, &spec->ts_size,
+			 state->rec_total - 1, spec->ts_known);
+}
+
+static void spec_daddr(struct etm_state *state, uint32_t known)
+{
+	struct etm_spec *spec = state->spec;
+
+	if (!spec || state->eof || (spec->daddr_known | known) == spec->daddr_known)
+		return;
+	spec->daddr_known |= known;
+	spec_mask_change(spec, &spec->daddr, &spec->daddr_count, &spec->daddr_size,
+			 state->rec_total - 1, spec->daddr_known);
+}
+
+static int refill(struct etm_state *state)
+{
+	ssize_t len;
+
+	if (state->in_fd < 0)
+		return 0;
+	do {
+		len = read(state->in_fd, state->in_buf, state->in_buf_size);
+	} while (len < 0 && errno == EINTR);
+	if (len <= 0)
+		return 0;
+	state->in = state->in_buf;
+	state->in_end = state->in_buf + len;
+	return 1;
+}
+
+static inline int next_input(struct etm_state *state)
+{
+	if (state->in == state->in_end && !refill(state))
+		return -1;
+	return *state->in++;
+}
+
+static int get_byte_from_formatter(struct etm_state *state)
+{
+	int ch;
+	int i;
+	int ebit;
+	int sourceid = state->sourceid;
+	struct etm_record *r;
+
+	while (1) {
+		if (!state->formatter_index) {
+			debug(state, "raw:");
+			for (i = 0; i < 16; i++) {
+				ch = next_input(state);
+				if (ch < 0)
+					return ch;
+				debug(state, " %02x%s", ch, (!(i & 1) && (ch & 1)) ? "(ID)" : "");
+				state->formatter_packet[i] = ch;
+			}
+			debug(state, "\n");
+		}
+		i = state->formatter_index;
+		ch = state->formatter_packet[i];
+		state->formatter_index = (i + 1) % 15;
+		if (!(i & 1)) {
+			ebit = (state->formatter_packet[15] >> (i / 2)) & 1;
+			if (ch & 1) {
+				ch >>= 1;
+				if (state->sourceid != ch) {
+					r = emit(state, ETM_REC_SOURCE_ID);
+					r->value = ch;
+					r->aux = ebit;
+					state->sourceid = ch;
+					if (!ebit)
+						sourceid = ch;
+				}
+				continue;
+			}
+			ch = ch | ebit;
+		}
+		if ((1 << sourceid) & state->sourceid_match)
+			return ch;
+		debug(state, "%02x ignored source %x\n", ch, sourceid);
+		sourceid = state->sourceid;
+	}
+}
+
+static int get_byte(struct etm_state *state)
+{
+	int i;
+	int ch;
+
+	if (state->eof)
+		return 0;
+	if (state->formatter)
+		ch = get_byte_from_formatter(state);
+	else
+		ch = next_input(state);
+	if (ch < 0) {
+		emit(state, ETM_REC_END)->value = state->wait_count;
+		state->eof = true;
+		state->data = 0;
+		return 0;
+	}
+	state->data = ch;
+	if (!ch && state->sync <= 0) {
+		if (state->sync == -4)
+			state->sync = 1;
+		else
+			state->sync--;
+	}
+	if (state->print_input) {
+		debug(state, "%02x (", ch);
+		for (i = 0; i < 8; i++)
+			debug(state, "%d", (ch >> (7 - i)) & 1);
+		debug(state, ")\n");
+	}
+	return ch;
+}
+
+static uint32_t next_pc(struct etm_state *state)
+{
+	uint32_t ret = state->pc;
+	if (state->program_flow_only)
+		state->branch_count++;
+	else
+		state->pc += 1 << state->mode;
+	return ret;
+}
+
+static void print_instruction(struct etm_state *state, bool execute)
+{
+	int waited = state->wait_count;
+	uint32_t pc = next_pc(state);
+	struct etm_record *r;
+
+	if (waited)
+		state->wait_count = 0;
+	r = emit(state, ETM_REC_INSTR);
+	if (state->spec && state->spec->wait_rec == ETM_SPEC_NONE && !state->eof)
+		state->spec->wait_rec = state->rec_total - 1;
+	if (waited > state->long_wait)
+		r->flags |= ETM_REC_F_LONG_WAIT;
+	if (execute)
+		r->flags |= ETM_REC_F_EXECUTED;
+	if (state->program_flow_only) {
+		r->flags |= ETM_REC_F_PFT;
+		r->value2 = state->branch_count;
+	}
+	r->addr = pc;
+	r->value = waited;
+}
+
+static int get_branch_addr(struct etm_state *state)
+{
+	int addr = state->iaddr >> state->mode;
+	int count = 1;
+	uint32_t valid_mask = 0x3f;
+	uint8_t mask;
+	int ret;
+
+	addr = (addr & ~0x3f) | ((state->data >> 1) & 0x3f);
+	debug(state, "  v %x a %x\n", valid_mask << state->mode, addr << state->mode);
+	while (state->data & 0x80 && count < 5) {
+		get_byte(state);
+		if (state->alt_branch && !(state->data & 0x80))
+			mask = 0x3f;
+		else
+			mask = 0x7f;
+		addr = (addr & ~(mask << (7 * count - 1))) | ((state->data & mask) << (7 * count - 1));
+		valid_mask ^= mask << (7 * count - 1);
+		count++;
+		debug(state, "  v %x a %x\n", valid_mask << state->mode, addr << state->mode);
+	}
+	ret = (count == 5 || (state->alt_branch && count > 1)) && state->data & 0x40;
+	if (!ret && state->program_flow_only) {
+		// PFT Branch without exception implies an E atom
+		print_instruction(state, true);
+	}
+	if (count == 5) {
+		if (!(state->data & 0xb0))
+			state->mode = 2;
+		else if (!(state->data  & 0xa0))
+			state->mode = 1;
+		else
+			state->mode = 0;
+	}
+	addr <<= state->mode;
+	valid_mask <<= state->mode | ((1 << state->mode) - 1);
+	if (state->iaddr_valid < valid_mask)
+		state->iaddr_valid = valid_mask;
+	state->iaddr = addr;
+	state->pc = addr;
+	state->branch_count = 0;
+	return ret;
+}
+
+static int branch(struct etm_state *state)
+{
+	uint32_t exception_data = 0;
+	struct etm_record *r;
+	int ret;
+
+	ret = get_branch_addr(state);
+	if (ret) {
+		exception_data = get_byte(state);
+		if (exception_data & 0x80)
+			exception_data |= get_byte(state);
+	}
+
+	r = emit(state, ETM_REC_BRANCH);
+	r->addr = state->iaddr;
+	if (ret) {
+		r->flags |= ETM_REC_F_EXCEPTION;
+		r->value = exception_data;
+	}
+	return 0;
+}
+
+static int timestamp(struct etm_state *state)
+{
+	uint64_t timestamp = state->timestamp;
+	uint64_t delta;
+	uint64_t known = 0;
+	uint8_t mask = 0x7f;
+	int r = !!(state->data & 4);
+	struct etm_record *rec;
+	int i;
+
+	for (i = 0; i < 9; i++) {
+		get_byte(state);
+		if (i == 8)
+			mask = 0xff;
+		timestamp = (timestamp & ~((uint64_t)mask << (7 * i))) | ((uint64_t)(state->data & mask) << (7 * i));
+		known |= (uint64_t)mask << (7 * i);
+		if (!(state->data & 0x80))
+			break;
+	}
+	// TODO: Convert from gray-code to binary if ETMCCER[28] is not set
+	delta = timestamp - state->timestamp;
+	rec = emit(state, ETM_REC_TIMESTAMP);
+	rec->timestamp = timestamp;
+	rec->value = (uint32_t)delta;
+	rec->value2 = (uint32_t)(delta >> 32);
+	rec->aux = r;
+	spec_timestamp(state, known);
+	state->timestamp = timestamp;
+	return 0;
+}
+
+static int async(struct etm_state *state)
+{
+	return 0;
+}
+
+static int ignore(struct etm_state *state)
+{
+	return 0;
+}
+
+static void cycle_count(struct etm_state *state, uint32_t count)
+{
+	struct etm_record *r = emit(state, ETM_REC_CYCLE_COUNT);
+
+	if (count > state->long_wait)
+		r->flags |= ETM_REC_F_LONG_WAIT;
+	r->value = count;
+}
+
+static int ccount(struct etm_state *state)
+{
+	uint32_t count = 0;
+	int i;
+	for (i = 0; i < 5; i++) {
+		get_byte(state);
+		count |= (state->data & 0x7f) << (7 * i);
+		if (!(state->data & 0x80))
+			break;
+	}
+	cycle_count(state, count);
+	return 0;
+}
+
+static uint32_t get_contextid(struct etm_state *state)
+{
+	int i;
+	uint32_t contextid = 0;
+	for (i = 0; i < state->contextid_bytes; i++) {
+		get_byte(state);
+		contextid |= state->data << (8 * i);
+	}
+	return contextid;
+}
+
+static uint32_t get_addr(struct etm_state *state)
+{
+	int i;
+	uint32_t addr = 0;
+	for (i = 0; i < 4; i++) {
+		get_byte(state);
+		addr |= state->data << (8 * i);
+	}
+	return addr;
+}
+
+static void update_addr(struct etm_state *state, uint8_t ib, uint32_t addr)
+{
+	if (ib & 0x10) {
+		state->mode = 0;
+	} else if (addr & 1) {
+		state->mode = 1;
+		addr &= ~1;
+	} else {
+		state->mode = 2;
+	}
+	state->iaddr = addr;
+	state->iaddr_valid = 0xffffffff;
+	state->pc = addr;
+	state->branch_count = 0;
+	if (state->spec && state->spec->isync_rec == ETM_SPEC_NONE && !state->eof)
+		state->spec->isync_rec = state->rec_total;
+}
+
+static void isync_record(struct etm_state *state, uint32_t contextid, uint8_t ib)
+{
+	struct etm_record *r;
+
+	if (!state->eof) {
+		state->contextid = contextid;
+		if (state->spec && state->spec->context_rec == ETM_SPEC_NONE)
+			state->spec->context_rec = state->rec_total;
+	}
+	r = emit(state, ETM_REC_ISYNC);
+	r->value = contextid;
+	r->aux = ib;
+	r->addr = state->iaddr;
+}
+
+static int isync(struct etm_state *state)
+{
+	uint32_t contextid;
+	uint32_t addr;
+	uint8_t ib;
+
+	contextid = get_contextid(state);
+	ib = get_byte(state);
+	addr = get_addr(state);
+	update_addr(state, ib, addr);
+	isync_record(state, contextid, ib);
+	return 0;
+}
+
+static int isynccc(struct etm_state *state)
+{
+	ccount(state);
+	return isync(state);
+}
+
+static int contextid(struct etm_state *state)
+{
+	uint32_t contextid;
+
+	contextid = get_contextid(state);
+	if (!state->eof) {
+		state->contextid = contextid;
+		if (state->spec && state->spec->context_rec == ETM_SPEC_NONE)
+			state->spec->context_rec = state->rec_total;
+	}
+	emit(state, ETM_REC_CONTEXTID)->value = contextid;
+	return 0;
+}
+
+static int vmid(struct etm_state *state)
+{
+	uint8_t vmid;
+
+	vmid = get_byte(state);
+	emit(state, ETM_REC_VMID)->value = vmid;
+	return 0;
+}
+
+static int ndata(struct etm_state *state)
+{
+	uint8_t h = state->data;
+	int size = (h >> 2) & 3;
+	int i;
+	uint32_t data = 0;
+	uint32_t known = 0;
+	struct etm_record *r;
+
+	if (h & 0x20) {
+		for (i = 0; i < 5; i++) {
+			get_byte(state);
+			state->daddr = (state->daddr & ~(0x7f << (7 * i))) | (state->data & 0x7f) << (7 * i);
+			known |= 0x7fU << (7 * i);
+			if (!(state->data & 0x80))
+				break;
+		}
+	}
+	for (i = 0; i < size; i++) {
+		get_byte(state);
+		data |= state->data << (i * 8);
+	}
+	r = emit(state, ETM_REC_DATA);
+	r->aux = size;
+	r->value = data;
+	if (h & 0x20) {
+		r->flags |= ETM_REC_F_DATA_ADDR;
+		r->addr = state->daddr;
+		spec_daddr(state, known);
+	}
+	return 0;
+}
+
+static void bad_pheader(struct etm_state *state)
+{
+	state->sync = 0;
+	emit(state, ETM_REC_BAD_PHEADER);
+}
+
+static int pheader_cycle_accurate(struct etm_state *state)
+{
+	int i;
+	if (state->data == 0x80) {
+		state->wait_count++;
+	} else if ((state->data & 0xa3) == 0x80) {
+		i = (state->data >> 2) & 0x7;
+		while (i--) {
+			state->wait_count++;
+			print_instruction(state, true);
+		}
+		i = (state->data >> 6) & 0x1;
+		while (i--) {
+			state->wait_count++;
+			print_instruction(state, false);
+		}
+	} else if ((state->data & 0xf3) == 0x82) {
+		state->wait_count++;
+		print_instruction(state, !(state->data & 0x08));
+		print_instruction(state, !(state->data & 0x04));
+	} else if ((state->data & 0xa3) == 0xa0) {
+		i = ((state->data >> 2) & 0x7) + 1;
+		state->wait_count += i;
+		i = (state->data >> 6) & 0x1;
+		while (i--)
+			print_instruction(state, true);
+	} else if ((state->data & 0xfb) == 0x92) {
+		print_instruction(state, !(state->data & 0x04));
+	} else {
+		bad_pheader(state);
+	}
+	return 0;
+}
+
+static int pheader_non_cycle_accurate(struct etm_state *state)
+{
+	int i;
+	if ((state->data & 0x83) == 0x80) {
+		i = (state->data >> 2) & 0x0f;
+		while (i--)
+			print_instruction(state, true);
+		if (state->data & 0x40)
+			print_instruction(state, false);
+	} else if ((state->data & 0xf3) == 0x82) {
+		print_instruction(state, !(state->data & 0x08));
+		print_instruction(state, !(state->data & 0x04));
+	} else {
+		bad_pheader(state);
+	}
+	return 0;
+}
+
+static int pheader(struct etm_state *state)
+{
+	if (state->cycle_accurate)
+		return pheader_cycle_accurate(state);
+	else
+		return pheader_non_cycle_accurate(state);
+}
+
+static int cycle_count_pft(struct etm_state *state)
+{
+	int i;
+	uint8_t h = state->data;
+	uint32_t count = (h >> 2) & 0xf;
+	int shift = 4;
+	if (h & 0x40) {
+		for (i = 0; i < 4; i++) {
+			get_byte(state);
+			count |= (state->data & 0x7f) << shift;
+			shift += 7;
+			if (!(state->data & 0x80))
+				break;
+		}
+	}
+	cycle_count(state, count);
+	return 0;
+}
+
+static int isync_pft(struct etm_state *state)
+{
+	uint32_t contextid;
+	uint32_t addr;
+	uint8_t ib;
+
+	addr = get_addr(state);
+	ib = get_byte(state);
+	update_addr(state, ib, addr);
+
+	if (state->cycle_accurate && (ib & 0x60)) {
+		get_byte(state);
+		cycle_count_pft(state);
+	}
+
+	contextid = get_contextid(state);
+	isync_record(state, contextid, ib);
+	return 0;
+}
+
+static int waypoint(struct etm_state *state)
+{
+	struct etm_record *r;
+	uint8_t ib = 0;
+	int ret;
+
+	get_byte(state);
+	ret = get_branch_addr(state);
+	if (ret)
+		ib = get_byte(state);
+
+	r = emit(state, ETM_REC_WAYPOINT);
+	r->addr = state->iaddr;
+	if (ret) {
+		r->flags |= ETM_REC_F_EXCEPTION;
+		r->aux = ib;
+	}
+	return 0;
+}
+
+static int branch_pft(struct etm_state *state)
+{
+	int ret;
+	ret = branch(state);
+	if (!ret && state->cycle_accurate) {
+		get_byte(state);
+		ret = cycle_count_pft(state);
+	}
+	return ret;
+}
+
+static int timestamp_pft(struct etm_state *state)
+{
+	int ret;
+	ret = timestamp(state);
+	if (!ret && state->cycle_accurate) {
+		get_byte(state);
+		ret = cycle_count_pft(state);
+	}
+	return ret;
+}
+
+static int atom_cycle_accurate(struct etm_state *state)
+{
+	uint8_t h = state->data;
+	cycle_count_pft(state);
+	print_instruction(state, !(h & 0x02));
+	return 0;
+}
+
+static int atom_non_cycle_accurate(struct etm_state *state)
+{
+	int i;
+	uint8_t d = state->data << 1;
+	for (i = 5; i > 0; i--, d <<= 1)
+		if (d & 0x80)
+			break;
+	while (i--) {
+		d <<= 1;
+		print_instruction(state, !(d & 0x80));
+	}
+	return 0;
+}
+
+static int atom(struct etm_state *state)
+{
+	if (state->cycle_accurate)
+		return atom_cycle_accurate(state);
+	else
+		return atom_non_cycle_accurate(state);
+}
+
+static int trigger(struct etm_state *state)
+{
+	emit(state, ETM_REC_TRIGGER);
+	return 0;
+}
+
+static int except_ret(struct etm_state *state)
+{
+	emit(state, ETM_REC_EXCEPTION_RETURN);
+	return 0;
+}
+
+static const struct packet_type packet_types_etm_3_3[] = {
+	{ 0x01, 0x01, 0x00, branch,	"Branch address"		},
+	{ 0xff, 0x00, 0x00, async,	"A-sync"			},
+	{ 0xff, 0x04, 0x00, ccount,	"Cycle count"			},
+	{ 0xff, 0x08, 0x00, isync,	"I-sync"			},
+	{ 0xff, 0x0c, 0x00, NULL,	"Trigger"			},
+	{ 0x93, 0x00, 0x60, NULL,	"Out-of-order data"		},
+	{ 0xff, 0x50, 0x00, NULL,	"Store failed"			},
+	{ 0xff, 0x70, 0x00, isynccc,	"I-sync with cycle count"	},
+	{ 0xd3, 0x50, 0x0c, NULL,	"Out-of-order placeholder"	},
+	{ 0xd3, 0x12, 0x00, NULL,	"Reserved"			},
+	{ 0xf3, 0x10, 0x00, NULL,	"Reserved"			},
+	{ 0xfb, 0x30, 0x00, NULL,	"Reserved"			},
+	{ 0xff, 0x3c, 0x00, vmid,	"VMID"				},
+	{ 0xff, 0x38, 0x00, NULL,	"Reserved"			},
+	{ 0xd3, 0x02, 0x00, ndata,	"Normal data"			},
+	{ 0xf3, 0x52, 0x00, NULL,	"Reserved"			},
+	{ 0xfb, 0x42, 0x00, timestamp,	"Timestamp"			},
+	{ 0xfb, 0x4a, 0x00, NULL,	"Reserved"			},
+	{ 0xff, 0x62, 0x00, NULL,	"Data suppressed"		},
+	{ 0xff, 0x66, 0x00, ignore,	"Ignore"			},
+	{ 0xef, 0x6a, 0x00, NULL,	"Value not traced"		},
+	{ 0xff, 0x6e, 0x00, contextid,	"Context ID"			},
+	{ 0xff, 0x76, 0x00, NULL,	"Exception exit"		},
+	{ 0xff, 0x7e, 0x00, NULL,	"Exception entry"		},
+	{ 0xff, 0x72, 0x00, NULL,	"Reserved"			},
+	{ 0x81, 0x80, 0x00, pheader,	"P-header"			},
+
+	{ 0x00, 0x00, 0x00, NULL,	"Unknown"			},
+};
+
+static const struct packet_type packet_types_pft[] = {
+	{ 0xff, 0x00, 0x00, async,	"A-sync"			},
+	{ 0xff, 0x08, 0x00, isync_pft,	"I-sync"			},
+	{ 0x81, 0x80, 0x00, atom,	"Atom"				},
+	{ 0x01, 0x01, 0x00, branch_pft,	"Branch address"		},
+	{ 0xff, 0x72, 0x00, waypoint,	"Waypoint update"		},
+	{ 0xff, 0x0c, 0x00, trigger,	"Trigger"			},
+	{ 0xff, 0x6e, 0x00, contextid,	"Context ID"			},
+	{ 0xff, 0x3c, 0x00, vmid,	"VMID"				},
+	{ 0xfb, 0x42, 0x00, timestamp_pft, "Timestamp"			},
+	{ 0xff, 0x76, 0x00, except_ret,	"Exception return"		},
+	{ 0xff, 0x66, 0x00, ignore,	"Ignore"			},
+
+	{ 0xff, 0x04, 0x00, NULL,	"Reserved"			},
+	{ 0x93, 0x00, 0x60, NULL,	"Reserved"			},
+	{ 0xff, 0x50, 0x00, NULL,	"Reserved"			},
+	{ 0xff, 0x70, 0x00, NULL,	"Reserved"			},
+	{ 0xd3, 0x50, 0x0c, NULL,	"Reserved"			},
+	{ 0xd3, 0x12, 0x00, NULL,	"Reserved"			},
+	{ 0xf3, 0x10, 0x00, NULL,	"Reserved"			},
+	{ 0xfb, 0x30, 0x00, NULL,	"Reserved"			},
+	{ 0xff, 0x38, 0x00, NULL,	"Reserved"			},
+	{ 0xd3, 0x02, 0x00, NULL,	"Reserved"			},
+	{ 0xf3, 0x52, 0x00, NULL,	"Reserved"			},
+	{ 0xfb, 0x4a, 0x00, NULL,	"Reserved"			},
+	{ 0xff, 0x62, 0x00, NULL,	"Reserved"			},
+	{ 0xef, 0x6a, 0x00, NULL,	"Reserved"			},
+	{ 0xff, 0x7e, 0x00, NULL,	"Reserved"			},
+
+	{ 0x00, 0x00, 0x00, NULL,	"Unknown"			},
+};
+
+static int is_match(const struct packet_type *type, int ch)
+{
+	return (ch & type->match_mask) == type->match_val &&
+		(!type->nonzero_mask || (type->nonzero_mask & ch));
+}
+
+void etm_init(struct etm_state *state)
+{
+	memset(state, 0, sizeof(*state));
+	state->contextid_bytes = 4;
+	state->cycle_accurate = 1;
+	state->long_wait = 1000000;
+	state->in_fd = -1;
+}
+
+/* the first matching entry decodes a header, the table ends in a catch-all */
+void etm_set_protocol(struct etm_state *state, enum etm_protocol protocol)
+{
+	const struct packet_type *type;
+	int ch;
+
+	switch (protocol) {
+	case ETM_PROTOCOL_ETM_3_3:
+		state->alt_branch = false;
+		state->packet_types = packet_types_etm_3_3;
+		break;
+	case ETM_PROTOCOL_ETM_3_4_ALT:
+		state->alt_branch = true;
+		state->packet_types = packet_types_etm_3_3;
+		break;
+	case ETM_PROTOCOL_PFT_1_1:
+		state->alt_branch = true;
+		state->program_flow_only = true;
+		state->packet_types = packet_types_pft;
+		break;
+	}
+	for (ch = 0; ch < 256; ch++) {
+		for (type = state->packet_types; !is_match(type, ch); type++)
+			;
+		state->dispatch[ch] = type;
+	}
+}
+
+void etm_check_packet_types(const struct etm_state *state)
+{
+	const struct packet_type *type;
+	int ch;
+	int mc;
+
+	for (ch = 0; ch < 256; ch++) {
+		mc = 0;
+		for (type = state->packet_types; type->match_mask; type++)
+			if (is_match(type, ch))
+				mc++;
+		if (mc == 1)
+			continue;
+		if (mc == 0)
+			printf("%02x not covered\n", ch);
+		else {
+			printf("%02x has multiple matches, %d\n", ch, mc);
+			for (type = state->packet_types; type->match_mask; type++)
+				if (is_match(type, ch))
+					printf("    %02x %02x %02x %s\n", type->match_mask,
+					type->match_val, type->nonzero_mask,
+					type->name);
+		}
+	}
+}
+
+void etm_set_input(struct etm_state *state, const uint8_t *buf, size_t len)
+{
+	state->in = buf;
+	state->in_end = buf + len;
+	state->in_fd = -1;
+	state->eof = false;
+}
+
+int etm_open_input(struct etm_state *state, int fd)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			etm_set_input(state, map, st.st_size);
+			state->in_map = map;
+			state->in_map_size = st.st_size;
+			return 0;
+		}
+	}
+
+	state->in_buf_size = ETM_READ_BLOCK;
+	state->in_buf = malloc(state->in_buf_size);
+	if (!state->in_buf)
+		return -1;
+	etm_set_input(state, state->in_buf, 0);
+	state->in_fd = fd;
+	return 0;
+}
+
+void etm_close_input(struct etm_state *state)
+{
+	if (state->in_map)
+		munmap(state->in_map, state->in_map_size);
+	free(state->in_buf);
+	state->in_map = NULL;
+	state->in_buf = NULL;
+	state->in_fd = -1;
+}
+
+int etm_set_sink(struct etm_state *state, etm_sink_t sink, void *ctx,
+		 size_t records)
+{
+	free(state->rec);
+	state->rec = malloc(records * sizeof(*state->rec));
+	if (!state->rec)
+		return -1;
+	state->rec_size = records;
+	state->rec_count = 0;
+	state->sink = sink;
+	state->sink_ctx = ctx;
+	return 0;
+}
+
+void etm_decode(struct etm_state *state)
+{
+	etm_decode_until(state, NULL);
+}
+
+const uint8_t *etm_decode_until(struct etm_state *state, const uint8_t *stop)
+{
+	const struct packet_type *type;
+	struct etm_record *r;
+	int ch;
+
+	while (!stop || state->in < stop) {
+		ch = get_byte(state);
+		if (state->eof)
+			break;
+		type = state->dispatch[ch];
+		debug(state, "  %s\n", type->name);
+		if (type->decode) {
+			type->decode(state);
+		} else {
+			state->sync = 0;
+			r = emit(state, ETM_REC_NOT_HANDLED);
+			r->aux = ch;
+			r->value = type - state->packet_types;
+		}
+	}
+	etm_flush(state);
+	return state->in;
+}
+
+/* the text formatter, hand rolled for the packets that make up a trace */
+
+static char *put_str(char *p, const char *s)
+{
+	while (*s)
+		*p++ = *s++;
+	return p;
+}
+
+static char *put_hex(char *p, uint32_t v, int digits)
+{
+	static const char hex[] = "0123456789abcdef";
+	int i;
+
+	for (i = digits - 1; i >= 0; i--)
+		p[i] = hex[v & 0xf], v >>= 4;
+	return p + digits;
+}
+
+static char *put_int(char *p, int v)
+{
+	char tmp[12];
+	unsigned int u = v;
+	int n = 0;
+
+	if (v < 0) {
+		*p++ = '-';
+		u = -u;
+	}
+	do {
+		tmp[n++] = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	while (n)
+		*p++ = tmp[--n];
+	return p;
+}
+
+static char *put_valid(char *p, const struct etm_record *rec, const char *fmt)
+{
+	if (rec->valid == 0xffffffff)
+		return p;
+	p = put_str(p, fmt);
+	p = put_hex(p, rec->valid, 8);
+	return rec->type == ETM_REC_INSTR ? p : put_str(p, ")");
+}
+
+size_t etm_format_text(char *buf, const struct etm_record *rec,
+		       const struct packet_type *packet_types)
+{
+	char sync = rec->flags & ETM_REC_F_SYNC ? ' ' : '?';
+	uint64_t delta;
+	char *p = buf;
+
+	switch (rec->type) {
+	case ETM_REC_INSTR:
+		if (rec->flags & ETM_REC_F_LONG_WAIT)
+			p = put_str(p, "  ==== Long wait ====\n");
+		*p++ = sync;
+		*p++ = ' ';
+		*p++ = rec->flags & ETM_REC_F_EXECUTED ? 'E' : 'N';
+		*p++ = '(';
+		p = put_hex(p, rec->addr, 8);
+		*p++ = ')';
+		if (rec->flags & ETM_REC_F_PFT) {
+			p = put_str(p, " +");
+			p = put_int(p, rec->value2);
+			p = put_str(p, " branch points");
+		}
+		p = put_valid(p, rec, " valid ");
+		if (rec->value) {
+			p = put_str(p, " Waited ");
+			p = put_int(p, rec->value);
+		}
+		*p++ = '\n';
+		break;
+	case ETM_REC_BRANCH:
+	case ETM_REC_WAYPOINT:
+		*p++ = sync;
+		if (rec->type == ETM_REC_BRANCH) {
+			p = put_str(p, "   Branch ");
+			p = put_hex(p, rec->addr, 8);
+			if (rec->flags & ETM_REC_F_EXCEPTION) {
+				p = put_str(p, " Exception data ");
+				p = put_hex(p, rec->value, 4);
+			}
+		} else {
+			p = put_str(p, "   Waypoint ");
+			p = put_hex(p, rec->addr, 8);
+			if (rec->flags & ETM_REC_F_EXCEPTION) {
+				p = put_str(p, " ib ");
+				p = put_hex(p, rec->aux, 2);
+			}
+		}
+		p = put_valid(p, rec, " (valid ");
+		*p++ = ' ';
+		p = put_str(p, mode_name[rec->mode]);
+		*p++ = '\n';
+		break;
+	case ETM_REC_CYCLE_COUNT:
+		if (rec->flags & ETM_REC_F_LONG_WAIT)
+			p = put_str(p, "    ==== Long wait ====\n");
+		*p++ = sync;
+		p = put_str(p, "   Cycle count ");
+		p = put_int(p, rec->value);
+		*p++ = '\n';
+		break;
+	case ETM_REC_TIMESTAMP:
+		delta = rec->value | (uint64_t)rec->value2 << 32;
+		p += sprintf(p, "%c   Timestamp %"PRIu64" (%+"PRIi64"), R %d\n",
+			     sync, rec->timestamp, (int64_t)delta, rec->aux);
+		break;
+	case ETM_REC_ISYNC:
+		p += sprintf(p, "%c I-sync Context %08x, IB %02x, Addr %08x\n",
+			     sync, rec->value, rec->aux, rec->addr);
+		break;
+	case ETM_REC_CONTEXTID:
+		p += sprintf(p, "%c ContextID %08x\n", sync, rec->value);
+		break;
+	case ETM_REC_VMID:
+		p += sprintf(p, "%c VMID %08x\n", sync, rec->value);
+		break;
+	case ETM_REC_DATA:
+		p += sprintf(p, "%c   Normal data", sync);
+		if (rec->aux)
+			p += sprintf(p, " %08x", rec->value);
+		if (rec->flags & ETM_REC_F_DATA_ADDR)
+			p += sprintf(p, " addr %08x", rec->addr);
+		*p++ = '\n';
+		break;
+	case ETM_REC_TRIGGER:
+		p += sprintf(p, "%c   Trigger\n", sync);
+		break;
+	case ETM_REC_EXCEPTION_RETURN:
+		p += sprintf(p, "%c   Exception return\n", sync);
+		break;
+	case ETM_REC_BAD_PHEADER:
+		p = put_str(p, "  ?\n");
+		break;
+	case ETM_REC_NOT_HANDLED:
+		p += sprintf(p, "  %02x: not handled (%s)\n", rec->aux,
+			     packet_types[rec->value].name);
+		break;
+	case ETM_REC_SOURCE_ID:
+		p += sprintf(p, "New ID %x %d\n", rec->value, rec->aux);
+		break;
+	case ETM_REC_END:
+		if (rec->value)
+			p += sprintf(p, " Waited %d", (int)rec->value);
+		break;
+	}
+	return p - buf;
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ETM_DECODE_H
+#define ETM_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define false (0)
+#define true (1)
+typedef int bool;
+
+/*
+ * ETM v3.x / PFT v1.1 trace decoder.
+ *
+ * The decoder reads a whole buffer (usually an mmap of the trace dump)
+ * or large blocks from a file descriptor and turns the packets into
+ * fixed size etm_record entries. Records are collected in a buffer and
+ * handed to a sink in batches; etm_format_text() renders one record the
+ * way etm always printed it.
+ */
+
+enum etm_record_type {
+	ETM_REC_INSTR,		/* E/N atom at addr */
+	ETM_REC_BRANCH,		/* branch to addr */
+	ETM_REC_WAYPOINT,	/* PFT waypoint update to addr */
+	ETM_REC_TIMESTAMP,
+	ETM_REC_CYCLE_COUNT,
+	ETM_REC_ISYNC,
+	ETM_REC_CONTEXTID,
+	ETM_REC_VMID,
+	ETM_REC_DATA,		/* ETM normal data */
+	ETM_REC_TRIGGER,
+	ETM_REC_EXCEPTION_RETURN,
+	ETM_REC_BAD_PHEADER,	/* P-header that does not decode */
+	ETM_REC_NOT_HANDLED,	/* packet without a decoder */
+	ETM_REC_SOURCE_ID,	/* formatter switched trace source */
+	ETM_REC_END,		/* end of the trace */
+};
+
+/* etm_record.flags */
+#define ETM_REC_F_SYNC		0x01	/* decoded after synchronisation */
+#define ETM_REC_F_EXECUTED	0x02	/* INSTR: E atom, N otherwise */
+#define ETM_REC_F_LONG_WAIT	0x04	/* INSTR, CYCLE_COUNT: over --print-long-waits */
+#define ETM_REC_F_EXCEPTION	0x08	/* BRANCH: exception data, WAYPOINT: IB */
+#define ETM_REC_F_DATA_ADDR	0x10	/* DATA: addr is valid */
+#define ETM_REC_F_PFT		0x20	/* INSTR: value2 counts branch points */
+
+struct etm_record {
+	uint8_t type;
+	uint8_t flags;
+	uint8_t mode;		/* 2 ARM, 1 Thumb, 0 Jazelle */
+	uint8_t aux;		/* IB, data size, timestamp R bit, header, E bit */
+	uint32_t addr;		/* PC, branch target, I-sync or data address */
+	uint32_t valid;		/* known bits of addr, 0xffffffff after I-sync */
+	uint32_t value;		/* waits, exception data, cycles, context ID, VMID,
+				 * data, source ID, packet index or low half of the
+				 * timestamp delta */
+	uint32_t value2;	/* branch points, high half of the timestamp delta */
+	uint32_t context;	/* current context ID */
+	uint64_t timestamp;	/* current timestamp */
+};
+
+struct etm_state;
+struct etm_symbols;
+
+/*
+ * Receives decoded records in trace order. A call with count 0 asks the
+ * sink to flush whatever output it buffers.
+ */
+typedef void (*etm_sink_t)(void *ctx, const struct etm_record *rec, size_t count);
+
+struct packet_type {
+	uint8_t match_mask;
+	uint8_t match_val;
+	uint8_t nonzero_mask;
+	int (*decode)(struct etm_state *state);
+	const char *name;
+};
+
+enum etm_protocol {
+	ETM_PROTOCOL_ETM_3_3,
+	ETM_PROTOCOL_ETM_3_4_ALT,
+	ETM_PROTOCOL_PFT_1_1,
+};
+
+/*
+ * A decoder started at a sync point (see etm_parallel.c) does not know
+ * the timestamp, data address, context ID, wait count, address valid
+ * mask or mode the serial decoder would have at that point. It decodes
+ * with them zeroed and notes which records depend on them, so that they
+ * can be patched once the state left by the previous chunk is known.
+ */
+#define ETM_SPEC_NONE ((size_t)-1)
+
+struct etm_mask_change {
+	size_t rec;		/* index of the record that changed the mask */
+	uint64_t mask;		/* known bits from that record on */
+};
+
+struct etm_spec {
+	uint64_t ts_known;
+	uint32_t daddr_known;
+	size_t isync_rec;	/* records before this one have the old valid/mode */
+	size_t context_rec;	/* records before this one have the old context ID */
+	size_t wait_rec;	/* first INSTR, it includes the old wait count */
+	struct etm_mask_change *ts;
+	size_t ts_count;
+	size_t ts_size;
+	struct etm_mask_change *daddr;
+	size_t daddr_count;
+	size_t daddr_size;
+	bool failed;		/* out of memory for the mask changes */
+};
+
+struct etm_state {
+	uint8_t data;
+	uint32_t iaddr;
+	uint32_t iaddr_valid;
+	uint64_t timestamp;
+	int wait_count;
+	unsigned int long_wait;
+	uint32_t pc; // best guess
+	int branch_count;
+	int mode; // 2 ARM, 1 Thumb, 0 Jazelle
+	int sync;
+	uint8_t formatter_packet[16];
+	int formatter_index;
+	int sourceid;
+	uint32_t contextid;
+	uint32_t daddr;
+
+	int contextid_bytes;
+	int sourceid_match;
+	bool cycle_accurate;
+	bool alt_branch;
+	bool program_flow_only;
+	bool print_input;
+	bool formatter;
+
+	const struct packet_type *packet_types;
+	const struct packet_type *dispatch[256];
+
+	/* input */
+	const uint8_t *in;
+	const uint8_t *in_end;
+	int in_fd;
+	uint8_t *in_buf;
+	size_t in_buf_size;
+	void *in_map;
+	size_t in_map_size;
+	bool eof;
+
+	/* output */
+	struct etm_record *rec;
+	size_t rec_count;
+	size_t rec_size;
+	size_t rec_total;		/* records emitted so far */
+	struct etm_spec *spec;		/* only when decoding from a sync point */
+	const struct etm_symbols *symbols;	/* annotate the text, see etm_symbols.h */
+	etm_sink_t sink;
+	void *sink_ctx;
+	struct etm_record discard;	/* target of records past the end */
+};
+
+void etm_init(struct etm_state *state);
+void etm_set_protocol(struct etm_state *state, enum etm_protocol protocol);
+
+/* decode from memory, or from fd (mapped when it is a regular file) */
+void etm_set_input(struct etm_state *state, const uint8_t *buf, size_t len);
+int etm_open_input(struct etm_state *state, int fd);
+void etm_close_input(struct etm_state *state);
+
+int etm_set_sink(struct etm_state *state, etm_sink_t sink, void *ctx,
+		 size_t records);
+void etm_flush(struct etm_state *state);
+
+/* print header bytes that match no packet type or more than one */
+void etm_check_packet_types(const struct etm_state *state);
+
+/* decode to the end of the input; records end with an ETM_REC_END */
+void etm_decode(struct etm_state *state);
+
+/*
+ * Decode the packets that start before stop and return where the last
+ * one ended. Records end with an ETM_REC_END only if the input did.
+ */
+const uint8_t *etm_decode_until(struct etm_state *state, const uint8_t *stop);
+
+/* start a speculative decode, spec must be zeroed */
+void etm_spec_start(struct etm_state *state, struct etm_spec *spec);
+void etm_spec_free(struct etm_spec *spec);
+
+/* threaded decode of a whole buffer, see etm_parallel.c */
+int etm_decode_parallel(const struct etm_state *config, const uint8_t *buf,
+			size_t len, int threads, bool binary);
+
+/*
+ * Append the text of one record to buf, which must have room for
+ * ETM_TEXT_MAX bytes, and return the length.
+ */
+#define ETM_TEXT_MAX 256
+size_t etm_format_text(char *buf, const struct etm_record *rec,
+		       const struct packet_type *packet_types);
+
+#endif
@@ -0,0 +1,440 @@
+/*
+ * Copyright 2026 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Writes a synthetic ETM v3.3 or PFT v1.1 trace to stdout, to check the
+ * threaded decoder against the serial one without a board:
+ *
+ *   etm_gen --pft-1.1 --size=64M > t.bin
+ *   etm --pft-1.1 -i t.bin > serial.txt
+ *   etm --pft-1.1 -i t.bin --threads=4 > threaded.txt
+ *   cmp serial.txt threaded.txt
+ *
+ * The packets follow the encodings etm decodes, with an A-sync and an
+ * I-sync every --sync-interval bytes. --false-sync adds I-syncs whose
+ * payload contains the A-sync pattern, --noise adds random bytes that
+ * make the decoder lose sync until the next A-sync.
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define false (0)
+#define true (1)
+typedef int bool;
+
+struct gen {
+	bool pft;
+	bool alt_branch;
+	bool cycle_accurate;
+	int contextid_bytes;
+	uint64_t timestamp;
+	uint32_t contextid;
+	uint32_t seed;
+
+	uint8_t buf[1 << 16];
+	size_t len;
+};
+
+static uint32_t rnd(struct gen *g)
+{
+	g->seed = g->seed * 1103515245 + 12345;
+	return g->seed >> 8;
+}
+
+static bool chance(struct gen *g, int permille)
+{
+	return (int)(rnd(g) % 1000) < permille;
+}
+
+static void put(struct gen *g, uint8_t ch)
+{
+	g->buf[g->len++] = ch;
+}
+
+/* 7 bits per byte, bit 7 set while more follow */
+static void put_continued(struct gen *g, uint32_t v, int max)
+{
+	int i;
+
+	for (i = 1; i < max && v >> 7; i++, v >>= 7)
+		put(g, 0x80 | (v & 0x7f));
+	put(g, v & 0x7f);
+}
+
+static void put_cycle_count_pft(struct gen *g)
+{
+	uint32_t count = rnd(g) % 4096;
+
+	if (count < 16) {
+		put(g, 0x80 | count << 2);
+		return;
+	}
+	put(g, 0xc0 | (count & 0xf) << 2);
+	put_continued(g, count >> 4, 4);
+}
+
+static void put_contextid(struct gen *g)
+{
+	int i;
+
+	for (i = 0; i < g->contextid_bytes; i++)
+		put(g, g->contextid >> (8 * i));
+}
+
+static void put_addr(struct gen *g, uint32_t addr)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		put(g, addr >> (8 * i));
+}
+
+static void async(struct gen *g)
+{
+	int i;
+
+	for (i = 0; i < 5; i++)
+		put(g, 0);
+	put(g, 0x80);
+}
+
+static void isync(struct gen *g, uint32_t addr, uint8_t ib)
+{
+	if (chance(g, 100))
+		g->contextid = rnd(g);
+	if (g->pft) {
+		put(g, 0x08);
+		put_addr(g, addr);
+		put(g, ib);
+		if (g->cycle_accurate && (ib & 0x60))
+			put_cycle_count_pft(g);
+		put_contextid(g);
+		return;
+	}
+	if (g->cycle_accurate && chance(g, 500)) {
+		put(g, 0x70);
+		put_continued(g, rnd(g) % 100000, 5);
+	} else {
+		put(g, 0x08);
+	}
+	put_contextid(g);
+	put(g, ib);
+	put_addr(g, addr);
+}
+
+/*
+ * An I-sync whose context ID, IB and address bytes look like a sync
+ * point. Needs 4 (ETM) or at least 2 (PFT) context ID bytes.
+ */
+static void false_sync(struct gen *g)
+{
+	uint32_t contextid = g->contextid;
+
+	if (g->pft) {
+		if (g->contextid_bytes < 2)
+			return;
+		put(g, 0x08);
+		put_addr(g, 0);
+		put(g, 0x00);
+		g->contextid = 0x80 | 0x08 << 8;
+		put_contextid(g);
+	} else {
+		if (g->contextid_bytes != 4)
+			return;
+		g->contextid = 0;
+		put(g, 0x08);
+		put_contextid(g);
+		put(g, 0x00);
+		put_addr(g, 0x0880 | (rnd(g) & 0xffff0000));
+	}
+	g->contextid = contextid;
+}
+
+/* what the decoder reads after a branch address, see get_branch_addr() */
+static void branch_addr(struct gen *g, bool *exception)
+{
+	int count = 1 + rnd(g) % 5;
+	uint8_t ch;
+	int i;
+
+	ch = (rnd(g) & 0x7e) | 1;
+	if (count == 1) {
+		put(g, ch);
+		*exception = false;
+		return;
+	}
+	put(g, ch | 0x80);
+	for (i = 2; i < count; i++)
+		put(g, 0x80 | (rnd(g) & 0x7f));
+	if (count == 5) {
+		/* mode bits: ARM or Thumb, and maybe an exception */
+		ch = chance(g, 500) ? 0x10 : 0x00;
+		if (chance(g, 100))
+			ch |= 0x40;
+		put(g, ch | (rnd(g) & 0x07));
+		*exception = !!(ch & 0x40);
+		return;
+	}
+	ch = rnd(g) & 0x7f;
+	if (g->alt_branch && !chance(g, 100))
+		ch &= ~0x40;
+	put(g, ch);
+	*exception = g->alt_branch && (ch & 0x40);
+}
+
+static void branch(struct gen *g)
+{
+	bool exception;
+	uint8_t data;
+
+	branch_addr(g, &exception);
+	if (exception) {
+		data = rnd(g);
+		put(g, data);
+		if (data & 0x80)
+			put(g, rnd(g));
+	}
+	/* branch() returns 0, so etm reads a cycle count after any branch */
+	if (g->pft && g->cycle_accurate)
+		put_cycle_count_pft(g);
+}
+
+static void waypoint(struct gen *g)
+{
+	bool exception;
+
+	put(g, 0x72);
+	branch_addr(g, &exception);
+	if (exception)
+		put(g, rnd(g) & 0x7f);
+}
+
+/* the low bytes of a timestamp that counts up */
+static void timestamp(struct gen *g)
+{
+	uint64_t ts;
+	int bytes, i;
+
+	g->timestamp += rnd(g) % 100000;
+	ts = g->timestamp;
+	bytes = chance(g, 50) ? 9 : 1 + rnd(g) % 4;
+	put(g, chance(g, 100) ? 0x46 : 0x42);
+	for (i = 0; i < bytes - 1 && i < 8; i++, ts >>= 7)
+		put(g, 0x80 | (ts & 0x7f));
+	put(g, i == 8 ? ts & 0xff : ts & 0x7f);
+	if (g->pft && g->cycle_accurate)
+		put_cycle_count_pft(g);
+}
+
+static void atom(struct gen *g)
+{
+	uint8_t ch;
+
+	if (g->pft) {
+		ch = 0x80 | (rnd(g) & 0x3e);
+		if (g->cycle_accurate && chance(g, 200)) {
+			put(g, ch | 0x40);
+			put_continued(g, rnd(g) % 10000, 4);
+		} else {
+			put(g, ch);
+		}
+		return;
+	}
+	/* ETM P-headers */
+	do {
+		ch = 0x80 | (rnd(g) & 0x7e);
+	} while (g->cycle_accurate ?
+		 !(ch == 0x80 || (ch & 0xa3) == 0x80 || (ch & 0xf3) == 0x82 ||
+		   (ch & 0xa3) == 0xa0 || (ch & 0xfb) == 0x92) :
+		 !((ch & 0x83) == 0x80 || (ch & 0xf3) == 0x82));
+	put(g, ch);
+}
+
+static void ndata(struct gen *g)
+{
+	int size = rnd(g) % 4;
+	bool addr = chance(g, 500);
+	int i;
+
+	put(g, 0x02 | (addr ? 0x20 : 0) | size << 2);
+	if (addr)
+		put_continued(g, rnd(g) & 0xffffff, 1 + rnd(g) % 5);
+	for (i = 0; i < size; i++)
+		put(g, rnd(g));
+}
+
+static void packet(struct gen *g)
+{
+	uint32_t r = rnd(g) % 1000;
+
+	if (r < 600)
+		atom(g);
+	else if (r < 800)
+		branch(g);
+	else if (r < 850)
+		timestamp(g);
+	else if (r < 870) {
+		g->contextid = rnd(g);
+		put(g, 0x6e);
+		put_contextid(g);
+	} else if (r < 880) {
+		put(g, 0x3c);
+		put(g, rnd(g));
+	} else if (r < 890) {
+		put(g, 0x66);
+	} else if (!g->pft) {
+		if (r < 950)
+			ndata(g);
+		else if (g->cycle_accurate) {
+			put(g, 0x04);
+			put_continued(g, rnd(g) % 100000, 5);
+		}
+	} else if (r < 950) {
+		waypoint(g);
+	} else if (r < 960) {
+		put(g, 0x76);
+	} else if (r < 965) {
+		put(g, 0x0c);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct gen g = { .contextid_bytes = 4, .cycle_accurate = true, .seed = 1 };
+	uint64_t size = 16 << 20, written = 0, next_sync = 0;
+	int sync_interval = 4096;
+	int noise = 0, false_syncs = 0;
+	int protocol = -1;
+	int option_index, c;
+	char *end;
+
+	enum options {
+		OPT_ETM_3_3,
+		OPT_ETM_3_4_ALT,
+		OPT_PFT_1_1,
+		OPT_CYCLE_ACCURATE,
+		OPT_CONTEXTID_BYTES,
+		OPT_SIZE,
+		OPT_SYNC_INTERVAL,
+		OPT_FALSE_SYNC,
+		OPT_NOISE,
+		OPT_SEED,
+		OPT_PRINT_HELP,
+	};
+
+	struct option long_options[] = {
+		[OPT_ETM_3_3] = { "etm-3.3", 0, 0, 0 },
+		[OPT_ETM_3_4_ALT] = { "etm-3.4-alt-branch", 0, 0, 0 },
+		[OPT_PFT_1_1] = { "pft-1.1", 0, 0, 0 },
+		[OPT_CYCLE_ACCURATE] = { "cycle-accurate", 2, &g.cycle_accurate, true },
+		[OPT_CONTEXTID_BYTES] = { "contextid-bytes", 1, &g.contextid_bytes, 0 },
+		[OPT_SIZE] = { "size", 1, 0, 0 },
+		[OPT_SYNC_INTERVAL] = { "sync-interval", 1, &sync_interval, 0 },
+		[OPT_FALSE_SYNC] = { "false-sync", 1, &false_syncs, 0 },
+		[OPT_NOISE] = { "noise", 1, &noise, 0 },
+		[OPT_SEED] = { "seed", 1, (int *)&g.seed, 0 },
+		[OPT_PRINT_HELP] = { "help", 0, 0, 'h' },
+		{},
+	};
+	const char *help_txt[] = {
+		[OPT_ETM_3_3] = "ETM v3.3 trace data",
+		[OPT_ETM_3_4_ALT] = "ETM v3.4 trace data with alternative branch encoding",
+		[OPT_PFT_1_1] = "PFT v1.1 trace data\n",
+
+		[OPT_CYCLE_ACCURATE] = "Cycle-accurate tracing (Default 1)",
+		[OPT_CONTEXTID_BYTES] = "Number of Context ID bytes (Default 4)\n",
+
+		[OPT_SIZE] = "Bytes to write, K and M suffixes (Default 16M)",
+		[OPT_SYNC_INTERVAL] = "Bytes between A-syncs (Default 4096)",
+		[OPT_FALSE_SYNC] = "I-syncs per thousand that contain the A-sync pattern",
+		[OPT_NOISE] = "Random bytes per thousand packets",
+		[OPT_SEED] = "Random seed (Default 1)",
+		[OPT_PRINT_HELP] = "Print usage information",
+	};
+
+	while (1) {
+		c = getopt_long(argc, argv, "h", long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+			switch (option_index) {
+			case OPT_ETM_3_3:
+			case OPT_ETM_3_4_ALT:
+			case OPT_PFT_1_1:
+				protocol = option_index;
+				break;
+			case OPT_SIZE:
+				size = strtoull(optarg, &end, 0);
+				if (*end == 'K' || *end == 'k')
+					size <<= 10;
+				else if (*end == 'M' || *end == 'm')
+					size <<= 20;
+				break;
+			default: {
+				int *flag = long_options[option_index].flag;
+				if (optarg && flag)
+					*flag = atoi(optarg);
+				} break;
+			}
+			break;
+
+		case 'h':
+			printf("Usage: %s [options] > trace\n", argv[0]);
+			printf("Options:\n");
+			for (c = 0; long_options[c].name; c++)
+				printf("  --%-20s %s\n", long_options[c].name, help_txt[c]);
+			return 0;
+
+		default:
+			return 1;
+		}
+	}
+	if (protocol < 0) {
+		fprintf(stderr, "%s: Must specify etm/pft type\n", argv[0]);
+		return 1;
+	}
+	g.pft = protocol == OPT_PFT_1_1;
+	g.alt_branch = protocol != OPT_ETM_3_3;
+	if (g.contextid_bytes < 0 || g.contextid_bytes > 4 || sync_interval < 64) {
+		fprintf(stderr, "%s: bad --contextid-bytes or --sync-interval\n", argv[0]);
+		return 1;
+	}
+
+	while (written + g.len < size) {
+		if (written + g.len >= next_sync) {
+			async(&g);
+			isync(&g, rnd(&g) & ~1, chance(&g, 100) ? 0x20 : 0x00);
+			next_sync = written + g.len + sync_interval;
+		}
+		if (chance(&g, false_syncs))
+			false_sync(&g);
+		if (noise && chance(&g, noise))
+			put(&g, rnd(&g));
+		packet(&g);
+		if (g.len > sizeof(g.buf) / 2) {
+			written += g.len;
+			fwrite(g.buf, 1, g.len, stdout);
+			g.len = 0;
+		}
+	}
+	fwrite(g.buf, 1, g.len, stdout);
+	return 0;
+}
@@ -0,0 +1,447 @@
+/*
+ * Copyright 2026 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Threaded decoding of a trace buffer.
+ *
+ * The buffer is cut into chunks that start at an I-sync packet right
+ * after an A-sync (five zero bytes and 0x80). After the A-sync the
+ * decoder is in sync and the I-sync sets the address, mode and context,
+ * so a chunk can be decoded with a fresh state; what it cannot know
+ * (timestamp bits, data address bits, pending wait count and the old
+ * context for records before the I-sync) is tracked in an etm_spec and
+ * patched in afterwards.
+ *
+ * The byte pattern can also occur inside a packet. A chunk is therefore
+ * only used when the previous chunk, decoded up to it, ended its last
+ * packet exactly at the chunk start; otherwise the chunk is decoded
+ * again serially from where the previous one really ended. The output
+ * is the same as the serial decoder's, byte for byte.
+ *
+ * Worker threads decode chunks and, once the state entering a chunk is
+ * known, patch and format them. The main thread chains the chunk states
+ * in order and writes the output, keeping a bounded window of chunks in
+ * flight.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "etm_decode.h"
+#include "etm_symbols.h"
+
+#define CHUNK_SIZE	(1 << 20)	/* input bytes per chunk, roughly */
+#define CHUNK_WINDOW	4		/* chunks in flight per thread */
+
+enum chunk_status {
+	CHUNK_PENDING,
+	CHUNK_DECODING,
+	CHUNK_DECODED,
+	CHUNK_READY,		/* entering state known */
+	CHUNK_FORMATTING,
+	CHUNK_FORMATTED,
+	CHUNK_DONE,
+};
+
+/* the parts of the state a chunk decoded from a sync point assumed */
+struct entry_state {
+	uint64_t timestamp;
+	uint32_t daddr;
+	uint32_t contextid;
+	int wait_count;
+	uint32_t iaddr_valid;
+	int mode;
+};
+
+struct chunk {
+	const uint8_t *start;
+	const uint8_t *stop;
+	const uint8_t *end;		/* where the last packet ended */
+	struct etm_state state;		/* state after the chunk */
+	struct etm_spec spec;
+	bool speculative;
+	struct entry_state entry;
+
+	struct etm_record *rec;
+	size_t count;
+	size_t size;
+	bool nomem;
+
+	char *text;
+	size_t text_len;
+	size_t text_size;
+
+	enum chunk_status status;
+};
+
+struct parallel {
+	const struct etm_state *config;
+	const uint8_t *buf;
+	size_t len;
+	bool binary;
+
+	struct chunk *chunks;
+	size_t count;
+	size_t next_decode;
+	size_t written;			/* chunks before this one are out */
+	size_t window;
+	bool failed;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static void chunk_sink(void *ctx, const struct etm_record *rec, size_t count)
+{
+	struct chunk *c = ctx;
+	struct etm_record *r;
+	size_t size;
+
+	if (!count || c->nomem)
+		return;
+	if (c->count + count > c->size) {
+		size = c->size ? c->size : 4096;
+		while (size < c->count + count)
+			size *= 2;
+		r = realloc(c->rec, size * sizeof(*r));
+		if (!r) {
+			c->nomem = true;
+			return;
+		}
+		c->rec = r;
+		c->size = size;
+	}
+	memcpy(c->rec + c->count, rec, count * sizeof(*rec));
+	c->count += count;
+}
+
+/* chunks begin at an I-sync header that follows an A-sync */
+static const uint8_t *find_sync(const struct etm_state *config,
+				const uint8_t *p, const uint8_t *end)
+{
+	for (p = p < end ? p : end; p < end; p++) {
+		if (*p != 0x08 && (*p != 0x70 || config->program_flow_only))
+			continue;
+		if (p[-1] == 0x80 && !p[-2] && !p[-3] && !p[-4] && !p[-5] && !p[-6])
+			return p;
+	}
+	return NULL;
+}
+
+static int decode_chunk(struct parallel *par, struct chunk *c,
+			const struct etm_state *from)
+{
+	c->state = *from;
+	c->state.rec = NULL;
+	c->state.spec = NULL;
+	c->state.rec_total = 0;
+	c->count = 0;
+	if (etm_set_sink(&c->state, chunk_sink, c, 4096))
+		return -1;
+	etm_set_input(&c->state, c->start, par->buf + par->len - c->start);
+	if (c->speculative)
+		etm_spec_start(&c->state, &c->spec);
+	c->end = etm_decode_until(&c->state, c->stop);
+	free(c->state.rec);
+	c->state.rec = NULL;
+	c->state.spec = NULL;
+	return c->nomem || c->spec.failed ? -1 : 0;
+}
+
+static uint64_t mask_at(const struct etm_mask_change *changes, size_t count,
+			size_t *pos, size_t rec)
+{
+	while (*pos < count && changes[*pos].rec <= rec)
+		(*pos)++;
+	return *pos ? changes[*pos - 1].mask : 0;
+}
+
+/* fill in what the chunk could not know when it was decoded */
+static void patch_chunk(const struct parallel *par, struct chunk *c)
+{
+	const struct entry_state *in = &c->entry;
+	struct etm_spec *spec = &c->spec;
+	struct etm_record *r;
+	uint64_t ts_mask, ts_prev, spec_old, delta;
+	uint32_t daddr_mask;
+	size_t i, ts_pos = 0, daddr_pos = 0;
+
+	if (!c->speculative)
+		return;
+	for (i = 0; i < c->count; i++) {
+		r = &c->rec[i];
+		ts_prev = ts_pos ? spec->ts[ts_pos - 1].mask : 0;
+		ts_mask = mask_at(spec->ts, spec->ts_count, &ts_pos, i);
+		if (r->type == ETM_REC_TIMESTAMP) {
+			delta = r->value | (uint64_t)r->value2 << 32;
+			spec_old = r->timestamp - delta;
+			delta = (r->timestamp | (in->timestamp & ~ts_mask)) -
+				(spec_old | (in->timestamp & ~ts_prev));
+			r->value = (uint32_t)delta;
+			r->value2 = (uint32_t)(delta >> 32);
+		}
+		r->timestamp |= in->timestamp & ~ts_mask;
+
+		daddr_mask = mask_at(spec->daddr, spec->daddr_count, &daddr_pos, i);
+		if (r->type == ETM_REC_DATA && (r->flags & ETM_REC_F_DATA_ADDR))
+			r->addr |= in->daddr & ~daddr_mask;
+
+		if (i < spec->context_rec)
+			r->context = in->contextid;
+		if (i < spec->isync_rec) {
+			r->valid = in->iaddr_valid;
+			r->mode = in->mode;
+		}
+		if (i == spec->wait_rec ||
+		    (r->type == ETM_REC_END && spec->wait_rec == ETM_SPEC_NONE)) {
+			r->value += in->wait_count;
+			if (r->type == ETM_REC_INSTR) {
+				r->flags &= ~ETM_REC_F_LONG_WAIT;
+				if ((int)r->value > par->config->long_wait)
+					r->flags |= ETM_REC_F_LONG_WAIT;
+			}
+		}
+	}
+}
+
+static int format_chunk(const struct parallel *par, struct chunk *c)
+{
+	const struct etm_symbols *syms = par->config->symbols;
+	size_t i, len;
+	char *t;
+
+	patch_chunk(par, c);
+	if (par->binary)
+		return 0;
+	c->text_size = c->count * 48 + ETM_TEXT_MAX + ETM_SYM_TEXT_MAX;
+	c->text = malloc(c->text_size);
+	if (!c->text)
+		return -1;
+	for (i = 0; i < c->count; i++) {
+		if (c->text_len + ETM_TEXT_MAX + ETM_SYM_TEXT_MAX > c->text_size) {
+			t = realloc(c->text, c->text_size * 2);
+			if (!t)
+				return -1;
+			c->text = t;
+			c->text_size *= 2;
+		}
+		t = c->text + c->text_len;
+		len = etm_format_text(t, &c->rec[i], par->config->packet_types);
+		if (syms)
+			len = etm_symbols_annotate(syms, t, len, &c->rec[i]);
+		c->text_len += len;
+	}
+	return 0;
+}
+
+static void *worker(void *arg)
+{
+	struct parallel *par = arg;
+	struct chunk *c;
+	size_t i;
+	int ret;
+
+	pthread_mutex_lock(&par->lock);
+	while (!par->failed) {
+		c = NULL;
+		for (i = par->written; i < par->count && i < par->written + par->window; i++) {
+			if (par->chunks[i].status == CHUNK_READY) {
+				c = &par->chunks[i];
+				c->status = CHUNK_FORMATTING;
+				break;
+			}
+		}
+		if (!c && par->next_decode < par->count &&
+		    par->next_decode < par->written + par->window) {
+			c = &par->chunks[par->next_decode++];
+			c->status = CHUNK_DECODING;
+		}
+		if (!c) {
+			if (par->written == par->count)
+				break;
+			pthread_cond_wait(&par->cond, &par->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&par->lock);
+
+		if (c->status == CHUNK_DECODING)
+			ret = decode_chunk(par, c, par->config);
+		else
+			ret = format_chunk(par, c);
+
+		pthread_mutex_lock(&par->lock);
+		if (ret)
+			par->failed = true;
+		c->status = c->status == CHUNK_DECODING ? CHUNK_DECODED : CHUNK_FORMATTED;
+		pthread_cond_broadcast(&par->cond);
+	}
+	pthread_mutex_unlock(&par->lock);
+	return NULL;
+}
+
+/*
+ * Work out the state entering chunk k from the one leaving chunk k - 1,
+ * or decode chunk k again if its speculative decode can't be used.
+ * Runs with the lock dropped, the chunk belongs to the main thread.
+ */
+static int chain_chunk(struct parallel *par, size_t k)
+{
+	struct chunk *prev = &par->chunks[k - 1];
+	struct chunk *c = &par->chunks[k];
+	struct etm_state *s = &prev->state;
+
+	if (c->speculative && prev->end == c->start && s->sync == 1 && !s->eof &&
+	    c->spec.context_rec != ETM_SPEC_NONE) {
+		c->entry.timestamp = s->timestamp;
+		c->entry.daddr = s->daddr;
+		c->entry.contextid = s->contextid;
+		c->entry.wait_count = s->wait_count;
+		c->entry.iaddr_valid = s->iaddr_valid;
+		c->entry.mode = s->mode;
+
+		/* and what leaves this chunk */
+		c->state.timestamp |= s->timestamp & ~c->spec.ts_known;
+		c->state.daddr |= s->daddr & ~c->spec.daddr_known;
+		if (c->spec.wait_rec == ETM_SPEC_NONE)
+			c->state.wait_count += s->wait_count;
+		return 0;
+	}
+
+	/* the previous chunk ran past this start, or it is a false sync */
+	etm_spec_free(&c->spec);
+	c->speculative = false;
+	if (s->eof || (c->stop && prev->end >= c->stop)) {
+		/* nothing of this chunk is left to decode */
+		c->state = *s;
+		c->end = prev->end;
+		c->count = 0;
+		return 0;
+	}
+	c->start = prev->end;
+	return decode_chunk(par, c, s);
+}
+
+static int write_chunk(const struct parallel *par, struct chunk *c)
+{
+	size_t len;
+
+	if (par->binary)
+		len = fwrite(c->rec, sizeof(*c->rec), c->count, stdout) != c->count;
+	else
+		len = fwrite(c->text, 1, c->text_len, stdout) != c->text_len;
+	free(c->rec);
+	free(c->text);
+	c->rec = NULL;
+	c->text = NULL;
+	etm_spec_free(&c->spec);
+	return len ? -1 : 0;
+}
+
+int etm_decode_parallel(const struct etm_state *config, const uint8_t *buf,
+			size_t len, int threads, bool binary)
+{
+	struct parallel par;
+	pthread_t *tid;
+	const uint8_t *p, *end = buf + len;
+	size_t k, next_chain = 1;
+	int i, ret = 0;
+
+	memset(&par, 0, sizeof(par));
+	par.config = config;
+	par.buf = buf;
+	par.len = len;
+	par.binary = binary;
+	par.window = threads * CHUNK_WINDOW;
+
+	par.chunks = calloc(len / CHUNK_SIZE + 2, sizeof(*par.chunks));
+	tid = calloc(threads, sizeof(*tid));
+	if (!par.chunks || !tid) {
+		free(par.chunks);
+		free(tid);
+		return -1;
+	}
+	par.chunks[0].start = buf;
+	par.count = 1;
+	for (p = buf + CHUNK_SIZE; p < end; p += CHUNK_SIZE) {
+		p = find_sync(config, p < buf + 6 ? buf + 6 : p, end);
+		if (!p)
+			break;
+		par.chunks[par.count - 1].stop = p;
+		par.chunks[par.count].start = p;
+		par.chunks[par.count].speculative = true;
+		par.count++;
+	}
+	par.chunks[par.count - 1].stop = NULL;
+
+	pthread_mutex_init(&par.lock, NULL);
+	pthread_cond_init(&par.cond, NULL);
+	for (i = 0; i < threads; i++)
+		pthread_create(&tid[i], NULL, worker, &par);
+
+	pthread_mutex_lock(&par.lock);
+	while (!par.failed && par.written < par.count) {
+		/* chain the next decoded chunk to its predecessor */
+		if (next_chain <= par.count && par.chunks[next_chain - 1].status >= CHUNK_DECODED &&
+		    (next_chain == par.count || par.chunks[next_chain].status == CHUNK_DECODED)) {
+			if (next_chain == 1)
+				par.chunks[0].status = CHUNK_READY;
+			if (next_chain < par.count) {
+				pthread_mutex_unlock(&par.lock);
+				ret = chain_chunk(&par, next_chain);
+				pthread_mutex_lock(&par.lock);
+				if (ret)
+					par.failed = true;
+				par.chunks[next_chain].status = CHUNK_READY;
+			}
+			next_chain++;
+			pthread_cond_broadcast(&par.cond);
+			continue;
+		}
+		if (par.chunks[par.written].status == CHUNK_FORMATTED) {
+			k = par.written;
+			pthread_mutex_unlock(&par.lock);
+			ret = write_chunk(&par, &par.chunks[k]);
+			pthread_mutex_lock(&par.lock);
+			if (ret)
+				par.failed = true;
+			par.chunks[k].status = CHUNK_DONE;
+			par.written++;
+			pthread_cond_broadcast(&par.cond);
+			continue;
+		}
+		pthread_cond_wait(&par.cond, &par.lock);
+	}
+	ret = par.failed ? -1 : 0;
+	par.failed = true;
+	pthread_cond_broadcast(&par.cond);
+	pthread_mutex_unlock(&par.lock);
+
+	for (i = 0; i < threads; i++)
+		pthread_join(tid[i], NULL);
+	for (k = 0; k < par.count; k++) {
+		free(par.chunks[k].rec);
+		free(par.chunks[k].text);
+		etm_spec_free(&par.chunks[k].spec);
+	}
+	pthread_mutex_destroy(&par.lock);
+	pthread_cond_destroy(&par.cond);
+	free(par.chunks);
+	free(tid);
+	fflush(stdout);
+	return ret;
+}
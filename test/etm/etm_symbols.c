@@ -0,0 +1,831 @@
+/*
+ * Copyright 2026 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <elf.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "etm_symbols.h"
+
+/* the parts of a 32 or 64 bit section header that are used */
+struct section {
+	const char *name;
+	uint32_t type;
+	uint64_t flags;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t link;
+	uint64_t entsize;
+};
+
+struct elf {
+	const char *path;
+	const uint8_t *data;
+	size_t size;
+	bool is64;
+	struct section *sh;
+	int shnum;
+};
+
+void etm_symbols_init(struct etm_symbols *syms)
+{
+	memset(syms, 0, sizeof(*syms));
+}
+
+void etm_symbols_free(struct etm_symbols *syms)
+{
+	size_t i;
+
+	for (i = 0; i < syms->map_count; i++)
+		munmap(syms->maps[i].map, syms->maps[i].size);
+	free(syms->maps);
+	free(syms->sym);
+	free(syms->line);
+	free(syms->file);
+	memset(syms, 0, sizeof(*syms));
+}
+
+static int grow(void **array, size_t *size, size_t count, size_t elem)
+{
+	size_t n = *size ? *size * 2 : 1024;
+	void *p;
+
+	if (count < *size)
+		return 0;
+	p = realloc(*array, n * elem);
+	if (!p)
+		return -1;
+	*array = p;
+	*size = n;
+	return 0;
+}
+
+static bool in_file(const struct elf *elf, uint64_t offset, uint64_t size)
+{
+	return offset <= elf->size && size <= elf->size - offset;
+}
+
+static int read_sections(struct elf *elf)
+{
+	const Elf32_Ehdr *eh32 = (const void *)elf->data;
+	const Elf64_Ehdr *eh64 = (const void *)elf->data;
+	uint64_t shoff;
+	int shentsize, shstrndx, i;
+	const char *shstr;
+
+	if (elf->size < sizeof(*eh32) || memcmp(elf->data, ELFMAG, SELFMAG)) {
+		fprintf(stderr, "%s: not an ELF file\n", elf->path);
+		return -1;
+	}
+	if (elf->data[EI_DATA] != ELFDATA2LSB) {
+		fprintf(stderr, "%s: only little endian ELF files are supported\n", elf->path);
+		return -1;
+	}
+	elf->is64 = elf->data[EI_CLASS] == ELFCLASS64;
+	if (elf->is64 && elf->size < sizeof(*eh64))
+		return -1;
+	shoff = elf->is64 ? eh64->e_shoff : eh32->e_shoff;
+	elf->shnum = elf->is64 ? eh64->e_shnum : eh32->e_shnum;
+	shentsize = elf->is64 ? eh64->e_shentsize : eh32->e_shentsize;
+	shstrndx = elf->is64 ? eh64->e_shstrndx : eh32->e_shstrndx;
+	if (!in_file(elf, shoff, (uint64_t)elf->shnum * shentsize) ||
+	    shentsize < (int)(elf->is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr)) ||
+	    shstrndx >= elf->shnum) {
+		fprintf(stderr, "%s: bad section headers\n", elf->path);
+		return -1;
+	}
+
+	elf->sh = calloc(elf->shnum, sizeof(*elf->sh));
+	if (!elf->sh)
+		return -1;
+	for (i = 0; i < elf->shnum; i++) {
+		const uint8_t *p = elf->data + shoff + (uint64_t)i * shentsize;
+		struct section *s = &elf->sh[i];
+
+		if (elf->is64) {
+			const Elf64_Shdr *sh = (const void *)p;
+			s->type = sh->sh_type;
+			s->flags = sh->sh_flags;
+			s->offset = sh->sh_offset;
+			s->size = sh->sh_size;
+			s->link = sh->sh_link;
+			s->entsize = sh->sh_entsize;
+			s->name = (const char *)(uintptr_t)sh->sh_name;
+		} else {
+			const Elf32_Shdr *sh = (const void *)p;
+			s->type = sh->sh_type;
+			s->flags = sh->sh_flags;
+			s->offset = sh->sh_offset;
+			s->size = sh->sh_size;
+			s->link = sh->sh_link;
+			s->entsize = sh->sh_entsize;
+			s->name = (const char *)(uintptr_t)sh->sh_name;
+		}
+		if (s->type != SHT_NOBITS && !in_file(elf, s->offset, s->size)) {
+			fprintf(stderr, "%s: section %d outside the file\n", elf->path, i);
+			return -1;
+		}
+	}
+	shstr = (const char *)elf->data + elf->sh[shstrndx].offset;
+	for (i = 0; i < elf->shnum; i++) {
+		uintptr_t off = (uintptr_t)elf->sh[i].name;
+		elf->sh[i].name = off < elf->sh[shstrndx].size ? shstr + off : "";
+	}
+	return 0;
+}
+
+static const struct section *find_section(const struct elf *elf, const char *name)
+{
+	int i;
+
+	for (i = 0; i < elf->shnum; i++)
+		if (!strcmp(elf->sh[i].name, name))
+			return &elf->sh[i];
+	return NULL;
+}
+
+/* $a, $t, $d mark ARM, Thumb and data, .L are local labels */
+static bool skip_symbol(const char *name)
+{
+	return !*name || name[0] == '$' || !strncmp(name, ".L", 2);
+}
+
+static int read_symbols(struct etm_symbols *syms, const struct elf *elf,
+			uint32_t offset)
+{
+	const struct section *symtab = find_section(elf, ".symtab");
+	const struct section *strtab;
+	size_t entsize, i, n;
+	const char *str;
+
+	if (!symtab)
+		symtab = find_section(elf, ".dynsym");
+	if (!symtab || symtab->link >= (uint32_t)elf->shnum) {
+		fprintf(stderr, "%s: no symbol table\n", elf->path);
+		return -1;
+	}
+	strtab = &elf->sh[symtab->link];
+	str = (const char *)elf->data + strtab->offset;
+	entsize = elf->is64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+	n = symtab->size / entsize;
+
+	for (i = 1; i < n; i++) {
+		const uint8_t *p = elf->data + symtab->offset + i * entsize;
+		uint64_t value, size;
+		uint32_t name;
+		int type, shndx;
+
+		if (elf->is64) {
+			const Elf64_Sym *s = (const void *)p;
+			value = s->st_value;
+			size = s->st_size;
+			name = s->st_name;
+			type = ELF64_ST_TYPE(s->st_info);
+			shndx = s->st_shndx;
+		} else {
+			const Elf32_Sym *s = (const void *)p;
+			value = s->st_value;
+			size = s->st_size;
+			name = s->st_name;
+			type = ELF32_ST_TYPE(s->st_info);
+			shndx = s->st_shndx;
+		}
+		if ((type != STT_FUNC && type != STT_NOTYPE) ||
+		    shndx == SHN_UNDEF || shndx >= elf->shnum ||
+		    !(elf->sh[shndx].flags & SHF_EXECINSTR) ||
+		    name >= strtab->size || skip_symbol(str + name))
+			continue;
+		if (grow((void **)&syms->sym, &syms->size, syms->count, sizeof(*syms->sym)))
+			return -1;
+		/* bit 0 of a Thumb function is the mode, not the address */
+		syms->sym[syms->count].addr = (uint32_t)(value & ~1ULL) + offset;
+		syms->sym[syms->count].size = size;
+		syms->sym[syms->count].name = str + name;
+		syms->count++;
+	}
+	return 0;
+}
+
+/* DWARF .debug_line, versions 2 to 5, 32-bit DWARF only */
+
+struct reader {
+	const uint8_t *p;
+	const uint8_t *end;
+};
+
+static uint64_t get_uleb(struct reader *r)
+{
+	uint64_t v = 0;
+	int shift = 0;
+
+	while (r->p < r->end) {
+		uint8_t b = *r->p++;
+		if (shift < 64)
+			v |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+		if (!(b & 0x80))
+			break;
+	}
+	return v;
+}
+
+static int64_t get_sleb(struct reader *r)
+{
+	int64_t v = 0;
+	int shift = 0;
+	uint8_t b = 0;
+
+	while (r->p < r->end) {
+		b = *r->p++;
+		if (shift < 64)
+			v |= (int64_t)(b & 0x7f) << shift;
+		shift += 7;
+		if (!(b & 0x80))
+			break;
+	}
+	if (shift < 64 && (b & 0x40))
+		v |= -((int64_t)1 << shift);
+	return v;
+}
+
+static uint64_t get_u(struct reader *r, int bytes)
+{
+	uint64_t v = 0;
+	int i;
+
+	if (r->end - r->p < bytes) {
+		r->p = r->end;
+		return 0;
+	}
+	for (i = 0; i < bytes; i++)
+		v |= (uint64_t)*r->p++ << (8 * i);
+	return v;
+}
+
+static const char *get_str(struct reader *r)
+{
+	const char *s = (const char *)r->p;
+
+	while (r->p < r->end && *r->p)
+		r->p++;
+	if (r->p == r->end)
+		return "";
+	r->p++;
+	return s;
+}
+
+struct line_unit {
+	int version;
+	int min_inst;
+	int line_base;
+	int line_range;
+	int opcode_base;
+	const uint8_t *std_len;
+	size_t file_base;	/* first etm_symbols.file entry of the unit */
+	size_t file_count;
+};
+
+static int add_file(struct etm_symbols *syms, const char *name)
+{
+	if (grow((void **)&syms->file, &syms->file_size, syms->file_count,
+		 sizeof(*syms->file)))
+		return -1;
+	syms->file[syms->file_count++] = name;
+	return 0;
+}
+
+/* a DWARF 5 entry format attribute; only the path is kept */
+static const char *get_form(struct reader *r, uint64_t form, const struct elf *elf,
+			    const struct section *str, const struct section *line_str)
+{
+	const struct section *s = NULL;
+	uint64_t off;
+
+	switch (form) {
+	case 0x08:			/* DW_FORM_string */
+		return get_str(r);
+	case 0x0e:			/* DW_FORM_strp */
+		s = str;
+		/* fall through */
+	case 0x1f:			/* DW_FORM_line_strp */
+		if (!s)
+			s = line_str;
+		off = get_u(r, 4);
+		return s && off < s->size ? (const char *)elf->data + s->offset + off : "";
+	case 0x0b:			/* DW_FORM_data1 */
+		get_u(r, 1);
+		break;
+	case 0x05:			/* DW_FORM_data2 */
+		get_u(r, 2);
+		break;
+	case 0x06:			/* DW_FORM_data4 */
+		get_u(r, 4);
+		break;
+	case 0x07:			/* DW_FORM_data8 */
+		get_u(r, 8);
+		break;
+	case 0x1e:			/* DW_FORM_data16 */
+		r->p = r->end - r->p < 16 ? r->end : r->p + 16;
+		break;
+	case 0x0f:			/* DW_FORM_udata */
+		get_uleb(r);
+		break;
+	case 0x09:			/* DW_FORM_block */
+		off = get_uleb(r);
+		r->p = (uint64_t)(r->end - r->p) < off ? r->end : r->p + off;
+		break;
+	default:
+		r->p = r->end;
+		break;
+	}
+	return NULL;
+}
+
+static int read_entries_v5(struct etm_symbols *syms, struct reader *r,
+			   const struct elf *elf, bool files, struct line_unit *u)
+{
+	const struct section *str = find_section(elf, ".debug_str");
+	const struct section *line_str = find_section(elf, ".debug_line_str");
+	uint64_t format[16][2], count, i;
+	int nformat, j;
+	const char *name, *s;
+
+	nformat = get_u(r, 1);
+	if (nformat > 16)
+		return -1;
+	for (j = 0; j < nformat; j++) {
+		format[j][0] = get_uleb(r);
+		format[j][1] = get_uleb(r);
+	}
+	count = get_uleb(r);
+	for (i = 0; i < count && r->p < r->end; i++) {
+		name = "";
+		for (j = 0; j < nformat; j++) {
+			s = get_form(r, format[j][1], elf, str, line_str);
+			if (format[j][0] == 1 && s)	/* DW_LNCT_path */
+				name = s;
+		}
+		if (files) {
+			if (add_file(syms, name))
+				return -1;
+			u->file_count++;
+		}
+	}
+	return 0;
+}
+
+static int add_row(struct etm_symbols *syms, uint64_t addr, uint32_t line,
+		   uint64_t file, const struct line_unit *u)
+{
+	struct etm_line *l;
+
+	if (grow((void **)&syms->line, &syms->line_size, syms->line_count,
+		 sizeof(*syms->line)))
+		return -1;
+	/* files count from 1 before DWARF 5, from 0 since */
+	if (u->version < 5)
+		file--;
+	l = &syms->line[syms->line_count++];
+	l->addr = addr;
+	l->line = line;
+	l->file = file < u->file_count ? u->file_base + file : (uint32_t)-1;
+	return 0;
+}
+
+static int read_line_program(struct etm_symbols *syms, struct reader *r,
+			     const struct line_unit *u, uint32_t offset)
+{
+	uint64_t addr = 0, file = 1;
+	int64_t line = 1;
+	uint64_t len, adj;
+	const uint8_t *next;
+	int op;
+
+	while (r->p < r->end) {
+		op = *r->p++;
+		if (op >= u->opcode_base) {
+			adj = op - u->opcode_base;
+			addr += (adj / u->line_range) * u->min_inst;
+			line += u->line_base + (int)(adj % u->line_range);
+			if (add_row(syms, addr + offset, line, file, u))
+				return -1;
+			continue;
+		}
+		switch (op) {
+		case 0:			/* extended */
+			len = get_uleb(r);
+			if (!len || (uint64_t)(r->end - r->p) < len) {
+				r->p = r->end;
+				break;
+			}
+			next = r->p + len;
+			switch (*r->p++) {
+			case 1:		/* DW_LNE_end_sequence */
+				if (add_row(syms, addr + offset, 0, file, u))
+					return -1;
+				addr = 0;
+				file = 1;
+				line = 1;
+				break;
+			case 2:		/* DW_LNE_set_address */
+				addr = get_u(r, len - 1);
+				break;
+			}
+			r->p = next;
+			break;
+		case 1:			/* DW_LNS_copy */
+			if (add_row(syms, addr + offset, line, file, u))
+				return -1;
+			break;
+		case 2:			/* DW_LNS_advance_pc */
+			addr += get_uleb(r) * u->min_inst;
+			break;
+		case 3:			/* DW_LNS_advance_line */
+			line += get_sleb(r);
+			break;
+		case 4:			/* DW_LNS_set_file */
+			file = get_uleb(r);
+			break;
+		case 8:			/* DW_LNS_const_add_pc */
+			addr += ((255 - u->opcode_base) / u->line_range) * u->min_inst;
+			break;
+		case 9:			/* DW_LNS_fixed_advance_pc */
+			addr += get_u(r, 2);
+			break;
+		default:		/* skip the operands */
+			for (len = u->std_len[op - 1]; len; len--)
+				get_uleb(r);
+			break;
+		}
+	}
+	return 0;
+}
+
+static int read_lines(struct etm_symbols *syms, const struct elf *elf,
+		      uint32_t offset)
+{
+	const struct section *sec = find_section(elf, ".debug_line");
+	const uint8_t *program;
+	struct reader all, r, h;
+	struct line_unit u;
+	uint64_t len;
+	const char *name;
+
+	if (!sec) {
+		fprintf(stderr, "%s: no .debug_line, only function names\n", elf->path);
+		return 0;
+	}
+	if (sec->flags & SHF_COMPRESSED) {
+		fprintf(stderr, "%s: compressed .debug_line is not supported\n", elf->path);
+		return 0;
+	}
+	all.p = elf->data + sec->offset;
+	all.end = all.p + sec->size;
+	while (all.end - all.p >= 4) {
+		len = get_u(&all, 4);
+		if (len >= 0xfffffff0 || (uint64_t)(all.end - all.p) < len)
+			break;		/* 64-bit DWARF or truncated */
+		r.p = all.p;
+		r.end = all.p + len;
+		all.p = r.end;
+
+		memset(&u, 0, sizeof(u));
+		u.version = get_u(&r, 2);
+		if (u.version < 2 || u.version > 5)
+			continue;
+		if (u.version >= 5)
+			get_u(&r, 2);	/* address and segment selector size */
+		len = get_u(&r, 4);
+		if ((uint64_t)(r.end - r.p) < len)
+			continue;
+		program = r.p + len;
+
+		u.min_inst = get_u(&r, 1);
+		if (u.version >= 4)
+			get_u(&r, 1);	/* maximum operations per instruction */
+		get_u(&r, 1);		/* default is_stmt */
+		u.line_base = (int8_t)get_u(&r, 1);
+		u.line_range = get_u(&r, 1);
+		u.opcode_base = get_u(&r, 1);
+		if (!u.line_range || !u.opcode_base || program - r.p < u.opcode_base - 1)
+			continue;
+		u.std_len = r.p;
+		r.p += u.opcode_base - 1;
+		u.file_base = syms->file_count;
+
+		h.p = r.p;
+		h.end = program;
+		if (u.version >= 5) {
+			/* directory, then file name entries */
+			if (read_entries_v5(syms, &h, elf, false, &u) ||
+			    read_entries_v5(syms, &h, elf, true, &u))
+				return -1;
+		} else {
+			/* include directories, then file names */
+			do {
+				name = get_str(&h);
+			} while (*name);
+			while (h.p < h.end) {
+				name = get_str(&h);
+				if (!*name)
+					break;
+				get_uleb(&h);	/* directory */
+				get_uleb(&h);	/* modification time */
+				get_uleb(&h);	/* length */
+				if (add_file(syms, name))
+					return -1;
+				u.file_count++;
+			}
+		}
+		r.p = program;
+		if (read_line_program(syms, &r, &u, offset))
+			return -1;
+	}
+	return 0;
+}
+
+static int cmp_symbol(const void *a, const void *b)
+{
+	const struct etm_symbol *x = a, *y = b;
+
+	if (x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	/* sized (function) symbols first, they survive the dedup */
+	if (!x->size != !y->size)
+		return x->size ? -1 : 1;
+	return strcmp(x->name, y->name);
+}
+
+static int cmp_line(const void *a, const void *b)
+{
+	const struct etm_line *x = a, *y = b;
+
+	if (x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	/* a sequence that starts where another ends wins */
+	return (x->line != 0) - (y->line != 0);
+}
+
+static void sort_symbols(struct etm_symbols *syms)
+{
+	size_t i, n = 0;
+
+	qsort(syms->sym, syms->count, sizeof(*syms->sym), cmp_symbol);
+	for (i = 0; i < syms->count; i++) {
+		if (n && syms->sym[n - 1].addr == syms->sym[i].addr)
+			continue;
+		syms->sym[n++] = syms->sym[i];
+	}
+	syms->count = n;
+	for (i = 0; i < n; i++) {
+		if (syms->sym[i].size)
+			continue;
+		syms->sym[i].size = i + 1 < n ? syms->sym[i + 1].addr - syms->sym[i].addr : 4;
+	}
+	qsort(syms->line, syms->line_count, sizeof(*syms->line), cmp_line);
+}
+
+int etm_symbols_load(struct etm_symbols *syms, const char *path,
+		     uint32_t offset, bool lines)
+{
+	struct elf elf;
+	struct stat st;
+	void *map;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if (fstat(fd, &st) || !st.st_size) {
+		fprintf(stderr, "%s: empty file\n", path);
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(path);
+		return -1;
+	}
+	if (grow((void **)&syms->maps, &syms->map_size, syms->map_count,
+		 sizeof(*syms->maps))) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+	syms->maps[syms->map_count].map = map;
+	syms->maps[syms->map_count].size = st.st_size;
+	syms->map_count++;
+
+	memset(&elf, 0, sizeof(elf));
+	elf.path = path;
+	elf.data = map;
+	elf.size = st.st_size;
+	ret = read_sections(&elf);
+	if (!ret)
+		ret = read_symbols(syms, &elf, offset);
+	if (!ret && lines)
+		ret = read_lines(syms, &elf, offset);
+	free(elf.sh);
+	sort_symbols(syms);
+	return ret;
+}
+
+const struct etm_symbol *etm_symbols_find(const struct etm_symbols *syms,
+					  uint32_t addr)
+{
+	size_t lo = 0, hi = syms->count, mid;
+	const struct etm_symbol *s;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (syms->sym[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!lo)
+		return NULL;
+	s = &syms->sym[lo - 1];
+	return addr - s->addr < s->size ? s : NULL;
+}
+
+const struct etm_line *etm_symbols_find_line(const struct etm_symbols *syms,
+					     uint32_t addr)
+{
+	size_t lo = 0, hi = syms->line_count, mid;
+	const struct etm_line *l;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (syms->line[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!lo)
+		return NULL;
+	l = &syms->line[lo - 1];
+	return l->line && l->file < syms->file_count ? l : NULL;
+}
+
+static bool has_addr(const struct etm_record *rec)
+{
+	switch (rec->type) {
+	case ETM_REC_INSTR:
+	case ETM_REC_BRANCH:
+	case ETM_REC_WAYPOINT:
+	case ETM_REC_ISYNC:
+		return rec->valid == 0xffffffff;
+	}
+	return false;
+}
+
+size_t etm_symbols_annotate(const struct etm_symbols *syms, char *buf,
+			    size_t len, const struct etm_record *rec)
+{
+	const struct etm_symbol *s;
+	const struct etm_line *l;
+	char *p;
+	int n = 0;
+
+	if (!len || buf[len - 1] != '\n' || !has_addr(rec))
+		return len;
+	s = etm_symbols_find(syms, rec->addr);
+	l = etm_symbols_find_line(syms, rec->addr);
+	if (!s && !l)
+		return len;
+	p = buf + len - 1;
+	if (s)
+		n = snprintf(p, ETM_SYM_TEXT_MAX - 1, " <%.200s+0x%x>", s->name,
+			     rec->addr - s->addr);
+	if (l && n < ETM_SYM_TEXT_MAX - 1)
+		n += snprintf(p + n, ETM_SYM_TEXT_MAX - 1 - n, " %.100s:%u",
+			      syms->file[l->file], l->line);
+	if (n > ETM_SYM_TEXT_MAX - 2)
+		n = ETM_SYM_TEXT_MAX - 2;
+	p[n] = '\n';
+	return len + n;
+}
+
+int etm_profile_init(struct etm_profile *prof, const struct etm_symbols *syms)
+{
+	memset(prof, 0, sizeof(*prof));
+	prof->syms = syms;
+	prof->entry = calloc(syms->count + 1, sizeof(*prof->entry));
+	prof->last = syms->count;
+	prof->prev_type = -1;
+	return prof->entry ? 0 : -1;
+}
+
+void etm_profile_free(struct etm_profile *prof)
+{
+	free(prof->entry);
+	prof->entry = NULL;
+}
+
+/*
+ * Cycle counts come before the atom they belong to, except after a PFT
+ * branch, where they count the branch instruction traced just before.
+ * ETM cycle-accurate atoms carry their wait count themselves.
+ */
+void etm_profile_sink(void *ctx, const struct etm_record *rec, size_t count)
+{
+	struct etm_profile *prof = ctx;
+	const struct etm_symbol *s;
+	size_t i, e;
+
+	for (i = 0; i < count; i++, rec++) {
+		switch (rec->type) {
+		case ETM_REC_INSTR:
+			s = has_addr(rec) ? etm_symbols_find(prof->syms, rec->addr) : NULL;
+			e = s ? (size_t)(s - prof->syms->sym) : prof->syms->count;
+			if (rec->flags & ETM_REC_F_EXECUTED)
+				prof->entry[e].executed++;
+			else
+				prof->entry[e].not_executed++;
+			prof->entry[e].cycles += prof->pending + rec->value;
+			prof->pending = 0;
+			prof->last = e;
+			break;
+		case ETM_REC_CYCLE_COUNT:
+			if (prof->prev_type == ETM_REC_BRANCH)
+				prof->entry[prof->last].cycles += rec->value;
+			else
+				prof->pending += rec->value;
+			break;
+		}
+		prof->prev_type = rec->type;
+	}
+}
+
+static const struct etm_profile *sort_prof;
+
+static int cmp_entry(const void *a, const void *b)
+{
+	const struct etm_profile_entry *x = &sort_prof->entry[*(const size_t *)a];
+	const struct etm_profile_entry *y = &sort_prof->entry[*(const size_t *)b];
+	uint64_t xa = x->executed + x->not_executed, ya = y->executed + y->not_executed;
+
+	if (x->cycles != y->cycles)
+		return x->cycles > y->cycles ? -1 : 1;
+	if (xa != ya)
+		return xa > ya ? -1 : 1;
+	return 0;
+}
+
+void etm_profile_print(const struct etm_profile *prof, FILE *f)
+{
+	const struct etm_profile_entry *e;
+	uint64_t cycles = 0, atoms = 0;
+	size_t *order, i, n = 0;
+
+	order = malloc((prof->syms->count + 1) * sizeof(*order));
+	if (!order)
+		return;
+	for (i = 0; i <= prof->syms->count; i++) {
+		e = &prof->entry[i];
+		if (!e->executed && !e->not_executed && !e->cycles)
+			continue;
+		order[n++] = i;
+		cycles += e->cycles;
+		atoms += e->executed + e->not_executed;
+	}
+	sort_prof = prof;
+	qsort(order, n, sizeof(*order), cmp_entry);
+
+	fprintf(f, "%14s %6s %12s %12s %6s  %s\n",
+		"cycles", "%", "executed", "not exec", "%", "function");
+	for (i = 0; i < n; i++) {
+		e = &prof->entry[order[i]];
+		fprintf(f, "%14" PRIu64 " %6.2f %12" PRIu64 " %12" PRIu64 " %6.2f  %s\n",
+			e->cycles, cycles ? 100.0 * e->cycles / cycles : 0.0,
+			e->executed, e->not_executed,
+			atoms ? 100.0 * (e->executed + e->not_executed) / atoms : 0.0,
+			order[i] < prof->syms->count ?
+				prof->syms->sym[order[i]].name : "[unknown]");
+	}
+	fprintf(f, "%14" PRIu64 " %6s %12" PRIu64 " atoms in %zu functions\n",
+		cycles, "", atoms, n);
+	free(order);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2026 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ETM_SYMBOLS_H
+#define ETM_SYMBOLS_H
+
+#include <stdio.h>
+
+#include "etm_decode.h"
+
+/*
+ * Address to function (and optionally source line) lookup for decoded
+ * traces, read once from the ELF symbol table and .debug_line of the
+ * traced images (vmlinux, modules, executables) instead of running
+ * objdump over them and matching its text.
+ */
+
+struct etm_symbol {
+	uint32_t addr;
+	uint32_t size;		/* up to the next symbol if the ELF has none */
+	const char *name;
+};
+
+struct etm_line {
+	uint32_t addr;
+	uint32_t line;		/* 0 marks the end of a sequence */
+	uint32_t file;		/* index into etm_symbols.file */
+};
+
+struct etm_elf_map {
+	void *map;
+	size_t size;
+};
+
+struct etm_symbols {
+	struct etm_symbol *sym;		/* sorted by address */
+	size_t count;
+	size_t size;
+
+	struct etm_line *line;		/* sorted by address */
+	size_t line_count;
+	size_t line_size;
+	const char **file;
+	size_t file_count;
+	size_t file_size;
+
+	struct etm_elf_map *maps;	/* names point into these */
+	size_t map_count;
+	size_t map_size;
+};
+
+void etm_symbols_init(struct etm_symbols *syms);
+void etm_symbols_free(struct etm_symbols *syms);
+
+/*
+ * Add the functions of an ELF file, moved by offset (the load address
+ * of a module or shared library), and its line table if lines is set.
+ */
+int etm_symbols_load(struct etm_symbols *syms, const char *path,
+		     uint32_t offset, bool lines);
+
+const struct etm_symbol *etm_symbols_find(const struct etm_symbols *syms,
+					  uint32_t addr);
+const struct etm_line *etm_symbols_find_line(const struct etm_symbols *syms,
+					     uint32_t addr);
+
+/*
+ * Add " <function+offset> file:line" before the newline that ends the
+ * text of an instruction, branch, waypoint or I-sync record whose
+ * address is known. Appends at most ETM_SYM_TEXT_MAX bytes.
+ */
+#define ETM_SYM_TEXT_MAX 256
+size_t etm_symbols_annotate(const struct etm_symbols *syms, char *buf,
+			    size_t len, const struct etm_record *rec);
+
+/*
+ * Per function histogram of executed and not executed atoms and of the
+ * cycles counted in a cycle-accurate trace. etm_profile_sink() takes
+ * the records of a decode in order.
+ */
+struct etm_profile_entry {
+	uint64_t executed;
+	uint64_t not_executed;
+	uint64_t cycles;
+};
+
+struct etm_profile {
+	const struct etm_symbols *syms;
+	struct etm_profile_entry *entry;	/* per symbol, then unknown */
+	size_t last;				/* entry of the last atom */
+	uint64_t pending;			/* cycles for the next atom */
+	int prev_type;
+};
+
+int etm_profile_init(struct etm_profile *prof, const struct etm_symbols *syms);
+void etm_profile_free(struct etm_profile *prof);
+void etm_profile_sink(void *ctx, const struct etm_record *rec, size_t count);
+void etm_profile_print(const struct etm_profile *prof, FILE *f);
+
+#endif
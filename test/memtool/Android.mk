@@ -4,6 +4,7 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
        memtool.c \
+       memtool_lookup.c \
        mx6dl_modules.c \
        mx6q_modules.c \
        mx6sx_modules.c \
@@ -15,6 +16,8 @@ LOCAL_SRC_FILES := \
        mx8mq_modules.c
 
 #LOCAL_CFLAGS += -DBUILD_FOR_ANDROID
+# no host generator step here, sort the register index on first use instead
+LOCAL_CFLAGS += -DMEMTOOL_RUNTIME_INDEX
 
 LOCAL_C_INCLUDES += $(LOCAL_PATH) \
 
@@ -22,7 +22,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/utsname.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
 #include "memtools_register_info.h"
+#include "memtool_lookup.h"
 
 int g_size = 4;
 unsigned long g_paddr;
@@ -35,25 +40,25 @@ char *g_reg;
 char *g_field;
 char *g_reg_input;
 
-int g_fmem;
-uintptr_t g_map_vaddr = 0;
-int g_map_paddr = 0;
+int g_fmem = -1;
+const char *g_mem_path = "/dev/mem";
+unsigned long g_mem_size;
 int g_comp = 0;
 int g_module_match = 0;
+int g_annotate = 0;
+const struct mt_index *g_index;
 
 #define MAP_SIZE 0x1000
+#define MAP_WINDOWS 16
+#define BATCH_MAX_ARGS 16
+#define OUTBUF_SIZE (4 << 20)
+#define SAMPLE_MAX_TARGETS 32
+#define SAMPLE_DEFAULT_COUNT 65536
 #define KERN_VER(a, b, c) (((a) << 16) + ((b) << 8) + (c))
 
 extern const module_t mx6q[];
 extern const module_t mx6dl[];
 extern const module_t mx6sl[];
-extern const module_t mx6sx[];
-extern const module_t mx6ul[];
-extern const module_t mx7d[];
-extern const module_t mx6ull[];
-extern const module_t mx7ulp[];
-extern const module_t imx8mq7dvajz[];
-extern const module_t imx8mm7dvajz[];
 
 char g_buffer[4096];
 
@@ -63,41 +68,100 @@ void die(char *p)
 	exit(-1);
 }
 
+/*
+ * Mapped MAP_SIZE windows of the memory file, reused least recently used
+ * first, so a batch of accesses spread over a few blocks maps each once.
+ */
+struct map_window {
+	unsigned long paddr;
+	uintptr_t vaddr;
+	unsigned long last_use;
+};
+
+struct map_window g_windows[MAP_WINDOWS];
+unsigned long g_map_clock;
+unsigned long g_map_hits;
+unsigned long g_map_misses;
+
 int open_mem_file(void)
 {
-	if (!g_fmem)
-		g_fmem = open("/dev/mem", O_RDWR | O_SYNC, 0);
+	if (g_fmem >= 0)
+		return 0;
 
-	if (!g_fmem)
-		die("Can't open file /dev/mem\n");
+	if (g_mem_size) {
+		/* anonymous memory standing in for /dev/mem */
+#ifdef SYS_memfd_create
+		g_fmem = syscall(SYS_memfd_create, "memtool", 0);
+#endif
+		if (g_fmem < 0 || ftruncate(g_fmem, g_mem_size) < 0)
+			die("Can't create memfd\n");
+		return 0;
+	}
+
+	g_fmem = open(g_mem_path, O_RDWR | O_SYNC, 0);
+	if (g_fmem < 0) {
+		printf("Can't open file %s\n", g_mem_path);
+		exit(-1);
+	}
 	return 0;
 }
 
-int map_address(int address)
+/* virtual address of the window holding address, mapping it if needed */
+uintptr_t map_address(unsigned long address)
 {
-	if ((address & (~(MAP_SIZE - 1))) == g_map_paddr)
-		return 0;
-	if (g_map_vaddr)
-		munmap((void *)g_map_vaddr, MAP_SIZE);
+	struct map_window *w, *victim = &g_windows[0];
+	unsigned long paddr = address & ~(unsigned long)(MAP_SIZE - 1);
+	void *vaddr;
+	int i;
 
-	g_map_vaddr =
-	    (uintptr_t)mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
-		      g_fmem, address & (~(MAP_SIZE - 1)));
-	g_map_paddr = address & (~(MAP_SIZE - 1));
+	g_map_clock++;
+	for (i = 0; i < MAP_WINDOWS; i++) {
+		w = &g_windows[i];
+		if (w->vaddr && w->paddr == paddr) {
+			w->last_use = g_map_clock;
+			g_map_hits++;
+			return w->vaddr;
+		}
+		if (w->last_use < victim->last_use)
+			victim = w;
+	}
 
-	return 0;
+	g_map_misses++;
+	if (victim->vaddr)
+		munmap((void *)victim->vaddr, MAP_SIZE);
+
+	vaddr = mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+		     g_fmem, paddr);
+	if (vaddr == MAP_FAILED) {
+		printf("Can't map address 0x%08lX\n", paddr);
+		exit(-1);
+	}
+	victim->paddr = paddr;
+	victim->vaddr = (uintptr_t)vaddr;
+	victim->last_use = g_map_clock;
+	return victim->vaddr;
 }
 
-int readm(int address, int width)
+void unmap_all(void)
+{
+	int i;
+
+	for (i = 0; i < MAP_WINDOWS; i++) {
+		if (g_windows[i].vaddr)
+			munmap((void *)g_windows[i].vaddr, MAP_SIZE);
+		g_windows[i].vaddr = 0;
+		g_windows[i].last_use = 0;
+	}
+}
+
+int readm(unsigned long address, int width)
 {
 	uint8_t *addr8;
 	uint16_t *addr16;
 	uint32_t *addr32;
 
 	open_mem_file();
-	map_address(address);
-
-	addr32 = (uint32_t *) (g_map_vaddr + (address & (MAP_SIZE - 1)));
+	addr32 = (uint32_t *) (map_address(address) + (address & (MAP_SIZE - 1)));
 	addr16 = (uint16_t *) addr32;
 	addr8 = (uint8_t *) addr16;
 
@@ -114,15 +178,14 @@ int readm(int address, int width)
 	return 0;
 }
 
-int writem(int address, int width, int value)
+int writem(unsigned long address, int width, int value)
 {
 	uint8_t *addr8;
 	uint16_t *addr16;
 	uint32_t *addr32;
 
 	open_mem_file();
-	map_address(address);
-	addr32 = (uint32_t *) (g_map_vaddr + (address & (MAP_SIZE - 1)));
+	addr32 = (uint32_t *) (map_address(address) + (address & (MAP_SIZE - 1)));
 	addr16 = (uint16_t *) addr32;
 	addr8 = (uint8_t *) addr16;
 
@@ -190,20 +253,27 @@ void parse_reg(const module_t * mx, const char *reg, char *field)
 
 	int i = 0;
 
-	str = strchr(reg, '*');
-	if (str != NULL)
+	if (reg && (str = strchr(reg, '*')) != NULL)
 		*str = 0;	/*cut register name */
 
-	for (i = 0; i < mx->reg_count; i++) {
-		if (g_comp) {
-			if (field != NULL && reg != NULL) {
-				if (strcmp(sreg->name, reg) == 0)
-					parse_field(mx, sreg, field, 0);
-			} else if (reg == NULL || strncmp(sreg->name, reg, strlen(reg)) == 0) {
-				printf("%s.%s.\n", mx->name, sreg->name);
-			}
+	if (g_comp) {
+		unsigned first, n;
+
+		if (field != NULL && reg != NULL) {
+			sreg = mt_find_reg(g_index, mx, reg);
+			if (sreg)
+				parse_field(mx, sreg, field, 0);
+			return;
+		}
+		n = mt_reg_range(g_index, mx, reg, &first);
+		for (i = 0; i < n; i++)
+			printf("%s.%s.\n", mx->name,
+			       mt_reg_at(g_index, mx, first + i)->name);
+		return;
+	}
 
-		} else if (reg == NULL || *reg == 0 || strlen(reg) == 0 ||
+	for (i = 0; i < mx->reg_count; i++) {
+		if (reg == NULL || *reg == 0 || strlen(reg) == 0 ||
 		    strncmp(sreg->name, reg, strlen(reg)) == 0 || *reg == '-') {
 			printf("  %s.%s Addr:0x%08X Value:0x%08X - %s\n",
 			       mx->name, sreg->name,
@@ -250,10 +320,10 @@ void write_reg(int addr, int width, int value)
 	writem(addr, width, value);
 }
 
-void parse_module(char *module, char *reg, char *field, int iswrite)
+/* find the module table of the running SoC and its lookup index */
+const module_t *get_soc(void)
 {
-	const module_t *mx = NULL;
-	char *str = NULL;
+	static const module_t *mx;
 	int fd = 0;
 	int n;
 	char *rev;
@@ -261,6 +331,9 @@ void parse_module(char *module, char *reg, char *field, int iswrite)
 	int kv, kv_major, kv_minor, kv_rel;
 	struct utsname sys_name;
 
+	if (mx)
+		return mx;
+
 	if (uname(&sys_name) < 0)
 		die("uname error");
 
@@ -317,118 +390,74 @@ void parse_module(char *module, char *reg, char *field, int iswrite)
 			die("fail to get soc_id");
 		}
 
-		if (fscanf(fp, "%s", soc_name) != 1) {
+		if (fscanf(fp, "%254s", soc_name) != 1) {
 			fclose(fp);
 			die("fail to get soc_name");
 		}
 		fclose(fp);
 
-		if (!g_comp)
+		if (!g_comp && !g_annotate)
 			printf("SOC: %s\n", soc_name);
 
-		if (!strcmp(soc_name, "i.MX6Q"))
-			mx = mx6q;
-		else if (!strcmp(soc_name, "i.MX6DL"))
-			mx = mx6dl;
-		else if (!strcmp(soc_name, "i.MX6SL"))
-			mx = mx6sl;
-		else if (!strcmp(soc_name, "i.MX6SX"))
-			mx = mx6sx;
-		else if (!strcmp(soc_name, "i.MX6UL"))
-			mx = mx6ul;
-		else if (!strcmp(soc_name, "i.MX7D"))
-			mx = mx7d;
-		else if (!strcmp(soc_name, "i.MX6ULL"))
-			mx = mx6ull;
-		else if (!strcmp(soc_name, "i.MX7ULP"))
-			mx = mx7ulp;
-		else if (!strcmp(soc_name, "i.MX8MQ"))
-			mx = imx8mq7dvajz;
-		else if (!strcmp(soc_name, "i.MX8MM"))
-			mx = imx8mm7dvajz;
-		else
+		mx = mt_soc_modules(soc_name);
+		if (mx == NULL)
 			die("Unknown SOC\n");
 	}
 
+	g_index = mt_index_get(mx);
+	if (g_index == NULL)
+		die("No register index for this SOC\n");
+	return mx;
+}
+
+void parse_module(char *module, char *reg, char *field, int iswrite)
+{
+	const module_t *mx = get_soc();
+	char *str = NULL;
+
 	if (iswrite && !g_comp) {
-		while (mx) {
-			if (strcmp(mx->name, module) == 0) {
-
-				const reg_t *r = mx->regs;
-				int i = 0;
-				for (i = 0; i < mx->reg_count; i++) {
-					if (strcmp(r->name, reg) == 0) {
-						if (field == NULL || *field == 0) {
-							if (r->is_writable)
-								write_reg(mx->
-									  base_address
-									  +
-									  r->
-									  offset,
-									  r->
-									  width,
-									  g_value);
-							else
-								printf
-								    ("%s.%s is not writable register\n",
-								     mx->name,
-								     r->name);
-							return;
-						} else {
-							const field_t *f = r->fields;
-							int j;
-							for (j = 0; j < r->field_count; j++) {
-								if (strcmp(f->name, field) == 0) {
-									if (f->is_writable)
-										write_reg_mask
-										    (mx->
-										     base_address
-										     +
-										     r->
-										     offset,
-										     r->
-										     width,
-										     g_value,
-										     f->
-										     lsb,
-										     f->
-										     msb);
-									else
-										printf
-										    ("%s.%s.%s is not writable\n",
-										     mx->
-										     name,
-										     r->
-										     name,
-										     f->
-										     name);
-								}
-								f++;
-
-							}
-							return;
-						}
-					}
-
-					r++;
-
-				}
-				printf("Can't find register %s\n", reg);
-				return;
-			}
-			mx++;
+		const reg_t *r;
+		const field_t *f;
+
+		mx = mt_find_module(g_index, module);
+		if (mx == NULL) {
+			printf("Can't find module %s\n", module);
+			return;
+		}
+		r = reg ? mt_find_reg(g_index, mx, reg) : NULL;
+		if (r == NULL) {
+			printf("Can't find register %s\n", reg);
+			return;
+		}
+		if (field == NULL || *field == 0) {
+			if (r->is_writable)
+				write_reg(mx->base_address + r->offset,
+					  r->width, g_value);
+			else
+				printf("%s.%s is not writable register\n",
+				       mx->name, r->name);
+			return;
 		}
-		printf("Can't find module %s\n", module);
+		f = mt_find_field(r, field);
+		if (f == NULL)
+			return;
+		if (f->is_writable)
+			write_reg_mask(mx->base_address + r->offset, r->width,
+				       g_value, f->lsb, f->msb);
+		else
+			printf("%s.%s.%s is not writable\n",
+			       mx->name, r->name, f->name);
 		return;
 	}
 
 	if (g_comp && !g_module_match) {
-		while (mx->name) {
-			if (module == NULL || strlen(module)==0 || (strncmp(mx->name, module, strlen(module)) == 0))
-				printf("%s.\n", mx->name);
-			mx++;
-		}
+		unsigned first, n, i;
 
+		/* only complete the module name, there is no register yet */
+		n = mt_module_range(g_index, module, &first);
+		for (i = 0; i < n; i++)
+			printf("%s.\n", mt_module_at(g_index, first + i)->name);
+		return;
 	} else if (module == NULL || *module == 0 || (str = strchr(module, '*'))) {	/* list all modules */
 		printf("   Module\t\tBase Address\n");
 		if (str)
@@ -448,19 +477,29 @@ void parse_module(char *module, char *reg, char *field, int iswrite)
 			return;
 	}
 
-	while (mx->name) {
-		if (strcmp(mx->name, module) == 0) {
-			if (!g_comp)
-				printf("%s\t Addr:0x%x \n", mx->name, mx->base_address);
-			parse_reg(mx, reg, field);
-			break;
-		}
-		mx++;
+	mx = mt_find_module(g_index, module);
+	if (mx) {
+		if (!g_comp)
+			printf("%s\t Addr:0x%x \n", mx->name, mx->base_address);
+		parse_reg(mx, reg, field);
 	}
 }
 
+/* a whole hex number, optionally ended by term instead of the string end */
+static int parse_hex(const char *str, char term, unsigned long *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtoul(str, &end, 16);
+	if (errno || end == str || *str == '-' || (*end && *end != term))
+		return -1;
+	return 0;
+}
+
 int parse_cmdline(int argc, char **argv)
 {
+	unsigned long val;
 	int cur_arg = 0;
 	char *str;
 
@@ -479,6 +518,13 @@ int parse_cmdline(int argc, char **argv)
 		g_size = 4;
 	}
 
+	if (cur_arg < argc && strcmp(argv[cur_arg], "-a") == 0) {
+		g_annotate = 1;
+		cur_arg++;
+		if (cur_arg >= argc)
+			return -1;
+	}
+
 	if (strcmp(argv[cur_arg], "-comp") == 0)
 	{
 		g_comp = 1;
@@ -519,17 +565,18 @@ int parse_cmdline(int argc, char **argv)
 				g_is_write = 1;
 				*equal = 0;
 				equal++;
-				g_value = strtoul(equal, NULL, 16);
-				return 0;
+				if (parse_hex(equal, 0, &val))
+					return -1;
+				g_value = val;
+				return cur_arg + 1 < argc ? -1 : 0;
 			}
 		}
-		return 0;
+		return cur_arg + 1 < argc ? -1 : 0;
 		//cur_arg++;
 	}
 
 	if (!g_is_reg) {
-		g_paddr = strtoul(argv[cur_arg], NULL, 16);
-		if (!g_paddr)
+		if (parse_hex(argv[cur_arg], '=', &g_paddr) || !g_paddr)
 			return -1;
 	}
 
@@ -537,8 +584,10 @@ int parse_cmdline(int argc, char **argv)
 		g_is_write = 1;
 		if (strlen(str) > 1) {
 			str++;
-			g_value = strtoul(str, NULL, 16);
-			return 0;
+			if (parse_hex(str, 0, &val))
+				return -1;
+			g_value = val;
+			return cur_arg + 1 < argc ? -1 : 0;
 		}
 	}
 	if (++cur_arg >= argc)
@@ -552,52 +601,179 @@ int parse_cmdline(int argc, char **argv)
 			if (++cur_arg >= argc)
 				return -1;
 		}
-		g_value = strtoul(argv[cur_arg], NULL, 16);
+		if (parse_hex(argv[cur_arg], 0, &val))
+			return -1;
+		g_value = val;
 	} else {
+		if (parse_hex(argv[cur_arg], 0, &val))
+			return -1;
 		if (g_is_write)
-			g_value = strtoul(argv[cur_arg], NULL, 16);
+			g_value = val;
 		else
-			g_count = strtoul(argv[cur_arg], NULL, 16);
+			g_count = val;
 	}
-	printf("E\n");
-	return 0;
+	/* anything left over means the command was not understood */
+	return cur_arg + 1 < argc ? -1 : 0;
 }
 
-void read_mem(void *addr, uint32_t count, uint32_t size)
+/*
+ * Output formatted into one large buffer and written with a single
+ * write(), flushing early only when the buffer fills.
+ */
+struct outbuf {
+	char *buf;
+	size_t len;
+	size_t size;
+	int fd;
+};
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+int ob_init(struct outbuf *ob, int fd, size_t size)
 {
-	int i;
-	uint8_t *addr8 = addr;
-	uint16_t *addr16 = addr;
-	uint32_t *addr32 = addr;
+	ob->buf = malloc(size);
+	ob->len = 0;
+	ob->size = size;
+	ob->fd = fd;
+	return ob->buf ? 0 : -1;
+}
 
-	switch (size) {
-	case 1:
-		for (i = 0; i < count; i++) {
-			if ((i % 16) == 0)
-				printf("\n0x%08lX: ", g_paddr);
-			printf(" %02X", addr8[i]);
-			g_paddr++;
+void ob_flush(struct outbuf *ob)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < ob->len) {
+		n = write(ob->fd, ob->buf + done, ob->len - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
 		}
-		break;
-	case 2:
-		for (i = 0; i < count; i++) {
-			if ((i % 8) == 0)
-				printf("\n0x%08lX: ", g_paddr);
-			printf(" %04X", addr16[i]);
-			g_paddr += 2;
+		done += n;
+	}
+	ob->len = 0;
+}
+
+void ob_free(struct outbuf *ob)
+{
+	ob_flush(ob);
+	free(ob->buf);
+}
+
+/* make room for n more bytes */
+static inline char *ob_reserve(struct outbuf *ob, size_t n)
+{
+	if (ob->len + n > ob->size)
+		ob_flush(ob);
+	return ob->buf + ob->len;
+}
+
+void ob_str(struct outbuf *ob, const char *str)
+{
+	size_t n = strlen(str);
+
+	memcpy(ob_reserve(ob, n), str, n);
+	ob->len += n;
+}
+
+void ob_hex(struct outbuf *ob, uint32_t value, int digits)
+{
+	char *p = ob_reserve(ob, digits);
+	int i;
+
+	for (i = digits - 1; i >= 0; i--, value >>= 4)
+		p[i] = hex_digits[value & 0xF];
+	ob->len += digits;
+}
+
+void ob_dec(struct outbuf *ob, uint64_t value)
+{
+	char tmp[24];
+	int i = sizeof(tmp);
+
+	do {
+		tmp[--i] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	memcpy(ob_reserve(ob, sizeof(tmp) - i), tmp + i, sizeof(tmp) - i);
+	ob->len += sizeof(tmp) - i;
+}
+
+void read_mem(void *addr, uint32_t count, uint32_t size)
+{
+	struct outbuf ob;
+	char line[32];
+	uint32_t value = 0;
+	int i, per_line = 16 / size;
+	size_t need;
+
+	/* 0x%08lX prefix per line, " %0*X" per element */
+	need = (size_t)count * (size * 2 + 1) + (count / per_line + 1) * 24 + 4;
+	if (ob_init(&ob, STDOUT_FILENO, need < OUTBUF_SIZE ? need : OUTBUF_SIZE))
+		die("out of memory\n");
+	fflush(stdout);
+
+	for (i = 0; i < count; i++) {
+		if ((i % per_line) == 0) {
+			snprintf(line, sizeof(line), "\n0x%08lX: ", g_paddr);
+			ob_str(&ob, line);
 		}
-		break;
-	case 4:
-		for (i = 0; i < count; i++) {
-			if ((i % 4) == 0)
-				printf("\n0x%08lX: ", g_paddr);
-			printf(" %08X", addr32[i]);
-			g_paddr += 4;
+		switch (size) {
+		case 1:
+			value = ((uint8_t *)addr)[i];
+			break;
+		case 2:
+			value = ((uint16_t *)addr)[i];
+			break;
+		case 4:
+			value = ((uint32_t *)addr)[i];
+			break;
 		}
-		break;
+		*ob_reserve(&ob, 1) = ' ';
+		ob.len++;
+		ob_hex(&ob, value, size * 2);
+		g_paddr += size;
 	}
-	printf("\n\n");
+	ob_str(&ob, "\n\n");
+	ob_free(&ob);
+}
 
+/* one element per line, followed by the registers it belongs to */
+void read_mem_annotated(void *addr, uint32_t count, uint32_t size)
+{
+	const struct mt_addr *a;
+	const module_t *m;
+	uint32_t value = 0;
+	unsigned n, j;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		switch (size) {
+		case 1:
+			value = ((uint8_t *)addr)[i];
+			break;
+		case 2:
+			value = ((uint16_t *)addr)[i];
+			break;
+		case 4:
+			value = ((uint32_t *)addr)[i];
+			break;
+		}
+		printf("0x%08lX: %0*X", g_paddr, size * 2, value);
+
+		n = mt_find_address(g_index, g_paddr, &a);
+		for (j = 0; j < n; j++) {
+			m = &g_index->modules[a[j].module];
+			printf("%s%s.%s", j ? ", " : "  ", m->name,
+			       m->regs[a[j].reg].name);
+			if (g_paddr != a[j].address)
+				printf("+%lu", g_paddr - a[j].address);
+		}
+		printf("\n");
+		g_paddr += size;
+	}
+	printf("\n");
 }
 
 void write_mem(void *addr, uint32_t value, uint32_t size)
@@ -619,32 +795,323 @@ void write_mem(void *addr, uint32_t value, uint32_t size)
 	}
 }
 
-int main(int argc, char **argv)
+/*
+ * Sampling: poll a set of addresses or named registers/fields at a fixed
+ * period into a ring of timestamped records, then dump the ring as CSV
+ * or as a binary trace:
+ *
+ *   struct sample_file_header, then target_count struct sample_file_target,
+ *   then record_count records of { uint64_t time_ns; uint32_t value[n]; }
+ *
+ * all little endian on the target, oldest record first.
+ */
+struct sample_target {
+	char name[48];
+	unsigned long address;
+	unsigned width;
+	unsigned lsb;
+	unsigned msb;
+	volatile void *ptr;
+	void *map;
+};
+
+struct sample_file_header {
+	char magic[8];			/* "MTTRACE1" */
+	uint32_t target_count;
+	uint32_t record_count;
+	uint64_t period_ns;
+	uint64_t late_count;		/* samples taken after their slot */
+};
+
+struct sample_file_target {
+	char name[48];
+	uint32_t address;
+	uint8_t width;
+	uint8_t lsb;
+	uint8_t msb;
+	uint8_t reserved;
+};
+
+struct sample_opts {
+	unsigned long period_us;
+	unsigned long count;		/* ring size */
+	unsigned long duration_ms;	/* 0: stop when the ring is full */
+	int busy_wait;
+	int binary;
+	const char *output;
+};
+
+volatile sig_atomic_t g_stop;
+
+void stop_sampling(int sig)
 {
-	int fd;
-	void *mem;
-	void *aligned_vaddr;
-	unsigned long aligned_paddr;
-	uint32_t aligned_size;
-	int page_size = getpagesize();
+	g_stop = 1;
+}
 
-	if (parse_cmdline(argc, argv)) {
-		printf("Usage:\n\n"
-		       "Read memory: memtool [-8 | -16 | -32] <phys addr> <count>\n"
-		       "Write memory: memtool [-8 | -16 | -32] <phys addr>=<value>\n\n"
-		       "List SOC module: memtool *. or memtool .\n"
-		       "Read register:  memtool UART1.*\n"
-		       "                memtool UART1.UMCR\n"
-		       "                memtool UART1.UMCR.MDEN\n"
-		       "		memtool UART1.-\n"
-		       "Write register: memtool UART.UMCR=0x12\n"
-		       "                memtool UART.UMCR.MDEN=0x1\n"
-		       "Default access size is 32-bit.\n\nAddress, count and value are all in hex.\n"
-		       "\nTo support autocompete feature please run below command:\n"
-		       "     complete -o nospace -C /unit_tests/memtool memtool\n");
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* resolve "[-8|-16|-32] addr" or "MODULE.REG[.FIELD]" into a target */
+int sample_target_parse(struct sample_target *t, char *arg, int size)
+{
+	const module_t *mx;
+	const reg_t *r;
+	const field_t *f;
+	char *reg, *field;
+
+	memset(t, 0, sizeof(*t));
+	reg = strchr(arg, '.');
+	if (reg == NULL) {
+		t->address = strtoul(arg, NULL, 16) & ~(unsigned long)(size - 1);
+		t->width = size;
+		t->msb = size * 8 - 1;
+		snprintf(t->name, sizeof(t->name), "0x%08lX", t->address);
+		return 0;
+	}
+
+	snprintf(t->name, sizeof(t->name), "%s", arg);
+	*reg++ = 0;
+	if ((field = strchr(reg, '.')))
+		*field++ = 0;
+
+	get_soc();
+	mx = mt_find_module(g_index, arg);
+	r = mx ? mt_find_reg(g_index, mx, reg) : NULL;
+	if (r == NULL) {
+		printf("Can't find register %s\n", t->name);
+		return -1;
+	}
+	t->address = mx->base_address + r->offset;
+	t->width = r->width;
+	t->msb = r->width * 8 - 1;
+	if (field && *field) {
+		f = mt_find_field(r, field);
+		if (f == NULL) {
+			printf("Can't find field %s\n", t->name);
+			return -1;
+		}
+		t->lsb = f->lsb;
+		t->msb = f->msb;
+	}
+	return 0;
+}
+
+/* each target gets its own mapping, the sampling loop never remaps */
+int sample_target_map(struct sample_target *t)
+{
+	unsigned long paddr = t->address & ~(unsigned long)(MAP_SIZE - 1);
+
+	t->map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_SHARED, g_fmem, paddr);
+	if (t->map == MAP_FAILED) {
+		printf("Can't map address 0x%08lX\n", paddr);
+		return -1;
+	}
+	t->ptr = (volatile uint8_t *)t->map + (t->address - paddr);
+	return 0;
+}
+
+static inline uint32_t sample_read(const struct sample_target *t)
+{
+	uint32_t v;
+
+	switch (t->width) {
+	case 1:
+		v = *(volatile uint8_t *)t->ptr;
+		break;
+	case 2:
+		v = *(volatile uint16_t *)t->ptr;
+		break;
+	default:
+		v = *(volatile uint32_t *)t->ptr;
+		break;
+	}
+	return (v >> t->lsb) & (0xFFFFFFFF >> (31 - (t->msb - t->lsb)));
+}
+
+void sample_dump(struct sample_opts *o, struct sample_target *targets, int n,
+		 const uint64_t *ring, unsigned long head, uint64_t late)
+{
+	struct sample_file_header hdr;
+	struct sample_file_target ft;
+	struct outbuf ob;
+	unsigned long records = head < o->count ? head : o->count;
+	unsigned long i, slot, stride = 2 + (n + 1) / 2;
+	const uint32_t *v;
+	int fd = STDOUT_FILENO, j;
+
+	if (o->output) {
+		fd = open(o->output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			printf("Can't create %s\n", o->output);
+			return;
+		}
+	}
+	fflush(stdout);
+	if (ob_init(&ob, fd, OUTBUF_SIZE))
+		die("out of memory\n");
+
+	if (o->binary) {
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, "MTTRACE1", 8);
+		hdr.target_count = n;
+		hdr.record_count = records;
+		hdr.period_ns = o->period_us * 1000ULL;
+		hdr.late_count = late;
+		memcpy(ob_reserve(&ob, sizeof(hdr)), &hdr, sizeof(hdr));
+		ob.len += sizeof(hdr);
+		for (j = 0; j < n; j++) {
+			memset(&ft, 0, sizeof(ft));
+			memcpy(ft.name, targets[j].name, sizeof(ft.name) - 1);
+			ft.address = targets[j].address;
+			ft.width = targets[j].width;
+			ft.lsb = targets[j].lsb;
+			ft.msb = targets[j].msb;
+			memcpy(ob_reserve(&ob, sizeof(ft)), &ft, sizeof(ft));
+			ob.len += sizeof(ft);
+		}
+	} else {
+		ob_str(&ob, "time_ns");
+		for (j = 0; j < n; j++) {
+			ob_str(&ob, ",");
+			ob_str(&ob, targets[j].name);
+		}
+		ob_str(&ob, "\n");
+	}
+
+	for (i = 0; i < records; i++) {
+		slot = (head - records + i) % o->count;
+		if (o->binary) {
+			size_t len = 8 + n * 4;
+
+			memcpy(ob_reserve(&ob, len), &ring[slot * stride], len);
+			ob.len += len;
+			continue;
+		}
+		ob_dec(&ob, ring[slot * stride]);
+		v = (const uint32_t *)&ring[slot * stride + 1];
+		for (j = 0; j < n; j++) {
+			ob_str(&ob, ",0x");
+			ob_hex(&ob, v[j], (targets[j].msb - targets[j].lsb) / 4 + 1);
+		}
+		ob_str(&ob, "\n");
+	}
+	ob_free(&ob);
+	if (fd != STDOUT_FILENO)
+		close(fd);
+}
+
+/*
+ * Poll the targets every period. Timestamps are relative to the first
+ * sample; a record is { time, values } packed into 64-bit ring slots.
+ */
+int run_sampling(struct sample_opts *o, int argc, char **argv)
+{
+	struct sample_target targets[SAMPLE_MAX_TARGETS];
+	uint64_t *ring, *rec;
+	uint64_t start, next, t, period, lateness, late = 0, max_late = 0;
+	uint64_t duration = o->duration_ms * 1000000ULL;
+	unsigned long head = 0, stride;
+	struct timespec ts;
+	uint32_t *v;
+	int i, n = 0, size = 4, ret = 0;
+
+	open_mem_file();
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-8") == 0) {
+			size = 1;
+		} else if (strcmp(argv[i], "-16") == 0) {
+			size = 2;
+		} else if (strcmp(argv[i], "-32") == 0) {
+			size = 4;
+		} else if (n == SAMPLE_MAX_TARGETS) {
+			printf("At most %d targets\n", SAMPLE_MAX_TARGETS);
+			return 1;
+		} else {
+			if (sample_target_parse(&targets[n], argv[i], size) ||
+			    sample_target_map(&targets[n]))
+				return 1;
+			n++;
+		}
+	}
+	if (n == 0 || o->period_us == 0 || o->count == 0) {
+		printf("Nothing to sample\n");
 		return 1;
 	}
 
+	stride = 2 + (n + 1) / 2;
+	ring = calloc(o->count, stride * sizeof(*ring));
+	if (ring == NULL)
+		die("out of memory\n");
+
+	signal(SIGINT, stop_sampling);
+	signal(SIGTERM, stop_sampling);
+	period = o->period_us * 1000ULL;
+	start = next = now_ns();
+
+	while (!g_stop) {
+		if (o->busy_wait) {
+			while ((t = now_ns()) < next && !g_stop)
+				;
+		} else {
+			ts.tv_sec = next / 1000000000ULL;
+			ts.tv_nsec = next % 1000000000ULL;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					       &ts, NULL) == EINTR && !g_stop)
+				;
+			t = now_ns();
+		}
+		/* woken early by a signal, there is no sample due */
+		if (g_stop)
+			break;
+
+		rec = &ring[(head % o->count) * stride];
+		rec[0] = t - start;
+		v = (uint32_t *)&rec[1];
+		for (i = 0; i < n; i++)
+			v[i] = sample_read(&targets[i]);
+		head++;
+
+		lateness = t > next ? t - next : 0;
+		if (lateness > max_late)
+			max_late = lateness;
+		if (duration ? t - start >= duration : head == o->count)
+			break;
+
+		/* skip the slots we overslept instead of bunching up */
+		next += period;
+		if (t >= next) {
+			late += (t - next) / period + 1;
+			next += ((t - next) / period + 1) * period;
+		}
+	}
+
+	fprintf(stderr, "%lu samples of %d targets in %.3f ms, %llu slots missed, "
+		"max wakeup latency %.1f us\n", head, n,
+		(now_ns() - start) / 1e6, (unsigned long long)late, max_late / 1e3);
+
+	sample_dump(o, targets, n, ring, head, late);
+
+	for (i = 0; i < n; i++)
+		munmap(targets[i].map, MAP_SIZE);
+	free(ring);
+	return ret;
+}
+
+/* run the access parsed by parse_cmdline() */
+int do_command(void)
+{
+	void *mem;
+	void *aligned_vaddr = NULL;
+	unsigned long aligned_paddr;
+	uint32_t aligned_size = 0;
+	unsigned long offset;
+	int page_size = getpagesize();
+
 	if (g_is_reg || g_comp) {
 		parse_module(g_module, g_reg, g_field, g_is_write);
 		return 0;
@@ -652,10 +1119,6 @@ int main(int argc, char **argv)
 	/* Align address to access size */
 	g_paddr &= ~(g_size - 1);
 
-	aligned_paddr = g_paddr & ~(page_size - 1);
-	aligned_size = g_paddr - aligned_paddr + (g_count * g_size);
-	aligned_size = (aligned_size + page_size - 1) & ~(page_size - 1);
-
 	if (g_is_write)
 		printf("Writing %d-bit value 0x%X to address 0x%08lX\n",
 		       g_size * 8, g_value, g_paddr);
@@ -663,33 +1126,212 @@ int main(int argc, char **argv)
 		printf("Reading 0x%X count starting at address 0x%08lX\n",
 		       g_count, g_paddr);
 
-	if ((fd = open("/dev/mem", O_RDWR | O_SYNC, 0)) < 0)
-		return 1;
+	if (g_annotate && !g_is_write)
+		get_soc();
 
-	aligned_vaddr =
-	    mmap(NULL, aligned_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
-		 aligned_paddr);
-	if (aligned_vaddr == NULL) {
-		printf("Error mapping address\n");
-		close(fd);
-		return 1;
-	}
+	open_mem_file();
 
-	mem = aligned_vaddr + (g_paddr - aligned_paddr);
+	offset = g_paddr & (MAP_SIZE - 1);
+	if (offset + (unsigned long)g_count * g_size <= MAP_SIZE) {
+		/* fits in one cached window */
+		mem = (void *)(map_address(g_paddr) + offset);
+	} else {
+		aligned_paddr = g_paddr & ~(page_size - 1);
+		aligned_size = g_paddr - aligned_paddr + (g_count * g_size);
+		aligned_size = (aligned_size + page_size - 1) & ~(page_size - 1);
+
+		aligned_vaddr =
+		    mmap(NULL, aligned_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 g_fmem, aligned_paddr);
+		if (aligned_vaddr == MAP_FAILED) {
+			printf("Error mapping address\n");
+			return 1;
+		}
+		mem = aligned_vaddr + (g_paddr - aligned_paddr);
+	}
 
 	if (g_is_write) {
 		write_mem(mem, g_value, g_size);
+	} else if (g_annotate) {
+		read_mem_annotated(mem, g_count, g_size);
 	} else {
 		read_mem(mem, g_count, g_size);
 	}
 
-	munmap(aligned_vaddr, aligned_size);
-	close(fd);
+	if (aligned_vaddr)
+		munmap(aligned_vaddr, aligned_size);
+	return 0;
+}
+
+/* back to the defaults before parsing the next batch line */
+void reset_cmdline(void)
+{
+	g_size = 4;
+	g_paddr = 0;
+	g_is_write = 0;
+	g_value = 0;
+	g_count = 1;
+	g_is_reg = 0;
+	g_module = NULL;
+	g_reg = NULL;
+	g_field = NULL;
+	g_comp = 0;
+	g_module_match = 0;
+	g_annotate = 0;
+}
+
+double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
 
-	if (g_map_vaddr)
-		munmap((void *)g_map_vaddr, MAP_SIZE);
-	if (g_fmem)
+/*
+ * Run one command per line of the script ("-" for stdin), with the same
+ * syntax as the command line, e.g. "-16 20e0000 4" or "UART1.UCR1.TXEN=1".
+ * '#' starts a comment. Lines that don't parse are reported and skipped,
+ * and make the batch exit non-zero.
+ */
+int run_batch(const char *script, int timing)
+{
+	FILE *fp = stdin;
+	char line[1024];
+	char *argv[BATCH_MAX_ARGS + 1];
+	char *tok, *save;
+	int argc, lineno = 0, ops = 0, errors = 0;
+	double t0, t, total = 0;
+
+	if (strcmp(script, "-")) {
+		fp = fopen(script, "r");
+		if (fp == NULL) {
+			printf("Can't open script %s\n", script);
+			return 1;
+		}
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if ((tok = strchr(line, '#')))
+			*tok = 0;
+
+		argv[0] = "batch";
+		argc = 1;
+		for (tok = strtok_r(line, " \t\r\n", &save);
+		     tok && argc < BATCH_MAX_ARGS;
+		     tok = strtok_r(NULL, " \t\r\n", &save))
+			argv[argc++] = tok;
+		argv[argc] = NULL;
+		if (argc == 1)
+			continue;
+
+		reset_cmdline();
+		/* never guess: a line that doesn't parse is not run at all */
+		if (tok || parse_cmdline(argc, argv) || g_comp) {
+			printf("line %d: bad command\n", lineno);
+			errors++;
+			continue;
+		}
+
+		t0 = now_us();
+		if (do_command())
+			errors++;
+		t = now_us() - t0;
+		total += t;
+		ops++;
+		if (timing)
+			printf("# line %d: %.1f us\n", lineno, t);
+	}
+
+	if (fp != stdin)
+		fclose(fp);
+	if (timing)
+		printf("# %d ops in %.1f us, %lu window hits, %lu maps\n",
+		       ops, total, g_map_hits, g_map_misses);
+	return errors ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *script = NULL;
+	struct sample_opts sample = { 0, SAMPLE_DEFAULT_COUNT, 0, 0, 0, NULL };
+	int timing = 0;
+	int ret;
+
+	/* batch and backing memory options come first */
+	while (argc > 1 && argv[1][0] == '-' && argv[1][1] &&
+	       strchr("fmMtSNTBxo", argv[1][1]) && argv[1][2] == 0) {
+		char opt = argv[1][1];
+		int used = 1;
+
+		if (!strchr("tBx", opt)) {
+			if (argc < 3)
+				break;
+			used = 2;
+		}
+		if (opt == 't')
+			timing = 1;
+		else if (opt == 'B')
+			sample.busy_wait = 1;
+		else if (opt == 'x')
+			sample.binary = 1;
+		else if (opt == 'f')
+			script = argv[2];
+		else if (opt == 'm')
+			g_mem_path = argv[2];
+		else if (opt == 'M')
+			g_mem_size = strtoul(argv[2], NULL, 0);
+		else if (opt == 'S')
+			sample.period_us = strtoul(argv[2], NULL, 0);
+		else if (opt == 'N')
+			sample.count = strtoul(argv[2], NULL, 0);
+		else if (opt == 'T')
+			sample.duration_ms = strtoul(argv[2], NULL, 0);
+		else
+			sample.output = argv[2];
+
+		argv[used] = argv[0];
+		argc -= used;
+		argv += used;
+	}
+
+	if (sample.period_us) {
+		ret = run_sampling(&sample, argc, argv);
+	} else if (script) {
+		ret = run_batch(script, timing);
+	} else if (parse_cmdline(argc, argv)) {
+		printf("Usage:\n\n"
+		       "Read memory: memtool [-8 | -16 | -32] <phys addr> <count>\n"
+		       "Read memory with register names: memtool [-8 | -16 | -32] -a <phys addr> <count>\n"
+		       "Write memory: memtool [-8 | -16 | -32] <phys addr>=<value>\n\n"
+		       "List SOC module: memtool *. or memtool .\n"
+		       "Read register:  memtool UART1.*\n"
+		       "                memtool UART1.UMCR\n"
+		       "                memtool UART1.UMCR.MDEN\n"
+		       "		memtool UART1.-\n"
+		       "Write register: memtool UART.UMCR=0x12\n"
+		       "                memtool UART.UMCR.MDEN=0x1\n"
+		       "Default access size is 32-bit.\n\nAddress, count and value are all in hex.\n"
+		       "\nBatch mode:     memtool [-t] -f <script | ->\n"
+		       "                one command per line as above, -t times each one\n"
+		       "Memory file:    memtool -m <file> ...   access a file instead of /dev/mem\n"
+		       "                memtool -M <size> ...   access a memfd of that size\n"
+		       "Sampling:       memtool -S <period us> [-N <samples>] [-T <ms>] [-B] [-x] [-o <file>]\n"
+		       "                        [-8 | -16 | -32] <phys addr | MODULE.REG[.FIELD]>...\n"
+		       "                keeps the last N samples (default 65536) until N are taken,\n"
+		       "                T ms have passed or Ctrl-C, then dumps them as CSV\n"
+		       "                (-x: binary trace). -B busy-waits instead of sleeping.\n"
+		       "\nTo support autocompete feature please run below command:\n"
+		       "     complete -o nospace -C /unit_tests/memtool memtool\n");
+		return 1;
+	} else {
+		ret = do_command();
+	}
+
+	unmap_all();
+	if (g_fmem >= 0)
 		close(g_fmem);
 
-	return 0;
+	return ret;
 }
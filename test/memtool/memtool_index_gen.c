@@ -0,0 +1,90 @@
+/*
+ * Copyright 2020 NXP
+ */
+
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+/*
+ * Build host tool: sorts the module tables of every SoC with the runtime
+ * index builder (memtool_lookup.c built with MEMTOOL_RUNTIME_INDEX) and
+ * prints the result as C, which becomes memtool_index.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "memtool_lookup.h"
+
+static void print_u16(const char *sym, const char *suffix,
+		      const uint16_t *v, unsigned n)
+{
+	unsigned i;
+
+	printf("static const uint16_t %s_%s[] = {", sym, suffix);
+	for (i = 0; i < n; i++)
+		printf("%s%u,", (i % 16) ? " " : "\n\t", v[i]);
+	printf("\n};\n\n");
+}
+
+static void print_index(const struct mt_soc *soc, const struct mt_index *idx)
+{
+	unsigned i, regs = 0;
+
+	/* reg_order holds one run per distinct regs array */
+	for (i = 0; i < idx->module_count; i++)
+		if (idx->reg_start[i] + idx->modules[i].reg_count > regs)
+			regs = idx->reg_start[i] + idx->modules[i].reg_count;
+
+	print_u16(soc->symbol, "module_order", idx->module_order,
+		  idx->module_count);
+
+	printf("static const uint32_t %s_reg_start[] = {", soc->symbol);
+	for (i = 0; i < idx->module_count; i++)
+		printf("%s%u,", (i % 8) ? " " : "\n\t", idx->reg_start[i]);
+	printf("\n};\n\n");
+
+	print_u16(soc->symbol, "reg_order", idx->reg_order, regs);
+
+	printf("static const struct mt_addr %s_addr_map[] = {\n", soc->symbol);
+	for (i = 0; i < idx->addr_count; i++)
+		printf("\t{ 0x%08x, %u, %u },\n", idx->addr_map[i].address,
+		       idx->addr_map[i].module, idx->addr_map[i].reg);
+	printf("};\n\n");
+}
+
+int main(void)
+{
+	const struct mt_soc *soc;
+	const struct mt_index *idx;
+
+	printf("/* Generated by memtool_index_gen, do not edit. */\n\n"
+	       "#include <stddef.h>\n"
+	       "#include \"memtool_lookup.h\"\n\n");
+
+	for (soc = mt_socs; soc->soc_id; soc++) {
+		idx = mt_index_get(soc->modules);
+		if (idx == NULL) {
+			fprintf(stderr, "can't index %s\n", soc->symbol);
+			return 1;
+		}
+		printf("extern const module_t %s[];\n\n", soc->symbol);
+		print_index(soc, idx);
+	}
+
+	printf("const struct mt_index mt_index_table[] = {\n");
+	for (soc = mt_socs; soc->soc_id; soc++) {
+		idx = mt_index_get(soc->modules);
+		printf("\t{ %s, %u, %s_module_order, %s_reg_start, %s_reg_order, "
+		       "%u, %s_addr_map },\n", soc->symbol, idx->module_count,
+		       soc->symbol, soc->symbol, soc->symbol, idx->addr_count,
+		       soc->symbol);
+	}
+	printf("\t{ NULL }\n};\n");
+	return 0;
+}
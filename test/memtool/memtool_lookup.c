@@ -0,0 +1,320 @@
+/*
+ * Copyright 2020 NXP
+ */
+
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memtool_lookup.h"
+
+extern const module_t mx6q[];
+extern const module_t mx6dl[];
+extern const module_t mx6sl[];
+extern const module_t mx6sx[];
+extern const module_t mx6ul[];
+extern const module_t mx7d[];
+extern const module_t mx6ull[];
+extern const module_t mx7ulp[];
+extern const module_t imx8mq7dvajz[];
+extern const module_t imx8mm7dvajz[];
+
+const struct mt_soc mt_socs[] = {
+	{ "i.MX6Q", "mx6q", mx6q },
+	{ "i.MX6DL", "mx6dl", mx6dl },
+	{ "i.MX6SL", "mx6sl", mx6sl },
+	{ "i.MX6SX", "mx6sx", mx6sx },
+	{ "i.MX6UL", "mx6ul", mx6ul },
+	{ "i.MX7D", "mx7d", mx7d },
+	{ "i.MX6ULL", "mx6ull", mx6ull },
+	{ "i.MX7ULP", "mx7ulp", mx7ulp },
+	{ "i.MX8MQ", "imx8mq7dvajz", imx8mq7dvajz },
+	{ "i.MX8MM", "imx8mm7dvajz", imx8mm7dvajz },
+	{ NULL, NULL, NULL }
+};
+
+const module_t *mt_soc_modules(const char *soc_id)
+{
+	const struct mt_soc *soc;
+
+	for (soc = mt_socs; soc->soc_id; soc++)
+		if (strcmp(soc->soc_id, soc_id) == 0)
+			return soc->modules;
+	return NULL;
+}
+
+#ifdef MEMTOOL_RUNTIME_INDEX
+
+#define MT_MAX_SOCS 16
+
+static struct mt_index g_built[MT_MAX_SOCS];
+static const module_t *g_sort_modules;
+static const reg_t *g_sort_regs;
+
+static int cmp_module(const void *a, const void *b)
+{
+	uint16_t ia = *(const uint16_t *)a, ib = *(const uint16_t *)b;
+	int r = strcmp(g_sort_modules[ia].name, g_sort_modules[ib].name);
+
+	return r ? r : ia - ib;
+}
+
+static int cmp_reg(const void *a, const void *b)
+{
+	uint16_t ia = *(const uint16_t *)a, ib = *(const uint16_t *)b;
+	int r = strcmp(g_sort_regs[ia].name, g_sort_regs[ib].name);
+
+	return r ? r : ia - ib;
+}
+
+static int cmp_addr(const void *a, const void *b)
+{
+	const struct mt_addr *x = a, *y = b;
+
+	if (x->address != y->address)
+		return x->address < y->address ? -1 : 1;
+	if (x->module != y->module)
+		return x->module - y->module;
+	return x->reg - y->reg;
+}
+
+/* sort the name and address tables of one SoC */
+static int build_index(struct mt_index *idx, const module_t *modules)
+{
+	uint16_t *module_order, *reg_order;
+	uint32_t *reg_start;
+	struct mt_addr *addr_map;
+	unsigned n, m, i, regs = 0, pos = 0, a = 0;
+
+	for (n = 0; modules[n].name; n++)
+		regs += modules[n].reg_count;
+
+	module_order = malloc(n * sizeof(*module_order) + 1);
+	reg_start = malloc(n * sizeof(*reg_start) + 1);
+	reg_order = malloc(regs * sizeof(*reg_order) + 1);
+	addr_map = malloc(regs * sizeof(*addr_map) + 1);
+	if (!module_order || !reg_start || !reg_order || !addr_map) {
+		free(module_order);
+		free(reg_start);
+		free(reg_order);
+		free(addr_map);
+		return -1;
+	}
+
+	for (m = 0; m < n; m++)
+		module_order[m] = m;
+	g_sort_modules = modules;
+	qsort(module_order, n, sizeof(*module_order), cmp_module);
+
+	for (m = 0; m < n; m++) {
+		/* instances of one block (UART1..UART5) share the reg order */
+		for (i = 0; i < m; i++)
+			if (modules[i].regs == modules[m].regs &&
+			    modules[i].reg_count == modules[m].reg_count)
+				break;
+		if (i < m) {
+			reg_start[m] = reg_start[i];
+		} else {
+			reg_start[m] = pos;
+			for (i = 0; i < modules[m].reg_count; i++)
+				reg_order[pos + i] = i;
+			g_sort_regs = modules[m].regs;
+			qsort(reg_order + pos, modules[m].reg_count,
+			      sizeof(*reg_order), cmp_reg);
+			pos += modules[m].reg_count;
+		}
+
+		for (i = 0; i < modules[m].reg_count; i++, a++) {
+			addr_map[a].address = modules[m].base_address +
+					      modules[m].regs[i].offset;
+			addr_map[a].module = m;
+			addr_map[a].reg = i;
+		}
+	}
+	qsort(addr_map, a, sizeof(*addr_map), cmp_addr);
+
+	idx->modules = modules;
+	idx->module_count = n;
+	idx->module_order = module_order;
+	idx->reg_start = reg_start;
+	idx->reg_order = reg_order;
+	idx->addr_count = a;
+	idx->addr_map = addr_map;
+	return 0;
+}
+
+const struct mt_index *mt_index_get(const module_t *modules)
+{
+	int i;
+
+	if (!modules)
+		return NULL;
+	for (i = 0; i < MT_MAX_SOCS; i++) {
+		if (g_built[i].modules == modules)
+			return &g_built[i];
+		if (g_built[i].modules == NULL)
+			return build_index(&g_built[i], modules) ? NULL : &g_built[i];
+	}
+	return NULL;
+}
+
+#else
+
+/* generated by memtool_index_gen, terminated by a NULL modules entry */
+extern const struct mt_index mt_index_table[];
+
+const struct mt_index *mt_index_get(const module_t *modules)
+{
+	const struct mt_index *idx;
+
+	for (idx = mt_index_table; idx->modules; idx++)
+		if (idx->modules == modules)
+			return idx;
+	return NULL;
+}
+
+#endif
+
+/* first sorted module position whose name is not below key */
+static unsigned module_lower(const struct mt_index *idx, const char *key)
+{
+	unsigned lo = 0, hi = idx->module_count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strcmp(idx->modules[idx->module_order[mid]].name, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static unsigned reg_lower(const struct mt_index *idx, const module_t *mod,
+			  const char *key)
+{
+	const uint16_t *order = idx->reg_order + idx->reg_start[mod - idx->modules];
+	unsigned lo = 0, hi = mod->reg_count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strcmp(mod->regs[order[mid]].name, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+const module_t *mt_module_at(const struct mt_index *idx, unsigned pos)
+{
+	return &idx->modules[idx->module_order[pos]];
+}
+
+const reg_t *mt_reg_at(const struct mt_index *idx, const module_t *mod,
+		       unsigned pos)
+{
+	return &mod->regs[idx->reg_order[idx->reg_start[mod - idx->modules] + pos]];
+}
+
+const module_t *mt_find_module(const struct mt_index *idx, const char *name)
+{
+	unsigned pos = module_lower(idx, name);
+
+	if (pos < idx->module_count &&
+	    strcmp(mt_module_at(idx, pos)->name, name) == 0)
+		return mt_module_at(idx, pos);
+	return NULL;
+}
+
+const reg_t *mt_find_reg(const struct mt_index *idx, const module_t *mod,
+			 const char *name)
+{
+	unsigned pos = reg_lower(idx, mod, name);
+
+	if (pos < mod->reg_count && strcmp(mt_reg_at(idx, mod, pos)->name, name) == 0)
+		return mt_reg_at(idx, mod, pos);
+	return NULL;
+}
+
+/* a register has at most 32 fields, a walk is as fast as any index */
+const field_t *mt_find_field(const reg_t *reg, const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < reg->field_count; i++)
+		if (strcmp(reg->fields[i].name, name) == 0)
+			return &reg->fields[i];
+	return NULL;
+}
+
+unsigned mt_module_range(const struct mt_index *idx, const char *prefix,
+			 unsigned *first)
+{
+	size_t len;
+	unsigned pos, end;
+
+	if (prefix == NULL)
+		prefix = "";
+	len = strlen(prefix);
+	pos = len ? module_lower(idx, prefix) : 0;
+	for (end = pos; end < idx->module_count; end++)
+		if (strncmp(mt_module_at(idx, end)->name, prefix, len))
+			break;
+	*first = pos;
+	return end - pos;
+}
+
+unsigned mt_reg_range(const struct mt_index *idx, const module_t *mod,
+		      const char *prefix, unsigned *first)
+{
+	size_t len;
+	unsigned pos, end;
+
+	if (prefix == NULL)
+		prefix = "";
+	len = strlen(prefix);
+	pos = len ? reg_lower(idx, mod, prefix) : 0;
+	for (end = pos; end < mod->reg_count; end++)
+		if (strncmp(mt_reg_at(idx, mod, end)->name, prefix, len))
+			break;
+	*first = pos;
+	return end - pos;
+}
+
+unsigned mt_find_address(const struct mt_index *idx, uint32_t address,
+			 const struct mt_addr **first)
+{
+	const struct mt_addr *map = idx->addr_map;
+	const reg_t *reg;
+	unsigned lo = 0, hi = idx->addr_count, mid, start;
+
+	/* last entry at or below the address */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (map[mid].address <= address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return 0;
+
+	reg = &idx->modules[map[lo - 1].module].regs[map[lo - 1].reg];
+	if (address - map[lo - 1].address >= reg->width)
+		return 0;
+
+	for (start = lo - 1; start > 0; start--)
+		if (map[start - 1].address != map[lo - 1].address)
+			break;
+	*first = &map[start];
+	return lo - start;
+}
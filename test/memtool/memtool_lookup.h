@@ -0,0 +1,85 @@
+/*
+ * Copyright 2020 NXP
+ */
+
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#if !defined(__MEMTOOL_LOOKUP_H__)
+#define __MEMTOOL_LOOKUP_H__
+
+#include <stdint.h>
+#include "memtools_register_info.h"
+
+/*
+ * Name and address index over one SoC's module_t table.
+ *
+ * The index is generated at build time by memtool_index_gen (see the
+ * Makefile) into memtool_index.c, so a lookup never walks the tables.
+ * Built with MEMTOOL_RUNTIME_INDEX the same index is instead sorted on
+ * first use, which is how the generator itself gets it.
+ */
+
+/* one register instance, in the address map */
+struct mt_addr {
+	uint32_t address;
+	uint16_t module;	/* index into the SoC's module_t table */
+	uint16_t reg;		/* index into that module's regs */
+};
+
+struct mt_index {
+	const module_t *modules;
+	unsigned module_count;
+	const uint16_t *module_order;	/* module indices sorted by name */
+	const uint32_t *reg_start;	/* per module, first entry in reg_order */
+	const uint16_t *reg_order;	/* per module, reg indices sorted by name */
+	unsigned addr_count;
+	const struct mt_addr *addr_map;	/* sorted by address */
+};
+
+/* SoC name as in /sys/devices/soc0/soc_id, and its module table */
+struct mt_soc {
+	const char *soc_id;
+	const char *symbol;	/* name of the module table */
+	const module_t *modules;
+};
+
+extern const struct mt_soc mt_socs[];
+
+const module_t *mt_soc_modules(const char *soc_id);
+const struct mt_index *mt_index_get(const module_t *modules);
+
+/* exact name lookups, NULL when there is no such name */
+const module_t *mt_find_module(const struct mt_index *idx, const char *name);
+const reg_t *mt_find_reg(const struct mt_index *idx, const module_t *mod,
+			 const char *name);
+const field_t *mt_find_field(const reg_t *reg, const char *name);
+
+/*
+ * Prefix ranges for completion. Both return how many names start with
+ * prefix and set *first to the sorted position of the first one; walk
+ * them with mt_module_at()/mt_reg_at().
+ */
+unsigned mt_module_range(const struct mt_index *idx, const char *prefix,
+			 unsigned *first);
+const module_t *mt_module_at(const struct mt_index *idx, unsigned pos);
+unsigned mt_reg_range(const struct mt_index *idx, const module_t *mod,
+		      const char *prefix, unsigned *first);
+const reg_t *mt_reg_at(const struct mt_index *idx, const module_t *mod,
+		       unsigned pos);
+
+/*
+ * Registers covering a physical address. Returns how many map entries
+ * (aliases of the same register, e.g. SDMAARM/SDMABP) start at the
+ * matching address, with *first pointing at the first one.
+ */
+unsigned mt_find_address(const struct mt_index *idx, uint32_t address,
+			 const struct mt_addr **first);
+
+#endif // __MEMTOOL_LOOKUP_H__
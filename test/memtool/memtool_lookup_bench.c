@@ -0,0 +1,215 @@
+/*
+ * Copyright 2020 NXP
+ */
+
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+/*
+ * Compares the memtool_lookup index with the linear strcmp walk over the
+ * module tables that memtool used before, for every SoC built in:
+ * exact MODULE.REG lookups, module name completion and address to
+ * register lookups. Needs no hardware.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "memtool_lookup.h"
+
+#define ROUNDS 20
+
+static volatile unsigned long g_sink;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const reg_t *walk_reg(const module_t *mx, const char *module,
+			     const char *reg)
+{
+	const reg_t *r;
+	unsigned i;
+
+	for (; mx->name; mx++) {
+		if (strcmp(mx->name, module))
+			continue;
+		for (i = 0, r = mx->regs; i < mx->reg_count; i++, r++)
+			if (strcmp(r->name, reg) == 0)
+				return r;
+		return NULL;
+	}
+	return NULL;
+}
+
+static unsigned walk_complete(const module_t *mx, const char *prefix)
+{
+	size_t len = strlen(prefix);
+	unsigned n = 0;
+
+	for (; mx->name; mx++)
+		if (strncmp(mx->name, prefix, len) == 0)
+			n++;
+	return n;
+}
+
+static const reg_t *walk_address(const module_t *mx, uint32_t address)
+{
+	unsigned i;
+
+	for (; mx->name; mx++)
+		for (i = 0; i < mx->reg_count; i++)
+			if (mx->base_address + mx->regs[i].offset == address)
+				return &mx->regs[i];
+	return NULL;
+}
+
+static void report(const char *what, unsigned ops, double walk, double index)
+{
+	printf("  %-10s %7u ops  walk %9.1f ns/op  index %7.1f ns/op  x%.1f\n",
+	       what, ops, walk / ops, index / ops, walk / index);
+}
+
+struct name {
+	const char *module;
+	const char *reg;
+	uint32_t address;
+};
+
+static int bench_soc(const struct mt_soc *soc)
+{
+	const module_t *mx, *m;
+	const struct mt_index *idx = mt_index_get(soc->modules);
+	const struct mt_addr *a;
+	const reg_t *r1, *r2;
+	struct name *names;
+	char (*prefixes)[4];
+	unsigned i, round, regs = 0, n = 0, np = 0, len, first;
+	unsigned long sum;
+	double t0, walk, index;
+	int bad = 0;
+
+	if (idx == NULL) {
+		printf("%s: no index\n", soc->soc_id);
+		return 1;
+	}
+	for (mx = soc->modules; mx->name; mx++)
+		regs += mx->reg_count;
+	printf("%s: %u modules, %u registers\n", soc->soc_id,
+	       idx->module_count, regs);
+	if (regs == 0)
+		return 0;
+
+	names = malloc(regs * sizeof(*names));
+	prefixes = malloc(idx->module_count * 3 * sizeof(*prefixes));
+	if (!names || !prefixes) {
+		printf("out of memory\n");
+		exit(1);
+	}
+	for (mx = soc->modules; mx->name; mx++) {
+		for (i = 0; i < mx->reg_count; i++, n++) {
+			names[n].module = mx->name;
+			names[n].reg = mx->regs[i].name;
+			names[n].address = mx->base_address + mx->regs[i].offset;
+		}
+		for (len = 1; len <= 3 && mx->name[len - 1]; len++, np++) {
+			strncpy(prefixes[np], mx->name, len);
+			prefixes[np][len] = 0;
+		}
+	}
+
+	/* both sides must agree before their speed matters */
+	for (i = 0; i < n; i++) {
+		r1 = walk_reg(soc->modules, names[i].module, names[i].reg);
+		m = mt_find_module(idx, names[i].module);
+		r2 = m ? mt_find_reg(idx, m, names[i].reg) : NULL;
+		if (r1 != r2)
+			bad++;
+
+		r1 = walk_address(soc->modules, names[i].address);
+		if (mt_find_address(idx, names[i].address, &a) == 0 ||
+		    idx->modules[a->module].base_address +
+		    idx->modules[a->module].regs[a->reg].offset != names[i].address ||
+		    r1 == NULL)
+			bad++;
+	}
+	for (i = 0; i < np; i++)
+		if (walk_complete(soc->modules, prefixes[i]) !=
+		    mt_module_range(idx, prefixes[i], &first))
+			bad++;
+
+	/* every MODULE.REG name */
+	sum = 0;
+	t0 = now_ns();
+	for (round = 0; round < ROUNDS; round++)
+		for (i = 0; i < n; i++)
+			sum += (unsigned long)walk_reg(soc->modules,
+						       names[i].module,
+						       names[i].reg);
+	walk = now_ns() - t0;
+	t0 = now_ns();
+	for (round = 0; round < ROUNDS; round++) {
+		for (i = 0; i < n; i++) {
+			m = mt_find_module(idx, names[i].module);
+			sum += (unsigned long)mt_find_reg(idx, m, names[i].reg);
+		}
+	}
+	index = now_ns() - t0;
+	report("lookup", n * ROUNDS, walk, index);
+
+	/* completion of every 1..3 character module name prefix */
+	t0 = now_ns();
+	for (round = 0; round < ROUNDS; round++)
+		for (i = 0; i < np; i++)
+			sum += walk_complete(soc->modules, prefixes[i]);
+	walk = now_ns() - t0;
+	t0 = now_ns();
+	for (round = 0; round < ROUNDS; round++)
+		for (i = 0; i < np; i++)
+			sum += mt_module_range(idx, prefixes[i], &first);
+	index = now_ns() - t0;
+	report("complete", np * ROUNDS, walk, index);
+
+	/* every register address */
+	t0 = now_ns();
+	for (round = 0; round < ROUNDS; round++)
+		for (i = 0; i < n; i++)
+			sum += (unsigned long)walk_address(soc->modules,
+							   names[i].address);
+	walk = now_ns() - t0;
+	t0 = now_ns();
+	for (round = 0; round < ROUNDS; round++)
+		for (i = 0; i < n; i++)
+			sum += mt_find_address(idx, names[i].address, &a);
+	index = now_ns() - t0;
+	report("address", n * ROUNDS, walk, index);
+
+	g_sink = sum;
+	free(names);
+	free(prefixes);
+	if (bad)
+		printf("  %d mismatches between walk and index\n", bad);
+	return bad != 0;
+}
+
+int main(int argc, char **argv)
+{
+	const struct mt_soc *soc;
+	int err = 0;
+
+	for (soc = mt_socs; soc->soc_id; soc++)
+		if (argc < 2 || strcmp(argv[1], soc->soc_id) == 0)
+			err |= bench_soc(soc);
+	return err;
+}
@@ -2,7 +2,7 @@
 LOCAL_PATH:= $(call my-dir)
 include $(CLEAR_VARS)
 
-LOCAL_SRC_FILES = mmdc.c
+LOCAL_SRC_FILES = mmdc.c mmdc_io.c mmdc_daemon.c
 LOCAL_MODULE := mmdc
 LOCAL_MODULE_TAGS := 	optional eng
 LOCAL_C_INCLUDES :=	mmdc.h
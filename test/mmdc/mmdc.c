@@ -31,7 +31,7 @@ pMMDC_t mmdc_p0 = (pMMDC_t)(MMDC_P0_IPS_BASE_ADDR);
 pMMDC_t mmdc_p1 = (pMMDC_t)(MMDC_P1_IPS_BASE_ADDR);
 int g_size = 4;
 unsigned int system_rev = 0;
-int g_quit = 0;
+volatile int g_quit = 0;
 /**************************** Functions ***************************************/
 static unsigned long getTickCount(void)
 {
@@ -43,135 +43,128 @@ static unsigned long getTickCount(void)
 
 /************************ Profiler Functions **********************************/
 
-void start_mmdc_profiling(pMMDC_t mmdc)
+void start_mmdc_profiling(pMMDC_IO_t mmdc)
 {
 	/* Reset counters and clear Overflow bit */
 	if(cpu_is_mx6qp() == 1)
-		mmdc->madpcr0 = 0x1A;
+		mmdc_write(mmdc, madpcr0, 0x1A);
 	else if( cpu_is_mx6q() == 1
 		|| cpu_is_mx6dl() == 1
 		|| cpu_is_mx6sl() == 1
 		|| cpu_is_mx6sx() == 1
 		|| cpu_is_mx6ul() == 1)
-		mmdc->madpcr0 = 0xA;
+		mmdc_write(mmdc, madpcr0, 0xA);
 	else
 		return;
-	msync(&(mmdc->madpcr0),4,MS_SYNC);
 
 	/* Enable counters */
 	if(cpu_is_mx6qp() == 1)
-		mmdc->madpcr0 = 0x11;
+		mmdc_write(mmdc, madpcr0, 0x11);
 	else if( cpu_is_mx6q() == 1
 		|| cpu_is_mx6dl() == 1
 		|| cpu_is_mx6sl() == 1
 		|| cpu_is_mx6sx() == 1
 		|| cpu_is_mx6ul() == 1)
-		mmdc->madpcr0 = 0x1;
+		mmdc_write(mmdc, madpcr0, 0x1);
 	else
 		return;
-	msync(&(mmdc->madpcr0),4,MS_SYNC);
 
 }
 
-void stop_mmdc_profiling(pMMDC_t mmdc)
+void stop_mmdc_profiling(pMMDC_IO_t mmdc)
 {
 	/* Disable counters */
 	if(cpu_is_mx6qp() == 1)
-		mmdc->madpcr0 = 0x10;
+		mmdc_write(mmdc, madpcr0, 0x10);
 	else if( cpu_is_mx6q() == 1
 		|| cpu_is_mx6dl() == 1
 		|| cpu_is_mx6sl() == 1
 		|| cpu_is_mx6sx() == 1)
-		mmdc->madpcr0 = 0x0;
+		mmdc_write(mmdc, madpcr0, 0x0);
 	else
 		return;
-	msync(&(mmdc->madpcr0),4,MS_SYNC);
 
 }
 
-void pause_mmdc_profiling(pMMDC_t mmdc)
+void pause_mmdc_profiling(pMMDC_IO_t mmdc)
 {
 	/* PRF_FRZ = 1 */
 	if(cpu_is_mx6qp() == 1)
-		mmdc->madpcr0 = 0x13;
+		mmdc_write(mmdc, madpcr0, 0x13);
 	else if( cpu_is_mx6q() == 1
 		|| cpu_is_mx6dl() == 1
 		|| cpu_is_mx6sl() == 1
 		|| cpu_is_mx6sx() == 1)
-		mmdc->madpcr0 = 0x3;
+		mmdc_write(mmdc, madpcr0, 0x3);
 	else
 		return;
-	msync(&(mmdc->madpcr0),4,MS_SYNC);
 }
 
-void resume_mmdc_profiling(pMMDC_t mmdc)
+void resume_mmdc_profiling(pMMDC_IO_t mmdc)
 {
 	/* PRF_FRZ = 0 */
 	if(cpu_is_mx6qp() == 1)
-		mmdc->madpcr0 = 0x11;
+		mmdc_write(mmdc, madpcr0, 0x11);
 	else if( cpu_is_mx6q() == 1
 		|| cpu_is_mx6dl() == 1
 		|| cpu_is_mx6sl() == 1
 		|| cpu_is_mx6sx() == 1)
-		mmdc->madpcr0 = 0x1;
+		mmdc_write(mmdc, madpcr0, 0x1);
 	else
 		return;
-	msync(&(mmdc->madpcr0),4,MS_SYNC);
 }
-void load_mmdc_results(pMMDC_t mmdc)
+void load_mmdc_results(pMMDC_IO_t mmdc)
 {
 	/* printf("before : mmdc->madpcr0 0x%x\n",mmdc->madpcr0);*/
 	/* sets the PRF_FRZ bit to 1 in order to load the results into the registers */
 	if(cpu_is_mx6qp() == 1)
-		mmdc->madpcr0 |= 0x14; 
+		mmdc_write(mmdc, madpcr0, mmdc_read(mmdc, madpcr0) | 0x14); 
 	else if( cpu_is_mx6q() == 1
 		|| cpu_is_mx6dl() == 1
 		|| cpu_is_mx6sl() == 1
 		|| cpu_is_mx6sx() == 1)
-		mmdc->madpcr0 |= 0x4;
+		mmdc_write(mmdc, madpcr0, mmdc_read(mmdc, madpcr0) | 0x4);
 	else
 		return;
 	/* printf("after : mmdc->madpcr0 0x%x\n",mmdc->madpcr0); */
-	msync(&(mmdc->madpcr0),4,MS_SYNC);
 }
 
-void clear_mmdc_results(pMMDC_t mmdc)
+void clear_mmdc_results(pMMDC_IO_t mmdc)
 {
 	/* Reset counters and clear Overflow bit */
 	if(cpu_is_mx6qp() == 1)
-		mmdc->madpcr0 = 0x1A;
+		mmdc_write(mmdc, madpcr0, 0x1A);
 	else if( cpu_is_mx6q() == 1
 		|| cpu_is_mx6dl() == 1
 		|| cpu_is_mx6sl() == 1
 		|| cpu_is_mx6sx() == 1)
-		mmdc->madpcr0 = 0xA;
+		mmdc_write(mmdc, madpcr0, 0xA);
 	else
 		return;
-	msync(&(mmdc->madpcr0),4,MS_SYNC);
 }
 
-void get_mmdc_profiling_results(pMMDC_t mmdc, MMDC_PROFILE_RES_t *results)
+void get_mmdc_profiling_results(pMMDC_IO_t mmdc, MMDC_PROFILE_RES_t *results)
 {
 	unsigned int bytewidth;
-	results->total_cycles 	= mmdc->madpsr0;
-	results->busy_cycles 	= mmdc->madpsr1;
-	results->read_accesses	= mmdc->madpsr2;
-	results->write_accesses	= mmdc->madpsr3;
-	results->read_bytes	= mmdc->madpsr4;
-	results->write_bytes	= mmdc->madpsr5;
-	bytewidth = 4 << ((mmdc->mdctl & 0x30000)>>16);
+	results->total_cycles 	= mmdc_read(mmdc, madpsr0);
+	results->busy_cycles 	= mmdc_read(mmdc, madpsr1);
+	results->read_accesses	= mmdc_read(mmdc, madpsr2);
+	results->write_accesses	= mmdc_read(mmdc, madpsr3);
+	results->read_bytes	= mmdc_read(mmdc, madpsr4);
+	results->write_bytes	= mmdc_read(mmdc, madpsr5);
+	bytewidth = 4 << ((mmdc_read(mmdc, mdctl) & 0x30000)>>16);
 	if(results->read_bytes!=0 || results->write_bytes!=0)
 	{
 		results->utilization	= (int)(((double)results->read_bytes+(double)results->write_bytes)/((double)results->busy_cycles * bytewidth) * 100);
 
 		results->data_load  	= (int)((float)results->busy_cycles/(float)results->total_cycles * 100);
 		results->access_utilization	= (int)(((double)results->read_bytes+(double)results->write_bytes)/((double)results->read_accesses + (double)results->write_accesses));
-		if(mmdc->madpsr3)
-			results->avg_write_burstsize = (int)mmdc->madpsr5 / mmdc->madpsr3;
+		if(results->write_accesses)
+			results->avg_write_burstsize = results->write_bytes / results->write_accesses;
 		else
 			results->avg_write_burstsize = 0;
-		if(mmdc->madpsr2)
-			results->avg_read_burstsize = (int)mmdc->madpsr4 / mmdc->madpsr2;
+		if(results->read_accesses)
+			results->avg_read_burstsize = results->read_bytes / results->read_accesses;
 		else
 			results->avg_read_burstsize = 0;
 	}
@@ -222,6 +215,83 @@ void print_mmdc_profiling_results(MMDC_PROFILE_RES_t results, MMDC_RES_TYPE_t pr
 	}
 }
 
+/**************************** AXI Masters *************************************/
+
+/* MADPCR1 AXI ID and mask per master name, searched in order */
+static const MMDC_MASTER_t mmdc_masters[] = {
+	{ "DSP1",	MXC_CPU_MX6SX,	axi_lcd1_6sx },
+	{ "DSP1",	MXC_CPU_MX6SL,	axi_lcd1_6sl },
+	{ "DSP1",	MXC_CPU_MX6UL,	axi_lcdif_6ul },
+	{ "DSP1",	MXC_CPU_ANY,	axi_ipu1 },
+	{ "DSP2",	MXC_CPU_MX6Q,	axi_ipu2_6q },
+	{ "DSP2",	MXC_CPU_MX6QP,	axi_ipu2_6qp },
+	{ "DSP2",	MXC_CPU_MX6SX,	axi_lcd2_6sx },
+	{ "M4",		MXC_CPU_MX6SX,	axi_m4_6sx },
+	{ "PXP",	MXC_CPU_MX6SX,	axi_pxp_6sx },
+	{ "PXP",	MXC_CPU_MX6UL,	axi_pxp_6ul },
+	{ "ENET1",	MXC_CPU_MX6UL,	axi_enet1_6ul },
+	{ "ENET2",	MXC_CPU_MX6UL,	axi_enet2_6ul },
+	{ "GPU3D",	MXC_CPU_MX6SX,	axi_gpu3d_6sx },
+	{ "GPU3D",	MXC_CPU_MX6DL,	axi_gpu3d_6dl },
+	{ "GPU3D",	MXC_CPU_MX6QP,	axi_gpu3dd0_6qp },
+	{ "GPU3D2",	MXC_CPU_MX6QP,	axi_gpu3dd1_6qp, "GPU3DD1" },
+	{ "GPU3D",	MXC_CPU_MX6Q,	axi_gpu3d_6q },
+	{ "GPU2D1",	MXC_CPU_MX6DL,	axi_gpu2d1_6dl },
+	{ "GPU2D",	MXC_CPU_MX6QP,	axi_gpu2d_6qp },
+	{ "GPU2D",	MXC_CPU_MX6Q,	axi_gpu2d_6q },
+	{ "GPU2D2",	MXC_CPU_MX6DL,	axi_gpu2d2_6dl },
+	{ "GPU2D",	MXC_CPU_MX6SL,	axi_gpu2d_6sl },
+	{ "VPU",	MXC_CPU_MX6DL,	axi_vpu_6dl },
+	{ "VPU",	MXC_CPU_MX6QP,	axi_vpu_6qp },
+	{ "VPU",	MXC_CPU_MX6Q,	axi_vpu_6q },
+	{ "PRE",	MXC_CPU_MX6QP,	axi_pre_6qp },
+	{ "PRE0",	MXC_CPU_MX6QP,	axi_pre0_6qp },
+	{ "PRE1",	MXC_CPU_MX6QP,	axi_pre1_6qp },
+	{ "PRE2",	MXC_CPU_MX6QP,	axi_pre2_6qp },
+	{ "PRE3",	MXC_CPU_MX6QP,	axi_pre3_6qp },
+	{ "GPUVG",	MXC_CPU_MX6Q,	axi_openvg_6q },
+	{ "GPUVG",	MXC_CPU_MX6QP,	axi_openvg_6qp },
+	{ "GPUVG",	MXC_CPU_MX6SL,	axi_openvg_6sl },
+	{ "USB",	MXC_CPU_MX6SX,	axi_usb_6sx },
+	{ "USB",	MXC_CPU_MX6SL,	axi_usb_6sl },
+	{ "USB",	MXC_CPU_MX6UL,	axi_usb_6ul },
+	{ "USB",	MXC_CPU_ANY,	axi_usb },
+	{ "ARM",	MXC_CPU_MX6SX,	axi_arm_6sx },
+	{ "ARM",	MXC_CPU_MX6UL,	axi_arm_6ul },
+	{ "ARM",	MXC_CPU_ANY,	axi_arm },
+	{ "SUM",	MXC_CPU_ANY,	axi_default },
+	{ NULL,		0,		0 }
+};
+
+const MMDC_MASTER_t *mmdc_find_master(const char *name)
+{
+	const MMDC_MASTER_t *m;
+
+	for (m = mmdc_masters; m->name; m++)
+		if ((m->cpu == MXC_CPU_ANY || mxc_is_cpu(m->cpu)) &&
+		    strcmp(m->name, name) == 0)
+			return m;
+	return NULL;
+}
+
+void mmdc_select_master(pMMDC_IO_t mmdc, unsigned int madpcr1)
+{
+	mmdc_write(mmdc, madpcr1, madpcr1);
+}
+
+/* SoC names as in /sys/devices/soc0/soc_id, for MMDC_SOC */
+static const struct {
+	const char *name;
+	unsigned int rev;
+} mmdc_socs[] = {
+	{ "i.MX6QP",	0x65000 },
+	{ "i.MX6Q",	0x63000 },
+	{ "i.MX6DL",	0x61000 },
+	{ "i.MX6SL",	0x60000 },
+	{ "i.MX6SX",	0x62000 },
+	{ "i.MX6UL",	0x64000 },
+};
+
 static int get_system_rev(void)
 {
 	FILE *fp;
@@ -230,6 +300,20 @@ static int get_system_rev(void)
 	char *tmp, *rev;
 	int rev_major, rev_minor;
 	int ret = -1;
+	unsigned int i;
+
+	tmp = getenv("MMDC_SOC");
+	if (tmp != NULL) {
+		for (i = 0; i < sizeof(mmdc_socs) / sizeof(mmdc_socs[0]); i++) {
+			if (strcmp(tmp, mmdc_socs[i].name) == 0) {
+				system_rev = mmdc_socs[i].rev;
+				printf("%s selected.\n", tmp);
+				return 0;
+			}
+		}
+		printf("MMDC_SOC: unknown SoC %s\n", tmp);
+		return ret;
+	}
 
 	fp = fopen("/proc/cpuinfo", "r");
 	if (fp == NULL) {
@@ -326,30 +410,90 @@ static int get_system_rev(void)
 
 void signalhandler(int signal)
 {
-	printf("singal %d received, quit the application.\n", signal);
 	g_quit = 1;
 }
 void help(void)
 {
-	printf("======================MMDC v1.3===========================\n");
-	printf("Usage: mmdc [ARM:DSP1:DSP2:GPU2D:GPU2D1:GPU2D2:GPU3D:GPU3D2:GPUVG:VPU:M4:PXP:USB:SUM] [...]\n");
+	printf("======================MMDC v1.4===========================\n");
+	printf("Usage: mmdc [-F fake] [ARM:DSP1:DSP2:GPU2D:GPU2D1:GPU2D2:GPU3D:GPU3D2:GPUVG:VPU:M4:PXP:USB:SUM] [...]\n");
+	printf("       mmdc -d [-i slice_ms] [-n depth] [-r rounds] [-o csv] [-s socket] [-F fake] MASTER [...]\n");
 	printf("export MMDC_SLEEPTIME can be used to define profiling duration, 500 by default means 0.5s\n");
 	printf("export MMDC_LOOPCOUNT can be used to define profiling times. 1 by default. -1 means infinite loop.\n");
 	printf("export MMDC_CUST_MADPCR1 can be used to customize madpcr1. Will ignore it if defined master\n");
+	printf("export MMDC_SOC (e.g. i.MX6QP) overrides the SoC detection, needed with -F\n");
 	printf("Note1: More than 1 master can be inputed. They will be profiled one by one.\n");
 	printf("Note2: MX6DL can't profile master GPU2D, GPU2D1 and GPU2D2 are used instead.\n");
+	printf("Daemon mode (-d) hands the counters to each master in turn for slice_ms (100 by default),\n");
+	printf("keeps the last depth samples (1024 by default) of every master and runs until SIGINT,\n");
+	printf("or for the given number of rounds. Samples are appended to the csv file (- for stdout)\n");
+	printf("and the socket answers \"stats\", \"series MASTER\" and \"csv\" requests.\n");
+	printf("-F runs against a fake register file (a path, or memfd) instead of /dev/mem.\n");
 }
+
+static void profile(pMMDC_IO_t mmdc, unsigned int timeForSleep)
+{
+	MMDC_PROFILE_RES_t results;
+	int ulStartTime;
+
+	clear_mmdc_results(mmdc);
+	ulStartTime=getTickCount();
+	start_mmdc_profiling(mmdc);
+	usleep(timeForSleep*1000);
+	load_mmdc_results(mmdc);
+	get_mmdc_profiling_results(mmdc, &results);
+	print_mmdc_profiling_results(results , RES_FULL,getTickCount()-ulStartTime);
+	fflush(stdout);
+	stop_mmdc_profiling(mmdc);
+}
+
 int main(int argc, char **argv)
 {
 	unsigned int timeForSleep = 500;
-	void *A;
-	MMDC_PROFILE_RES_t results;
-	int ulStartTime = 0;
-	int i;
+	pMMDC_IO_t mmdc;
+	const MMDC_MASTER_t *masters[64];
+	MMDC_DAEMON_OPTS_t opts = { 100, 1024, -1, NULL, NULL };
+	const char *fake = NULL;
+	int daemon = 0;
+	int count = 0;
+	int ret = 0;
+	int i, j, c;
 	int loopcount= 1;
 	unsigned int customized_madpcr1= 0;
 	char *p;
 
+	while ((c = getopt(argc, argv, "+di:n:r:o:s:F:h")) != -1)
+	{
+		switch (c)
+		{
+		case 'd':
+			daemon = 1;
+			break;
+		case 'i':
+			opts.slice_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opts.depth = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			opts.rounds = strtol(optarg, NULL, 0);
+			break;
+		case 'o':
+			opts.csv = optarg;
+			break;
+		case 's':
+			opts.socket = optarg;
+			break;
+		case 'F':
+			fake = optarg;
+			break;
+		default:
+			help();
+			return c == 'h' ? 0 : -1;
+		}
+	}
+	argv += optind - 1;
+	argc -= optind - 1;
+
 	p = getenv("MMDC_SLEEPTIME");
 	if (p != 0)
 	{
@@ -368,190 +512,69 @@ int main(int argc, char **argv)
 		customized_madpcr1 = strtol(p, 0, 16);
 	}
 
-	int fd = open("/dev/mem", O_RDWR, 0);
-		if (fd < 0)
-	{
-		printf("Could not open /dev/mem\n");
-		return -1;
-	}
-	A = (unsigned long*) mmap(NULL, 0x4000, PROT_READ | PROT_WRITE, MAP_SHARED, fd, MMDC_P0_IPS_BASE_ADDR);
-		if (A == MAP_FAILED)
-	{
-		printf("Mapping failed mmdc_p0\n");
-		close(fd);
+	if (fake)
+		mmdc = mmdc_io_open_fake(fake);
+	else
+		mmdc = mmdc_io_open_devmem(MMDC_P0_IPS_BASE_ADDR);
+	if (mmdc == NULL)
 		return -1;
-	}
-
 
 	if(get_system_rev()<0){
 		printf("Fail to get system revision,parameter will be ignored \n");
 		argc = 1;
 	}
+
+	for (j = 1; j < argc; j++)
+	{
+		if (count == (int)(sizeof(masters) / sizeof(masters[0])))
+		{
+			printf("Too many masters, ignoring %s and the rest\n", argv[j]);
+			break;
+		}
+		masters[count] = mmdc_find_master(argv[j]);
+		if (masters[count] == NULL)
+		{
+			printf("MMDC DOES NOT KNOW %s \n",argv[j]);
+			help();
+			mmdc_io_close(mmdc);
+			return 0;
+		}
+		count++;
+	}
+
+	if (daemon)
+	{
+		if (count == 0)
+			masters[count++] = mmdc_find_master("SUM");
+		ret = mmdc_daemon(mmdc, masters, count, &opts);
+		mmdc_io_close(mmdc);
+		return ret;
+	}
+
 	g_quit = 0;
 	for(i=0; !g_quit && i!=loopcount; i++)
 	{
-		if(argc >= 2)
+		if(count > 0)
 		{
-			int j;
-			for(j=1; j<argc; j++)
+			for(j=0; j<count; j++)
 			{
-				if(strcmp(argv[j],"DSP1")==0){
-					if(cpu_is_mx6sx()==1)
-						((pMMDC_t)A)->madpcr1 = axi_lcd1_6sx;
-					else if(cpu_is_mx6sl()==1)
-						((pMMDC_t)A)->madpcr1 = axi_lcd1_6sl;
-					else if(cpu_is_mx6ul()==1)
-						((pMMDC_t)A)->madpcr1 = axi_lcdif_6ul;
-					else
-						((pMMDC_t)A)->madpcr1 = axi_ipu1;
-					printf("MMDC DSP1 \n");
-				}else if((strcmp(argv[j], "DSP2")==0)&&(cpu_is_mx6q()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_ipu2_6q;
-				  printf("MMDC DSP2 \n");
-				}else if((strcmp(argv[j], "DSP2")==0)&&(cpu_is_mx6qp()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_ipu2_6qp;
-				  printf("MMDC DSP2 \n");
-				}else if((strcmp(argv[j], "DSP2")==0)&&(cpu_is_mx6sx()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_lcd2_6sx;
-				  printf("MMDC DSP2 \n");
-				}else if((strcmp(argv[j], "M4")==0)&&(cpu_is_mx6sx()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_m4_6sx;
-				  printf("MMDC M4 \n");
-				}else if((strcmp(argv[j], "PXP")==0)&&(cpu_is_mx6sx()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_pxp_6sx;
-				  printf("MMDC PXP \n");
-				}else if((strcmp(argv[j], "PXP")==0)&&(cpu_is_mx6ul()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_pxp_6ul;
-				  printf("MMDC PXP \n");
-				}else if((strcmp(argv[j], "ENET1")==0)&&(cpu_is_mx6ul()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_enet1_6ul;
-				  printf("MMDC ENET1 \n");
-				}else if((strcmp(argv[j], "ENET2")==0)&&(cpu_is_mx6ul()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_enet2_6ul;
-				  printf("MMDC ENET2 \n");
-				}else if((strcmp(argv[j], "GPU3D")==0)&&(cpu_is_mx6sx()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_gpu3d_6sx;
-				  printf("MMDC GPU3D \n");
-				}else if((strcmp(argv[j], "GPU3D")==0)&&(cpu_is_mx6dl()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_gpu3d_6dl;
-				  printf("MMDC GPU3D \n");
-				}else if((strcmp(argv[j], "GPU3D")==0)&&(cpu_is_mx6qp()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_gpu3dd0_6qp;
-				  printf("MMDC GPU3D \n");
-				}else if((strcmp(argv[j], "GPU3D2")==0)&&(cpu_is_mx6qp()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_gpu3dd1_6qp;
-				  printf("MMDC GPU3DD1 \n");
-				}else if((strcmp(argv[j], "GPU3D")==0)&&(cpu_is_mx6q()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_gpu3d_6q;
-				  printf("MMDC GPU3D \n");
-				}else if((strcmp(argv[j], "GPU2D1")==0)&&(cpu_is_mx6dl()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_gpu2d1_6dl;
-				  printf("MMDC GPU2D1 \n");
-				}else if((strcmp(argv[j], "GPU2D")==0)&&(cpu_is_mx6qp()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_gpu2d_6qp;
-				  printf("MMDC GPU2D \n");
-				}else if((strcmp(argv[j], "GPU2D")==0)&&(cpu_is_mx6q()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_gpu2d_6q;
-				  printf("MMDC GPU2D \n");
-				}else if((strcmp(argv[j], "GPU2D2")==0)&&(cpu_is_mx6dl()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_gpu2d2_6dl;
-				  printf("MMDC GPU2D2 \n");
-				}else if((strcmp(argv[j], "GPU2D")==0)&&(cpu_is_mx6sl()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_gpu2d_6sl;
-				  printf("MMDC GPU2D \n");
-				}else if((strcmp(argv[j],"VPU")==0)&&(cpu_is_mx6dl()==1)){
-				  ((pMMDC_t)A)->madpcr1 = axi_vpu_6dl;
-				  printf("MMDC VPU \n");
-				}else if((strcmp(argv[j],"VPU")==0)&&(cpu_is_mx6qp()==1)){
-				   ((pMMDC_t)A)->madpcr1 = axi_vpu_6qp;
-				   printf("MMDC VPU \n");
-				}else if((strcmp(argv[j],"VPU")==0)&&(cpu_is_mx6q()==1)){
-				   ((pMMDC_t)A)->madpcr1 = axi_vpu_6q;
-				   printf("MMDC VPU \n");
-				}else if((strcmp(argv[j],"PRE")==0)&&(cpu_is_mx6qp()==1)){
-				   ((pMMDC_t)A)->madpcr1 = axi_pre_6qp;
-				   printf("MMDC PRE \n");
-				}else if((strcmp(argv[j],"PRE0")==0)&&(cpu_is_mx6qp()==1)){
-				   ((pMMDC_t)A)->madpcr1 = axi_pre0_6qp;
-				   printf("MMDC PRE0 \n");
-				}else if((strcmp(argv[j],"PRE1")==0)&&(cpu_is_mx6qp()==1)){
-				   ((pMMDC_t)A)->madpcr1 = axi_pre1_6qp;
-				   printf("MMDC PRE1 \n");
-				}else if((strcmp(argv[j],"PRE2")==0)&&(cpu_is_mx6qp()==1)){
-				   ((pMMDC_t)A)->madpcr1 = axi_pre2_6qp;
-				   printf("MMDC PRE2 \n");
-				}else if((strcmp(argv[j],"PRE3")==0)&&(cpu_is_mx6qp()==1)){
-				   ((pMMDC_t)A)->madpcr1 = axi_pre3_6qp;
-				   printf("MMDC PRE3 \n");
-				}else if((strcmp(argv[j],"GPUVG")==0)&&(cpu_is_mx6q()==1)){
-				   ((pMMDC_t)A)->madpcr1 = axi_openvg_6q;
-				   printf("MMDC GPUVG \n");
-				}else if((strcmp(argv[j],"GPUVG")==0)&&(cpu_is_mx6qp()==1)){
-				   ((pMMDC_t)A)->madpcr1 = axi_openvg_6qp;
-				   printf("MMDC GPUVG \n");
-				}else if((strcmp(argv[j],"GPUVG")==0)&&(cpu_is_mx6sl()==1)){
-				   ((pMMDC_t)A)->madpcr1 = axi_openvg_6sl;
-				   printf("MMDC GPUVG \n");
-				}else if(strcmp(argv[j],"USB")==0){
-					if(cpu_is_mx6sx()==1)
-						((pMMDC_t)A)->madpcr1 = axi_usb_6sx;
-					else if(cpu_is_mx6sl()==1)
-						((pMMDC_t)A)->madpcr1 = axi_usb_6sl;
-					else if(cpu_is_mx6ul()==1)
-						((pMMDC_t)A)->madpcr1 = axi_usb_6ul;
-					else
-						((pMMDC_t)A)->madpcr1 = axi_usb;
-				        printf("MMDC USB \n");
-				}else if(strcmp(argv[j],"ARM")==0){
-					if((cpu_is_mx6sx()==1))
-						((pMMDC_t)A)->madpcr1 = axi_arm_6sx;
-					else if((cpu_is_mx6ul()==1))
-						((pMMDC_t)A)->madpcr1 = axi_arm_6ul;
-					else
-						((pMMDC_t)A)->madpcr1 = axi_arm;
-					printf("MMDC ARM \n");
-				}else if(strcmp(argv[j], "SUM")==0){
-				  ((pMMDC_t)A)->madpcr1 = axi_default;
-				  printf("MMDC SUM \n");
-				}else{
-					printf("MMDC DOES NOT KNOW %s \n",argv[j]);
-					help();
-					close(fd);
-					return 0;
-				}
-				msync(&(((pMMDC_t)A)->madpcr1),4,MS_SYNC);
-				clear_mmdc_results((pMMDC_t)A);
-				ulStartTime=getTickCount();
-				start_mmdc_profiling((pMMDC_t)A);
-				usleep(timeForSleep*1000);
-				load_mmdc_results((pMMDC_t)A);
-				get_mmdc_profiling_results((pMMDC_t)A, &results);
-				print_mmdc_profiling_results(results , RES_FULL,getTickCount()-ulStartTime);
-				fflush(stdout);
-				stop_mmdc_profiling((pMMDC_t)A);
+				mmdc_select_master(mmdc, masters[j]->madpcr1);
+				printf("MMDC %s \n", masters[j]->label ?
+				       masters[j]->label : masters[j]->name);
+				profile(mmdc, timeForSleep);
 			}
 		}else {
 			if(customized_madpcr1!= 0)
 			{
-				((pMMDC_t)A)->madpcr1 = customized_madpcr1;
-				msync(&(((pMMDC_t)A)->madpcr1),4,MS_SYNC);
+				mmdc_select_master(mmdc, customized_madpcr1);
 				printf("MMDC 0x%x \n",customized_madpcr1);
 			}else{
-				((pMMDC_t)A)->madpcr1 = axi_default;
-				msync(&(((pMMDC_t)A)->madpcr1),4,MS_SYNC);
+				mmdc_select_master(mmdc, axi_default);
 				printf("MMDC SUM \n");
 			}
-			clear_mmdc_results((pMMDC_t)A);
-			ulStartTime=getTickCount();
-			start_mmdc_profiling((pMMDC_t)A);
-			usleep(timeForSleep*1000);
-			load_mmdc_results((pMMDC_t)A);
-			get_mmdc_profiling_results((pMMDC_t)A, &results);
-			print_mmdc_profiling_results(results , RES_FULL,getTickCount()-ulStartTime);
-			fflush(stdout);
-			stop_mmdc_profiling((pMMDC_t)A);
+			profile(mmdc, timeForSleep);
 		}
 	}
-	close(fd);
+	mmdc_io_close(mmdc);
 	return 0;
 }
@@ -14,6 +14,8 @@
 #ifndef MMDC_H_
 #define MMDC_H_
 
+#include <stddef.h>
+
 typedef struct
 {
 	unsigned int mdctl;
@@ -108,6 +110,37 @@ typedef struct
 
 typedef MMDC_t *pMMDC_t;
 
+/********************* Register Access ************************/
+/*
+ * All register accesses go through an MMDC_IO_t so that the profiler
+ * can run against /dev/mem or against a file/memfd backed fake that
+ * models the profiling counters (see mmdc_io.c).
+ */
+#define MMDC_MAP_SIZE		0x4000
+#define MMDC_REG(reg)		offsetof(MMDC_t, reg)
+
+typedef struct mmdc_io
+{
+	unsigned int (*read)(struct mmdc_io *io, unsigned int offset);
+	void (*write)(struct mmdc_io *io, unsigned int offset, unsigned int value);
+	volatile unsigned char *base;
+	int fd;
+	/* fake only */
+	int enabled;
+	unsigned long long start_ns;
+	unsigned int seed;
+} MMDC_IO_t;
+
+typedef MMDC_IO_t *pMMDC_IO_t;
+
+#define mmdc_read(io, reg)	((io)->read((io), MMDC_REG(reg)))
+#define mmdc_write(io, reg, v)	((io)->write((io), MMDC_REG(reg), (v)))
+
+pMMDC_IO_t mmdc_io_open_devmem(unsigned long base);
+pMMDC_IO_t mmdc_io_open_fake(const char *path);
+void mmdc_io_close(pMMDC_IO_t io);
+unsigned long long mmdc_now_ns(void);
+
 /********************* Profiler Types & Functions ************************/
 typedef struct
 {
@@ -130,24 +163,68 @@ typedef enum
     RES_UTILIZATION
 } MMDC_RES_TYPE_t;
 
-void start_mmdc_profiling(pMMDC_t mmdc);
-void stop_mmdc_profiling(pMMDC_t mmdc);
-void pause_mmdc_profiling(pMMDC_t mmdc);
-void resume_mmdc_profiling(pMMDC_t mmdc);
-void get_mmdc_profiling_results(pMMDC_t mmdc, MMDC_PROFILE_RES_t *results);
+/* MADPCR0 */
+#define MADPCR0_DBG_EN		0x1
+#define MADPCR0_DBG_RST		0x2
+#define MADPCR0_PRF_FRZ		0x4
+#define MADPCR0_CYC_OVF		0x8
+
+void start_mmdc_profiling(pMMDC_IO_t mmdc);
+void stop_mmdc_profiling(pMMDC_IO_t mmdc);
+void pause_mmdc_profiling(pMMDC_IO_t mmdc);
+void resume_mmdc_profiling(pMMDC_IO_t mmdc);
+void load_mmdc_results(pMMDC_IO_t mmdc);
+void clear_mmdc_results(pMMDC_IO_t mmdc);
+void get_mmdc_profiling_results(pMMDC_IO_t mmdc, MMDC_PROFILE_RES_t *results);
 void print_mmdc_profiling_results(MMDC_PROFILE_RES_t results, MMDC_RES_TYPE_t print_type,int time);
 
+/********************* AXI Masters ************************/
+/* one MADPCR1 setting; cpu 0 matches any SoC, the first match wins */
+typedef struct
+{
+	const char *name;
+	unsigned int cpu;
+	unsigned int madpcr1;
+	const char *label;	/* printed instead of name if set */
+} MMDC_MASTER_t;
+
+const MMDC_MASTER_t *mmdc_find_master(const char *name);
+void mmdc_select_master(pMMDC_IO_t mmdc, unsigned int madpcr1);
+
+/********************* Daemon ************************/
+typedef struct
+{
+	unsigned int slice_ms;		/* time each master owns the counters */
+	unsigned int depth;		/* samples kept per master */
+	int rounds;			/* -1: until SIGINT/SIGTERM */
+	const char *csv;		/* per sample rows, "-" for stdout */
+	const char *socket;		/* Unix socket serving the statistics */
+} MMDC_DAEMON_OPTS_t;
+
+int mmdc_daemon(pMMDC_IO_t mmdc, const MMDC_MASTER_t **masters, int count,
+		const MMDC_DAEMON_OPTS_t *opts);
+
 extern unsigned int system_rev;
+extern volatile int g_quit;
+void signalhandler(int signal);
 
 #define CHIP_REV_1_0            	0x1
 #define CHIP_REV_2_0			0x2
 
-#define cpu_is_mx6qp()		mxc_is_cpu(0x65)
-#define cpu_is_mx6q()		mxc_is_cpu(0x63)
-#define cpu_is_mx6dl()		mxc_is_cpu(0x61)
-#define cpu_is_mx6sl()		mxc_is_cpu(0x60)
-#define cpu_is_mx6sx()		mxc_is_cpu(0x62)
-#define cpu_is_mx6ul()		mxc_is_cpu(0x64)
+#define MXC_CPU_ANY		0
+#define MXC_CPU_MX6SL		0x60
+#define MXC_CPU_MX6DL		0x61
+#define MXC_CPU_MX6SX		0x62
+#define MXC_CPU_MX6Q		0x63
+#define MXC_CPU_MX6UL		0x64
+#define MXC_CPU_MX6QP		0x65
+
+#define cpu_is_mx6qp()		mxc_is_cpu(MXC_CPU_MX6QP)
+#define cpu_is_mx6q()		mxc_is_cpu(MXC_CPU_MX6Q)
+#define cpu_is_mx6dl()		mxc_is_cpu(MXC_CPU_MX6DL)
+#define cpu_is_mx6sl()		mxc_is_cpu(MXC_CPU_MX6SL)
+#define cpu_is_mx6sx()		mxc_is_cpu(MXC_CPU_MX6SX)
+#define cpu_is_mx6ul()		mxc_is_cpu(MXC_CPU_MX6UL)
 #define mxc_is_cpu(part)        ((mxc_cpu() == (unsigned int)part) ? 1 : 0)
 #define mxc_cpu()               (system_rev >> 12)
 #define mxc_cpu_rev()           (system_rev & 0xFF)
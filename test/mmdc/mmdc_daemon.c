@@ -0,0 +1,424 @@
+/*
+ * Copyright 2020 NXP
+ */
+
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+/*
+ * MMDC daemon mode.
+ *
+ * The MMDC has a single set of profiling counters, filtered by MADPCR1
+ * on one AXI ID/mask at a time. The daemon hands the counters to each
+ * configured master in turn for one slice and keeps the last N samples
+ * of every master in a ring. Rates are per slice, so with M masters each
+ * one is observed 1/M of the time; what it does while the others own the
+ * counters is not seen.
+ *
+ * Samples can be appended to a CSV file as they are taken, and a Unix
+ * stream socket serves one request per connection:
+ *
+ *   stats           p50/p90/p99/max of the rates and loads per master
+ *   series MASTER   the ring of that master as CSV, oldest first
+ *   csv             the rings of all masters
+ *
+ * An empty request (or none within 100ms) gets the stats.
+ */
+
+#include "mmdc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MMDC_SLICE_MAX_MS	4000	/* total cycles wrap after ~8s at 528MHz */
+#define MMDC_REQUEST_MS		100
+
+typedef struct
+{
+	unsigned long long time_ms;	/* since start, at the end of the slice */
+	unsigned int duration_us;
+	unsigned int total_cycles;
+	unsigned int busy_cycles;
+	unsigned int read_accesses;
+	unsigned int write_accesses;
+	unsigned int read_bytes;
+	unsigned int write_bytes;
+	unsigned short utilization;
+	unsigned short data_load;
+	unsigned char overflow;
+} MMDC_SAMPLE_t;
+
+typedef struct
+{
+	const MMDC_MASTER_t *master;
+	MMDC_SAMPLE_t *ring;
+	unsigned int head;		/* samples taken so far */
+} MMDC_SERIES_t;
+
+typedef struct
+{
+	MMDC_SERIES_t *series;
+	int count;
+	unsigned int depth;
+	int listen_fd;
+	FILE *csv;
+	unsigned long long start_ns;
+} MMDC_DAEMON_t;
+
+enum
+{
+	STAT_READ,
+	STAT_WRITE,
+	STAT_TOTAL,
+	STAT_UTIL,
+	STAT_LOAD,
+	STAT_COUNT
+};
+
+static const char *stat_names[STAT_COUNT] = {
+	"read MB/s", "write MB/s", "total MB/s", "util %", "load %"
+};
+
+static double sample_stat(const MMDC_SAMPLE_t *s, int stat)
+{
+	double sec = s->duration_us / 1e6;
+
+	switch (stat)
+	{
+	case STAT_READ:
+		return s->read_bytes / sec / (1024 * 1024);
+	case STAT_WRITE:
+		return s->write_bytes / sec / (1024 * 1024);
+	case STAT_TOTAL:
+		return ((double)s->read_bytes + s->write_bytes) / sec / (1024 * 1024);
+	case STAT_UTIL:
+		return s->utilization;
+	default:
+		return s->data_load;
+	}
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* nearest rank percentile of sorted values */
+static double percentile(const double *v, unsigned int n, unsigned int pct)
+{
+	unsigned int rank = (n * pct + 99) / 100;
+
+	return v[rank ? rank - 1 : 0];
+}
+
+static unsigned int series_count(const MMDC_DAEMON_t *d, const MMDC_SERIES_t *s)
+{
+	return s->head < d->depth ? s->head : d->depth;
+}
+
+static const MMDC_SAMPLE_t *series_at(const MMDC_DAEMON_t *d,
+				      const MMDC_SERIES_t *s, unsigned int i)
+{
+	return &s->ring[(s->head - series_count(d, s) + i) % d->depth];
+}
+
+static void print_stats(const MMDC_DAEMON_t *d, FILE *out)
+{
+	const MMDC_SERIES_t *s;
+	double *v;
+	unsigned int n, i, valid;
+	int m, stat;
+
+	v = malloc(d->depth * sizeof(*v));
+	if (v == NULL)
+		return;
+
+	fprintf(out, "%-8s %-11s %7s %10s %10s %10s %10s\n",
+		"master", "", "samples", "p50", "p90", "p99", "max");
+	for (m = 0; m < d->count; m++)
+	{
+		s = &d->series[m];
+		n = series_count(d, s);
+		for (stat = 0; stat < STAT_COUNT; stat++)
+		{
+			for (i = 0, valid = 0; i < n; i++)
+				if (!series_at(d, s, i)->overflow)
+					v[valid++] = sample_stat(series_at(d, s, i), stat);
+			fprintf(out, "%-8s %-11s %7u", stat ? "" : s->master->name,
+				stat_names[stat], valid);
+			if (valid == 0)
+			{
+				fprintf(out, "\n");
+				continue;
+			}
+			qsort(v, valid, sizeof(*v), cmp_double);
+			fprintf(out, " %10.2f %10.2f %10.2f %10.2f\n",
+				percentile(v, valid, 50), percentile(v, valid, 90),
+				percentile(v, valid, 99), v[valid - 1]);
+		}
+	}
+	free(v);
+}
+
+static void print_csv_header(FILE *out)
+{
+	fprintf(out, "time_ms,master,madpcr1,duration_us,total_cycles,busy_cycles,"
+		"read_accesses,write_accesses,read_bytes,write_bytes,"
+		"read_mbs,write_mbs,utilization,data_load,overflow\n");
+}
+
+static void print_csv_row(FILE *out, const MMDC_MASTER_t *master,
+			  const MMDC_SAMPLE_t *s)
+{
+	fprintf(out, "%llu,%s,0x%08x,%u,%u,%u,%u,%u,%u,%u,%.2f,%.2f,%u,%u,%u\n",
+		s->time_ms, master->name, master->madpcr1, s->duration_us,
+		s->total_cycles, s->busy_cycles, s->read_accesses,
+		s->write_accesses, s->read_bytes, s->write_bytes,
+		sample_stat(s, STAT_READ), sample_stat(s, STAT_WRITE),
+		s->utilization, s->data_load, s->overflow);
+}
+
+static void print_series(const MMDC_DAEMON_t *d, const MMDC_SERIES_t *s,
+			 FILE *out)
+{
+	unsigned int i, n = series_count(d, s);
+
+	for (i = 0; i < n; i++)
+		print_csv_row(out, s->master, series_at(d, s, i));
+}
+
+static int open_socket(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		printf("Socket path too long: %s\n", path);
+		return -1;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		perror("socket");
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0)
+	{
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* answer one request, see the top of the file */
+static void serve_client(const MMDC_DAEMON_t *d)
+{
+	struct pollfd pfd;
+	char req[64];
+	ssize_t len = 0;
+	FILE *out;
+	int fd, m;
+
+	fd = accept(d->listen_fd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, MMDC_REQUEST_MS) > 0)
+		len = read(fd, req, sizeof(req) - 1);
+	req[len > 0 ? len : 0] = 0;
+	req[strcspn(req, "\r\n")] = 0;
+
+	out = fdopen(fd, "w");
+	if (out == NULL)
+	{
+		close(fd);
+		return;
+	}
+	if (strncmp(req, "series ", 7) == 0)
+	{
+		for (m = 0; m < d->count; m++)
+			if (strcmp(d->series[m].master->name, req + 7) == 0)
+				break;
+		if (m == d->count)
+		{
+			fprintf(out, "unknown master %s\n", req + 7);
+		} else {
+			print_csv_header(out);
+			print_series(d, &d->series[m], out);
+		}
+	} else if (strcmp(req, "csv") == 0) {
+		print_csv_header(out);
+		for (m = 0; m < d->count; m++)
+			print_series(d, &d->series[m], out);
+	} else {
+		print_stats(d, out);
+	}
+	fclose(out);
+}
+
+/* sleep until the deadline, serving socket requests meanwhile */
+static void wait_until(const MMDC_DAEMON_t *d, unsigned long long deadline)
+{
+	struct pollfd pfd;
+	unsigned long long now;
+	int ret;
+
+	pfd.fd = d->listen_fd;
+	pfd.events = POLLIN;
+	while (!g_quit && (now = mmdc_now_ns()) < deadline)
+	{
+		ret = poll(&pfd, d->listen_fd >= 0, (deadline - now + 999999) / 1000000);
+		if (ret > 0 && (pfd.revents & POLLIN))
+			serve_client(d);
+	}
+}
+
+/* one slice of one master, returns -1 when interrupted */
+static int take_sample(pMMDC_IO_t mmdc, MMDC_DAEMON_t *d, MMDC_SERIES_t *s,
+		       unsigned int slice_ms)
+{
+	MMDC_PROFILE_RES_t res;
+	MMDC_SAMPLE_t *sample;
+	unsigned long long t0, t1;
+
+	mmdc_select_master(mmdc, s->master->madpcr1);
+	clear_mmdc_results(mmdc);
+	t0 = mmdc_now_ns();
+	start_mmdc_profiling(mmdc);
+	wait_until(d, t0 + slice_ms * 1000000ULL);
+	load_mmdc_results(mmdc);
+	t1 = mmdc_now_ns();
+	if (g_quit)
+	{
+		stop_mmdc_profiling(mmdc);
+		return -1;
+	}
+	get_mmdc_profiling_results(mmdc, &res);
+
+	sample = &s->ring[s->head % d->depth];
+	sample->time_ms = (t1 - d->start_ns) / 1000000;
+	sample->duration_us = (t1 - t0) / 1000;
+	sample->total_cycles = res.total_cycles;
+	sample->busy_cycles = res.busy_cycles;
+	sample->read_accesses = res.read_accesses;
+	sample->write_accesses = res.write_accesses;
+	sample->read_bytes = res.read_bytes;
+	sample->write_bytes = res.write_bytes;
+	sample->utilization = res.utilization;
+	sample->data_load = res.data_load;
+	sample->overflow = (mmdc_read(mmdc, madpcr0) & MADPCR0_CYC_OVF) ||
+			   res.utilization > 100 || res.data_load > 100;
+	stop_mmdc_profiling(mmdc);
+	s->head++;
+
+	if (d->csv)
+	{
+		print_csv_row(d->csv, s->master, sample);
+		fflush(d->csv);
+	}
+	return 0;
+}
+
+int mmdc_daemon(pMMDC_IO_t mmdc, const MMDC_MASTER_t **masters, int count,
+		const MMDC_DAEMON_OPTS_t *opts)
+{
+	MMDC_DAEMON_t d;
+	int i, round, ret = 0;
+
+	if (opts->slice_ms == 0 || opts->slice_ms > MMDC_SLICE_MAX_MS || opts->depth == 0)
+	{
+		printf("slice must be 1..%d ms and depth at least 1\n", MMDC_SLICE_MAX_MS);
+		return -1;
+	}
+
+	memset(&d, 0, sizeof(d));
+	d.count = count;
+	d.depth = opts->depth;
+	d.listen_fd = -1;
+	d.series = calloc(count, sizeof(*d.series));
+	if (d.series == NULL)
+		return -1;
+	for (i = 0; i < count; i++)
+	{
+		d.series[i].master = masters[i];
+		d.series[i].ring = calloc(d.depth, sizeof(MMDC_SAMPLE_t));
+		if (d.series[i].ring == NULL)
+		{
+			printf("Out of memory\n");
+			ret = -1;
+			goto out;
+		}
+	}
+
+	if (opts->csv)
+	{
+		d.csv = strcmp(opts->csv, "-") ? fopen(opts->csv, "w") : stdout;
+		if (d.csv == NULL)
+		{
+			perror(opts->csv);
+			ret = -1;
+			goto out;
+		}
+		print_csv_header(d.csv);
+	}
+	if (opts->socket)
+	{
+		d.listen_fd = open_socket(opts->socket);
+		if (d.listen_fd < 0)
+		{
+			ret = -1;
+			goto out;
+		}
+	}
+
+	g_quit = 0;
+	signal(SIGINT, signalhandler);
+	signal(SIGTERM, signalhandler);
+	signal(SIGPIPE, SIG_IGN);
+
+	d.start_ns = mmdc_now_ns();
+	for (round = 0; !g_quit && round != opts->rounds; round++)
+		for (i = 0; i < count; i++)
+			if (take_sample(mmdc, &d, &d.series[i], opts->slice_ms) < 0)
+				break;
+
+	/* the summary goes to stderr when stdout carries the CSV */
+	print_stats(&d, d.csv == stdout ? stderr : stdout);
+
+out:
+	if (d.listen_fd >= 0)
+	{
+		close(d.listen_fd);
+		unlink(opts->socket);
+	}
+	if (d.csv && d.csv != stdout)
+		fclose(d.csv);
+	else if (d.csv)
+		fflush(stdout);
+	for (i = 0; i < count; i++)
+		free(d.series[i].ring);
+	free(d.series);
+	return ret;
+}
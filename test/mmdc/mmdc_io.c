@@ -0,0 +1,200 @@
+/*
+ * Copyright 2020 NXP
+ */
+
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+/*
+ * MMDC register access backends.
+ *
+ * The /dev/mem backend maps the MMDC register block. The fake backend
+ * maps a regular file (or an anonymous memfd) with the same layout and
+ * models the profiling counters, so the profiler and its daemon mode
+ * can be exercised without the hardware:
+ *
+ *  - DBG_RST clears MADPSR0-5 and CYC_OVF,
+ *  - DBG_EN starts the cycle count at a 528MHz DDR clock,
+ *  - PRF_FRZ loads the counters, with every MADPCR1 value given a
+ *    stable share of the bus plus some jitter; 0 (SUM) sees the most.
+ *
+ * The register file stays readable in the file for inspection.
+ */
+
+#include "mmdc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define FAKE_DDR_CLOCK_HZ	528000000ULL
+#define FAKE_MDCTL		0x831A0000
+
+unsigned long long mmdc_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static volatile unsigned int *reg_ptr(pMMDC_IO_t io, unsigned int offset)
+{
+	return (volatile unsigned int *)(io->base + offset);
+}
+
+static unsigned int mem_read(pMMDC_IO_t io, unsigned int offset)
+{
+	return *reg_ptr(io, offset);
+}
+
+static void mem_write(pMMDC_IO_t io, unsigned int offset, unsigned int value)
+{
+	*reg_ptr(io, offset) = value;
+}
+
+static pMMDC_IO_t io_map(int fd, unsigned long base)
+{
+	pMMDC_IO_t io;
+	void *map;
+
+	map = mmap(NULL, MMDC_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, base);
+	if (map == MAP_FAILED)
+	{
+		printf("Mapping failed mmdc_p0\n");
+		close(fd);
+		return NULL;
+	}
+	io = calloc(1, sizeof(*io));
+	if (io == NULL)
+	{
+		munmap(map, MMDC_MAP_SIZE);
+		close(fd);
+		return NULL;
+	}
+	io->base = map;
+	io->fd = fd;
+	io->read = mem_read;
+	io->write = mem_write;
+	return io;
+}
+
+pMMDC_IO_t mmdc_io_open_devmem(unsigned long base)
+{
+	int fd = open("/dev/mem", O_RDWR, 0);
+
+	if (fd < 0)
+	{
+		printf("Could not open /dev/mem\n");
+		return NULL;
+	}
+	return io_map(fd, base);
+}
+
+static unsigned int fake_rand(pMMDC_IO_t io)
+{
+	io->seed = io->seed * 1103515245 + 12345;
+	return io->seed >> 16;
+}
+
+/* latch what the counters would hold after running since DBG_EN */
+static void fake_load(pMMDC_IO_t io)
+{
+	unsigned long long total, busy, bytes, rd;
+	unsigned int master = *reg_ptr(io, MMDC_REG(madpcr1));
+	unsigned int mdctl = *reg_ptr(io, MMDC_REG(mdctl));
+	unsigned int width = 4 << ((mdctl & 0x30000) >> 16);
+	unsigned int share;
+
+	total = (mmdc_now_ns() - io->start_ns) * FAKE_DDR_CLOCK_HZ / 1000000000ULL;
+	if (total > 0xFFFFFFFFULL)
+	{
+		total = 0xFFFFFFFFULL;
+		*reg_ptr(io, MMDC_REG(madpcr0)) |= MADPCR0_CYC_OVF;
+	}
+
+	share = master ? (master * 2654435761u >> 24) % 30 + 5 : 60;
+	share += fake_rand(io) % 11;
+	busy = total * share / 100;
+	bytes = busy * width * (60 + fake_rand(io) % 30) / 100;
+	if (bytes > 0xFFFFFFFFULL)
+		bytes = 0xFFFFFFFFULL;
+	rd = bytes * (50 + fake_rand(io) % 30) / 100;
+
+	*reg_ptr(io, MMDC_REG(madpsr0)) = total;
+	*reg_ptr(io, MMDC_REG(madpsr1)) = busy;
+	*reg_ptr(io, MMDC_REG(madpsr2)) = rd / 32;
+	*reg_ptr(io, MMDC_REG(madpsr3)) = (bytes - rd) / 32;
+	*reg_ptr(io, MMDC_REG(madpsr4)) = rd;
+	*reg_ptr(io, MMDC_REG(madpsr5)) = bytes - rd;
+}
+
+static void fake_write(pMMDC_IO_t io, unsigned int offset, unsigned int value)
+{
+	volatile unsigned int *r = reg_ptr(io, offset);
+
+	if (offset != MMDC_REG(madpcr0))
+	{
+		*r = value;
+		return;
+	}
+
+	/* DBG_RST and CYC_OVF are self clearing / write one to clear */
+	*r = (*r & MADPCR0_CYC_OVF) | (value & ~(MADPCR0_DBG_RST | MADPCR0_CYC_OVF));
+	if (value & MADPCR0_DBG_RST)
+	{
+		memset((void *)reg_ptr(io, MMDC_REG(madpsr0)), 0, 6 * sizeof(unsigned int));
+		io->start_ns = mmdc_now_ns();
+	}
+	if (value & MADPCR0_CYC_OVF)
+		*r &= ~MADPCR0_CYC_OVF;
+	if ((value & MADPCR0_DBG_EN) && !io->enabled)
+		io->start_ns = mmdc_now_ns();
+	io->enabled = value & MADPCR0_DBG_EN;
+	if ((value & MADPCR0_PRF_FRZ) && io->enabled)
+		fake_load(io);
+}
+
+/* path NULL or "memfd" gives an anonymous register file */
+pMMDC_IO_t mmdc_io_open_fake(const char *path)
+{
+	pMMDC_IO_t io;
+	int fd;
+
+	if (path == NULL || strcmp(path, "memfd") == 0)
+		fd = syscall(SYS_memfd_create, "mmdc", 0);
+	else
+		fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0 || ftruncate(fd, MMDC_MAP_SIZE) < 0)
+	{
+		printf("Could not create fake MMDC %s\n", path ? path : "memfd");
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	io = io_map(fd, 0);
+	if (io == NULL)
+		return NULL;
+	io->write = fake_write;
+	io->seed = 1;
+	if (*reg_ptr(io, MMDC_REG(mdctl)) == 0)
+		*reg_ptr(io, MMDC_REG(mdctl)) = FAKE_MDCTL;
+	return io;
+}
+
+void mmdc_io_close(pMMDC_IO_t io)
+{
+	munmap((void *)io->base, MMDC_MAP_SIZE);
+	close(io->fd);
+	free(io);
+}
@@ -62,37 +62,37 @@ struct dff_form_dsd_chunk {
 
 #define BE 1
 
-static int read_dff_dsd_data(int fd, struct dff_dsd_data_chunk *dsd_data)
+static int read_dff_dsd_data(struct dsd_reader *r, struct dff_dsd_data_chunk *dsd_data)
 {
-	return read_u64_t(fd, &dsd_data->chunk_size, BE);
+	return read_u64_t(r, &dsd_data->chunk_size, BE);
 }
 
-static int read_dff_prop(int fd, struct dff_property_chunk *prop)
+static int read_dff_prop(struct dsd_reader *r, struct dff_property_chunk *prop)
 {
 	int err;
 	uint8_t next_chunk[4];
 	uint64_t next_chunk_size;
 	int fs = 0, cc = 0, ctc = 0;
 
-	err = read_u64_t(fd, &prop->chunk_size, BE);
+	err = read_u64_t(r, &prop->chunk_size, BE);
 	if (err < 0) return err;
 
-	err = read(fd, prop->prop_type, sizeof(prop->prop_type));
+	err = read_bytes(r, prop->prop_type, sizeof(prop->prop_type));
 	if (err < 0) return err;
 	if (memcmp(prop->prop_type, "SND ", 4) != 0)
 		return -1;
 
 	while (!fs || !cc || !ctc) {
-		err = read(fd, next_chunk, sizeof(next_chunk));
+		err = read_bytes(r, next_chunk, sizeof(next_chunk));
 		if (err < 0) return err;
 
 		if (!fs && !memcmp(next_chunk, "FS  ", 4)) {
 			struct dff_sample_rate_chunk *fsr = &prop->fs;
 
 			memcpy(fsr->chunk_header, next_chunk, 4);
-			err = read_u64_t(fd, &fsr->chunk_size, BE);
+			err = read_u64_t(r, &fsr->chunk_size, BE);
 			if (err < 0) return err;
-			err = read_u32_t(fd, &fsr->sample_rate, BE);
+			err = read_u32_t(r, &fsr->sample_rate, BE);
 			if (err < 0) return err;
 
 			fs = 1;
@@ -100,14 +100,13 @@ static int read_dff_prop(int fd, struct dff_property_chunk *prop)
 			struct dff_channels_chunk *chnl = &prop->chnl;
 
 			memcpy(chnl->chunk_header, next_chunk, 4);
-			err = read_u64_t(fd, &chnl->chunk_size, BE);
+			err = read_u64_t(r, &chnl->chunk_size, BE);
 			if (err < 0) return err;
-			err = read_u16_t(fd, &chnl->num_channels, BE);
+			err = read_u16_t(r, &chnl->num_channels, BE);
 			if (err < 0) return err;
 
 			/* skip num_channels*4 bytes */
-			uint8_t buff[4*chnl->num_channels];
-			err = read_full(fd, buff, 4*chnl->num_channels);
+			err = read_skip(r, 4*chnl->num_channels);
 			if (err < 0) return err;
 
 			cc = 1;
@@ -115,24 +114,29 @@ static int read_dff_prop(int fd, struct dff_property_chunk *prop)
 			struct dff_compression_type_chunk *compr = &prop->compr;
 
 			memcpy(compr->chunk_header, next_chunk, 4);
-			err = read_u64_t(fd, &compr->chunk_size, BE);
+			err = read_u64_t(r, &compr->chunk_size, BE);
 			if (err < 0) return err;
-			err = read(fd, compr->compr_type, sizeof(compr->compr_type));
+			err = read_bytes(r, compr->compr_type, sizeof(compr->compr_type));
 			if (err < 0) return err;
 			if (memcmp(compr->compr_type, "DSD ", 4) != 0)
 				return -1;
-			err = read(fd, &compr->count, sizeof(compr->count));
+			err = read_bytes(r, &compr->count, sizeof(compr->count));
 			if (err < 0) return err;
-			err = read(fd, compr->compr_name, compr->chunk_size - 5);
+			if (compr->chunk_size - 5 > sizeof(compr->compr_name)) {
+				err = read_bytes(r, compr->compr_name, sizeof(compr->compr_name));
+				if (err < 0) return err;
+				err = read_skip(r, compr->chunk_size - 5 - sizeof(compr->compr_name));
+			} else {
+				err = read_bytes(r, compr->compr_name, compr->chunk_size - 5);
+			}
 			if (err < 0) return err;
 
 			ctc = 1;
 		} else { /* unknown chunk, skip it*/
-			err = read_u64_t(fd, &next_chunk_size, BE);
+			err = read_u64_t(r, &next_chunk_size, BE);
 			if (err < 0) return err;
 
-			uint8_t buff[next_chunk_size];
-			err = read_full(fd, buff, next_chunk_size);
+			err = read_skip(r, next_chunk_size);
 			if (err < 0) return err;
 		}
 	}
@@ -140,45 +144,45 @@ static int read_dff_prop(int fd, struct dff_property_chunk *prop)
 	return 0;
 }
 
-static int read_dff_fver(int fd, struct dff_format_version_chunk *version)
+static int read_dff_fver(struct dsd_reader *r, struct dff_format_version_chunk *version)
 {
 	int err;
 
-	err = read_u64_t(fd, &version->chunk_size, BE);
+	err = read_u64_t(r, &version->chunk_size, BE);
 	if (err < 0) return err;
 
-	return read_u32_t(fd, &version->version, BE);
+	return read_u32_t(r, &version->version, BE);
 }
 
-static int read_dff_form(int fd, struct dff_form_dsd_chunk *form)
+static int read_dff_form(struct dsd_reader *r, struct dff_form_dsd_chunk *form)
 {
 	int err;
 	uint8_t next_chunk[4];
 	uint64_t next_chunk_size;
 	int v = 0, p = 0, d = 0;
 
-	err = read(fd, form->chunk_header, sizeof(form->chunk_header));
+	err = read_bytes(r, form->chunk_header, sizeof(form->chunk_header));
 	if (err < 0) return err;
 	if (memcmp(form->chunk_header, "FRM8", 4) != 0)
 		return -1;
 
-	err = read_u64_t(fd, &form->chunk_size, BE);
+	err = read_u64_t(r, &form->chunk_size, BE);
 	if (err < 0) return err;
 
-	err = read(fd, form->form_type, sizeof(form->form_type));
+	err = read_bytes(r, form->form_type, sizeof(form->form_type));
 	if (err < 0) return err;
 	if (memcmp(form->form_type, "DSD ", 4) != 0)
 		return -1;
 
 	while (!v || !p || !d) {
-		err = read(fd, next_chunk, sizeof(next_chunk));
+		err = read_bytes(r, next_chunk, sizeof(next_chunk));
 		if (err < 0) return err;
 
 		if (!v && !p && !d && !memcmp(next_chunk, "FVER", 4)) {
 			struct dff_format_version_chunk *version = &form->version;
 
 			memcpy(version->chunk_header, next_chunk, 4);
-			err = read_dff_fver(fd, version);
+			err = read_dff_fver(r, version);
 			if (err < 0)
 				return err;
 			v = 1;
@@ -186,7 +190,7 @@ static int read_dff_form(int fd, struct dff_form_dsd_chunk *form)
 			struct dff_property_chunk *prop = &form->prop;
 
 			memcpy(prop->chunk_header, next_chunk, 4);
-			err = read_dff_prop(fd, prop);
+			err = read_dff_prop(r, prop);
 			if (err < 0)
 				return err;
 			p = 1;
@@ -194,16 +198,15 @@ static int read_dff_form(int fd, struct dff_form_dsd_chunk *form)
 			struct dff_dsd_data_chunk *dsd_data = &form->dsd_data;
 
 			memcpy(dsd_data->chunk_header, next_chunk, 4);
-			err = read_dff_dsd_data(fd, dsd_data);
+			err = read_dff_dsd_data(r, dsd_data);
 			if (err < 0)
 				return err;
 			d = 1;
 		} else { /* unknown chunk, skip it*/
-			err = read_u64_t(fd, &next_chunk_size, BE);
+			err = read_u64_t(r, &next_chunk_size, BE);
 			if (err < 0) return err;
 
-			uint8_t buff[next_chunk_size];
-			err = read_full(fd, buff, next_chunk_size);
+			err = read_skip(r, next_chunk_size);
 			if (err < 0) return err;
 		}
 	}
@@ -211,12 +214,12 @@ static int read_dff_form(int fd, struct dff_form_dsd_chunk *form)
 	return 0;
 }
 
-int read_dff_file(int fd, struct dsd_params *params)
+int read_dff_file(struct dsd_reader *r, struct dsd_params *params)
 {
 	int err;
 	struct dff_form_dsd_chunk form;
 
-	err = read_dff_form(fd, &form);
+	err = read_dff_form(r, &form);
 	if (err < 0)
 		return err;
 
@@ -224,6 +227,9 @@ int read_dff_file(int fd, struct dsd_params *params)
 	params->bits_per_sample = 8;
 	params->channel_num     = form.prop.chnl.num_channels;
 	params->dsd_chunk_size	= form.dsd_data.chunk_size;
+	params->data_offset	= reader_tell(r);
+	params->sample_count	= 0;
+	params->planar		= 0;
 
 	return 0;
 }
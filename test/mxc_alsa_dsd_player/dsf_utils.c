@@ -43,49 +43,49 @@ struct dsf_file_header {
 
 #define BE 0
 
-int read_dsf_file(int fd, struct dsd_params *params)
+int read_dsf_file(struct dsd_reader *r, struct dsd_params *params)
 {
 	int err;
 	struct dsf_file_header header;
 
-	err = read(fd, header.dsd.chunk_header, sizeof(header.dsd.chunk_header));
+	err = read_bytes(r, header.dsd.chunk_header, sizeof(header.dsd.chunk_header));
 	if (err < 0) return err;
-	err = read_u64_t(fd, &header.dsd.chunk_size, BE);
+	err = read_u64_t(r, &header.dsd.chunk_size, BE);
 	if (err < 0) return err;
-	err = read_u64_t(fd, &header.dsd.file_size, BE);
+	err = read_u64_t(r, &header.dsd.file_size, BE);
 	if (err < 0) return err;
-	err = read_u64_t(fd, &header.dsd.metadata_ptr, BE);
+	err = read_u64_t(r, &header.dsd.metadata_ptr, BE);
 	if (err < 0) return err;
-	err = read(fd, header.fmt.chunk_header, sizeof(header.fmt.chunk_header));
+	err = read_bytes(r, header.fmt.chunk_header, sizeof(header.fmt.chunk_header));
 	if (err < 0) return err;
-	err = read_u64_t(fd, &header.fmt.chunk_size, BE);
+	err = read_u64_t(r, &header.fmt.chunk_size, BE);
 	if (err < 0) return err;
-	err = read_u32_t(fd, &header.fmt.format_version, BE);
+	err = read_u32_t(r, &header.fmt.format_version, BE);
 	if (err < 0) return err;
-	err = read_u32_t(fd, &header.fmt.format_id, BE);
+	err = read_u32_t(r, &header.fmt.format_id, BE);
 	if (err < 0) return err;
-	err = read_u32_t(fd, &header.fmt.channel_type, BE);
+	err = read_u32_t(r, &header.fmt.channel_type, BE);
 	if (err < 0) return err;
-	err = read_u32_t(fd, &header.fmt.channel_num, BE);
+	err = read_u32_t(r, &header.fmt.channel_num, BE);
 	if (err < 0) return err;
-	err = read_u32_t(fd, &header.fmt.sampling_freq, BE);
+	err = read_u32_t(r, &header.fmt.sampling_freq, BE);
 	if (err < 0) return err;
-	err = read_u32_t(fd, &header.fmt.bits_per_sample, BE);
+	err = read_u32_t(r, &header.fmt.bits_per_sample, BE);
 	if (err < 0) return err;
-	err = read_u64_t(fd, &header.fmt.sample_count, BE);
+	err = read_u64_t(r, &header.fmt.sample_count, BE);
 	if (err < 0) return err;
-	err = read_u32_t(fd, &header.fmt.block_size_per_ch, BE);
+	err = read_u32_t(r, &header.fmt.block_size_per_ch, BE);
 	if (err < 0) return err;
 
 	if (header.fmt.block_size_per_ch != DSF_BLOCK_SIZE)
 		return -1;
 
-	err = read_u32_t(fd, &header.fmt.reserved, BE);
+	err = read_u32_t(r, &header.fmt.reserved, BE);
 	if (err < 0) return err;
 
-	err = read(fd, header.data.chunk_header, sizeof(header.data.chunk_header));
+	err = read_bytes(r, header.data.chunk_header, sizeof(header.data.chunk_header));
 	if (err < 0) return err;
-	err = read_u64_t(fd, &header.data.chunk_size, BE);
+	err = read_u64_t(r, &header.data.chunk_size, BE);
 	if (err < 0) return err;
 
 	printf("DSD chunk header: [%.4s]\n", header.dsd.chunk_header);
@@ -109,7 +109,11 @@ int read_dsf_file(int fd, struct dsd_params *params)
 	params->sampling_freq   = header.fmt.sampling_freq;
 	params->bits_per_sample = header.fmt.bits_per_sample;
 	params->channel_num     = header.fmt.channel_num;
-	params->dsd_chunk_size  = header.data.chunk_size;
+	/* the data chunk size includes its own 12 byte header */
+	params->dsd_chunk_size  = header.data.chunk_size - 12;
+	params->data_offset     = reader_tell(r);
+	params->sample_count    = header.fmt.sample_count;
+	params->planar          = 1;
 
 	return 0;
 }
@@ -18,6 +18,7 @@
  */
 #include "bit_reverse.h"
 #include "read_utils.h"
+#include "track.h"
 #include <sys/time.h>
 #include <getopt.h>
 #include <string.h>
@@ -40,9 +41,12 @@ static int open_mode = 0;
 static int verbose = 0;
 static int nonblock = 0;
 static int no_period_wakeup = 0;
+static unsigned preload_ms = 2000;
 
 #define ALSA_FORMAT	SND_PCM_FORMAT_DSD_U32_LE
 #define FRAMECOUNT	(1024 * 128)
+/* DSD idle pattern, MSB first; 0x00 would be full-scale negative */
+#define DSD_SILENCE	0x69
 
 static int open_stream(snd_pcm_t **handle, const char *name, int dir,
 			unsigned int rate, unsigned int channels)
@@ -270,20 +274,12 @@ static ssize_t pcm_write(snd_pcm_t *handle, uint8_t *data, size_t count, int byt
 	return result;
 }
 
-static struct file_parser {
-	char ext[4];
-	int (*read_file)(int fd, struct dsd_params *params);
-	void (*interleave)(uint8_t *dest, const uint8_t *src, unsigned ch, snd_pcm_format_t fmt);
-} parsers[] = {
-  { .ext = ".dsf", .read_file = read_dsf_file, .interleave = interleaveDsfBlock },
-  { .ext = ".dff", .read_file = read_dff_file, .interleave = interleaveDffBlock },
-};
-
 enum {
 	OPT_VERSION = 1,
 	OPT_PERIOD_SIZE,
 	OPT_BUFFER_SIZE,
 	OPT_NO_PERIOD_WAKEUP,
+	OPT_PRELOAD,
 };
 
 static void usage(char *command)
@@ -299,6 +295,11 @@ _("Usage: %s [OPTION]... [FILE]...\n"
 "    --period-size=#     distance between interrupts is # frames\n"
 "    --buffer-size=#     buffer duration is # frames\n"
 "    --no-period-wakeup  set no period wakeup flag\n"
+"    --preload=#         read the first # ms of the next file while the\n"
+"                        current one plays (default 2000)\n"
+"\n"
+"Consecutive files with the same rate and channel count are played\n"
+"gaplessly on the same PCM.\n"
 )
 		, command);
 }
@@ -324,20 +325,142 @@ static long parse_long(const char *str, int *err)
 	return val;
 }
 
+/* pad the stream to a whole period so the last data is played, then stop */
+static void close_stream(snd_pcm_t *handle, uint64_t writesize, int bytes_per_frame)
+{
+	if (writesize % chunk_size) {
+		uint8_t *pad_buf = malloc((chunk_size - (writesize % chunk_size)) * bytes_per_frame);
+
+		memset(pad_buf, DSD_SILENCE, (chunk_size - (writesize % chunk_size)) * bytes_per_frame);
+		pcm_write(handle, pad_buf,
+				(chunk_size - (writesize % chunk_size)),
+				bytes_per_frame);
+		free(pad_buf);
+	}
+
+	snd_pcm_nonblock(handle, 0);
+	snd_pcm_drain(handle);
+	snd_pcm_nonblock(handle, nonblock);
+
+	snd_pcm_close(handle);
+}
+
+/*
+ * Bytes per channel of real audio in a block of r bytes, offset bytes into
+ * each channel. DSF blocks are one DSF_BLOCK_SIZE slice per channel and the
+ * last one is padded past sample_count; DFF data is byte interleaved and
+ * ends with the audio.
+ */
+static size_t block_valid_bytes(struct dsd_params *params, uint64_t offset, ssize_t r)
+{
+	unsigned ch = params->channel_num;
+	size_t valid;
+	uint64_t total;
+
+	if (!params->planar)
+		return (r + ch - 1) / ch;
+
+	/* a truncated block holds all of the first channels, part of the last */
+	valid = r > (ssize_t)((ch - 1) * DSF_BLOCK_SIZE) ?
+		r - (ch - 1) * DSF_BLOCK_SIZE : 0;
+	if (valid > DSF_BLOCK_SIZE)
+		valid = DSF_BLOCK_SIZE;
+
+	if (params->sample_count) {
+		total = (params->sample_count + 7) / 8;
+		if (offset >= total)
+			return 0;
+		if (valid > total - offset)
+			valid = total - offset;
+	}
+	return valid;
+}
+
+/*
+ * Play a track, adding the frames written to *writesize. The last block is
+ * cut at the end of its samples rather than written whole, so the next
+ * track on the same PCM follows it without a gap.
+ */
+static int play_track(snd_pcm_t *handle, struct dsd_track *track, uint64_t *writesize)
+{
+	struct dsd_params *params = &track->params;
+	int block_size, bytes_per_frame, frames;
+	uint8_t *buffer, *interleaved_buffer;
+	uint64_t offset = 0;
+	size_t valid;
+	unsigned c;
+	int err = 0;
+
+	block_size = params->channel_num * DSF_BLOCK_SIZE;
+	bytes_per_frame = params->channel_num * snd_pcm_format_width(ALSA_FORMAT) / 8;
+
+	buffer = malloc(2 * block_size);
+	if (!buffer) {
+		fprintf(stderr, "no memory for %d byte blocks\n", block_size);
+		return -ENOMEM;
+	}
+	interleaved_buffer = buffer + block_size;
+
+	while (track->left > 0) {
+		ssize_t r;
+
+		r = track_read(track, buffer, block_size);
+		if (r < 0) {
+			fprintf(stderr, "reading %d bytes failed (%d-%s)\n",
+					block_size, errno, strerror(errno));
+			err = -errno;
+			break;
+		}
+
+		/* r == 0 indicates end of file */
+		if (r == 0) {
+			fprintf(stderr, "%s: file ends before its audio data\n", track->name);
+			err = -EIO;
+			break;
+		}
+
+		if (params->bits_per_sample == 8)
+			bit_reverse_buffer(buffer, buffer + r);
+
+		frames = block_size / bytes_per_frame;
+		valid = block_valid_bytes(params, offset, r);
+		offset += DSF_BLOCK_SIZE;
+		if (valid < DSF_BLOCK_SIZE) {
+			/* the rest of the block, up to the end of its frame, stays idle */
+			if (params->planar) {
+				for (c = 0; c < params->channel_num; c++)
+					memset(buffer + c * DSF_BLOCK_SIZE + valid, DSD_SILENCE,
+					       DSF_BLOCK_SIZE - valid);
+			} else {
+				memset(buffer + r, DSD_SILENCE, block_size - r);
+			}
+			frames = (valid * params->channel_num + bytes_per_frame - 1) /
+				bytes_per_frame;
+			if (frames == 0)
+				continue;
+		}
+
+		track->parser->interleave(interleaved_buffer, buffer, params->channel_num, ALSA_FORMAT);
+
+		pcm_write(handle, interleaved_buffer,
+			frames, bytes_per_frame);
+
+		*writesize += frames;
+	}
+
+	free(buffer);
+	return err;
+}
+
 int main(int argc, char *argv[])
 {
-	int fd, err, block_size, bytes_per_frame, frames;
-	unsigned int len;
-	snd_pcm_t *playback_handle;
-	char *name;
-	struct dsd_params params;
-	uint64_t readsize=0;
-	uint64_t leftsize=0;
+	int err, bytes_per_frame = 0;
+	snd_pcm_t *playback_handle = NULL;
+	struct dsd_track tracks[2], *cur, *next, *tmp;
+	struct dsd_params stream_params = { 0 };
 	uint64_t writesize = 0;
-	int i, n;
-	struct file_parser parser;
 	char *pcm_name = "default";
-	int c, option_index;
+	int c, option_index, i, nfiles, failed = 0;
 
 	static const char short_options[] = "hD:NF:B:v";
 	static const struct option long_options[] = {
@@ -351,6 +474,7 @@ int main(int argc, char *argv[])
 		{"buffer-size", 1, 0, OPT_BUFFER_SIZE},
 		{"verbose", 0, 0, 'v'},
 		{"no-period-wakeup", 0, 0, OPT_NO_PERIOD_WAKEUP},
+		{"preload", 1, 0, OPT_PRELOAD},
 		{0, 0, 0, 0}
 	};
 
@@ -402,6 +526,13 @@ int main(int argc, char *argv[])
 		case OPT_NO_PERIOD_WAKEUP:
 			no_period_wakeup = 1;
 			break;
+		case OPT_PRELOAD:
+			preload_ms = parse_long(optarg, &err);
+			if (err < 0) {
+				error(_("invalid preload argument '%s'"), optarg);
+				return 1;
+			}
+			break;
 		case 'v':
 			verbose++;
 			break;
@@ -411,116 +542,80 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (optind <= argc - 1)
-		name = argv[optind++];
-	else {
+	nfiles = argc - optind;
+	if (nfiles <= 0) {
 		usage(command);
 		return EXIT_FAILURE;
 	}
 
-	fd = open(name, O_RDONLY);
-	if (fd < 0) {
-		fprintf(stderr, "Unable to open file (%m)\n");
-		return fd;
-	}
-
-	printf("File: [%s]\n", name);
-	printf("===============================\n");
-
-	len = strlen(name);
-	if (len <= 4) {
-		fprintf(stderr, "%s name too short!\n", name);
-		return EXIT_FAILURE;
-	}
-
-	for (i = 0, n = sizeof(parsers)/sizeof(parsers[0]); i < n; i++) {
-		if (strncmp(name + len - 4, parsers[i].ext, 4) != 0)
-			continue;
-		parser = parsers[i];
-		break;
-	}
+	cur = &tracks[0];
+	next = &tracks[1];
 
-	if (i == n) {
-		fprintf(stderr, "%s format not supported !\n", name);
-		return EXIT_FAILURE;
-	}
+	track_open(cur, argv[optind], preload_ms);
 
-	err = parser.read_file(fd, &params);
-	if (err < 0)
-		return err;
-
-	if ((err = open_stream(&playback_handle, pcm_name,
-				SND_PCM_STREAM_PLAYBACK,
-				params.sampling_freq / snd_pcm_format_width(ALSA_FORMAT),
-				params.channel_num) < 0))
-		return err;
-
-	if ((err = snd_pcm_prepare(playback_handle)) < 0) {
-		fprintf(stderr, "cannot prepare audio interface for use(%s)\n",
-			 snd_strerror(err));
-		return err;
-	}
+	for (i = 0; i < nfiles; i++) {
+		/* parse and preload the next file while this one plays */
+		if (i + 1 < nfiles)
+			track_prefetch_start(next, argv[optind + i + 1], preload_ms);
 
-	block_size = params.channel_num * DSF_BLOCK_SIZE;
-	bytes_per_frame = params.channel_num * snd_pcm_format_width(ALSA_FORMAT) / 8;
-	frames = block_size / bytes_per_frame;
-
-	leftsize = params.dsd_chunk_size;
-
-	while (leftsize > 0) {
-		size_t r;
-		uint8_t buffer[block_size];
-		uint8_t interleaved_buffer[block_size];
-
-		if (leftsize >= block_size)
-			readsize = block_size;
-		else
-			readsize = leftsize;
-
-		r = read_full(fd, buffer, readsize);
-		if (r < 0) {
-			fprintf(stderr, "reading %lu bytes failed (%d-%s)\n",
-					readsize, errno, strerror(errno));
-			break;
+		if (cur->err < 0) {
+			failed++;
+			goto next_track;
 		}
 
-		/* r == 0 indicates end of file */
-		if (r == 0)
-			break;
+		printf("File: [%s]\n", cur->name);
+		printf("===============================\n");
 
-		if (r < block_size) {
-			memset(buffer + r, 0x00, block_size - r);
+		if (playback_handle &&
+		    (stream_params.sampling_freq != cur->params.sampling_freq ||
+		     stream_params.channel_num != cur->params.channel_num)) {
+			close_stream(playback_handle, writesize, bytes_per_frame);
+			playback_handle = NULL;
 		}
 
-		leftsize = leftsize - r;
+		if (!playback_handle) {
+			if ((err = open_stream(&playback_handle, pcm_name,
+						SND_PCM_STREAM_PLAYBACK,
+						cur->params.sampling_freq / snd_pcm_format_width(ALSA_FORMAT),
+						cur->params.channel_num)) < 0) {
+				playback_handle = NULL;
+				failed++;
+				goto next_track;
+			}
 
-		if (params.bits_per_sample == 8)
-			bit_reverse_buffer(buffer, buffer + block_size);
+			if ((err = snd_pcm_prepare(playback_handle)) < 0) {
+				fprintf(stderr, "cannot prepare audio interface for use(%s)\n",
+					 snd_strerror(err));
+				snd_pcm_close(playback_handle);
+				playback_handle = NULL;
+				failed++;
+				goto next_track;
+			}
 
-		parser.interleave(interleaved_buffer, buffer, params.channel_num, ALSA_FORMAT);
+			stream_params = cur->params;
+			bytes_per_frame = cur->params.channel_num * snd_pcm_format_width(ALSA_FORMAT) / 8;
+			writesize = 0;
+		}
 
-		pcm_write(playback_handle, interleaved_buffer,
-			frames, bytes_per_frame);
+		if (play_track(playback_handle, cur, &writesize) < 0)
+			failed++;
 
-		writesize += frames;
+next_track:
+		track_close(cur);
+		if (i + 1 < nfiles) {
+			track_prefetch_wait(next);
+			tmp = cur;
+			cur = next;
+			next = tmp;
+		}
 	}
 
-	if (writesize % chunk_size) {
-		uint8_t *zero_buf = malloc((chunk_size - (writesize % chunk_size)) * bytes_per_frame);
+	if (playback_handle)
+		close_stream(playback_handle, writesize, bytes_per_frame);
 
-		memset(zero_buf, 0, (chunk_size - (writesize % chunk_size)) * bytes_per_frame);
-		pcm_write(playback_handle, zero_buf,
-				(chunk_size - (writesize % chunk_size)),
-				bytes_per_frame);
-		free(zero_buf);
+	if (failed) {
+		fprintf(stderr, "%d of %d files could not be played\n", failed, nfiles);
+		return EXIT_FAILURE;
 	}
-
-	snd_pcm_nonblock(playback_handle, 0);
-	snd_pcm_drain(playback_handle);
-	snd_pcm_nonblock(playback_handle, nonblock);
-
-	snd_pcm_close(playback_handle);
-	close(fd);
-
 	return 0;
 }
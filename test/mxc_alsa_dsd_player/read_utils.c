@@ -9,78 +9,149 @@
 
 #include "read_utils.h"
 
-int read_u16_t(int fd, uint16_t *val, int be)
+void reader_init(struct dsd_reader *r, int fd)
 {
-	int err;
-	unsigned char buff[2];
+	r->fd = fd;
+	r->offset = lseek(fd, 0, SEEK_CUR);
+	if (r->offset < 0)
+		r->offset = 0;
+	r->pos = 0;
+	r->len = 0;
+}
 
-	err = read(fd, buff, sizeof(buff));
-	if (err < 0)
-		return err;
+off_t reader_tell(struct dsd_reader *r)
+{
+	return r->offset + r->pos;
+}
 
-	if (be) (*val) = buff[0] << 8 | buff[1];
-	else    (*val) = buff[1] << 8 | buff[0];
+static int reader_fill(struct dsd_reader *r)
+{
+	ssize_t n;
+
+	/* keep the unread tail, top the buffer up with one read */
+	if (r->pos) {
+		memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+		r->offset += r->pos;
+		r->len -= r->pos;
+		r->pos = 0;
+	}
+
+	n = read_full(r->fd, r->buf + r->len, sizeof(r->buf) - r->len);
+	if (n < 0)
+		return n;
+	if (n == 0)
+		return -1;
 
+	r->len += n;
 	return 0;
 }
 
-int read_u32_t(int fd, uint32_t *val, int be)
+int read_bytes(struct dsd_reader *r, void *dst, size_t size)
 {
+	uint8_t *p = dst;
+	size_t n;
 	int err;
-	uint16_t hval, lval;
-	uint32_t xval;
 
-	err = read_u16_t(fd, &lval, be);
-	if (err < 0)
-		return err;
+	while (size > 0) {
+		if (r->pos == r->len) {
+			err = reader_fill(r);
+			if (err < 0)
+				return err;
+		}
+		n = r->len - r->pos;
+		if (n > size)
+			n = size;
+		memcpy(p, r->buf + r->pos, n);
+		r->pos += n;
+		p += n;
+		size -= n;
+	}
 
-	err = read_u16_t(fd, &hval, be);
-	if (err < 0)
-		return err;
+	return 0;
+}
 
-	xval = hval;
+int read_skip(struct dsd_reader *r, uint64_t size)
+{
+	off_t target;
 
-	if (be) (*val) = (lval << 16) | xval;
-	else    (*val) = (xval << 16) | lval;
+	if (size <= r->len - r->pos) {
+		r->pos += size;
+		return 0;
+	}
+
+	/* large chunks (ID3, comments, ...) are seeked over, not read */
+	target = reader_tell(r) + size;
+	if (lseek(r->fd, target, SEEK_SET) < 0)
+		return -errno;
 
+	r->offset = target;
+	r->pos = 0;
+	r->len = 0;
 	return 0;
 }
 
-int read_u64_t(int fd, uint64_t *val, int be)
+static int read_uint(struct dsd_reader *r, uint64_t *val, int size, int be)
 {
-	int err;
-	uint32_t hval, lval;
-	uint64_t xval;
+	uint8_t buff[8];
+	int err, i;
 
-	err = read_u32_t(fd, &lval, be);
+	err = read_bytes(r, buff, size);
 	if (err < 0)
 		return err;
 
-	err = read_u32_t(fd, &hval, be);
+	*val = 0;
+	for (i = 0; i < size; i++) {
+		if (be) (*val) = (*val) << 8 | buff[i];
+		else    (*val) = (*val) << 8 | buff[size - 1 - i];
+	}
+
+	return 0;
+}
+
+int read_u16_t(struct dsd_reader *r, uint16_t *val, int be)
+{
+	uint64_t xval;
+	int err;
+
+	err = read_uint(r, &xval, sizeof(*val), be);
 	if (err < 0)
 		return err;
 
-	xval = hval;
+	(*val) = xval;
+	return 0;
+}
 
-	if (be) {
-		(*val) = lval;
-		(*val) = (*val) << 32 | xval;
-	} else {
-		(*val) = (xval << 32) | lval;
-	}
+int read_u32_t(struct dsd_reader *r, uint32_t *val, int be)
+{
+	uint64_t xval;
+	int err;
+
+	err = read_uint(r, &xval, sizeof(*val), be);
+	if (err < 0)
+		return err;
 
+	(*val) = xval;
 	return 0;
 }
 
-size_t read_full(int fd, void *_buffer, size_t size)
+int read_u64_t(struct dsd_reader *r, uint64_t *val, int be)
+{
+	return read_uint(r, val, sizeof(*val), be);
+}
+
+ssize_t read_full(int fd, void *_buffer, size_t size)
 {
 	uint8_t *buffer = (uint8_t *)_buffer;
-	size_t r = 0, to_read = size;
+	ssize_t r = 0;
+	size_t to_read = size;
 
 	while (to_read > 0) {
 		r = read(fd, buffer, to_read);
-		if (r < 0)
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
 			return r;
+		}
 		if (r == 0) {
 			/* Indicates end of file */
 			break;
@@ -91,4 +162,3 @@ size_t read_full(int fd, void *_buffer, size_t size)
 
 	return size - to_read;
 }
-
@@ -21,20 +21,43 @@
 #define DSF_BLOCK_SIZE		4096
 #define DSF_MAX_CHANNELS	6
 
+/*
+ * Headers are parsed out of one buffered read instead of a syscall per
+ * field. DSF headers are 92 bytes and DFF property chunks are a few hundred,
+ * so a single fill covers them in practice; whatever is left in the buffer
+ * after the header is the start of the audio data.
+ */
+#define DSD_READER_SIZE		4096
+
+struct dsd_reader {
+	int fd;
+	off_t offset;	/* file offset of buf[0] */
+	size_t pos;
+	size_t len;
+	uint8_t buf[DSD_READER_SIZE];
+};
+
 struct dsd_params {
 	uint32_t sampling_freq;
 	uint32_t bits_per_sample;
 	uint32_t channel_num;
 	uint64_t dsd_chunk_size;
+	off_t data_offset;
+	uint64_t sample_count;	/* per channel, 0 if the data chunk is exact */
+	int planar;		/* DSF: each block holds one slice per channel */
 };
 
-int read_u16_t(int fd, uint16_t *val, int be);
-int read_u32_t(int fd, uint32_t *val, int be);
-int read_u64_t(int fd, uint64_t *val, int be);
-size_t read_full(int fd, void *_buffer, size_t size);
+void reader_init(struct dsd_reader *r, int fd);
+off_t reader_tell(struct dsd_reader *r);
+int read_bytes(struct dsd_reader *r, void *dst, size_t size);
+int read_skip(struct dsd_reader *r, uint64_t size);
+int read_u16_t(struct dsd_reader *r, uint16_t *val, int be);
+int read_u32_t(struct dsd_reader *r, uint32_t *val, int be);
+int read_u64_t(struct dsd_reader *r, uint64_t *val, int be);
+ssize_t read_full(int fd, void *_buffer, size_t size);
 
-int read_dsf_file(int fd, struct dsd_params *params);
-int read_dff_file(int fd, struct dsd_params *params);
+int read_dsf_file(struct dsd_reader *r, struct dsd_params *params);
+int read_dff_file(struct dsd_reader *r, struct dsd_params *params);
 
 void interleaveDsfBlock(uint8_t *dest, const uint8_t *src, unsigned channels, snd_pcm_format_t format);
 void interleaveDffBlock(uint8_t *dest, const uint8_t *src, unsigned channels, snd_pcm_format_t format);
@@ -0,0 +1,202 @@
+/*
+ * Copyright 2018 NXP
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ */
+
+#include "track.h"
+
+static const struct file_parser parsers[] = {
+  { .ext = ".dsf", .read_file = read_dsf_file, .interleave = interleaveDsfBlock },
+  { .ext = ".dff", .read_file = read_dff_file, .interleave = interleaveDffBlock },
+};
+
+static const struct file_parser *find_parser(const char *name)
+{
+	size_t len = strlen(name);
+	unsigned int i;
+
+	if (len <= 4) {
+		fprintf(stderr, "%s name too short!\n", name);
+		return NULL;
+	}
+
+	for (i = 0; i < sizeof(parsers)/sizeof(parsers[0]); i++) {
+		if (strncmp(name + len - 4, parsers[i].ext, 4) == 0)
+			return &parsers[i];
+	}
+
+	fprintf(stderr, "%s format not supported !\n", name);
+	return NULL;
+}
+
+static int track_preload(struct dsd_track *t, struct dsd_reader *r)
+{
+	struct dsd_params *params = &t->params;
+	size_t block_size = params->channel_num * DSF_BLOCK_SIZE;
+	size_t buffered = r->len - r->pos;
+	uint64_t len;
+	ssize_t n;
+
+	/* DSD rate in bits/s per channel, rounded up to whole blocks */
+	len = (uint64_t)params->sampling_freq / 8 * params->channel_num *
+		t->preload_ms / 1000;
+	len = (len + block_size - 1) / block_size * block_size;
+	if (len > params->dsd_chunk_size)
+		len = params->dsd_chunk_size;
+
+	t->preload_len = 0;
+	t->preload_pos = 0;
+	t->left = params->dsd_chunk_size;
+
+	if (buffered > len)
+		buffered = len;
+
+	if (len) {
+		t->preload = malloc(len);
+		if (!t->preload)
+			return -ENOMEM;
+
+		/* the header read already pulled in the start of the data */
+		memcpy(t->preload, r->buf + r->pos, buffered);
+
+		n = read_full(t->fd, t->preload + buffered, len - buffered);
+		if (n < 0)
+			return -errno;
+		t->preload_len = buffered + n;
+	}
+
+	/* only part of the header buffer was used, rewind to the preload end */
+	if (buffered < r->len - r->pos) {
+		if (lseek(t->fd, params->data_offset + t->preload_len, SEEK_SET) < 0)
+			return -errno;
+	}
+
+	return 0;
+}
+
+static void track_init(struct dsd_track *t, const char *name, unsigned preload_ms)
+{
+	memset(t, 0, sizeof(*t));
+	t->name = name;
+	t->preload_ms = preload_ms;
+	t->fd = -1;
+}
+
+static int track_load(struct dsd_track *t)
+{
+	const char *name = t->name;
+	struct dsd_reader r;
+	int err;
+
+	t->parser = find_parser(name);
+	if (!t->parser)
+		return t->err = -EINVAL;
+
+	t->fd = open(name, O_RDONLY);
+	if (t->fd < 0) {
+		fprintf(stderr, "Unable to open file %s (%m)\n", name);
+		return t->err = -errno;
+	}
+
+	reader_init(&r, t->fd);
+
+	err = t->parser->read_file(&r, &t->params);
+	if (err < 0) {
+		fprintf(stderr, "%s: invalid header\n", name);
+		goto fail;
+	}
+
+	err = track_preload(t, &r);
+	if (err < 0) {
+		fprintf(stderr, "%s: preload failed (%s)\n", name, strerror(-err));
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	track_close(t);
+	return t->err = err;
+}
+
+int track_open(struct dsd_track *t, const char *name, unsigned preload_ms)
+{
+	track_init(t, name, preload_ms);
+	return track_load(t);
+}
+
+ssize_t track_read(struct dsd_track *t, uint8_t *buffer, size_t size)
+{
+	size_t done = 0, n;
+	ssize_t r;
+
+	if (size > t->left)
+		size = t->left;
+
+	if (t->preload_pos < t->preload_len) {
+		n = t->preload_len - t->preload_pos;
+		if (n > size)
+			n = size;
+		memcpy(buffer, t->preload + t->preload_pos, n);
+		t->preload_pos += n;
+		done = n;
+
+		/* drop the preload as soon as it is consumed */
+		if (t->preload_pos == t->preload_len) {
+			free(t->preload);
+			t->preload = NULL;
+		}
+	}
+
+	if (done < size) {
+		r = read_full(t->fd, buffer + done, size - done);
+		if (r < 0)
+			return r;
+		done += r;
+	}
+
+	t->left -= done;
+	return done;
+}
+
+void track_close(struct dsd_track *t)
+{
+	free(t->preload);
+	t->preload = NULL;
+	if (t->fd >= 0)
+		close(t->fd);
+	t->fd = -1;
+}
+
+static void *prefetch_thread(void *arg)
+{
+	track_load(arg);
+	return NULL;
+}
+
+int track_prefetch_start(struct dsd_track *t, const char *name, unsigned preload_ms)
+{
+	track_init(t, name, preload_ms);
+
+	if (pthread_create(&t->thread, NULL, prefetch_thread, t)) {
+		/* fall back to a synchronous open */
+		return track_load(t);
+	}
+
+	t->prefetching = 1;
+	return 0;
+}
+
+int track_prefetch_wait(struct dsd_track *t)
+{
+	if (t->prefetching) {
+		pthread_join(t->thread, NULL);
+		t->prefetching = 0;
+	}
+
+	return t->err;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright 2018 NXP
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ */
+
+#ifndef TRACK_H_
+#define TRACK_H_
+
+#include <pthread.h>
+#include "read_utils.h"
+
+struct file_parser {
+	char ext[4];
+	int (*read_file)(struct dsd_reader *r, struct dsd_params *params);
+	void (*interleave)(uint8_t *dest, const uint8_t *src, unsigned ch, snd_pcm_format_t fmt);
+};
+
+/*
+ * One playlist entry. The header is parsed and the first preload_ms of
+ * audio data are read into memory by track_open(), which the player runs
+ * on a prefetch thread for the next entry while the current one plays.
+ */
+struct dsd_track {
+	const char *name;
+	int fd;
+	const struct file_parser *parser;
+	struct dsd_params params;
+	uint8_t *preload;
+	size_t preload_len;
+	size_t preload_pos;
+	uint64_t left;		/* audio bytes not yet handed to the player */
+	int err;
+
+	pthread_t thread;
+	int prefetching;
+	unsigned preload_ms;
+};
+
+int track_open(struct dsd_track *t, const char *name, unsigned preload_ms);
+ssize_t track_read(struct dsd_track *t, uint8_t *buffer, size_t size);
+void track_close(struct dsd_track *t);
+
+int track_prefetch_start(struct dsd_track *t, const char *name, unsigned preload_ms);
+int track_prefetch_wait(struct dsd_track *t);
+
+#endif
@@ -11,6 +11,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <alsa/asoundlib.h>
 
 /*===== Global variable =====*/
@@ -27,12 +34,23 @@ unsigned int full_rates[rate_count] = {8000, 11025, 16000, 22050, 32000, 44100,
 void help(void)
 {
     printf("Usage: mxc_alsa_hw_params.out <device> <substream> <attribute>\n");
-    printf("This tool is used to get sound card hardware parameters");
+    printf("       mxc_alsa_hw_params.out <device> s <capture device> [options]\n");
+    printf("This tool is used to get sound card hardware parameters\n");
     printf("<device> : the audio device like hw:0,0\n");
     printf("<substeam> : p is the playback substream and c is the capture substream\n");
+    printf("            s sweeps rate/format/period/buffer with a playback to capture loopback\n");
     printf("<attribute> : f to get the supported format list; r to get the supported rate list;\n");
     printf("            c to get the supported channel list\n");
+    printf("Sweep options:\n");
+    printf("  -r <rate>     only sweep this rate\n");
+    printf("  -f <format>   only sweep this format, e.g. S16_LE\n");
+    printf("  -c <channels> channel count (default: 2 if supported, else the minimum)\n");
+    printf("  -p <frames>   smallest period size (default 16)\n");
+    printf("  -P <frames>   largest period size (default 8192)\n");
+    printf("  -t <seconds>  run time per combination (default 2)\n");
+    printf("  -o <file>     write the CSV there instead of stdout\n");
     printf("For example: mxc_alsa_hw_params.out hw:0,0 p r\n");
+    printf("             mxc_alsa_hw_params.out hw:Loopback,0 s hw:Loopback,1 -r 48000\n");
     exit(1);
 }
 
@@ -206,6 +224,566 @@ int get_channels(snd_pcm_t *handle)
     return rv;
 }
 
+/*===== loopback sweep =====*/
+/*
+ * The sweep plays a pulse train on the playback device and looks for it on
+ * the capture device, which must be wired back to it: a loopback cable, or
+ * the two halves of the snd-aloop card (hw:Loopback,0 and hw:Loopback,1).
+ * Capture paces the loop: each captured period is answered by one played
+ * period, so the playback buffer stays full and the measured round trip is
+ * what an application echoing its input would see.
+ */
+#define SWEEP_PERIOD_MIN 16
+#define SWEEP_PERIOD_MAX 8192
+#define SWEEP_SECONDS 2
+#define PULSE_FRAMES 8
+#define PULSE_RING 16
+
+unsigned int sweep_periods[] = {2, 4, 8};
+#define sweep_periods_count (sizeof(sweep_periods) / sizeof(sweep_periods[0]))
+
+struct sweep_opts
+{
+    unsigned int rate;              /* 0 sweeps every supported rate */
+    snd_pcm_format_t format;        /* UNKNOWN sweeps every supported format */
+    unsigned int channels;          /* 0 picks a count both devices support */
+    snd_pcm_uframes_t period_min;
+    snd_pcm_uframes_t period_max;
+    unsigned int seconds;
+    FILE *csv;
+};
+
+struct sweep_result
+{
+    unsigned long wakeups;
+    double jitter_avg_us;
+    double jitter_std_us;
+    double jitter_max_us;
+    unsigned int xruns;
+    double cpu_pct;
+    unsigned int pulses;
+    double path_ms;                 /* playback frame to capture frame */
+    double rt_min_ms;               /* writei() return to readi() return */
+    double rt_avg_ms;
+    double rt_max_ms;
+};
+
+/* state of one timed loopback run */
+struct sweep_run
+{
+    snd_pcm_t *play;
+    snd_pcm_t *cap;
+    int linked;
+    snd_pcm_format_t format;
+    int sample_bytes;
+    int sample_shift;
+    unsigned int channels;
+    snd_pcm_uframes_t period;
+    snd_pcm_uframes_t buffer;
+    unsigned long interval;         /* frames between pulses */
+    unsigned long wpos;             /* frames written since (re)start */
+    unsigned long rpos;             /* frames read since (re)start */
+    unsigned long next_detect;      /* ignore capture before this frame */
+    unsigned long pulse_id[PULSE_RING];
+    double pulse_time[PULSE_RING];
+    unsigned char *pbuf;
+    unsigned char *cbuf;
+    double last_wake;
+};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static double cpu_ms(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000.0 +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000.0;
+}
+
+/*===== sweep_format_ok =====*/
+/**
+ @brief  Check whether the sweep can generate and detect the pulse in a format.
+ @param  Input:    fmt - sample format.
+ @return Nonzero for signed little endian integer formats.
+ **/
+int sweep_format_ok(snd_pcm_format_t fmt)
+{
+    if (snd_pcm_format_linear(fmt) != 1 || snd_pcm_format_signed(fmt) != 1)
+        return 0;
+    if (snd_pcm_format_physical_width(fmt) > 32)
+        return 0;
+    return fmt == SND_PCM_FORMAT_S8 || snd_pcm_format_little_endian(fmt) == 1;
+}
+
+/* store a full scale 32 bit sample value in the run's format */
+static void put_sample(struct sweep_run *run, unsigned char *p, int32_t v)
+{
+    uint32_t u = (uint32_t)(v >> run->sample_shift);
+    int i;
+
+    for (i = 0; i < run->sample_bytes; i++)
+        p[i] = u >> (8 * i);
+}
+
+static int32_t get_sample(struct sweep_run *run, const unsigned char *p)
+{
+    uint32_t u = 0;
+    int i;
+
+    for (i = 0; i < run->sample_bytes; i++)
+        u |= (uint32_t)p[i] << (8 * i);
+    return (int32_t)(u << run->sample_shift);
+}
+
+/*===== sweep_setup =====*/
+/**
+ @brief  Install exactly the given configuration on one side of the loop.
+ @param  Input:    handle - audio substeam handle.
+                   run - format, channels, period and buffer to use.
+                   rate - sample rate.
+ @return On failure - negative error code.
+         On success - zero.
+ **/
+int sweep_setup(snd_pcm_t *handle, struct sweep_run *run, unsigned int rate)
+{
+    int rv = 0;
+    snd_pcm_hw_params_t *params;
+    snd_pcm_sw_params_t *swparams;
+
+    snd_pcm_hw_params_alloca(&params);
+    snd_pcm_sw_params_alloca(&swparams);
+
+    if ((rv = snd_pcm_hw_params_any(handle, params)) < 0 ||
+        (rv = snd_pcm_hw_params_set_rate_resample(handle, params, 0)) < 0 ||
+        (rv = snd_pcm_hw_params_set_access(handle, params,
+                                           SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+        (rv = snd_pcm_hw_params_set_format(handle, params, run->format)) < 0 ||
+        (rv = snd_pcm_hw_params_set_channels(handle, params, run->channels)) < 0 ||
+        (rv = snd_pcm_hw_params_set_rate(handle, params, rate, 0)) < 0 ||
+        (rv = snd_pcm_hw_params_set_period_size(handle, params, run->period, 0)) < 0 ||
+        (rv = snd_pcm_hw_params_set_buffer_size(handle, params, run->buffer)) < 0 ||
+        (rv = snd_pcm_hw_params(handle, params)) < 0)
+        return rv;
+
+    /* both sides are started explicitly, never by a write or read */
+    if ((rv = snd_pcm_sw_params_current(handle, swparams)) < 0 ||
+        (rv = snd_pcm_sw_params_set_avail_min(handle, swparams, run->period)) < 0 ||
+        (rv = snd_pcm_sw_params_set_start_threshold(handle, swparams,
+                                                     run->buffer * 2)) < 0 ||
+        (rv = snd_pcm_sw_params(handle, swparams)) < 0)
+        return rv;
+    return 0;
+}
+
+/* generate the next period of the pulse train into pbuf */
+static int fill_period(struct sweep_run *run, snd_pcm_uframes_t frames)
+{
+    unsigned long pos;
+    snd_pcm_uframes_t f;
+    unsigned int ch;
+    unsigned char *p = run->pbuf;
+    int32_t v;
+    int pulse = -1;
+
+    for (f = 0; f < frames; f++)
+    {
+        pos = run->wpos + f;
+        /* no pulse in the first interval, it is already queued at start */
+        v = 0;
+        if (pos >= run->interval && pos % run->interval < PULSE_FRAMES)
+        {
+            v = INT32_MAX / 2;
+            if (pos % run->interval == 0)
+                pulse = pos / run->interval;
+        }
+        for (ch = 0; ch < run->channels; ch++, p += run->sample_bytes)
+            put_sample(run, p, v);
+    }
+    return pulse;
+}
+
+/*===== sweep_start =====*/
+/**
+ @brief  (Re)start both streams with a full playback buffer.
+ @param  Input:    run - loop state.
+ @return On failure - negative error code.
+         On success - zero.
+ **/
+int sweep_start(struct sweep_run *run)
+{
+    int rv = 0;
+    int i = 0;
+    snd_pcm_uframes_t done;
+    snd_pcm_sframes_t n;
+
+    snd_pcm_drop(run->play);
+    snd_pcm_drop(run->cap);
+    if ((rv = snd_pcm_prepare(run->play)) < 0)
+        return rv;
+    if (!run->linked && (rv = snd_pcm_prepare(run->cap)) < 0)
+        return rv;
+
+    run->wpos = 0;
+    run->rpos = 0;
+    run->next_detect = 0;
+    run->last_wake = 0;
+    for (i = 0; i < PULSE_RING; i++)
+        run->pulse_id[i] = 0;
+
+    for (done = 0; done < run->buffer; done += n)
+    {
+        fill_period(run, run->period);
+        n = snd_pcm_writei(run->play, run->pbuf, run->period);
+        if (n < 0)
+            return n;
+        run->wpos += n;
+    }
+
+    if ((rv = snd_pcm_start(run->play)) < 0)
+        return rv;
+    if (!run->linked && (rv = snd_pcm_start(run->cap)) < 0)
+        return rv;
+    return 0;
+}
+
+/*===== sweep_measure =====*/
+/**
+ @brief  Run one configuration for a fixed time and collect the statistics.
+ @param  Input:    run - configured loop.
+                   rate - sample rate.
+                   seconds - capture time to run.
+         Output:   res - jitter, xrun, CPU and latency figures.
+ @return On failure - negative error code.
+         On success - zero.
+ **/
+int sweep_measure(struct sweep_run *run, unsigned int rate, unsigned int seconds,
+                  struct sweep_result *res)
+{
+    int rv = 0;
+    int pulse = 0;
+    int slot = 0;
+    unsigned long total = 0;
+    unsigned long pos = 0;
+    unsigned long jitter_n = 0;
+    snd_pcm_sframes_t n;
+    snd_pcm_sframes_t f;
+    double t, rt, dev;
+    double jitter_sum = 0, jitter_sq = 0;
+    double rt_sum = 0, path_sum = 0;
+    double wall0, cpu0;
+    int32_t threshold = INT32_MAX / 4;
+    int32_t v;
+
+    memset(res, 0, sizeof(*res));
+    res->rt_min_ms = 1e9;
+
+    wall0 = now_ms();
+    cpu0 = cpu_ms();
+    if ((rv = sweep_start(run)) < 0)
+        return rv;
+
+    while (total < (unsigned long)rate * seconds)
+    {
+        n = snd_pcm_readi(run->cap, run->cbuf, run->period);
+        t = now_ms();
+        if (n == -EPIPE || n == -ESTRPIPE)
+        {
+            res->xruns++;
+            if ((rv = sweep_start(run)) < 0)
+                return rv;
+            continue;
+        }
+        if (n < 0)
+            return n;
+
+        /* the first wakeups still carry the start-up skew */
+        res->wakeups++;
+        if (run->last_wake > 0 && run->rpos > 2 * run->period)
+        {
+            dev = fabs((t - run->last_wake) - n * 1000.0 / rate) * 1000.0;
+            jitter_sum += dev;
+            jitter_sq += dev * dev;
+            if (dev > res->jitter_max_us)
+                res->jitter_max_us = dev;
+            jitter_n++;
+        }
+        run->last_wake = t;
+
+        /* channel 0 crossing the threshold marks a pulse */
+        for (f = 0; f < n; f++)
+        {
+            pos = run->rpos + f;
+            if (pos < run->next_detect)
+                continue;
+            v = get_sample(run, run->cbuf + f * run->channels * run->sample_bytes);
+            if (v < threshold && v > -threshold)
+                continue;
+            run->next_detect = pos + run->interval / 2;
+            slot = (pos / run->interval) % PULSE_RING;
+            if (run->pulse_id[slot] != pos / run->interval)
+                continue;
+            res->pulses++;
+            path_sum += (pos % run->interval) * 1000.0 / rate;
+            rt = t - run->pulse_time[slot];
+            rt_sum += rt;
+            if (rt < res->rt_min_ms)
+                res->rt_min_ms = rt;
+            if (rt > res->rt_max_ms)
+                res->rt_max_ms = rt;
+        }
+        run->rpos += n;
+        total += n;
+
+        pulse = fill_period(run, n);
+        f = snd_pcm_writei(run->play, run->pbuf, n);
+        if (f == -EPIPE || f == -ESTRPIPE)
+        {
+            res->xruns++;
+            if ((rv = sweep_start(run)) < 0)
+                return rv;
+            continue;
+        }
+        if (f < 0)
+            return f;
+        if (pulse > 0)
+        {
+            run->pulse_id[pulse % PULSE_RING] = pulse;
+            run->pulse_time[pulse % PULSE_RING] = now_ms();
+        }
+        run->wpos += f;
+    }
+
+    snd_pcm_drop(run->play);
+    snd_pcm_drop(run->cap);
+
+    res->cpu_pct = (cpu_ms() - cpu0) * 100.0 / (now_ms() - wall0);
+    if (jitter_n)
+    {
+        res->jitter_avg_us = jitter_sum / jitter_n;
+        res->jitter_std_us = sqrt(jitter_sq / jitter_n -
+                                  res->jitter_avg_us * res->jitter_avg_us);
+    }
+    if (res->pulses)
+    {
+        res->path_ms = path_sum / res->pulses;
+        res->rt_avg_ms = rt_sum / res->pulses;
+    }
+    else
+        res->rt_min_ms = 0;
+    return 0;
+}
+
+/*===== sweep_restrict =====*/
+/**
+ @brief  Narrow a full parameter space to one rate, format and channel count.
+ @return On failure - None zero value.
+         On success - zero.
+ **/
+int sweep_restrict(snd_pcm_t *handle, snd_pcm_hw_params_t *params, unsigned int rate,
+                   snd_pcm_format_t fmt, unsigned int channels)
+{
+    if (snd_pcm_hw_params_any(handle, params) < 0)
+        return 1;
+    if (snd_pcm_hw_params_set_rate_resample(handle, params, 0) < 0 ||
+        snd_pcm_hw_params_set_access(handle, params, SND_PCM_ACCESS_RW_INTERLEAVED) < 0 ||
+        snd_pcm_hw_params_set_format(handle, params, fmt) < 0 ||
+        snd_pcm_hw_params_set_channels(handle, params, channels) < 0 ||
+        snd_pcm_hw_params_set_rate(handle, params, rate, 0) < 0)
+        return 1;
+    return 0;
+}
+
+/*===== sweep_channels =====*/
+/**
+ @brief  Pick a channel count both ends of the loop support.
+ @return On failure - zero.
+         On success - the channel count.
+ **/
+unsigned int sweep_channels(snd_pcm_t *play, snd_pcm_t *cap, unsigned int wanted)
+{
+    unsigned int i = 0;
+    unsigned int min_chn = 0;
+    unsigned int max_chn = 0;
+    snd_pcm_hw_params_t *pp;
+    snd_pcm_hw_params_t *cp;
+
+    snd_pcm_hw_params_alloca(&pp);
+    snd_pcm_hw_params_alloca(&cp);
+    if (snd_pcm_hw_params_any(play, pp) < 0 || snd_pcm_hw_params_any(cap, cp) < 0)
+        return 0;
+
+    if (wanted)
+    {
+        if (snd_pcm_hw_params_test_channels(play, pp, wanted) == 0 &&
+            snd_pcm_hw_params_test_channels(cap, cp, wanted) == 0)
+            return wanted;
+        return 0;
+    }
+    if (snd_pcm_hw_params_test_channels(play, pp, 2) == 0 &&
+        snd_pcm_hw_params_test_channels(cap, cp, 2) == 0)
+        return 2;
+
+    snd_pcm_hw_params_get_channels_min(pp, &min_chn);
+    snd_pcm_hw_params_get_channels_max(pp, &max_chn);
+    for (i = min_chn; i <= max_chn; i++)
+    {
+        if (snd_pcm_hw_params_test_channels(play, pp, i) == 0 &&
+            snd_pcm_hw_params_test_channels(cap, cp, i) == 0)
+            return i;
+    }
+    return 0;
+}
+
+/*===== sweep =====*/
+/**
+ @brief  Run the loopback measurement for every configuration both devices
+         accept and write one CSV row per configuration.
+ @param  Input:    play_dev - playback device.
+                   cap_dev - capture device wired back to play_dev.
+                   opts - sweep limits and output.
+ @return On failure - None zero value.
+         On success - zero.
+ **/
+int sweep(char *play_dev, char *cap_dev, struct sweep_opts *opts)
+{
+    int rv = 0;
+    int i = 0;
+    int fmt = 0;
+    unsigned int j = 0;
+    unsigned int rate = 0;
+    unsigned int runs = 0;
+    snd_pcm_uframes_t period;
+    snd_pcm_hw_params_t *pp;
+    snd_pcm_hw_params_t *cp;
+    struct sweep_run run;
+    struct sweep_result res;
+    const char *status;
+
+    memset(&run, 0, sizeof(run));
+    open_stream(play_dev, "p", &run.play);
+    open_stream(cap_dev, "c", &run.cap);
+    snd_pcm_hw_params_alloca(&pp);
+    snd_pcm_hw_params_alloca(&cp);
+
+    run.channels = sweep_channels(run.play, run.cap, opts->channels);
+    if (run.channels == 0)
+    {
+        printf("No channel count supported by both devices.\n");
+        exit(1);
+    }
+    /* big enough for the largest period in the widest format */
+    run.pbuf = malloc(opts->period_max * run.channels * 4);
+    run.cbuf = malloc(opts->period_max * run.channels * 4);
+    if (!run.pbuf || !run.cbuf)
+    {
+        printf("Can't allocate period buffers.\n");
+        exit(1);
+    }
+
+    fprintf(opts->csv, "rate,format,channels,period,buffer,periods,period_ms,buffer_ms,"
+                       "wakeups,jitter_avg_us,jitter_std_us,jitter_max_us,xruns,cpu_pct,"
+                       "pulses,path_ms,rt_min_ms,rt_avg_ms,rt_max_ms,status\n");
+
+    for (i = 0; i < rate_count; i++)
+    {
+        rate = full_rates[i];
+        if (opts->rate && opts->rate != rate)
+            continue;
+        for (fmt = 0; fmt <= SND_PCM_FORMAT_LAST; fmt++)
+        {
+            if (opts->format != SND_PCM_FORMAT_UNKNOWN && opts->format != fmt)
+                continue;
+            if (!sweep_format_ok((snd_pcm_format_t)fmt))
+                continue;
+            if (sweep_restrict(run.play, pp, rate, fmt, run.channels) ||
+                sweep_restrict(run.cap, cp, rate, fmt, run.channels))
+                continue;
+
+            run.format = (snd_pcm_format_t)fmt;
+            run.sample_bytes = snd_pcm_format_physical_width(run.format) / 8;
+            run.sample_shift = 32 - snd_pcm_format_width(run.format);
+
+            for (period = opts->period_min; period <= opts->period_max; period *= 2)
+            {
+                if (snd_pcm_hw_params_test_period_size(run.play, pp, period, 0) ||
+                    snd_pcm_hw_params_test_period_size(run.cap, cp, period, 0))
+                    continue;
+                for (j = 0; j < sweep_periods_count; j++)
+                {
+                    run.period = period;
+                    run.buffer = period * sweep_periods[j];
+                    if (snd_pcm_hw_params_test_buffer_size(run.play, pp, run.buffer) ||
+                        snd_pcm_hw_params_test_buffer_size(run.cap, cp, run.buffer))
+                        continue;
+
+                    /* pulses far enough apart that the echo can't be confused */
+                    run.interval = rate / 2;
+                    if (run.interval < run.buffer * 4)
+                        run.interval = run.buffer * 4;
+
+                    fprintf(stderr, "%u Hz %s %lu/%lu frames\n", rate,
+                            snd_pcm_format_name(run.format),
+                            run.period, run.buffer);
+                    memset(&res, 0, sizeof(res));
+                    status = "ok";
+                    snd_pcm_unlink(run.play);
+                    if (sweep_setup(run.play, &run, rate) < 0 ||
+                        sweep_setup(run.cap, &run, rate) < 0)
+                        status = "setup_failed";
+                    else
+                    {
+                        /* linked streams start on the same frame */
+                        run.linked = snd_pcm_link(run.cap, run.play) == 0;
+                        rv = sweep_measure(&run, rate, opts->seconds, &res);
+                        if (rv < 0)
+                        {
+                            fprintf(stderr, "  %s\n", snd_strerror(rv));
+                            status = "error";
+                        }
+                        else if (res.pulses == 0)
+                            status = "no_loopback";
+                        else if (!run.linked)
+                            status = "not_linked";
+                    }
+
+                    fprintf(opts->csv, "%u,%s,%u,%lu,%lu,%u,%.3f,%.3f,"
+                            "%lu,%.1f,%.1f,%.1f,%u,%.1f,"
+                            "%u,%.3f,%.3f,%.3f,%.3f,%s\n",
+                            rate, snd_pcm_format_name(run.format), run.channels,
+                            run.period, run.buffer, sweep_periods[j],
+                            run.period * 1000.0 / rate, run.buffer * 1000.0 / rate,
+                            res.wakeups, res.jitter_avg_us, res.jitter_std_us,
+                            res.jitter_max_us, res.xruns, res.cpu_pct,
+                            res.pulses, res.path_ms, res.rt_min_ms, res.rt_avg_ms,
+                            res.rt_max_ms, status);
+                    fflush(opts->csv);
+                    runs++;
+                }
+            }
+        }
+    }
+
+    snd_pcm_unlink(run.play);
+    snd_pcm_close(run.play);
+    snd_pcm_close(run.cap);
+    free(run.pbuf);
+    free(run.cbuf);
+    if (runs == 0)
+    {
+        printf("No configuration supported by both devices.\n");
+        return 1;
+    }
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     snd_pcm_t *handle;
@@ -213,6 +791,70 @@ int main(int argc, char **argv)
     char *card;
     char *substream;
     char *attribute;
+    struct sweep_opts opts;
+    int opt = 0;
+
+    if (argc >= 4 && *argv[2] == 's')
+    {
+        opts.rate = 0;
+        opts.format = SND_PCM_FORMAT_UNKNOWN;
+        opts.channels = 0;
+        opts.period_min = SWEEP_PERIOD_MIN;
+        opts.period_max = SWEEP_PERIOD_MAX;
+        opts.seconds = SWEEP_SECONDS;
+        opts.csv = stdout;
+
+        /* options follow the capture device, which getopt sees as argv[0] */
+        while ((opt = getopt(argc - 3, argv + 3, "r:f:c:p:P:t:o:")) != -1)
+        {
+            switch (opt)
+            {
+                case 'r':
+                    opts.rate = strtoul(optarg, NULL, 0);
+                    break;
+                case 'f':
+                    opts.format = snd_pcm_format_value(optarg);
+                    if (opts.format == SND_PCM_FORMAT_UNKNOWN ||
+                        !sweep_format_ok(opts.format))
+                    {
+                        printf("Unsupported sweep format: %s\n", optarg);
+                        exit(1);
+                    }
+                    break;
+                case 'c':
+                    opts.channels = strtoul(optarg, NULL, 0);
+                    break;
+                case 'p':
+                    opts.period_min = strtoul(optarg, NULL, 0);
+                    break;
+                case 'P':
+                    opts.period_max = strtoul(optarg, NULL, 0);
+                    break;
+                case 't':
+                    opts.seconds = strtoul(optarg, NULL, 0);
+                    break;
+                case 'o':
+                    opts.csv = fopen(optarg, "w");
+                    if (opts.csv == NULL)
+                    {
+                        printf("Can't create %s\n", optarg);
+                        exit(1);
+                    }
+                    break;
+                default:
+                    help();
+                    break;
+            }
+        }
+        if (opts.period_min == 0 || opts.period_min > opts.period_max ||
+            opts.seconds == 0)
+            help();
+
+        opt = sweep(argv[1], argv[3], &opts);
+        if (opts.csv != stdout)
+            fclose(opts.csv);
+        return opt;
+    }
 
     if (argc != 4)
     {
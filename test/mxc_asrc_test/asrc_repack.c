@@ -0,0 +1,318 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * SPDX-License-Identifier: BSD-3
+ *
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define REPACK_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define REPACK_SSE2
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#endif
+
+#include "asrc_repack.h"
+
+const struct repack_size repack_size[] = {
+	[REPACK_U8_TO_S8]	= { 1, 1 },
+	[REPACK_U8_TO_S16]	= { 1, 2 },
+	[REPACK_16]		= { 2, 2 },
+	[REPACK_24_3]		= { 3, 3 },
+	[REPACK_20_3_TO_S24]	= { 3, 4 },
+	[REPACK_24_3_TO_S24]	= { 3, 4 },
+	[REPACK_32]		= { 4, 4 },
+	[REPACK_32_TO_S24]	= { 4, 4 },
+};
+
+/*
+ * The scalar loops define the conversions. The vector loops below handle
+ * whole vectors and leave the tail to these, so both must stay bit-exact.
+ */
+static void u8_to_s8(int8_t *dst, const uint8_t *src, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = (int8_t)((int)src[i] - 128);
+}
+
+static void u8_to_s16(int16_t *dst, const uint8_t *src, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = (int16_t)(((int)src[i] - 128) * 256);
+}
+
+static void s20_3_to_s24(uint32_t *dst, const uint8_t *src, int n)
+{
+	uint32_t data;
+	int i;
+
+	for (i = 0; i < n; i++, src += 3) {
+		data = src[0] | src[1] << 8 | src[2] << 16;
+		dst[i] = (data << 4) & 0xFFFFFF;
+	}
+}
+
+static void s24_3_to_s24(uint32_t *dst, const uint8_t *src, int n)
+{
+	uint32_t data;
+	int i;
+
+	for (i = 0; i < n; i++, src += 3) {
+		data = src[0] | src[1] << 8 | src[2] << 16;
+		dst[i] = data & 0xFFFF00;
+	}
+}
+
+static void s32_to_s24(uint32_t *dst, const uint8_t *src, int n)
+{
+	uint32_t data;
+	int i;
+
+	for (i = 0; i < n; i++, src += 4) {
+		memcpy(&data, src, 4);
+		dst[i] = (data >> 8) & 0x00FFFFFF;
+	}
+}
+
+#if defined(REPACK_NEON)
+
+/* offset 0x80 flips the sign bit: u8 - 128 == u8 ^ 0x80 */
+static int u8_to_s8_simd(int8_t *dst, const uint8_t *src, int n)
+{
+	uint8x16_t bias = vdupq_n_u8(0x80);
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16)
+		vst1q_u8((uint8_t *)dst + i, veorq_u8(vld1q_u8(src + i), bias));
+	return i;
+}
+
+/* (u8 ^ 0x80) becomes the high byte of each 16-bit sample */
+static int u8_to_s16_simd(int16_t *dst, const uint8_t *src, int n)
+{
+	uint8x16_t bias = vdupq_n_u8(0x80);
+	uint8x16x2_t v;
+	int i;
+
+	v.val[0] = vdupq_n_u8(0);
+	for (i = 0; i + 16 <= n; i += 16) {
+		v.val[1] = veorq_u8(vld1q_u8(src + i), bias);
+		vst2q_u8((uint8_t *)(dst + i), v);
+	}
+	return i;
+}
+
+/* 24-bit packed: de-interleave 8 samples into byte planes and widen */
+static inline uint32x4x2_t load_s24_3(const uint8_t *src)
+{
+	uint8x8x3_t b = vld3_u8(src);
+	uint16x8_t lo = vorrq_u16(vmovl_u8(b.val[0]), vshll_n_u8(b.val[1], 8));
+	uint16x8_t hi = vmovl_u8(b.val[2]);
+	uint32x4x2_t v;
+
+	v.val[0] = vorrq_u32(vmovl_u16(vget_low_u16(lo)),
+			     vshll_n_u16(vget_low_u16(hi), 16));
+	v.val[1] = vorrq_u32(vmovl_u16(vget_high_u16(lo)),
+			     vshll_n_u16(vget_high_u16(hi), 16));
+	return v;
+}
+
+static int s20_3_to_s24_simd(uint32_t *dst, const uint8_t *src, int n)
+{
+	uint32x4_t mask = vdupq_n_u32(0xFFFFFF);
+	uint32x4x2_t v;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = load_s24_3(src + i * 3);
+		vst1q_u32(dst + i, vandq_u32(vshlq_n_u32(v.val[0], 4), mask));
+		vst1q_u32(dst + i + 4, vandq_u32(vshlq_n_u32(v.val[1], 4), mask));
+	}
+	return i;
+}
+
+/* bytes b1, b2 of each sample land in bytes 1, 2 of the 32-bit slot */
+static int s24_3_to_s24_simd(uint32_t *dst, const uint8_t *src, int n)
+{
+	uint8x16x3_t b;
+	uint8x16x4_t v;
+	int i;
+
+	v.val[0] = vdupq_n_u8(0);
+	v.val[3] = vdupq_n_u8(0);
+	for (i = 0; i + 16 <= n; i += 16) {
+		b = vld3q_u8(src + i * 3);
+		v.val[1] = b.val[1];
+		v.val[2] = b.val[2];
+		vst4q_u8((uint8_t *)(dst + i), v);
+	}
+	return i;
+}
+
+/* drop byte 0, move bytes 1..3 down, clear byte 3 */
+static int s32_to_s24_simd(uint32_t *dst, const uint8_t *src, int n)
+{
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		uint32x4_t a = vreinterpretq_u32_u8(vld1q_u8(src + i * 4));
+		uint32x4_t b = vreinterpretq_u32_u8(vld1q_u8(src + i * 4 + 16));
+
+		vst1q_u32(dst + i, vshrq_n_u32(a, 8));
+		vst1q_u32(dst + i + 4, vshrq_n_u32(b, 8));
+	}
+	return i;
+}
+
+#elif defined(REPACK_SSE2)
+
+static int u8_to_s8_simd(int8_t *dst, const uint8_t *src, int n)
+{
+	__m128i bias = _mm_set1_epi8((char)0x80);
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, bias));
+	}
+	return i;
+}
+
+static int u8_to_s16_simd(int16_t *dst, const uint8_t *src, int n)
+{
+	__m128i bias = _mm_set1_epi8((char)0x80);
+	__m128i zero = _mm_setzero_si128();
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i)), bias);
+
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(zero, v));
+		_mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpackhi_epi8(zero, v));
+	}
+	return i;
+}
+
+#ifdef __SSSE3__
+/*
+ * pshufb spreads 4 packed samples (12 bytes) into 32-bit slots. The last
+ * 16-byte load of a block would read past the 12 used bytes, so stop
+ * while at least 4 more bytes follow.
+ */
+static inline __m128i load_s24_3(const uint8_t *src)
+{
+	const __m128i shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+					   6, 7, 8, -1, 9, 10, 11, -1);
+
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), shuf);
+}
+
+static int s20_3_to_s24_simd(uint32_t *dst, const uint8_t *src, int n)
+{
+	__m128i mask = _mm_set1_epi32(0xFFFFFF);
+	int i;
+
+	for (i = 0; i + 6 <= n; i += 4) {
+		__m128i v = _mm_slli_epi32(load_s24_3(src + i * 3), 4);
+
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_and_si128(v, mask));
+	}
+	return i;
+}
+
+static int s24_3_to_s24_simd(uint32_t *dst, const uint8_t *src, int n)
+{
+	__m128i mask = _mm_set1_epi32(0xFFFF00);
+	int i;
+
+	for (i = 0; i + 6 <= n; i += 4) {
+		__m128i v = load_s24_3(src + i * 3);
+
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_and_si128(v, mask));
+	}
+	return i;
+}
+#else
+static int s20_3_to_s24_simd(uint32_t *dst, const uint8_t *src, int n)
+{
+	return 0;
+}
+
+static int s24_3_to_s24_simd(uint32_t *dst, const uint8_t *src, int n)
+{
+	return 0;
+}
+#endif
+
+static int s32_to_s24_simd(uint32_t *dst, const uint8_t *src, int n)
+{
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_srli_epi32(v, 8));
+	}
+	return i;
+}
+
+#else
+
+static int u8_to_s8_simd(int8_t *dst, const uint8_t *src, int n) { return 0; }
+static int u8_to_s16_simd(int16_t *dst, const uint8_t *src, int n) { return 0; }
+static int s20_3_to_s24_simd(uint32_t *dst, const uint8_t *src, int n) { return 0; }
+static int s24_3_to_s24_simd(uint32_t *dst, const uint8_t *src, int n) { return 0; }
+static int s32_to_s24_simd(uint32_t *dst, const uint8_t *src, int n) { return 0; }
+
+#endif
+
+void repack(enum repack_mode mode, void *dst, const unsigned char *src, int n)
+{
+	int done;
+
+	switch (mode) {
+	case REPACK_U8_TO_S8:
+		done = u8_to_s8_simd(dst, src, n);
+		u8_to_s8((int8_t *)dst + done, src + done, n - done);
+		break;
+	case REPACK_U8_TO_S16:
+		done = u8_to_s16_simd(dst, src, n);
+		u8_to_s16((int16_t *)dst + done, src + done, n - done);
+		break;
+	case REPACK_16:
+		memcpy(dst, src, n * 2);
+		break;
+	case REPACK_24_3:
+		memcpy(dst, src, n * 3);
+		break;
+	case REPACK_20_3_TO_S24:
+		done = s20_3_to_s24_simd(dst, src, n);
+		s20_3_to_s24((uint32_t *)dst + done, src + done * 3, n - done);
+		break;
+	case REPACK_24_3_TO_S24:
+		done = s24_3_to_s24_simd(dst, src, n);
+		s24_3_to_s24((uint32_t *)dst + done, src + done * 3, n - done);
+		break;
+	case REPACK_32:
+		memcpy(dst, src, n * 4);
+		break;
+	case REPACK_32_TO_S24:
+		done = s32_to_s24_simd(dst, src, n);
+		s32_to_s24((uint32_t *)dst + done, src + done * 4, n - done);
+		break;
+	default:
+		break;
+	}
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * SPDX-License-Identifier: BSD-3
+ *
+ */
+
+#ifndef ASRC_REPACK_H
+#define ASRC_REPACK_H
+
+/* how bitshift() turns WAV samples into the ASRC input format */
+enum repack_mode {
+	REPACK_NONE = -1,
+	REPACK_U8_TO_S8,
+	REPACK_U8_TO_S16,
+	REPACK_16,
+	REPACK_24_3,
+	REPACK_20_3_TO_S24,
+	REPACK_24_3_TO_S24,
+	REPACK_32,
+	REPACK_32_TO_S24,
+};
+
+struct repack_size {
+	int in_bytes;
+	int out_bytes;
+};
+
+extern const struct repack_size repack_size[];
+
+/* convert n WAV samples at src into the ASRC input format at dst */
+void repack(enum repack_mode mode, void *dst, const unsigned char *src, int n);
+
+#endif
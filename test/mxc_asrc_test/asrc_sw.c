@@ -0,0 +1,669 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * SPDX-License-Identifier: BSD-3
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "asrc_sw.h"
+
+/* coefficient rows are padded to this many taps for the SIMD loops */
+#define SW_TAP_ALIGN	8
+/* rate pairs needing more phases use interpolated rows */
+#define SW_MAX_PHASES	2048
+
+#define SW_BANK_MAGIC	"ASRCBNK2"
+
+static const struct {
+	unsigned int half;	/* zero crossings per side at full bandwidth */
+	double atten;		/* stopband attenuation in dB */
+} sw_quality[] = {
+	[ASRC_SW_LOW]		= { 8, 60 },
+	[ASRC_SW_MEDIUM]	= { 24, 100 },
+	[ASRC_SW_HIGH]		= { 64, 140 },
+};
+
+struct asrc_sw {
+	unsigned int channels;
+	snd_pcm_format_t input_format;
+	snd_pcm_format_t output_format;
+	int in_bytes;
+	int out_bytes;
+	enum asrc_sw_quality quality;
+
+	/* output/input = up/down, reduced by their gcd */
+	unsigned int up;
+	unsigned int down;
+	unsigned int nphase;	/* rows in the bank, up unless interpolated */
+	unsigned int taps;	/* padded to SW_TAP_ALIGN */
+	float *coefs;		/* nphase + 1 rows of taps coefficients */
+
+	/* planar input history, hist_len frames in use per channel */
+	float **hist;
+	unsigned int hist_len;
+	unsigned int hist_max;
+	unsigned int pos;	/* first history frame of the next output */
+	unsigned int phase;	/* 0 ... up - 1 */
+};
+
+struct sw_bank_header {
+	char magic[8];
+	uint32_t up;
+	uint32_t down;
+	uint32_t nphase;
+	uint32_t taps;
+	uint32_t quality;
+	uint32_t checksum;	/* FNV-1a of the coefficients */
+};
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	while (b) {
+		unsigned int t = a % b;
+
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+uint64_t asrc_sw_supported_formats(void)
+{
+	return (1ULL << SND_PCM_FORMAT_S8) |
+		(1ULL << SND_PCM_FORMAT_S16_LE) |
+		(1ULL << SND_PCM_FORMAT_S24_LE) |
+		(1ULL << SND_PCM_FORMAT_S32_LE) |
+		(1ULL << SND_PCM_FORMAT_FLOAT_LE) |
+		(1ULL << SND_PCM_FORMAT_S20_3LE) |
+		(1ULL << SND_PCM_FORMAT_S24_3LE);
+}
+
+static int format_bytes(snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_S8:
+		return 1;
+	case SND_PCM_FORMAT_S16_LE:
+		return 2;
+	case SND_PCM_FORMAT_S20_3LE:
+	case SND_PCM_FORMAT_S24_3LE:
+		return 3;
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S32_LE:
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return 4;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int32_t sign_extend(uint32_t v, int bits)
+{
+	return (int32_t)(v << (32 - bits)) >> (32 - bits);
+}
+
+int asrc_sw_to_float(snd_pcm_format_t format, const void *src, float *dst,
+		     unsigned int n)
+{
+	const uint8_t *p = src;
+	unsigned int i;
+	uint32_t v;
+
+	switch (format) {
+	case SND_PCM_FORMAT_S8:
+		for (i = 0; i < n; i++)
+			dst[i] = (int8_t)p[i] * (1.0f / 128);
+		break;
+	case SND_PCM_FORMAT_S16_LE:
+		for (i = 0; i < n; i++, p += 2)
+			dst[i] = (int16_t)(p[0] | p[1] << 8) * (1.0f / 32768);
+		break;
+	case SND_PCM_FORMAT_S20_3LE:
+		for (i = 0; i < n; i++, p += 3) {
+			v = p[0] | p[1] << 8 | p[2] << 16;
+			dst[i] = sign_extend(v, 20) * (1.0f / 524288);
+		}
+		break;
+	case SND_PCM_FORMAT_S24_3LE:
+		for (i = 0; i < n; i++, p += 3) {
+			v = p[0] | p[1] << 8 | p[2] << 16;
+			dst[i] = sign_extend(v, 24) * (1.0f / 8388608);
+		}
+		break;
+	case SND_PCM_FORMAT_S24_LE:
+		for (i = 0; i < n; i++, p += 4) {
+			memcpy(&v, p, 4);
+			dst[i] = sign_extend(v, 24) * (1.0f / 8388608);
+		}
+		break;
+	case SND_PCM_FORMAT_S32_LE:
+		for (i = 0; i < n; i++, p += 4) {
+			memcpy(&v, p, 4);
+			dst[i] = (int32_t)v * (1.0f / 2147483648.0f);
+		}
+		break;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		memcpy(dst, src, n * sizeof(float));
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int32_t quantize(float f, int bits)
+{
+	double scale = (double)(1U << (bits - 1));
+	double v = floor(f * scale + 0.5);
+
+	if (v > scale - 1)
+		v = scale - 1;
+	if (v < -scale)
+		v = -scale;
+	return (int32_t)v;
+}
+
+static void store_sample(uint8_t *p, float f, snd_pcm_format_t format)
+{
+	uint32_t v;
+
+	switch (format) {
+	case SND_PCM_FORMAT_S8:
+		p[0] = quantize(f, 8);
+		break;
+	case SND_PCM_FORMAT_S16_LE:
+		v = quantize(f, 16);
+		p[0] = v;
+		p[1] = v >> 8;
+		break;
+	case SND_PCM_FORMAT_S20_3LE:
+	case SND_PCM_FORMAT_S24_3LE:
+		v = quantize(f, format == SND_PCM_FORMAT_S20_3LE ? 20 : 24);
+		p[0] = v;
+		p[1] = v >> 8;
+		p[2] = v >> 16;
+		break;
+	case SND_PCM_FORMAT_S24_LE:
+		v = quantize(f, 24) & 0xFFFFFF;
+		memcpy(p, &v, 4);
+		break;
+	case SND_PCM_FORMAT_S32_LE:
+		v = quantize(f, 32);
+		memcpy(p, &v, 4);
+		break;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		memcpy(p, &f, 4);
+		break;
+	default:
+		break;
+	}
+}
+
+/* n is a multiple of SW_TAP_ALIGN, only a is aligned */
+static inline float dot(const float *a, const float *b, unsigned int n)
+{
+	unsigned int i;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+	float32x2_t sum;
+
+	for (i = 0; i < n; i += 8) {
+		acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+		acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+	}
+	acc0 = vaddq_f32(acc0, acc1);
+	sum = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+	return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#elif defined(__SSE__)
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+	float r[4];
+
+	for (i = 0; i < n; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_load_ps(a + i),
+						   _mm_loadu_ps(b + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_load_ps(a + i + 4),
+						   _mm_loadu_ps(b + i + 4)));
+	}
+	_mm_storeu_ps(r, _mm_add_ps(acc0, acc1));
+	return (r[0] + r[1]) + (r[2] + r[3]);
+#else
+	float acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+
+	for (i = 0; i < n; i += 4) {
+		acc0 += a[i] * b[i];
+		acc1 += a[i + 1] * b[i + 1];
+		acc2 += a[i + 2] * b[i + 2];
+		acc3 += a[i + 3] * b[i + 3];
+	}
+	return (acc0 + acc1) + (acc2 + acc3);
+#endif
+}
+
+static double sinc(double x)
+{
+	if (fabs(x) < 1e-9)
+		return 1.0;
+	return sin(M_PI * x) / (M_PI * x);
+}
+
+/* zeroth order modified Bessel function of the first kind */
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0, k;
+
+	for (k = 1; k < 64; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-17)
+			break;
+	}
+	return sum;
+}
+
+/*
+ * Row r of the bank is the output phase r/nphase input samples after
+ * frame i, built from frames i - half + 1 ... i + half. The -6 dB point
+ * sits half a transition band below the lower of the two Nyquist rates,
+ * and the filter widens by the same factor when downsampling.
+ */
+static void build_bank(struct asrc_sw *sw)
+{
+	double atten = sw_quality[sw->quality].atten;
+	double fc = sw->up < sw->down ? (double)sw->up / sw->down : 1.0;
+	unsigned int half = (unsigned int)ceil(sw_quality[sw->quality].half / fc);
+	double beta, i0_beta, dw;
+	unsigned int r, k;
+
+	beta = atten > 50 ? 0.1102 * (atten - 8.7) :
+		0.5842 * pow(atten - 21, 0.4) + 0.07886 * (atten - 21);
+	i0_beta = bessel_i0(beta);
+
+	/* Kaiser transition width in rad/sample for 2 * half taps */
+	dw = (atten - 8) / (2.285 * 2 * half);
+	fc -= dw / (2 * M_PI);
+
+	for (r = 0; r <= sw->nphase; r++) {
+		float *row = sw->coefs + r * sw->taps;
+		double sum = 0;
+
+		for (k = 0; k < sw->taps; k++) {
+			double d = (double)r / sw->nphase + half - 1 - k;
+			double x = d / half;
+
+			if (k >= 2 * half || fabs(x) >= 1.0) {
+				row[k] = 0;
+				continue;
+			}
+			row[k] = fc * sinc(fc * d) *
+				bessel_i0(beta * sqrt(1 - x * x)) / i0_beta;
+			sum += row[k];
+		}
+
+		/* unity DC gain for every phase */
+		for (k = 0; k < sw->taps; k++)
+			row[k] /= sum;
+	}
+}
+
+/* A cache directory only we can write to, or -1 */
+static int private_dir(const char *dir)
+{
+	struct stat st;
+
+	if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+		return -1;
+	if (lstat(dir, &st) < 0 || !S_ISDIR(st.st_mode) ||
+	    st.st_uid != getuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+		return -1;
+	return 0;
+}
+
+static int bank_path(struct asrc_sw *sw, char *path, size_t len)
+{
+	const char *dir = getenv("ASRC_SW_CACHE");
+	const char *base = getenv("XDG_CACHE_HOME");
+	char buf[256];
+	int n;
+
+	if (!dir || !*dir) {
+		if (base && *base == '/') {
+			n = snprintf(buf, sizeof(buf), "%s/%s", base,
+				     ASRC_SW_CACHE_DIR);
+		} else {
+			base = getenv("HOME");
+			if (!base || *base != '/')
+				return -ENOENT;
+			n = snprintf(buf, sizeof(buf), "%s/.cache", base);
+			if (n < 0 || n >= (int)sizeof(buf) ||
+			    private_dir(buf) < 0)
+				return -ENOENT;
+			n = snprintf(buf, sizeof(buf), "%s/.cache/%s", base,
+				     ASRC_SW_CACHE_DIR);
+		}
+		if (n < 0 || n >= (int)sizeof(buf))
+			return -ENOENT;
+		dir = buf;
+	}
+	if (private_dir(dir) < 0)
+		return -EACCES;
+
+	n = snprintf(path, len, "%s/asrc_sw_%u_%u_q%d.bank", dir,
+		     sw->up, sw->down, sw->quality);
+	return n < 0 || n >= (int)len ? -ENAMETOOLONG : 0;
+}
+
+static size_t bank_size(struct asrc_sw *sw)
+{
+	return sizeof(float) * (sw->nphase + 1) * sw->taps;
+}
+
+static uint32_t bank_checksum(struct asrc_sw *sw)
+{
+	const unsigned char *p = (const unsigned char *)sw->coefs;
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < bank_size(sw); i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+/*
+ * What build_bank() leaves behind: taps past 2 * half are zero and every
+ * row has unity DC gain.
+ */
+static int bank_valid(struct asrc_sw *sw, unsigned int half)
+{
+	unsigned int r, k;
+
+	for (r = 0; r <= sw->nphase; r++) {
+		const float *row = sw->coefs + r * sw->taps;
+		double sum = 0;
+
+		for (k = 0; k < sw->taps; k++) {
+			if (!isfinite(row[k]) || (k >= 2 * half && row[k] != 0))
+				return 0;
+			sum += row[k];
+		}
+		if (fabs(sum - 1) > 1e-4)
+			return 0;
+	}
+	return 1;
+}
+
+static int load_bank(struct asrc_sw *sw, const char *path, unsigned int half)
+{
+	struct sw_bank_header hdr;
+	struct stat st;
+	FILE *f;
+	int fd, ok;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return -ENOENT;
+	/* ours, and exactly one header and bank of this ratio and quality */
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    st.st_uid != getuid() ||
+	    st.st_size != (off_t)(sizeof(hdr) + bank_size(sw))) {
+		close(fd);
+		return -EINVAL;
+	}
+	f = fdopen(fd, "rb");
+	if (!f) {
+		close(fd);
+		return -ENOMEM;
+	}
+
+	ok = fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+		!memcmp(hdr.magic, SW_BANK_MAGIC, sizeof(hdr.magic)) &&
+		hdr.up == sw->up && hdr.down == sw->down &&
+		hdr.nphase == sw->nphase && hdr.taps == sw->taps &&
+		hdr.quality == (uint32_t)sw->quality &&
+		fread(sw->coefs, bank_size(sw), 1, f) == 1 &&
+		hdr.checksum == bank_checksum(sw) && bank_valid(sw, half);
+	fclose(f);
+
+	return ok ? 0 : -EINVAL;
+}
+
+static void save_bank(struct asrc_sw *sw, const char *path)
+{
+	struct sw_bank_header hdr;
+	char tmp[300];
+	FILE *f;
+	int fd, ok;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SW_BANK_MAGIC, sizeof(hdr.magic));
+	hdr.up = sw->up;
+	hdr.down = sw->down;
+	hdr.nphase = sw->nphase;
+	hdr.taps = sw->taps;
+	hdr.quality = sw->quality;
+	hdr.checksum = bank_checksum(sw);
+
+	/* write a private file and rename it so readers never see half a bank */
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+		  0600);
+	if (fd < 0)
+		return;
+	f = fdopen(fd, "wb");
+	if (!f) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+		fwrite(sw->coefs, bank_size(sw), 1, f) == 1;
+	if (fclose(f) != 0)
+		ok = 0;
+	if (!ok || rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
+static int setup_bank(struct asrc_sw *sw)
+{
+	double fc = sw->up < sw->down ? (double)sw->up / sw->down : 1.0;
+	unsigned int half = (unsigned int)ceil(sw_quality[sw->quality].half / fc);
+	char path[256];
+	void *mem;
+
+	sw->nphase = sw->up <= SW_MAX_PHASES ? sw->up : SW_MAX_PHASES;
+	sw->taps = (2 * half + SW_TAP_ALIGN - 1) / SW_TAP_ALIGN * SW_TAP_ALIGN;
+
+	if (posix_memalign(&mem, 64, bank_size(sw)))
+		return -ENOMEM;
+	sw->coefs = mem;
+
+	/* no usable cache directory: build the bank every time */
+	if (bank_path(sw, path, sizeof(path)) < 0) {
+		build_bank(sw);
+		return 0;
+	}
+	if (load_bank(sw, path, half) == 0)
+		return 0;
+
+	build_bank(sw);
+	save_bank(sw, path);
+	return 0;
+}
+
+struct asrc_sw *asrc_sw_open(unsigned int channels,
+			     unsigned int input_rate, unsigned int output_rate,
+			     snd_pcm_format_t input_format,
+			     snd_pcm_format_t output_format,
+			     enum asrc_sw_quality quality)
+{
+	struct asrc_sw *sw;
+	unsigned int g, c;
+
+	if (!channels || !input_rate || !output_rate ||
+	    quality > ASRC_SW_HIGH ||
+	    format_bytes(input_format) < 0 || format_bytes(output_format) < 0) {
+		printf("software ASRC: unsupported configuration\n");
+		return NULL;
+	}
+
+	sw = calloc(1, sizeof(*sw));
+	if (!sw)
+		return NULL;
+
+	g = gcd(input_rate, output_rate);
+	sw->channels = channels;
+	sw->input_format = input_format;
+	sw->output_format = output_format;
+	sw->in_bytes = format_bytes(input_format);
+	sw->out_bytes = format_bytes(output_format);
+	sw->quality = quality;
+	sw->up = output_rate / g;
+	sw->down = input_rate / g;
+
+	sw->hist = calloc(channels, sizeof(*sw->hist));
+	if (!sw->hist || setup_bank(sw) < 0)
+		goto err;
+
+	/* prime the history so the first output lines up with input frame 0 */
+	sw->hist_len = (unsigned int)ceil(sw_quality[quality].half /
+		(sw->up < sw->down ? (double)sw->up / sw->down : 1.0)) - 1;
+	sw->hist_max = sw->hist_len + sw->taps;
+	for (c = 0; c < channels; c++) {
+		sw->hist[c] = calloc(sw->hist_max, sizeof(float));
+		if (!sw->hist[c])
+			goto err;
+	}
+
+	return sw;
+
+err:
+	asrc_sw_close(sw);
+	return NULL;
+}
+
+static int hist_reserve(struct asrc_sw *sw, unsigned int frames)
+{
+	unsigned int c, max = sw->hist_len + frames;
+	float *hist;
+
+	if (max <= sw->hist_max)
+		return 0;
+
+	for (c = 0; c < sw->channels; c++) {
+		hist = realloc(sw->hist[c], sizeof(float) * max);
+		if (!hist)
+			return -ENOMEM;
+		sw->hist[c] = hist;
+	}
+	sw->hist_max = max;
+	return 0;
+}
+
+/* deinterleave the input block into the history */
+static void load_input(struct asrc_sw *sw, const uint8_t *in, unsigned int frames)
+{
+	unsigned int ch = sw->channels, c, i;
+	float tmp[256];
+
+	while (frames) {
+		unsigned int n = frames < sizeof(tmp) / sizeof(tmp[0]) / ch ?
+			frames : sizeof(tmp) / sizeof(tmp[0]) / ch;
+
+		asrc_sw_to_float(sw->input_format, in, tmp, n * ch);
+		for (c = 0; c < ch; c++) {
+			float *dst = sw->hist[c] + sw->hist_len;
+
+			for (i = 0; i < n; i++)
+				dst[i] = tmp[i * ch + c];
+		}
+		sw->hist_len += n;
+		in += n * ch * sw->in_bytes;
+		frames -= n;
+	}
+}
+
+int asrc_sw_convert(struct asrc_sw *sw, struct asrc_convert_buffer *buf)
+{
+	unsigned int ch = sw->channels;
+	unsigned int in_frames = buf->input_buffer_length / (sw->in_bytes * ch);
+	unsigned int out_max = buf->output_buffer_length / (sw->out_bytes * ch);
+	uint8_t *out = buf->output_buffer_vaddr;
+	unsigned int n, c, pos = sw->pos, drop;
+	int exact = sw->nphase == sw->up;
+
+	if (hist_reserve(sw, in_frames) < 0)
+		return -ENOMEM;
+
+	load_input(sw, buf->input_buffer_vaddr, in_frames);
+
+	for (n = 0; n < out_max && pos + sw->taps <= sw->hist_len; n++) {
+		const float *coef;
+		float frac = 0;
+
+		if (exact) {
+			coef = sw->coefs + sw->phase * sw->taps;
+		} else {
+			uint64_t p = (uint64_t)sw->phase * sw->nphase;
+			unsigned int row = p / sw->up;
+
+			frac = (float)(p % sw->up) / sw->up;
+			coef = sw->coefs + row * sw->taps;
+		}
+
+		for (c = 0; c < ch; c++) {
+			const float *x = sw->hist[c] + pos;
+			float acc = dot(coef, x, sw->taps);
+
+			/* between two rows of the bank, blend the results */
+			if (frac != 0)
+				acc += frac * (dot(coef + sw->taps, x, sw->taps) - acc);
+			store_sample(out, acc, sw->output_format);
+			out += sw->out_bytes;
+		}
+
+		sw->phase += sw->down;
+		pos += sw->phase / sw->up;
+		sw->phase %= sw->up;
+	}
+
+	/* drop the frames no later output needs */
+	drop = pos < sw->hist_len ? pos : sw->hist_len;
+	for (c = 0; c < ch; c++)
+		memmove(sw->hist[c], sw->hist[c] + drop,
+			sizeof(float) * (sw->hist_len - drop));
+	sw->hist_len -= drop;
+	sw->pos = pos - drop;
+
+	buf->output_buffer_length = n * sw->out_bytes * ch;
+	return 0;
+}
+
+void asrc_sw_close(struct asrc_sw *sw)
+{
+	unsigned int c;
+
+	if (!sw)
+		return;
+	if (sw->hist) {
+		for (c = 0; c < sw->channels; c++)
+			free(sw->hist[c]);
+		free(sw->hist);
+	}
+	free(sw->coefs);
+	free(sw);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * SPDX-License-Identifier: BSD-3
+ *
+ */
+
+#ifndef ASRC_SW_H
+#define ASRC_SW_H
+
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+#include <linux/mxc_asrc.h>
+
+/*
+ * Software counterpart of an ASRC pair: a polyphase Kaiser-windowed-sinc
+ * resampler that takes the same asrc_convert_buffer the ASRC_CONVERT
+ * ioctl does. It serves as the reference for checking hardware output
+ * and as the fallback when no pair is available.
+ */
+struct asrc_sw;
+
+enum asrc_sw_quality {
+	ASRC_SW_LOW,		/* 16 taps, ~60 dB stopband */
+	ASRC_SW_MEDIUM,		/* 48 taps, ~100 dB stopband */
+	ASRC_SW_HIGH,		/* 128 taps, ~140 dB stopband */
+};
+
+/*
+ * Filter banks are saved per rate ratio and quality in this directory of
+ * $XDG_CACHE_HOME or ~/.cache (overridden by $ASRC_SW_CACHE) and reused by
+ * later runs.  The directory must belong to the user and not be writable
+ * by others, and a bank is only loaded if it passes its checksum.
+ */
+#define ASRC_SW_CACHE_DIR	"asrc_sw"
+
+uint64_t asrc_sw_supported_formats(void);
+
+struct asrc_sw *asrc_sw_open(unsigned int channels,
+			     unsigned int input_rate, unsigned int output_rate,
+			     snd_pcm_format_t input_format,
+			     snd_pcm_format_t output_format,
+			     enum asrc_sw_quality quality);
+int asrc_sw_convert(struct asrc_sw *sw, struct asrc_convert_buffer *buf);
+void asrc_sw_close(struct asrc_sw *sw);
+
+/* convert n samples in one of the supported formats to float */
+int asrc_sw_to_float(snd_pcm_format_t format, const void *src, float *dst,
+		     unsigned int n);
+
+#endif
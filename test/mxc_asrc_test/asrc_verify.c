@@ -0,0 +1,260 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * SPDX-License-Identifier: BSD-3
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "asrc_verify.h"
+
+/* lag between hardware and reference searched in +-VERIFY_MAX_LAG frames */
+#define VERIFY_MAX_LAG	2048
+#define VERIFY_FFT_MAX	16384
+
+struct asrc_verify {
+	unsigned int channels;
+	unsigned int rate;
+	unsigned int max_frames;
+	float *hw;
+	float *ref;
+	unsigned int hw_frames;
+	unsigned int ref_frames;
+};
+
+struct asrc_verify *asrc_verify_open(unsigned int channels, unsigned int rate,
+				     unsigned int max_frames)
+{
+	struct asrc_verify *v;
+
+	v = calloc(1, sizeof(*v));
+	if (!v)
+		return NULL;
+
+	v->channels = channels;
+	v->rate = rate;
+	v->max_frames = max_frames;
+	v->hw = malloc(sizeof(float) * channels * max_frames);
+	v->ref = malloc(sizeof(float) * channels * max_frames);
+	if (!v->hw || !v->ref) {
+		asrc_verify_close(v);
+		return NULL;
+	}
+
+	return v;
+}
+
+static void append(float *dst, unsigned int *len, unsigned int max,
+		   const float *src, unsigned int n, unsigned int ch)
+{
+	if (*len + n > max)
+		n = max - *len;
+	memcpy(dst + *len * ch, src, sizeof(float) * n * ch);
+	*len += n;
+}
+
+void asrc_verify_add(struct asrc_verify *v, const float *hw, unsigned int hw_frames,
+		     const float *ref, unsigned int ref_frames)
+{
+	append(v->hw, &v->hw_frames, v->max_frames, hw, hw_frames, v->channels);
+	append(v->ref, &v->ref_frames, v->max_frames, ref, ref_frames, v->channels);
+}
+
+/* in-place radix-2 FFT, n a power of two */
+static void fft(double *re, double *im, unsigned int n)
+{
+	unsigned int i, j, k, len;
+
+	for (i = 1, j = 0; i < n; i++) {
+		unsigned int bit = n >> 1;
+
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j) {
+			double t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	for (len = 2; len <= n; len <<= 1) {
+		double a = -2 * M_PI / len;
+
+		for (i = 0; i < n; i += len) {
+			for (k = 0; k < len / 2; k++) {
+				double wr = cos(a * k), wi = sin(a * k);
+				double *ur = &re[i + k], *ui = &im[i + k];
+				double *vr = &re[i + k + len / 2], *vi = &im[i + k + len / 2];
+				double xr = *vr * wr - *vi * wi;
+				double xi = *vr * wi + *vi * wr;
+
+				*vr = *ur - xr;
+				*vi = *ui - xi;
+				*ur += xr;
+				*ui += xi;
+			}
+		}
+	}
+}
+
+/*
+ * THD and THD+N of one channel, in dB relative to the strongest tone.
+ * A 4-term Blackman-Harris window keeps leakage far below 16-bit noise;
+ * each tone is summed over +-4 bins around its peak.
+ */
+static int analyse(const float *x, unsigned int frames, unsigned int ch,
+		   unsigned int rate, double *f0, double *thd, double *thdn)
+{
+	unsigned int n = VERIFY_FFT_MAX, i, k, peak = 1, h;
+	double *re, *im, *pw, total = 0, fund = 0, harm = 0;
+
+	while (n > frames)
+		n >>= 1;
+	if (n < 1024)
+		return -EINVAL;
+
+	re = calloc(3 * n, sizeof(double));
+	if (!re)
+		return -ENOMEM;
+	im = re + n;
+	pw = im + n;
+
+	/* skip the start-up transient when there is enough data */
+	x += (frames - n) / 2 * ch;
+	for (i = 0; i < n; i++) {
+		double w = 0.35875 - 0.48829 * cos(2 * M_PI * i / n) +
+			0.14128 * cos(4 * M_PI * i / n) -
+			0.01168 * cos(6 * M_PI * i / n);
+
+		re[i] = x[i * ch] * w;
+	}
+	fft(re, im, n);
+
+	for (k = 1; k < n / 2; k++) {
+		pw[k] = re[k] * re[k] + im[k] * im[k];
+		total += pw[k];
+		if (pw[k] > pw[peak])
+			peak = k;
+	}
+
+	for (h = 1; h * peak < n / 2 - 4; h++) {
+		double sum = 0;
+
+		for (k = h * peak - 4; k <= h * peak + 4; k++)
+			sum += pw[k];
+		if (h == 1)
+			fund = sum;
+		else if (h <= 9)
+			harm += sum;
+	}
+
+	*f0 = (double)peak * rate / n;
+	*thd = 10 * log10((harm + 1e-30) / (fund + 1e-30));
+	*thdn = 10 * log10((total - fund + 1e-30) / (fund + 1e-30));
+
+	free(re);
+	return 0;
+}
+
+/*
+ * Frame offset of hw relative to ref with the highest normalised
+ * correlation. Lags are tried from 0 outwards and a later one has to be
+ * clearly better, so periodic test tones resolve to the smallest lag.
+ */
+static int find_lag(struct asrc_verify *v, unsigned int frames)
+{
+	unsigned int ch = v->channels, win, i;
+	int step, lag, best = 0;
+	double best_corr = -2;
+
+	if (frames <= 2 * VERIFY_MAX_LAG)
+		return 0;
+	win = frames - 2 * VERIFY_MAX_LAG;
+	if (win > 8192)
+		win = 8192;
+
+	for (step = 0; step <= 2 * VERIFY_MAX_LAG; step++) {
+		const float *r = v->ref + VERIFY_MAX_LAG * ch;
+		const float *h;
+		double corr = 0, er = 0, eh = 0;
+
+		lag = step & 1 ? -(step + 1) / 2 : step / 2;
+		h = v->hw + (VERIFY_MAX_LAG + lag) * ch;
+		for (i = 0; i < win; i++) {
+			corr += (double)r[i * ch] * h[i * ch];
+			er += (double)r[i * ch] * r[i * ch];
+			eh += (double)h[i * ch] * h[i * ch];
+		}
+		corr /= sqrt(er * eh) + 1e-30;
+		if (corr > best_corr + 1e-4) {
+			best_corr = corr;
+			best = lag;
+		}
+	}
+
+	return best;
+}
+
+int asrc_verify_report(struct asrc_verify *v, double min_snr)
+{
+	unsigned int ch = v->channels, frames, start, end, i, c;
+	double f0, thd, thdn, rthd, rthdn, worst = 1e30;
+	int lag;
+
+	frames = v->hw_frames < v->ref_frames ? v->hw_frames : v->ref_frames;
+	lag = find_lag(v, frames);
+
+	/* leave out both ends, where the two filters are still settling */
+	start = frames / 16 + (lag < 0 ? -lag : 0);
+	end = frames - frames / 16 - (lag > 0 ? lag : 0);
+
+	printf("\nCross-check against the software reference:\n");
+	printf("  %u hw / %u reference frames compared, hw lag %d frames\n",
+	       v->hw_frames, v->ref_frames, lag);
+	if (end <= start) {
+		printf("  not enough output to compare\n");
+		return -EINVAL;
+	}
+
+	for (c = 0; c < ch; c++) {
+		double sig = 0, err = 0, snr;
+
+		for (i = start; i < end; i++) {
+			double r = v->ref[i * ch + c];
+			double d = v->hw[(i + lag) * ch + c] - r;
+
+			sig += r * r;
+			err += d * d;
+		}
+		snr = 10 * log10((sig + 1e-30) / (err + 1e-30));
+		if (snr < worst)
+			worst = snr;
+
+		printf("  ch%u: SNR vs reference %6.1f dB", c, snr);
+		if (analyse(v->hw + c, v->hw_frames, ch, v->rate, &f0, &thd, &thdn) == 0 &&
+		    analyse(v->ref + c, v->ref_frames, ch, v->rate, &f0, &rthd, &rthdn) == 0)
+			printf(", %.0f Hz: THD %6.1f / %6.1f dB, THD+N %6.1f / %6.1f dB (hw / ref)",
+			       f0, thd, rthd, thdn, rthdn);
+		printf("\n");
+	}
+
+	if (worst < min_snr) {
+		printf("  FAIL: SNR %.1f dB below %.1f dB\n", worst, min_snr);
+		return -1;
+	}
+	return 0;
+}
+
+void asrc_verify_close(struct asrc_verify *v)
+{
+	if (!v)
+		return;
+	free(v->hw);
+	free(v->ref);
+	free(v);
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * SPDX-License-Identifier: BSD-3
+ *
+ */
+
+#ifndef ASRC_VERIFY_H
+#define ASRC_VERIFY_H
+
+/*
+ * Collects hardware output next to the software reference for the same
+ * input and reports how far apart they are.
+ */
+struct asrc_verify;
+
+struct asrc_verify *asrc_verify_open(unsigned int channels, unsigned int rate,
+				     unsigned int max_frames);
+/* append n interleaved frames of hardware and of reference output */
+void asrc_verify_add(struct asrc_verify *v, const float *hw, unsigned int hw_frames,
+		     const float *ref, unsigned int ref_frames);
+/* print SNR against the reference and THD of both; <0 if below min_snr */
+int asrc_verify_report(struct asrc_verify *v, double min_snr);
+void asrc_verify_close(struct asrc_verify *v);
+
+#endif
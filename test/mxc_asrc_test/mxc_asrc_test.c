@@ -23,10 +23,20 @@
 #include <string.h>
 #include <malloc.h>
 #include <sys/time.h>
+#include <pthread.h>
 #include <alsa/asoundlib.h>
 #include <linux/mxc_asrc.h>
 
+#include "asrc_sw.h"
+#include "asrc_verify.h"
+#include "asrc_repack.h"
+
 #define DMA_BUF_SIZE 4096
+#define STREAM_QUEUE_DEPTH 8
+/* samples repacked per fread() when loading the whole file */
+#define REPACK_CHUNK (64 * 1024)
+/* seconds of output kept for the hardware/software cross-check */
+#define VERIFY_SECONDS 10
 
 /*
  * From 38 kernel, asrc driver only supports one pair of buffer
@@ -79,6 +89,61 @@ static enum asrc_outclk outclk;
 unsigned int convert_flag;
 int fd_asrc;
 
+/* software pair used instead of /dev/mxc_asrc */
+static int use_sw;
+/* use_sw was not asked for, the ASRC itself went untested */
+static int sw_fallback;
+static struct asrc_sw *sw_pair;
+static enum asrc_sw_quality sw_quality = ASRC_SW_HIGH;
+
+/* software reference run next to the hardware pair */
+static int verify_mode;
+static double verify_min_snr = -1000;
+static struct asrc_sw *ref_pair;
+static struct asrc_verify *verifier;
+static snd_pcm_format_t verify_format;
+static unsigned int verify_channels;
+
+static int stream_mode;
+static int queue_depth = STREAM_QUEUE_DEPTH;
+
+/* a buffer passed between the streaming threads */
+struct stream_block {
+	char *data;
+	unsigned int length;
+	struct timeval stamp;	/* when its input was read */
+};
+
+struct block_queue {
+	struct stream_block **slot;
+	int size;
+	int head;
+	int count;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct stream_ctx {
+	FILE *src;
+	FILE *dst;
+	struct audio_info_s *info;
+	enum repack_mode mode;
+	unsigned int raw_left;		/* WAV data bytes not read yet */
+	unsigned int in_block_size;
+	unsigned int out_block_size;
+
+	struct block_queue in_free, in_full;
+	struct block_queue out_free, out_full;
+
+	/* statistics, each written by one thread only */
+	unsigned long long bytes_in;
+	unsigned long long bytes_out;
+	unsigned int blocks_out;
+	double lat_min, lat_max, lat_sum;
+	double convert_time;
+	int error;
+};
+
 void *asrc_input_thread(void *info);
 void *asrc_output_thread(void *info);
 
@@ -168,6 +233,14 @@ void help_info(int ac, const char *av[])
 	printf("-c : channel\n");
 	printf("-p <input clock>\n");
 	printf("-q <output clock>\n");
+	printf("-s : stream the file through reader/convert/writer threads\n");
+	printf("-S : use the software converter instead of /dev/mxc_asrc\n");
+	printf("     (also used when all ASRC pairs are busy, the test then exits 2)\n");
+	printf("--quality <0|1|2> : software converter quality, low to high (default 2)\n");
+	printf("-V : cross-check the ASRC output against the software converter\n");
+	printf("--min-snr <dB> : fail the cross-check below this SNR\n");
+	printf("--depth <n> : buffers in flight per stage in stream mode (default %d)\n",
+	       STREAM_QUEUE_DEPTH);
 
 	printf("<input clock source> <output clock source>\n");
 	printf("input clock source types are:\n\n");
@@ -201,7 +274,7 @@ int parse_arguments(int argc, const char *argv[], struct audio_info_s *info)
 	}
 
 	int c, option_index;
-	static const char short_options[] = "ho:x:z:ep:q:f:c:r:F:C:m";
+	static const char short_options[] = "ho:x:z:ep:q:f:c:r:F:C:msSV";
 	static const struct option long_options[] = {
 		{"help", 0, 0, 'h'},
 		{"outFreq", 1, 0, 'o'},
@@ -215,6 +288,12 @@ int parse_arguments(int argc, const char *argv[], struct audio_info_s *info)
 		{"oformat", 1, 0, 'F'},
 		{"inclk", 1, 0, 'p'},
 		{"outclk", 1, 0, 'q'},
+		{"stream", 0, 0, 's'},
+		{"sw", 0, 0, 'S'},
+		{"depth", 1, 0, 'D'},
+		{"quality", 1, 0, 'Q'},
+		{"verify", 0, 0, 'V'},
+		{"min-snr", 1, 0, 'N'},
 		{0, 0, 0, 0}
 	};
 
@@ -253,6 +332,28 @@ int parse_arguments(int argc, const char *argv[], struct audio_info_s *info)
 		case 'q':
 			info->outclk = strtol(optarg, NULL, 0);
 			break;
+		case 's':
+			stream_mode = 1;
+			break;
+		case 'S':
+			use_sw = 1;
+			break;
+		case 'D':
+			queue_depth = strtol(optarg, NULL, 0);
+			if (queue_depth < 2)
+				queue_depth = 2;
+			break;
+		case 'Q':
+			sw_quality = strtol(optarg, NULL, 0);
+			if (sw_quality > ASRC_SW_HIGH)
+				sw_quality = ASRC_SW_HIGH;
+			break;
+		case 'V':
+			verify_mode = 1;
+			break;
+		case 'N':
+			verify_min_snr = strtod(optarg, NULL);
+			break;
 		case 'h':
 			help_info(argc, argv);
 			exit(1);
@@ -271,10 +372,26 @@ int request_asrc_channel(int fd_asrc, struct audio_info_s *info)
 	int err = 0;
 	struct asrc_req req;
 
+	if (use_sw) {
+		printf("Software pair requested\n");
+		supported_in_format = asrc_sw_supported_formats();
+		supported_out_format = asrc_sw_supported_formats();
+		pair_index = ASRC_PAIR_A;
+		return 0;
+	}
+
 	req.chn_num = info->channel;
 	if ((err = ioctl(fd_asrc, ASRC_REQ_PAIR, &req)) < 0) {
+		int busy = errno == EBUSY;
+
 		printf("Req ASRC pair FAILED\n");
-		return err;
+		if (!busy || verify_mode)
+			return err;
+		/* all pairs taken: convert on the CPU, but don't report a pass */
+		printf("All ASRC pairs busy, falling back to the software converter\n");
+		use_sw = 1;
+		sw_fallback = 1;
+		return request_asrc_channel(fd_asrc, info);
 	}
 	if (req.index == 0)
 		printf("Pair A requested\n");
@@ -297,6 +414,29 @@ int configure_asrc_channel(int fd_asrc, struct audio_info_s *info)
 	int err = 0;
 	struct asrc_config config;
 
+	if (use_sw) {
+		sw_pair = asrc_sw_open(info->channel, info->sample_rate,
+				       info->output_sample_rate,
+				       info->input_format, info->output_format,
+				       sw_quality);
+		return sw_pair ? 0 : -EINVAL;
+	}
+
+	if (verify_mode) {
+		ref_pair = asrc_sw_open(info->channel, info->sample_rate,
+					info->output_sample_rate,
+					info->input_format, info->output_format,
+					sw_quality);
+		verifier = asrc_verify_open(info->channel, info->output_sample_rate,
+					    info->output_sample_rate * VERIFY_SECONDS);
+		if (!ref_pair || !verifier) {
+			printf("cannot set up the software reference\n");
+			return -EINVAL;
+		}
+		verify_format = info->output_format;
+		verify_channels = info->channel;
+	}
+
 	config.pair = pair_index;
 	config.channel_num = info->channel;
 	config.dma_buffer_size = info->input_dma_buf_size;
@@ -346,6 +486,92 @@ int asrc_get_output_buffer_size(int input_buffer_size,
 	return outbuffer_size;
 }
 
+static int asrc_start(void)
+{
+	if (use_sw)
+		return 0;
+	return ioctl(fd_asrc, ASRC_START_CONV, &pair_index);
+}
+
+static int asrc_stop(void)
+{
+	if (use_sw)
+		return 0;
+	return ioctl(fd_asrc, ASRC_STOP_CONV, &pair_index);
+}
+
+/* run the reference on the same input and hand both outputs to verifier */
+static int verify_convert(struct asrc_convert_buffer *hw_info,
+			  unsigned int output_max)
+{
+	static char *ref_out;
+	static float *hw_f, *ref_f;
+	static unsigned int ref_max;
+	struct asrc_convert_buffer ref_info;
+	int bytes = snd_pcm_format_physical_width(verify_format) / 8;
+	unsigned int frame = bytes * verify_channels;
+	int err;
+
+	if (output_max > ref_max) {
+		free(ref_out);
+		free(hw_f);
+		free(ref_f);
+		ref_out = malloc(output_max);
+		hw_f = malloc(output_max / bytes * sizeof(float));
+		ref_f = malloc(output_max / bytes * sizeof(float));
+		ref_max = output_max;
+		if (!ref_out || !hw_f || !ref_f) {
+			ref_max = 0;
+			return -ENOMEM;
+		}
+	}
+
+	ref_info = *hw_info;
+	ref_info.output_buffer_vaddr = ref_out;
+	ref_info.output_buffer_length = output_max;
+	err = asrc_sw_convert(ref_pair, &ref_info);
+	if (err < 0)
+		return err;
+
+	asrc_sw_to_float(verify_format, hw_info->output_buffer_vaddr, hw_f,
+			 hw_info->output_buffer_length / bytes);
+	asrc_sw_to_float(verify_format, ref_out, ref_f,
+			 ref_info.output_buffer_length / bytes);
+	asrc_verify_add(verifier, hw_f, hw_info->output_buffer_length / frame,
+			ref_f, ref_info.output_buffer_length / frame);
+	return 0;
+}
+
+static int asrc_convert(struct asrc_convert_buffer *buf_info)
+{
+	unsigned int output_max = buf_info->output_buffer_length;
+	int err;
+
+	if (use_sw)
+		return asrc_sw_convert(sw_pair, buf_info);
+
+	err = ioctl(fd_asrc, ASRC_CONVERT, buf_info);
+	if (err < 0 || !verifier)
+		return err;
+
+	return verify_convert(buf_info, output_max);
+}
+
+static void asrc_release(void)
+{
+	asrc_sw_close(ref_pair);
+	ref_pair = NULL;
+	asrc_verify_close(verifier);
+	verifier = NULL;
+
+	if (use_sw) {
+		asrc_sw_close(sw_pair);
+		sw_pair = NULL;
+		return;
+	}
+	ioctl(fd_asrc, ASRC_RELEASE_PAIR, &pair_index);
+}
+
 int play_file(FILE * fd_dst, int fd_asrc, struct audio_info_s *info)
 {
 	int err = 0;
@@ -368,7 +594,7 @@ int play_file(FILE * fd_dst, int fd_asrc, struct audio_info_s *info)
 
 	convert_flag = 1;
 	memset(input_null, 0, info->input_dma_buf_size);
-	if ((err = ioctl(fd_asrc, ASRC_START_CONV, &pair_index)) < 0)
+	if ((err = asrc_start()) < 0)
 		goto error;
 
 	info->output_used = 0;
@@ -389,7 +615,7 @@ int play_file(FILE * fd_dst, int fd_asrc, struct audio_info_s *info)
 
 		buf_info.output_buffer_length = output_dma_size + tail;
 		buf_info.output_buffer_vaddr = output_p;
-		if ((err = ioctl(fd_asrc, ASRC_CONVERT, &buf_info)) < 0)
+		if ((err = asrc_convert(&buf_info)) < 0)
 			goto error;
 		if (info->output_data_len > buf_info.output_buffer_length) {
 			info->output_data_len -= buf_info.output_buffer_length;
@@ -404,7 +630,7 @@ int play_file(FILE * fd_dst, int fd_asrc, struct audio_info_s *info)
 		if (info->output_data_len == 0)
 			break;
 	}
-	err = ioctl(fd_asrc, ASRC_STOP_CONV, &pair_index);
+	err = asrc_stop();
 
 	free(output_p);
 
@@ -436,13 +662,13 @@ int update_sample_bitdepth(struct audio_info_s *info)
 	return 0;
 }
 
-void bitshift(FILE * src, struct audio_info_s *info)
+/*
+ * Pick the ASRC input/output formats for the WAV sample layout and update
+ * the output header to match. Returns how each sample has to be repacked.
+ */
+static enum repack_mode bitshift_setup(struct audio_info_s *info)
 {
-	unsigned int data;
-	unsigned int zero;
-	int nleft;
 	int format_size;
-	int i = 0;
 	int slotwidth = 8 * info->blockalign / info->channel;
 	format_size = *(int *)&header[16];
 
@@ -450,45 +676,20 @@ void bitshift(FILE * src, struct audio_info_s *info)
 
 	switch (slotwidth) {
 	case 8:
-		nleft = info->input_data_len;
 		info->input_dma_buf_size = DMA_BUF_SIZE / 2;
 		break;
 	case 16:
-		nleft = (info->input_data_len >> 1);
-		break;
 	case 24:
-		nleft = info->input_data_len / 3;
-		break;
 	case 32:
-		nleft = (info->input_data_len >> 2);
 		break;
 	default:
 		printf("wrong slot width\n");
-		return;
+		return REPACK_NONE;
 	}
 
-	/*allocate input buffer*/
-	input_buffer = (int *)malloc(sizeof(int) * nleft +
-				info->input_dma_buf_size);
-	if (input_buffer == NULL)
-		printf("allocate input buffer error\n");
-	input_null = (int *)malloc(info->input_dma_buf_size);
-	if (input_null == NULL)
-		printf("allocate input null error\n");
-
 	if (info->frame_bits == 8) {
 		/*change data format*/
 		if (supported_in_format & (1ULL << SND_PCM_FORMAT_S8)) {
-			char * buf = (char *) input_buffer;
-			unsigned char c;
-			signed char d;
-
-			do {
-				fread(&c, 1, 1, src);
-				d = (char)((int)c - 128);
-				buf[i++] = d;
-			} while (--nleft);
-
 			/*change data length*/
 			info->output_data_len = info->output_data_len << 1;
 			update_datachunk_length(info, format_size);
@@ -497,17 +698,8 @@ void bitshift(FILE * src, struct audio_info_s *info)
 			info->blockalign = info->channel * 2;
 			info->input_format = SND_PCM_FORMAT_S8;
 			info->output_format = SND_PCM_FORMAT_S16_LE;
+			return REPACK_U8_TO_S8;
 		} else {
-			short * buf = (short *) input_buffer;
-			unsigned char c;
-			signed short d;
-
-			do {
-				fread(&c, 1, 1, src);
-				d = (short)((int)c - 128);
-				buf[i++] = d << 8;
-			} while (--nleft);
-
 			/*change data length*/
 			info->output_data_len = info->output_data_len << 1;
 			update_datachunk_length(info, format_size);
@@ -516,80 +708,46 @@ void bitshift(FILE * src, struct audio_info_s *info)
 			info->blockalign = info->channel * 2;
 			info->input_format = SND_PCM_FORMAT_S16_LE;
 			info->output_format = SND_PCM_FORMAT_S16_LE;
+			return REPACK_U8_TO_S16;
 		}
 	} else if (info->frame_bits == 16) {
-		short * buf = (short *) input_buffer;
-		/*change data format*/
-		do {
-			fread(&data, 2, 1, src);
-			buf[i++] = (short)(data & 0xFFFF);
-		} while (--nleft);
-
 		info->frame_bits = 16;
 		info->blockalign = info->channel * 2;
 		info->input_format = SND_PCM_FORMAT_S16_LE;
 		info->output_format = SND_PCM_FORMAT_S16_LE;
-
+		return REPACK_16;
 	} else if (info->frame_bits == 20 && (slotwidth == 24)) {
 		/*change data format*/
 		if (supported_in_format & (1ULL << SND_PCM_FORMAT_S20_3LE)) {
-			char * buf = (char *) input_buffer;
-			do {
-				fread(&data, 3, 1, src);
-				buf[i++] = (char)(data & 0xFF);
-				buf[i++] = (char)((data >> 8) & 0xFF);
-				buf[i++] = (char)((data >> 16) & 0xFF);
-			} while (--nleft);
 			/*change data length*/
 			info->input_dma_buf_size = (DMA_BUF_SIZE / 3) * 3;
-			info->input_data_len = info->input_data_len;
-			info->output_data_len = info->output_data_len;
 			update_datachunk_length(info, format_size);
 
 			info->frame_bits = 24;
 			info->blockalign = info->channel * 3;
 			info->input_format = SND_PCM_FORMAT_S20_3LE;
 			info->output_format = SND_PCM_FORMAT_S20_3LE;
+			return REPACK_24_3;
 		} else {
-			do {
-				fread(&data, 3, 1, src);
-				zero = (data << 4 ) & 0xFFFFFF;
-				input_buffer[i++] = zero;
-			} while (--nleft);
-
 			info->frame_bits = 24;
 			info->blockalign = info->channel * 4;
 			info->input_format = SND_PCM_FORMAT_S24_LE;
 			info->output_format = SND_PCM_FORMAT_S24_LE;
+			return REPACK_20_3_TO_S24;
 		}
-
 	} else if (info->frame_bits == 24 && (slotwidth == 24)) {
 		if (supported_in_format & (1ULL << SND_PCM_FORMAT_S24_3LE)) {
-			char * buf = (char *) input_buffer;
-			do {
-				fread(&data, 3, 1, src);
-				buf[i++] = (char)(data & 0xFF);
-				buf[i++] = (char)((data >> 8) & 0xFF);
-				buf[i++] = (char)((data >> 16) & 0xFF);
-			} while (--nleft);
 			/*change data length*/
 			info->input_dma_buf_size = (DMA_BUF_SIZE / 3) * 3;
-			info->input_data_len = info->input_data_len;
-			info->output_data_len = info->output_data_len;
 			update_datachunk_length(info, format_size);
 
 			info->frame_bits = 24;
 			info->blockalign = info->channel * 3;
 			info->input_format = SND_PCM_FORMAT_S24_3LE;
 			info->output_format = SND_PCM_FORMAT_S24_3LE;
+			return REPACK_24_3;
 		} else {
-			do {
-				fread(&data, 3, 1, src);
-				zero = (data & 0xFFFF00);
-				input_buffer[i++] = zero;
-			} while (--nleft);
 			/*change data length*/
-			info->input_data_len = info->input_data_len * 4 / 3;
 			info->output_data_len = info->output_data_len * 4 / 3;
 			update_datachunk_length(info, format_size);
 
@@ -597,28 +755,19 @@ void bitshift(FILE * src, struct audio_info_s *info)
 			info->blockalign = info->channel * 4;
 			info->input_format = SND_PCM_FORMAT_S24_LE;
 			info->output_format = SND_PCM_FORMAT_S24_LE;
+			return REPACK_24_3_TO_S24;
 		}
 	} else if (info->frame_bits == 24 && (slotwidth == 32)) {
-		/*change data format*/
-		do {
-			fread(&data, 4, 1, src);
-			input_buffer[i++] = data;
-		} while (--nleft);
-
 		info->frame_bits = 24;
 		info->blockalign = info->channel * 4;
 		info->input_format = SND_PCM_FORMAT_S24_LE;
 		info->output_format = SND_PCM_FORMAT_S24_LE;
+		return REPACK_32;
 	} else if (info->frame_bits == 32) {
 		/*change data format*/
 		if ((supported_in_format & (1ULL << SND_PCM_FORMAT_S32_LE)) &&
 			(supported_out_format & (1ULL << SND_PCM_FORMAT_IEC958_SUBFRAME_LE)) &&
 			info->iec958 && info->audioformat == 1) {
-			do {
-				fread(&data, 4, 1, src);
-				input_buffer[i++] = data;
-			} while (--nleft);
-
 			info->frame_bits = 32;
 			info->blockalign = info->channel * 4;
 			info->input_format = SND_PCM_FORMAT_S32_LE;
@@ -626,11 +775,6 @@ void bitshift(FILE * src, struct audio_info_s *info)
 		} else if ((supported_in_format & (1ULL << SND_PCM_FORMAT_S32_LE)) &&
 			(supported_out_format & (1ULL << SND_PCM_FORMAT_FLOAT_LE)) &&
 			info->audioformat == 1) {
-			do {
-				fread(&data, 4, 1, src);
-				input_buffer[i++] = data;
-			} while (--nleft);
-
 			info->frame_bits = 32;
 			info->blockalign = info->channel * 4;
 			info->input_format = SND_PCM_FORMAT_S32_LE;
@@ -639,36 +783,424 @@ void bitshift(FILE * src, struct audio_info_s *info)
 		} else if ((supported_in_format & (1ULL << SND_PCM_FORMAT_FLOAT_LE)) &&
 			(supported_out_format & (1ULL << SND_PCM_FORMAT_S32_LE)) &&
 			info->audioformat == 3) {
-			do {
-				fread(&data, 4, 1, src);
-				input_buffer[i++] = data;
-			} while (--nleft);
-
 			info->frame_bits = 32;
 			info->audioformat = 1;
 			info->blockalign = info->channel * 4;
 			info->input_format = SND_PCM_FORMAT_FLOAT_LE;
 			info->output_format = SND_PCM_FORMAT_S32_LE;
-
 		} else {
-			do {
-				fread(&data, 4, 1, src);
-				/*change data bit from 32bit to 24bit*/
-				zero = (data >> 8) & 0x00FFFFFF;
-				input_buffer[i++] = zero;
-			} while (--nleft);
-
+			/*change data bit from 32bit to 24bit*/
 			info->frame_bits = 24;
 			info->blockalign = info->channel * 4;
 			info->input_format = SND_PCM_FORMAT_S24_LE;
 			info->output_format = SND_PCM_FORMAT_S24_LE;
+			return REPACK_32_TO_S24;
 		}
+		return REPACK_32;
 	}
 
+	printf("unsupported sample format: %d bits in %d bit slots\n",
+	       info->frame_bits, slotwidth);
+	return REPACK_NONE;
+}
+
+/* load the whole WAV data into input_buffer in the ASRC input format */
+int bitshift(FILE * src, struct audio_info_s *info)
+{
+	enum repack_mode mode;
+	unsigned char *raw;
+	char *dst;
+	int nleft, n, in_bytes, out_bytes;
+
+	mode = bitshift_setup(info);
+	if (mode == REPACK_NONE)
+		return -EINVAL;
+
+	in_bytes = repack_size[mode].in_bytes;
+	out_bytes = repack_size[mode].out_bytes;
+	nleft = info->input_data_len / in_bytes;
+
+	/*allocate input buffer*/
+	input_buffer = (int *)malloc(sizeof(int) * nleft +
+				info->input_dma_buf_size);
+	if (input_buffer == NULL) {
+		printf("allocate input buffer error\n");
+		return -ENOMEM;
+	}
+	input_null = (int *)malloc(info->input_dma_buf_size);
+	if (input_null == NULL) {
+		printf("allocate input null error\n");
+		return -ENOMEM;
+	}
+	raw = malloc(REPACK_CHUNK * 4);
+	if (raw == NULL) {
+		printf("allocate repack buffer error\n");
+		return -ENOMEM;
+	}
+
+	dst = (char *)input_buffer;
+	while (nleft > 0) {
+		n = nleft < REPACK_CHUNK ? nleft : REPACK_CHUNK;
+		n = fread(raw, in_bytes, n, src);
+		if (n <= 0)
+			break;
+		repack(mode, dst, raw, n);
+		dst += n * out_bytes;
+		nleft -= n;
+	}
+	free(raw);
+
+	/*change data length*/
+	info->input_data_len = dst - (char *)input_buffer;
+
 	/*change block align*/
 	update_blockalign(info);
 
 	update_sample_bitdepth(info);
+	return 0;
+}
+
+static double tv_diff(struct timeval *end, struct timeval *start)
+{
+	return (end->tv_sec - start->tv_sec) +
+		(end->tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static int queue_init(struct block_queue *q, int size)
+{
+	q->slot = calloc(size, sizeof(*q->slot));
+	if (!q->slot)
+		return -ENOMEM;
+	q->size = size;
+	q->head = 0;
+	q->count = 0;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	return 0;
+}
+
+static void queue_free(struct block_queue *q)
+{
+	free(q->slot);
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->cond);
+}
+
+static void queue_put(struct block_queue *q, struct stream_block *blk)
+{
+	pthread_mutex_lock(&q->lock);
+	while (q->count == q->size)
+		pthread_cond_wait(&q->cond, &q->lock);
+	q->slot[(q->head + q->count) % q->size] = blk;
+	q->count++;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static struct stream_block *queue_get(struct block_queue *q)
+{
+	struct stream_block *blk;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->count == 0)
+		pthread_cond_wait(&q->cond, &q->lock);
+	blk = q->slot[q->head];
+	q->head = (q->head + 1) % q->size;
+	q->count--;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+
+	return blk;
+}
+
+/* fill a pool queue with depth blocks of size bytes */
+static int queue_alloc_blocks(struct block_queue *q, int depth, unsigned int size)
+{
+	struct stream_block *blk;
+	int i;
+
+	if (queue_init(q, depth) < 0)
+		return -ENOMEM;
+
+	for (i = 0; i < depth; i++) {
+		blk = calloc(1, sizeof(*blk) + size);
+		if (!blk)
+			return -ENOMEM;
+		blk->data = (char *)(blk + 1);
+		queue_put(q, blk);
+	}
+	return 0;
+}
+
+static void queue_free_blocks(struct block_queue *q)
+{
+	while (q->count)
+		free(queue_get(q));
+	queue_free(q);
+}
+
+/* reader: raw WAV data -> repacked input blocks, length 0 marks the end */
+void *asrc_input_thread(void *arg)
+{
+	struct stream_ctx *ctx = arg;
+	int in_bytes = repack_size[ctx->mode].in_bytes;
+	int out_bytes = repack_size[ctx->mode].out_bytes;
+	int samples = ctx->in_block_size / out_bytes;
+	struct stream_block *blk;
+	unsigned char *raw;
+	int n;
+
+	raw = malloc(samples * in_bytes);
+	if (!raw)
+		ctx->raw_left = 0;
+
+	while (ctx->raw_left > 0) {
+		n = ctx->raw_left / in_bytes;
+		if (n > samples)
+			n = samples;
+		n = fread(raw, in_bytes, n, ctx->src);
+		if (n <= 0)
+			break;
+		ctx->raw_left -= n * in_bytes;
+
+		blk = queue_get(&ctx->in_free);
+		gettimeofday(&blk->stamp, NULL);
+		repack(ctx->mode, blk->data, raw, n);
+		/* the last block is zero padded to a full frame */
+		blk->length = n * out_bytes;
+		memset(blk->data + blk->length, 0, ctx->in_block_size - blk->length);
+		blk->length = ctx->in_block_size;
+		ctx->bytes_in += n * out_bytes;
+		queue_put(&ctx->in_full, blk);
+	}
+
+	free(raw);
+
+	blk = queue_get(&ctx->in_free);
+	blk->length = 0;
+	queue_put(&ctx->in_full, blk);
+	return NULL;
+}
+
+/* writer: output blocks -> file, length 0 marks the end */
+void *asrc_output_thread(void *arg)
+{
+	struct stream_ctx *ctx = arg;
+	struct stream_block *blk;
+	struct timeval now;
+	double lat;
+
+	for (;;) {
+		blk = queue_get(&ctx->out_full);
+		if (blk->length == 0) {
+			queue_put(&ctx->out_free, blk);
+			break;
+		}
+
+		if (fwrite(blk->data, blk->length, 1, ctx->dst) != 1)
+			ctx->error = -EIO;
+
+		gettimeofday(&now, NULL);
+		lat = tv_diff(&now, &blk->stamp);
+		if (ctx->blocks_out == 0 || lat < ctx->lat_min)
+			ctx->lat_min = lat;
+		if (lat > ctx->lat_max)
+			ctx->lat_max = lat;
+		ctx->lat_sum += lat;
+		ctx->blocks_out++;
+		ctx->bytes_out += blk->length;
+
+		queue_put(&ctx->out_free, blk);
+	}
+
+	return NULL;
+}
+
+static void stream_summary(struct stream_ctx *ctx, double elapsed)
+{
+	struct audio_info_s *info = ctx->info;
+	double audio = (double)ctx->bytes_out /
+		(info->output_sample_rate * info->blockalign);
+	unsigned long long mem;
+
+	mem = (unsigned long long)queue_depth *
+		(ctx->in_block_size + ctx->out_block_size);
+
+	printf("\nStream summary (%s converter, depth %d, %llu bytes buffered):\n",
+	       use_sw ? "software" : "ASRC", queue_depth, mem);
+	printf("  input   : %llu bytes\n", ctx->bytes_in);
+	printf("  output  : %llu bytes in %u blocks, %.3f s of audio\n",
+	       ctx->bytes_out, ctx->blocks_out, audio);
+	if (elapsed > 0)
+		printf("  elapsed : %.3f s, %.2f MB/s in, %.2f MB/s out, %.1fx realtime\n",
+		       elapsed, ctx->bytes_in / elapsed / 1e6,
+		       ctx->bytes_out / elapsed / 1e6, audio / elapsed);
+	if (ctx->blocks_out)
+		printf("  latency : read to write min %.3f ms, avg %.3f ms, max %.3f ms\n",
+		       ctx->lat_min * 1000, ctx->lat_sum / ctx->blocks_out * 1000,
+		       ctx->lat_max * 1000);
+	if (elapsed > 0)
+		printf("  convert : %.3f s busy (%.1f%%)\n", ctx->convert_time,
+		       ctx->convert_time / elapsed * 100);
+}
+
+/*
+ * Streaming counterpart of bitshift() + play_file(): a reader thread
+ * repacks the WAV data block by block, this thread runs the conversion and
+ * a writer thread stores the result, so memory use is bounded by the queue
+ * depth instead of the file size.
+ */
+int stream_file(FILE *fd_src, FILE *fd_dst, struct audio_info_s *info,
+		enum repack_mode mode)
+{
+	struct stream_ctx ctx;
+	struct stream_block *in, *out, null_blk;
+	struct asrc_convert_buffer buf_info;
+	struct timeval start, end, t0, t1;
+	pthread_t reader, writer;
+	unsigned int tail, frame_bytes;
+	int err = 0, eof = 0, idle = 0;
+	int started = 0, have_reader = 0, have_writer = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.src = fd_src;
+	ctx.dst = fd_dst;
+	ctx.info = info;
+	ctx.mode = mode;
+	ctx.raw_left = info->input_data_len;
+
+	/* whole frames per block, so a short last block pads cleanly */
+	frame_bytes = repack_size[mode].out_bytes * info->channel;
+	ctx.in_block_size = info->input_dma_buf_size / frame_bytes * frame_bytes;
+	tail = info->channel * 4 * 16;
+	ctx.out_block_size =
+	    asrc_get_output_buffer_size(ctx.in_block_size,
+					info->sample_rate,
+					info->output_sample_rate,
+					info->input_format,
+					info->output_format) + tail;
+
+	null_blk.data = calloc(1, ctx.in_block_size);
+	if (!null_blk.data)
+		return -ENOMEM;
+
+	if (queue_alloc_blocks(&ctx.in_free, queue_depth, ctx.in_block_size) < 0 ||
+	    queue_init(&ctx.in_full, queue_depth) < 0 ||
+	    queue_alloc_blocks(&ctx.out_free, queue_depth, ctx.out_block_size) < 0 ||
+	    queue_init(&ctx.out_full, queue_depth) < 0) {
+		printf("allocate stream buffers error\n");
+		err = -ENOMEM;
+		goto end;
+	}
+
+	if ((err = asrc_start()) < 0)
+		goto end;
+	started = 1;
+
+	gettimeofday(&start, NULL);
+	if ((err = pthread_create(&reader, NULL, asrc_input_thread, &ctx))) {
+		printf("create reader thread error\n");
+		err = -err;
+		goto end;
+	}
+	have_reader = 1;
+	if ((err = pthread_create(&writer, NULL, asrc_output_thread, &ctx))) {
+		printf("create writer thread error\n");
+		err = -err;
+		goto end;
+	}
+	have_writer = 1;
+
+	info->output_used = 0;
+	while (info->output_data_len > 0) {
+		if (!eof) {
+			in = queue_get(&ctx.in_full);
+			if (in->length == 0) {
+				queue_put(&ctx.in_free, in);
+				eof = 1;
+			}
+		}
+		/* keep feeding silence until the converter drained */
+		if (eof) {
+			in = &null_blk;
+			in->length = ctx.in_block_size;
+			gettimeofday(&in->stamp, NULL);
+		}
+
+		out = queue_get(&ctx.out_free);
+		out->stamp = in->stamp;
+
+		buf_info.input_buffer_vaddr = in->data;
+		buf_info.input_buffer_length = in->length;
+		buf_info.output_buffer_vaddr = out->data;
+		buf_info.output_buffer_length = ctx.out_block_size;
+
+		gettimeofday(&t0, NULL);
+		err = asrc_convert(&buf_info);
+		gettimeofday(&t1, NULL);
+		ctx.convert_time += tv_diff(&t1, &t0);
+
+		if (in != &null_blk)
+			queue_put(&ctx.in_free, in);
+		if (err < 0) {
+			queue_put(&ctx.out_free, out);
+			break;
+		}
+
+		out->length = buf_info.output_buffer_length;
+		if (out->length > (unsigned int)info->output_data_len)
+			out->length = info->output_data_len;
+		info->output_data_len -= out->length;
+		info->output_used += out->length;
+
+		if (out->length == 0) {
+			queue_put(&ctx.out_free, out);
+			/* a converter that stopped producing output is stuck */
+			if (eof && ++idle > queue_depth * 4) {
+				printf("converter produced no output, giving up\n");
+				break;
+			}
+			continue;
+		}
+		idle = 0;
+		queue_put(&ctx.out_full, out);
+	}
+
+end:
+	/* unblock and stop the reader if the conversion ended early */
+	if (have_reader) {
+		while (!eof) {
+			in = queue_get(&ctx.in_full);
+			if (in->length == 0)
+				eof = 1;
+			queue_put(&ctx.in_free, in);
+		}
+		pthread_join(reader, NULL);
+	}
+
+	if (have_writer) {
+		out = queue_get(&ctx.out_free);
+		out->length = 0;
+		queue_put(&ctx.out_full, out);
+		pthread_join(writer, NULL);
+	}
+
+	gettimeofday(&end, NULL);
+	if (started)
+		asrc_stop();
+
+	if (have_writer)
+		stream_summary(&ctx, tv_diff(&end, &start));
+
+	queue_free_blocks(&ctx.in_free);
+	queue_free(&ctx.in_full);
+	queue_free_blocks(&ctx.out_free);
+	queue_free(&ctx.out_full);
+	free(null_blk.data);
+
+	if (err >= 0)
+		err = ctx.error;
+	return err;
 }
 
 int read_file_length(FILE *src, struct audio_info_s *info) {
@@ -827,6 +1359,7 @@ int main(int ac, const char *av[])
 	FILE *fd_dst = NULL;
 	FILE *fd_src = NULL;
 	struct audio_info_s audio_info;
+	enum repack_mode mode = REPACK_NONE;
 	int i = 0, err = 0;
 
 	convert_flag = 0;
@@ -841,9 +1374,18 @@ int main(int ac, const char *av[])
 
 	printf("\n---- Running < %s > test ----\n\n", av[0]);
 
-	fd_asrc = open("/dev/mxc_asrc", O_RDWR);
-	if (fd_asrc < 0)
-		printf("Unable to open device\n");
+	if (verify_mode && use_sw) {
+		printf("-V compares the ASRC against the software converter, drop -S\n");
+		return 1;
+	}
+
+	if (!use_sw) {
+		fd_asrc = open("/dev/mxc_asrc", O_RDWR);
+		if (fd_asrc < 0) {
+			printf("Unable to open device\n");
+			return 1;
+		}
+	}
 
 	switch (audio_info.inclk) {
 	case 0:
@@ -1026,7 +1568,19 @@ int main(int ac, const char *av[])
 	if (err < 0)
 		goto end_err;
 
-	bitshift(fd_src, &audio_info);
+	if (stream_mode) {
+		mode = bitshift_setup(&audio_info);
+		if (mode == REPACK_NONE) {
+			err = -EINVAL;
+			goto end_err;
+		}
+		update_blockalign(&audio_info);
+		update_sample_bitdepth(&audio_info);
+	} else {
+		err = bitshift(fd_src, &audio_info);
+		if (err < 0)
+			goto end_err;
+	}
 
 	err = configure_asrc_channel(fd_asrc, &audio_info);
 	if (err < 0)
@@ -1035,18 +1589,33 @@ int main(int ac, const char *av[])
 	header_write(fd_dst);
 
 	/* Config HW */
-	err += play_file(fd_dst, fd_asrc, &audio_info);
+	if (stream_mode)
+		err += stream_file(fd_src, fd_dst, &audio_info, mode);
+	else
+		err += play_file(fd_dst, fd_asrc, &audio_info);
 	if (err < 0)
 		goto end_err;
 
+	if (verifier) {
+		err = asrc_verify_report(verifier, verify_min_snr);
+		if (err < 0)
+			goto end_err;
+	}
+
 	header_update(fd_dst, &audio_info);
 
 	fclose(fd_src);
 	fclose(fd_dst);
-	close(fd_asrc);
+	asrc_release();
+	if (!use_sw)
+		close(fd_asrc);
 
 	free(input_null);
 	free(input_buffer);
+	if (sw_fallback) {
+		printf("Converted on the CPU, the ASRC was not tested\n");
+		return 2;
+	}
 	printf("All tests passed with success\n");
 	return 0;
 
@@ -1058,7 +1627,8 @@ end_head_parse:
 err_src_not_found:
 	fclose(fd_dst);
 err_dst_not_found:
-	ioctl(fd_asrc, ASRC_RELEASE_PAIR, &pair_index);
-	close(fd_asrc);
+	asrc_release();
+	if (!use_sw)
+		close(fd_asrc);
 	return err;
 }
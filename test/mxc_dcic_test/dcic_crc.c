@@ -0,0 +1,434 @@
+/*
+ * Copyright (C) 2014-2015 Freescale Semiconductor, Inc. All rights reserved.
+ */
+
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+/*
+ * @file dcic_crc.c
+ *
+ * @brief Fast DCIC signature calculation
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "dcic_crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DCIC_CRC_X86_CLMUL
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define DCIC_CRC_ARM_PMULL
+#endif
+
+#define DCIC_CRC_POLY		0x04C11DB7
+
+/* pixels converted to bus bytes per engine call */
+#define DCIC_CRC_CHUNK		1024
+
+static uint32_t crc_table[8][256];
+
+/*
+ * Folding constants x^(d + 64) mod P and x^d mod P for folding a 128 bit
+ * block forward by d = 512 (four lanes), 384, 256 and 128 bits.
+ */
+static uint64_t fold_512[2];
+static uint64_t fold_384[2];
+static uint64_t fold_256[2];
+static uint64_t fold_128[2];
+
+static int clmul_supported;
+static int initialized;
+static enum dcic_crc_engine crc_engine = DCIC_CRC_TABLE;
+
+static uint32_t xpow_mod(unsigned int n)
+{
+	uint32_t r = 1;
+
+	while (n--)
+		r = (r << 1) ^ ((r & 0x80000000) ? DCIC_CRC_POLY : 0);
+
+	return r;
+}
+
+static void fold_const(uint64_t *k, unsigned int d)
+{
+	k[0] = xpow_mod(d + 64);
+	k[1] = xpow_mod(d);
+}
+
+static uint32_t crc_bytes_table(uint32_t crc, const uint8_t *p, size_t len)
+{
+	while (len--)
+		crc = (crc << 8) ^ crc_table[0][(crc >> 24) ^ *p++];
+
+	return crc;
+}
+
+static uint32_t crc_bytes_slice8(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint32_t hi;
+
+	while (len >= 8) {
+		hi = crc ^ ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+			    (uint32_t)p[2] << 8 | p[3]);
+		crc = crc_table[7][hi >> 24] ^
+		      crc_table[6][(hi >> 16) & 0xFF] ^
+		      crc_table[5][(hi >> 8) & 0xFF] ^
+		      crc_table[4][hi & 0xFF] ^
+		      crc_table[3][p[4]] ^ crc_table[2][p[5]] ^
+		      crc_table[1][p[6]] ^ crc_table[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+
+	return crc_bytes_table(crc, p, len);
+}
+
+/*
+ * Carry-less multiply folding for a non reflected CRC: the stream is read
+ * as big endian 128 bit blocks in four lanes. A block H:L that is d bits
+ * ahead of the end of the fold is congruent to H * (x^(d+64) mod P) +
+ * L * (x^d mod P), a 95 bit product that is added into the block at that
+ * position. The 128 bit remainder is finished with the byte table.
+ */
+#ifdef DCIC_CRC_X86_CLMUL
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i clmul_fold(__m128i x, const uint64_t *k)
+{
+	__m128i kk = _mm_set_epi64x(k[0], k[1]);
+
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, kk, 0x11),
+			     _mm_clmulepi64_si128(x, kk, 0x00));
+}
+
+__attribute__((target("pclmul,ssse3")))
+static uint32_t crc_bytes_clmul(uint32_t crc, const uint8_t *p, size_t len)
+{
+	const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+					  8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i x0, x1, x2, x3;
+	uint8_t rem[16];
+
+	if (len < 64)
+		return crc_bytes_slice8(crc, p, len);
+
+#define LOAD(i)	_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + (i) * 16)), swap)
+	x0 = _mm_xor_si128(LOAD(0), _mm_set_epi32(crc, 0, 0, 0));
+	x1 = LOAD(1);
+	x2 = LOAD(2);
+	x3 = LOAD(3);
+	p += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		x0 = _mm_xor_si128(clmul_fold(x0, fold_512), LOAD(0));
+		x1 = _mm_xor_si128(clmul_fold(x1, fold_512), LOAD(1));
+		x2 = _mm_xor_si128(clmul_fold(x2, fold_512), LOAD(2));
+		x3 = _mm_xor_si128(clmul_fold(x3, fold_512), LOAD(3));
+		p += 64;
+		len -= 64;
+	}
+
+	x0 = _mm_xor_si128(clmul_fold(x0, fold_384), clmul_fold(x1, fold_256));
+	x0 = _mm_xor_si128(x0, clmul_fold(x2, fold_128));
+	x0 = _mm_xor_si128(x0, x3);
+
+	while (len >= 16) {
+		x0 = _mm_xor_si128(clmul_fold(x0, fold_128), LOAD(0));
+		p += 16;
+		len -= 16;
+	}
+#undef LOAD
+
+	_mm_storeu_si128((__m128i *)rem, _mm_shuffle_epi8(x0, swap));
+	crc = crc_bytes_table(0, rem, 16);
+
+	return crc_bytes_table(crc, p, len);
+}
+
+static int clmul_probe(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul") &&
+	       __builtin_cpu_supports("ssse3");
+}
+#endif
+
+#ifdef DCIC_CRC_ARM_PMULL
+/* lane 1 holds the high 64 bits of the big endian block */
+static inline uint64x2_t pmull_load(const uint8_t *p)
+{
+	uint64x2_t v = vreinterpretq_u64_u8(vrev64q_u8(vld1q_u8(p)));
+
+	return vextq_u64(v, v, 1);
+}
+
+static inline uint64x2_t pmull_fold(uint64x2_t x, const uint64_t *k)
+{
+	uint64x2_t hi, lo;
+
+	hi = vreinterpretq_u64_p128(vmull_p64(vgetq_lane_u64(x, 1), k[0]));
+	lo = vreinterpretq_u64_p128(vmull_p64(vgetq_lane_u64(x, 0), k[1]));
+
+	return veorq_u64(hi, lo);
+}
+
+static uint32_t crc_bytes_clmul(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint64x2_t x0, x1, x2, x3;
+	uint8_t rem[16];
+
+	if (len < 64)
+		return crc_bytes_slice8(crc, p, len);
+
+	x0 = veorq_u64(pmull_load(p), vcombine_u64(vcreate_u64(0),
+			vcreate_u64((uint64_t)crc << 32)));
+	x1 = pmull_load(p + 16);
+	x2 = pmull_load(p + 32);
+	x3 = pmull_load(p + 48);
+	p += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		x0 = veorq_u64(pmull_fold(x0, fold_512), pmull_load(p));
+		x1 = veorq_u64(pmull_fold(x1, fold_512), pmull_load(p + 16));
+		x2 = veorq_u64(pmull_fold(x2, fold_512), pmull_load(p + 32));
+		x3 = veorq_u64(pmull_fold(x3, fold_512), pmull_load(p + 48));
+		p += 64;
+		len -= 64;
+	}
+
+	x0 = veorq_u64(pmull_fold(x0, fold_384), pmull_fold(x1, fold_256));
+	x0 = veorq_u64(x0, pmull_fold(x2, fold_128));
+	x0 = veorq_u64(x0, x3);
+
+	while (len >= 16) {
+		x0 = veorq_u64(pmull_fold(x0, fold_128), pmull_load(p));
+		p += 16;
+		len -= 16;
+	}
+
+	x0 = vextq_u64(x0, x0, 1);
+	vst1q_u8(rem, vrev64q_u8(vreinterpretq_u8_u64(x0)));
+	crc = crc_bytes_table(0, rem, 16);
+
+	return crc_bytes_table(crc, p, len);
+}
+
+static int clmul_probe(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_PMULL) != 0;
+}
+#endif
+
+#if !defined(DCIC_CRC_X86_CLMUL) && !defined(DCIC_CRC_ARM_PMULL)
+static uint32_t crc_bytes_clmul(uint32_t crc, const uint8_t *p, size_t len)
+{
+	return crc_bytes_slice8(crc, p, len);
+}
+
+static int clmul_probe(void)
+{
+	return 0;
+}
+#endif
+
+static uint32_t crc_bytes(uint32_t crc, const uint8_t *p, size_t len)
+{
+	switch (crc_engine) {
+	case DCIC_CRC_CLMUL:
+		return crc_bytes_clmul(crc, p, len);
+	case DCIC_CRC_SLICE8:
+		return crc_bytes_slice8(crc, p, len);
+	default:
+		return crc_bytes_table(crc, p, len);
+	}
+}
+
+/* pixel to 24 bit bus word, as the crc32_calc_* converters do */
+static inline uint32_t bus_18of24(uint32_t d)
+{
+	return ((d & 0xFC0000) >> 6) | ((d & 0xFC00) >> 4) | ((d & 0xFC) >> 2);
+}
+
+static inline uint32_t bus_24of16(uint32_t d)
+{
+	return ((d & 0xF800) << 8) | ((d & 0xE000) << 3) |
+	       ((d & 0x7E0) << 5) | ((d & 0x600) >> 1) |
+	       ((d & 0x1F) << 3) | ((d & 0x1C) >> 2);
+}
+
+static inline uint32_t bus_18of16(uint32_t d)
+{
+	return ((d & 0xF800) << 2) | ((d & 0x8000) >> 3) |
+	       ((d & 0x7E0) << 1) |
+	       ((d & 0x1F) << 1) | ((d & 0x10) >> 4);
+}
+
+#define PACK_LOOP(type, conv)					\
+	do {							\
+		const type *s = pixels;				\
+		for (i = 0; i < count; i++, out += 3) {		\
+			uint32_t d = conv(s[i]);		\
+			out[0] = d >> 16;			\
+			out[1] = d >> 8;			\
+			out[2] = d;				\
+		}						\
+	} while (0)
+
+#define BUS_24(d)	(d)
+
+static void pack_pixels(uint8_t *out, enum dcic_crc_format format,
+			const void *pixels, unsigned int count)
+{
+	unsigned int i;
+
+	switch (format) {
+	case DCIC_CRC_24:
+		PACK_LOOP(uint32_t, BUS_24);
+		break;
+	case DCIC_CRC_18OF24:
+		PACK_LOOP(uint32_t, bus_18of24);
+		break;
+	case DCIC_CRC_24OF16:
+		PACK_LOOP(uint16_t, bus_24of16);
+		break;
+	case DCIC_CRC_18OF16:
+		PACK_LOOP(uint16_t, bus_18of16);
+		break;
+	default:
+		break;
+	}
+}
+
+enum dcic_crc_engine dcic_crc_init(void)
+{
+	uint32_t crc;
+	int i, j;
+
+	if (initialized)
+		return crc_engine;
+
+	for (i = 0; i < 256; i++) {
+		crc = (uint32_t)i << 24;
+		for (j = 0; j < 8; j++)
+			crc = (crc << 1) ^ ((crc & 0x80000000) ? DCIC_CRC_POLY : 0);
+		crc_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc_table[j][i] = (crc_table[j - 1][i] << 8) ^
+				crc_table[0][crc_table[j - 1][i] >> 24];
+
+	fold_const(fold_512, 512);
+	fold_const(fold_384, 384);
+	fold_const(fold_256, 256);
+	fold_const(fold_128, 128);
+
+	clmul_supported = clmul_probe();
+	crc_engine = clmul_supported ? DCIC_CRC_CLMUL : DCIC_CRC_SLICE8;
+	initialized = 1;
+
+	return crc_engine;
+}
+
+int dcic_crc_engine_supported(enum dcic_crc_engine engine)
+{
+	if (engine == DCIC_CRC_CLMUL)
+		return clmul_supported;
+
+	return engine < DCIC_CRC_ENGINES;
+}
+
+int dcic_crc_set_engine(enum dcic_crc_engine engine)
+{
+	if (!dcic_crc_engine_supported(engine))
+		return -1;
+
+	crc_engine = engine;
+	return 0;
+}
+
+const char *dcic_crc_engine_name(enum dcic_crc_engine engine)
+{
+	static const char *names[DCIC_CRC_ENGINES] = {
+		"table", "slice-by-8", "clmul",
+	};
+
+	return engine < DCIC_CRC_ENGINES ? names[engine] : "?";
+}
+
+const char *dcic_crc_format_name(enum dcic_crc_format format)
+{
+	static const char *names[DCIC_CRC_FORMATS] = {
+		"24bit", "18of24bit", "24of16bit", "18of16bit",
+	};
+
+	return format < DCIC_CRC_FORMATS ? names[format] : "?";
+}
+
+unsigned int dcic_crc_bpp_bytes(enum dcic_crc_format format)
+{
+	return (format == DCIC_CRC_24OF16 || format == DCIC_CRC_18OF16) ? 2 : 4;
+}
+
+unsigned int dcic_crc_pixels(unsigned int crc, enum dcic_crc_format format,
+			     const void *pixels, unsigned int count)
+{
+	uint8_t buf[DCIC_CRC_CHUNK * 3];
+	const uint8_t *src = pixels;
+	unsigned int bpp = dcic_crc_bpp_bytes(format);
+	unsigned int n;
+
+	while (count) {
+		n = count < DCIC_CRC_CHUNK ? count : DCIC_CRC_CHUNK;
+		pack_pixels(buf, format, src, n);
+		crc = crc_bytes(crc, buf, n * 3);
+		src += n * bpp;
+		count -= n;
+	}
+
+	return crc;
+}
+
+/* rows are packed back to back so narrow ROIs still fill the engine */
+unsigned int dcic_crc_rect(unsigned int crc, enum dcic_crc_format format,
+			   const void *base, unsigned int stride,
+			   unsigned int width, unsigned int height)
+{
+	uint8_t buf[DCIC_CRC_CHUNK * 3];
+	const uint8_t *row = base;
+	unsigned int bpp = dcic_crc_bpp_bytes(format);
+	unsigned int used = 0;
+	unsigned int x, n, y;
+
+	for (y = 0; y < height; y++, row += stride) {
+		for (x = 0; x < width; x += n) {
+			n = width - x;
+			if (n > DCIC_CRC_CHUNK - used)
+				n = DCIC_CRC_CHUNK - used;
+			pack_pixels(buf + used * 3, format, row + x * bpp, n);
+			used += n;
+			if (used == DCIC_CRC_CHUNK) {
+				crc = crc_bytes(crc, buf, used * 3);
+				used = 0;
+			}
+		}
+	}
+
+	return crc_bytes(crc, buf, used * 3);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2014-2015 Freescale Semiconductor, Inc. All rights reserved.
+ */
+
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+/*
+ * @file dcic_crc.h
+ *
+ * @brief Fast DCIC signature calculation
+ *
+ */
+
+#ifndef DCIC_CRC_H
+#define DCIC_CRC_H
+
+/*
+ * The DCIC signature is a CRC-32 (polynomial 0x04C11DB7, not reflected,
+ * no final XOR) over the 24 bit display bus word of each pixel, most
+ * significant bit first. That is the plain CRC of the byte stream
+ * R G B R G B ..., so after converting a row of pixels into bus bytes
+ * any byte oriented CRC-32 engine gives the same result as
+ * crc32_calc_single_24bit() applied per pixel.
+ */
+
+/* frame buffer bpp to display bus width */
+enum dcic_crc_format {
+	DCIC_CRC_24,		/* bpp 24, bus width 24 */
+	DCIC_CRC_18OF24,	/* bpp 24, bus width 18 */
+	DCIC_CRC_24OF16,	/* bpp 16, bus width 24 */
+	DCIC_CRC_18OF16,	/* bpp 16, bus width 18 */
+	DCIC_CRC_FORMATS,
+};
+
+enum dcic_crc_engine {
+	DCIC_CRC_TABLE,		/* one 256 entry table, a byte per step */
+	DCIC_CRC_SLICE8,	/* eight tables, 8 bytes per step */
+	DCIC_CRC_CLMUL,		/* PCLMULQDQ / PMULL folding, 64 bytes per step */
+	DCIC_CRC_ENGINES,
+};
+
+/*
+ * Build the tables and folding constants and select the fastest engine
+ * the CPU supports, which is returned. Call before any other function,
+ * and before starting threads that use them.
+ */
+enum dcic_crc_engine dcic_crc_init(void);
+
+/* -1 if the engine is not available on this CPU */
+int dcic_crc_set_engine(enum dcic_crc_engine engine);
+int dcic_crc_engine_supported(enum dcic_crc_engine engine);
+const char *dcic_crc_engine_name(enum dcic_crc_engine engine);
+const char *dcic_crc_format_name(enum dcic_crc_format format);
+
+/* bytes per pixel in the frame buffer */
+unsigned int dcic_crc_bpp_bytes(enum dcic_crc_format format);
+
+/* continue crc over count contiguous pixels */
+unsigned int dcic_crc_pixels(unsigned int crc, enum dcic_crc_format format,
+			     const void *pixels, unsigned int count);
+
+/*
+ * Signature of a width x height rectangle starting at base, with rows
+ * stride bytes apart, as the DCIC computes it over a ROI.
+ */
+unsigned int dcic_crc_rect(unsigned int crc, enum dcic_crc_format format,
+			   const void *base, unsigned int stride,
+			   unsigned int width, unsigned int height);
+
+#endif
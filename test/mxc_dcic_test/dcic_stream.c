@@ -0,0 +1,555 @@
+/*
+ * Copyright (C) 2014-2015 Freescale Semiconductor, Inc. All rights reserved.
+ */
+
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+/*
+ * @file dcic_stream.c
+ *
+ * @brief Per frame DCIC reference signatures for a stream of frames
+ *
+ * Frames come from a raw file or a V4L2 capture device. The signatures
+ * of all enabled ROIs of a frame are computed by a pool of worker
+ * threads while the main thread fetches the next frame, so a frame is
+ * only waited for when the workers are done with the previous one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+
+#include "dcic_crc.h"
+#include "dcic_stream.h"
+
+#define TFAIL -1
+#define TPASS 0
+
+#define STREAM_V4L2_BUFFERS	4
+
+struct stream_frame {
+	unsigned char *data;
+	unsigned int stride;
+	int index;			/* V4L2 buffer, -1 for file frames */
+	double ready;			/* ms, when the frame was available */
+};
+
+struct stream_source {
+	int fd;
+	int v4l2;
+	unsigned int xres;
+	unsigned int yres;
+	unsigned int bpp_bytes;
+	unsigned int stride;
+	size_t frame_size;
+	struct {
+		void *start;
+		size_t length;
+	} buffers[STREAM_V4L2_BUFFERS];
+	unsigned int num_buffers;
+	unsigned char *file_buf[2];
+	unsigned int file_next;
+};
+
+struct stream_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	unsigned int seq;		/* bumped for every frame */
+	int quit;
+
+	enum dcic_crc_format format;
+	const struct stream_frame *frame;
+	unsigned int order[DCIC_STREAM_ROIS];	/* largest ROI first */
+	const struct dcic_stream_roi *roi;
+	unsigned int nroi;
+	unsigned int next;
+	unsigned int finished;
+	unsigned int sig[DCIC_STREAM_ROIS];
+};
+
+static double stream_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int source_open_v4l2(struct stream_source *src, unsigned int bpp)
+{
+	struct v4l2_capability cap;
+	struct v4l2_format fmt;
+	struct v4l2_requestbuffers req;
+	struct v4l2_buffer buf;
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	unsigned int i;
+
+	if (ioctl(src->fd, VIDIOC_QUERYCAP, &cap) < 0 ||
+	    !(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+	    !(cap.capabilities & V4L2_CAP_STREAMING)) {
+		printf("Not a streaming video capture device\n");
+		return TFAIL;
+	}
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt.fmt.pix.width = src->xres;
+	fmt.fmt.pix.height = src->yres;
+	/* little endian 0x00RRGGBB and RGB565, as in the frame buffer */
+	fmt.fmt.pix.pixelformat = bpp == 16 ? V4L2_PIX_FMT_RGB565 :
+					      V4L2_PIX_FMT_XBGR32;
+	fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	if (ioctl(src->fd, VIDIOC_S_FMT, &fmt) < 0) {
+		printf("VIDIOC_S_FMT failed\n");
+		return TFAIL;
+	}
+	if (fmt.fmt.pix.pixelformat != (bpp == 16 ? V4L2_PIX_FMT_RGB565 :
+						    V4L2_PIX_FMT_XBGR32)) {
+		printf("Capture device does not support %u bpp RGB\n", bpp);
+		return TFAIL;
+	}
+
+	src->xres = fmt.fmt.pix.width;
+	src->yres = fmt.fmt.pix.height;
+	src->stride = fmt.fmt.pix.bytesperline;
+
+	memset(&req, 0, sizeof(req));
+	req.count = STREAM_V4L2_BUFFERS;
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+	if (ioctl(src->fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2) {
+		printf("VIDIOC_REQBUFS failed\n");
+		return TFAIL;
+	}
+	src->num_buffers = req.count < STREAM_V4L2_BUFFERS ?
+			   req.count : STREAM_V4L2_BUFFERS;
+
+	for (i = 0; i < src->num_buffers; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if (ioctl(src->fd, VIDIOC_QUERYBUF, &buf) < 0) {
+			printf("VIDIOC_QUERYBUF error\n");
+			return TFAIL;
+		}
+
+		src->buffers[i].length = buf.length;
+		src->buffers[i].start = mmap(NULL, buf.length, PROT_READ,
+					     MAP_SHARED, src->fd, buf.m.offset);
+		if (src->buffers[i].start == MAP_FAILED) {
+			printf("mmap failed\n");
+			src->buffers[i].start = NULL;
+			return TFAIL;
+		}
+
+		if (ioctl(src->fd, VIDIOC_QBUF, &buf) < 0) {
+			printf("VIDIOC_QBUF error\n");
+			return TFAIL;
+		}
+	}
+
+	if (ioctl(src->fd, VIDIOC_STREAMON, &type) < 0) {
+		printf("VIDIOC_STREAMON error\n");
+		return TFAIL;
+	}
+
+	return TPASS;
+}
+
+static int source_open(struct stream_source *src,
+		       const struct dcic_stream_params *params)
+{
+	struct stat st;
+
+	memset(src, 0, sizeof(*src));
+	src->xres = params->xres;
+	src->yres = params->yres;
+	src->bpp_bytes = params->bpp == 16 ? 2 : 4;
+
+	src->fd = open(params->source, O_RDWR, 0);
+	if (src->fd < 0)
+		src->fd = open(params->source, O_RDONLY, 0);
+	if (src->fd < 0 || fstat(src->fd, &st) < 0) {
+		printf("Unable to open %s: %s\n", params->source, strerror(errno));
+		return TFAIL;
+	}
+
+	if (S_ISCHR(st.st_mode)) {
+		src->v4l2 = 1;
+		return source_open_v4l2(src, params->bpp);
+	}
+
+	src->stride = src->xres * src->bpp_bytes;
+	src->frame_size = (size_t)src->stride * src->yres;
+	src->file_buf[0] = malloc(src->frame_size);
+	src->file_buf[1] = malloc(src->frame_size);
+	if (!src->file_buf[0] || !src->file_buf[1]) {
+		printf("Unable to allocate frame buffers\n");
+		return TFAIL;
+	}
+
+	return TPASS;
+}
+
+static void source_close(struct stream_source *src)
+{
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	unsigned int i;
+
+	if (src->v4l2) {
+		ioctl(src->fd, VIDIOC_STREAMOFF, &type);
+		for (i = 0; i < src->num_buffers; i++)
+			if (src->buffers[i].start)
+				munmap(src->buffers[i].start,
+				       src->buffers[i].length);
+	}
+
+	free(src->file_buf[0]);
+	free(src->file_buf[1]);
+	if (src->fd >= 0)
+		close(src->fd);
+}
+
+/* 1 for a frame, 0 at the end of the stream, TFAIL on error */
+static int source_get(struct stream_source *src, struct stream_frame *frame)
+{
+	struct v4l2_buffer buf;
+	size_t got = 0;
+	ssize_t n;
+
+	if (src->v4l2) {
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		if (ioctl(src->fd, VIDIOC_DQBUF, &buf) < 0) {
+			printf("VIDIOC_DQBUF failed\n");
+			return TFAIL;
+		}
+		frame->data = src->buffers[buf.index].start;
+		frame->index = buf.index;
+	} else {
+		frame->data = src->file_buf[src->file_next];
+		frame->index = -1;
+		src->file_next ^= 1;
+		while (got < src->frame_size) {
+			n = read(src->fd, frame->data + got, src->frame_size - got);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0) {
+				printf("Frame read failed: %s\n", strerror(errno));
+				return TFAIL;
+			}
+			if (n == 0)
+				return 0;
+			got += n;
+		}
+	}
+
+	frame->stride = src->stride;
+	frame->ready = stream_time_ms();
+	return 1;
+}
+
+static void source_put(struct stream_source *src, struct stream_frame *frame)
+{
+	struct v4l2_buffer buf;
+
+	if (!src->v4l2)
+		return;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = frame->index;
+	if (ioctl(src->fd, VIDIOC_QBUF, &buf) < 0)
+		printf("VIDIOC_QBUF failed\n");
+}
+
+static void *stream_worker(void *arg)
+{
+	struct stream_pool *pool = arg;
+	const struct dcic_stream_roi *roi;
+	const struct stream_frame *frame;
+	unsigned int seq = 0;
+	unsigned int bpp_bytes = dcic_crc_bpp_bytes(pool->format);
+	unsigned int n, sig;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->quit && (pool->seq == seq || pool->next >= pool->nroi))
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->quit)
+			break;
+		seq = pool->seq;
+
+		while (pool->next < pool->nroi) {
+			n = pool->order[pool->next++];
+			frame = pool->frame;
+			pthread_mutex_unlock(&pool->lock);
+
+			roi = &pool->roi[n];
+			sig = dcic_crc_rect(0x0, pool->format,
+					frame->data + roi->start_y * frame->stride +
+					roi->start_x * bpp_bytes,
+					frame->stride,
+					roi->end_x - roi->start_x + 1,
+					roi->end_y - roi->start_y + 1);
+
+			pthread_mutex_lock(&pool->lock);
+			pool->sig[n] = sig;
+			if (++pool->finished == pool->nroi)
+				pthread_cond_signal(&pool->done);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static void pool_start(struct stream_pool *pool, const struct stream_frame *frame)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->frame = frame;
+	pool->next = 0;
+	pool->finished = 0;
+	pool->seq++;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void pool_wait(struct stream_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (pool->finished < pool->nroi)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static int stream_setup_rois(struct dcic_stream_params *params,
+			     const struct stream_source *src,
+			     struct stream_pool *pool)
+{
+	struct dcic_stream_roi *roi = params->roi;
+	unsigned long long area[DCIC_STREAM_ROIS];
+	unsigned int i, j, n;
+
+	for (i = 0; i < DCIC_STREAM_ROIS; i++)
+		if (roi[i].enabled)
+			break;
+
+	/* default: a 4x4 grid over the whole frame */
+	if (i == DCIC_STREAM_ROIS) {
+		for (i = 0; i < DCIC_STREAM_ROIS; i++) {
+			roi[i].enabled = 1;
+			roi[i].start_x = (i % 4) * src->xres / 4;
+			roi[i].end_x = (i % 4 + 1) * src->xres / 4 - 1;
+			roi[i].start_y = (i / 4) * src->yres / 4;
+			roi[i].end_y = (i / 4 + 1) * src->yres / 4 - 1;
+		}
+	}
+
+	for (i = 0, n = 0; i < DCIC_STREAM_ROIS; i++) {
+		if (!roi[i].enabled)
+			continue;
+		if (roi[i].start_x > roi[i].end_x || roi[i].start_y > roi[i].end_y ||
+		    roi[i].end_x >= src->xres || roi[i].end_y >= src->yres) {
+			printf("ROI%u (%u,%u)-(%u,%u) is outside the %ux%u frame\n",
+				i, roi[i].start_x, roi[i].start_y,
+				roi[i].end_x, roi[i].end_y, src->xres, src->yres);
+			return TFAIL;
+		}
+		area[i] = (unsigned long long)(roi[i].end_x - roi[i].start_x + 1) *
+			  (roi[i].end_y - roi[i].start_y + 1);
+
+		/* insertion by area, so a big ROI does not start last */
+		for (j = n++; j > 0 && area[pool->order[j - 1]] < area[i]; j--)
+			pool->order[j] = pool->order[j - 1];
+		pool->order[j] = i;
+	}
+
+	pool->roi = roi;
+	pool->nroi = n;
+	return TPASS;
+}
+
+static int latency_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void stream_report(double *latency, unsigned int frames,
+			  double budget, double elapsed)
+{
+	double sum = 0;
+	unsigned int over = 0;
+	unsigned int i, rank;
+
+	if (frames == 0) {
+		printf("No frames\n");
+		return;
+	}
+
+	for (i = 0; i < frames; i++) {
+		sum += latency[i];
+		if (latency[i] > budget)
+			over++;
+	}
+	qsort(latency, frames, sizeof(*latency), latency_cmp);
+	/* nearest rank p99 */
+	rank = (frames * 99 + 99) / 100;
+
+	printf("%u frames in %.1f ms, %.1f fps\n",
+		frames, elapsed, frames * 1000.0 / elapsed);
+	printf("latency ms: min %.3f avg %.3f p99 %.3f max %.3f, budget %.3f\n",
+		latency[0], sum / frames, latency[rank - 1],
+		latency[frames - 1], budget);
+	printf("%u frames over budget\n", over);
+}
+
+int dcic_stream_run(struct dcic_stream_params *params)
+{
+	struct stream_source src;
+	struct stream_pool pool;
+	struct stream_frame frame[2];
+	pthread_t *threads = NULL;
+	FILE *log = NULL, *lat = NULL;
+	double *latency = NULL, *tmp;
+	enum dcic_crc_engine engine;
+	double budget, start, done;
+	unsigned int nthreads = 0, frames = 0, latency_size = 0;
+	unsigned int cur = 0, i, n;
+	int have, retval = TFAIL;
+
+	memset(&pool, 0, sizeof(pool));
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.work, NULL);
+	pthread_cond_init(&pool.done, NULL);
+
+	if (params->bpp == 16)
+		pool.format = params->bus_width == 18 ? DCIC_CRC_18OF16 : DCIC_CRC_24OF16;
+	else
+		pool.format = params->bus_width == 18 ? DCIC_CRC_18OF24 : DCIC_CRC_24;
+	budget = 1000.0 / (params->fps ? params->fps : 60);
+
+	engine = dcic_crc_init();
+
+	if (source_open(&src, params) < 0)
+		goto out;
+	if (stream_setup_rois(params, &src, &pool) < 0)
+		goto out;
+
+	if (params->log) {
+		log = fopen(params->log, "w");
+		if (log == NULL) {
+			printf("Unable to create %s\n", params->log);
+			goto out;
+		}
+		fprintf(log, "# %ux%u %s\n", src.xres, src.yres,
+			dcic_crc_format_name(pool.format));
+		for (i = 0; i < DCIC_STREAM_ROIS; i++)
+			if (params->roi[i].enabled)
+				fprintf(log, "# roi %u (%u,%u)-(%u,%u)\n", i,
+					params->roi[i].start_x, params->roi[i].start_y,
+					params->roi[i].end_x, params->roi[i].end_y);
+		fprintf(log, "# frame roi signature\n");
+	}
+	if (params->latency) {
+		lat = fopen(params->latency, "w");
+		if (lat == NULL) {
+			printf("Unable to create %s\n", params->latency);
+			goto out;
+		}
+		fprintf(lat, "# frame latency_ms ok|over\n");
+	}
+
+	n = params->threads ? params->threads : 1;
+	threads = calloc(n, sizeof(*threads));
+	if (threads == NULL)
+		goto out;
+	for (nthreads = 0; nthreads < n; nthreads++)
+		if (pthread_create(&threads[nthreads], NULL, stream_worker, &pool)) {
+			printf("Unable to create worker thread\n");
+			goto out;
+		}
+
+	printf("%ux%u %s, %u ROIs, %u threads, %.3f ms budget, engine %s\n",
+		src.xres, src.yres, dcic_crc_format_name(pool.format), pool.nroi,
+		nthreads, budget, dcic_crc_engine_name(engine));
+
+	start = stream_time_ms();
+	have = source_get(&src, &frame[cur]);
+	while (have > 0) {
+		pool_start(&pool, &frame[cur]);
+
+		/* fetch the next frame while the workers run */
+		have = 0;
+		if (!params->count || frames + 1 < params->count)
+			have = source_get(&src, &frame[cur ^ 1]);
+
+		pool_wait(&pool);
+		done = stream_time_ms();
+
+		if (frames == latency_size) {
+			latency_size = latency_size ? latency_size * 2 : 1024;
+			tmp = realloc(latency, latency_size * sizeof(*latency));
+			if (tmp == NULL)
+				goto out;
+			latency = tmp;
+		}
+		latency[frames] = done - frame[cur].ready;
+
+		if (log)
+			for (i = 0; i < DCIC_STREAM_ROIS; i++)
+				if (params->roi[i].enabled)
+					fprintf(log, "%u %u 0x%08x\n", frames, i, pool.sig[i]);
+		if (lat)
+			fprintf(lat, "%u %.3f %s\n", frames, latency[frames],
+				latency[frames] > budget ? "over" : "ok");
+
+		source_put(&src, &frame[cur]);
+		frames++;
+		cur ^= 1;
+	}
+
+	if (have == 0) {
+		stream_report(latency, frames, budget, stream_time_ms() - start);
+		retval = TPASS;
+	}
+
+out:
+	pthread_mutex_lock(&pool.lock);
+	pool.quit = 1;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	free(latency);
+	if (log)
+		fclose(log);
+	if (lat)
+		fclose(lat);
+	source_close(&src);
+	return retval;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2014-2015 Freescale Semiconductor, Inc. All rights reserved.
+ */
+
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+/*
+ * @file dcic_stream.h
+ *
+ * @brief Per frame DCIC reference signatures for a stream of frames
+ *
+ */
+
+#ifndef DCIC_STREAM_H
+#define DCIC_STREAM_H
+
+/* ROIs of one DCIC instance */
+#define DCIC_STREAM_ROIS	16
+
+struct dcic_stream_roi {
+	int enabled;
+	unsigned int start_x;
+	unsigned int start_y;
+	unsigned int end_x;
+	unsigned int end_y;
+};
+
+struct dcic_stream_params {
+	/* raw RGB frame file, or a V4L2 capture device such as vivid */
+	const char *source;
+	unsigned int xres;
+	unsigned int yres;
+	unsigned int bpp;		/* 16 or 32 */
+	unsigned int bus_width;		/* 18 or 24 */
+
+	/* none enabled: a 4x4 grid over the frame */
+	struct dcic_stream_roi roi[DCIC_STREAM_ROIS];
+
+	unsigned int threads;
+	unsigned int fps;		/* latency budget is one frame period */
+	unsigned int count;		/* 0: until the end of the source */
+
+	const char *log;		/* expected signatures, one per ROI */
+	const char *latency;		/* per frame latency */
+};
+
+int dcic_stream_run(struct dcic_stream_params *params);
+
+#endif
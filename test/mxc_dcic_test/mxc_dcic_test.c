@@ -40,6 +40,10 @@ extern "C"{
 #include <math.h>
 #include <string.h>
 #include <malloc.h>
+#include <time.h>
+
+#include "dcic_crc.h"
+#include "dcic_stream.h"
 
 #define TFAIL -1
 #define TPASS 0
@@ -59,6 +63,13 @@ static unsigned int g_start_x_offset=100;
 static unsigned int g_start_y_offset=100;
 static unsigned int g_end_x_offset=200;
 static unsigned int g_end_y_offset=200;
+static unsigned int g_bench_frames = 0;
+static struct dcic_stream_params g_stream = {
+	.xres = 1920,
+	.yres = 1080,
+	.bpp = 32,
+	.fps = 60,
+};
 
 unsigned int crc32_calc_single_24bit(unsigned int crc_in, unsigned int data_in)
 {
@@ -289,19 +300,19 @@ void roi_fb_init(unsigned char *fb,
 	if (var->bits_per_pixel == 16) {
 		/* lcdif bpp 16 to bus width 24 */
 		if (g_disp_bus_width == 24)
-			roi->ref_sig = crc32_calc_24of16bit(0x0, (unsigned short *)pbuf, buf_size/sizeof(short));
+			roi->ref_sig = dcic_crc_pixels(0x0, DCIC_CRC_24OF16, pbuf, buf_size/sizeof(short));
 
 		/* lcdif bpp=16, lvds bus width 18 */
 		if (g_disp_bus_width == 18)
-			roi->ref_sig = crc32_calc_18of16bit(0x0, (unsigned short *)pbuf, buf_size/sizeof(short));
+			roi->ref_sig = dcic_crc_pixels(0x0, DCIC_CRC_18OF16, pbuf, buf_size/sizeof(short));
 	} else {
 		/* lcdif bpp 24 to bus width 24 */
 		if (g_disp_bus_width == 24)
-			roi->ref_sig = crc32_calc_24bit(0x0, (unsigned int *)pbuf, buf_size/sizeof(int));
+			roi->ref_sig = dcic_crc_pixels(0x0, DCIC_CRC_24, pbuf, buf_size/sizeof(int));
 
 		/* lcdif bpp=24 lvds bus width 18  */
 		if (g_disp_bus_width == 18)
-			roi->ref_sig = crc32_calc_18of24bit(0x0, (unsigned int *)pbuf, buf_size/sizeof(int));
+			roi->ref_sig = dcic_crc_pixels(0x0, DCIC_CRC_18OF24, pbuf, buf_size/sizeof(int));
 	}
 
 	line_len = (roi->end_x - roi->start_x + 1) * bpp_bytes;
@@ -375,6 +386,145 @@ void roi_config(unsigned char *fb ,struct fb_var_screeninfo *fb_info)
 	return;
 }
 
+/* reference signature of a ROI inside a frame, one row at a time */
+static unsigned int crc_ref_rect(enum dcic_crc_format format, unsigned int crc,
+		unsigned char *base, unsigned int stride,
+		unsigned int width, unsigned int height)
+{
+	unsigned int y;
+
+	for (y = 0; y < height; y++, base += stride) {
+		switch (format) {
+		case DCIC_CRC_24:
+			crc = crc32_calc_24bit(crc, (unsigned int *)base, width);
+			break;
+		case DCIC_CRC_18OF24:
+			crc = crc32_calc_18of24bit(crc, (unsigned int *)base, width);
+			break;
+		case DCIC_CRC_24OF16:
+			crc = crc32_calc_24of16bit(crc, (unsigned short *)base, width);
+			break;
+		default:
+			crc = crc32_calc_18of16bit(crc, (unsigned short *)base, width);
+			break;
+		}
+	}
+
+	return crc;
+}
+
+static double time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+ * Check every CRC engine bit-exact against crc32_calc_* on a synthetic
+ * frame, then time it over the ROI given with -sx/-sy/-ex/-ey. Needs no
+ * frame buffer or DCIC device.
+ */
+int crc_benchmark(void)
+{
+	unsigned int xres, yres, width, height, stride, bpp_bytes;
+	unsigned int ref, crc, init, len, i, n;
+	unsigned char *frame, *roi;
+	enum dcic_crc_format format;
+	enum dcic_crc_engine best, engine;
+	double start, ms, ref_ms;
+	int retval = TPASS;
+
+	if (g_end_x_offset < g_start_x_offset || g_end_y_offset < g_start_y_offset) {
+		printf("Invalid ROI\n");
+		return TFAIL;
+	}
+
+	xres = g_end_x_offset + 1 > 1920 ? g_end_x_offset + 1 : 1920;
+	yres = g_end_y_offset + 1 > 1080 ? g_end_y_offset + 1 : 1080;
+	width = g_end_x_offset - g_start_x_offset + 1;
+	height = g_end_y_offset - g_start_y_offset + 1;
+
+	frame = malloc(xres * yres * 4);
+	if (frame == NULL) {
+		printf("Unable to allocate %ux%u frame\n", xres, yres);
+		return TFAIL;
+	}
+
+	srand(1);
+	for (i = 0; i < xres * yres * 4; i++)
+		frame[i] = rand();
+
+	best = dcic_crc_init();
+	printf("frame %ux%u, ROI (%u,%u)-(%u,%u), %u frames, default engine %s\n",
+		xres, yres, g_start_x_offset, g_start_y_offset,
+		g_end_x_offset, g_end_y_offset, g_bench_frames,
+		dcic_crc_engine_name(best));
+	printf("%-10s %-11s %10s %10s %8s\n",
+		"format", "engine", "MB/s", "ms/ROI", "speedup");
+
+	for (format = 0; format < DCIC_CRC_FORMATS; format++) {
+		bpp_bytes = dcic_crc_bpp_bytes(format);
+		stride = xres * bpp_bytes;
+		roi = frame + g_start_y_offset * stride + g_start_x_offset * bpp_bytes;
+
+		start = time_ms();
+		ref = crc_ref_rect(format, 0x0, roi, stride, width, height);
+		ref_ms = time_ms() - start;
+		printf("%-10s %-11s %10.1f %10.3f %8s\n",
+			dcic_crc_format_name(format), "reference",
+			width * height * bpp_bytes / ref_ms / 1000.0, ref_ms, "1.0");
+
+		for (engine = 0; engine < DCIC_CRC_ENGINES; engine++) {
+			if (dcic_crc_set_engine(engine) < 0)
+				continue;
+
+			crc = dcic_crc_rect(0x0, format, roi, stride, width, height);
+			if (crc != ref) {
+				printf("%s %s: signature 0x%08x, expected 0x%08x\n",
+					dcic_crc_format_name(format),
+					dcic_crc_engine_name(engine), crc, ref);
+				retval = TFAIL;
+				continue;
+			}
+
+			/* short and unaligned runs with a non zero seed */
+			for (n = 0; n < 2000; n++) {
+				len = rand() % 300 + 1;
+				init = rand() ^ (rand() << 16);
+				i = rand() % (xres * yres - len);
+				crc = dcic_crc_pixels(init, format, frame + i * bpp_bytes, len);
+				if (crc != crc_ref_rect(format, init, frame + i * bpp_bytes,
+							len * bpp_bytes, len, 1)) {
+					printf("%s %s: mismatch on %u pixels at %u\n",
+						dcic_crc_format_name(format),
+						dcic_crc_engine_name(engine), len, i);
+					retval = TFAIL;
+					break;
+				}
+			}
+
+			start = time_ms();
+			for (n = 0; n < g_bench_frames; n++)
+				crc = dcic_crc_rect(0x0, format, roi, stride, width, height);
+			ms = (time_ms() - start) / g_bench_frames;
+			printf("%-10s %-11s %10.1f %10.3f %8.1f\n",
+				dcic_crc_format_name(format),
+				dcic_crc_engine_name(engine),
+				width * height * bpp_bytes / ms / 1000.0, ms, ref_ms / ms);
+		}
+	}
+
+	dcic_crc_set_engine(best);
+	free(frame);
+
+	if (retval == TPASS)
+		printf("All CRC engines match the reference\n");
+
+	return retval;
+}
+
 void print_help(void)
 {
 	printf("DCIC Device Test\n"
@@ -385,6 +535,15 @@ void print_help(void)
 		" -sy <crc check start y offset>\n"
 		" -ex <crc check end x offset>\n"
 		" -ey <crc check end y offset>\n"
+		" -bench <frames: verify and time the sw CRC engines over the ROI>\n"
+		"\nReference signatures for a stream of frames:\n"
+		" -stream <raw RGB frame file or V4L2 capture device>\n"
+		" -xres <frame width> -yres <frame height> -bpp <16 or 32>\n"
+		" -roi <n,sx,sy,ex,ey: DCIC ROI 0~15, repeatable; default 4x4 grid>\n"
+		" -threads <worker threads, default one per cpu>\n"
+		" -fps <frame rate for the latency budget, default 60>\n"
+		" -count <frames, default all>\n"
+		" -log <per frame signature log> -latency <per frame latency log>\n"
 	);
 }
 
@@ -412,6 +571,40 @@ int process_cmdline(int argc, char **argv)
 			g_end_x_offset = atoi(argv[++i]);
 		} else if (strcmp(argv[i], "-ey") == 0) {
 			g_end_y_offset = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-bench") == 0) {
+			g_bench_frames = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-stream") == 0) {
+			g_stream.source = argv[++i];
+		} else if (strcmp(argv[i], "-xres") == 0) {
+			g_stream.xres = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-yres") == 0) {
+			g_stream.yres = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-bpp") == 0) {
+			g_stream.bpp = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-roi") == 0) {
+			unsigned int n, sx, sy, ex, ey;
+
+			if (++i >= argc || sscanf(argv[i], "%u,%u,%u,%u,%u",
+					&n, &sx, &sy, &ex, &ey) != 5 ||
+			    n >= DCIC_STREAM_ROIS) {
+				print_help();
+				return -1;
+			}
+			g_stream.roi[n].enabled = 1;
+			g_stream.roi[n].start_x = sx;
+			g_stream.roi[n].start_y = sy;
+			g_stream.roi[n].end_x = ex;
+			g_stream.roi[n].end_y = ey;
+		} else if (strcmp(argv[i], "-threads") == 0) {
+			g_stream.threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-fps") == 0) {
+			g_stream.fps = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-count") == 0) {
+			g_stream.count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-log") == 0) {
+			g_stream.log = argv[++i];
+		} else if (strcmp(argv[i], "-latency") == 0) {
+			g_stream.latency = argv[++i];
 		} else if (strcmp(argv[i], "-help") == 0) {
 			print_help();
 			return -1;
@@ -435,6 +628,18 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
+	if (g_bench_frames > 0)
+		return crc_benchmark();
+
+	if (g_stream.source) {
+		g_stream.bus_width = g_disp_bus_width;
+		if (g_stream.threads == 0)
+			g_stream.threads = sysconf(_SC_NPROCESSORS_ONLN);
+		return dcic_stream_run(&g_stream);
+	}
+
+	dcic_crc_init();
+
 	if ((fd_fb0 = open("/dev/fb0", O_RDWR, 0)) < 0) {
 		printf("Unable to open /dev/fb0\n");
 		retval = TFAIL;
@@ -0,0 +1,472 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file epdc_dither.c
+ *
+ * @brief CPU dithering of Y8 content to fewer grey levels
+ *
+ * Ordered dithering uses an 8x8 Bayer matrix: with L levels a pixel maps
+ * to level floor((v * (L - 1) + t) / 255) where t is the matrix threshold
+ * scaled to 1..253.  The division is done as (x + 1 + (x >> 8)) >> 8,
+ * exact for x < 65535, so the scalar and vector kernels agree bit for bit.
+ *
+ * Error diffusion works on rows.  Errors are kept in sixteenths of a Y8
+ * code: to the right in one or two carried values, downwards in a small
+ * ring of per row accumulators.  Row y can process column x once row y - 1
+ * has finished column x + 1, so threads take rows in order from a shared
+ * counter and each follows the row above it in blocks of columns, the
+ * usual wavefront.  All arithmetic is integer, so the order in which
+ * contributions land does not change the result.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define DITHER_SIMD	"sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DITHER_SIMD	"neon"
+#endif
+
+#include "epdc_dither.h"
+
+#define MAX_THREADS	16
+/* Columns a row publishes at a time to the row below it */
+#define WAVE_BLOCK	64
+/* Error buffers have room for x - 1 and x + 1 writes at the edges */
+#define ERR_PAD		2
+/* Progress counters one cache line apart */
+#define PROGRESS_STRIDE	16
+
+static const unsigned char bayer8[8][8] = {
+	{  0, 32,  8, 40,  2, 34, 10, 42 },
+	{ 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44,  4, 36, 14, 46,  6, 38 },
+	{ 60, 28, 52, 20, 62, 30, 54, 22 },
+	{  3, 35, 11, 43,  1, 33,  9, 41 },
+	{ 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47,  7, 39, 13, 45,  5, 37 },
+	{ 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+static const char *mode_names[EPDC_DITHER_NUM_MODES] = {
+	"passthrough",
+	"floyd-steinberg",
+	"atkinson",
+	"ordered",
+	"quantize",
+	"sierra-lite",
+};
+
+static int use_simd = 1;
+
+struct dither_job {
+	int mode;
+	int bits;
+	const unsigned char *src;
+	int src_stride;
+	unsigned char *dst;
+	int dst_stride;
+	int width;
+	int height;
+	int next_row;
+	/* level index and expanded level for every input value */
+	unsigned char nearest[256];
+	unsigned char expand[128];
+	/* error diffusion */
+	short *err;
+	int err_stride;
+	int ring;
+	int *progress;
+};
+
+const char *epdc_dither_name(int mode)
+{
+	if (mode < 0 || mode >= EPDC_DITHER_NUM_MODES)
+		return "unknown";
+	return mode_names[mode];
+}
+
+const char *epdc_dither_simd(void)
+{
+#ifdef DITHER_SIMD
+	return use_simd ? DITHER_SIMD : NULL;
+#else
+	return NULL;
+#endif
+}
+
+void epdc_dither_set_simd(int enable)
+{
+	use_simd = enable;
+}
+
+/* Level index q of 2^bits levels replicated into eight bits */
+static unsigned char expand_level(int q, int bits)
+{
+	int v = 0, shift;
+
+	for (shift = 8 - bits; shift > -bits; shift -= bits)
+		v |= shift >= 0 ? q << shift : q >> -shift;
+	return v;
+}
+
+static void init_tables(struct dither_job *job)
+{
+	int levels = 1 << job->bits;
+	int v, q;
+
+	for (q = 0; q < levels; q++)
+		job->expand[q] = expand_level(q, job->bits);
+	for (v = 0; v < 256; v++)
+		job->nearest[v] = job->expand[(v * (levels - 1) + 127) / 255];
+}
+
+/* Per row thresholds for ordered dithering, one per column mod 8 */
+static void bayer_row(int y, unsigned short *thr)
+{
+	int x;
+
+	for (x = 0; x < 8; x++)
+		thr[x] = (2 * bayer8[y & 7][x] + 1) * 255 / 128;
+}
+
+static void ordered_row_c(const struct dither_job *job, int y,
+			  const unsigned char *src, unsigned char *dst, int x)
+{
+	unsigned short thr[8];
+	int mul = (1 << job->bits) - 1;
+	unsigned int t;
+
+	bayer_row(y, thr);
+	for (; x < job->width; x++) {
+		t = src[x] * mul + thr[x & 7];
+		dst[x] = job->expand[(t + 1 + (t >> 8)) >> 8];
+	}
+}
+
+#if defined(__SSE2__)
+/* Only for 1, 2 and 4 bits, where the expansion is a multiplication */
+static int ordered_row_simd(const struct dither_job *job, int y,
+			    const unsigned char *src, unsigned char *dst)
+{
+	unsigned short thr[8];
+	__m128i zero = _mm_setzero_si128();
+	__m128i one = _mm_set1_epi16(1);
+	__m128i mul = _mm_set1_epi16((1 << job->bits) - 1);
+	__m128i rep = _mm_set1_epi16(255 / ((1 << job->bits) - 1));
+	__m128i vthr, v, lo, hi;
+	int x;
+
+	bayer_row(y, thr);
+	vthr = _mm_loadu_si128((const __m128i *)thr);
+
+	for (x = 0; x + 16 <= job->width; x += 16) {
+		v = _mm_loadu_si128((const __m128i *)(src + x));
+		lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero),
+				mul), vthr);
+		hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero),
+				mul), vthr);
+		lo = _mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8));
+		hi = _mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8));
+		lo = _mm_mullo_epi16(_mm_srli_epi16(lo, 8), rep);
+		hi = _mm_mullo_epi16(_mm_srli_epi16(hi, 8), rep);
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+
+	return x;
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+static int ordered_row_simd(const struct dither_job *job, int y,
+			    const unsigned char *src, unsigned char *dst)
+{
+	unsigned short thr[8];
+	uint16_t mul = (1 << job->bits) - 1;
+	uint16_t rep = 255 / mul;
+	uint16x8_t vthr, one = vdupq_n_u16(1), lo, hi;
+	uint8x16_t v;
+	int x;
+
+	bayer_row(y, thr);
+	vthr = vld1q_u16(thr);
+
+	for (x = 0; x + 16 <= job->width; x += 16) {
+		v = vld1q_u8(src + x);
+		lo = vmlaq_n_u16(vthr, vmovl_u8(vget_low_u8(v)), mul);
+		hi = vmlaq_n_u16(vthr, vmovl_u8(vget_high_u8(v)), mul);
+		lo = vaddq_u16(vaddq_u16(lo, one), vshrq_n_u16(lo, 8));
+		hi = vaddq_u16(vaddq_u16(hi, one), vshrq_n_u16(hi, 8));
+		lo = vmulq_n_u16(vshrq_n_u16(lo, 8), rep);
+		hi = vmulq_n_u16(vshrq_n_u16(hi, 8), rep);
+		vst1q_u8(dst + x, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+	}
+
+	return x;
+}
+#endif
+
+static void ordered_row(const struct dither_job *job, int y)
+{
+	const unsigned char *src = job->src + y * job->src_stride;
+	unsigned char *dst = job->dst + y * job->dst_stride;
+	int x = 0;
+
+#ifdef DITHER_SIMD
+	if (use_simd && (job->bits == 1 || job->bits == 2 || job->bits == 4))
+		x = ordered_row_simd(job, y, src, dst);
+#endif
+	ordered_row_c(job, y, src, dst, x);
+}
+
+static void simple_row(const struct dither_job *job, int y)
+{
+	const unsigned char *src = job->src + y * job->src_stride;
+	unsigned char *dst = job->dst + y * job->dst_stride;
+	int x;
+
+	if (job->mode == EPDC_DITHER_PASSTHROUGH) {
+		if (dst != src)
+			memcpy(dst, src, job->width);
+		return;
+	}
+
+	for (x = 0; x < job->width; x++)
+		dst[x] = job->nearest[src[x]];
+}
+
+static short *err_row(const struct dither_job *job, int y)
+{
+	return job->err + (y % job->ring) * job->err_stride + ERR_PAD;
+}
+
+/*
+ * Columns [x0, x1) of one row.  c1 and c2 carry the error headed for the
+ * next two columns between calls.  The mode is a constant in each caller,
+ * so the compiler drops the switch out of the loop.
+ */
+static inline __attribute__((always_inline))
+void diffuse_span(const struct dither_job *job, int mode, int y, int x0,
+		  int x1, int *c1, int *c2)
+{
+	const unsigned char *src = job->src + y * job->src_stride;
+	unsigned char *dst = job->dst + y * job->dst_stride;
+	short *cur = err_row(job, y);
+	short *n1 = err_row(job, y + 1);
+	short *n2 = err_row(job, y + 2);
+	int x, acc, val, out, e;
+
+	for (x = x0; x < x1; x++) {
+		acc = cur[x] + *c1;
+		cur[x] = 0;
+		*c1 = *c2;
+		*c2 = 0;
+
+		val = src[x] + ((acc + 8) >> 4);
+		if (val < 0)
+			val = 0;
+		else if (val > 255)
+			val = 255;
+		out = job->nearest[val];
+		dst[x] = out;
+		e = val - out;
+
+		switch (mode) {
+		case EPDC_DITHER_FLOYD_STEINBERG:
+			*c1 += 7 * e;
+			n1[x - 1] += 3 * e;
+			n1[x] += 5 * e;
+			n1[x + 1] += e;
+			break;
+		case EPDC_DITHER_ATKINSON:
+			*c1 += 2 * e;
+			*c2 += 2 * e;
+			n1[x - 1] += 2 * e;
+			n1[x] += 2 * e;
+			n1[x + 1] += 2 * e;
+			n2[x] += 2 * e;
+			break;
+		case EPDC_DITHER_SIERRA_LITE:
+			*c1 += 8 * e;
+			n1[x - 1] += 4 * e;
+			n1[x] += 4 * e;
+			break;
+		}
+	}
+}
+
+static void diffuse_span_fs(const struct dither_job *job, int y, int x0,
+			    int x1, int *c1, int *c2)
+{
+	diffuse_span(job, EPDC_DITHER_FLOYD_STEINBERG, y, x0, x1, c1, c2);
+}
+
+static void diffuse_span_atkinson(const struct dither_job *job, int y,
+				  int x0, int x1, int *c1, int *c2)
+{
+	diffuse_span(job, EPDC_DITHER_ATKINSON, y, x0, x1, c1, c2);
+}
+
+static void diffuse_span_sierra(const struct dither_job *job, int y, int x0,
+				int x1, int *c1, int *c2)
+{
+	diffuse_span(job, EPDC_DITHER_SIERRA_LITE, y, x0, x1, c1, c2);
+}
+
+static void wait_progress(int *progress, int need)
+{
+	int spins = 0;
+
+	while (__atomic_load_n(progress, __ATOMIC_ACQUIRE) < need)
+		if (++spins > 64)
+			sched_yield();
+}
+
+static int take_row(struct dither_job *job)
+{
+	return __atomic_fetch_add(&job->next_row, 1, __ATOMIC_RELAXED);
+}
+
+static void diffuse_rows(struct dither_job *job)
+{
+	void (*span)(const struct dither_job *, int, int, int, int *, int *);
+	int *above, *mine;
+	int y, x0, x1, need, c1, c2;
+
+	if (job->mode == EPDC_DITHER_FLOYD_STEINBERG)
+		span = diffuse_span_fs;
+	else if (job->mode == EPDC_DITHER_ATKINSON)
+		span = diffuse_span_atkinson;
+	else
+		span = diffuse_span_sierra;
+
+	while ((y = take_row(job)) < job->height) {
+		mine = job->progress + y * PROGRESS_STRIDE;
+		above = y ? mine - PROGRESS_STRIDE : NULL;
+		c1 = c2 = 0;
+
+		for (x0 = 0; x0 < job->width; x0 = x1) {
+			x1 = x0 + WAVE_BLOCK;
+			if (x1 > job->width)
+				x1 = job->width;
+			if (above) {
+				need = x1 + 2 < job->width ? x1 + 2 : job->width;
+				wait_progress(above, need);
+			}
+			span(job, y, x0, x1, &c1, &c2);
+			__atomic_store_n(mine, x1, __ATOMIC_RELEASE);
+		}
+	}
+}
+
+static void run_rows(struct dither_job *job)
+{
+	int y;
+
+	switch (job->mode) {
+	case EPDC_DITHER_FLOYD_STEINBERG:
+	case EPDC_DITHER_ATKINSON:
+	case EPDC_DITHER_SIERRA_LITE:
+		diffuse_rows(job);
+		break;
+	case EPDC_DITHER_ORDERED:
+		while ((y = take_row(job)) < job->height)
+			ordered_row(job, y);
+		break;
+	default:
+		while ((y = take_row(job)) < job->height)
+			simple_row(job, y);
+		break;
+	}
+}
+
+static void *dither_thread(void *arg)
+{
+	run_rows(arg);
+	return NULL;
+}
+
+int epdc_dither(int mode, int bits, const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride, int width, int height,
+		int threads)
+{
+	pthread_t tid[MAX_THREADS];
+	struct dither_job *job;
+	int i, started, diffuse, ret = 0;
+
+	if (mode < 0 || mode >= EPDC_DITHER_NUM_MODES || bits < 1 || bits > 7)
+		return -EINVAL;
+	if (width <= 0 || height <= 0 || src_stride < width ||
+	    dst_stride < width)
+		return -EINVAL;
+	if (threads < 1)
+		threads = 1;
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+	if (threads > height)
+		threads = height;
+
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return -ENOMEM;
+	job->mode = mode;
+	job->bits = bits;
+	job->src = src;
+	job->src_stride = src_stride;
+	job->dst = dst;
+	job->dst_stride = dst_stride;
+	job->width = width;
+	job->height = height;
+	init_tables(job);
+
+	diffuse = mode == EPDC_DITHER_FLOYD_STEINBERG ||
+		  mode == EPDC_DITHER_ATKINSON ||
+		  mode == EPDC_DITHER_SIERRA_LITE;
+	if (diffuse) {
+		/*
+		 * Rows finish in order, and a thread takes a new row only
+		 * after finishing its last one, so when row y starts every
+		 * row above y - threads is done and threads + 3 accumulators
+		 * are never in use twice over.
+		 */
+		job->ring = threads + 3;
+		job->err_stride = width + 2 * ERR_PAD;
+		job->err = calloc(job->ring * job->err_stride, sizeof(short));
+		job->progress = calloc(height * PROGRESS_STRIDE, sizeof(int));
+		if (!job->err || !job->progress) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	/* Fewer threads than asked for only makes it slower */
+	for (started = 1; started < threads; started++)
+		if (pthread_create(&tid[started], NULL, dither_thread, job))
+			break;
+	run_rows(job);
+	for (i = 1; i < started; i++)
+		pthread_join(tid[i], NULL);
+
+out:
+	free(job->err);
+	free(job->progress);
+	free(job);
+	return ret;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file epdc_dither.h
+ *
+ * @brief CPU dithering of Y8 content to fewer grey levels
+ *
+ * Reference for the EPDC hardware dithering (mxc_epdc_v2_fb_test -d/-q),
+ * and a way to pre-dither pages when the PxP is busy.  Output stays Y8:
+ * each pixel is one of 2^bits levels, with the level index replicated into
+ * all eight bits (for Y4, 0x00, 0x11, ... 0xff), which is what an 8bpp
+ * grayscale EPDC framebuffer takes.
+ */
+
+#ifndef EPDC_DITHER_H
+#define EPDC_DITHER_H
+
+/* Numbered like the hardware dither_mode, Sierra Lite is CPU only */
+enum epdc_dither_mode {
+	EPDC_DITHER_PASSTHROUGH = 0,
+	EPDC_DITHER_FLOYD_STEINBERG = 1,
+	EPDC_DITHER_ATKINSON = 2,
+	EPDC_DITHER_ORDERED = 3,
+	EPDC_DITHER_QUANT_ONLY = 4,
+	EPDC_DITHER_SIERRA_LITE = 5,
+	EPDC_DITHER_NUM_MODES
+};
+
+/*
+ * Dither width x height Y8 pixels from src to dst, keeping `bits` bits of
+ * grey (1 to 7).  src and dst may be the same buffer.  Error diffusion runs
+ * as a wavefront over `threads` threads, the other modes split the image
+ * in bands; the result is the same for any thread count.
+ * Returns 0 or a negative errno value.
+ */
+int epdc_dither(int mode, int bits, const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride, int width, int height,
+		int threads);
+
+const char *epdc_dither_name(int mode);
+
+/* Name of the vector unit used by the ordered kernel, NULL if none */
+const char *epdc_dither_simd(void);
+/* Force the scalar ordered kernel (0) or allow the vector one (1) */
+void epdc_dither_set_simd(int enable);
+
+#endif
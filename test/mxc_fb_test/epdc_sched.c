@@ -0,0 +1,327 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file epdc_sched.c
+ *
+ * @brief User space EPDC update scheduler
+ *
+ * Pending regions are kept in damage order.  Two pending regions only swap
+ * places on the way to the panel when they do not overlap, so the last
+ * update to touch a pixel is always the one the caller issued last.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "epdc_sched.h"
+
+static int rect_intersects(const struct epdc_rect *a, const struct epdc_rect *b)
+{
+	return a->left < b->left + b->width && b->left < a->left + a->width &&
+	       a->top < b->top + b->height && b->top < a->top + a->height;
+}
+
+/* Overlapping, touching or within gap pixels of each other */
+static int rect_near(const struct epdc_rect *a, const struct epdc_rect *b,
+		     int gap)
+{
+	return a->left <= b->left + b->width + gap &&
+	       b->left <= a->left + a->width + gap &&
+	       a->top <= b->top + b->height + gap &&
+	       b->top <= a->top + a->height + gap;
+}
+
+static void rect_union(struct epdc_rect *d, const struct epdc_rect *a,
+		       const struct epdc_rect *b)
+{
+	int right = a->left + a->width;
+	int bottom = a->top + a->height;
+
+	if (b->left + b->width > right)
+		right = b->left + b->width;
+	if (b->top + b->height > bottom)
+		bottom = b->top + b->height;
+	d->left = a->left < b->left ? a->left : b->left;
+	d->top = a->top < b->top ? a->top : b->top;
+	d->width = right - d->left;
+	d->height = bottom - d->top;
+}
+
+static long long rect_area(const struct epdc_rect *r)
+{
+	return (long long)r->width * r->height;
+}
+
+static void remove_at(struct epdc_update *a, int *n, int i)
+{
+	memmove(&a[i], &a[i + 1], (*n - i - 1) * sizeof(*a));
+	(*n)--;
+}
+
+void epdc_sched_init(struct epdc_sched *s, const struct epdc_sched_ops *ops,
+		     void *priv, int max_inflight)
+{
+	memset(s, 0, sizeof(*s));
+	s->ops = ops;
+	s->priv = priv;
+	if (max_inflight <= 0 || max_inflight > EPDC_SCHED_MAX_INFLIGHT)
+		max_inflight = EPDC_SCHED_MAX_INFLIGHT;
+	s->max_inflight = max_inflight;
+	s->gap = 8;
+	s->waste = 25;
+}
+
+/*
+ * Whether pending region k can grow to cover r without overtaking a
+ * differently keyed region queued after it that r overlaps.
+ */
+static int can_merge(struct epdc_sched *s, int k, const struct epdc_update *u,
+		     struct epdc_rect *r)
+{
+	struct epdc_update *p = &s->pending[k];
+	long long unused;
+	int j;
+
+	if (p->waveform != u->waveform || p->flags != u->flags)
+		return 0;
+	if (!rect_near(&p->rect, &u->rect, s->gap))
+		return 0;
+
+	rect_union(r, &p->rect, &u->rect);
+	if (!rect_intersects(&p->rect, &u->rect)) {
+		unused = rect_area(r) - rect_area(&p->rect) - rect_area(&u->rect);
+		if (unused * 100 > rect_area(r) * s->waste)
+			return 0;
+	}
+
+	for (j = k + 1; j < s->npending; j++) {
+		if (&s->pending[j] == u)
+			continue;
+		if (s->pending[j].waveform == p->waveform &&
+		    s->pending[j].flags == p->flags)
+			continue;
+		if (rect_intersects(r, &s->pending[j].rect))
+			return 0;
+	}
+
+	return 1;
+}
+
+static void absorb(struct epdc_update *p, const struct epdc_update *u,
+		   const struct epdc_rect *r)
+{
+	p->rect = *r;
+	p->ndamage += u->ndamage;
+	p->t_sum += u->t_sum;
+	if (u->t_first < p->t_first)
+		p->t_first = u->t_first;
+}
+
+static int retire(struct epdc_sched *s, int i)
+{
+	struct epdc_update *u = &s->inflight[i];
+	long long t;
+	int ret;
+
+	ret = s->ops->wait(s->priv, u);
+	s->stats.waits++;
+	if (u->collision)
+		s->stats.collisions++;
+
+	t = s->ops->now(s->priv);
+	s->stats.lat_sum += u->ndamage * t - u->t_sum;
+	if (t - u->t_first > s->stats.lat_max)
+		s->stats.lat_max = t - u->t_first;
+
+	remove_at(s->inflight, &s->ninflight, i);
+	return ret;
+}
+
+/*
+ * Send whatever can go without colliding, in damage order.  Returns 1 when
+ * the backend refused an update and a completion has to be waited for.
+ */
+static int kick(struct epdc_sched *s)
+{
+	struct epdc_update u;
+	int i = 0, j, blocked, ret;
+
+	while (i < s->npending && s->ninflight < s->max_inflight) {
+		blocked = 0;
+		for (j = 0; j < i && !blocked; j++)
+			blocked = rect_intersects(&s->pending[j].rect,
+						  &s->pending[i].rect);
+		for (j = 0; j < s->ninflight && !blocked; j++)
+			blocked = rect_intersects(&s->inflight[j].rect,
+						  &s->pending[i].rect);
+		if (blocked) {
+			i++;
+			continue;
+		}
+
+		u = s->pending[i];
+		if (u.waveform == EPDC_SCHED_WAVEFORM_AUTO && s->ops->classify)
+			u.waveform = s->ops->classify(s->priv, &u.rect);
+		u.collision = 0;
+
+		ret = s->ops->send(s->priv, &u);
+		if (ret == -EBUSY) {
+			s->stats.busy++;
+			return 1;
+		}
+		if (ret < 0)
+			return ret;
+
+		s->stats.sent++;
+		s->stats.pixels += rect_area(&u.rect);
+		s->inflight[s->ninflight++] = u;
+		remove_at(s->pending, &s->npending, i);
+	}
+
+	return 0;
+}
+
+/*
+ * Wait for one in-flight update: the oldest one in the way of the first
+ * pending region if there is one, otherwise simply the oldest.
+ */
+static int step(struct epdc_sched *s)
+{
+	int i;
+
+	if (!s->ninflight)
+		return -EBUSY;
+
+	if (s->npending) {
+		for (i = 0; i < s->ninflight; i++)
+			if (rect_intersects(&s->inflight[i].rect,
+					    &s->pending[0].rect)) {
+				s->stats.held++;
+				return retire(s, i);
+			}
+	}
+
+	return retire(s, 0);
+}
+
+int epdc_sched_damage(struct epdc_sched *s, int left, int top, int width,
+		      int height, int waveform, unsigned int flags)
+{
+	struct epdc_update u;
+	struct epdc_rect r;
+	int k, m, ret;
+
+	if (width <= 0 || height <= 0)
+		return 0;
+
+	memset(&u, 0, sizeof(u));
+	u.rect.left = left;
+	u.rect.top = top;
+	u.rect.width = width;
+	u.rect.height = height;
+	u.waveform = waveform;
+	u.flags = flags;
+	u.ndamage = 1;
+	u.t_first = u.t_sum = s->ops->now(s->priv);
+	s->stats.damage++;
+
+	for (k = 0; k < s->npending; k++)
+		if (can_merge(s, k, &u, &r))
+			break;
+
+	if (k < s->npending) {
+		absorb(&s->pending[k], &u, &r);
+		s->stats.merged++;
+
+		/* The grown region may now reach regions queued after it */
+		for (m = k + 1; m < s->npending; m++) {
+			if (!can_merge(s, k, &s->pending[m], &r))
+				continue;
+			absorb(&s->pending[k], &s->pending[m], &r);
+			remove_at(s->pending, &s->npending, m);
+			s->stats.merged++;
+			m = k;
+		}
+		return 0;
+	}
+
+	while (s->npending == EPDC_SCHED_MAX_PENDING) {
+		ret = kick(s);
+		if (ret < 0)
+			return ret;
+		if (s->npending < EPDC_SCHED_MAX_PENDING)
+			break;
+		ret = step(s);
+		if (ret < 0)
+			return ret;
+	}
+
+	s->pending[s->npending++] = u;
+	return 0;
+}
+
+int epdc_sched_submit(struct epdc_sched *s)
+{
+	int ret = kick(s);
+
+	return ret < 0 ? ret : 0;
+}
+
+int epdc_sched_flush(struct epdc_sched *s)
+{
+	int ret;
+
+	for (;;) {
+		ret = kick(s);
+		if (ret < 0)
+			return ret;
+		if (!s->npending)
+			return 0;
+		ret = step(s);
+		if (ret < 0)
+			return ret;
+	}
+}
+
+int epdc_sched_drain(struct epdc_sched *s)
+{
+	int ret = epdc_sched_flush(s);
+
+	while (s->ninflight) {
+		int r = retire(s, 0);
+
+		if (r < 0 && !ret)
+			ret = r;
+	}
+
+	return ret;
+}
+
+void epdc_sched_print_stats(const struct epdc_sched *s, const char *name)
+{
+	const struct epdc_sched_stats *st = &s->stats;
+
+	printf("%s: %lu rects, %lu merged, %lu updates, %lld Mpixel\n",
+		name, st->damage, st->merged, st->sent, st->pixels / 1000000);
+	printf("%s: %lu busy, %lu held for collisions, %lu waits, "
+		"%lu collisions\n",
+		name, st->busy, st->held, st->waits, st->collisions);
+	if (st->damage)
+		printf("%s: latency avg %lld ms, max %lld ms\n", name,
+			st->lat_sum / (long long)st->damage / 1000,
+			st->lat_max / 1000);
+}
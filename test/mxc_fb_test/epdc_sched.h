@@ -0,0 +1,166 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file epdc_sched.h
+ *
+ * @brief User space EPDC update scheduler
+ *
+ * Dirty rectangles are collected as pending regions, coalesced with
+ * overlapping or adjacent ones, and submitted to a backend while a bounded
+ * set of updates is in flight.  An update that would collide with one still
+ * on the panel is held back until that update completes; the scheduler then
+ * blocks on the completion of that marker rather than sleeping and retrying.
+ *
+ * Two backends exist: the MXCFB ioctl one used by the EPDC fb tests and a
+ * simulator that models LUT occupancy and collision timing on a virtual
+ * clock, so that scheduling policies can be compared on a host.
+ */
+
+#ifndef EPDC_SCHED_H
+#define EPDC_SCHED_H
+
+/* Same value as WAVEFORM_MODE_AUTO in linux/mxcfb.h */
+#define EPDC_SCHED_WAVEFORM_AUTO	257
+
+#define EPDC_SCHED_MAX_PENDING		64
+#define EPDC_SCHED_MAX_INFLIGHT		64
+
+struct epdc_rect {
+	int left;
+	int top;
+	int width;
+	int height;
+};
+
+struct epdc_update {
+	struct epdc_rect rect;
+	int waveform;
+	unsigned int flags;
+	unsigned int marker;		/* assigned by the backend on send */
+	int collision;			/* collision test result on completion */
+	/* damage bookkeeping for latency accounting, in microseconds */
+	int ndamage;
+	long long t_first;
+	long long t_sum;
+};
+
+struct epdc_sched_ops {
+	/*
+	 * Queue one update and assign upd->marker.  Returns -EBUSY when the
+	 * driver has no room for another update, other negative errno values
+	 * on failure.
+	 */
+	int (*send)(void *priv, struct epdc_update *upd);
+	/* Block until the update carrying upd->marker has completed */
+	int (*wait)(void *priv, struct epdc_update *upd);
+	/* Current time in microseconds */
+	long long (*now)(void *priv);
+	/* Optional: waveform for a region submitted with the auto waveform */
+	int (*classify)(void *priv, const struct epdc_rect *r);
+};
+
+struct epdc_sched_stats {
+	unsigned long damage;		/* rectangles handed to the scheduler */
+	unsigned long merged;		/* of those, coalesced into another */
+	unsigned long sent;		/* updates submitted */
+	unsigned long busy;		/* submissions refused by the backend */
+	unsigned long held;		/* times an update waited on a collision */
+	unsigned long waits;		/* completions waited for */
+	unsigned long collisions;	/* non-zero collision test results */
+	long long pixels;		/* area submitted */
+	long long lat_sum;		/* damage to completion, summed */
+	long long lat_max;
+};
+
+struct epdc_sched {
+	const struct epdc_sched_ops *ops;
+	void *priv;
+	int max_inflight;
+	int gap;			/* adjacency slack in pixels */
+	int waste;			/* % of a merged region allowed unused */
+	struct epdc_update pending[EPDC_SCHED_MAX_PENDING];
+	int npending;
+	struct epdc_update inflight[EPDC_SCHED_MAX_INFLIGHT];
+	int ninflight;
+	struct epdc_sched_stats stats;
+};
+
+void epdc_sched_init(struct epdc_sched *s, const struct epdc_sched_ops *ops,
+		     void *priv, int max_inflight);
+/* Record a dirty rectangle; nothing is sent until submit/flush */
+int epdc_sched_damage(struct epdc_sched *s, int left, int top, int width,
+		      int height, int waveform, unsigned int flags);
+/* Send every pending region that can go now, blocking only when full */
+int epdc_sched_submit(struct epdc_sched *s);
+/* Send all pending regions, waiting on collisions as needed */
+int epdc_sched_flush(struct epdc_sched *s);
+/* Flush and wait until nothing is in flight */
+int epdc_sched_drain(struct epdc_sched *s);
+void epdc_sched_print_stats(const struct epdc_sched *s, const char *name);
+
+/* MXCFB ioctl backend, epdc_sched_fb.c */
+struct epdc_sched_fb {
+	int fd;
+	unsigned int *marker;		/* shared with the caller's markers */
+	void *fb;			/* for classify, may be NULL */
+	int stride;			/* pixels per line */
+	int bpp;			/* 8 or 16 */
+	int mono_waveform;		/* used for pure black/white regions */
+	int gray_waveform;		/* used for anything else */
+};
+
+extern const struct epdc_sched_ops epdc_sched_fb_ops;
+
+/* Simulator backend, epdc_sim.c */
+struct epdc_sim_waveform {
+	int mode;
+	int ms;
+};
+
+struct epdc_sim_update;
+
+struct epdc_sim {
+	int nluts;
+	int queue;			/* updates the driver can hold */
+	int ioctl_us;			/* cost of a send on the caller */
+	int setup_us;			/* per update processing overhead */
+	int ns_per_pixel;		/* per pixel processing cost */
+	const struct epdc_sim_waveform *waveforms;
+	int default_ms;
+	long long now;
+	long long proc_free;
+	long long lut_free[64];
+	struct epdc_sim_update *upd;	/* indexed by marker */
+	int nupd;
+	int maxupd;
+	int tail;			/* oldest update that may be live */
+	unsigned long collisions;
+	long long lut_busy;		/* summed LUT occupancy */
+};
+
+extern const struct epdc_sim_waveform epdc_sim_default_waveforms[];
+extern const struct epdc_sched_ops epdc_sim_ops;
+
+int epdc_sim_init(struct epdc_sim *sim, int nluts, int queue);
+void epdc_sim_free(struct epdc_sim *sim);
+/* Let virtual time pass on the caller side, e.g. rendering */
+void epdc_sim_advance(struct epdc_sim *sim, long long us);
+/* Completion time of an update, -1 for an unknown marker */
+long long epdc_sim_end(const struct epdc_sim *sim, unsigned int marker);
+/* Time at which the last update sent so far completes */
+long long epdc_sim_idle_time(const struct epdc_sim *sim);
+
+#endif
@@ -0,0 +1,349 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file epdc_sched_bench.c
+ *
+ * @brief EPDC update scheduler benchmark on the simulator backend
+ *
+ * Replays the update patterns of the EPDC fb tests against the timing
+ * simulator, once the way update_to_display() issues them (one send per
+ * rectangle, one second sleep when the driver is full) and once through
+ * the update scheduler, and reports throughput and latency in virtual time.
+ * Runs on any host; no EPDC is needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "epdc_sched.h"
+
+#define TFAIL -1
+#define TPASS 0
+
+/* Waveform numbers as in mxc_epdc_v2_fb_test.c */
+#define WAVEFORM_MODE_DU	0x1
+#define WAVEFORM_MODE_GL16	0x3
+
+#define NAIVE_MAX_RETRY		10
+
+struct bench {
+	const char *workload;
+	int use_sched;
+	int xres, yres;
+	int nluts, queue, inflight;
+	int count;
+
+	struct epdc_sim sim;
+	struct epdc_sched sched;
+
+	/* naive path accounting */
+	unsigned long rects, sent, busy, lost;
+	long long lat_sum, lat_max;
+
+	/* per page / per frame latency */
+	unsigned long syncs;
+	long long sync_start, sync_sum, sync_max;
+};
+
+static void damage(struct bench *b, int left, int top, int width, int height,
+		   int waveform, long long render_us)
+{
+	struct epdc_update u;
+	long long t, lat;
+	int retry, ret;
+
+	epdc_sim_advance(&b->sim, render_us);
+
+	if (b->use_sched) {
+		epdc_sched_damage(&b->sched, left, top, width, height,
+				  waveform, 0);
+		epdc_sched_submit(&b->sched);
+		return;
+	}
+
+	/* What update_to_display() does when not waiting for completion */
+	memset(&u, 0, sizeof(u));
+	u.rect.left = left;
+	u.rect.top = top;
+	u.rect.width = width;
+	u.rect.height = height;
+	u.waveform = waveform;
+	t = b->sim.now;
+	b->rects++;
+
+	ret = epdc_sim_ops.send(&b->sim, &u);
+	for (retry = 0; ret == -EBUSY && retry < NAIVE_MAX_RETRY; retry++) {
+		b->busy++;
+		epdc_sim_advance(&b->sim, 1000000);
+		ret = epdc_sim_ops.send(&b->sim, &u);
+	}
+	if (ret < 0) {
+		b->lost++;
+		return;
+	}
+
+	b->sent++;
+	lat = epdc_sim_end(&b->sim, u.marker) - t;
+	b->lat_sum += lat;
+	if (lat > b->lat_max)
+		b->lat_max = lat;
+}
+
+static void sync_begin(struct bench *b)
+{
+	b->sync_start = b->sim.now;
+}
+
+/* Wait until everything issued so far is on the panel */
+static void sync_end(struct bench *b)
+{
+	long long t;
+
+	if (b->use_sched)
+		epdc_sched_drain(&b->sched);
+	else
+		b->sim.now = epdc_sim_idle_time(&b->sim);
+
+	t = b->sim.now - b->sync_start;
+	b->syncs++;
+	b->sync_sum += t;
+	if (t > b->sync_max)
+		b->sync_max = t;
+}
+
+/*
+ * Page turns: a page of text is laid out word by word and every word is
+ * sent as soon as it has been rendered, like a reader refreshing glyph runs.
+ */
+static void workload_page(struct bench *b)
+{
+	int page, x, y, w;
+	int line_h = 32, word_gap = 8, margin = 24;
+
+	for (page = 0; page < b->count; page++) {
+		sync_begin(b);
+		for (y = margin; y + line_h < b->yres - margin; y += line_h) {
+			x = margin;
+			while (1) {
+				w = 24 + rand() % 120;
+				if (x + w > b->xres - margin)
+					break;
+				damage(b, x, y, w, line_h - 6,
+				       WAVEFORM_MODE_GL16, 150);
+				x += w + word_gap;
+			}
+		}
+		sync_end(b);
+	}
+}
+
+/* The random rectangles of the stress test */
+static void workload_stress(struct bench *b)
+{
+	int i, x, y, width, height;
+
+	sync_begin(b);
+	for (i = 0; i < b->count * 100; i++) {
+		width = (rand() % b->xres) + 1;
+		height = (rand() % b->yres) + 1;
+		x = width == b->xres ? 0 : rand() % (b->xres - width);
+		y = height == b->yres ? 0 : rand() % (b->yres - height);
+		/* filling the rectangle on the CPU, roughly 1ns per pixel */
+		damage(b, x, y, width, height, EPDC_SCHED_WAVEFORM_AUTO,
+		       20 + (long long)width * height / 1000);
+	}
+	sync_end(b);
+}
+
+/* The moving square of the fast updates test, one step per frame */
+static void workload_anim(struct bench *b)
+{
+	int pass, xpos, last;
+	int side = 100, step = 40, ypos = 110;
+
+	for (pass = 0; pass < b->count; pass++) {
+		sync_begin(b);
+		last = -1;
+		for (xpos = 20; xpos + side <= b->xres; xpos += step) {
+			if (last >= 0)
+				damage(b, last, ypos, side, side,
+				       WAVEFORM_MODE_DU, 0);
+			damage(b, xpos, ypos, side, side, WAVEFORM_MODE_DU,
+			       16000);
+			last = xpos;
+		}
+		sync_end(b);
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*run)(struct bench *b);
+} workloads[] = {
+	{ "page", workload_page },
+	{ "stress", workload_stress },
+	{ "anim", workload_anim },
+};
+
+static int run(struct bench *b, int use_sched, unsigned int seed)
+{
+	const char *mode = use_sched ? "sched" : "naive";
+	unsigned long rects, sent, busy;
+	long long lat_avg, lat_max, end;
+	int i, ret;
+
+	ret = epdc_sim_init(&b->sim, b->nluts, b->queue);
+	if (ret < 0)
+		return ret;
+	epdc_sched_init(&b->sched, &epdc_sim_ops, &b->sim, b->inflight);
+	b->use_sched = use_sched;
+	b->rects = b->sent = b->busy = b->lost = 0;
+	b->lat_sum = b->lat_max = 0;
+	b->syncs = 0;
+	b->sync_sum = b->sync_max = 0;
+	srand(seed);
+
+	for (i = 0; i < (int)(sizeof(workloads) / sizeof(workloads[0])); i++)
+		if (!strcmp(workloads[i].name, b->workload))
+			workloads[i].run(b);
+
+	end = epdc_sim_idle_time(&b->sim);
+	if (use_sched) {
+		rects = b->sched.stats.damage;
+		sent = b->sched.stats.sent;
+		busy = b->sched.stats.busy;
+		lat_avg = rects ? b->sched.stats.lat_sum / (long long)rects : 0;
+		lat_max = b->sched.stats.lat_max;
+	} else {
+		rects = b->rects;
+		sent = b->sent;
+		busy = b->busy;
+		lat_avg = sent ? b->lat_sum / (long long)sent : 0;
+		lat_max = b->lat_max;
+	}
+
+	printf("%-7s %-6s %7lu %7lu %6lu %6lu %9.2f %8.1f %7lld %7lld %5.1f%%",
+		b->workload, mode, rects, sent, busy, b->sim.collisions,
+		end / 1e6, end ? rects * 1e6 / end : 0.0,
+		lat_avg / 1000, lat_max / 1000,
+		end ? 100.0 * b->sim.lut_busy / ((double)end * b->nluts) : 0.0);
+	if (b->syncs > 1)
+		printf("  sync %lld/%lld ms",
+			b->sync_sum / (long long)b->syncs / 1000,
+			b->sync_max / 1000);
+	if (b->lost)
+		printf("  %lu lost", b->lost);
+	printf("\n");
+
+	epdc_sim_free(&b->sim);
+	return 0;
+}
+
+static void usage(char *app)
+{
+	printf("EPDC update scheduler benchmark on the simulator backend.\n");
+	printf("Usage: %s [-w workload] [-n count] [-x xres] [-y yres] "
+		"[-l luts] [-q queue] [-i inflight] [-s seed]\n", app);
+	printf("\t-w\t  page, stress, anim or all (default)\n");
+	printf("\t-n\t  pages, hundreds of stress rectangles or animation "
+		"passes (default 4)\n");
+	printf("\t-x -y\t  panel resolution (default 1024x758)\n");
+	printf("\t-l\t  LUTs (default 16)\n");
+	printf("\t-q\t  updates the driver can hold (default 20)\n");
+	printf("\t-i\t  scheduler in-flight limit (default 16)\n");
+	printf("\t-s\t  random seed\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct bench *b;
+	const char *workload = "all";
+	unsigned int seed = 1;
+	int i, rt;
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return TFAIL;
+	b->xres = 1024;
+	b->yres = 758;
+	b->nluts = 16;
+	b->queue = 20;
+	b->inflight = 16;
+	b->count = 4;
+
+	while ((rt = getopt(argc, argv, "hw:n:x:y:l:q:i:s:")) >= 0) {
+		switch (rt) {
+		case 'w':
+			workload = optarg;
+			break;
+		case 'n':
+			b->count = atoi(optarg);
+			break;
+		case 'x':
+			b->xres = atoi(optarg);
+			break;
+		case 'y':
+			b->yres = atoi(optarg);
+			break;
+		case 'l':
+			b->nluts = atoi(optarg);
+			break;
+		case 'q':
+			b->queue = atoi(optarg);
+			break;
+		case 'i':
+			b->inflight = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			free(b);
+			return rt == 'h' ? TPASS : TFAIL;
+		}
+	}
+
+	if (b->xres < 200 || b->yres < 200 || b->count <= 0) {
+		usage(argv[0]);
+		free(b);
+		return TFAIL;
+	}
+
+	printf("%dx%d, %d LUTs, driver queue %d, %d in flight\n\n",
+		b->xres, b->yres, b->nluts, b->queue, b->inflight);
+	printf("%-7s %-6s %7s %7s %6s %6s %9s %8s %7s %7s %6s\n",
+		"load", "mode", "rects", "updates", "busy", "coll",
+		"time s", "rects/s", "avg ms", "max ms", "LUTs");
+
+	for (i = 0; i < (int)(sizeof(workloads) / sizeof(workloads[0])); i++) {
+		if (strcmp(workload, "all") && strcmp(workload, workloads[i].name))
+			continue;
+		b->workload = workloads[i].name;
+		if (run(b, 0, seed) < 0 || run(b, 1, seed) < 0) {
+			printf("Invalid simulator configuration\n");
+			free(b);
+			return TFAIL;
+		}
+	}
+
+	free(b);
+	return TPASS;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file epdc_sched_fb.c
+ *
+ * @brief MXCFB ioctl backend for the EPDC update scheduler
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <linux/mxcfb.h>
+
+#include "epdc_sched.h"
+
+static int fb_send(void *priv, struct epdc_update *upd)
+{
+	struct epdc_sched_fb *f = priv;
+	struct mxcfb_update_data upd_data;
+
+	memset(&upd_data, 0, sizeof(upd_data));
+	upd_data.update_mode = UPDATE_MODE_PARTIAL;
+	upd_data.waveform_mode = upd->waveform;
+	upd_data.update_region.left = upd->rect.left;
+	upd_data.update_region.top = upd->rect.top;
+	upd_data.update_region.width = upd->rect.width;
+	upd_data.update_region.height = upd->rect.height;
+	upd_data.temp = TEMP_USE_AMBIENT;
+	upd_data.flags = upd->flags;
+	/* Marker 0 means "no marker" to the driver */
+	if (!*f->marker)
+		(*f->marker)++;
+	upd_data.update_marker = (*f->marker)++;
+
+	/*
+	 * Apart from bad arguments the driver only fails a send when it is
+	 * out of update buffers; report that as busy so that the scheduler
+	 * waits for a completion before trying again.
+	 */
+	if (ioctl(f->fd, MXCFB_SEND_UPDATE, &upd_data) < 0)
+		return errno == EINVAL ? -EINVAL : -EBUSY;
+
+	upd->marker = upd_data.update_marker;
+	return 0;
+}
+
+static int fb_wait(void *priv, struct epdc_update *upd)
+{
+	struct epdc_sched_fb *f = priv;
+	struct mxcfb_update_marker_data upd_marker_data;
+
+	upd_marker_data.update_marker = upd->marker;
+	upd_marker_data.collision_test = 0;
+	if (ioctl(f->fd, MXCFB_WAIT_FOR_UPDATE_COMPLETE, &upd_marker_data) < 0)
+		return -errno;
+
+	upd->collision = upd_marker_data.collision_test;
+	return 0;
+}
+
+static long long fb_now(void *priv)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Pure black/white regions can use a direct update waveform, anything with
+ * intermediate grey levels needs the full greyscale one.
+ */
+static int fb_classify(void *priv, const struct epdc_rect *r)
+{
+	struct epdc_sched_fb *f = priv;
+	int x, y;
+
+	if (!f->fb)
+		return EPDC_SCHED_WAVEFORM_AUTO;
+
+	for (y = r->top; y < r->top + r->height; y++) {
+		if (f->bpp == 16) {
+			const __u16 *p = (const __u16 *)f->fb + y * f->stride;
+
+			for (x = r->left; x < r->left + r->width; x++)
+				if (p[x] != 0x0000 && p[x] != 0xFFFF)
+					return f->gray_waveform;
+		} else {
+			const __u8 *p = (const __u8 *)f->fb + y * f->stride;
+
+			for (x = r->left; x < r->left + r->width; x++)
+				if (p[x] != 0x00 && p[x] != 0xFF)
+					return f->gray_waveform;
+		}
+	}
+
+	return f->mono_waveform;
+}
+
+const struct epdc_sched_ops epdc_sched_fb_ops = {
+	.send = fb_send,
+	.wait = fb_wait,
+	.now = fb_now,
+	.classify = fb_classify,
+};
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file epdc_sim.c
+ *
+ * @brief EPDC timing simulator backend for the update scheduler
+ *
+ * A coarse model of the driver on a virtual microsecond clock:
+ *
+ * - Each send costs the caller ioctl_us and is refused with -EBUSY while
+ *   the driver already holds `queue` updates that have not completed.
+ * - Updates are processed one at a time (setup_us plus ns_per_pixel for
+ *   the region), then need a free LUT for as long as their waveform runs.
+ * - An update overlapping one still on the panel is a collision: it is
+ *   put back and processed again once the earlier update has completed.
+ *
+ * The driver's own merging of queued updates is not modelled, so the
+ * numbers describe what user space hands it rather than what reaches the
+ * panel under the queue-and-merge scheme.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "epdc_sched.h"
+
+struct epdc_sim_update {
+	struct epdc_rect rect;
+	long long start;
+	long long end;
+};
+
+/* Waveform numbers as in mxc_epdc_v2_fb_test.c, 25C panel durations */
+const struct epdc_sim_waveform epdc_sim_default_waveforms[] = {
+	{ 0, 2000 },	/* INIT */
+	{ 1, 260 },	/* DU */
+	{ 2, 760 },	/* GC16 */
+	{ 3, 640 },	/* GL16 */
+	{ 4, 640 },	/* GLR16 */
+	{ 5, 640 },	/* GLD16 */
+	{ 6, 120 },	/* A2 */
+	{ 7, 290 },	/* DU4 */
+	{ -1, 0 },
+};
+
+int epdc_sim_init(struct epdc_sim *sim, int nluts, int queue)
+{
+	memset(sim, 0, sizeof(*sim));
+	if (nluts <= 0 || nluts > 64)
+		return -EINVAL;
+	sim->nluts = nluts;
+	sim->queue = queue > 0 ? queue : 20;
+	sim->ioctl_us = 50;
+	sim->setup_us = 1000;
+	sim->ns_per_pixel = 4;
+	sim->waveforms = epdc_sim_default_waveforms;
+	sim->default_ms = 760;
+	return 0;
+}
+
+void epdc_sim_free(struct epdc_sim *sim)
+{
+	free(sim->upd);
+	sim->upd = NULL;
+	sim->nupd = sim->maxupd = sim->tail = 0;
+}
+
+void epdc_sim_advance(struct epdc_sim *sim, long long us)
+{
+	sim->now += us;
+}
+
+long long epdc_sim_end(const struct epdc_sim *sim, unsigned int marker)
+{
+	if (!marker || marker > (unsigned int)sim->nupd)
+		return -1;
+	return sim->upd[marker - 1].end;
+}
+
+long long epdc_sim_idle_time(const struct epdc_sim *sim)
+{
+	long long t = sim->now;
+	int i;
+
+	for (i = 0; i < sim->nluts; i++)
+		if (sim->lut_free[i] > t)
+			t = sim->lut_free[i];
+	return t;
+}
+
+static int waveform_ms(const struct epdc_sim *sim, int mode)
+{
+	const struct epdc_sim_waveform *w;
+
+	for (w = sim->waveforms; w->mode >= 0; w++)
+		if (w->mode == mode)
+			return w->ms;
+	return sim->default_ms;
+}
+
+static int overlaps(const struct epdc_rect *a, const struct epdc_rect *b)
+{
+	return a->left < b->left + b->width && b->left < a->left + a->width &&
+	       a->top < b->top + b->height && b->top < a->top + a->height;
+}
+
+/*
+ * Updates are only ever compared against the recent past: anything that
+ * ended before the current time can neither collide nor hold a buffer, so
+ * scans start at the oldest update that may still be live.
+ */
+static int sim_send(void *priv, struct epdc_update *upd)
+{
+	struct epdc_sim *sim = priv;
+	struct epdc_sim_update *u, *a;
+	long long proc, start;
+	int i, live, lut, moved;
+
+	sim->now += sim->ioctl_us;
+
+	while (sim->tail < sim->nupd && sim->upd[sim->tail].end <= sim->now)
+		sim->tail++;
+	live = 0;
+	for (i = sim->tail; i < sim->nupd; i++)
+		if (sim->upd[i].end > sim->now)
+			live++;
+	if (live >= sim->queue)
+		return -EBUSY;
+
+	if (sim->nupd == sim->maxupd) {
+		int n = sim->maxupd ? sim->maxupd * 2 : 1024;
+
+		u = realloc(sim->upd, n * sizeof(*u));
+		if (!u)
+			return -ENOMEM;
+		sim->upd = u;
+		sim->maxupd = n;
+	}
+	u = &sim->upd[sim->nupd];
+	u->rect = upd->rect;
+
+	proc = sim->setup_us +
+	       (long long)upd->rect.width * upd->rect.height *
+	       sim->ns_per_pixel / 1000;
+	start = (sim->proc_free > sim->now ? sim->proc_free : sim->now) + proc;
+	sim->proc_free = start;
+
+	do {
+		moved = 0;
+		for (i = sim->tail; i < sim->nupd; i++) {
+			a = &sim->upd[i];
+			if (a->end > start && overlaps(&a->rect, &u->rect)) {
+				start = a->end + proc;
+				sim->collisions++;
+				moved = 1;
+			}
+		}
+	} while (moved);
+
+	lut = 0;
+	for (i = 1; i < sim->nluts; i++)
+		if (sim->lut_free[i] < sim->lut_free[lut])
+			lut = i;
+	if (sim->lut_free[lut] > start)
+		start = sim->lut_free[lut];
+
+	u->start = start;
+	u->end = start + waveform_ms(sim, upd->waveform) * 1000LL;
+	sim->lut_free[lut] = u->end;
+	sim->lut_busy += u->end - u->start;
+
+	upd->marker = ++sim->nupd;
+	return 0;
+}
+
+static int sim_wait(void *priv, struct epdc_update *upd)
+{
+	struct epdc_sim *sim = priv;
+	long long end = epdc_sim_end(sim, upd->marker);
+
+	if (end < 0)
+		return -EINVAL;
+	if (end > sim->now)
+		sim->now = end;
+	sim->now += sim->ioctl_us;
+	upd->collision = 0;
+	return 0;
+}
+
+static long long sim_now(void *priv)
+{
+	struct epdc_sim *sim = priv;
+
+	return sim->now;
+}
+
+const struct epdc_sched_ops epdc_sim_ops = {
+	.send = sim_send,
+	.wait = sim_wait,
+	.now = sim_now,
+};
@@ -0,0 +1,649 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file fb_surface.c
+ *
+ * @brief Image sources and a threaded blitter for the framebuffer tests
+ *
+ * A blit walks the destination row by row.  For a rotated blit the row is
+ * a source column, or a source row backwards, and is gathered into a line
+ * buffer first.  A row in another format is converted into a second line
+ * buffer, through 32 bit BGRA or by table lookup from RGB565, then written
+ * out in one go; a row in the same format is copied straight across.
+ * Threads take chunks of rows from a shared counter, so a thread that
+ * could not be started only costs time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define BLIT_STREAM	"sse2"
+#elif defined(__aarch64__)
+#define BLIT_STREAM	"stnp"
+#endif
+
+#include "fb_surface.h"
+
+#define MAX_THREADS	16
+/* Rows a thread takes from the counter at a time */
+#define ROW_CHUNK	8
+
+static const struct {
+	const char *name;
+	const char *suffix;
+	int bpp;
+} formats[FB_SURFACE_NUM_FORMATS] = {
+	[FB_SURFACE_RGB565] = { "rgb565", "565", 2 },
+	[FB_SURFACE_RGB888] = { "rgb888", "888", 3 },
+	[FB_SURFACE_BGRA] = { "bgra", "bgra", 4 },
+	[FB_SURFACE_Y8] = { "y8", "y8", 1 },
+};
+
+int fb_surface_bpp(int format)
+{
+	if (format < 0 || format >= FB_SURFACE_NUM_FORMATS)
+		return 0;
+	return formats[format].bpp;
+}
+
+const char *fb_surface_format_name(int format)
+{
+	if (format < 0 || format >= FB_SURFACE_NUM_FORMATS)
+		return "unknown";
+	return formats[format].name;
+}
+
+int fb_surface_fb_format(int bits_per_pixel)
+{
+	switch (bits_per_pixel) {
+	case 8:
+		return FB_SURFACE_Y8;
+	case 16:
+		return FB_SURFACE_RGB565;
+	case 24:
+		return FB_SURFACE_RGB888;
+	case 32:
+		return FB_SURFACE_BGRA;
+	}
+	return -1;
+}
+
+const char *fb_blit_stream_name(void)
+{
+#ifdef BLIT_STREAM
+	return BLIT_STREAM;
+#else
+	return NULL;
+#endif
+}
+
+void fb_surface_wrap(struct fb_surface *img, void *data, int width,
+		     int height, int stride, int format)
+{
+	memset(img, 0, sizeof(*img));
+	img->width = width;
+	img->height = height;
+	img->stride = stride ? stride : width * fb_surface_bpp(format);
+	img->format = format;
+	img->data = data;
+}
+
+int fb_surface_open(struct fb_surface *img, const char *fname, int width,
+		    int height, int stride, int format)
+{
+	struct stat st;
+	size_t need;
+	void *map;
+	int fd, ret = 0;
+
+	if (width <= 0 || height <= 0 || !fb_surface_bpp(format))
+		return -EINVAL;
+	if (!stride)
+		stride = width * fb_surface_bpp(format);
+	if (stride < width * fb_surface_bpp(format))
+		return -EINVAL;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0) {
+		ret = -errno;
+		goto out;
+	}
+	need = (size_t)stride * (height - 1) + width * fb_surface_bpp(format);
+	if ((size_t)st.st_size < need) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	map = mmap(NULL, need, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		ret = -errno;
+		goto out;
+	}
+	/* Start reading the file in while the caller sets up the screen */
+	madvise(map, need, MADV_WILLNEED);
+
+	fb_surface_wrap(img, map, width, height, stride, format);
+	img->map = map;
+	img->map_size = need;
+out:
+	close(fd);
+	return ret;
+}
+
+int fb_surface_parse_name(const char *fname, int *width, int *height,
+			  int *format)
+{
+	const char *base, *ext, *fmt, *res;
+	char *end;
+	int i, w, h;
+
+	base = strrchr(fname, '/');
+	base = base ? base + 1 : fname;
+	ext = strrchr(base, '.');
+	if (!ext || strcmp(ext, ".rgb"))
+		return 0;
+
+	/* <name>-<xres>x<yres>-<format>.rgb, the name may contain dashes */
+	for (fmt = ext; fmt > base && fmt[-1] != '-'; fmt--)
+		;
+	if (fmt == base)
+		return 0;
+	for (res = fmt - 1; res > base && res[-1] != '-'; res--)
+		;
+	if (res == base)
+		return 0;
+
+	for (i = 0; i < FB_SURFACE_NUM_FORMATS; i++)
+		if (ext - fmt == (int)strlen(formats[i].suffix) &&
+		    !strncmp(fmt, formats[i].suffix, ext - fmt))
+			break;
+	if (i == FB_SURFACE_NUM_FORMATS)
+		return 0;
+
+	w = strtol(res, &end, 10);
+	if (end == res || *end != 'x')
+		return 0;
+	res = end + 1;
+	h = strtol(res, &end, 10);
+	if (end == res || end != fmt - 1 || w <= 0 || h <= 0)
+		return 0;
+
+	*width = w;
+	*height = h;
+	*format = i;
+	return 1;
+}
+
+int fb_surface_open_name(struct fb_surface *img, const char *fname)
+{
+	int width, height, format;
+
+	if (!fb_surface_parse_name(fname, &width, &height, &format))
+		return -EINVAL;
+	return fb_surface_open(img, fname, width, height, 0, format);
+}
+
+void fb_surface_close(struct fb_surface *img)
+{
+	if (img->map)
+		munmap(img->map, img->map_size);
+	memset(img, 0, sizeof(*img));
+}
+
+/* n pixels to 0xAARRGGBB */
+static void unpack(int format, const unsigned char *s, int n, uint32_t *out)
+{
+	uint32_t p, r, g, b;
+	int i;
+
+	switch (format) {
+	case FB_SURFACE_RGB565:
+		for (i = 0; i < n; i++, s += 2) {
+			p = s[0] | s[1] << 8;
+			r = p >> 11;
+			g = (p >> 5) & 0x3f;
+			b = p & 0x1f;
+			/* replicate the top bits so that 0x1f becomes 0xff */
+			out[i] = 0xff000000 | (r << 3 | r >> 2) << 16 |
+				 (g << 2 | g >> 4) << 8 | (b << 3 | b >> 2);
+		}
+		break;
+	case FB_SURFACE_RGB888:
+		for (i = 0; i < n; i++, s += 3)
+			out[i] = 0xff000000 | s[2] << 16 | s[1] << 8 | s[0];
+		break;
+	case FB_SURFACE_BGRA:
+		for (i = 0; i < n; i++, s += 4)
+			out[i] = (uint32_t)s[3] << 24 | s[2] << 16 |
+				 s[1] << 8 | s[0];
+		break;
+	case FB_SURFACE_Y8:
+		for (i = 0; i < n; i++)
+			out[i] = 0xff000000 | s[i] * 0x010101;
+		break;
+	}
+}
+
+/* A rotated line: n pixels starting at s, step bytes apart, packed */
+static void gather(int bpp, const unsigned char *s, ptrdiff_t step, int n,
+		   unsigned char *d)
+{
+	int i;
+
+	switch (bpp) {
+	case 1:
+		for (i = 0; i < n; i++, s += step)
+			d[i] = *s;
+		break;
+	case 2:
+		for (i = 0; i < n; i++, s += step)
+			((uint16_t *)d)[i] = *(const uint16_t *)s;
+		break;
+	case 4:
+		for (i = 0; i < n; i++, s += step)
+			((uint32_t *)d)[i] = *(const uint32_t *)s;
+		break;
+	default:
+		for (i = 0; i < n; i++, s += step, d += bpp)
+			memcpy(d, s, bpp);
+		break;
+	}
+}
+
+static void pack(int format, const uint32_t *in, int n, unsigned char *d)
+{
+	uint32_t p, r, g, b;
+	int i;
+
+	switch (format) {
+	case FB_SURFACE_RGB565:
+		for (i = 0; i < n; i++) {
+			p = in[i];
+			((uint16_t *)d)[i] = (p >> 8 & 0xf800) |
+					     (p >> 5 & 0x07e0) |
+					     (p >> 3 & 0x001f);
+		}
+		break;
+	case FB_SURFACE_RGB888:
+		for (i = 0; i < n; i++, d += 3) {
+			d[0] = in[i];
+			d[1] = in[i] >> 8;
+			d[2] = in[i] >> 16;
+		}
+		break;
+	case FB_SURFACE_BGRA:
+		for (i = 0; i < n; i++, d += 4) {
+			d[0] = in[i];
+			d[1] = in[i] >> 8;
+			d[2] = in[i] >> 16;
+			d[3] = in[i] >> 24;
+		}
+		break;
+	case FB_SURFACE_Y8:
+		/* BT.601 luma, the weights add up to 256 so white stays 255 */
+		for (i = 0; i < n; i++) {
+			r = in[i] >> 16 & 0xff;
+			g = in[i] >> 8 & 0xff;
+			b = in[i] & 0xff;
+			d[i] = (77 * r + 150 * g + 29 * b + 128) >> 8;
+		}
+		break;
+	}
+}
+
+/*
+ * RGB565 to BGRA and to luma by halves: the expanded green bits taken from
+ * each byte of a pixel do not overlap, so a lookup on each byte, OR-ed or
+ * added, gives the same result as unpack() and pack().
+ */
+static uint32_t bgra_lo[256], bgra_hi[256];
+static unsigned short luma_lo[256], luma_hi[256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void tables_init(void)
+{
+	uint32_t argb, r, g, b;
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		/* low byte: blue and the low three bits of green */
+		b = (i & 0x1f) << 3 | (i & 0x1f) >> 2;
+		g = (i >> 5) << 2;
+		bgra_lo[i] = g << 8 | b;
+		luma_lo[i] = 150 * g + 29 * b;
+
+		/* high byte: red and the high three bits of green */
+		r = (i >> 3) << 3 | (i >> 3) >> 2;
+		g = (i & 7) << 5 | (i & 7) >> 1;
+		argb = 0xff000000 | r << 16 | g << 8;
+		bgra_hi[i] = argb;
+		luma_hi[i] = 77 * r + 150 * g + 128;
+	}
+}
+
+/*
+ * Unrotated lines from RGB565, which is what the embedded images are,
+ * without the round trip through BGRA.  Returns 0 for other formats.
+ */
+static int convert_565(int format, const unsigned char *s, int n,
+		       unsigned char *d)
+{
+	uint32_t p;
+	int i;
+
+	pthread_once(&tables_once, tables_init);
+
+	switch (format) {
+	case FB_SURFACE_Y8:
+		for (i = 0; i < n; i++, s += 2)
+			d[i] = (luma_lo[s[0]] + luma_hi[s[1]]) >> 8;
+		return 1;
+	case FB_SURFACE_BGRA:
+		for (i = 0; i < n; i++, s += 2)
+			((uint32_t *)d)[i] = bgra_lo[s[0]] | bgra_hi[s[1]];
+		return 1;
+	case FB_SURFACE_RGB888:
+		for (i = 0; i < n; i++, s += 2, d += 3) {
+			p = bgra_lo[s[0]] | bgra_hi[s[1]];
+			d[0] = p;
+			d[1] = p >> 8;
+			d[2] = p >> 16;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Copy a line to write-combined memory.  Non-temporal stores go to the
+ * write-combining buffers without a read for ownership of the line, which
+ * a plain memcpy() may do on a cacheable mapping.
+ */
+static void copy_stream(unsigned char *d, const unsigned char *s, size_t n)
+{
+#if defined(__SSE2__)
+	__m128i a, b, c, e;
+
+	while (n && ((uintptr_t)d & 15)) {
+		*d++ = *s++;
+		n--;
+	}
+	for (; n >= 64; n -= 64, d += 64, s += 64) {
+		a = _mm_loadu_si128((const __m128i *)s);
+		b = _mm_loadu_si128((const __m128i *)(s + 16));
+		c = _mm_loadu_si128((const __m128i *)(s + 32));
+		e = _mm_loadu_si128((const __m128i *)(s + 48));
+		_mm_stream_si128((__m128i *)d, a);
+		_mm_stream_si128((__m128i *)(d + 16), b);
+		_mm_stream_si128((__m128i *)(d + 32), c);
+		_mm_stream_si128((__m128i *)(d + 48), e);
+	}
+#elif defined(__aarch64__)
+	while (n && ((uintptr_t)d & 15)) {
+		*d++ = *s++;
+		n--;
+	}
+	for (; n >= 64; n -= 64, d += 64, s += 64)
+		asm volatile("ldp q0, q1, [%1]\n\t"
+			     "ldp q2, q3, [%1, #32]\n\t"
+			     "stnp q0, q1, [%0]\n\t"
+			     "stnp q2, q3, [%0, #32]"
+			     : : "r" (d), "r" (s)
+			     : "v0", "v1", "v2", "v3", "memory");
+#endif
+	memcpy(d, s, n);
+}
+
+/* Order the non-temporal stores before the blit is reported done */
+static void stream_fence(void)
+{
+#if defined(__SSE2__)
+	_mm_sfence();
+#elif defined(__aarch64__)
+	asm volatile("dmb ishst" : : : "memory");
+#endif
+}
+
+struct blit_job {
+	const struct fb_surface *src;
+	struct fb_surface *dst;
+	int rotate;
+	unsigned int flags;
+	/* source rectangle, unclipped, as passed in */
+	int sx, sy, width, height;
+	/* visible part of the destination, relative to (dx, dy) */
+	int dx, dy;
+	int u0, u1, v0, v1;
+	int next_row;
+	int err;
+};
+
+/* Source pixel for destination pixel (u, v) relative to (dx, dy) */
+static void src_pos(const struct blit_job *job, int u, int v, int *x, int *y)
+{
+	switch (job->rotate) {
+	case FB_SURFACE_ROTATE_0:
+		*x = u;
+		*y = v;
+		break;
+	case FB_SURFACE_ROTATE_90:
+		*x = v;
+		*y = job->height - 1 - u;
+		break;
+	case FB_SURFACE_ROTATE_180:
+		*x = job->width - 1 - u;
+		*y = job->height - 1 - v;
+		break;
+	default:
+		*x = job->width - 1 - v;
+		*y = u;
+		break;
+	}
+	*x += job->sx;
+	*y += job->sy;
+}
+
+static ptrdiff_t src_offset(const struct blit_job *job, int u, int v)
+{
+	int x, y;
+
+	src_pos(job, u, v, &x, &y);
+	return (ptrdiff_t)y * job->src->stride +
+	       (ptrdiff_t)x * fb_surface_bpp(job->src->format);
+}
+
+static void blit_rows(struct blit_job *job)
+{
+	const struct fb_surface *src = job->src;
+	struct fb_surface *dst = job->dst;
+	int n = job->u1 - job->u0;
+	int sbpp = fb_surface_bpp(src->format);
+	int dbpp = fb_surface_bpp(dst->format);
+	int stream = (job->flags & FB_BLIT_STREAM) && fb_blit_stream_name();
+	int convert = src->format != dst->format;
+	const unsigned char *s;
+	unsigned char *d, *out, *rotated = NULL, *line = NULL;
+	uint32_t *argb = NULL;
+	ptrdiff_t step;
+	int v, end;
+
+	if (job->rotate != FB_SURFACE_ROTATE_0)
+		rotated = malloc(n * sbpp);
+	if (convert) {
+		argb = malloc(n * sizeof(*argb));
+		line = malloc(n * dbpp);
+	}
+	if ((job->rotate != FB_SURFACE_ROTATE_0 && !rotated) ||
+	    (convert && (!argb || !line))) {
+		job->err = -ENOMEM;
+		goto out;
+	}
+
+	while (1) {
+		v = __atomic_fetch_add(&job->next_row, ROW_CHUNK,
+				       __ATOMIC_RELAXED);
+		if (v >= job->v1)
+			break;
+		end = v + ROW_CHUNK < job->v1 ? v + ROW_CHUNK : job->v1;
+
+		for (; v < end; v++) {
+			s = src->data + src_offset(job, job->u0, v);
+			d = dst->data + (ptrdiff_t)(job->dy + v) * dst->stride +
+			    (ptrdiff_t)(job->dx + job->u0) * dbpp;
+
+			if (rotated) {
+				step = src_offset(job, job->u0 + 1, v) -
+				       src_offset(job, job->u0, v);
+				gather(sbpp, s, step, n, rotated);
+				s = rotated;
+			}
+
+			if (!convert) {
+				if (stream)
+					copy_stream(d, s, n * dbpp);
+				else
+					memcpy(d, s, n * dbpp);
+				continue;
+			}
+
+			out = stream ? line : d;
+			if (src->format != FB_SURFACE_RGB565 ||
+			    !convert_565(dst->format, s, n, out)) {
+				unpack(src->format, s, n, argb);
+				pack(dst->format, argb, n, out);
+			}
+			if (stream)
+				copy_stream(d, line, n * dbpp);
+		}
+	}
+	if (stream)
+		stream_fence();
+out:
+	free(rotated);
+	free(argb);
+	free(line);
+}
+
+static void *blit_thread(void *arg)
+{
+	blit_rows(arg);
+	return NULL;
+}
+
+/* Narrow [lo, hi) to the t for which base + sign * t is in [0, limit) */
+static void clip_axis(int *lo, int *hi, int base, int sign, int limit)
+{
+	int a, b;
+
+	if (sign > 0) {
+		a = -base;
+		b = limit - base;
+	} else {
+		a = base - limit + 1;
+		b = base + 1;
+	}
+	if (*lo < a)
+		*lo = a;
+	if (*hi > b)
+		*hi = b;
+}
+
+long fb_blit(const struct fb_surface *src, int sx, int sy, int width,
+	     int height, struct fb_surface *dst, int dx, int dy, int rotate,
+	     int threads, unsigned int flags)
+{
+	pthread_t tid[MAX_THREADS];
+	struct blit_job job;
+	int i, started, rw, rh, x0, y0, x1, y1;
+
+	if (!fb_surface_bpp(src->format) || !fb_surface_bpp(dst->format) ||
+	    rotate < FB_SURFACE_ROTATE_0 || rotate > FB_SURFACE_ROTATE_270)
+		return -EINVAL;
+	if (width <= 0 || height <= 0)
+		return 0;
+
+	memset(&job, 0, sizeof(job));
+	job.src = src;
+	job.dst = dst;
+	job.rotate = rotate;
+	job.flags = flags;
+	job.sx = sx;
+	job.sy = sy;
+	job.width = width;
+	job.height = height;
+	job.dx = dx;
+	job.dy = dy;
+
+	rw = rotate & 1 ? height : width;
+	rh = rotate & 1 ? width : height;
+	job.u0 = 0;
+	job.u1 = rw;
+	job.v0 = 0;
+	job.v1 = rh;
+	clip_axis(&job.u0, &job.u1, dx, 1, dst->width);
+	clip_axis(&job.v0, &job.v1, dy, 1, dst->height);
+
+	/*
+	 * Every source coordinate follows one destination axis, forwards or
+	 * backwards, so the source bounds clip u and v the same way.  The
+	 * corners tell which axis and which direction.
+	 */
+	src_pos(&job, 0, 0, &x0, &y0);
+	src_pos(&job, 1, 0, &x1, &y1);
+	if (x1 != x0) {
+		clip_axis(&job.u0, &job.u1, x0, x1 - x0, src->width);
+		src_pos(&job, 0, 1, &x1, &y1);
+		clip_axis(&job.v0, &job.v1, y0, y1 - y0, src->height);
+	} else {
+		clip_axis(&job.u0, &job.u1, y0, y1 - y0, src->height);
+		src_pos(&job, 0, 1, &x1, &y1);
+		clip_axis(&job.v0, &job.v1, x0, x1 - x0, src->width);
+	}
+	if (job.u0 >= job.u1 || job.v0 >= job.v1)
+		return 0;
+	job.next_row = job.v0;
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+	if (threads > (job.v1 - job.v0 + ROW_CHUNK - 1) / ROW_CHUNK)
+		threads = (job.v1 - job.v0 + ROW_CHUNK - 1) / ROW_CHUNK;
+
+	for (started = 1; started < threads; started++)
+		if (pthread_create(&tid[started], NULL, blit_thread, &job))
+			break;
+	blit_rows(&job);
+	for (i = 1; i < started; i++)
+		pthread_join(tid[i], NULL);
+
+	if (job.err)
+		return job.err;
+	return (long)(job.u1 - job.u0) * (job.v1 - job.v0) *
+	       fb_surface_bpp(dst->format);
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file fb_surface.h
+ *
+ * @brief Image sources and a threaded blitter for the framebuffer tests
+ *
+ * An fb_surface describes pixels somewhere in memory: a raw image file mapped
+ * with mmap, one of the embedded image arrays, or a framebuffer mapping.
+ * fb_blit() copies a rectangle between two of them with clipping, pixel
+ * format conversion and rotation, splitting the destination rows across
+ * threads.  Writes to framebuffer memory, which is mapped write-combined,
+ * go through non-temporal stores so that they do not pull the destination
+ * into the cache first.
+ */
+
+#ifndef FB_SURFACE_H
+#define FB_SURFACE_H
+
+#include <stddef.h>
+
+enum fb_surface_format {
+	FB_SURFACE_RGB565,		/* 16 bit, little endian */
+	FB_SURFACE_RGB888,		/* 24 bit, B G R in memory */
+	FB_SURFACE_BGRA,			/* 32 bit, B G R A in memory */
+	FB_SURFACE_Y8,			/* 8 bit grey */
+	FB_SURFACE_NUM_FORMATS
+};
+
+/* Clockwise, same values as FB_ROTATE_* */
+enum fb_surface_rotate {
+	FB_SURFACE_ROTATE_0,
+	FB_SURFACE_ROTATE_90,
+	FB_SURFACE_ROTATE_180,
+	FB_SURFACE_ROTATE_270
+};
+
+/* fb_blit flags */
+#define FB_BLIT_STREAM		0x1	/* non-temporal stores to dst */
+
+struct fb_surface {
+	int width;
+	int height;
+	int stride;			/* bytes per line */
+	int format;
+	unsigned char *data;
+	/* set when the pixels are a mapping owned by the image */
+	void *map;
+	size_t map_size;
+};
+
+/*
+ * Map a raw image file read only.  stride 0 means tightly packed lines.
+ * Returns 0 or a negative errno value; -EINVAL if the file is too short.
+ */
+int fb_surface_open(struct fb_surface *img, const char *fname, int width,
+		    int height, int stride, int format);
+/*
+ * Same for a file named <name>-<xres>x<yres>-<565|888|bgra|y8>.rgb, the
+ * geometry and format are taken from the name.
+ */
+int fb_surface_open_name(struct fb_surface *img, const char *fname);
+/* Parse such a name; returns 1 and fills the fields when it matches */
+int fb_surface_parse_name(const char *fname, int *width, int *height,
+			  int *format);
+
+/*
+ * Wrap pixels already in memory, e.g. the embedded RGB565 image arrays or a
+ * framebuffer mapping.  Nothing is copied or converted up front: a blit
+ * only reads the lines it needs and converts them on the way to the
+ * destination.
+ */
+void fb_surface_wrap(struct fb_surface *img, void *data, int width,
+		     int height, int stride, int format);
+void fb_surface_close(struct fb_surface *img);
+
+int fb_surface_bpp(int format);
+const char *fb_surface_format_name(int format);
+/* Format of a framebuffer with this depth, -1 if there is none */
+int fb_surface_fb_format(int bits_per_pixel);
+
+/*
+ * Copy the width x height rectangle of src at (sx, sy) to dst at (dx, dy),
+ * rotated clockwise by `rotate`; for 90 and 270 it covers height x width
+ * pixels of dst.  Both rectangles are clipped, a negative position moves the
+ * visible part accordingly.  threads 1 copies on the caller's thread, 0
+ * uses one thread per online CPU.
+ * Returns the number of dst bytes written or a negative errno value.
+ */
+long fb_blit(const struct fb_surface *src, int sx, int sy, int width,
+	     int height, struct fb_surface *dst, int dx, int dy, int rotate,
+	     int threads, unsigned int flags);
+
+/* Name of the non-temporal store path, NULL if plain stores are used */
+const char *fb_blit_stream_name(void);
+
+#endif
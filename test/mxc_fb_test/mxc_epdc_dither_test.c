@@ -0,0 +1,449 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file mxc_epdc_dither_test.c
+ *
+ * @brief CPU dithering benchmark and reference for EPDC dithering
+ *
+ * Without -i, times every dithering mode at e-reader panel sizes and
+ * checks that the threaded and vector kernels match the single threaded
+ * scalar result bit for bit.  With -i, dithers one raw Y8 image and can
+ * write the result out or compare it against a raw readback file or an
+ * 8bpp framebuffer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fb.h>
+
+#include "epdc_dither.h"
+
+#define TFAIL -1
+#define TPASS 0
+
+static const struct {
+	int width;
+	int height;
+} bench_sizes[] = {
+	{ 1872, 1404 },
+	{ 2200, 1650 },
+};
+
+static const int bench_modes[] = {
+	EPDC_DITHER_QUANT_ONLY,
+	EPDC_DITHER_ORDERED,
+	EPDC_DITHER_FLOYD_STEINBERG,
+	EPDC_DITHER_ATKINSON,
+	EPDC_DITHER_SIERRA_LITE,
+};
+
+static const int bench_bits[] = { 4, 2, 1 };
+
+#define ARRAY_SIZE(x)	(sizeof(x)/sizeof(x[0]))
+
+static double time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+ * Something like a page: a grey ramp, a smooth photo-like area and lines
+ * of black "glyphs" on white with anti-aliased edges.
+ */
+static void make_page(unsigned char *img, int width, int height)
+{
+	unsigned int h;
+	int x, y, v, gx, gy;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			if (y < height / 6) {
+				v = x * 255 / (width - 1);
+			} else if (y < height / 2) {
+				v = 128 + ((x * 7 + y * 3) % 200) - 100 +
+					((x / 13 + y / 17) % 2) * 20;
+			} else {
+				gx = x % 24;
+				gy = y % 40;
+				h = (x / 24) * 2654435761u ^ (y / 40) * 40503u;
+				if (gy >= 30 || gx >= 20 || ((h >> 7) & 3) == 0)
+					v = 255;
+				else if (gx == 0 || gy == 0 || gx == 19 ||
+					 gy == 29)
+					v = 160;
+				else
+					v = 0;
+			}
+			img[y * width + x] = v < 0 ? 0 : v > 255 ? 255 : v;
+		}
+	}
+}
+
+static int dither_timed(int mode, int bits, const unsigned char *src,
+			unsigned char *dst, int width, int height, int threads,
+			int iterations, double *best)
+{
+	double t;
+	int i, ret;
+
+	*best = 0;
+	for (i = 0; i < iterations; i++) {
+		t = time_ms();
+		ret = epdc_dither(mode, bits, src, width, dst, width, width,
+				  height, threads);
+		t = time_ms() - t;
+		if (ret < 0)
+			return ret;
+		if (!i || t < *best)
+			*best = t;
+	}
+
+	return 0;
+}
+
+static int benchmark(int threads, int iterations, int width, int height)
+{
+	unsigned char *src, *ref, *out;
+	const char *simd = epdc_dither_simd();
+	double t_ref, t_fast;
+	int s, m, b, mode, bits, ret = TPASS;
+	int w, h;
+	size_t size;
+
+	printf("reference: 1 thread, scalar; tested: %d threads, %s ordered "
+		"kernel; best of %d\n\n", threads, simd ? simd : "scalar",
+		iterations);
+	printf("%-10s %-16s %4s %10s %10s %10s %8s %6s\n", "size", "mode",
+		"bits", "ref ms", "ms", "Mpix/s", "speedup", "exact");
+
+	for (s = 0; s < (int)ARRAY_SIZE(bench_sizes); s++) {
+		w = width ? width : bench_sizes[s].width;
+		h = height ? height : bench_sizes[s].height;
+		if (s && width)
+			break;
+
+		size = (size_t)w * h;
+		src = malloc(size);
+		ref = malloc(size);
+		out = malloc(size);
+		if (!src || !ref || !out) {
+			printf("Out of memory\n");
+			free(src);
+			free(ref);
+			free(out);
+			return TFAIL;
+		}
+		make_page(src, w, h);
+
+		for (m = 0; m < (int)ARRAY_SIZE(bench_modes); m++) {
+			for (b = 0; b < (int)ARRAY_SIZE(bench_bits); b++) {
+				mode = bench_modes[m];
+				bits = bench_bits[b];
+
+				/* Reference: one thread, scalar kernels */
+				epdc_dither_set_simd(0);
+				if (dither_timed(mode, bits, src, ref, w, h, 1,
+						 iterations, &t_ref) < 0)
+					goto fail;
+				epdc_dither_set_simd(1);
+				memset(out, 0xaa, size);
+				if (dither_timed(mode, bits, src, out, w, h,
+						 threads, iterations,
+						 &t_fast) < 0)
+					goto fail;
+
+				printf("%4dx%-5d %-16s %4d %10.2f %10.2f %10.1f "
+					"%7.2fx %6s\n", w, h,
+					epdc_dither_name(mode), bits, t_ref,
+					t_fast, size / t_fast / 1000.0,
+					t_ref / t_fast,
+					memcmp(ref, out, size) ? "NO" : "yes");
+				if (memcmp(ref, out, size))
+					ret = TFAIL;
+			}
+		}
+
+		free(src);
+		free(ref);
+		free(out);
+	}
+
+	return ret;
+
+fail:
+	printf("Dithering failed\n");
+	free(src);
+	free(ref);
+	free(out);
+	return TFAIL;
+}
+
+static int load_file(const char *name, unsigned char *buf, size_t size)
+{
+	FILE *f = fopen(name, "rb");
+	size_t n;
+
+	if (!f) {
+		printf("Unable to open %s: %s\n", name, strerror(errno));
+		return TFAIL;
+	}
+	n = fread(buf, 1, size, f);
+	fclose(f);
+	if (n != size) {
+		printf("%s: expected %zu bytes, got %zu\n", name, size, n);
+		return TFAIL;
+	}
+	return TPASS;
+}
+
+/*
+ * Read back the visible top-left width x height of an 8bpp framebuffer,
+ * honouring the line length and pan offset.
+ */
+static int load_fb(const char *name, unsigned char *buf, int width, int height)
+{
+	struct fb_var_screeninfo var;
+	struct fb_fix_screeninfo fix;
+	off_t offset;
+	int fd, y, ret = TPASS;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		printf("Unable to open %s: %s\n", name, strerror(errno));
+		return TFAIL;
+	}
+
+	if (ioctl(fd, FBIOGET_VSCREENINFO, &var) < 0 ||
+	    ioctl(fd, FBIOGET_FSCREENINFO, &fix) < 0) {
+		printf("Unable to read screeninfo for %s\n", name);
+		close(fd);
+		return TFAIL;
+	}
+	if (var.bits_per_pixel != 8 || (int)var.xres < width ||
+	    (int)var.yres < height) {
+		printf("%s is %ux%u at %u bpp, need 8 bpp and at least %dx%d\n",
+			name, var.xres, var.yres, var.bits_per_pixel,
+			width, height);
+		close(fd);
+		return TFAIL;
+	}
+
+	for (y = 0; y < height; y++) {
+		offset = (off_t)(var.yoffset + y) * fix.line_length +
+			var.xoffset;
+		if (pread(fd, buf + (size_t)y * width, width, offset) != width) {
+			printf("Short read from %s\n", name);
+			ret = TFAIL;
+			break;
+		}
+	}
+
+	close(fd);
+	return ret;
+}
+
+static int compare(const unsigned char *out, const unsigned char *rb,
+		   int width, int height)
+{
+	long mismatch = 0;
+	int x, y, diff, max_diff = 0, fx = -1, fy = -1;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			diff = abs(out[y * width + x] - rb[y * width + x]);
+			if (!diff)
+				continue;
+			if (!mismatch++) {
+				fx = x;
+				fy = y;
+			}
+			if (diff > max_diff)
+				max_diff = diff;
+		}
+	}
+
+	if (!mismatch) {
+		printf("Readback matches bit for bit\n");
+		return TPASS;
+	}
+
+	printf("%ld of %ld pixels differ (%.3f%%), max difference %d\n",
+		mismatch, (long)width * height,
+		100.0 * mismatch / ((double)width * height), max_diff);
+	printf("First difference at %d,%d: cpu 0x%02x, readback 0x%02x\n",
+		fx, fy, out[fy * width + fx], rb[fy * width + fx]);
+	return TFAIL;
+}
+
+static int convert(const char *in, const char *outname, const char *readback,
+		   int mode, int bits, int threads, int width, int height)
+{
+	unsigned char *src, *out, *rb = NULL;
+	size_t size = (size_t)width * height;
+	double t;
+	int ret = TFAIL;
+	FILE *f;
+
+	src = malloc(size);
+	out = malloc(size);
+	if (!src || !out) {
+		printf("Out of memory\n");
+		goto done;
+	}
+	if (load_file(in, src, size) != TPASS)
+		goto done;
+
+	t = time_ms();
+	if (epdc_dither(mode, bits, src, width, out, width, width, height,
+			threads) < 0) {
+		printf("Dithering failed\n");
+		goto done;
+	}
+	t = time_ms() - t;
+	printf("%s Y8->Y%d, %dx%d: %.2f ms\n", epdc_dither_name(mode), bits,
+		width, height, t);
+
+	if (outname) {
+		f = fopen(outname, "wb");
+		if (!f || fwrite(out, 1, size, f) != size) {
+			printf("Unable to write %s\n", outname);
+			if (f)
+				fclose(f);
+			goto done;
+		}
+		fclose(f);
+	}
+
+	if (readback) {
+		rb = malloc(size);
+		if (!rb) {
+			printf("Out of memory\n");
+			goto done;
+		}
+		if (!strncmp(readback, "/dev/fb", 7))
+			ret = load_fb(readback, rb, width, height);
+		else
+			ret = load_file(readback, rb, size);
+		if (ret == TPASS)
+			ret = compare(out, rb, width, height);
+	} else {
+		ret = TPASS;
+	}
+
+done:
+	free(src);
+	free(out);
+	free(rb);
+	return ret;
+}
+
+static void usage(char *app)
+{
+	int i;
+
+	printf("EPDC CPU dithering benchmark and reference.\n");
+	printf("Usage: %s [-t threads] [-n iterations] [-W width -H height]\n",
+		app);
+	printf("       %s -i in.y8 -W width -H height [-m mode] [-b bits] "
+		"[-o out.y8] [-c readback]\n", app);
+	printf("\t-i\t  Dither a raw Y8 image instead of benchmarking\n");
+	printf("\t-m\t  Dither mode, numbered like the hardware modes:\n");
+	for (i = 0; i < EPDC_DITHER_NUM_MODES; i++)
+		printf("\t\t  %d - %s\n", i, epdc_dither_name(i));
+	printf("\t-b\t  Bits per pixel to keep, 1 to 7 (default 4)\n");
+	printf("\t-o\t  Write the dithered Y8 image\n");
+	printf("\t-c\t  Compare with a raw Y8 readback file or an 8bpp "
+		"/dev/fbN\n");
+	printf("\t-t\t  Threads (default: online CPUs)\n");
+	printf("\t-n\t  Benchmark iterations, best is reported (default 3)\n");
+	printf("\t-W -H\t  Image size; for the benchmark, replaces the panel "
+		"sizes\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *in = NULL, *out = NULL, *readback = NULL;
+	int mode = EPDC_DITHER_FLOYD_STEINBERG, bits = 4;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int iterations = 3, width = 0, height = 0;
+	int rt;
+
+	while ((rt = getopt(argc, argv, "hi:o:c:m:b:t:n:W:H:")) >= 0) {
+		switch (rt) {
+		case 'i':
+			in = optarg;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'c':
+			readback = optarg;
+			break;
+		case 'm':
+			mode = atoi(optarg);
+			break;
+		case 'b':
+			bits = atoi(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'W':
+			width = atoi(optarg);
+			break;
+		case 'H':
+			height = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return rt == 'h' ? TPASS : TFAIL;
+		}
+	}
+
+	if (threads < 1)
+		threads = 1;
+	if (iterations < 1)
+		iterations = 1;
+	if (mode < 0 || mode >= EPDC_DITHER_NUM_MODES || bits < 1 || bits > 7 ||
+	    width < 0 || height < 0 || !width != !height) {
+		usage(argv[0]);
+		return TFAIL;
+	}
+
+	if (!in)
+		return benchmark(threads, iterations, width, height);
+
+	if (!width) {
+		printf("-i needs -W and -H\n");
+		return TFAIL;
+	}
+	return convert(in, out, readback, mode, bits, threads, width, height);
+}
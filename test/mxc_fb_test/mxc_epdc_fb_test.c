@@ -55,6 +55,8 @@ extern "C"{
 #include "fsl_rgb_480x360.c"
 #include "colorbar_rgb_800x600.c"
 #include "../../include/test_utils.h"
+#include "epdc_sched.h"
+#include "fb_surface.h"
 
 
 #define TFAIL -1
@@ -104,6 +106,9 @@ int use_animation = 0;
 int num_flashes = 10;
 
 static int vt_fd = -1;
+static int use_sched;
+static struct epdc_sched sched;
+static struct epdc_sched_fb sched_fb;
 static int orig_vt = -1;
 
 void memset_dword(void *s, int c, size_t count)
@@ -118,16 +123,18 @@ void memset_dword(void *s, int c, size_t count)
 static void copy_image_to_buffer(int left, int top, int width, int height, uint *img_ptr,
 			uint target_buf, struct fb_var_screeninfo *screen_info)
 {
-	int i;
+	struct fb_surface src, dst;
 	uint *fb_ptr;
+	int lines = screen_info->yres_virtual;
 
 	if (target_buf == BUFFER_FB)
 		fb_ptr =  (uint *)fb;
-	else if (target_buf == BUFFER_OVERLAY)
+	else if (target_buf == BUFFER_OVERLAY) {
 		fb_ptr = (uint *)fb +
 			(screen_info->xres_virtual * ALIGN_PIXEL_128(screen_info->yres) *
 			screen_info->bits_per_pixel/8)/4;
-	else {
+		lines -= ALIGN_PIXEL_128(screen_info->yres);
+	} else {
 		printf("Invalid target buffer specified!\n");
 		return;
 	}
@@ -137,8 +144,14 @@ static void copy_image_to_buffer(int left, int top, int width, int height, uint
 		return;
 	}
 
-	for (i = 0; i < height; i++)
-		memcpy(fb_ptr + ((i + top) * screen_info->xres_virtual + left) * 2 / 4, img_ptr + (i * width) * 2 /4, width * 2);
+	/* The embedded images are RGB565, converted when the fb is Y8 */
+	fb_surface_wrap(&src, img_ptr, width, height, 0, FB_SURFACE_RGB565);
+	fb_surface_wrap(&dst, fb_ptr, screen_info->xres_virtual, lines,
+		screen_info->xres_virtual * screen_info->bits_per_pixel / 8,
+		fb_surface_fb_format(screen_info->bits_per_pixel));
+	if (fb_blit(&src, 0, 0, width, height, &dst, left, top,
+		    FB_SURFACE_ROTATE_0, 0, FB_BLIT_STREAM) < 0)
+		printf("Image copy failed!\n");
 }
 
 static __u32 update_to_display(int left, int top, int width, int height, int wave_mode,
@@ -198,6 +211,54 @@ static __u32 update_to_display(int left, int top, int width, int height, int wav
 		return upd_data.waveform_mode;
 }
 
+/*
+ * Bind the update scheduler to the current fb layout.  Has to be redone
+ * after every FBIOPUT_VSCREENINFO, rotation changes stride and depth.
+ */
+static void sched_start(void)
+{
+	sched_fb.fd = fd_fb_ioctl;
+	sched_fb.marker = &marker_val;
+	sched_fb.fb = fb;
+	sched_fb.stride = screen_info.xres_virtual;
+	sched_fb.bpp = screen_info.bits_per_pixel;
+	sched_fb.mono_waveform = WAVEFORM_MODE_DU;
+	sched_fb.gray_waveform = WAVEFORM_MODE_GC16;
+	epdc_sched_init(&sched, &epdc_sched_fb_ops, &sched_fb, 16);
+}
+
+/* Wait for everything handed to the scheduler to reach the panel */
+static int sched_finish(void)
+{
+	int retval = epdc_sched_drain(&sched);
+
+	epdc_sched_print_stats(&sched, "Update scheduler");
+	if (retval < 0) {
+		printf("Scheduled updates failed.  Error = %d\n", retval);
+		return TFAIL;
+	}
+	return TPASS;
+}
+
+/*
+ * Same as update_to_display(), or with -s hand the region to the update
+ * scheduler, which merges it with pending ones and sends it once it no
+ * longer collides with an update in flight.
+ */
+static void queue_update(int left, int top, int width, int height,
+	int wave_mode, int wait_for_complete, uint flags)
+{
+	if (!use_sched) {
+		update_to_display(left, top, width, height, wave_mode,
+			wait_for_complete, flags);
+		return;
+	}
+
+	if (epdc_sched_damage(&sched, left, top, width, height, wave_mode,
+			flags) < 0 || epdc_sched_submit(&sched) < 0)
+		printf("Scheduled update failed\n");
+}
+
 static void draw_rgb_crosshatch(struct fb_var_screeninfo * var, int mode)
 {
 	__u32 *stripe_start;
@@ -1518,6 +1579,9 @@ static int test_fast_square(void)
 	update_to_display(0, 0, screen_info.xres, screen_info.yres,
 		WAVEFORM_MODE_AUTO, TRUE, 0);
 
+	if (use_sched)
+		sched_start();
+
 	xpos = 20;
 	last_pos = 0;
 	ypos = 110;
@@ -1531,7 +1595,7 @@ static int test_fast_square(void)
 		if (!first_go) {
 			draw_rectangle(fb, last_pos, ypos, side_len, side_len,
 					0xFFFF);
-			update_to_display(last_pos, ypos, side_len, side_len,
+			queue_update(last_pos, ypos, side_len, side_len,
 				wave_mode,
 				wait_upd_compl, 0);
 		}
@@ -1540,7 +1604,7 @@ static int test_fast_square(void)
 
 		/* Draw new grey square */
 		draw_rectangle(fb, xpos, ypos, side_len, side_len, 0x0000);
-		update_to_display(xpos, ypos, side_len, side_len,
+		queue_update(xpos, ypos, side_len, side_len,
 			wave_mode, wait_upd_compl, 0);
 
 		last_pos = xpos;
@@ -1551,7 +1615,7 @@ static int test_fast_square(void)
 
 	/* Clear last square (set area to white) */
 	draw_rectangle(fb, last_pos, ypos, side_len, side_len, 0xFFFF);
-	update_to_display(last_pos, ypos, side_len, side_len,
+	queue_update(last_pos, ypos, side_len, side_len,
 		WAVEFORM_MODE_DU,
 		wait_upd_compl, 0);
 
@@ -1566,7 +1630,7 @@ static int test_fast_square(void)
 		if (!first_go) {
 			draw_rectangle(fb, xpos, last_pos, side_len, side_len,
 					0xFFFF);
-			update_to_display(xpos, last_pos, side_len,
+			queue_update(xpos, last_pos, side_len,
 				side_len,
 				wave_mode,
 				wait_upd_compl, 0);
@@ -1578,13 +1642,16 @@ static int test_fast_square(void)
 		draw_rectangle(fb, xpos, ypos, side_len, side_len, 0x0000);
 
 		/* Send to display */
-		update_to_display(xpos, ypos, side_len,
+		queue_update(xpos, ypos, side_len,
 			side_len + increment, wave_mode, wait_upd_compl, 0);
 
 		last_pos = ypos;
 		ypos += increment;
 	}
 
+	if (use_sched)
+		retval = sched_finish();
+
 	return retval;
 }
 
@@ -1960,6 +2027,9 @@ static int test_stress(void)
 			return TFAIL;
 		}
 
+		if (use_sched)
+			sched_start();
+
 		for (j = 0; j < 1000; j++) {
 			width = (rand() % (screen_info.xres)) + 1;
 			height = (rand() % (screen_info.yres)) + 1;
@@ -1988,9 +2058,12 @@ static int test_stress(void)
 				flags = EPDC_FLAG_TEST_COLLISION;
 			else
 				flags = 0;
-			update_to_display(x, y, width, height,
+			queue_update(x, y, width, height,
 				WAVEFORM_MODE_AUTO, FALSE, flags);
 		}
+
+		if (use_sched && sched_finish() != TPASS)
+			return TFAIL;
 	}
 
 	return retval;
@@ -2049,9 +2122,11 @@ static int test_dithering_y8_y4(void)
 void usage(char *app)
 {
 	printf("EPDC framebuffer driver test program.\n");
-	printf("Usage: mxc_epdc_fb_test [-h] [-a] [-p delay] [-u s/q/m] [-n <expression>]\n");
+	printf("Usage: mxc_epdc_fb_test [-h] [-a] [-s] [-p delay] [-u s/q/m] [-n <expression>]\n");
 	printf("\t-h\t  Print this message\n");
 	printf("\t-a\t  Enabled animation waveforms for fast updates (tests 8-9)\n");
+	printf("\t-s\t  Send fast and stress test updates (tests 9, 14) through\n");
+	printf("\t\t  the update scheduler\n");
 	printf("\t-p\t  Provide a power down delay (in ms) for the EPDC driver\n");
 	printf("\t\t  0 - Immediate (default)\n");
 	printf("\t\t  -1 - Never\n");
@@ -2317,7 +2392,7 @@ main(int argc, char **argv)
 		if (i != 13)
 			test_map[i] = TRUE;
 
-	while ((rt = getopt(argc, argv, "hau:n:p:f:")) >= 0) {
+	while ((rt = getopt(argc, argv, "hasu:n:p:f:")) >= 0) {
 		switch (rt) {
 		case 'h':
 			usage(argv[0]);
@@ -2325,6 +2400,10 @@ main(int argc, char **argv)
 		case 'a':
 			use_animation = 1;
 			break;
+		case 's':
+			use_sched = 1;
+			printf("using update scheduler\n");
+			break;
 		case 'f':
 			num_flashes = atoi(optarg);
 			printf("number of flashes = %d\n", num_flashes);
@@ -0,0 +1,383 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file mxc_fb_blit_test.c
+ *
+ * @brief Image copy throughput into a framebuffer or a file
+ *
+ * Fills the visible screen with tiles of an image, the way the fb tests
+ * load their pictures, and reports MB/s for each rotation: with one thread
+ * and plain stores, with all threads, and with all threads and
+ * non-temporal stores.  For an image file in the screen format the
+ * read() loop fb_test_file() used before is timed too.  Every result is
+ * compared with the single thread one.  The target is /dev/fbN, e.g. vfb
+ * on a host, or any file, so no display is needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+
+#include "fb_surface.h"
+#include "colorbar_rgb_800x600.c"
+
+#define TFAIL -1
+#define TPASS 0
+
+struct target {
+	struct fb_surface img;
+	void *map;
+	size_t map_size;
+	int fd;
+};
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int open_fb(struct target *t, const char *dev)
+{
+	struct fb_var_screeninfo var;
+	struct fb_fix_screeninfo fix;
+	unsigned char *visible;
+	int format;
+
+	t->fd = open(dev, O_RDWR);
+	if (t->fd < 0) {
+		printf("Unable to open %s\n", dev);
+		return TFAIL;
+	}
+	if (ioctl(t->fd, FBIOGET_VSCREENINFO, &var) < 0 ||
+	    ioctl(t->fd, FBIOGET_FSCREENINFO, &fix) < 0) {
+		printf("Unable to read the screen info of %s\n", dev);
+		return TFAIL;
+	}
+	format = fb_surface_fb_format(var.bits_per_pixel);
+	if (format < 0) {
+		printf("Unsupported depth %d\n", var.bits_per_pixel);
+		return TFAIL;
+	}
+
+	t->map_size = fix.smem_len;
+	t->map = mmap(NULL, t->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      t->fd, 0);
+	if (t->map == MAP_FAILED) {
+		printf("Unable to map %s\n", dev);
+		t->map = NULL;
+		return TFAIL;
+	}
+	visible = (unsigned char *)t->map + var.yoffset * fix.line_length +
+		  var.xoffset * var.bits_per_pixel / 8;
+	fb_surface_wrap(&t->img, visible, var.xres, var.yres, fix.line_length,
+			format);
+	return TPASS;
+}
+
+static int open_file(struct target *t, const char *fname, int width,
+		     int height, int format)
+{
+	t->fd = open(fname, O_RDWR | O_CREAT, 0644);
+	if (t->fd < 0) {
+		printf("Unable to open %s\n", fname);
+		return TFAIL;
+	}
+	t->map_size = (size_t)width * height * fb_surface_bpp(format);
+	if (ftruncate(t->fd, t->map_size) < 0) {
+		printf("Unable to size %s\n", fname);
+		return TFAIL;
+	}
+	t->map = mmap(NULL, t->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      t->fd, 0);
+	if (t->map == MAP_FAILED) {
+		printf("Unable to map %s\n", fname);
+		t->map = NULL;
+		return TFAIL;
+	}
+	fb_surface_wrap(&t->img, t->map, width, height, 0, format);
+	return TPASS;
+}
+
+static void clear_target(struct target *t)
+{
+	int y;
+
+	for (y = 0; y < t->img.height; y++)
+		memset(t->img.data + y * t->img.stride, 0,
+		       t->img.width * fb_surface_bpp(t->img.format));
+}
+
+/* Tile the screen with the image, returns bytes written */
+static long fill(const struct fb_surface *src, struct target *t, int rotate,
+		 int threads, unsigned int flags)
+{
+	int w = rotate & 1 ? src->height : src->width;
+	int h = rotate & 1 ? src->width : src->height;
+	long ret, total = 0;
+	int x, y;
+
+	for (y = 0; y < t->img.height; y += h)
+		for (x = 0; x < t->img.width; x += w) {
+			ret = fb_blit(src, 0, 0, src->width, src->height,
+				      &t->img, x, y, rotate, threads, flags);
+			if (ret < 0)
+				return ret;
+			total += ret;
+		}
+	return total;
+}
+
+/* What fb_test_file() did: read() every line of every tile into place */
+static long fill_read(int fd, const struct fb_surface *src, struct target *t)
+{
+	int bpp = fb_surface_bpp(src->format);
+	long total = 0;
+	int x, y, line, w, h;
+
+	for (y = 0; y < t->img.height; y += src->height)
+		for (x = 0; x < t->img.width; x += src->width) {
+			w = t->img.width - x < src->width ?
+				t->img.width - x : src->width;
+			h = t->img.height - y < src->height ?
+				t->img.height - y : src->height;
+			for (line = 0; line < h; line++) {
+				if (lseek(fd, (off_t)line * src->stride,
+					  SEEK_SET) < 0 ||
+				    read(fd, t->img.data +
+					 (y + line) * t->img.stride + x * bpp,
+					 w * bpp) != w * bpp)
+					return -EIO;
+				total += w * bpp;
+			}
+		}
+	return total;
+}
+
+static int same(struct target *t, const unsigned char *ref)
+{
+	int y, len = t->img.width * fb_surface_bpp(t->img.format);
+
+	for (y = 0; y < t->img.height; y++)
+		if (memcmp(t->img.data + y * t->img.stride, ref + y * len, len))
+			return 0;
+	return 1;
+}
+
+static void save(struct target *t, unsigned char *ref)
+{
+	int y, len = t->img.width * fb_surface_bpp(t->img.format);
+
+	for (y = 0; y < t->img.height; y++)
+		memcpy(ref + y * len, t->img.data + y * t->img.stride, len);
+}
+
+static void report(const char *rot, const char *path, int threads,
+		   long bytes, long long us, int loops, const char *check)
+{
+	printf("%-5s %-7s %7d %9.2f %9.1f  %s\n", rot, path, threads,
+		us / 1000.0 / loops, us ? bytes * (double)loops / us : 0.0,
+		check);
+}
+
+static void usage(char *app)
+{
+	printf("Image copy throughput into a framebuffer or a file.\n");
+	printf("Usage: %s [-d fbdev | -f file -W width -H height -F format] "
+		"[-i image.rgb] [-r rotation] [-t threads] [-n loops]\n", app);
+	printf("\t-d\t  framebuffer device (default /dev/fb0)\n");
+	printf("\t-f\t  fill a file instead, created if needed\n");
+	printf("\t-W -H\t  file target geometry (default 1920x1080)\n");
+	printf("\t-F\t  file target format: 565, 888, bgra or y8 "
+		"(default 565)\n");
+	printf("\t-i\t  source <name>-<xres>x<yres>-<format>.rgb "
+		"(default the built in 800x600 colorbar)\n");
+	printf("\t-r\t  0, 90, 180 or 270 (default all)\n");
+	printf("\t-t\t  threads for the threaded runs (default online CPUs)\n");
+	printf("\t-n\t  screens filled per run (default 20)\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const char *rot_names[] = { "0", "90", "180", "270" };
+	static const char *fmt_names[] = { "565", "888", "bgra", "y8" };
+	const char *dev = "/dev/fb0", *fname = NULL, *image = NULL;
+	int width = 1920, height = 1080, format = FB_SURFACE_RGB565;
+	int rotation = -1, threads = 0, loops = 20;
+	struct target t = { .fd = -1 };
+	struct fb_surface src;
+	unsigned char *ref = NULL;
+	long long start, us;
+	long bytes = 0;
+	int i, r, fd = -1, ret = TFAIL, rt;
+
+	while ((rt = getopt(argc, argv, "hd:f:W:H:F:i:r:t:n:")) >= 0) {
+		switch (rt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'f':
+			fname = optarg;
+			break;
+		case 'W':
+			width = atoi(optarg);
+			break;
+		case 'H':
+			height = atoi(optarg);
+			break;
+		case 'F':
+			for (format = 0; format < FB_SURFACE_NUM_FORMATS;
+			     format++)
+				if (!strcmp(optarg, fmt_names[format]))
+					break;
+			break;
+		case 'i':
+			image = optarg;
+			break;
+		case 'r':
+			rotation = atoi(optarg) / 90;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return rt == 'h' ? TPASS : TFAIL;
+		}
+	}
+	if (width <= 0 || height <= 0 || format >= FB_SURFACE_NUM_FORMATS ||
+	    rotation > FB_SURFACE_ROTATE_270 || loops <= 0) {
+		usage(argv[0]);
+		return TFAIL;
+	}
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (image) {
+		if (fb_surface_open_name(&src, image) < 0) {
+			printf("Unable to map %s\n", image);
+			return TFAIL;
+		}
+		fd = open(image, O_RDONLY);
+	} else {
+		fb_surface_wrap(&src, colorbar_rgb_800x600, 800, 600, 0,
+				FB_SURFACE_RGB565);
+	}
+
+	if (fname)
+		rt = open_file(&t, fname, width, height, format);
+	else
+		rt = open_fb(&t, dev);
+	if (rt < 0)
+		goto out;
+
+	ref = malloc((size_t)t.img.width * t.img.height *
+		     fb_surface_bpp(t.img.format));
+	if (!ref)
+		goto out;
+
+	printf("%s %dx%d %s <- %dx%d %s, non-temporal stores: %s\n\n",
+		fname ? fname : dev, t.img.width, t.img.height,
+		fb_surface_format_name(t.img.format), src.width, src.height,
+		fb_surface_format_name(src.format),
+		fb_blit_stream_name() ? fb_blit_stream_name() : "none");
+	printf("%-5s %-7s %7s %9s %9s  %s\n", "rot", "path", "threads",
+		"ms/fill", "MB/s", "check");
+
+	ret = TPASS;
+	for (r = FB_SURFACE_ROTATE_0; r <= FB_SURFACE_ROTATE_270; r++) {
+		if (rotation >= 0 && r != rotation)
+			continue;
+
+		/* Reference: one thread, plain stores */
+		clear_target(&t);
+		start = now_us();
+		for (i = 0; i < loops; i++)
+			bytes = fill(&src, &t, r, 1, 0);
+		us = now_us() - start;
+		if (bytes < 0) {
+			printf("Blit failed: %s\n", strerror(-bytes));
+			ret = TFAIL;
+			break;
+		}
+		save(&t, ref);
+		report(rot_names[r], "plain", 1, bytes, us, loops, "ref");
+
+		clear_target(&t);
+		start = now_us();
+		for (i = 0; i < loops; i++)
+			bytes = fill(&src, &t, r, threads, 0);
+		us = now_us() - start;
+		rt = bytes >= 0 && same(&t, ref);
+		report(rot_names[r], "plain", threads, bytes, us, loops,
+			rt ? "exact" : "MISMATCH");
+		if (!rt)
+			ret = TFAIL;
+
+		if (fb_blit_stream_name()) {
+			clear_target(&t);
+			start = now_us();
+			for (i = 0; i < loops; i++)
+				bytes = fill(&src, &t, r, threads,
+					     FB_BLIT_STREAM);
+			us = now_us() - start;
+			rt = bytes >= 0 && same(&t, ref);
+			report(rot_names[r], "stream", threads, bytes, us,
+				loops, rt ? "exact" : "MISMATCH");
+			if (!rt)
+				ret = TFAIL;
+		}
+
+		if (r == FB_SURFACE_ROTATE_0 && fd >= 0 &&
+		    src.format == t.img.format) {
+			clear_target(&t);
+			start = now_us();
+			for (i = 0; i < loops; i++)
+				bytes = fill_read(fd, &src, &t);
+			us = now_us() - start;
+			rt = bytes >= 0 && same(&t, ref);
+			report(rot_names[r], "read", 1, bytes, us, loops,
+				rt ? "exact" : "MISMATCH");
+			if (!rt)
+				ret = TFAIL;
+		}
+	}
+
+out:
+	free(ref);
+	if (t.map)
+		munmap(t.map, t.map_size);
+	if (t.fd >= 0)
+		close(t.fd);
+	if (fd >= 0)
+		close(fd);
+	fb_surface_close(&src);
+	return ret;
+}
@@ -42,6 +42,8 @@ extern "C"{
 #include <dirent.h>
 #include <getopt.h>
 
+#include "fb_surface.h"
+
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 #define TFAIL -1
@@ -351,9 +353,9 @@ int fb_test_file(struct fb_info *fb, struct img_file* img, int first)
 {
 	int ret = 0;
 	char c = 0;
-	int fd;
 	volatile int delay;
-	size_t fsize = 0, rdsize = 0;
+	long len;
+	struct fb_surface src, dst;
 	struct mxcfb_gbl_alpha gbl_alpha;
 
 	if (img->bpp != 16 && img->bpp != 32) {
@@ -365,22 +367,21 @@ int fb_test_file(struct fb_info *fb, struct img_file* img, int first)
 		return ret;
 	}
 
-	if ((fd = open(img->fname, O_RDONLY, 0)) < 0) {
-		printf("Unable to open img file %s\n", img->fname);
+	if (fb_surface_open(&src, img->fname, img->xres, img->yres, 0,
+			    img->bpp == 16 ? FB_SURFACE_RGB565 : FB_SURFACE_BGRA) < 0) {
+		printf("Unable to map img file %s\n", img->fname);
 		return ret;
 	}
-	fsize = lseek(fd, 0, SEEK_END);
-	if (fsize == 0)
-		return ret;
-	lseek(fd, 0, SEEK_SET);
 
 	// If this is the first test, use a larger virtual screen, for X/Y panning test
 	if (first)
 		ret = set_screen(fb, img->xres, img->yres, img->xres + img->xres / 2, img->yres + img->yres / 2, img->bpp);
 	else
 		ret = set_screen(fb, img->xres, img->yres, img->xres, img->yres, img->bpp);
-	if (ret < 0)
+	if (ret < 0) {
+		fb_surface_close(&src);
 		return ret;
+	}
 	gbl_alpha.enable = 1;
 	if (fb->id == 1)
 		gbl_alpha.alpha = 0x0;
@@ -397,8 +398,9 @@ int fb_test_file(struct fb_info *fb, struct img_file* img, int first)
 		scanf("%c", &c);
 	}
 
-	if (fsize > fb->size) {
-		printf("FB size:%d is smaller than file size: %zd!\n", fb->size, fsize);
+	if (src.map_size > fb->size) {
+		printf("FB size:%d is smaller than file size: %zd!\n", fb->size, src.map_size);
+		fb_surface_close(&src);
 		return ret;
 	}
 	if (fb->id == 1) {
@@ -407,19 +409,15 @@ int fb_test_file(struct fb_info *fb, struct img_file* img, int first)
 	}
 
 	printf("@%s: Using %s to fill the screen...\n", fb->name, img->fname);
-	if (fb->screen_info.xres < fb->screen_info.xres_virtual) {
-		void *fb_ptr = fb->fb;
-		int y;
-		// Copy the image line by line
-		for (y = 0; y < fb->screen_info.yres; y++) {
-			rdsize += read(fd, fb_ptr, (fb->screen_info.xres * (fb->screen_info.bits_per_pixel / 8)));
-			fb_ptr += (fb->screen_info.xres_virtual * (fb->screen_info.bits_per_pixel / 8));
-		}
-		fprintf(stderr, "Read %zd, expected %zd\n", rdsize, fsize);
-	} else {
-		if ((rdsize = read(fd, fb->fb, fsize)) != fsize)
-			fprintf(stderr, "Warning: Read %zd, expected %zd\n", rdsize, fsize);
-	}
+	// Copy the mapped image into the visible part of the virtual screen
+	fb_surface_wrap(&dst, fb->fb, fb->screen_info.xres, fb->screen_info.yres,
+			fb->screen_info.xres_virtual * (fb->screen_info.bits_per_pixel / 8),
+			src.format);
+	len = fb_blit(&src, 0, 0, src.width, src.height, &dst, 0, 0,
+		      FB_SURFACE_ROTATE_0, 0, FB_BLIT_STREAM);
+	if (len != (long)src.width * src.height * (img->bpp / 8))
+		fprintf(stderr, "Warning: Copied %ld, expected %zd\n", len, src.map_size);
+	fb_surface_close(&src);
 	if (fb->id == 1) {
 		if (first) {
 			int i;
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <getopt.h>
 
 /* Verification Test Environment Include Files */
 #include <sys/ioctl.h>
@@ -29,64 +30,172 @@
 
 #include <linux/mxcfb.h>
 #include "../../include/test_utils.h"
+#include "pacing.h"
 
 
-int fd_fb = 0;
-
-
+static void usage(char *app)
+{
+	printf("Usage:\n\n%s <fb #> <count>\n", app);
+	printf("%s [-b fb|drm|sim] [-d device] [-n count] [-f] [-w us] "
+		"[-j us] [-p us] [-J us] [-s seed] [-r] [-H us] [-v]\n\n", app);
+	printf("\t-b\t  backend: fbdev (default), DRM/KMS, or simulated "
+		"vblanks\n");
+	printf("\t-d\t  device (default /dev/fb0 or /dev/dri/card0); with "
+		"-b sim an fbdev to pan, e.g. vfb, in real time\n");
+	printf("\t-n\t  vblanks or frames to time (default 300)\n");
+	printf("\t-f\t  flip: render, pan or page flip, wait for it, "
+		"instead of only waiting for vblanks\n");
+	printf("\t-w -j\t  render time per frame, plus up to -j more, in us\n");
+	printf("\t-p -J\t  sim: refresh period (default 16667) and vblank "
+		"jitter, in us\n");
+	printf("\t-s\t  seed for render times and sim jitter (default 1)\n");
+	printf("\t-r\t  sim: run in real time instead of on a virtual clock\n");
+	printf("\t-H\t  latency histogram step in us (default 1000)\n");
+	printf("\t-v\t  print every sample\n");
+}
 
 int
 main(int argc, char **argv)
 {
-        int count;
-	int i;
-
-        int retval = 0;
+	struct pacing p;
+	struct pacing_result res;
+	struct pacing_fb fb = { .fd = -1 };
+	struct pacing_drm drm = { .fd = -1 };
+	struct pacing_sim sim;
+	char fbdev[] = "/dev/fb0";
+	const char *backend = "fb", *dev = NULL;
+	int period = 16667, vjitter = 0, realtime = 0;
+	long long total_time;
 	unsigned int fps;
-	unsigned int total_time;
-        char fbdev[] = "/dev/fb0";
-        struct timeval tv_start, tv_current;
-
-        print_name(argv);
-
-        if (argc != 3) {
-                printf("Usage:\n\n%s <fb #> <count>\n\n", argv[0]);
-                return -1;
-        }
-
-        count = atoi(argv[2]);
-        fbdev[7] = argv[1][0];
-
-        if ((fd_fb = open(fbdev, O_RDWR, 0)) < 0)
-        {
-                printf("Unable to open %s\n", fbdev);
-                retval = -1;
-                goto err0;
-        }
-
-	gettimeofday(&tv_start, 0);
-	for (i = 0; i < count; i++) {
-	        retval = ioctl(fd_fb, MXCFB_WAIT_FOR_VSYNC, &i);
-        	if (retval < 0)
-        	{
-                	goto err1;
-        	}
+	int retval = 0, rt;
+
+	print_name(argv);
+
+	memset(&p, 0, sizeof(p));
+	p.count = 300;
+	p.seed = 1;
+	p.bucket_us = 1000;
+
+	while ((rt = getopt(argc, argv, "hb:d:n:fw:j:p:J:s:rH:v")) >= 0) {
+		switch (rt) {
+		case 'b':
+			backend = optarg;
+			break;
+		case 'd':
+			dev = optarg;
+			break;
+		case 'n':
+			p.count = atoi(optarg);
+			break;
+		case 'f':
+			p.mode = PACING_FLIP;
+			break;
+		case 'w':
+			p.render_us = atoi(optarg);
+			break;
+		case 'j':
+			p.render_jitter = atoi(optarg);
+			break;
+		case 'p':
+			period = atoi(optarg);
+			break;
+		case 'J':
+			vjitter = atoi(optarg);
+			break;
+		case 's':
+			p.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			realtime = 1;
+			break;
+		case 'H':
+			p.bucket_us = atoi(optarg);
+			break;
+		case 'v':
+			p.verbose = 1;
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return rt == 'h' ? 0 : -1;
+		}
+	}
+
+	/* The original form: <fb #> <count> */
+	if (optind + 2 == argc) {
+		fbdev[7] = argv[optind][0];
+		dev = fbdev;
+		p.count = atoi(argv[optind + 1]);
+	} else if (optind != argc) {
+		usage(argv[0]);
+		return -1;
+	}
+	if (p.count < 2 || p.bucket_us <= 0 || p.render_us < 0 ||
+	    p.render_jitter < 0) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if (!strcmp(backend, "fb")) {
+		retval = pacing_fb_open(&fb, dev ? dev : fbdev,
+					p.mode == PACING_FLIP);
+		p.ops = &pacing_fb_ops;
+		p.priv = &fb;
+	} else if (!strcmp(backend, "drm")) {
+		retval = pacing_drm_open(&drm, dev ? dev : "/dev/dri/card0");
+		p.ops = &pacing_drm_ops;
+		p.priv = &drm;
+	} else if (!strcmp(backend, "sim")) {
+		/* panning a real device only makes sense in real time */
+		if (dev) {
+			realtime = 1;
+			retval = pacing_fb_open(&fb, dev,
+						p.mode == PACING_FLIP);
+		}
+		pacing_sim_init(&sim, period, vjitter, p.seed, realtime);
+		if (dev)
+			sim.fb = &fb;
+		p.ops = &pacing_sim_ops;
+		p.priv = &sim;
+	} else {
+		usage(argv[0]);
+		return -1;
+	}
+	if (retval < 0)
+		goto err0;
+
+	printf("%s: %d %s, render %d+%d us%s\n", p.ops->name, p.count,
+		p.mode == PACING_FLIP ? "flips" : "vblanks", p.render_us,
+		p.render_jitter, p.ops == &pacing_sim_ops && !realtime ?
+		", virtual clock" : "");
+
+	retval = pacing_run(&p);
+	if (retval < 0) {
+		printf("Stopped after %d samples: %s\n", p.nsamples,
+			strerror(-retval));
+		if (retval == -ENOTTY || retval == -EINVAL)
+			printf("No vsync on this device, try -b sim -d %s\n",
+				dev ? dev : fbdev);
+		goto err1;
 	}
-	gettimeofday(&tv_current, 0);
 
-        total_time = (tv_current.tv_sec - tv_start.tv_sec) * 1000000L;
-        total_time += tv_current.tv_usec - tv_start.tv_usec;
-	fps = (i * 1000000ULL) / total_time;
-        printf("total time for %u frames = %u us =  %lld fps\n", i, total_time, (i * 1000000ULL) / total_time);
+	total_time = p.samples[p.nsamples - 1].ev.ts - p.start.ts;
+	if (total_time <= 0)
+		total_time = 1;
+	printf("total time for %u frames = %lld us =  %lld fps\n\n", p.count,
+		total_time, (p.count * 1000000LL) / total_time);
 
+	pacing_report(&p, &res);
+	fps = res.period > 0 ? llround(1e6 / res.period) : 0;
 	if (fps > 45 && fps < 80)
 		retval = 0;
 	else
 		retval = -1;
 
 err1:
-        close(fd_fb);
+	pacing_free(&p);
 err0:
-        return retval;
+	pacing_fb_close(&fb);
+	pacing_drm_close(&drm);
+	return retval;
 }
-
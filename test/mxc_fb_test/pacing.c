@@ -0,0 +1,309 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file pacing.c
+ *
+ * @brief Vsync timing and frame pacing analysis
+ *
+ * The refresh period comes from the vblank counter when the backend has
+ * one, otherwise from the median interval between samples.  Each interval
+ * is then n periods long: n - 1 vblanks were missed by a waiting client,
+ * or a frame stayed on screen for n vblanks.  Jitter is measured on the
+ * intervals one vblank long only, so that missed vblanks do not hide in it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "pacing.h"
+
+#define HIST_ROWS	24
+#define HIST_WIDTH	50
+
+long long pacing_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void pacing_sleep_us(long long us)
+{
+	struct timespec ts;
+
+	if (us <= 0)
+		return;
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+		;
+}
+
+/* Same sequence on every run and every backend for a given seed */
+static int render_time(struct pacing *p)
+{
+	if (!p->render_jitter)
+		return p->render_us;
+	p->seed = p->seed * 1103515245 + 12345;
+	return p->render_us + (p->seed >> 16) % (p->render_jitter + 1);
+}
+
+int pacing_run(struct pacing *p)
+{
+	struct pacing_sample *s;
+	int i, buf = 1, ret;
+
+	p->samples = calloc(p->count, sizeof(*p->samples));
+	if (!p->samples)
+		return -ENOMEM;
+	p->nsamples = 0;
+
+	/* Start right after a vblank */
+	ret = p->ops->wait_vblank(p->priv, &p->start);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < p->count; i++) {
+		s = &p->samples[i];
+		if (p->render_us || p->render_jitter)
+			p->ops->work(p->priv, render_time(p));
+
+		if (p->mode == PACING_FLIP) {
+			s->req = p->ops->now(p->priv);
+			ret = p->ops->flip(p->priv, buf);
+			if (ret < 0)
+				return ret;
+			ret = p->ops->flip_done(p->priv, &s->ev);
+			buf ^= 1;
+		} else {
+			ret = p->ops->wait_vblank(p->priv, &s->ev);
+		}
+		if (ret < 0)
+			return ret;
+		p->nsamples++;
+	}
+	return 0;
+}
+
+void pacing_free(struct pacing *p)
+{
+	free(p->samples);
+	p->samples = NULL;
+	p->nsamples = 0;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Percentile of n sorted values */
+static long long pct(const long long *v, int n, int p)
+{
+	if (!n)
+		return 0;
+	return v[(long long)(n - 1) * p / 100];
+}
+
+static void print_bar(unsigned long n, unsigned long max)
+{
+	int i, len = max ? (n * HIST_WIDTH + max - 1) / max : 0;
+
+	for (i = 0; i < len; i++)
+		putchar('#');
+	putchar('\n');
+}
+
+static void latency_histogram(const long long *lat, int n, int bucket)
+{
+	unsigned long rows[HIST_ROWS];
+	unsigned long max = 0;
+	int i, r, first = HIST_ROWS, last = 0;
+
+	memset(rows, 0, sizeof(rows));
+	for (i = 0; i < n; i++) {
+		r = lat[i] / bucket;
+		if (r >= HIST_ROWS)
+			r = HIST_ROWS - 1;
+		if (r < 0)
+			r = 0;
+		rows[r]++;
+	}
+	for (r = 0; r < HIST_ROWS; r++) {
+		if (!rows[r])
+			continue;
+		if (r < first)
+			first = r;
+		last = r;
+		if (rows[r] > max)
+			max = rows[r];
+	}
+
+	printf("\nflip to vblank latency, ms\n");
+	for (r = first; r <= last; r++) {
+		if (r == HIST_ROWS - 1)
+			printf("  %6.1f+       %6lu ", r * bucket / 1000.0,
+				rows[r]);
+		else
+			printf("  %6.1f-%-6.1f %6lu ", r * bucket / 1000.0,
+				(r + 1) * bucket / 1000.0, rows[r]);
+		print_bar(rows[r], max);
+	}
+}
+
+void pacing_report(const struct pacing *p, struct pacing_result *res)
+{
+	const struct pacing_sample *s = p->samples;
+	long long *d, *k, *v, first, span;
+	unsigned long max = 0;
+	double sum = 0, sq = 0;
+	int i, n = p->nsamples, m = 0, use_seq = 1;
+
+	memset(res, 0, sizeof(*res));
+	if (n < 2) {
+		printf("Not enough samples\n");
+		return;
+	}
+
+	d = calloc(n, sizeof(*d));
+	k = calloc(n, sizeof(*k));
+	v = calloc(n, sizeof(*v));
+	if (!d || !k || !v)
+		goto out;
+
+	for (i = 0; i < n; i++)
+		if (s[i].ev.seq < 0)
+			use_seq = 0;
+	if (use_seq && s[n - 1].ev.seq <= s[0].ev.seq)
+		use_seq = 0;
+
+	/* Intervals, and the period as the median of them */
+	for (i = 1; i < n; i++)
+		v[i - 1] = d[i] = s[i].ev.ts - s[i - 1].ev.ts;
+	qsort(v, n - 1, sizeof(*v), cmp_ll);
+	res->period = v[(n - 2) / 2];
+	if (res->period <= 0) {
+		printf("Timestamps do not advance\n");
+		goto out;
+	}
+
+	/* Vblanks per interval, then the period over the whole run */
+	span = 0;
+	for (i = 1; i < n; i++) {
+		if (use_seq)
+			k[i] = s[i].ev.seq - s[i - 1].ev.seq;
+		else
+			k[i] = llround(d[i] / res->period);
+		if (k[i] < 1)
+			k[i] = 1;
+		span += k[i];
+	}
+	res->period = (double)(s[n - 1].ev.ts - s[0].ev.ts) / span;
+
+	res->period_min = -1;
+	for (i = 1; i < n; i++) {
+		res->intervals++;
+		res->missed += k[i] - 1;
+		res->hold[k[i] > 5 ? 4 : k[i] - 1]++;
+		if (k[i] != 1)
+			continue;
+		sum += d[i];
+		sq += (double)d[i] * d[i];
+		if (res->period_min < 0 || d[i] < res->period_min)
+			res->period_min = d[i];
+		if (d[i] > res->period_max)
+			res->period_max = d[i];
+		v[m++] = llabs(d[i] - llround(res->period));
+	}
+	if (m) {
+		res->period_mean = sum / m;
+		res->period_sd = sqrt(fmax(sq / m - res->period_mean *
+					   res->period_mean, 0));
+		qsort(v, m, sizeof(*v), cmp_ll);
+		res->jitter_p50 = pct(v, m, 50);
+		res->jitter_p99 = pct(v, m, 99);
+		res->jitter_max = v[m - 1];
+	}
+
+	if (p->verbose) {
+		first = s[0].ev.ts;
+		printf("%6s %10s %12s %10s %4s %10s\n", "sample", "vblank",
+			"time ms", "interval", "n", "latency");
+		for (i = 0; i < n; i++) {
+			printf("%6d %10lld %12.3f %10lld %4lld", i, s[i].ev.seq,
+				(s[i].ev.ts - first) / 1000.0,
+				i ? d[i] : 0, i ? k[i] : 0);
+			if (p->mode == PACING_FLIP)
+				printf(" %10lld", s[i].ev.ts - s[i].req);
+			printf("\n");
+		}
+		printf("\n");
+	}
+
+	printf("refresh %.3f Hz, period %.1f us (%s)\n", 1e6 / res->period,
+		res->period, use_seq ? "vblank counter" : "median interval");
+	printf("%lu intervals, %lu one vblank long: mean %.1f us, sd %.1f us, "
+		"min %lld, max %lld\n", res->intervals, (unsigned long)m,
+		res->period_mean, res->period_sd, res->period_min,
+		res->period_max);
+	printf("jitter |interval - period|: p50 %lld us, p99 %lld us, "
+		"max %lld us\n", res->jitter_p50, res->jitter_p99,
+		res->jitter_max);
+	printf("%s: %lu\n", p->mode == PACING_FLIP ?
+		"repeated frames (vblanks without a new frame)" :
+		"missed vblanks", res->missed);
+
+	printf("\n%s\n", p->mode == PACING_FLIP ?
+		"frames on screen for" : "waits spanning");
+	for (i = 0; i < 5; i++)
+		if (res->hold[i] > max)
+			max = res->hold[i];
+	for (i = 0; i < 5; i++) {
+		printf("  %d%s vblank%s %6lu ", i + 1, i == 4 ? "+" : " ",
+			i ? "s" : " ", res->hold[i]);
+		print_bar(res->hold[i], max);
+	}
+
+	if (p->mode == PACING_FLIP) {
+		sum = 0;
+		for (i = 0; i < n; i++) {
+			v[i] = s[i].ev.ts - s[i].req;
+			sum += v[i];
+		}
+		res->lat_mean = sum / n;
+		latency_histogram(v, n, p->bucket_us);
+		qsort(v, n, sizeof(*v), cmp_ll);
+		res->lat_p50 = pct(v, n, 50);
+		res->lat_p90 = pct(v, n, 90);
+		res->lat_p99 = pct(v, n, 99);
+		res->lat_max = v[n - 1];
+		printf("latency: mean %.1f us, p50 %lld, p90 %lld, p99 %lld, "
+			"max %lld us\n", res->lat_mean, res->lat_p50,
+			res->lat_p90, res->lat_p99, res->lat_max);
+	}
+
+out:
+	free(d);
+	free(k);
+	free(v);
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file pacing.h
+ *
+ * @brief Vsync timing and frame pacing analysis
+ *
+ * Every vblank a client waits for, and every flip it makes, is time
+ * stamped.  From those the analyser derives the refresh period and its
+ * jitter, the vblanks that went by unseen, the latency from a flip request
+ * to the vblank that shows it, and for how many vblanks each frame stayed
+ * on screen, which is what judder is made of.
+ *
+ * Backends: fbdev (vsync ioctl and FBIOPAN_DISPLAY), DRM/KMS (vblank
+ * events and page flips) and a simulated vblank source.  The simulator
+ * runs on a virtual clock, so its results only depend on the seed, or in
+ * real time, so that pans can be sent to a device without vsync such as
+ * vfb.
+ */
+
+#ifndef PACING_H
+#define PACING_H
+
+#include <stdint.h>
+#include <linux/fb.h>
+
+struct pacing_event {
+	long long ts;			/* microseconds, CLOCK_MONOTONIC */
+	long long seq;			/* vblank counter, -1 if unknown */
+};
+
+struct pacing_ops {
+	const char *name;
+	/* Block until the next vblank */
+	int (*wait_vblank)(void *priv, struct pacing_event *ev);
+	/* Queue buffer 0 or 1 for scan out from the next vblank on */
+	int (*flip)(void *priv, int buf);
+	/* Block until the last flip is on screen; ev is that vblank */
+	int (*flip_done)(void *priv, struct pacing_event *ev);
+	/* Current time in microseconds */
+	long long (*now)(void *priv);
+	/* Spend us microseconds, e.g. rendering a frame */
+	void (*work)(void *priv, long long us);
+};
+
+enum pacing_mode {
+	PACING_VSYNC,			/* wait for every vblank */
+	PACING_FLIP,			/* render, flip, wait for the flip */
+};
+
+struct pacing_sample {
+	long long req;			/* flip requested, flip mode only */
+	struct pacing_event ev;
+};
+
+struct pacing {
+	const struct pacing_ops *ops;
+	void *priv;
+	int mode;
+	int count;
+	/* client model: render time plus up to render_jitter more */
+	int render_us;
+	int render_jitter;
+	unsigned int seed;
+	int bucket_us;			/* latency histogram resolution */
+	int verbose;			/* print every sample */
+	struct pacing_sample *samples;
+	int nsamples;
+	struct pacing_event start;	/* vblank the run started after */
+};
+
+struct pacing_result {
+	double period;			/* nominal refresh period, us */
+	double period_mean;		/* of intervals one vblank long */
+	double period_sd;
+	long long period_min, period_max;
+	long long jitter_p50, jitter_p99, jitter_max;
+	unsigned long intervals;
+	unsigned long missed;		/* vblanks not seen, or repeats */
+	unsigned long hold[5];		/* frames shown 1, 2, 3, 4, 5+ vblanks */
+	long long lat_p50, lat_p90, lat_p99, lat_max;
+	double lat_mean;
+};
+
+/* Collect count samples; returns 0 or a negative errno value */
+int pacing_run(struct pacing *p);
+/* Analyse and print what pacing_run() collected */
+void pacing_report(const struct pacing *p, struct pacing_result *res);
+void pacing_free(struct pacing *p);
+
+/* Helpers for backends that run on the real clock */
+long long pacing_now_us(void);
+void pacing_sleep_us(long long us);
+
+/* fbdev backend, pacing_fb.c */
+struct pacing_fb {
+	int fd;
+	struct fb_var_screeninfo var;
+	int can_flip;
+};
+
+extern const struct pacing_ops pacing_fb_ops;
+/* flip: set up two buffers for panning, growing yres_virtual if needed */
+int pacing_fb_open(struct pacing_fb *fb, const char *dev, int flip);
+void pacing_fb_close(struct pacing_fb *fb);
+
+/* DRM/KMS backend, pacing_drm.c */
+struct pacing_drm_buf {
+	uint32_t handle;
+	uint32_t fb_id;
+	uint32_t pitch;
+	uint64_t size;
+	void *map;
+};
+
+struct pacing_drm {
+	int fd;
+	uint32_t conn_id;
+	uint32_t crtc_id;
+	int pipe;			/* index of the CRTC, for vblank waits */
+	void *mode;			/* drmModeModeInfo */
+	void *saved_crtc;		/* drmModeCrtc restored on close */
+	struct pacing_drm_buf buf[2];
+	int flip_pending;
+	struct pacing_event flip_ev;
+};
+
+extern const struct pacing_ops pacing_drm_ops;
+int pacing_drm_open(struct pacing_drm *drm, const char *dev);
+void pacing_drm_close(struct pacing_drm *drm);
+
+/* Simulated vblank source, pacing_sim.c */
+struct pacing_sim {
+	int period;			/* us */
+	int jitter;			/* vblank timestamps move up to +/- this */
+	unsigned int seed;
+	int realtime;			/* sleep until each vblank */
+	struct pacing_fb *fb;		/* optional device to pan, e.g. vfb */
+	long long t0;
+	long long now;			/* virtual clock */
+	long long seq;			/* last vblank delivered */
+	int flip_pending;
+};
+
+extern const struct pacing_ops pacing_sim_ops;
+void pacing_sim_init(struct pacing_sim *sim, int period, int jitter,
+		     unsigned int seed, int realtime);
+
+#endif
@@ -0,0 +1,320 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file pacing_drm.c
+ *
+ * @brief DRM/KMS backend of the frame pacing analyser
+ *
+ * Takes the first connected connector with its preferred mode and scans
+ * out one of two dumb buffers.  Vblank waits and page flip events carry
+ * the kernel's own vblank timestamp and counter, so the analyser sees
+ * exactly which vblank each frame went out on, not when the process
+ * happened to wake up.  Works on vkms as well as on real hardware.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#include <drm/drm.h>
+#include <drm/drm_mode.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "pacing.h"
+
+static unsigned int vblank_pipe(const struct pacing_drm *drm)
+{
+	if (drm->pipe == 1)
+		return DRM_VBLANK_SECONDARY;
+	if (drm->pipe > 1)
+		return (drm->pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) &
+		       DRM_VBLANK_HIGH_CRTC_MASK;
+	return 0;
+}
+
+static int drm_wait_vblank(void *priv, struct pacing_event *ev)
+{
+	struct pacing_drm *drm = priv;
+	drmVBlank vbl;
+
+	memset(&vbl, 0, sizeof(vbl));
+	vbl.request.type = DRM_VBLANK_RELATIVE | vblank_pipe(drm);
+	vbl.request.sequence = 1;
+	if (drmWaitVBlank(drm->fd, &vbl) < 0)
+		return -errno;
+	ev->ts = vbl.reply.tval_sec * 1000000LL + vbl.reply.tval_usec;
+	ev->seq = vbl.reply.sequence;
+	return 0;
+}
+
+static int drm_flip(void *priv, int buf)
+{
+	struct pacing_drm *drm = priv;
+
+	if (drmModePageFlip(drm->fd, drm->crtc_id, drm->buf[buf].fb_id,
+			    DRM_MODE_PAGE_FLIP_EVENT, drm) < 0)
+		return -errno;
+	drm->flip_pending = 1;
+	return 0;
+}
+
+static void page_flip_handler(int fd, unsigned int sequence,
+			      unsigned int tv_sec, unsigned int tv_usec,
+			      void *data)
+{
+	struct pacing_drm *drm = data;
+
+	drm->flip_ev.ts = tv_sec * 1000000LL + tv_usec;
+	drm->flip_ev.seq = sequence;
+	drm->flip_pending = 0;
+}
+
+static int drm_flip_done(void *priv, struct pacing_event *ev)
+{
+	struct pacing_drm *drm = priv;
+	drmEventContext evctx;
+	struct pollfd pfd;
+
+	memset(&evctx, 0, sizeof(evctx));
+	evctx.version = 2;
+	evctx.page_flip_handler = page_flip_handler;
+	pfd.fd = drm->fd;
+	pfd.events = POLLIN;
+
+	while (drm->flip_pending) {
+		/* a second is a lot of vblanks, the flip is lost */
+		if (poll(&pfd, 1, 1000) <= 0)
+			return -ETIMEDOUT;
+		if (drmHandleEvent(drm->fd, &evctx) < 0)
+			return -EIO;
+	}
+	*ev = drm->flip_ev;
+	return 0;
+}
+
+static long long drm_now(void *priv)
+{
+	return pacing_now_us();
+}
+
+static void drm_work(void *priv, long long us)
+{
+	pacing_sleep_us(us);
+}
+
+const struct pacing_ops pacing_drm_ops = {
+	.name = "drm",
+	.wait_vblank = drm_wait_vblank,
+	.flip = drm_flip,
+	.flip_done = drm_flip_done,
+	.now = drm_now,
+	.work = drm_work,
+};
+
+static int find_crtc(struct pacing_drm *drm, drmModeRes *res,
+		     drmModeConnector *conn)
+{
+	drmModeEncoder *enc;
+	int i, j;
+
+	/* keep the CRTC already driving the connector if there is one */
+	enc = drmModeGetEncoder(drm->fd, conn->encoder_id);
+	if (enc) {
+		drm->crtc_id = enc->crtc_id;
+		drmModeFreeEncoder(enc);
+	}
+	for (i = 0; !drm->crtc_id && i < conn->count_encoders; i++) {
+		enc = drmModeGetEncoder(drm->fd, conn->encoders[i]);
+		if (!enc)
+			continue;
+		for (j = 0; j < res->count_crtcs; j++)
+			if (enc->possible_crtcs & (1 << j)) {
+				drm->crtc_id = res->crtcs[j];
+				break;
+			}
+		drmModeFreeEncoder(enc);
+	}
+	if (!drm->crtc_id)
+		return -ENOENT;
+
+	for (i = 0; i < res->count_crtcs; i++)
+		if (res->crtcs[i] == drm->crtc_id)
+			drm->pipe = i;
+	return 0;
+}
+
+static int create_buf(struct pacing_drm *drm, struct pacing_drm_buf *buf,
+		      int width, int height)
+{
+	struct drm_mode_create_dumb creq;
+	struct drm_mode_destroy_dumb dreq;
+	struct drm_mode_map_dumb mreq;
+
+	memset(&creq, 0, sizeof(creq));
+	creq.width = width;
+	creq.height = height;
+	creq.bpp = 32;
+	if (drmIoctl(drm->fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0)
+		return -errno;
+	buf->handle = creq.handle;
+	buf->pitch = creq.pitch;
+	buf->size = creq.size;
+
+	if (drmModeAddFB(drm->fd, width, height, 24, 32, buf->pitch,
+			 buf->handle, &buf->fb_id) < 0)
+		goto destroy;
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.handle = buf->handle;
+	if (drmIoctl(drm->fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) < 0)
+		goto remove;
+	buf->map = mmap(NULL, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			drm->fd, mreq.offset);
+	if (buf->map == MAP_FAILED)
+		goto remove;
+	memset(buf->map, 0, buf->size);
+	return 0;
+
+remove:
+	drmModeRmFB(drm->fd, buf->fb_id);
+destroy:
+	memset(&dreq, 0, sizeof(dreq));
+	dreq.handle = buf->handle;
+	drmIoctl(drm->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+	memset(buf, 0, sizeof(*buf));
+	return -ENOMEM;
+}
+
+static void destroy_buf(struct pacing_drm *drm, struct pacing_drm_buf *buf)
+{
+	struct drm_mode_destroy_dumb dreq;
+
+	if (!buf->handle)
+		return;
+	munmap(buf->map, buf->size);
+	drmModeRmFB(drm->fd, buf->fb_id);
+	memset(&dreq, 0, sizeof(dreq));
+	dreq.handle = buf->handle;
+	drmIoctl(drm->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+	memset(buf, 0, sizeof(*buf));
+}
+
+int pacing_drm_open(struct pacing_drm *drm, const char *dev)
+{
+	drmModeRes *res;
+	drmModeConnector *conn = NULL;
+	drmModeModeInfo *mode;
+	int i, ret = -ENODEV;
+
+	memset(drm, 0, sizeof(*drm));
+	drm->fd = open(dev, O_RDWR | O_CLOEXEC);
+	if (drm->fd < 0) {
+		printf("Unable to open %s\n", dev);
+		return -errno;
+	}
+	if (drmSetMaster(drm->fd) < 0)
+		printf("Not DRM master, the mode set may fail\n");
+
+	res = drmModeGetResources(drm->fd);
+	if (!res) {
+		printf("Cannot retrieve DRM resources\n");
+		goto err;
+	}
+	for (i = 0; i < res->count_connectors; i++) {
+		conn = drmModeGetConnector(drm->fd, res->connectors[i]);
+		if (conn && conn->connection == DRM_MODE_CONNECTED &&
+		    conn->count_modes > 0 && !find_crtc(drm, res, conn))
+			break;
+		drmModeFreeConnector(conn);
+		conn = NULL;
+	}
+	drmModeFreeResources(res);
+	if (!conn) {
+		printf("No connected output with a free CRTC\n");
+		goto err;
+	}
+
+	drm->conn_id = conn->connector_id;
+	mode = malloc(sizeof(*mode));
+	if (!mode) {
+		drmModeFreeConnector(conn);
+		ret = -ENOMEM;
+		goto err;
+	}
+	*mode = conn->modes[0];
+	drm->mode = mode;
+	drmModeFreeConnector(conn);
+
+	for (i = 0; i < 2; i++) {
+		ret = create_buf(drm, &drm->buf[i], mode->hdisplay,
+				 mode->vdisplay);
+		if (ret < 0) {
+			printf("Cannot create a %dx%d dumb buffer\n",
+				mode->hdisplay, mode->vdisplay);
+			goto err;
+		}
+	}
+
+	drm->saved_crtc = drmModeGetCrtc(drm->fd, drm->crtc_id);
+	if (drmModeSetCrtc(drm->fd, drm->crtc_id, drm->buf[0].fb_id, 0, 0,
+			   &drm->conn_id, 1, mode) < 0) {
+		printf("Cannot set mode %s on CRTC %u\n", mode->name,
+			drm->crtc_id);
+		ret = -errno;
+		goto err;
+	}
+	printf("%s: %s %.2f Hz on CRTC %u (pipe %d)\n", dev, mode->name,
+		mode->clock * 1000.0 / (mode->htotal * mode->vtotal),
+		drm->crtc_id, drm->pipe);
+	return 0;
+
+err:
+	pacing_drm_close(drm);
+	return ret;
+}
+
+void pacing_drm_close(struct pacing_drm *drm)
+{
+	drmModeCrtc *crtc = drm->saved_crtc;
+	struct pacing_event ev;
+
+	if (drm->fd < 0)
+		return;
+	if (drm->flip_pending)
+		drm_flip_done(drm, &ev);
+	if (crtc) {
+		if (crtc->mode_valid)
+			drmModeSetCrtc(drm->fd, crtc->crtc_id, crtc->buffer_id,
+				       crtc->x, crtc->y, &drm->conn_id, 1,
+				       &crtc->mode);
+		else
+			drmModeSetCrtc(drm->fd, crtc->crtc_id, 0, 0, 0, NULL,
+				       0, NULL);
+		drmModeFreeCrtc(crtc);
+	}
+	destroy_buf(drm, &drm->buf[0]);
+	destroy_buf(drm, &drm->buf[1]);
+	free(drm->mode);
+	drmDropMaster(drm->fd);
+	close(drm->fd);
+	drm->fd = -1;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file pacing_fb.c
+ *
+ * @brief fbdev backend of the frame pacing analyser
+ *
+ * Vblanks come from MXCFB_WAIT_FOR_VSYNC, which is FBIO_WAITFORVSYNC for
+ * other drivers too, and are time stamped when the ioctl returns; fbdev
+ * has no vblank counter.  A flip pans between the two halves of the virtual
+ * screen and is on screen at the vblank that follows it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/mxcfb.h>
+
+#include "pacing.h"
+
+static int fb_wait_vblank(void *priv, struct pacing_event *ev)
+{
+	struct pacing_fb *fb = priv;
+	__u32 crtc = 0;
+
+	if (ioctl(fb->fd, MXCFB_WAIT_FOR_VSYNC, &crtc) < 0)
+		return -errno;
+	ev->ts = pacing_now_us();
+	ev->seq = -1;
+	return 0;
+}
+
+static int fb_flip(void *priv, int buf)
+{
+	struct pacing_fb *fb = priv;
+
+	if (!fb->can_flip)
+		return -EINVAL;
+	fb->var.xoffset = 0;
+	fb->var.yoffset = buf * fb->var.yres;
+	if (ioctl(fb->fd, FBIOPAN_DISPLAY, &fb->var) < 0)
+		return -errno;
+	return 0;
+}
+
+static long long fb_now(void *priv)
+{
+	return pacing_now_us();
+}
+
+static void fb_work(void *priv, long long us)
+{
+	pacing_sleep_us(us);
+}
+
+const struct pacing_ops pacing_fb_ops = {
+	.name = "fbdev",
+	.wait_vblank = fb_wait_vblank,
+	.flip = fb_flip,
+	.flip_done = fb_wait_vblank,
+	.now = fb_now,
+	.work = fb_work,
+};
+
+int pacing_fb_open(struct pacing_fb *fb, const char *dev, int flip)
+{
+	struct fb_fix_screeninfo fix;
+	void *map;
+	size_t size;
+
+	memset(fb, 0, sizeof(*fb));
+	fb->fd = open(dev, O_RDWR);
+	if (fb->fd < 0) {
+		printf("Unable to open %s\n", dev);
+		return -errno;
+	}
+	if (ioctl(fb->fd, FBIOGET_VSCREENINFO, &fb->var) < 0)
+		goto err;
+	if (!flip)
+		return 0;
+
+	if (fb->var.yres_virtual < 2 * fb->var.yres) {
+		fb->var.yres_virtual = 2 * fb->var.yres;
+		if (ioctl(fb->fd, FBIOPUT_VSCREENINFO, &fb->var) < 0 ||
+		    ioctl(fb->fd, FBIOGET_VSCREENINFO, &fb->var) < 0 ||
+		    fb->var.yres_virtual < 2 * fb->var.yres) {
+			printf("%s cannot hold two buffers\n", dev);
+			goto err;
+		}
+	}
+	if (ioctl(fb->fd, FBIOGET_FSCREENINFO, &fix) < 0)
+		goto err;
+
+	/* Both buffers black, so that only the timing changes on screen */
+	size = (size_t)fix.line_length * 2 * fb->var.yres;
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fb->fd, 0);
+	if (map != MAP_FAILED) {
+		memset(map, 0, size);
+		munmap(map, size);
+	}
+	fb->can_flip = 1;
+	return 0;
+
+err:
+	close(fb->fd);
+	fb->fd = -1;
+	return -EINVAL;
+}
+
+void pacing_fb_close(struct pacing_fb *fb)
+{
+	if (fb->fd < 0)
+		return;
+	if (fb->can_flip) {
+		fb->var.yoffset = 0;
+		ioctl(fb->fd, FBIOPAN_DISPLAY, &fb->var);
+	}
+	close(fb->fd);
+	fb->fd = -1;
+}
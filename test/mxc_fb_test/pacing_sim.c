@@ -0,0 +1,150 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file pacing_sim.c
+ *
+ * @brief Simulated vblank source for the frame pacing analyser
+ *
+ * Vblank k happens at t0 + k * period, moved by a pseudo random amount
+ * that only depends on the seed and k.  On the virtual clock the client's
+ * render time simply advances the clock, so a run is the same on every
+ * machine.  In real time the simulator sleeps until each vblank, which
+ * gives vfb the vsync it does not have; flips are then also panned on the
+ * device when one is attached.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "pacing.h"
+
+static unsigned int mix(unsigned int x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+static long long vblank_time(const struct pacing_sim *sim, long long k)
+{
+	long long t = sim->t0 + k * sim->period;
+
+	if (sim->jitter)
+		t += (long long)(mix(sim->seed ^ (unsigned int)k * 0x9e3779b9) %
+				 (2 * sim->jitter + 1)) - sim->jitter;
+	return t;
+}
+
+static long long sim_now(void *priv)
+{
+	struct pacing_sim *sim = priv;
+
+	return sim->realtime ? pacing_now_us() : sim->now;
+}
+
+static void sim_work(void *priv, long long us)
+{
+	struct pacing_sim *sim = priv;
+
+	if (sim->realtime)
+		pacing_sleep_us(us);
+	else
+		sim->now += us;
+}
+
+/* First vblank after now, never one delivered already */
+static int sim_wait_vblank(void *priv, struct pacing_event *ev)
+{
+	struct pacing_sim *sim = priv;
+	long long now = sim_now(sim), k;
+	struct timespec ts;
+
+	k = (now - sim->t0 - sim->jitter) / sim->period;
+	if (k <= sim->seq)
+		k = sim->seq + 1;
+	while (vblank_time(sim, k) <= now)
+		k++;
+
+	ev->ts = vblank_time(sim, k);
+	ev->seq = k;
+	sim->seq = k;
+	if (sim->realtime) {
+		ts.tv_sec = ev->ts / 1000000;
+		ts.tv_nsec = ev->ts % 1000000 * 1000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL) == EINTR)
+			;
+	} else {
+		sim->now = ev->ts;
+	}
+	return 0;
+}
+
+static int sim_flip(void *priv, int buf)
+{
+	struct pacing_sim *sim = priv;
+	int ret;
+
+	if (sim->fb) {
+		ret = pacing_fb_ops.flip(sim->fb, buf);
+		if (ret < 0)
+			return ret;
+	}
+	sim->flip_pending = 1;
+	return 0;
+}
+
+/* A flip is latched at the first vblank after it was queued */
+static int sim_flip_done(void *priv, struct pacing_event *ev)
+{
+	struct pacing_sim *sim = priv;
+
+	if (!sim->flip_pending)
+		return -EINVAL;
+	sim->flip_pending = 0;
+	return sim_wait_vblank(sim, ev);
+}
+
+const struct pacing_ops pacing_sim_ops = {
+	.name = "sim",
+	.wait_vblank = sim_wait_vblank,
+	.flip = sim_flip,
+	.flip_done = sim_flip_done,
+	.now = sim_now,
+	.work = sim_work,
+};
+
+void pacing_sim_init(struct pacing_sim *sim, int period, int jitter,
+		     unsigned int seed, int realtime)
+{
+	memset(sim, 0, sizeof(*sim));
+	sim->period = period > 0 ? period : 16667;
+	/* vblanks must stay in order */
+	if (jitter < 0)
+		jitter = 0;
+	if (jitter > (sim->period - 1) / 2)
+		jitter = (sim->period - 1) / 2;
+	sim->jitter = jitter;
+	sim->seed = seed;
+	sim->realtime = realtime;
+	sim->t0 = realtime ? pacing_now_us() : 0;
+	sim->seq = -1;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2017 NXP
+ *
+ */
+
+/*
+ * The code contained herein is licensed under the GNU Lesser General
+ * Public License.  You may obtain a copy of the GNU Lesser General
+ * Public License Version 2.1 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/lgpl-license.html
+ * http://www.gnu.org/copyleft/lgpl.html
+ */
+
+/*!
+ * @file ipu_dev.c
+ *
+ * @brief IPU task backend selection and the /dev/mxc_ipu backend
+ *
+ * @ingroup IPU
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "ipu_dev.h"
+
+static int hw_open(struct ipu_dev *dev)
+{
+	dev->fd = open("/dev/mxc_ipu", O_RDWR, 0);
+	if (dev->fd < 0) {
+		printf("open ipu dev fail\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void hw_close(struct ipu_dev *dev)
+{
+	close(dev->fd);
+}
+
+static int hw_alloc(struct ipu_dev *dev, struct ipu_buf *buf, int size)
+{
+	/* IPU_ALLOC takes the size and gives back the address */
+	buf->paddr = size;
+	if (ioctl(dev->fd, IPU_ALLOC, &buf->paddr) < 0) {
+		printf("ioctl IPU_ALLOC fail\n");
+		buf->paddr = 0;
+		return -1;
+	}
+	buf->vaddr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			  dev->fd, buf->paddr);
+	if (buf->vaddr == MAP_FAILED) {
+		printf("mmap fail\n");
+		ioctl(dev->fd, IPU_FREE, &buf->paddr);
+		buf->paddr = 0;
+		buf->vaddr = NULL;
+		return -1;
+	}
+	buf->size = size;
+	return 0;
+}
+
+static void hw_free(struct ipu_dev *dev, struct ipu_buf *buf)
+{
+	if (!buf->paddr)
+		return;
+	munmap(buf->vaddr, buf->size);
+	ioctl(dev->fd, IPU_FREE, &buf->paddr);
+	memset(buf, 0, sizeof(*buf));
+}
+
+static int hw_check(struct ipu_dev *dev, struct ipu_task *t)
+{
+	return ioctl(dev->fd, IPU_CHECK_TASK, t);
+}
+
+static int hw_queue(struct ipu_dev *dev, struct ipu_task *t)
+{
+	return ioctl(dev->fd, IPU_QUEUE_TASK, t);
+}
+
+const struct ipu_dev_ops ipu_hw_ops = {
+	.name = "hw",
+	.open = hw_open,
+	.close = hw_close,
+	.alloc = hw_alloc,
+	.free = hw_free,
+	.check = hw_check,
+	.queue = hw_queue,
+};
+
+int ipu_dev_open(struct ipu_dev *dev, const char *name)
+{
+	memset(dev, 0, sizeof(*dev));
+	dev->fd = -1;
+	pthread_mutex_init(&dev->lock, NULL);
+
+	if (!name || !*name || !strcmp(name, "hw"))
+		dev->ops = &ipu_hw_ops;
+	else if (!strcmp(name, "sw"))
+		dev->ops = &ipu_sw_ops;
+	else {
+		printf("unknown backend %s, use hw or sw\n", name);
+		return -1;
+	}
+	if (dev->ops->open(dev) < 0) {
+		dev->ops = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+void ipu_dev_close(struct ipu_dev *dev)
+{
+	if (dev->ops)
+		dev->ops->close(dev);
+	dev->ops = NULL;
+	pthread_mutex_destroy(&dev->lock);
+}
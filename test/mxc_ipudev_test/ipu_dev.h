@@ -0,0 +1,70 @@
+/*
+ * Copyright 2017 NXP
+ *
+ */
+
+/*
+ * The code contained herein is licensed under the GNU Lesser General
+ * Public License.  You may obtain a copy of the GNU Lesser General
+ * Public License Version 2.1 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/lgpl-license.html
+ * http://www.gnu.org/copyleft/lgpl.html
+ */
+
+/*!
+ * @file ipu_dev.h
+ *
+ * @brief IPU task backends: /dev/mxc_ipu, or the CPU
+ *
+ * The software backend does colour space conversion, resizing and the
+ * eight IPU rotate/flip modes on the CPU, so conversions can be checked and
+ * timed on a part, or a PC, without an IPU.  Overlay and deinterlacing are
+ * only done by the hardware.
+ *
+ * @ingroup IPU
+ */
+#ifndef __IPU_DEV_H__
+#define __IPU_DEV_H__
+
+#include <pthread.h>
+#include <linux/ipu.h>
+
+#define IPU_SW_MAX_BUF	64
+
+struct ipu_buf {
+	dma_addr_t paddr;
+	void *vaddr;
+	int size;
+};
+
+struct ipu_dev;
+
+struct ipu_dev_ops {
+	const char *name;
+	int (*open)(struct ipu_dev *dev);
+	void (*close)(struct ipu_dev *dev);
+	int (*alloc)(struct ipu_dev *dev, struct ipu_buf *buf, int size);
+	void (*free)(struct ipu_dev *dev, struct ipu_buf *buf);
+	/* IPU_CHECK_TASK: IPU_CHECK_OK, a warning or an IPU_CHECK_ERR_* */
+	int (*check)(struct ipu_dev *dev, struct ipu_task *t);
+	/* IPU_QUEUE_TASK, returns when the task is done; may run in parallel */
+	int (*queue)(struct ipu_dev *dev, struct ipu_task *t);
+};
+
+struct ipu_dev {
+	const struct ipu_dev_ops *ops;
+	int fd;
+	/* software backend: "physical" address n is buf[n - 1] */
+	pthread_mutex_t lock;
+	struct ipu_buf *buf[IPU_SW_MAX_BUF];
+};
+
+extern const struct ipu_dev_ops ipu_hw_ops;
+extern const struct ipu_dev_ops ipu_sw_ops;
+
+/* name is "hw" or "sw" */
+int ipu_dev_open(struct ipu_dev *dev, const char *name);
+void ipu_dev_close(struct ipu_dev *dev);
+
+#endif
@@ -0,0 +1,409 @@
+/*
+ * Copyright 2017 NXP
+ *
+ */
+
+/*
+ * The code contained herein is licensed under the GNU Lesser General
+ * Public License.  You may obtain a copy of the GNU Lesser General
+ * Public License Version 2.1 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/lgpl-license.html
+ * http://www.gnu.org/copyleft/lgpl.html
+ */
+
+/*!
+ * @file ipu_pipeline.c
+ *
+ * @brief Pipelined IPU task executor
+ *
+ * @ingroup IPU
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "ipu_pipeline.h"
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static const char *task_id_name(int id)
+{
+	return id == IPU_TASK_ID_VF ? "vf" : id == IPU_TASK_ID_PP ? "pp" : "any";
+}
+
+int ipu_pipeline_init(struct ipu_pipeline *p, struct ipu_dev *dev,
+		      const struct ipu_task *t, int isize, int osize,
+		      dma_addr_t out_paddr, int tasks)
+{
+	struct ipu_slot *s;
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	p->dev = dev;
+	p->task = *t;
+	p->isize = isize;
+	p->osize = osize;
+	p->vdi = t->input.deinterlace.enable &&
+		 t->input.deinterlace.motion != HIGH_MOTION;
+	p->tasks = tasks < 1 ? 1 : tasks > IPU_PIPE_MAX_TASKS ?
+		   IPU_PIPE_MAX_TASKS : tasks;
+	/* one slot being read and one being written besides the tasks */
+	p->nr_slot = p->tasks + 2;
+	p->fcount = 1;
+	p->loops = 1;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+
+	for (i = 0; i < p->nr_slot; i++) {
+		s = &p->slot[i];
+		if (dev->ops->alloc(dev, &s->in, isize) < 0)
+			return -1;
+		if (p->vdi && dev->ops->alloc(dev, &s->in_n, isize) < 0)
+			return -1;
+		if (out_paddr)
+			s->out.paddr = out_paddr;
+		else if (dev->ops->alloc(dev, &s->out, osize) < 0)
+			return -1;
+	}
+	for (i = 0; i < p->tasks; i++)
+		p->task_id[i] = t->task_id;
+
+	p->reader.name = "read";
+	p->writer.name = "write";
+	for (i = 0; i < p->tasks; i++)
+		p->task_stage[i].name = "task";
+	return 0;
+}
+
+static void set_buffers(struct ipu_task *t, const struct ipu_slot *s)
+{
+	t->input.paddr = s->in.paddr;
+	t->input.paddr_n = s->in_n.paddr;
+	t->output.paddr = s->out.paddr;
+}
+
+int ipu_pipeline_check(struct ipu_pipeline *p)
+{
+	struct ipu_task *t = &p->task, t2;
+	int ret, i, id;
+
+	set_buffers(t, &p->slot[0]);
+again:
+	ret = p->dev->ops->check(p->dev, t);
+	if (ret != IPU_CHECK_OK) {
+		if (ret > IPU_CHECK_ERR_MIN) {
+			if (ret == IPU_CHECK_ERR_SPLIT_INPUTW_OVER) {
+				t->input.crop.w -= 8;
+				goto again;
+			}
+			if (ret == IPU_CHECK_ERR_SPLIT_INPUTH_OVER) {
+				t->input.crop.h -= 8;
+				goto again;
+			}
+			if (ret == IPU_CHECK_ERR_SPLIT_OUTPUTW_OVER) {
+				t->output.crop.w -= 8;
+				goto again;
+			}
+			if (ret == IPU_CHECK_ERR_SPLIT_OUTPUTH_OVER) {
+				t->output.crop.h -= 8;
+				goto again;
+			}
+			printf("ipu task check fail\n");
+			return -1;
+		}
+	}
+
+	/*
+	 * The IC runs the VF and PP tasks side by side.  The VDI is on VF
+	 * only, so deinterlacing keeps the user's choice.
+	 */
+	for (i = 0; i < p->tasks; i++) {
+		p->task_id[i] = t->task_id;
+		if (p->tasks == 1 || t->task_id != IPU_TASK_ID_ANY || p->vdi)
+			continue;
+		id = (i & 1) ? IPU_TASK_ID_PP : IPU_TASK_ID_VF;
+		t2 = *t;
+		t2.task_id = id;
+		if (p->dev->ops->check(p->dev, &t2) < IPU_CHECK_ERR_MIN)
+			p->task_id[i] = id;
+	}
+	return 0;
+}
+
+/* Called with the lock held */
+static struct ipu_slot *find_slot(struct ipu_pipeline *p, int state, int seq)
+{
+	int i;
+
+	for (i = 0; i < p->nr_slot; i++)
+		if (p->slot[i].state == state &&
+		    (seq < 0 || p->slot[i].seq == seq))
+			return &p->slot[i];
+	return NULL;
+}
+
+static void set_state(struct ipu_pipeline *p, struct ipu_slot *s, int state)
+{
+	pthread_mutex_lock(&p->lock);
+	s->state = state;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void set_error(struct ipu_pipeline *p)
+{
+	pthread_mutex_lock(&p->lock);
+	p->error = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+static int read_frame(struct ipu_pipeline *p, void *buf)
+{
+	return fread(buf, 1, p->isize, p->in) == (size_t)p->isize ? 0 : -1;
+}
+
+static void *reader_thread(void *arg)
+{
+	struct ipu_pipeline *p = arg;
+	struct ipu_slot *s;
+	void *ahead = NULL;
+	int seq, total = p->fcount * p->loops;
+	long long t;
+
+	if (p->vdi) {
+		ahead = malloc(p->isize);
+		if (!ahead) {
+			set_error(p);
+			return NULL;
+		}
+	}
+
+	for (seq = 0; seq < total; seq++) {
+		t = now_us();
+		pthread_mutex_lock(&p->lock);
+		while (!(s = find_slot(p, IPU_SLOT_FREE, -1)) && !p->error &&
+		       !*p->quit)
+			pthread_cond_wait(&p->cond, &p->lock);
+		pthread_mutex_unlock(&p->lock);
+		if (!s)
+			break;
+		p->reader.wait_us += now_us() - t;
+
+		t = now_us();
+		if (seq % p->fcount == 0) {
+			/* next loop over the file */
+			fseek(p->in, 0L, SEEK_SET);
+			if (p->vdi && read_frame(p, ahead) < 0)
+				goto short_read;
+		}
+		if (p->vdi) {
+			memcpy(s->in.vaddr, ahead, p->isize);
+			if (read_frame(p, s->in_n.vaddr) < 0)
+				goto short_read;
+			memcpy(ahead, s->in_n.vaddr, p->isize);
+		} else if (read_frame(p, s->in.vaddr) < 0) {
+			goto short_read;
+		}
+		p->reader.busy_us += now_us() - t;
+		p->reader.frames++;
+
+		pthread_mutex_lock(&p->lock);
+		s->seq = seq;
+		s->state = IPU_SLOT_READY;
+		p->read++;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+	}
+	goto out;
+
+short_read:
+	printf("Can not read enough data from input file\n");
+out:
+	pthread_mutex_lock(&p->lock);
+	p->eof = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+	free(ahead);
+	return NULL;
+}
+
+struct task_arg {
+	struct ipu_pipeline *p;
+	int id;
+};
+
+static void *task_thread(void *arg)
+{
+	struct task_arg *ta = arg;
+	struct ipu_pipeline *p = ta->p;
+	struct ipu_stage *st = &p->task_stage[ta->id];
+	struct ipu_task t = p->task;
+	struct ipu_slot *s;
+	long long t0;
+	int ret;
+
+	t.task_id = p->task_id[ta->id];
+	while (1) {
+		t0 = now_us();
+		pthread_mutex_lock(&p->lock);
+		while (!(s = find_slot(p, IPU_SLOT_READY, p->next_task)) &&
+		       !p->error && !(p->eof && p->next_task >= p->read))
+			pthread_cond_wait(&p->cond, &p->lock);
+		if (s) {
+			s->state = IPU_SLOT_BUSY;
+			p->next_task++;
+		}
+		pthread_mutex_unlock(&p->lock);
+		if (!s)
+			break;
+		st->wait_us += now_us() - t0;
+
+		set_buffers(&t, s);
+		t0 = now_us();
+		ret = p->dev->ops->queue(p->dev, &t);
+		st->busy_us += now_us() - t0;
+		if (ret < 0) {
+			printf("ioct IPU_QUEUE_TASK fail\n");
+			set_error(p);
+			break;
+		}
+		st->frames++;
+		set_state(p, s, IPU_SLOT_DONE);
+	}
+	return NULL;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct ipu_pipeline *p = arg;
+	struct ipu_slot *s;
+	long long t;
+	int ret;
+
+	while (1) {
+		t = now_us();
+		pthread_mutex_lock(&p->lock);
+		while (!(s = find_slot(p, IPU_SLOT_DONE, p->written)) &&
+		       !p->error && !(p->eof && p->written >= p->read))
+			pthread_cond_wait(&p->cond, &p->lock);
+		pthread_mutex_unlock(&p->lock);
+		if (!s)
+			break;
+		p->writer.wait_us += now_us() - t;
+
+		t = now_us();
+		if (!p->out) {
+			ret = ioctl(p->fd_fb, FBIOPAN_DISPLAY, p->fb_var);
+			if (ret < 0) {
+				printf("fb ioct FBIOPAN_DISPLAY fail\n");
+				set_error(p);
+				break;
+			}
+		} else if (fwrite(s->out.vaddr, 1, p->osize, p->out) <
+			   (size_t)p->osize) {
+			printf("Can not write enough data into output file\n");
+			set_error(p);
+			break;
+		}
+		p->writer.busy_us += now_us() - t;
+		p->writer.frames++;
+
+		pthread_mutex_lock(&p->lock);
+		s->state = IPU_SLOT_FREE;
+		p->written++;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+	}
+	return NULL;
+}
+
+int ipu_pipeline_run(struct ipu_pipeline *p)
+{
+	pthread_t reader, writer, task[IPU_PIPE_MAX_TASKS];
+	struct task_arg ta[IPU_PIPE_MAX_TASKS];
+	int i, nr_task;
+
+	p->start = now_us();
+	if (pthread_create(&reader, NULL, reader_thread, p))
+		return -1;
+	for (nr_task = 0; nr_task < p->tasks; nr_task++) {
+		ta[nr_task].p = p;
+		ta[nr_task].id = nr_task;
+		if (pthread_create(&task[nr_task], NULL, task_thread,
+				   &ta[nr_task])) {
+			set_error(p);
+			break;
+		}
+	}
+	if (pthread_create(&writer, NULL, writer_thread, p)) {
+		set_error(p);
+		writer = 0;
+	}
+
+	pthread_join(reader, NULL);
+	for (i = 0; i < nr_task; i++)
+		pthread_join(task[i], NULL);
+	if (writer)
+		pthread_join(writer, NULL);
+	p->end = now_us();
+
+	return p->error ? -1 : p->written;
+}
+
+static void report_stage(const struct ipu_stage *st, const char *suffix,
+			 long long total)
+{
+	printf("%-5s%-6s %8d %10.1f %10.1f %6.1f%%\n", st->name, suffix,
+	       st->frames, st->busy_us / 1000.0, st->wait_us / 1000.0,
+	       total ? st->busy_us * 100.0 / total : 0.0);
+}
+
+void ipu_pipeline_report(const struct ipu_pipeline *p)
+{
+	long long total = p->end - p->start, busy = 0;
+	char suffix[16];
+	int i;
+
+	printf("%s backend, %d task(s) in flight, %d buffers\n",
+	       p->dev->ops->name, p->tasks, p->nr_slot);
+	printf("stage        frames    busy ms    wait ms   util\n");
+	report_stage(&p->reader, "", total);
+	for (i = 0; i < p->tasks; i++) {
+		snprintf(suffix, sizeof(suffix), "%d %s", i,
+			 task_id_name(p->task_id[i]));
+		report_stage(&p->task_stage[i], suffix, total);
+		busy += p->task_stage[i].busy_us;
+	}
+	report_stage(&p->writer, "", total);
+	if (total)
+		printf("tasks in flight on average: %.2f\n",
+		       (double)busy / total);
+}
+
+void ipu_pipeline_fini(struct ipu_pipeline *p)
+{
+	struct ipu_slot *s;
+	int i;
+
+	for (i = 0; i < p->nr_slot; i++) {
+		s = &p->slot[i];
+		p->dev->ops->free(p->dev, &s->in);
+		p->dev->ops->free(p->dev, &s->in_n);
+		if (s->out.vaddr)
+			p->dev->ops->free(p->dev, &s->out);
+	}
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2017 NXP
+ *
+ */
+
+/*
+ * The code contained herein is licensed under the GNU Lesser General
+ * Public License.  You may obtain a copy of the GNU Lesser General
+ * Public License Version 2.1 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/lgpl-license.html
+ * http://www.gnu.org/copyleft/lgpl.html
+ */
+
+/*!
+ * @file ipu_pipeline.h
+ *
+ * @brief Pipelined IPU task executor
+ *
+ * A reader thread fills input buffers from the file, task threads keep
+ * several IPU tasks queued at once, and a writer thread saves (or pans to)
+ * the results in frame order.  Each frame owns a slot: its input, the
+ * next field for the VDI and its output buffer, so a slot goes
+ * free -> read -> task -> write -> free without copies between stages.
+ *
+ * @ingroup IPU
+ */
+#ifndef __IPU_PIPELINE_H__
+#define __IPU_PIPELINE_H__
+
+#include <stdio.h>
+#include <pthread.h>
+#include <linux/fb.h>
+
+#include "ipu_dev.h"
+
+#define IPU_PIPE_MAX_TASKS	8
+#define IPU_PIPE_MAX_SLOTS	(IPU_PIPE_MAX_TASKS + 2)
+
+enum {
+	IPU_SLOT_FREE,
+	IPU_SLOT_READY,		/* input read */
+	IPU_SLOT_BUSY,		/* task queued */
+	IPU_SLOT_DONE,		/* output ready to write */
+};
+
+struct ipu_slot {
+	struct ipu_buf in;
+	struct ipu_buf in_n;	/* next frame, VDI low/medium motion */
+	struct ipu_buf out;
+	int state;
+	int seq;
+};
+
+struct ipu_stage {
+	const char *name;
+	int frames;
+	long long busy_us;
+	long long wait_us;
+};
+
+struct ipu_pipeline {
+	struct ipu_dev *dev;
+	struct ipu_task task;		/* checked, shared by every slot */
+	int isize;
+	int osize;
+	int vdi;			/* read one frame ahead */
+
+	FILE *in;
+	FILE *out;			/* NULL when showing on fb */
+	int fd_fb;
+	struct fb_var_screeninfo *fb_var;
+
+	int fcount;			/* frames per loop */
+	int loops;
+	int tasks;
+	int nr_slot;
+	struct ipu_slot slot[IPU_PIPE_MAX_SLOTS];
+	u8 task_id[IPU_PIPE_MAX_TASKS];
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int read;			/* frames read */
+	int next_task;			/* next frame for the task threads */
+	int written;
+	int eof;
+	int error;
+	volatile int *quit;
+
+	struct ipu_stage reader;
+	struct ipu_stage task_stage[IPU_PIPE_MAX_TASKS];
+	struct ipu_stage writer;
+	long long start;
+	long long end;
+};
+
+/*
+ * Allocates the slots; out_paddr is the one output buffer they all share
+ * (the fb), 0 to allocate one each.  tasks is the number of tasks kept
+ * queued; with several and task_id "any", they go alternately to the VF
+ * and PP tasks when the IPU accepts the task on both.  The file and fb
+ * fields, fcount, loops and quit are filled in by the caller afterwards.
+ */
+int ipu_pipeline_init(struct ipu_pipeline *p, struct ipu_dev *dev,
+		      const struct ipu_task *t, int isize, int osize,
+		      dma_addr_t out_paddr, int tasks);
+/* Check the task as IPU_CHECK_TASK would, shrinking crops for splitting */
+int ipu_pipeline_check(struct ipu_pipeline *p);
+/* Returns the frames written, or a negative value on error */
+int ipu_pipeline_run(struct ipu_pipeline *p);
+void ipu_pipeline_report(const struct ipu_pipeline *p);
+void ipu_pipeline_fini(struct ipu_pipeline *p);
+
+#endif
@@ -0,0 +1,562 @@
+/*
+ * Copyright 2017 NXP
+ *
+ */
+
+/*
+ * The code contained herein is licensed under the GNU Lesser General
+ * Public License.  You may obtain a copy of the GNU Lesser General
+ * Public License Version 2.1 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/lgpl-license.html
+ * http://www.gnu.org/copyleft/lgpl.html
+ */
+
+/*!
+ * @file ipu_sw.c
+ *
+ * @brief Software IPU task backend
+ *
+ * A task runs in three steps, like the IC: the input crop is resized
+ * (bilinear) to the output crop size before rotation, then every output
+ * pixel is fetched from its rotated/flipped position, converted between
+ * RGB and YUV (BT.601, video range) when the families differ, and packed.
+ * Pixels travel as 4 bytes: R,G,B,A or Y,U,V,A.  Source rows are unpacked
+ * only when the resizer needs them, so only the resized frame is held.
+ *
+ * @ingroup IPU
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ipu_dev.h"
+
+enum {
+	SW_PACKED,
+	SW_RGB565,
+	SW_YUV422,		/* YUYV, UYVY */
+	SW_PLANAR,		/* Y, then U and V or V and U */
+	SW_NV12,
+};
+
+struct sw_fmt {
+	u32 fourcc;
+	int layout;
+	int yuv;
+	int cpp;		/* packed: bytes per pixel */
+	int pos[4];		/* byte of R/Y, G/U, B/V, alpha (-1); for
+				 * 4:2:2 the first Y of the pair, U, V */
+	int xs, ys;		/* planar: chroma subsampling shifts */
+	int swap_uv;
+};
+
+static const struct sw_fmt sw_fmts[] = {
+	{ IPU_PIX_FMT_RGB565, SW_RGB565, 0, 2, { 0, 0, 0, -1 } },
+	{ IPU_PIX_FMT_RGB24, SW_PACKED, 0, 3, { 0, 1, 2, -1 } },
+	{ IPU_PIX_FMT_BGR24, SW_PACKED, 0, 3, { 2, 1, 0, -1 } },
+	{ IPU_PIX_FMT_RGB32, SW_PACKED, 0, 4, { 0, 1, 2, -1 } },
+	{ IPU_PIX_FMT_BGR32, SW_PACKED, 0, 4, { 2, 1, 0, -1 } },
+	{ IPU_PIX_FMT_RGBA32, SW_PACKED, 0, 4, { 0, 1, 2, 3 } },
+	{ IPU_PIX_FMT_BGRA32, SW_PACKED, 0, 4, { 2, 1, 0, 3 } },
+	{ IPU_PIX_FMT_ABGR32, SW_PACKED, 0, 4, { 3, 2, 1, 0 } },
+	{ IPU_PIX_FMT_YUV444, SW_PACKED, 1, 3, { 0, 1, 2, -1 } },
+	{ IPU_PIX_FMT_YUYV, SW_YUV422, 1, 2, { 0, 1, 3, -1 } },
+	{ IPU_PIX_FMT_UYVY, SW_YUV422, 1, 2, { 1, 0, 2, -1 } },
+	{ IPU_PIX_FMT_YUV420P, SW_PLANAR, 1, 0, { 0 }, 1, 1, 0 },
+	{ IPU_PIX_FMT_YVU420P, SW_PLANAR, 1, 0, { 0 }, 1, 1, 1 },
+	{ IPU_PIX_FMT_YUV422P, SW_PLANAR, 1, 0, { 0 }, 1, 0, 0 },
+	{ IPU_PIX_FMT_YVU422P, SW_PLANAR, 1, 0, { 0 }, 1, 0, 1 },
+	{ IPU_PIX_FMT_YUV444P, SW_PLANAR, 1, 0, { 0 }, 0, 0, 0 },
+	{ IPU_PIX_FMT_NV12, SW_NV12, 1, 0, { 0 }, 1, 1, 0 },
+};
+
+/* A frame in memory */
+struct sw_image {
+	const struct sw_fmt *fmt;
+	u8 *base;
+	int width;
+	int height;
+};
+
+static const struct sw_fmt *sw_find_fmt(u32 fourcc)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(sw_fmts) / sizeof(sw_fmts[0]); i++)
+		if (sw_fmts[i].fourcc == fourcc)
+			return &sw_fmts[i];
+	return NULL;
+}
+
+static int sw_frame_size(const struct sw_fmt *f, int w, int h)
+{
+	switch (f->layout) {
+	case SW_PLANAR:
+		return w * h + 2 * (w >> f->xs) * (h >> f->ys);
+	case SW_NV12:
+		return w * h + w * (h >> 1);
+	default:
+		return w * h * f->cpp;
+	}
+}
+
+static void sw_chroma_planes(const struct sw_image *img, u8 **u, u8 **v)
+{
+	const struct sw_fmt *f = img->fmt;
+	int csize = (img->width >> f->xs) * (img->height >> f->ys);
+	u8 *p = img->base + img->width * img->height;
+
+	*u = f->swap_uv ? p + csize : p;
+	*v = f->swap_uv ? p : p + csize;
+}
+
+static inline u8 clip(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static void rgb_to_yuv(u8 *p)
+{
+	int r = p[0], g = p[1], b = p[2];
+
+	p[0] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+	p[1] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+	p[2] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+static void yuv_to_rgb(u8 *p)
+{
+	int c = p[0] - 16, d = p[1] - 128, e = p[2] - 128;
+
+	p[0] = clip((298 * c + 409 * e + 128) >> 8);
+	p[1] = clip((298 * c - 100 * d - 208 * e + 128) >> 8);
+	p[2] = clip((298 * c + 516 * d + 128) >> 8);
+}
+
+/* w pixels of row y from x0 on, 4 bytes each */
+static void sw_unpack_row(const struct sw_image *img, int x0, int y, int w,
+			  u8 *dst)
+{
+	const struct sw_fmt *f = img->fmt;
+	const u8 *s;
+	u8 *u, *v;
+	int x, px;
+
+	switch (f->layout) {
+	case SW_PACKED:
+		s = img->base + (y * img->width + x0) * f->cpp;
+		for (x = 0; x < w; x++, s += f->cpp, dst += 4) {
+			dst[0] = s[f->pos[0]];
+			dst[1] = s[f->pos[1]];
+			dst[2] = s[f->pos[2]];
+			dst[3] = f->pos[3] < 0 ? 0xff : s[f->pos[3]];
+		}
+		break;
+	case SW_RGB565:
+		s = img->base + (y * img->width + x0) * 2;
+		for (x = 0; x < w; x++, s += 2, dst += 4) {
+			px = s[0] | s[1] << 8;
+			dst[0] = (px >> 8 & 0xf8) | px >> 13;
+			dst[1] = (px >> 3 & 0xfc) | (px >> 9 & 0x3);
+			dst[2] = (px << 3 & 0xf8) | (px >> 2 & 0x7);
+			dst[3] = 0xff;
+		}
+		break;
+	case SW_YUV422:
+		s = img->base + y * img->width * 2;
+		for (x = x0; x < x0 + w; x++, dst += 4) {
+			dst[0] = s[(x & ~1) * 2 + f->pos[0] + (x & 1) * 2];
+			dst[1] = s[(x & ~1) * 2 + f->pos[1]];
+			dst[2] = s[(x & ~1) * 2 + f->pos[2]];
+			dst[3] = 0xff;
+		}
+		break;
+	case SW_PLANAR:
+		sw_chroma_planes(img, &u, &v);
+		s = img->base + y * img->width;
+		u += (y >> f->ys) * (img->width >> f->xs);
+		v += (y >> f->ys) * (img->width >> f->xs);
+		for (x = x0; x < x0 + w; x++, dst += 4) {
+			dst[0] = s[x];
+			dst[1] = u[x >> f->xs];
+			dst[2] = v[x >> f->xs];
+			dst[3] = 0xff;
+		}
+		break;
+	case SW_NV12:
+		s = img->base + y * img->width;
+		u = img->base + img->width * img->height +
+		    (y >> 1) * img->width;
+		for (x = x0; x < x0 + w; x++, dst += 4) {
+			dst[0] = s[x];
+			dst[1] = u[x & ~1];
+			dst[2] = u[(x & ~1) + 1];
+			dst[3] = 0xff;
+		}
+		break;
+	}
+}
+
+/*
+ * w pixels into row y from x0 on.  Subsampled chroma is the mean of the
+ * pixel pair; 4:2:0 chroma is taken from the even rows.
+ */
+static void sw_pack_row(const struct sw_image *img, int x0, int y, int w,
+			const u8 *src)
+{
+	const struct sw_fmt *f = img->fmt;
+	u8 *d, *u, *v;
+	int x, n, px;
+
+	switch (f->layout) {
+	case SW_PACKED:
+		d = img->base + (y * img->width + x0) * f->cpp;
+		for (x = 0; x < w; x++, d += f->cpp, src += 4) {
+			if (f->cpp == 4)
+				d[3] = 0xff;	/* unused byte of RGB32/BGR32 */
+			d[f->pos[0]] = src[0];
+			d[f->pos[1]] = src[1];
+			d[f->pos[2]] = src[2];
+			if (f->pos[3] >= 0)
+				d[f->pos[3]] = src[3];
+		}
+		break;
+	case SW_RGB565:
+		d = img->base + (y * img->width + x0) * 2;
+		for (x = 0; x < w; x++, d += 2, src += 4) {
+			px = (src[0] & 0xf8) << 8 | (src[1] & 0xfc) << 3 |
+			     src[2] >> 3;
+			d[0] = px;
+			d[1] = px >> 8;
+		}
+		break;
+	case SW_YUV422:
+		d = img->base + y * img->width * 2;
+		for (x = x0; x < x0 + w; x++, src += 4) {
+			d[(x & ~1) * 2 + f->pos[0] + (x & 1) * 2] = src[0];
+			if (x & 1)
+				continue;
+			n = x + 1 < x0 + w ? 4 : 0;
+			d[x * 2 + f->pos[1]] = (src[1] + src[1 + n]) >> 1;
+			d[x * 2 + f->pos[2]] = (src[2] + src[2 + n]) >> 1;
+		}
+		break;
+	case SW_PLANAR:
+		d = img->base + y * img->width;
+		for (x = 0; x < w; x++)
+			d[x0 + x] = src[x * 4];
+		if (y & ((1 << f->ys) - 1))
+			break;
+		sw_chroma_planes(img, &u, &v);
+		u += (y >> f->ys) * (img->width >> f->xs);
+		v += (y >> f->ys) * (img->width >> f->xs);
+		for (x = x0; x < x0 + w; x++, src += 4) {
+			if (x & ((1 << f->xs) - 1))
+				continue;
+			n = (f->xs && x + 1 < x0 + w) ? 4 : 0;
+			u[x >> f->xs] = (src[1] + src[1 + n]) >> 1;
+			v[x >> f->xs] = (src[2] + src[2 + n]) >> 1;
+		}
+		break;
+	case SW_NV12:
+		d = img->base + y * img->width;
+		for (x = 0; x < w; x++)
+			d[x0 + x] = src[x * 4];
+		if (y & 1)
+			break;
+		u = img->base + img->width * img->height + (y >> 1) * img->width;
+		for (x = x0; x < x0 + w; x++, src += 4) {
+			if (x & 1)
+				continue;
+			n = x + 1 < x0 + w ? 4 : 0;
+			u[x] = (src[1] + src[1 + n]) >> 1;
+			u[x + 1] = (src[2] + src[2 + n]) >> 1;
+		}
+		break;
+	}
+}
+
+/* Source position of each destination sample, 16.16, pixel centres */
+static void sw_scale_table(int *pos, int src, int dst)
+{
+	long long step = ((long long)src << 16) / dst;
+	long long p = step / 2 - 0x8000;
+	int i;
+
+	for (i = 0; i < dst; i++, p += step) {
+		if (p < 0)
+			pos[i] = 0;
+		else if (p > (long long)(src - 1) << 16)
+			pos[i] = (src - 1) << 16;
+		else
+			pos[i] = p;
+	}
+}
+
+struct sw_scaler {
+	const struct sw_image *img;
+	int x0, y0, sw, sh;	/* input crop */
+	int *xpos;
+	u8 *line;		/* one unpacked source row */
+	u8 *row[2];		/* horizontally scaled rows */
+	int row_y[2];
+	int dw;
+};
+
+static void sw_hscale(struct sw_scaler *sc, int y, u8 *dst)
+{
+	const u8 *a, *b;
+	int i, c, fx;
+
+	sw_unpack_row(sc->img, sc->x0, sc->y0 + y, sc->sw, sc->line);
+	for (i = 0; i < sc->dw; i++, dst += 4) {
+		a = sc->line + (sc->xpos[i] >> 16) * 4;
+		fx = sc->xpos[i] & 0xffff;
+		b = fx ? a + 4 : a;
+		for (c = 0; c < 4; c++)
+			dst[c] = (a[c] * (0x10000 - fx) + b[c] * fx + 0x8000) >> 16;
+	}
+}
+
+static u8 *sw_scaled_row(struct sw_scaler *sc, int y)
+{
+	int k = y & 1;
+
+	if (sc->row_y[k] != y) {
+		sw_hscale(sc, y, sc->row[k]);
+		sc->row_y[k] = y;
+	}
+	return sc->row[k];
+}
+
+/* Input crop -> dw x dh, bilinear */
+static int sw_resize(const struct sw_image *img, const struct ipu_crop *crop,
+		     u8 *dst, int dw, int dh)
+{
+	struct sw_scaler sc;
+	int *ypos;
+	const u8 *a, *b;
+	int x, y, fy, y0;
+
+	memset(&sc, 0, sizeof(sc));
+	sc.img = img;
+	sc.x0 = crop->pos.x;
+	sc.y0 = crop->pos.y;
+	sc.sw = crop->w;
+	sc.sh = crop->h;
+	sc.dw = dw;
+	sc.row_y[0] = sc.row_y[1] = -1;
+	sc.xpos = malloc(dw * sizeof(int));
+	ypos = malloc(dh * sizeof(int));
+	sc.line = malloc(sc.sw * 4);
+	sc.row[0] = malloc(dw * 4);
+	sc.row[1] = malloc(dw * 4);
+	if (!sc.xpos || !ypos || !sc.line || !sc.row[0] || !sc.row[1]) {
+		free(sc.xpos);
+		free(ypos);
+		free(sc.line);
+		free(sc.row[0]);
+		free(sc.row[1]);
+		return -ENOMEM;
+	}
+	sw_scale_table(sc.xpos, sc.sw, dw);
+	sw_scale_table(ypos, sc.sh, dh);
+
+	for (y = 0; y < dh; y++, dst += dw * 4) {
+		y0 = ypos[y] >> 16;
+		fy = ypos[y] & 0xffff;
+		a = sw_scaled_row(&sc, y0);
+		if (!fy) {
+			memcpy(dst, a, dw * 4);
+			continue;
+		}
+		b = sw_scaled_row(&sc, y0 + 1);
+		for (x = 0; x < dw * 4; x++)
+			dst[x] = (a[x] * (0x10000 - fy) + b[x] * fy + 0x8000) >> 16;
+	}
+
+	free(sc.xpos);
+	free(ypos);
+	free(sc.line);
+	free(sc.row[0]);
+	free(sc.row[1]);
+	return 0;
+}
+
+static struct ipu_buf *sw_lookup(struct ipu_dev *dev, dma_addr_t paddr)
+{
+	if (paddr < 1 || paddr > IPU_SW_MAX_BUF)
+		return NULL;
+	return dev->buf[paddr - 1];
+}
+
+static int sw_open(struct ipu_dev *dev)
+{
+	return 0;
+}
+
+static void sw_close(struct ipu_dev *dev)
+{
+}
+
+static int sw_alloc(struct ipu_dev *dev, struct ipu_buf *buf, int size)
+{
+	int i;
+
+	pthread_mutex_lock(&dev->lock);
+	for (i = 0; i < IPU_SW_MAX_BUF && dev->buf[i]; i++)
+		;
+	if (i == IPU_SW_MAX_BUF || posix_memalign(&buf->vaddr, 64, size)) {
+		pthread_mutex_unlock(&dev->lock);
+		printf("sw: alloc %d bytes fail\n", size);
+		return -1;
+	}
+	buf->paddr = i + 1;
+	buf->size = size;
+	dev->buf[i] = buf;
+	pthread_mutex_unlock(&dev->lock);
+	return 0;
+}
+
+static void sw_free(struct ipu_dev *dev, struct ipu_buf *buf)
+{
+	if (!buf->paddr)
+		return;
+	pthread_mutex_lock(&dev->lock);
+	dev->buf[buf->paddr - 1] = NULL;
+	pthread_mutex_unlock(&dev->lock);
+	free(buf->vaddr);
+	memset(buf, 0, sizeof(*buf));
+}
+
+static int sw_check(struct ipu_dev *dev, struct ipu_task *t)
+{
+	const struct sw_fmt *in = sw_find_fmt(t->input.format);
+	const struct sw_fmt *out = sw_find_fmt(t->output.format);
+
+	if (!in || !out || t->overlay_en || t->input.deinterlace.enable ||
+	    t->output.rotate > IPU_ROTATE_90_LEFT)
+		return IPU_CHECK_ERR_NOT_SUPPORT;
+	/* chroma is shared by pixel pairs */
+	if ((in->layout >= SW_YUV422 && (t->input.width & 1 ||
+					 t->input.height & 1)) ||
+	    (out->layout >= SW_YUV422 && (t->output.width & 1 ||
+					  t->output.height & 1)))
+		return IPU_CHECK_ERR_NOT_SUPPORT;
+
+	if (!t->input.crop.w)
+		t->input.crop.w = t->input.width - t->input.crop.pos.x;
+	if (!t->input.crop.h)
+		t->input.crop.h = t->input.height - t->input.crop.pos.y;
+	if (!t->output.crop.w)
+		t->output.crop.w = t->output.width - t->output.crop.pos.x;
+	if (!t->output.crop.h)
+		t->output.crop.h = t->output.height - t->output.crop.pos.y;
+
+	if (t->input.crop.pos.x + t->input.crop.w > t->input.width ||
+	    t->input.crop.pos.y + t->input.crop.h > t->input.height ||
+	    (int)t->input.crop.w <= 0 || (int)t->input.crop.h <= 0)
+		return IPU_CHECK_ERR_INPUT_CROP;
+	if (t->output.crop.pos.x + t->output.crop.w > t->output.width ||
+	    t->output.crop.pos.y + t->output.crop.h > t->output.height ||
+	    (int)t->output.crop.w <= 0 || (int)t->output.crop.h <= 0)
+		return IPU_CHECK_ERR_OUTPUT_CROP;
+	return IPU_CHECK_OK;
+}
+
+static int sw_queue(struct ipu_dev *dev, struct ipu_task *t)
+{
+	struct ipu_task task = *t;
+	struct sw_image in, out;
+	struct ipu_buf *ibuf, *obuf;
+	int rot90, vflip, hflip;
+	int pw, ph, W, H, x, y, u, v;
+	u8 *scaled, *line, *p;
+	int ret;
+
+	if (sw_check(dev, &task) != IPU_CHECK_OK) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&dev->lock);
+	ibuf = sw_lookup(dev, task.input.paddr);
+	obuf = sw_lookup(dev, task.output.paddr);
+	pthread_mutex_unlock(&dev->lock);
+
+	in.fmt = sw_find_fmt(task.input.format);
+	in.width = task.input.width;
+	in.height = task.input.height;
+	out.fmt = sw_find_fmt(task.output.format);
+	out.width = task.output.width;
+	out.height = task.output.height;
+	if (!ibuf || !obuf ||
+	    ibuf->size < sw_frame_size(in.fmt, in.width, in.height) ||
+	    obuf->size < sw_frame_size(out.fmt, out.width, out.height)) {
+		errno = EINVAL;
+		return -1;
+	}
+	in.base = ibuf->vaddr;
+	out.base = obuf->vaddr;
+
+	/* the IC flips first, then turns 90 degrees clockwise */
+	rot90 = task.output.rotate & 4;
+	hflip = task.output.rotate & 2;
+	vflip = task.output.rotate & 1;
+	W = task.output.crop.w;
+	H = task.output.crop.h;
+	pw = rot90 ? H : W;
+	ph = rot90 ? W : H;
+
+	scaled = malloc((size_t)pw * ph * 4);
+	line = malloc(W * 4);
+	if (!scaled || !line) {
+		free(scaled);
+		free(line);
+		errno = ENOMEM;
+		return -1;
+	}
+	ret = sw_resize(&in, &task.input.crop, scaled, pw, ph);
+	if (ret < 0) {
+		free(scaled);
+		free(line);
+		errno = -ret;
+		return -1;
+	}
+
+	for (y = 0; y < H; y++) {
+		for (x = 0; x < W; x++) {
+			u = rot90 ? y : x;
+			v = rot90 ? W - 1 - x : y;
+			if (hflip)
+				u = pw - 1 - u;
+			if (vflip)
+				v = ph - 1 - v;
+			p = line + x * 4;
+			memcpy(p, scaled + ((size_t)v * pw + u) * 4, 4);
+			if (in.fmt->yuv && !out.fmt->yuv)
+				yuv_to_rgb(p);
+			else if (!in.fmt->yuv && out.fmt->yuv)
+				rgb_to_yuv(p);
+		}
+		sw_pack_row(&out, task.output.crop.pos.x,
+			    task.output.crop.pos.y + y, W, line);
+	}
+
+	free(scaled);
+	free(line);
+	return 0;
+}
+
+const struct ipu_dev_ops ipu_sw_ops = {
+	.name = "sw",
+	.open = sw_open,
+	.close = sw_close,
+	.alloc = sw_alloc,
+	.free = sw_free,
+	.check = sw_check,
+	.queue = sw_queue,
+};
@@ -33,11 +33,13 @@
 #include <sys/stat.h>
 #include <linux/mxcfb.h>
 #include "mxc_ipudev_test.h"
+#include "ipu_dev.h"
+#include "ipu_pipeline.h"
 #include "../../include/soc_check.h"
 #include "../../include/test_utils.h"
 
 #define PAGE_ALIGN(x) (((x) + 4095) & ~4095)
-int ctrl_c_rev = 0;
+volatile int ctrl_c_rev = 0;
 void ctrl_c_handler(int signum, siginfo_t *info, void *myact)
 {
 	ctrl_c_rev = 1;
@@ -163,19 +165,18 @@ int main(int argc, char *argv[])
 {
 	ipu_test_handle_t test_handle;
 	struct ipu_task *t = &test_handle.task;
-	int ret = 0, done_cnt = 0;
-	int done_loop = 0, total_cnt = 0;
+	struct ipu_pipeline pipeline;
+	struct ipu_dev dev;
+	int ret = 0, total_cnt = 0;
 	struct sigaction act;
 	FILE * file_in = NULL;
 	FILE * file_out = NULL;
-	struct timeval begin, end;
-	int sec, usec, run_time = 0;
-	int fd_ipu = 0, fd_fb = 0;
+	int run_time;
+	int fd_fb = 0;
 	int isize = 0, ovsize = 0;
 	int alpsize = 0, osize = 0;
-	void *inbuf = NULL, *vdibuf = NULL;
-	void *ovbuf = NULL, *alpbuf = NULL;
-	void *outbuf = NULL;
+	struct ipu_buf ovbuf, alpbuf;
+	dma_addr_t fb_paddr = 0;
 	struct fb_var_screeninfo fb_var;
 	struct fb_fix_screeninfo fb_fix;
 	int blank;
@@ -183,13 +184,6 @@ int main(int argc, char *argv[])
 
 	print_name(argv);
 
-	ret = soc_version_check(soc_list);
-	if (ret == 0) {
-		printf("mxc_ipudev_test.out not supported on current soc\n");
-		return 0;
-	}
-
-
 	/*for ctrl-c*/
 	sigemptyset(&act.sa_mask);
 	act.sa_flags = SA_SIGINFO;
@@ -201,6 +195,9 @@ int main(int argc, char *argv[])
 	}
 
 	memset(&test_handle, 0, sizeof(ipu_test_handle_t));
+	memset(&pipeline, 0, sizeof(pipeline));
+	memset(&ovbuf, 0, sizeof(ovbuf));
+	memset(&alpbuf, 0, sizeof(alpbuf));
 
 	if (process_cmdline(argc, argv, &test_handle) < 0) {
 		printf("\nMXC IPU device Test\n\n" \
@@ -209,6 +206,15 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	/* the software backend runs anywhere */
+	if (strcmp(test_handle.backend, "sw")) {
+		ret = soc_version_check(soc_list);
+		if (ret == 0) {
+			printf("mxc_ipudev_test.out not supported on current soc\n");
+			return 0;
+		}
+	}
+
 	file_in = fopen(argv[argc-1], "rb");
 	if (file_in == NULL){
 		printf("there is no such file for reading %s\n", argv[argc-1]);
@@ -216,95 +222,46 @@ int main(int argc, char *argv[])
 		goto err0;
 	}
 
-	fd_ipu = open("/dev/mxc_ipu", O_RDWR, 0);
-	if (fd_ipu < 0) {
-		printf("open ipu dev fail\n");
-		ret = -1;
+	ret = ipu_dev_open(&dev, test_handle.backend);
+	if (ret < 0)
 		goto err1;
-	}
 
 	if (IPU_PIX_FMT_TILED_NV12F == t->input.format) {
 		isize = PAGE_ALIGN(t->input.width * t->input.height/2) +
 			PAGE_ALIGN(t->input.width * t->input.height/4);
-		isize = t->input.paddr = isize * 2;
+		isize = isize * 2;
 	} else
-		isize = t->input.paddr =
-			t->input.width * t->input.height
+		isize = t->input.width * t->input.height
 			* fmt_to_bpp(t->input.format)/8;
-	ret = ioctl(fd_ipu, IPU_ALLOC, &t->input.paddr);
-	if (ret < 0) {
-		printf("ioctl IPU_ALLOC fail\n");
-		goto err2;
-	}
-	inbuf = mmap(0, isize, PROT_READ | PROT_WRITE,
-		MAP_SHARED, fd_ipu, t->input.paddr);
-	if (!inbuf) {
-		printf("mmap fail\n");
-		ret = -1;
-		goto err3;
-	}
-
-	if (t->input.deinterlace.enable &&
-		(t->input.deinterlace.motion != HIGH_MOTION)) {
-		t->input.paddr_n = isize;
-		ret = ioctl(fd_ipu, IPU_ALLOC, &t->input.paddr_n);
-		if (ret < 0) {
-			printf("ioctl IPU_ALLOC fail\n");
-			goto err4;
-		}
-		vdibuf = mmap(0, isize, PROT_READ | PROT_WRITE,
-				MAP_SHARED, fd_ipu, t->input.paddr_n);
-		if (!vdibuf) {
-			printf("mmap fail\n");
-			ret = -1;
-			goto err5;
-		}
-	}
+	osize = t->output.width * t->output.height
+		* fmt_to_bpp(t->output.format)/8;
 
 	if (t->overlay_en) {
-		ovsize = t->overlay.paddr =
-			t->overlay.width * t->overlay.height
+		ovsize = t->overlay.width * t->overlay.height
 			* fmt_to_bpp(t->overlay.format)/8;
-		ret = ioctl(fd_ipu, IPU_ALLOC, &t->overlay.paddr);
-		if (ret < 0) {
-			printf("ioctl IPU_ALLOC fail\n");
-			goto err6;
-		}
-		ovbuf = mmap(0, ovsize, PROT_READ | PROT_WRITE,
-				MAP_SHARED, fd_ipu, t->overlay.paddr);
-		if (!ovbuf) {
-			printf("mmap fail\n");
-			ret = -1;
-			goto err7;
-		}
+		ret = dev.ops->alloc(&dev, &ovbuf, ovsize);
+		if (ret < 0)
+			goto err2;
+		t->overlay.paddr = ovbuf.paddr;
 
 		/*fill overlay buffer with dedicated data*/
-		memset(ovbuf, 0x00, ovsize/4);
-		memset(ovbuf+ovsize/4, 0x55, ovsize/4);
-		memset(ovbuf+ovsize/2, 0xaa, ovsize/4);
-		memset(ovbuf+ovsize*3/4, 0xff, ovsize/4);
+		memset(ovbuf.vaddr, 0x00, ovsize/4);
+		memset(ovbuf.vaddr+ovsize/4, 0x55, ovsize/4);
+		memset(ovbuf.vaddr+ovsize/2, 0xaa, ovsize/4);
+		memset(ovbuf.vaddr+ovsize*3/4, 0xff, ovsize/4);
 
 		if (t->overlay.alpha.mode == IPU_ALPHA_MODE_LOCAL) {
-			alpsize = t->overlay.alpha.loc_alp_paddr =
-				t->overlay.width * t->overlay.height;
-			ret = ioctl(fd_ipu, IPU_ALLOC, &t->overlay.alpha.loc_alp_paddr);
-			if (ret < 0) {
-				printf("ioctl IPU_ALLOC fail\n");
-				goto err8;
-			}
-			alpbuf = mmap(0, alpsize, PROT_READ | PROT_WRITE,
-					MAP_SHARED, fd_ipu, t->overlay.alpha.loc_alp_paddr);
-			if (!alpbuf) {
-				printf("mmap fail\n");
-				ret = -1;
-				goto err9;
-			}
+			alpsize = t->overlay.width * t->overlay.height;
+			ret = dev.ops->alloc(&dev, &alpbuf, alpsize);
+			if (ret < 0)
+				goto err3;
+			t->overlay.alpha.loc_alp_paddr = alpbuf.paddr;
 
 			/*fill loc alpha buffer with dedicated data*/
-			memset(alpbuf, 0x00, alpsize/4);
-			memset(alpbuf+alpsize/4, 0x55, alpsize/4);
-			memset(alpbuf+alpsize/2, 0xaa, alpsize/4);
-			memset(alpbuf+alpsize*3/4, 0xff, alpsize/4);
+			memset(alpbuf.vaddr, 0x00, alpsize/4);
+			memset(alpbuf.vaddr+alpsize/4, 0x55, alpsize/4);
+			memset(alpbuf.vaddr+alpsize/2, 0xaa, alpsize/4);
+			memset(alpbuf.vaddr+alpsize*3/4, 0xff, alpsize/4);
 		}
 	}
 
@@ -322,6 +279,13 @@ int main(int argc, char *argv[])
 		if (!strcmp(test_handle.outfile, "ipu1-2nd-fb"))
 			memcpy(fb_name, "DISP4 BG - DI1", 15);
 
+		if (dev.ops != &ipu_hw_ops) {
+			printf("the %s backend can not show to fb, use -s 0\n",
+				dev.ops->name);
+			ret = -1;
+			goto err4;
+		}
+
 		for (i=0; i<5; i++) {
 			fb_dev[7] = '0';
 			fb_dev[7] += i;
@@ -339,8 +303,9 @@ int main(int argc, char *argv[])
 
 		if (!found) {
 			printf("can not find fb dev %s\n", fb_name);
+			fd_fb = 0;
 			ret = -1;
-			goto err10;
+			goto err4;
 		}
 
 		ioctl(fd_fb, FBIOGET_VSCREENINFO, &fb_var);
@@ -356,178 +321,73 @@ int main(int argc, char *argv[])
 		ret = ioctl(fd_fb, FBIOPUT_VSCREENINFO, &fb_var);
 		if (ret < 0) {
 			printf("fb ioctl FBIOPUT_VSCREENINFO fail\n");
-			goto err11;
+			goto err5;
 		}
 		ioctl(fd_fb, FBIOGET_VSCREENINFO, &fb_var);
 		ioctl(fd_fb, FBIOGET_FSCREENINFO, &fb_fix);
 
-		t->output.paddr = fb_fix.smem_start;
+		fb_paddr = fb_fix.smem_start;
+		/* every task would draw into the one fb buffer */
+		test_handle.tasks = 1;
 		blank = FB_BLANK_UNBLANK;
 		ioctl(fd_fb, FBIOBLANK, blank);
 	} else {
-		osize = t->output.paddr =
-			t->output.width * t->output.height
-			* fmt_to_bpp(t->output.format)/8;
-		ret = ioctl(fd_ipu, IPU_ALLOC, &t->output.paddr);
-		if (ret < 0) {
-			printf("ioctl IPU_ALLOC fail\n");
-			goto err10;
-		}
-		outbuf = mmap(0, osize, PROT_READ | PROT_WRITE,
-				MAP_SHARED, fd_ipu, t->output.paddr);
-		if (!outbuf) {
-			printf("mmap fail\n");
-			ret = -1;
-			goto err11;
-		}
-
 		file_out = fopen(test_handle.outfile, "wb");
 		if (file_out == NULL) {
 			printf("can not open output file %s\n", test_handle.outfile);
 			ret = -1;
-			goto err12;
-		}
-	}
-
-again:
-	ret = ioctl(fd_ipu, IPU_CHECK_TASK, t);
-	if (ret != IPU_CHECK_OK) {
-		if (ret > IPU_CHECK_ERR_MIN) {
-			if (ret == IPU_CHECK_ERR_SPLIT_INPUTW_OVER) {
-				t->input.crop.w -= 8;
-				goto again;
-			}
-			if (ret == IPU_CHECK_ERR_SPLIT_INPUTH_OVER) {
-				t->input.crop.h -= 8;
-				goto again;
-			}
-			if (ret == IPU_CHECK_ERR_SPLIT_OUTPUTW_OVER) {
-				t->output.crop.w -= 8;
-				goto again;
-			}
-			if (ret == IPU_CHECK_ERR_SPLIT_OUTPUTH_OVER) {
-				t->output.crop.h -= 8;
-				goto again;
-			}
-			ret = 0;
-			printf("ipu task check fail\n");
-			goto err13;
+			goto err5;
 		}
 	}
-	dump_ipu_task(t);
-
-task_begin:
-	if (t->input.deinterlace.enable &&
-		(t->input.deinterlace.motion != HIGH_MOTION))
-		if (fread(vdibuf, 1, isize, file_in) < isize) {
-			ret = 0;
-			printf("Can not read enough data from input file\n");
-			goto err13;
-		}
-
-	while((done_cnt < test_handle.fcount) && (ctrl_c_rev == 0)) {
-		gettimeofday(&begin, NULL);
-
-		if (t->input.deinterlace.enable &&
-			(t->input.deinterlace.motion != HIGH_MOTION)) {
-			memcpy(inbuf, vdibuf, isize);
-			ret = fread(vdibuf, 1, isize, file_in);
-		} else
-			ret = fread(inbuf, 1, isize, file_in);
-		if (ret < isize) {
-			ret = 0;
-			printf("Can not read enough data from input file\n");
-			break;
-		}
-
-		ret = ioctl(fd_ipu, IPU_QUEUE_TASK, t);
-		if (ret < 0) {
-			printf("ioct IPU_QUEUE_TASK fail\n");
-			break;
-		}
-
-		if (test_handle.show_to_fb) {
-			ret = ioctl(fd_fb, FBIOPAN_DISPLAY, &fb_var);
-			if (ret < 0) {
-				printf("fb ioct FBIOPAN_DISPLAY fail\n");
-				break;
-			}
-		} else {
-			ret = fwrite(outbuf, 1, osize, file_out);
-			if (ret < osize) {
-				ret = -1;
-				printf("Can not write enough data into output file\n");
-				break;
-			}
-		}
-		done_cnt++;
-		total_cnt++;
 
-		gettimeofday(&end, NULL);
-		sec = end.tv_sec - begin.tv_sec;
-		usec = end.tv_usec - begin.tv_usec;
-
-		if (usec < 0) {
-			sec--;
-			usec = usec + 1000000;
-		}
-		run_time += (sec * 1000000) + usec;
+	ret = ipu_pipeline_init(&pipeline, &dev, t, isize, osize, fb_paddr,
+				test_handle.tasks);
+	if (ret < 0)
+		goto err6;
+	pipeline.in = file_in;
+	pipeline.out = file_out;
+	pipeline.fd_fb = fd_fb;
+	pipeline.fb_var = &fb_var;
+	pipeline.fcount = test_handle.fcount;
+	pipeline.loops = test_handle.loop_cnt > 0 ? test_handle.loop_cnt : 1;
+	pipeline.quit = &ctrl_c_rev;
+
+	if (ipu_pipeline_check(&pipeline) < 0) {
+		ret = 0;
+		goto err6;
 	}
+	dump_ipu_task(&pipeline.task);
 
-	if (ret >= 0) {
-		done_loop++;
-		if ((done_loop < test_handle.loop_cnt) && (ctrl_c_rev == 0)) {
-			done_cnt = 0;
-			fseek(file_in, 0L, SEEK_SET);
-			goto task_begin;
-		}
+	ret = ipu_pipeline_run(&pipeline);
+	if (ret > 0) {
+		total_cnt = ret;
+		ret = 0;
 	}
+	run_time = pipeline.end - pipeline.start;
 
-	printf("total frame count %d avg frame time %d us, fps %f\n",
-			total_cnt, run_time/total_cnt, total_cnt/(run_time/1000000.0));
+	if (total_cnt)
+		printf("total frame count %d avg frame time %d us, fps %f\n",
+			total_cnt, run_time/total_cnt,
+			total_cnt/(run_time/1000000.0));
+	ipu_pipeline_report(&pipeline);
 
-err13:
+err6:
+	ipu_pipeline_fini(&pipeline);
 	if (fd_fb) {
 		blank = FB_BLANK_POWERDOWN;
 		ioctl(fd_fb, FBIOBLANK, blank);
 	}
 	if (file_out)
 		fclose(file_out);
-err12:
-	if (outbuf)
-		munmap(outbuf, osize);
-err11:
+err5:
 	if (fd_fb)
 		close(fd_fb);
-	if (t->output.paddr)
-		ioctl(fd_ipu, IPU_FREE, &t->output.paddr);
-err10:
-	if (alpbuf)
-		munmap(alpbuf, alpsize);
-err9:
-	if (t->overlay.alpha.loc_alp_paddr)
-		ioctl(fd_ipu, IPU_FREE, &t->overlay.alpha.loc_alp_paddr);
-err8:
-	if (ovbuf)
-		munmap(ovbuf, ovsize);
-err7:
-	if (t->overlay.paddr)
-		ioctl(fd_ipu, IPU_FREE, &t->overlay.paddr);
-err6:
-	if (vdibuf)
-		munmap(vdibuf, isize);
-err5:
-	if (t->input.paddr_n)
-		ioctl(fd_ipu, IPU_FREE, &t->input.paddr_n);
 err4:
-	if (inbuf)
-		munmap(inbuf, isize);
+	dev.ops->free(&dev, &alpbuf);
 err3:
-	if (t->input.paddr)
-		ioctl(fd_ipu, IPU_FREE, &t->input.paddr);
+	dev.ops->free(&dev, &ovbuf);
 err2:
-	if (fd_ipu)
-		close(fd_ipu);
+	ipu_dev_close(&dev);
 err1:
 	if (file_in)
 		fclose(file_in);
@@ -30,6 +30,8 @@ typedef struct {
 	int loop_cnt;
 	int show_to_fb;
 	char outfile[128];
+	int tasks;		/* IPU tasks kept queued */
+	char backend[8];	/* "hw" or "sw" */
 } ipu_test_handle_t;
 
 extern int parse_config_file(char *file_name, ipu_test_handle_t *test_handle);
@@ -27,6 +27,7 @@
 #include <unistd.h>
 
 #include "mxc_ipudev_test.h"
+#include "ipu_pipeline.h"
 
 #define MAX_PATH	128
 
@@ -37,12 +38,12 @@
 #define deb_printf
 #endif
 
-char * options = "p:d:t:c:l:i:o:O:s:f:h";
+char * options = "p:d:t:c:l:i:o:O:s:f:q:b:h";
 
 void util_help(void)
 {
  printf("options: \n\r");
- printf("p:d:t:c:l:i:o:O:s:f:h \r\n");
+ printf("p:d:t:c:l:i:o:O:s:f:q:b:h \r\n");
  printf("p: priority\r\n");
  printf("d: tak id\r\n");
  printf("t: timeout\r\n");
@@ -53,6 +54,8 @@ void util_help(void)
  printf("O: output width,height,format,rotation, crop pos.x,pos.y,w,h\r\n");
  printf("s: output to fb enable\r\n");
  printf("f: output file name\r\n");
+ printf("q: tasks kept queued (1-%d)\r\n", IPU_PIPE_MAX_TASKS);
+ printf("b: backend, hw or sw\r\n");
 }
 
 
@@ -589,6 +592,33 @@ int parse_options(char *buf, ipu_test_handle_t *test_handle)
 		}
 	}
 
+	str = strstr(buf, "queue_depth");
+	if (str != NULL) {
+		str = strchr(buf, '=');
+		if (str != NULL) {
+			str++;
+			if (*str != '\0') {
+				test_handle->tasks = strtol(str, NULL, 10);
+				printf("queue_depth\t= %d\n", test_handle->tasks);
+			}
+			return 0;
+		}
+	}
+
+	str = strstr(buf, "backend");
+	if (str != NULL) {
+		str = strchr(buf, '=');
+		if (str != NULL) {
+			str++;
+			if (*str != '\0') {
+				snprintf(test_handle->backend,
+					 sizeof(test_handle->backend), "%s", str);
+				printf("backend\t\t= %s\n", test_handle->backend);
+			}
+			return 0;
+		}
+	}
+
 	return 0;
 }
 
@@ -665,6 +695,8 @@ int parse_cmd_input(int argc, char ** argv, ipu_test_handle_t *test_handle)
 
 	test_handle->show_to_fb = 1;
 	memcpy(test_handle->outfile,"ipu0-1st-ovfb",13);
+	test_handle->tasks = 1;
+	memcpy(test_handle->backend, "hw", 3);
 
 	while((opt = getopt(argc, argv, options)) > 0)
 	{
@@ -770,6 +802,19 @@ int parse_cmd_input(int argc, char ** argv, ipu_test_handle_t *test_handle)
 				sscanf(optarg,"%s",test_handle->outfile);
 				deb_printf("output file name %s \n",test_handle->outfile);
 				break;
+			case 'q':
+				if(NULL == optarg)
+					break;
+				test_handle->tasks = strtol(optarg, NULL, 10);
+				deb_printf("tasks queued %d\n", test_handle->tasks);
+				break;
+			case 'b':
+				if(NULL == optarg)
+					break;
+				snprintf(test_handle->backend,
+					 sizeof(test_handle->backend), "%s", optarg);
+				deb_printf("backend %s\n", test_handle->backend);
+				break;
 			case 'h':
 				util_help();
 				break;
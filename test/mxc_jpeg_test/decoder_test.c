@@ -26,6 +26,8 @@
 #include <linux/v4l2-subdev.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <linux/videodev2.h>
+#include "jpeg_batch.h"
 #include "mxc_jpeg_test.h"
 
 int main(int argc, char *argv[])
@@ -41,6 +43,8 @@ int main(int argc, char *argv[])
 	void *bufferout_start[1] = {0};
 
 	parse_args(argc, argv, &ea);
+	if (ea.batch)
+		return v4l2_batch(&ea, 0);
 
 	fd = open(ea.video_device, O_RDWR);
 	if (fd < 0) {
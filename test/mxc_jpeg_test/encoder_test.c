@@ -26,6 +26,8 @@
 #include <linux/v4l2-subdev.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <linux/videodev2.h>
+#include "jpeg_batch.h"
 #include "mxc_jpeg_test.h"
 
 int main(int argc, char *argv[])
@@ -42,6 +44,8 @@ int main(int argc, char *argv[])
 	void *bufferout_start[2] = {0};
 
 	parse_args(argc, argv, &ea);
+	if (ea.batch)
+		return v4l2_batch(&ea, 1);
 
 	fd = open(ea.video_device, O_RDWR);
 	if (fd < 0) {
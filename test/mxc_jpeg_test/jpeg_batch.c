@@ -0,0 +1,1139 @@
+/*
+ * Copyright 2018 NXP
+ */
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+#include "jpeg_batch.h"
+
+#define FWHT_MAGIC1		0x4f4f4f4f
+#define FWHT_MAGIC2		0xffffffff
+#define FWHT_HDR_SIZE		44
+
+/* Longest wait for a result before a context gives up */
+#define JPEG_TIMEOUT_MS		2000
+
+/* V4L2 device node */
+
+static int v4l2_dev_open(const char *dev)
+{
+	return open(dev, O_RDWR | O_NONBLOCK);
+}
+
+static int v4l2_dev_close(int fd)
+{
+	return close(fd);
+}
+
+static int v4l2_dev_ioctl(int fd, unsigned long req, void *arg)
+{
+	int ret;
+
+	do {
+		ret = ioctl(fd, req, arg);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+static void *v4l2_dev_mmap(int fd, size_t length, off_t offset)
+{
+	return mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		    offset);
+}
+
+static int v4l2_dev_munmap(void *addr, size_t length)
+{
+	return munmap(addr, length);
+}
+
+static int v4l2_dev_poll(int fd, short events, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = events };
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, timeout_ms);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret <= 0 ? ret : pfd.revents;
+}
+
+const struct jpeg_dev_ops jpeg_v4l2_ops = {
+	.name = "v4l2",
+	.open = v4l2_dev_open,
+	.close = v4l2_dev_close,
+	.ioctl = v4l2_dev_ioctl,
+	.mmap = v4l2_dev_mmap,
+	.munmap = v4l2_dev_munmap,
+	.poll = v4l2_dev_poll,
+};
+
+long long jpeg_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static unsigned int be32(const unsigned char *p)
+{
+	return (unsigned int)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static int is_sof(int m)
+{
+	/* SOF0..SOF15, which share the range with DHT, JPG and DAC */
+	return m >= 0xc0 && m <= 0xcf && m != 0xc4 && m != 0xc8 && m != 0xcc;
+}
+
+static size_t jpeg_length(const unsigned char *p, size_t n, int *width,
+			  int *height)
+{
+	size_t i = 2, len;
+	int m;
+
+	if (n < 4 || p[0] != 0xff || p[1] != 0xd8)
+		return 0;
+
+	*width = 0;
+	*height = 0;
+	while (i + 2 <= n) {
+		if (p[i] != 0xff)
+			return 0;
+		m = p[i + 1];
+		if (m == 0xff) {		/* fill byte */
+			i++;
+			continue;
+		}
+		if (m == 0xd9)
+			return *width && *height ? i + 2 : 0;
+		if ((m >= 0xd0 && m <= 0xd7) || m == 0x01) {
+			i += 2;
+			continue;
+		}
+		if (i + 4 > n)
+			return 0;
+		len = p[i + 2] << 8 | p[i + 3];
+		if (len < 2 || i + 2 + len > n)
+			return 0;
+		if (is_sof(m) && len >= 8) {
+			*height = p[i + 5] << 8 | p[i + 6];
+			*width = p[i + 7] << 8 | p[i + 8];
+		}
+		i += 2 + len;
+		if (m != 0xda)
+			continue;
+		/* entropy coded data runs up to the next marker */
+		while (i + 1 < n && (p[i] != 0xff || p[i + 1] == 0 ||
+				     (p[i + 1] >= 0xd0 && p[i + 1] <= 0xd7)))
+			i++;
+	}
+
+	return 0;
+}
+
+size_t jpeg_parse_image(const unsigned char *p, size_t n, int *width,
+			int *height, unsigned int *fourcc)
+{
+	size_t len;
+
+	if (n >= FWHT_HDR_SIZE && be32(p) == FWHT_MAGIC1 &&
+	    be32(p + 4) == FWHT_MAGIC2) {
+		len = FWHT_HDR_SIZE + (size_t)be32(p + 40);
+		*width = be32(p + 12);
+		*height = be32(p + 16);
+		*fourcc = V4L2_PIX_FMT_FWHT;
+		return len <= n && *width > 0 && *height > 0 ? len : 0;
+	}
+
+	*fourcc = V4L2_PIX_FMT_JPEG;
+	return jpeg_length(p, n, width, height);
+}
+
+size_t jpeg_raw_size(unsigned int fourcc, int width, int height)
+{
+	size_t pixels = (size_t)width * height;
+
+	switch (fourcc) {
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_YUV420:
+		return pixels * 3 / 2;
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_UYVY:
+		return pixels * 2;
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_YUV24:
+		return pixels * 3;
+	case V4L2_PIX_FMT_ARGB32:
+		return pixels * 4;
+	case V4L2_PIX_FMT_GREY:
+		return pixels;
+	}
+
+	return 0;
+}
+
+/* Loading */
+
+static int add_image(struct jpeg_batch *b, const char *name, int n,
+		     const unsigned char *data, size_t size, int width,
+		     int height, unsigned int fourcc)
+{
+	struct jpeg_image *img;
+
+	if ((b->nimg & (b->nimg - 1)) == 0) {
+		img = realloc(b->img, (b->nimg ? b->nimg * 2 : 16) *
+			      sizeof(*img));
+		if (!img)
+			return -ENOMEM;
+		b->img = img;
+	}
+	img = &b->img[b->nimg++];
+	if (n)
+		snprintf(img->name, sizeof(img->name), "%s#%d", name, n);
+	else
+		snprintf(img->name, sizeof(img->name), "%s", name);
+	img->data = data;
+	img->size = size;
+	img->width = width;
+	img->height = height;
+	img->fourcc = fourcc;
+	if (!b->encode && size > b->max_coded)
+		b->max_coded = size;
+
+	return 0;
+}
+
+static unsigned char *read_file(const char *path, size_t *size)
+{
+	unsigned char *data;
+	struct stat st;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+	if (fstat(fileno(f), &st) < 0 || st.st_size == 0) {
+		fclose(f);
+		errno = EINVAL;
+		return NULL;
+	}
+	data = malloc(st.st_size);
+	if (data && fread(data, st.st_size, 1, f) != 1) {
+		free(data);
+		data = NULL;
+		errno = EIO;
+	}
+	fclose(f);
+	*size = st.st_size;
+
+	return data;
+}
+
+/* "<width>x<height>" anywhere in the name, as in wall-1024x768-565.rgb */
+static int parse_size(const char *name, int *width, int *height)
+{
+	const char *s;
+
+	for (s = name; *s; s++) {
+		if (!isdigit((unsigned char)*s) ||
+		    (s != name && isdigit((unsigned char)s[-1])))
+			continue;
+		if (sscanf(s, "%dx%d", width, height) == 2 &&
+		    *width > 0 && *height > 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int load_file(struct jpeg_batch *b, const char *path,
+		     const char *name, int width, int height)
+{
+	unsigned char **files, *data;
+	unsigned int fourcc;
+	size_t size, off, len;
+	int n, w, h, ret;
+
+	data = read_file(path, &size);
+	if (!data) {
+		ret = -errno;
+		fprintf(stderr, "Could not read %s: %s\n", path,
+			strerror(errno));
+		return ret;
+	}
+	files = realloc(b->files, (b->nfiles + 1) * sizeof(*files));
+	if (!files) {
+		free(data);
+		return -ENOMEM;
+	}
+	b->files = files;
+	b->files[b->nfiles++] = data;
+
+	if (b->encode) {
+		parse_size(name, &width, &height);
+		len = jpeg_raw_size(b->raw_fourcc, width, height);
+		if (!width || !height) {
+			fprintf(stderr, "Skipping %s: no <width>x<height> in the name, nor -w/-h\n",
+				path);
+			return 0;
+		}
+		if (!len || size < len) {
+			fprintf(stderr, "Skipping %s: no %dx%d frame in it\n",
+				path, width, height);
+			return 0;
+		}
+		for (n = 0, off = 0; off + len <= size; n++, off += len) {
+			ret = add_image(b, name, n, data + off, len, width,
+					height, b->raw_fourcc);
+			if (ret < 0)
+				return ret;
+		}
+		return 0;
+	}
+
+	for (n = 0, off = 0; off < size; n++, off += len) {
+		len = jpeg_parse_image(data + off, size - off, &w, &h,
+				       &fourcc);
+		if (!len)
+			break;
+		ret = add_image(b, name, n, data + off, len, w, h, fourcc);
+		if (ret < 0)
+			return ret;
+	}
+	if (!n)
+		fprintf(stderr, "Skipping %s: no JPEG or FWHT image in it\n",
+			path);
+	else if (off < size)
+		fprintf(stderr, "%s: %zu bytes after image %d ignored\n",
+			path, size - off, n);
+
+	return 0;
+}
+
+int jpeg_batch_load(struct jpeg_batch *b, const char *path, int width,
+		    int height)
+{
+	struct dirent **list;
+	struct stat st;
+	char file[PATH_MAX];
+	const char *name;
+	int i, n, ret = 0;
+
+	if (stat(path, &st) < 0) {
+		ret = -errno;
+		fprintf(stderr, "Could not open %s: %s\n", path,
+			strerror(errno));
+		return ret;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		name = strrchr(path, '/');
+		ret = load_file(b, path, name ? name + 1 : path, width,
+				height);
+	} else {
+		n = scandir(path, &list, NULL, alphasort);
+		if (n < 0) {
+			ret = -errno;
+			fprintf(stderr, "Could not list %s: %s\n", path,
+				strerror(errno));
+			return ret;
+		}
+		for (i = 0; i < n; i++) {
+			snprintf(file, sizeof(file), "%s/%s", path,
+				 list[i]->d_name);
+			if (ret == 0 && list[i]->d_name[0] != '.' &&
+			    stat(file, &st) == 0 && S_ISREG(st.st_mode))
+				ret = load_file(b, file, list[i]->d_name,
+						width, height);
+			free(list[i]);
+		}
+		free(list);
+	}
+	if (ret < 0)
+		return ret;
+
+	if (!b->nimg) {
+		fprintf(stderr, "No images in %s\n", path);
+		return -ENOENT;
+	}
+	/* one OUTPUT buffer size fits every image, so only sizes renegotiate */
+	b->max_coded = (b->max_coded + 4095) & ~(size_t)4095;
+
+	return 0;
+}
+
+/* Contexts */
+
+static int ctx_ioctl(struct jpeg_ctx *c, unsigned long req, void *arg,
+		     const char *name)
+{
+	int err;
+
+	if (c->b->ops->ioctl(c->fd, req, arg) == 0)
+		return 0;
+	err = errno;
+	fprintf(stderr, "ctx %d: %s: %s\n", c->id, name, strerror(err));
+
+	return -err;
+}
+
+#define CTX_IOCTL(c, req, arg)	ctx_ioctl(c, req, arg, #req)
+
+static void read_format(struct jpeg_ctx *c, struct jpeg_queue *q,
+			const struct v4l2_format *fmt)
+{
+	int i;
+
+	if (!c->is_mp) {
+		q->fourcc = fmt->fmt.pix.pixelformat;
+		q->width = fmt->fmt.pix.width;
+		q->height = fmt->fmt.pix.height;
+		q->num_planes = 1;
+		q->sizeimage[0] = fmt->fmt.pix.sizeimage;
+		return;
+	}
+	q->fourcc = fmt->fmt.pix_mp.pixelformat;
+	q->width = fmt->fmt.pix_mp.width;
+	q->height = fmt->fmt.pix_mp.height;
+	q->num_planes = fmt->fmt.pix_mp.num_planes;
+	if (q->num_planes < 1)
+		q->num_planes = 1;
+	if (q->num_planes > JPEG_MAX_PLANES)
+		q->num_planes = JPEG_MAX_PLANES;
+	for (i = 0; i < q->num_planes; i++)
+		q->sizeimage[i] = fmt->fmt.pix_mp.plane_fmt[i].sizeimage;
+}
+
+static int set_format(struct jpeg_ctx *c, struct jpeg_queue *q,
+		      unsigned int fourcc, int width, int height,
+		      unsigned int sizeimage)
+{
+	struct v4l2_format fmt;
+	int ret;
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = q->type;
+	if (!c->is_mp) {
+		fmt.fmt.pix.pixelformat = fourcc;
+		fmt.fmt.pix.width = width;
+		fmt.fmt.pix.height = height;
+		fmt.fmt.pix.field = V4L2_FIELD_NONE;
+		fmt.fmt.pix.sizeimage = sizeimage;
+	} else {
+		fmt.fmt.pix_mp.pixelformat = fourcc;
+		fmt.fmt.pix_mp.width = width;
+		fmt.fmt.pix_mp.height = height;
+		fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+		fmt.fmt.pix_mp.num_planes = 1;
+		fmt.fmt.pix_mp.plane_fmt[0].sizeimage = sizeimage;
+	}
+	ret = CTX_IOCTL(c, VIDIOC_S_FMT, &fmt);
+	if (ret < 0)
+		return ret;
+	/* go on with what the driver made of it */
+	read_format(c, q, &fmt);
+
+	return 0;
+}
+
+static void free_bufs(struct jpeg_ctx *c, struct jpeg_queue *q)
+{
+	struct v4l2_requestbuffers req;
+	int i, p;
+
+	for (i = 0; i < q->count; i++)
+		for (p = 0; p < JPEG_MAX_PLANES; p++)
+			if (q->buf[i].start[p])
+				c->b->ops->munmap(q->buf[i].start[p],
+						  q->buf[i].length[p]);
+	memset(q->buf, 0, sizeof(q->buf));
+	q->count = 0;
+
+	memset(&req, 0, sizeof(req));
+	req.type = q->type;
+	req.memory = V4L2_MEMORY_MMAP;
+	c->b->ops->ioctl(c->fd, VIDIOC_REQBUFS, &req);
+}
+
+static int alloc_bufs(struct jpeg_ctx *c, struct jpeg_queue *q)
+{
+	struct v4l2_requestbuffers req;
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer buf;
+	struct jpeg_buf *jb;
+	unsigned int count;
+	int i, p, np, ret;
+	off_t offset;
+
+	memset(&req, 0, sizeof(req));
+	req.type = q->type;
+	req.memory = V4L2_MEMORY_MMAP;
+	req.count = c->b->depth;
+	ret = CTX_IOCTL(c, VIDIOC_REQBUFS, &req);
+	if (ret < 0)
+		return ret;
+	count = req.count < JPEG_MAX_DEPTH ? req.count : JPEG_MAX_DEPTH;
+	if (!count)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		memset(&buf, 0, sizeof(buf));
+		memset(planes, 0, sizeof(planes));
+		buf.type = q->type;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if (c->is_mp) {
+			buf.m.planes = planes;
+			buf.length = VIDEO_MAX_PLANES;
+		}
+		ret = CTX_IOCTL(c, VIDIOC_QUERYBUF, &buf);
+		if (ret < 0)
+			return ret;
+
+		np = c->is_mp ? buf.length : 1;
+		if (np < q->num_planes)
+			q->num_planes = np;
+		jb = &q->buf[i];
+		q->count = i + 1;
+		for (p = 0; p < q->num_planes; p++) {
+			jb->length[p] = c->is_mp ? planes[p].length :
+						   buf.length;
+			offset = c->is_mp ? planes[p].m.mem_offset :
+					    buf.m.offset;
+			jb->start[p] = c->b->ops->mmap(c->fd, jb->length[p],
+						       offset);
+			if (jb->start[p] == MAP_FAILED) {
+				ret = -errno;
+				jb->start[p] = NULL;
+				fprintf(stderr, "ctx %d: mmap: %s\n", c->id,
+					strerror(-ret));
+				return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int qbuf(struct jpeg_ctx *c, struct jpeg_queue *q, int index,
+		const unsigned int *used, int seq)
+{
+	struct v4l2_plane planes[JPEG_MAX_PLANES];
+	struct v4l2_buffer buf;
+	int p, ret;
+
+	memset(&buf, 0, sizeof(buf));
+	memset(planes, 0, sizeof(planes));
+	buf.type = q->type;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = index;
+	buf.field = V4L2_FIELD_NONE;
+	/* comes back on the result, which tells which image it is */
+	buf.timestamp.tv_sec = seq;
+	if (c->is_mp) {
+		buf.m.planes = planes;
+		buf.length = q->num_planes;
+		for (p = 0; p < q->num_planes; p++) {
+			planes[p].bytesused = used ? used[p] : 0;
+			planes[p].length = q->buf[index].length[p];
+		}
+	} else {
+		buf.bytesused = used ? used[0] : 0;
+		buf.length = q->buf[index].length[0];
+	}
+	ret = CTX_IOCTL(c, VIDIOC_QBUF, &buf);
+	if (ret == 0)
+		q->buf[index].queued = 1;
+
+	return ret;
+}
+
+/* 0, -EAGAIN when nothing is done yet, -EPIPE after the last buffer */
+static int dqbuf(struct jpeg_ctx *c, struct jpeg_queue *q,
+		 struct v4l2_buffer *buf, struct v4l2_plane *planes)
+{
+	int err;
+
+	memset(buf, 0, sizeof(*buf));
+	buf->type = q->type;
+	buf->memory = V4L2_MEMORY_MMAP;
+	if (c->is_mp) {
+		memset(planes, 0, JPEG_MAX_PLANES * sizeof(*planes));
+		buf->m.planes = planes;
+		buf->length = q->num_planes;
+	}
+	if (c->b->ops->ioctl(c->fd, VIDIOC_DQBUF, buf) == 0) {
+		if (buf->index >= q->count)
+			return -EINVAL;
+		q->buf[buf->index].queued = 0;
+		return 0;
+	}
+	err = errno;
+	if (err != EAGAIN && err != EPIPE)
+		fprintf(stderr, "ctx %d: VIDIOC_DQBUF: %s\n", c->id,
+			strerror(err));
+
+	return -err;
+}
+
+static int stream(struct jpeg_ctx *c, int on)
+{
+	int type_cap = c->cap.type, type_out = c->out.type;
+	int ret;
+
+	if (!on) {
+		c->b->ops->ioctl(c->fd, VIDIOC_STREAMOFF, &type_cap);
+		c->b->ops->ioctl(c->fd, VIDIOC_STREAMOFF, &type_out);
+		return 0;
+	}
+	ret = CTX_IOCTL(c, VIDIOC_STREAMON, &type_cap);
+	if (ret == 0)
+		ret = CTX_IOCTL(c, VIDIOC_STREAMON, &type_out);
+
+	return ret;
+}
+
+static int queue_capture(struct jpeg_ctx *c)
+{
+	int i, ret;
+
+	for (i = 0; i < c->cap.count; i++) {
+		ret = qbuf(c, &c->cap, i, NULL, 0);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* Formats and buffers for img, after draining what was in flight */
+static int ctx_configure(struct jpeg_ctx *c, const struct jpeg_image *img)
+{
+	struct jpeg_batch *b = c->b;
+	long long t0 = c->drain_start ? c->drain_start : jpeg_now_us();
+	int ret;
+
+	if (c->cur) {
+		stream(c, 0);
+		free_bufs(c, &c->out);
+		free_bufs(c, &c->cap);
+	}
+
+	if (b->encode) {
+		ret = set_format(c, &c->out, b->raw_fourcc, img->width,
+				 img->height, img->size);
+		if (ret == 0)
+			ret = set_format(c, &c->cap, b->coded_fourcc,
+					 img->width, img->height, 0);
+	} else {
+		ret = set_format(c, &c->out, img->fourcc, img->width,
+				 img->height, b->max_coded);
+		if (ret == 0)
+			ret = set_format(c, &c->cap, b->raw_fourcc,
+					 img->width, img->height, 0);
+	}
+	if (ret == 0)
+		ret = alloc_bufs(c, &c->out);
+	if (ret == 0)
+		ret = alloc_bufs(c, &c->cap);
+	if (ret == 0)
+		ret = queue_capture(c);
+	if (ret == 0)
+		ret = stream(c, 1);
+	if (ret < 0)
+		return ret;
+
+	if (c->cur) {
+		c->renegotiations++;
+		c->reneg_us += jpeg_now_us() - t0;
+	}
+	c->drain_start = 0;
+	c->cur = img;
+	if (b->verbose)
+		printf("ctx %d: %dx%d %.4s -> %dx%d %.4s\n", c->id,
+		       c->out.width, c->out.height, (char *)&c->out.fourcc,
+		       c->cap.width, c->cap.height, (char *)&c->cap.fourcc);
+
+	return 0;
+}
+
+/*
+ * A decoder found another resolution in the stream: take the CAPTURE
+ * format it settled on and give that queue new buffers.
+ */
+static int ctx_source_change(struct jpeg_ctx *c)
+{
+	struct v4l2_format fmt;
+	int type = c->cap.type;
+	int ret;
+
+	c->source_changes++;
+	c->b->ops->ioctl(c->fd, VIDIOC_STREAMOFF, &type);
+	free_bufs(c, &c->cap);
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = c->cap.type;
+	ret = CTX_IOCTL(c, VIDIOC_G_FMT, &fmt);
+	if (ret < 0)
+		return ret;
+	read_format(c, &c->cap, &fmt);
+	if (c->cap.fourcc != c->b->raw_fourcc) {
+		ret = set_format(c, &c->cap, c->b->raw_fourcc, c->cap.width,
+				 c->cap.height, 0);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = alloc_bufs(c, &c->cap);
+	if (ret == 0)
+		ret = queue_capture(c);
+	if (ret == 0)
+		ret = CTX_IOCTL(c, VIDIOC_STREAMON, &type);
+	c->cap_stalled = 0;
+
+	return ret;
+}
+
+static int ctx_events(struct jpeg_ctx *c)
+{
+	struct v4l2_event ev;
+	int change = 0;
+
+	while (c->b->ops->ioctl(c->fd, VIDIOC_DQEVENT, &ev) == 0)
+		if (ev.type == V4L2_EVENT_SOURCE_CHANGE &&
+		    (ev.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION))
+			change = 1;
+
+	return change ? ctx_source_change(c) : 0;
+}
+
+static int free_output(struct jpeg_ctx *c)
+{
+	int i;
+
+	for (i = 0; i < c->out.count; i++)
+		if (!c->out.buf[i].queued)
+			return i;
+
+	return -1;
+}
+
+static int queue_image(struct jpeg_ctx *c, int index, int image)
+{
+	const struct jpeg_image *img = &c->b->img[image];
+	struct jpeg_buf *jb = &c->out.buf[index];
+	unsigned int used[JPEG_MAX_PLANES] = { 0 };
+	const unsigned char *src = img->data;
+	size_t left = img->size, len;
+	int p, ret;
+
+	/* raw frames spread over the planes, compressed ones go in one */
+	for (p = 0; p < c->out.num_planes && left; p++) {
+		len = jb->length[p];
+		if (c->b->encode && c->out.num_planes > 1 &&
+		    c->out.sizeimage[p] < len)
+			len = c->out.sizeimage[p];
+		if (len > left)
+			len = left;
+		memcpy(jb->start[p], src, len);
+		used[p] = len;
+		src += len;
+		left -= len;
+		if (!c->b->encode)
+			break;
+	}
+	if (left) {
+		fprintf(stderr, "ctx %d: %s (%zu bytes) does not fit in %u\n",
+			c->id, img->name, img->size, jb->length[0]);
+		return -ENOSPC;
+	}
+
+	c->fl[c->nfl].seq = ++c->seq;
+	c->fl[c->nfl].image = image;
+	c->fl[c->nfl].queued = jpeg_now_us();
+	ret = qbuf(c, &c->out, index, used, c->seq);
+	if (ret < 0)
+		return ret;
+	c->nfl++;
+	c->bytes_in += img->size;
+
+	return 0;
+}
+
+static int dequeue_output(struct jpeg_ctx *c)
+{
+	struct v4l2_plane planes[JPEG_MAX_PLANES];
+	struct v4l2_buffer buf;
+	int ret;
+
+	while ((ret = dqbuf(c, &c->out, &buf, planes)) == 0)
+		;
+
+	return ret == -EAGAIN || ret == -EPIPE ? 0 : ret;
+}
+
+static int dequeue_capture(struct jpeg_ctx *c)
+{
+	struct v4l2_plane planes[JPEG_MAX_PLANES];
+	struct v4l2_buffer buf;
+	struct jpeg_sample *s;
+	long long now;
+	unsigned int bytes;
+	int k, p, ret;
+
+	while ((ret = dqbuf(c, &c->cap, &buf, planes)) == 0) {
+		now = jpeg_now_us();
+		bytes = buf.bytesused;
+		if (c->is_mp)
+			for (p = 0, bytes = 0; p < buf.length; p++)
+				bytes += planes[p].bytesused;
+		if ((buf.flags & V4L2_BUF_FLAG_LAST) && !bytes) {
+			/* the decoder stopped for a source change */
+			c->cap_stalled = 1;
+			continue;
+		}
+		if (!c->nfl) {
+			ret = qbuf(c, &c->cap, buf.index, NULL, 0);
+			if (ret < 0)
+				return ret;
+			continue;
+		}
+
+		/* by timestamp when the driver copies it, else in order */
+		for (k = 0; k < c->nfl; k++)
+			if (c->fl[k].seq == buf.timestamp.tv_sec)
+				break;
+		if (k == c->nfl)
+			k = 0;
+		s = &c->samples[c->nsamples++];
+		s->image = c->fl[k].image;
+		s->lat_us = now - c->fl[k].queued;
+		memmove(&c->fl[k], &c->fl[k + 1],
+			(c->nfl - k - 1) * sizeof(c->fl[0]));
+		c->nfl--;
+
+		if ((buf.flags & V4L2_BUF_FLAG_ERROR) || !bytes)
+			c->errors++;
+		c->bytes_out += bytes;
+		if (c->b->verbose)
+			printf("ctx %d: %-24s %5dx%-5d %7u -> %8u bytes %8.3f ms%s\n",
+			       c->id, c->b->img[s->image].name,
+			       c->b->img[s->image].width,
+			       c->b->img[s->image].height,
+			       (unsigned int)c->b->img[s->image].size, bytes,
+			       s->lat_us / 1000.0,
+			       buf.flags & V4L2_BUF_FLAG_ERROR ? " error" : "");
+
+		ret = qbuf(c, &c->cap, buf.index, NULL, 0);
+		if (ret < 0)
+			return ret;
+	}
+	if (ret == -EPIPE)
+		c->cap_stalled = 1;
+
+	return ret == -EAGAIN || ret == -EPIPE ? 0 : ret;
+}
+
+static int same_format(const struct jpeg_image *a, const struct jpeg_image *b)
+{
+	return a->width == b->width && a->height == b->height &&
+	       a->fourcc == b->fourcc;
+}
+
+static void *ctx_thread(void *arg)
+{
+	struct jpeg_ctx *c = arg;
+	struct jpeg_batch *b = c->b;
+	int total = b->nimg * b->loops;
+	/* contexts start at different places in the set */
+	int first = c->id * b->nimg / b->contexts;
+	const struct jpeg_image *img;
+	short events = POLLIN | POLLOUT | (c->events ? POLLPRI : 0);
+	int next = 0, image, index, rev, ret = 0;
+
+	c->start = jpeg_now_us();
+	while (c->nsamples < total) {
+		while (next < total && c->nfl < b->depth && !c->cap_stalled) {
+			image = (first + next) % b->nimg;
+			img = &b->img[image];
+			if (!c->cur || !same_format(c->cur, img)) {
+				if (c->nfl) {
+					if (!c->drain_start)
+						c->drain_start = jpeg_now_us();
+					break;
+				}
+				ret = ctx_configure(c, img);
+				if (ret < 0)
+					goto out;
+			}
+			index = free_output(c);
+			if (index < 0)
+				break;
+			ret = queue_image(c, index, image);
+			if (ret < 0)
+				goto out;
+			next++;
+		}
+
+		rev = b->ops->poll(c->fd, events, JPEG_TIMEOUT_MS);
+		if (rev < 0) {
+			ret = -errno;
+			fprintf(stderr, "ctx %d: poll: %s\n", c->id,
+				strerror(errno));
+			goto out;
+		}
+		if (rev == 0 || rev == POLLERR) {
+			fprintf(stderr, "ctx %d: no result %s\n", c->id,
+				rev ? "(POLLERR)" : "in time");
+			ret = rev ? -EIO : -ETIMEDOUT;
+			goto out;
+		}
+		ret = dequeue_output(c);
+		if (ret == 0)
+			ret = dequeue_capture(c);
+		if (ret == 0 && (rev & POLLPRI))
+			ret = ctx_events(c);
+		if (ret < 0)
+			goto out;
+	}
+
+out:
+	c->end = jpeg_now_us();
+	if (c->cur) {
+		stream(c, 0);
+		free_bufs(c, &c->out);
+		free_bufs(c, &c->cap);
+	}
+	c->ret = ret;
+
+	return NULL;
+}
+
+static int ctx_open(struct jpeg_batch *b, struct jpeg_ctx *c, int id)
+{
+	struct v4l2_capability cap;
+	struct v4l2_event_subscription sub;
+	unsigned int caps;
+	int ret;
+
+	c->b = b;
+	c->id = id;
+	c->fd = b->ops->open(b->device);
+	if (c->fd < 0) {
+		ret = -errno;
+		fprintf(stderr, "Could not open video device %s: %s\n",
+			b->device, strerror(errno));
+		return ret;
+	}
+
+	ret = CTX_IOCTL(c, VIDIOC_QUERYCAP, &cap);
+	if (ret < 0)
+		return ret;
+	caps = cap.capabilities & V4L2_CAP_DEVICE_CAPS ?
+	       cap.device_caps : cap.capabilities;
+	if (!(caps & (V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE))) {
+		fprintf(stderr, "Device doesn't handle M2M video capture\n");
+		return -EINVAL;
+	}
+	c->is_mp = !!(caps & V4L2_CAP_VIDEO_M2M_MPLANE);
+	c->out.type = c->is_mp ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE :
+				 V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	c->cap.type = c->is_mp ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE :
+				 V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (id == 0)
+		printf("%s: %s (%s), %s\n", b->device, (char *)cap.card,
+		       (char *)cap.driver,
+		       c->is_mp ? "multi-planar" : "single-plane");
+
+	/* decoders that don't send it get their formats set up front */
+	memset(&sub, 0, sizeof(sub));
+	sub.type = V4L2_EVENT_SOURCE_CHANGE;
+	c->events = !b->encode &&
+		    b->ops->ioctl(c->fd, VIDIOC_SUBSCRIBE_EVENT, &sub) == 0;
+
+	c->samples = calloc(b->nimg * b->loops, sizeof(*c->samples));
+
+	return c->samples ? 0 : -ENOMEM;
+}
+
+int jpeg_batch_run(struct jpeg_batch *b)
+{
+	struct jpeg_ctx *c;
+	int i, ret = 0;
+
+	if (b->depth > JPEG_MAX_DEPTH)
+		b->depth = JPEG_MAX_DEPTH;
+	b->ctx = calloc(b->contexts, sizeof(*b->ctx));
+	if (!b->ctx)
+		return -ENOMEM;
+	for (i = 0; i < b->contexts; i++)
+		b->ctx[i].fd = -1;
+
+	/* every context is open before any starts, as N clients would be */
+	for (i = 0; i < b->contexts && ret == 0; i++)
+		ret = ctx_open(b, &b->ctx[i], i);
+	if (ret < 0)
+		goto out;
+
+	b->start = jpeg_now_us();
+	for (i = 0; i < b->contexts; i++) {
+		c = &b->ctx[i];
+		if (pthread_create(&c->thread, NULL, ctx_thread, c) != 0) {
+			c->ret = -EAGAIN;
+			b->contexts = i;
+			break;
+		}
+	}
+	for (i = 0; i < b->contexts; i++) {
+		pthread_join(b->ctx[i].thread, NULL);
+		if (ret == 0)
+			ret = b->ctx[i].ret;
+	}
+	b->end = jpeg_now_us();
+
+out:
+	for (i = 0; i < b->contexts; i++)
+		if (b->ctx[i].fd >= 0)
+			b->ops->close(b->ctx[i].fd);
+
+	return ret;
+}
+
+/* Report */
+
+static int cmp_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static void print_latency(const char *what, int *lat, int n)
+{
+	long long sum = 0;
+	int i;
+
+	if (!n)
+		return;
+	qsort(lat, n, sizeof(*lat), cmp_int);
+	for (i = 0; i < n; i++)
+		sum += lat[i];
+	/* nearest rank percentiles */
+	printf("%-12s %7d %9.3f %9.3f %9.3f %9.3f %9.3f\n", what, n,
+	       lat[0] / 1000.0, sum / 1000.0 / n,
+	       lat[(n * 50 + 99) / 100 - 1] / 1000.0,
+	       lat[(n * 99 + 99) / 100 - 1] / 1000.0, lat[n - 1] / 1000.0);
+}
+
+void jpeg_batch_report(const struct jpeg_batch *b)
+{
+	const struct jpeg_ctx *c;
+	const struct jpeg_image *img;
+	long long bytes_in = 0, bytes_out = 0, sec;
+	int i, j, k, n, total = 0, errors = 0, reneg = 0;
+	int *lat;
+	char res[16];
+
+	if (!b->ctx || !b->start)
+		return;
+	for (i = 0; i < b->contexts; i++)
+		total += b->ctx[i].nsamples;
+	lat = malloc((total ? total : 1) * sizeof(*lat));
+	if (!lat)
+		return;
+
+	printf("\n%s, %d images x %d loops in %d contexts, %d buffers in flight\n",
+	       b->encode ? "Encode" : "Decode", b->nimg, b->loops,
+	       b->contexts, b->depth);
+	printf("ctx  images errors reneg reneg-ms src-change   img/s\n");
+	for (i = 0; i < b->contexts; i++) {
+		c = &b->ctx[i];
+		sec = c->end - c->start;
+		printf("%3d %7d %6d %5d %8.1f %10d %7.1f%s\n", i,
+		       c->nsamples, c->errors, c->renegotiations,
+		       c->reneg_us / 1000.0, c->source_changes,
+		       sec ? c->nsamples * 1e6 / sec : 0,
+		       c->ret ? " failed" : "");
+		errors += c->errors;
+		reneg += c->renegotiations;
+		bytes_in += c->bytes_in;
+		bytes_out += c->bytes_out;
+	}
+
+	printf("\nLatency (ms)  images       min       avg       p50       p99       max\n");
+	for (i = 0, n = 0; i < b->contexts; i++)
+		for (k = 0; k < b->ctx[i].nsamples; k++)
+			lat[n++] = b->ctx[i].samples[k].lat_us;
+	print_latency("all", lat, n);
+	/* then per resolution, in the order they first appear */
+	for (j = 0; j < b->nimg; j++) {
+		img = &b->img[j];
+		for (k = 0; k < j; k++)
+			if (b->img[k].width == img->width &&
+			    b->img[k].height == img->height)
+				break;
+		if (k < j)
+			continue;
+		for (i = 0, n = 0; i < b->contexts; i++)
+			for (k = 0; k < b->ctx[i].nsamples; k++)
+				if (b->img[b->ctx[i].samples[k].image].width ==
+				    img->width &&
+				    b->img[b->ctx[i].samples[k].image].height ==
+				    img->height)
+					lat[n++] = b->ctx[i].samples[k].lat_us;
+		snprintf(res, sizeof(res), "%dx%d", img->width, img->height);
+		print_latency(res, lat, n);
+	}
+	free(lat);
+
+	sec = b->end - b->start;
+	printf("\n%d images in %.3f s: %.1f images/s, %.1f MB/s in, %.1f MB/s out\n",
+	       total, sec / 1e6, sec ? total * 1e6 / sec : 0,
+	       sec ? bytes_in / (double)sec : 0,
+	       sec ? bytes_out / (double)sec : 0);
+	printf("%d renegotiations, %d errors\n", reneg, errors);
+}
+
+void jpeg_batch_free(struct jpeg_batch *b)
+{
+	int i;
+
+	if (b->ctx)
+		for (i = 0; i < b->contexts; i++)
+			free(b->ctx[i].samples);
+	free(b->ctx);
+	b->ctx = NULL;
+	for (i = 0; i < b->nfiles; i++)
+		free(b->files[i]);
+	free(b->files);
+	b->files = NULL;
+	b->nfiles = 0;
+	free(b->img);
+	b->img = NULL;
+	b->nimg = 0;
+}
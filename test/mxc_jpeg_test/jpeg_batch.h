@@ -0,0 +1,173 @@
+/*
+ * Copyright 2018 NXP
+ */
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+/*
+ * Batch throughput mode for the M2M JPEG codec tests
+ *
+ * A set of images of any resolutions, from a directory or a stream of
+ * concatenated images, goes through several codec contexts at once.  Each
+ * context has its own file handle and runs the whole set, keeps up to
+ * depth buffers queued on both sides, and renegotiates its formats only
+ * when the next image has another resolution or coded format: it drains
+ * what is in flight, then stops streaming, reallocates and restarts.
+ * Source change events from decoders that send them (vicodec) are
+ * followed too.  Latency is from queueing an image to dequeueing its
+ * result.
+ *
+ * The device is reached through jpeg_dev_ops, so the same code drives a
+ * V4L2 device node or the in-process mock codec of jpeg_mock.c.
+ */
+
+#ifndef JPEG_BATCH_H
+#define JPEG_BATCH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <linux/videodev2.h>
+
+#ifndef V4L2_PIX_FMT_FWHT
+#define V4L2_PIX_FMT_FWHT	v4l2_fourcc('F', 'W', 'H', 'T')
+#endif
+
+#define JPEG_MAX_DEPTH	16
+#define JPEG_MAX_PLANES	2
+
+struct jpeg_dev_ops {
+	const char *name;
+	/* The calls behave as open(2) with O_NONBLOCK, ioctl(2), ... */
+	int (*open)(const char *dev);
+	int (*close)(int fd);
+	int (*ioctl)(int fd, unsigned long req, void *arg);
+	void *(*mmap)(int fd, size_t length, off_t offset);
+	int (*munmap)(void *addr, size_t length);
+	/* Returns the poll(2) revents, 0 on timeout or -1 on error */
+	int (*poll)(int fd, short events, int timeout_ms);
+};
+
+extern const struct jpeg_dev_ops jpeg_v4l2_ops;
+/* A JPEG/FWHT codec emulated in the process, jpeg_mock.c */
+extern const struct jpeg_dev_ops jpeg_mock_ops;
+
+struct jpeg_image {
+	char name[64];
+	const unsigned char *data;
+	size_t size;
+	int width;
+	int height;
+	unsigned int fourcc;		/* JPEG or FWHT, raw format to encode */
+};
+
+struct jpeg_buf {
+	void *start[JPEG_MAX_PLANES];
+	unsigned int length[JPEG_MAX_PLANES];
+	int queued;
+};
+
+struct jpeg_queue {
+	unsigned int type;
+	unsigned int fourcc;
+	int width;
+	int height;
+	int num_planes;
+	unsigned int sizeimage[JPEG_MAX_PLANES];
+	int count;
+	struct jpeg_buf buf[JPEG_MAX_DEPTH];
+};
+
+struct jpeg_inflight {
+	int seq;
+	int image;
+	long long queued;		/* us */
+};
+
+struct jpeg_sample {
+	int image;
+	int lat_us;
+};
+
+struct jpeg_batch;
+
+struct jpeg_ctx {
+	struct jpeg_batch *b;
+	int id;
+	int fd;
+	int is_mp;
+	pthread_t thread;
+	struct jpeg_queue out;
+	struct jpeg_queue cap;
+	const struct jpeg_image *cur;	/* formats are set for this one */
+	int events;			/* source change events subscribed */
+	int cap_stalled;		/* LAST buffer seen, waiting for event */
+	struct jpeg_inflight fl[JPEG_MAX_DEPTH];
+	int nfl;
+	int seq;
+	struct jpeg_sample *samples;
+	int nsamples;
+	int renegotiations;
+	int source_changes;
+	int errors;			/* results flagged bad or empty */
+	long long reneg_us;		/* from the start of a drain on */
+	long long drain_start;
+	long long bytes_in;
+	long long bytes_out;
+	long long start;
+	long long end;
+	int ret;
+};
+
+struct jpeg_batch {
+	const struct jpeg_dev_ops *ops;
+	const char *device;
+	int encode;
+	unsigned int raw_fourcc;
+	unsigned int coded_fourcc;	/* encoder only, decoders go by data */
+	int contexts;
+	int depth;			/* buffers in flight per queue */
+	int loops;			/* passes over the set per context */
+	int verbose;			/* print every image */
+
+	struct jpeg_image *img;
+	int nimg;
+	size_t max_coded;		/* largest compressed image */
+	unsigned char **files;
+	int nfiles;
+
+	struct jpeg_ctx *ctx;
+	long long start;
+	long long end;
+};
+
+/*
+ * Length of the JPEG or FWHT image at p, 0 if there is none.  width,
+ * height and fourcc are those of its header.
+ */
+size_t jpeg_parse_image(const unsigned char *p, size_t n, int *width,
+			int *height, unsigned int *fourcc);
+/* Bytes of a raw frame, 0 for formats the batch mode can't encode */
+size_t jpeg_raw_size(unsigned int fourcc, int width, int height);
+long long jpeg_now_us(void);
+
+/*
+ * Collect the images from path: a directory or one file.  Decoders split
+ * files into the images they hold; encoders take the frame size from a
+ * "<width>x<height>" in the file name, or from width and height, and
+ * split files into frames of that size.
+ */
+int jpeg_batch_load(struct jpeg_batch *b, const char *path, int width,
+		    int height);
+/* Returns 0 or a negative errno value of the first context that failed */
+int jpeg_batch_run(struct jpeg_batch *b);
+void jpeg_batch_report(const struct jpeg_batch *b);
+void jpeg_batch_free(struct jpeg_batch *b);
+
+#endif
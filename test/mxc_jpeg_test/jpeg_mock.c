@@ -0,0 +1,682 @@
+/*
+ * Copyright 2018 NXP
+ */
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+/*
+ * Mock M2M JPEG/FWHT codec
+ *
+ * Emulates, in the process, the part of a multi-planar V4L2 M2M codec
+ * that the batch mode uses, so the batch mode can run where there is no
+ * codec.  Every handle is a context with an OUTPUT and a CAPTURE queue;
+ * the contexts share MOCK_CORES codec cores that take jobs from them in
+ * turn and spend MOCK_SETUP_US plus MOCK_NS_PER_PIXEL per pixel on each.
+ * Decoding checks the image header against the CAPTURE format and flags
+ * the result as an error when they disagree; encoding produces a small
+ * but well formed JPEG or FWHT image of the right size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+#include "jpeg_batch.h"
+
+#define MOCK_MAX_CTX		64
+#define MOCK_MAX_BUFS		32
+/* Keeps mock handles apart from real file descriptors */
+#define MOCK_FD_BASE		1000
+
+/* Cost model, about 60 1080p images/s on one core */
+#define MOCK_CORES		1
+#define MOCK_SETUP_US		200
+#define MOCK_NS_PER_PIXEL	8
+
+enum {
+	MOCK_DEQUEUED,
+	MOCK_QUEUED,
+	MOCK_ACTIVE,
+	MOCK_DONE,
+};
+
+struct mock_buf {
+	unsigned char *mem;
+	unsigned int length;
+	unsigned int bytesused;
+	unsigned int flags;
+	struct timeval timestamp;
+	int state;
+};
+
+struct mock_queue {
+	unsigned int fourcc;
+	int width;
+	int height;
+	unsigned int sizeimage;
+	int streaming;
+	int count;
+	struct mock_buf buf[MOCK_MAX_BUFS];
+	int ready[MOCK_MAX_BUFS];	/* queued, in order */
+	int nready;
+	int done[MOCK_MAX_BUFS];
+	int ndone;
+};
+
+struct mock_ctx {
+	int used;
+	int busy;			/* a job of this context is running */
+	struct mock_queue out;
+	struct mock_queue cap;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work;		/* a job may be ready */
+	pthread_cond_t done;		/* a job finished */
+	struct mock_ctx ctx[MOCK_MAX_CTX];
+	int open;
+	int quit;
+	int next;			/* context to look at first */
+	pthread_t core[MOCK_CORES];
+} mock = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+static int is_coded(unsigned int fourcc)
+{
+	return fourcc == V4L2_PIX_FMT_JPEG || fourcc == V4L2_PIX_FMT_FWHT;
+}
+
+static struct mock_ctx *mock_lookup(int fd)
+{
+	int i = fd - MOCK_FD_BASE;
+
+	if (i < 0 || i >= MOCK_MAX_CTX || !mock.ctx[i].used)
+		return NULL;
+
+	return &mock.ctx[i];
+}
+
+static struct mock_queue *mock_queue(struct mock_ctx *c, unsigned int type)
+{
+	if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+		return &c->out;
+	if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+		return &c->cap;
+
+	return NULL;
+}
+
+static void put_be32(unsigned char *p, unsigned int v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* A baseline greyscale JPEG or an FWHT frame of width x height */
+static unsigned int mock_encode(unsigned int fourcc, int width, int height,
+				unsigned char *p, unsigned int length)
+{
+	static const unsigned char sos[] = {
+		0xff, 0xda, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3f, 0x00,
+	};
+	unsigned int payload = width * height / 10;
+
+	if (fourcc == V4L2_PIX_FMT_FWHT) {
+		if (length < 44)
+			return 0;
+		if (payload > length - 44)
+			payload = length - 44;
+		memset(p, 0, 44);
+		put_be32(p, 0x4f4f4f4f);
+		put_be32(p + 4, 0xffffffff);
+		put_be32(p + 8, 3);
+		put_be32(p + 12, width);
+		put_be32(p + 16, height);
+		put_be32(p + 40, payload);
+		memset(p + 44, 0x55, payload);
+		return 44 + payload;
+	}
+
+	if (length < 2 + 13 + sizeof(sos) + 2)
+		return 0;
+	if (payload > length - (2 + 13 + sizeof(sos) + 2))
+		payload = length - (2 + 13 + sizeof(sos) + 2);
+	p[0] = 0xff;
+	p[1] = 0xd8;
+	/* SOF0, 8 bit, one component */
+	p[2] = 0xff;
+	p[3] = 0xc0;
+	p[4] = 0x00;
+	p[5] = 0x0b;
+	p[6] = 0x08;
+	p[7] = height >> 8;
+	p[8] = height;
+	p[9] = width >> 8;
+	p[10] = width;
+	p[11] = 0x01;
+	p[12] = 0x01;
+	p[13] = 0x11;
+	p[14] = 0x00;
+	memcpy(p + 15, sos, sizeof(sos));
+	memset(p + 15 + sizeof(sos), 0x55, payload);
+	p[15 + sizeof(sos) + payload] = 0xff;
+	p[16 + sizeof(sos) + payload] = 0xd9;
+
+	return 17 + sizeof(sos) + payload;
+}
+
+static void mock_sleep_until(long long t)
+{
+	long long us = t - jpeg_now_us();
+	struct timespec ts;
+
+	if (us <= 0)
+		return;
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = us % 1000000 * 1000;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+static struct mock_ctx *mock_next_job(void)
+{
+	struct mock_ctx *c;
+	int i;
+
+	for (i = 0; i < MOCK_MAX_CTX; i++) {
+		c = &mock.ctx[(mock.next + i) % MOCK_MAX_CTX];
+		if (c->used && !c->busy && c->out.streaming &&
+		    c->cap.streaming && c->out.nready && c->cap.nready) {
+			mock.next = (mock.next + i + 1) % MOCK_MAX_CTX;
+			return c;
+		}
+	}
+
+	return NULL;
+}
+
+static int pop(int *fifo, int *n)
+{
+	int v = fifo[0];
+
+	memmove(fifo, fifo + 1, --*n * sizeof(*fifo));
+	return v;
+}
+
+static void *mock_core(void *arg)
+{
+	struct mock_ctx *c;
+	struct mock_buf *ob, *cb;
+	struct mock_queue out, cap;
+	unsigned int fourcc, bytes, flags;
+	long long start;
+	int w, h;
+
+	pthread_mutex_lock(&mock.lock);
+	while (!mock.quit) {
+		c = mock_next_job();
+		if (!c) {
+			pthread_cond_wait(&mock.work, &mock.lock);
+			continue;
+		}
+		ob = &c->out.buf[pop(c->out.ready, &c->out.nready)];
+		cb = &c->cap.buf[pop(c->cap.ready, &c->cap.nready)];
+		ob->state = MOCK_ACTIVE;
+		cb->state = MOCK_ACTIVE;
+		c->busy = 1;
+		/* formats can't change while the queues stream */
+		out = c->out;
+		cap = c->cap;
+		pthread_mutex_unlock(&mock.lock);
+
+		start = jpeg_now_us();
+		flags = 0;
+		if (is_coded(out.fourcc)) {
+			w = h = 0;
+			if (!jpeg_parse_image(ob->mem, ob->bytesused, &w, &h,
+					      &fourcc) ||
+			    fourcc != out.fourcc || w != cap.width ||
+			    h != cap.height)
+				flags = V4L2_BUF_FLAG_ERROR;
+			bytes = flags ? 0 : cap.sizeimage;
+			if (bytes)
+				memset(cb->mem, 0x80, w);
+		} else {
+			w = out.width;
+			h = out.height;
+			if (ob->bytesused < out.sizeimage)
+				flags = V4L2_BUF_FLAG_ERROR;
+			bytes = flags ? 0 : mock_encode(cap.fourcc, w, h,
+							cb->mem, cb->length);
+		}
+		mock_sleep_until(start + MOCK_SETUP_US +
+				 (long long)w * h * MOCK_NS_PER_PIXEL / 1000);
+
+		pthread_mutex_lock(&mock.lock);
+		ob->state = MOCK_DONE;
+		c->out.done[c->out.ndone++] = ob - c->out.buf;
+		cb->state = MOCK_DONE;
+		cb->flags = flags;
+		cb->bytesused = bytes;
+		cb->timestamp = ob->timestamp;
+		c->cap.done[c->cap.ndone++] = cb - c->cap.buf;
+		c->busy = 0;
+		pthread_cond_broadcast(&mock.done);
+	}
+	pthread_mutex_unlock(&mock.lock);
+
+	return NULL;
+}
+
+static void mock_fill_fmt(const struct mock_queue *q, struct v4l2_format *f)
+{
+	struct v4l2_pix_format_mplane *mp = &f->fmt.pix_mp;
+
+	memset(mp, 0, sizeof(*mp));
+	mp->pixelformat = q->fourcc;
+	mp->width = q->width;
+	mp->height = q->height;
+	mp->field = V4L2_FIELD_NONE;
+	mp->num_planes = 1;
+	mp->plane_fmt[0].sizeimage = q->sizeimage;
+	if (!is_coded(q->fourcc))
+		mp->plane_fmt[0].bytesperline = q->width *
+			jpeg_raw_size(q->fourcc, 1, 1);
+}
+
+static int mock_s_fmt(struct mock_ctx *c, struct v4l2_format *f)
+{
+	struct v4l2_pix_format_mplane *mp = &f->fmt.pix_mp;
+	struct mock_queue *q = mock_queue(c, f->type);
+	unsigned int fourcc = mp->pixelformat;
+	int w = mp->width, h = mp->height;
+
+	if (!q)
+		return -EINVAL;
+	if (q->count)
+		return -EBUSY;
+	if (!is_coded(fourcc) && !jpeg_raw_size(fourcc, 2, 2))
+		fourcc = V4L2_PIX_FMT_NV12;
+	w = w < 16 ? 16 : w > 8192 ? 8192 : w;
+	h = h < 16 ? 16 : h > 8192 ? 8192 : h;
+
+	q->fourcc = fourcc;
+	q->width = w;
+	q->height = h;
+	if (!is_coded(fourcc))
+		q->sizeimage = jpeg_raw_size(fourcc, w, h);
+	else if (q == &c->out)
+		q->sizeimage = mp->plane_fmt[0].sizeimage > 4096 ?
+			       mp->plane_fmt[0].sizeimage : 4096;
+	else
+		q->sizeimage = w * h / 2 + 4096;
+	mock_fill_fmt(q, f);
+
+	return 0;
+}
+
+static void mock_free_bufs(struct mock_queue *q)
+{
+	int i;
+
+	for (i = 0; i < q->count; i++)
+		free(q->buf[i].mem);
+	memset(q->buf, 0, sizeof(q->buf));
+	q->count = 0;
+	q->nready = 0;
+	q->ndone = 0;
+}
+
+static int mock_reqbufs(struct mock_ctx *c, struct v4l2_requestbuffers *req)
+{
+	struct mock_queue *q = mock_queue(c, req->type);
+	unsigned int i, n;
+
+	if (!q || req->memory != V4L2_MEMORY_MMAP)
+		return -EINVAL;
+	if (q->streaming)
+		return -EBUSY;
+	mock_free_bufs(q);
+
+	n = req->count < MOCK_MAX_BUFS ? req->count : MOCK_MAX_BUFS;
+	for (i = 0; i < n; i++) {
+		q->buf[i].mem = malloc(q->sizeimage);
+		if (!q->buf[i].mem) {
+			mock_free_bufs(q);
+			return -ENOMEM;
+		}
+		q->buf[i].length = q->sizeimage;
+		q->count++;
+	}
+	req->count = n;
+
+	return 0;
+}
+
+static struct mock_buf *mock_buf(struct mock_ctx *c, struct v4l2_buffer *b,
+				 struct mock_queue **qp)
+{
+	struct mock_queue *q = mock_queue(c, b->type);
+
+	if (!q || b->index >= q->count || b->memory != V4L2_MEMORY_MMAP ||
+	    b->length < 1 || !b->m.planes)
+		return NULL;
+	*qp = q;
+
+	return &q->buf[b->index];
+}
+
+static void mock_fill_buf(struct mock_ctx *c, struct mock_queue *q,
+			  struct mock_buf *mb, struct v4l2_buffer *b)
+{
+	int index = mb - q->buf;
+
+	b->length = 1;
+	b->field = V4L2_FIELD_NONE;
+	b->flags = mb->flags | V4L2_BUF_FLAG_TIMESTAMP_COPY;
+	if (mb->state == MOCK_QUEUED || mb->state == MOCK_ACTIVE)
+		b->flags |= V4L2_BUF_FLAG_QUEUED;
+	b->timestamp = mb->timestamp;
+	memset(b->m.planes, 0, sizeof(*b->m.planes));
+	b->m.planes[0].bytesused = mb->bytesused;
+	b->m.planes[0].length = mb->length;
+	/* context, queue and index, a page apart */
+	b->m.planes[0].m.mem_offset = (((c - mock.ctx) * 2 + (q == &c->cap)) *
+				       MOCK_MAX_BUFS + index) * 4096;
+}
+
+static int mock_qbuf(struct mock_ctx *c, struct v4l2_buffer *b)
+{
+	struct mock_queue *q;
+	struct mock_buf *mb = mock_buf(c, b, &q);
+
+	if (!mb || mb->state != MOCK_DEQUEUED)
+		return -EINVAL;
+	if (q == &c->out) {
+		if (b->m.planes[0].bytesused > mb->length)
+			return -EINVAL;
+		mb->bytesused = b->m.planes[0].bytesused;
+		mb->timestamp = b->timestamp;
+	}
+	mb->flags = 0;
+	mb->state = MOCK_QUEUED;
+	q->ready[q->nready++] = b->index;
+	pthread_cond_broadcast(&mock.work);
+
+	return 0;
+}
+
+static int mock_dqbuf(struct mock_ctx *c, struct v4l2_buffer *b)
+{
+	struct mock_queue *q = mock_queue(c, b->type);
+	struct mock_buf *mb;
+
+	if (!q || b->length < 1 || !b->m.planes)
+		return -EINVAL;
+	if (!q->ndone)
+		return q->streaming ? -EAGAIN : -EINVAL;
+	b->index = pop(q->done, &q->ndone);
+	mb = &q->buf[b->index];
+	mb->state = MOCK_DEQUEUED;
+	mock_fill_buf(c, q, mb, b);
+
+	return 0;
+}
+
+static void mock_streamoff(struct mock_ctx *c, struct mock_queue *q)
+{
+	int i;
+
+	while (c->busy)
+		pthread_cond_wait(&mock.done, &mock.lock);
+	q->streaming = 0;
+	for (i = 0; i < q->count; i++) {
+		q->buf[i].state = MOCK_DEQUEUED;
+		q->buf[i].flags = 0;
+	}
+	q->nready = 0;
+	q->ndone = 0;
+}
+
+static int mock_ioctl_locked(struct mock_ctx *c, unsigned long req,
+			     void *arg)
+{
+	struct v4l2_capability *cap;
+	struct v4l2_format *f;
+	struct mock_queue *q;
+	struct mock_buf *mb;
+
+	switch (req) {
+	case VIDIOC_QUERYCAP:
+		cap = arg;
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "jpeg-mock");
+		strcpy((char *)cap->card, "mock M2M JPEG/FWHT codec");
+		strcpy((char *)cap->bus_info, "platform:jpeg-mock");
+		cap->device_caps = V4L2_CAP_VIDEO_M2M_MPLANE |
+				   V4L2_CAP_STREAMING;
+		cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+		return 0;
+	case VIDIOC_G_FMT:
+		f = arg;
+		q = mock_queue(c, f->type);
+		if (!q)
+			return -EINVAL;
+		mock_fill_fmt(q, f);
+		return 0;
+	case VIDIOC_S_FMT:
+		return mock_s_fmt(c, arg);
+	case VIDIOC_REQBUFS:
+		return mock_reqbufs(c, arg);
+	case VIDIOC_QUERYBUF:
+		mb = mock_buf(c, arg, &q);
+		if (!mb)
+			return -EINVAL;
+		mock_fill_buf(c, q, mb, arg);
+		return 0;
+	case VIDIOC_QBUF:
+		return mock_qbuf(c, arg);
+	case VIDIOC_DQBUF:
+		return mock_dqbuf(c, arg);
+	case VIDIOC_STREAMON:
+		q = mock_queue(c, *(int *)arg);
+		if (!q || !q->count)
+			return -EINVAL;
+		q->streaming = 1;
+		pthread_cond_broadcast(&mock.work);
+		return 0;
+	case VIDIOC_STREAMOFF:
+		q = mock_queue(c, *(int *)arg);
+		if (!q)
+			return -EINVAL;
+		mock_streamoff(c, q);
+		return 0;
+	}
+
+	/* no events: the formats always come from the client */
+	return -ENOTTY;
+}
+
+static int mock_ioctl(int fd, unsigned long req, void *arg)
+{
+	struct mock_ctx *c;
+	int ret = -EBADF;
+
+	pthread_mutex_lock(&mock.lock);
+	c = mock_lookup(fd);
+	if (c)
+		ret = mock_ioctl_locked(c, req, arg);
+	pthread_mutex_unlock(&mock.lock);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mock_open(const char *dev)
+{
+	int i, j;
+
+	pthread_mutex_lock(&mock.lock);
+	for (i = 0; i < MOCK_MAX_CTX; i++)
+		if (!mock.ctx[i].used)
+			break;
+	if (i == MOCK_MAX_CTX) {
+		pthread_mutex_unlock(&mock.lock);
+		errno = EBUSY;
+		return -1;
+	}
+	if (!mock.open++) {
+		for (j = 0; j < MOCK_CORES; j++)
+			if (pthread_create(&mock.core[j], NULL, mock_core,
+					   NULL) != 0)
+				break;
+		if (j < MOCK_CORES) {
+			mock.quit = 1;
+			pthread_cond_broadcast(&mock.work);
+			pthread_mutex_unlock(&mock.lock);
+			while (j--)
+				pthread_join(mock.core[j], NULL);
+			pthread_mutex_lock(&mock.lock);
+			mock.quit = 0;
+			mock.open--;
+			pthread_mutex_unlock(&mock.lock);
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+	memset(&mock.ctx[i], 0, sizeof(mock.ctx[i]));
+	mock.ctx[i].used = 1;
+	pthread_mutex_unlock(&mock.lock);
+
+	return MOCK_FD_BASE + i;
+}
+
+static int mock_close(int fd)
+{
+	struct mock_ctx *c;
+	int j;
+
+	pthread_mutex_lock(&mock.lock);
+	c = mock_lookup(fd);
+	if (!c) {
+		pthread_mutex_unlock(&mock.lock);
+		errno = EBADF;
+		return -1;
+	}
+	mock_streamoff(c, &c->out);
+	mock_streamoff(c, &c->cap);
+	mock_free_bufs(&c->out);
+	mock_free_bufs(&c->cap);
+	c->used = 0;
+	if (--mock.open) {
+		pthread_mutex_unlock(&mock.lock);
+		return 0;
+	}
+	mock.quit = 1;
+	pthread_cond_broadcast(&mock.work);
+	pthread_mutex_unlock(&mock.lock);
+	for (j = 0; j < MOCK_CORES; j++)
+		pthread_join(mock.core[j], NULL);
+	pthread_mutex_lock(&mock.lock);
+	mock.quit = 0;
+	pthread_mutex_unlock(&mock.lock);
+
+	return 0;
+}
+
+static void *mock_mmap(int fd, size_t length, off_t offset)
+{
+	struct mock_ctx *c;
+	struct mock_queue *q;
+	void *p = MAP_FAILED;
+	long n = offset / 4096;
+	int index = n % MOCK_MAX_BUFS;
+
+	pthread_mutex_lock(&mock.lock);
+	c = mock_lookup(fd);
+	if (c && offset % 4096 == 0 &&
+	    n / MOCK_MAX_BUFS / 2 == c - mock.ctx) {
+		q = n / MOCK_MAX_BUFS % 2 ? &c->cap : &c->out;
+		if (index < q->count && length <= q->buf[index].length)
+			p = q->buf[index].mem;
+	}
+	pthread_mutex_unlock(&mock.lock);
+	if (p == MAP_FAILED)
+		errno = EINVAL;
+
+	return p;
+}
+
+static int mock_munmap(void *addr, size_t length)
+{
+	/* the memory goes with the buffers, on VIDIOC_REQBUFS or close */
+	return 0;
+}
+
+static int mock_poll(int fd, short events, int timeout_ms)
+{
+	struct mock_ctx *c;
+	struct timespec ts;
+	int rev = -1;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += timeout_ms % 1000 * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&mock.lock);
+	c = mock_lookup(fd);
+	while (c) {
+		rev = 0;
+		if (c->out.ndone)
+			rev |= POLLOUT;
+		if (c->cap.ndone)
+			rev |= POLLIN;
+		rev &= events;
+		if (!c->out.streaming && !c->cap.streaming)
+			rev |= POLLERR;
+		if (rev || pthread_cond_timedwait(&mock.done, &mock.lock,
+						  &ts) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&mock.lock);
+	if (rev < 0)
+		errno = EBADF;
+
+	return rev;
+}
+
+const struct jpeg_dev_ops jpeg_mock_ops = {
+	.name = "mock",
+	.open = mock_open,
+	.close = mock_close,
+	.ioctl = mock_ioctl,
+	.mmap = mock_mmap,
+	.munmap = mock_munmap,
+	.poll = mock_poll,
+};
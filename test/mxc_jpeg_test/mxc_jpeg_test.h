@@ -21,6 +21,10 @@ struct encoder_args {
 	int fourcc;
 	int hexdump;
 	int num_iter;
+	int batch;
+	int contexts;
+	int depth;
+	int coded_fourcc;
 };
 
 struct pix_fmt_data {
@@ -71,6 +75,10 @@ void print_usage(char *str)
 	printf("-p <pixel_format> ");
 	printf("[-n <iterations>] ");
 	printf("[-x]\n");
+	printf("       %s -b -d </dev/videoX|mock> -f <DIR|FILE> ", str);
+	printf("-p <pixel_format> ");
+	printf("[-j <contexts>] [-q <buffers>] [-c jpeg|fwht] ");
+	printf("[-w <width> -h <height>] [-n <loops>] [-x]\n");
 	printf("Supported pixel formats:\n");
 	for (i = 0; i < sizeof(fmt_data) / sizeof(*fmt_data); i++)
 		printf("\t%8s: %s\n",
@@ -79,6 +87,15 @@ void print_usage(char *str)
 	printf("Optional arguments:\n");
 	printf("\t-x: print a hexdump of the result\n");
 	printf("\t-n: number of iterations for enqueue/dequeue loop\n");
+	printf("Batch mode:\n");
+	printf("\t-b: run every image of a directory, MJPEG or FWHT stream\n");
+	printf("\t    (decoder), or raw frames named <width>x<height>\n");
+	printf("\t    (encoder), -w/-h for names without a size\n");
+	printf("\t-j: contexts run concurrently, each on the whole set\n");
+	printf("\t-q: buffers in flight per queue and context\n");
+	printf("\t-c: format the encoder produces, jpeg or fwht\n");
+	printf("\t-n: passes over the set, -x: print every image\n");
+	printf("\t-d mock: in-process mock codec instead of a device\n");
 }
 
 
@@ -100,7 +117,10 @@ int parse_args(int argc, char **argv, struct encoder_args *ea)
 	memset(ea, 0, sizeof(struct encoder_args));
 	opterr = 0;
 	ea->num_iter = 1;
-	while ((c = getopt(argc, argv, "+d:f:w:h:p:xn:")) != -1)
+	ea->contexts = 1;
+	ea->depth = 4;
+	ea->coded_fourcc = V4L2_PIX_FMT_JPEG;
+	while ((c = getopt(argc, argv, "+d:f:w:h:p:xn:bj:q:c:")) != -1)
 		switch (c) {
 		case 'd':
 			ea->video_device = optarg;
@@ -133,6 +153,35 @@ int parse_args(int argc, char **argv, struct encoder_args *ea)
 				goto print_usage_and_exit;
 			}
 			break;
+		case 'b':
+			ea->batch = 1;
+			break;
+		case 'j':
+			ea->contexts = strtol(optarg, 0, 0);
+			if (ea->contexts < 1) {
+				fprintf(stderr, "Need at least 1 context\n");
+				goto print_usage_and_exit;
+			}
+			break;
+		case 'q':
+			ea->depth = strtol(optarg, 0, 0);
+			if (ea->depth < 1 || ea->depth > JPEG_MAX_DEPTH) {
+				fprintf(stderr, "Buffers in flight: 1 to %d\n",
+					JPEG_MAX_DEPTH);
+				goto print_usage_and_exit;
+			}
+			break;
+		case 'c':
+			if (strcmp(optarg, "jpeg") == 0) {
+				ea->coded_fourcc = V4L2_PIX_FMT_JPEG;
+			} else if (strcmp(optarg, "fwht") == 0) {
+				ea->coded_fourcc = V4L2_PIX_FMT_FWHT;
+			} else {
+				fprintf(stderr, "Unsupported coded format %s\n",
+					optarg);
+				goto print_usage_and_exit;
+			}
+			break;
 		case '?':
 			if (optopt == 'c')
 				fprintf(stderr,
@@ -150,10 +199,11 @@ int parse_args(int argc, char **argv, struct encoder_args *ea)
 			exit(1);
 		}
 
-	if (ea->video_device == 0 || ea->test_file == 0 ||
-		ea->width == 0 || ea->height == 0 || ea->fmt == 0) {
+	if (ea->video_device == 0 || ea->test_file == 0 || ea->fmt == 0)
+		goto print_usage_and_exit;
+	/* batch mode reads the sizes from the images or their names */
+	if (!ea->batch && (ea->width == 0 || ea->height == 0))
 		goto print_usage_and_exit;
-	}
 
 	return 1;
 
@@ -522,3 +572,33 @@ void v4l2_print_payload(bool is_mp, struct v4l2_buffer *buf,
 		}
 	}
 }
+
+int v4l2_batch(const struct encoder_args *ea, int encode)
+{
+	struct jpeg_batch b;
+	int ret;
+
+	memset(&b, 0, sizeof(b));
+	if (strcmp(ea->video_device, "mock") == 0)
+		b.ops = &jpeg_mock_ops;
+	else
+		b.ops = &jpeg_v4l2_ops;
+	b.device = ea->video_device;
+	b.encode = encode;
+	b.raw_fourcc = ea->fourcc;
+	b.coded_fourcc = ea->coded_fourcc;
+	b.contexts = ea->contexts;
+	b.depth = ea->depth;
+	b.loops = ea->num_iter;
+	b.verbose = ea->hexdump;
+
+	ret = jpeg_batch_load(&b, ea->test_file, ea->width, ea->height);
+	if (ret == 0) {
+		printf("%d images from %s\n", b.nimg, ea->test_file);
+		ret = jpeg_batch_run(&b);
+		jpeg_batch_report(&b);
+	}
+	jpeg_batch_free(&b);
+
+	return ret < 0 ? 1 : 0;
+}
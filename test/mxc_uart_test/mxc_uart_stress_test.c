@@ -20,6 +20,7 @@
 #include <pthread.h>
 #include <sys/ioctl.h>
 #include "../../include/test_utils.h"
+#include "uart_bench.h"
 
 #define TIOCM_LOOP      0x8000
 #define CHUNK_SIZE_DEFAULT 1024
@@ -27,7 +28,7 @@
 static int log_out = 0;
 static int loopflag = 0;
 
-static int uart_speed(int s)
+int uart_speed(int s)
 {
 	switch (s) {
 	case 9600:
@@ -444,6 +445,9 @@ int main(int argc, char* argv[])
 	int flow_control = 0;
 	char op;
 
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+		return uart_bench_main(argc - 1, argv + 1);
+
 	print_name(argv);
 	if (argc < 8) {
 		printf("Usage:\n\t%s <PORT> <BAUDRATE> <F> <R/W/L/D> <X> <Y> <O>\n"
@@ -479,6 +483,8 @@ int main(int argc, char* argv[])
 			"	  ./mxc_uart_stress_test.out /dev/ttymxc4 115200 D D 1000 1000 O\n\n"
 			"in mx6, two board full duplex R/W test (flowcontrol enable)"
 			"	  ./mxc_uart_stress_test.out /dev/ttymxc4 115200 F D 1000 1000 O\n\n"
+			"Throughput/latency/CPU benchmark (see --bench --help):\n"
+			"	  ./mxc_uart_stress_test.out --bench [--port <PORT>] [--baud 115200,4000000]\n\n"
 			,
 			argv[0]);
 		return 0;
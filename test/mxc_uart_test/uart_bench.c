@@ -0,0 +1,892 @@
+/*
+ * Copyright (C) 2014 Freescale Semiconductor, Inc. All rights reserved.
+ */
+
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+/*
+ * UART benchmark: sustained throughput, per message round trip latency
+ * and CPU cost for every combination of baud rate, chunk size, flow
+ * control and read path (blocking read, select, epoll, io_uring).
+ *
+ * The port under test is the "near" end: it is always the one read.
+ * The "far" end writes the throughput stream and echoes latency
+ * messages back. With a single port the far end is the port itself
+ * (internal or external loopback), with --pair it is the second port,
+ * and without a port it is the master side of a pseudo-terminal whose
+ * slave is the near end. A pty has no line, so the writer paces itself
+ * to the baud rate and RTS/CTS has no effect.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+
+#include "uart_bench.h"
+
+#define TIOCM_LOOP		0x8000
+#define BENCH_CHUNK_MAX		4096
+#define BENCH_TIMEOUT_MS	1000
+#define BENCH_LIST_MAX		16
+
+enum bench_io {
+	IO_BLOCKING,
+	IO_SELECT,
+	IO_EPOLL,
+	IO_URING,
+	IO_MODES,
+};
+
+static const char *io_names[IO_MODES] = {
+	"blocking", "select", "epoll", "io_uring",
+};
+
+struct bench_port {
+	int near;		/* read, and written for latency */
+	int far;		/* writes the stream, echoes messages */
+	int pty;
+	int echo;		/* far is a separate fd that must echo */
+};
+
+struct bench_uring {
+	int fd;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+#ifdef __NR_io_uring_setup
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	size_t sqes_size;
+#endif
+};
+
+struct bench_reader {
+	enum bench_io io;
+	int fd;
+	int epfd;
+	struct bench_uring ring;
+	unsigned long reads;	/* reads that returned data */
+};
+
+struct bench_config {
+	int baud;
+	int chunk;
+	int flow;
+	enum bench_io io;
+};
+
+struct bench_writer {
+	int fd;
+	int chunk;
+	int baud;
+	int pace;
+	double seconds;
+	unsigned long long written;
+	int error;
+	volatile int done;
+};
+
+struct bench_echo {
+	int fd;
+	volatile int stop;
+};
+
+static double bench_seconds = 2.0;
+static int bench_messages = 500;
+static int bench_loop;
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec * 1e6 + ru.ru_utime.tv_usec +
+	       ru.ru_stime.tv_sec * 1e6 + ru.ru_stime.tv_usec;
+}
+
+/* byte time on the line: start bit, 8 data bits, stop bit */
+static double line_us(unsigned long long bytes, int baud)
+{
+	return bytes * 10 * 1e6 / baud;
+}
+
+static int configure_tty(int fd, int baud, int flow, enum bench_io io)
+{
+	struct termios ti;
+
+	if (tcgetattr(fd, &ti) < 0) {
+		perror("Can't get port settings");
+		return -1;
+	}
+
+	cfmakeraw(&ti);
+	ti.c_cflag |= CLOCAL | CREAD;
+	if (flow)
+		ti.c_cflag |= CRTSCTS;
+	else
+		ti.c_cflag &= ~CRTSCTS;
+
+	/*
+	 * A blocking read returns as soon as data is there or after the
+	 * timeout; the event driven paths only read what is available.
+	 */
+	if (io == IO_BLOCKING) {
+		ti.c_cc[VMIN] = 0;
+		ti.c_cc[VTIME] = BENCH_TIMEOUT_MS / 100;
+	} else {
+		ti.c_cc[VMIN] = 1;
+		ti.c_cc[VTIME] = 0;
+	}
+
+	cfsetospeed(&ti, uart_speed(baud));
+	cfsetispeed(&ti, uart_speed(baud));
+	if (tcsetattr(fd, TCSANOW, &ti) < 0) {
+		perror("Can't set port settings");
+		return -1;
+	}
+
+	tcflush(fd, TCIOFLUSH);
+	return 0;
+}
+
+static int open_port(const char *dev)
+{
+	int fd, pins;
+
+	fd = open(dev, O_RDWR | O_NOCTTY);
+	if (fd < 0) {
+		perror("Can't open serial port");
+		return -1;
+	}
+
+	if (ioctl(fd, TIOCMGET, &pins) == 0) {
+		if (bench_loop)
+			pins |= TIOCM_LOOP;
+		else
+			pins &= ~TIOCM_LOOP;
+		ioctl(fd, TIOCMSET, &pins);
+	}
+
+	return fd;
+}
+
+static int open_pty(struct bench_port *port)
+{
+	int master;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+		perror("Can't open pseudo-terminal");
+		return -1;
+	}
+
+	port->near = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (port->near < 0) {
+		perror("Can't open pseudo-terminal slave");
+		close(master);
+		return -1;
+	}
+
+	port->far = master;
+	port->pty = 1;
+	port->echo = 1;
+	return 0;
+}
+
+#ifdef __NR_io_uring_setup
+static int uring_init(struct bench_uring *ring)
+{
+	struct io_uring_params p;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, 4, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+	    ring->sqes == MAP_FAILED) {
+		close(ring->fd);
+		ring->fd = -1;
+		return -1;
+	}
+
+	ring->sq_tail = (unsigned int *)((char *)ring->sq_ring + p.sq_off.tail);
+	ring->sq_mask = (unsigned int *)((char *)ring->sq_ring + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)((char *)ring->sq_ring + p.sq_off.array);
+	ring->cq_head = (unsigned int *)((char *)ring->cq_ring + p.cq_off.head);
+	ring->cq_tail = (unsigned int *)((char *)ring->cq_ring + p.cq_off.tail);
+	ring->cq_mask = (unsigned int *)((char *)ring->cq_ring + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + p.cq_off.cqes);
+	return 0;
+}
+
+static void uring_exit(struct bench_uring *ring)
+{
+	if (ring->fd < 0)
+		return;
+	munmap(ring->sqes, ring->sqes_size);
+	munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	ring->fd = -1;
+}
+
+/* a read linked to a timeout; both complete before this returns */
+static int uring_read(struct bench_uring *ring, int fd, void *buf, int len)
+{
+	struct __kernel_timespec ts = {
+		.tv_sec = BENCH_TIMEOUT_MS / 1000,
+		.tv_nsec = (BENCH_TIMEOUT_MS % 1000) * 1000000,
+	};
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned int tail, head, idx, seen = 0;
+	int res = 0;
+
+	tail = *ring->sq_tail;
+
+	idx = tail & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->off = -1;
+	sqe->user_data = 1;
+	ring->sq_array[idx] = idx;
+
+	idx = (tail + 1) & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_LINK_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (unsigned long)&ts;
+	sqe->len = 1;
+	sqe->user_data = 2;
+	ring->sq_array[idx] = idx;
+
+	__atomic_store_n(ring->sq_tail, tail + 2, __ATOMIC_RELEASE);
+
+	while (seen < 2) {
+		if (syscall(__NR_io_uring_enter, ring->fd, seen ? 0 : 2, 2 - seen,
+			    IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		head = *ring->cq_head;
+		while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			if (cqe->user_data == 1)
+				res = cqe->res;
+			head++;
+			seen++;
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	/* cancelled by the timeout */
+	if (res == -ECANCELED || res == -EINTR)
+		return 0;
+	if (res < 0) {
+		errno = -res;
+		return -1;
+	}
+	return res;
+}
+#else
+static int uring_init(struct bench_uring *ring)
+{
+	ring->fd = -1;
+	return -1;
+}
+
+static void uring_exit(struct bench_uring *ring)
+{
+}
+
+static int uring_read(struct bench_uring *ring, int fd, void *buf, int len)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif
+
+static int reader_init(struct bench_reader *r, enum bench_io io, int fd)
+{
+	struct epoll_event ev;
+
+	memset(r, 0, sizeof(*r));
+	r->io = io;
+	r->fd = fd;
+	r->epfd = -1;
+	r->ring.fd = -1;
+
+	if (io == IO_EPOLL) {
+		r->epfd = epoll_create1(0);
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		if (r->epfd < 0 || epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			perror("epoll");
+			return -1;
+		}
+	} else if (io == IO_URING) {
+		if (uring_init(&r->ring) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void reader_exit(struct bench_reader *r)
+{
+	if (r->epfd >= 0)
+		close(r->epfd);
+	uring_exit(&r->ring);
+}
+
+/* bytes read, 0 on timeout, -1 on error */
+static int reader_read(struct bench_reader *r, unsigned char *buf, int len)
+{
+	struct epoll_event ev;
+	struct timeval tv;
+	fd_set rfds;
+	int ret;
+
+	switch (r->io) {
+	case IO_SELECT:
+		FD_ZERO(&rfds);
+		FD_SET(r->fd, &rfds);
+		tv.tv_sec = BENCH_TIMEOUT_MS / 1000;
+		tv.tv_usec = (BENCH_TIMEOUT_MS % 1000) * 1000;
+		ret = select(r->fd + 1, &rfds, NULL, NULL, &tv);
+		if (ret <= 0)
+			return ret;
+		ret = read(r->fd, buf, len);
+		break;
+	case IO_EPOLL:
+		ret = epoll_wait(r->epfd, &ev, 1, BENCH_TIMEOUT_MS);
+		if (ret <= 0)
+			return ret;
+		ret = read(r->fd, buf, len);
+		break;
+	case IO_URING:
+		ret = uring_read(&r->ring, r->fd, buf, len);
+		break;
+	default:
+		ret = read(r->fd, buf, len);
+		break;
+	}
+
+	if (ret < 0 && errno == EINTR)
+		ret = 0;
+	if (ret > 0)
+		r->reads++;
+	return ret;
+}
+
+static int write_all(int fd, const unsigned char *buf, int len)
+{
+	int n, done = 0;
+
+	while (done < len) {
+		n = write(fd, buf + done, len - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		done += n;
+	}
+
+	return 0;
+}
+
+static void sleep_until_us(double t)
+{
+	struct timespec ts;
+
+	ts.tv_sec = t / 1e6;
+	ts.tv_nsec = (t - ts.tv_sec * 1e6) * 1e3;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static void *writer_thread(void *arg)
+{
+	struct bench_writer *w = arg;
+	unsigned char buf[BENCH_CHUNK_MAX];
+	double start = now_us(), end = start + w->seconds * 1e6;
+	int i;
+
+	while (now_us() < end) {
+		/*
+		 * A pty takes data as fast as it is read: hand over a chunk
+		 * only when it would have been shifted out at the baud rate.
+		 */
+		if (w->pace)
+			sleep_until_us(start + line_us(w->written + w->chunk, w->baud));
+
+		for (i = 0; i < w->chunk; i++)
+			buf[i] = (w->written + i) & 0xFF;
+		if (write_all(w->fd, buf, w->chunk) < 0) {
+			w->error = errno;
+			break;
+		}
+		w->written += w->chunk;
+	}
+
+	w->done = 1;
+	return NULL;
+}
+
+static void *echo_thread(void *arg)
+{
+	struct bench_echo *e = arg;
+	unsigned char buf[BENCH_CHUNK_MAX];
+	struct pollfd pfd;
+	int n;
+
+	pfd.fd = e->fd;
+	pfd.events = POLLIN;
+	while (!e->stop) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		n = read(e->fd, buf, sizeof(buf));
+		if (n <= 0)
+			continue;
+		if (write_all(e->fd, buf, n) < 0)
+			break;
+	}
+
+	return NULL;
+}
+
+struct bench_result {
+	double kbps;
+	double line_pct;
+	double bytes_per_read;
+	double cpu_pct;
+	double cpu_us_per_kb;
+	double lat[4];		/* p50, p99, p99.9, max */
+	unsigned long errors;
+	unsigned long long lost;
+	int lat_count;
+};
+
+static int run_throughput(struct bench_port *port, struct bench_config *cfg,
+			  struct bench_result *res)
+{
+	struct bench_writer w;
+	struct bench_reader r;
+	pthread_t tid;
+	unsigned char buf[BENCH_CHUNK_MAX];
+	unsigned long long received = 0, expect = 0;
+	double start, last, elapsed, cpu;
+	int i, n;
+
+	if (reader_init(&r, cfg->io, port->near) < 0) {
+		reader_exit(&r);
+		return -1;
+	}
+
+	memset(&w, 0, sizeof(w));
+	w.fd = port->far;
+	w.chunk = cfg->chunk;
+	w.baud = cfg->baud;
+	w.pace = port->pty;
+	w.seconds = bench_seconds;
+
+	cpu = cpu_us();
+	start = last = now_us();
+	if (pthread_create(&tid, NULL, writer_thread, &w)) {
+		reader_exit(&r);
+		return -1;
+	}
+
+	for (;;) {
+		n = reader_read(&r, buf, cfg->chunk);
+		if (n < 0) {
+			perror("read");
+			break;
+		}
+		if (n == 0) {
+			/* the writer is done and nothing more arrived */
+			if (w.done)
+				break;
+			continue;
+		}
+		last = now_us();
+
+		received += n;
+		for (i = 0; i < n; i++, expect++)
+			if (buf[i] != (expect & 0xFF)) {
+				res->errors++;
+				/* resynchronise on what arrived */
+				expect = buf[i];
+			}
+	}
+	pthread_join(tid, NULL);
+
+	/* up to the last byte, the final timeout is not part of the transfer */
+	elapsed = last - start;
+	if (elapsed <= 0)
+		elapsed = 1;
+	cpu = cpu_us() - cpu;
+
+	res->kbps = received / 1024.0 / (elapsed / 1e6);
+	res->line_pct = line_us(received, cfg->baud) * 100 / elapsed;
+	res->bytes_per_read = r.reads ? (double)received / r.reads : 0;
+	res->cpu_pct = cpu * 100 / elapsed;
+	res->cpu_us_per_kb = received ? cpu / (received / 1024.0) : 0;
+	res->lost = w.written > received ? w.written - received : 0;
+
+	reader_exit(&r);
+	return w.error ? -1 : 0;
+}
+
+static int double_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int run_latency(struct bench_port *port, struct bench_config *cfg,
+		       struct bench_result *res)
+{
+	struct bench_reader r;
+	struct bench_echo e;
+	pthread_t tid;
+	unsigned char msg[BENCH_CHUNK_MAX], buf[BENCH_CHUNK_MAX];
+	double *lat, t0, end;
+	int i, m, n, got, count = 0;
+
+	lat = calloc(bench_messages, sizeof(*lat));
+	if (lat == NULL || reader_init(&r, cfg->io, port->near) < 0) {
+		free(lat);
+		reader_exit(&r);
+		return -1;
+	}
+
+	e.fd = port->far;
+	e.stop = 0;
+	if (port->echo && pthread_create(&tid, NULL, echo_thread, &e)) {
+		reader_exit(&r);
+		free(lat);
+		return -1;
+	}
+
+	end = now_us() + bench_seconds * 1e6;
+	for (m = 0; m < bench_messages && now_us() < end; m++) {
+		for (i = 0; i < cfg->chunk; i++)
+			msg[i] = (m + i) & 0xFF;
+
+		t0 = now_us();
+		if (write_all(port->near, msg, cfg->chunk) < 0)
+			break;
+
+		for (got = 0; got < cfg->chunk; got += n) {
+			n = reader_read(&r, buf + got, cfg->chunk - got);
+			if (n <= 0)
+				break;
+		}
+
+		if (got < cfg->chunk) {
+			res->lost += cfg->chunk - got;
+			tcflush(port->near, TCIFLUSH);
+			continue;
+		}
+		if (memcmp(buf, msg, cfg->chunk))
+			res->errors++;
+		lat[count++] = now_us() - t0;
+	}
+
+	if (port->echo) {
+		e.stop = 1;
+		pthread_join(tid, NULL);
+	}
+
+	if (count) {
+		qsort(lat, count, sizeof(*lat), double_cmp);
+		res->lat[0] = lat[(count - 1) * 50 / 100];
+		res->lat[1] = lat[(count - 1) * 99 / 100];
+		res->lat[2] = lat[(count - 1) * 999 / 1000];
+		res->lat[3] = lat[count - 1];
+	}
+	res->lat_count = count;
+
+	reader_exit(&r);
+	free(lat);
+	return 0;
+}
+
+static int run_config(struct bench_port *port, struct bench_config *cfg)
+{
+	struct bench_result res;
+
+	memset(&res, 0, sizeof(res));
+
+	if (configure_tty(port->near, cfg->baud, cfg->flow, cfg->io) < 0)
+		return -1;
+	if (port->far != port->near && !port->pty &&
+	    configure_tty(port->far, cfg->baud, cfg->flow, IO_BLOCKING) < 0)
+		return -1;
+
+	if (run_throughput(port, cfg, &res) < 0 ||
+	    run_latency(port, cfg, &res) < 0) {
+		printf("%-9s %8d %5d %-6s failed\n", io_names[cfg->io],
+			cfg->baud, cfg->chunk, cfg->flow ? "rtscts" : "none");
+		return -1;
+	}
+
+	printf("%-9s %8d %5d %-6s %9.1f %6.1f %7.1f %6.1f %8.2f %8.0f %8.0f %8.0f %8.0f %9.0f %6lu %8llu\n",
+		io_names[cfg->io], cfg->baud, cfg->chunk,
+		cfg->flow ? "rtscts" : "none",
+		res.kbps, res.line_pct, res.bytes_per_read,
+		res.cpu_pct, res.cpu_us_per_kb,
+		res.lat[0], res.lat[1], res.lat[2], res.lat[3],
+		line_us(cfg->chunk, cfg->baud), res.errors, res.lost);
+	fflush(stdout);
+
+	return res.errors || res.lost ? -1 : 0;
+}
+
+/* comma separated list of numbers or names into values */
+static int parse_list(const char *arg, int *values, const char * const *names,
+		      int nnames)
+{
+	char *copy = strdup(arg), *tok, *save;
+	int n = 0, i;
+
+	for (tok = strtok_r(copy, ",", &save); tok && n < BENCH_LIST_MAX;
+	     tok = strtok_r(NULL, ",", &save)) {
+		if (names) {
+			for (i = 0; i < nnames; i++)
+				if (strcmp(tok, names[i]) == 0)
+					break;
+			if (i == nnames) {
+				printf("Unknown value %s\n", tok);
+				n = -1;
+				break;
+			}
+			values[n++] = i;
+		} else {
+			values[n++] = atoi(tok);
+		}
+	}
+
+	free(copy);
+	return n;
+}
+
+static void bench_usage(const char *name)
+{
+	printf("Usage:\n\t%s --bench [options]\n"
+		"--port DEV       UART under test, looped back (default: pty pair)\n"
+		"--pair DEV,DEV   UART under test and the UART wired to it\n"
+		"--loop           internal loopback on --port\n"
+		"--baud LIST      baud rates (default 115200,921600,4000000)\n"
+		"--chunk LIST     bytes per read/write and message (default 1,64,1024)\n"
+		"--flow LIST      none,rtscts (default none)\n"
+		"--io LIST        blocking,select,epoll,io_uring (default all)\n"
+		"--time SEC       throughput time per configuration (default 2)\n"
+		"--messages N     round trips per configuration (default 500)\n\n"
+		"For example, a 4 Mbaud sweep over an external loopback:\n"
+		"         %s --bench --port /dev/ttymxc1 --baud 4000000 --flow none,rtscts\n",
+		name, name);
+}
+
+int uart_bench_main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{ "port", required_argument, NULL, 'p' },
+		{ "pair", required_argument, NULL, 'P' },
+		{ "loop", no_argument, NULL, 'l' },
+		{ "baud", required_argument, NULL, 'b' },
+		{ "chunk", required_argument, NULL, 'c' },
+		{ "flow", required_argument, NULL, 'f' },
+		{ "io", required_argument, NULL, 'i' },
+		{ "time", required_argument, NULL, 't' },
+		{ "messages", required_argument, NULL, 'm' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	static const char * const flow_names[] = { "none", "rtscts" };
+	int bauds[BENCH_LIST_MAX] = { 115200, 921600, 4000000 };
+	int chunks[BENCH_LIST_MAX] = { 1, 64, 1024 };
+	int flows[BENCH_LIST_MAX] = { 0 };
+	int ios[BENCH_LIST_MAX] = { IO_BLOCKING, IO_SELECT, IO_EPOLL, IO_URING };
+	int nbauds = 3, nchunks = 3, nflows = 1, nios = IO_MODES;
+	const char *dev = NULL, *pair = NULL;
+	struct bench_port port;
+	struct bench_config cfg;
+	struct bench_reader probe;
+	int b, c, f, i, opt, failed = 0;
+	char *comma;
+
+	optind = 1;
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'p':
+			dev = optarg;
+			break;
+		case 'P':
+			pair = optarg;
+			break;
+		case 'l':
+			bench_loop = 1;
+			break;
+		case 'b':
+			nbauds = parse_list(optarg, bauds, NULL, 0);
+			break;
+		case 'c':
+			nchunks = parse_list(optarg, chunks, NULL, 0);
+			break;
+		case 'f':
+			nflows = parse_list(optarg, flows, flow_names, 2);
+			break;
+		case 'i':
+			nios = parse_list(optarg, ios, io_names, IO_MODES);
+			break;
+		case 't':
+			bench_seconds = atof(optarg);
+			break;
+		case 'm':
+			bench_messages = atoi(optarg);
+			break;
+		default:
+			bench_usage("mxc_uart_stress_test.out");
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (nbauds <= 0 || nchunks <= 0 || nflows <= 0 || nios <= 0 ||
+	    bench_seconds <= 0 || bench_messages <= 0) {
+		bench_usage("mxc_uart_stress_test.out");
+		return 1;
+	}
+	for (i = 0; i < nbauds; i++)
+		if (uart_speed(bauds[i]) == B0) {
+			printf("Unsupported baud rate %d\n", bauds[i]);
+			return 1;
+		}
+	for (i = 0; i < nchunks; i++)
+		if (chunks[i] < 1 || chunks[i] > BENCH_CHUNK_MAX) {
+			printf("Chunk size must be 1 to %d\n", BENCH_CHUNK_MAX);
+			return 1;
+		}
+
+	memset(&port, 0, sizeof(port));
+	if (pair) {
+		comma = strchr(pair, ',');
+		if (comma == NULL) {
+			bench_usage("mxc_uart_stress_test.out");
+			return 1;
+		}
+		*comma = 0;
+		port.near = open_port(pair);
+		port.far = open_port(comma + 1);
+		port.echo = 1;
+		if (port.near < 0 || port.far < 0)
+			return 1;
+		printf("UART %s, far end %s\n", pair, comma + 1);
+	} else if (dev) {
+		port.near = port.far = open_port(dev);
+		if (port.near < 0)
+			return 1;
+		printf("UART %s, %s loopback\n", dev,
+			bench_loop ? "internal" : "external");
+	} else {
+		if (open_pty(&port) < 0)
+			return 1;
+		printf("pty stand-in, writer paced to the baud rate, no RTS/CTS\n");
+	}
+
+	printf("\n%-9s %8s %5s %-6s %9s %6s %7s %6s %8s %8s %8s %8s %8s %9s %6s %8s\n",
+		"io", "baud", "chunk", "flow", "KB/s", "line%", "B/read",
+		"cpu%", "cpuus/KB", "p50us", "p99us", "p999us", "maxus",
+		"lineus", "errors", "lost");
+
+	for (i = 0; i < nios; i++) {
+		if (ios[i] == IO_URING) {
+			if (reader_init(&probe, IO_URING, port.near) < 0) {
+				printf("%-9s not supported by this kernel\n",
+					io_names[IO_URING]);
+				reader_exit(&probe);
+				continue;
+			}
+			reader_exit(&probe);
+		}
+
+		for (b = 0; b < nbauds; b++)
+			for (c = 0; c < nchunks; c++)
+				for (f = 0; f < nflows; f++) {
+					cfg.io = ios[i];
+					cfg.baud = bauds[b];
+					cfg.chunk = chunks[c];
+					cfg.flow = flows[f];
+					if (run_config(&port, &cfg) < 0)
+						failed++;
+				}
+	}
+
+	close(port.near);
+	if (port.far != port.near)
+		close(port.far);
+
+	printf("\n%d configurations with errors or lost data\n", failed);
+	return failed ? 1 : 0;
+}
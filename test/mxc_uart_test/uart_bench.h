@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2014 Freescale Semiconductor, Inc. All rights reserved.
+ */
+
+/*
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+#ifndef UART_BENCH_H
+#define UART_BENCH_H
+
+/* termios Bxxx constant for a baud rate, B0 if there is none */
+int uart_speed(int s);
+
+/*
+ * Throughput, round trip latency and CPU cost over a sweep of baud
+ * rates, chunk sizes, flow control and read paths. argv[0] is "--bench".
+ */
+int uart_bench_main(int argc, char *argv[]);
+
+#endif
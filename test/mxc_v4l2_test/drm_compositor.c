@@ -0,0 +1,721 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file drm_compositor.c
+ *
+ * @brief Multi-source DRM compositor for camera preview
+ *
+ * Every flip is one atomic commit: the overlay planes that got a new frame
+ * and, when something was copied, the primary plane's back buffer.  Without
+ * atomic modesetting everything is copied and the primary is page flipped.
+ * A frame stays on its plane, or in the copy sources, until a newer frame
+ * of the same source is on screen, then it goes back to the capture side.
+ * The back buffer only gets the sources it does not hold yet, so a source
+ * that did not move costs nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+
+#include <drm/drm.h>
+#include <drm/drm_mode.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "drm_compositor.h"
+
+/* Rows per copy tile */
+#define TILE_ROWS	32
+
+static const char *const prop_name[COMP_PROP_NUM] = {
+	[COMP_PROP_FB_ID] = "FB_ID",
+	[COMP_PROP_CRTC_ID] = "CRTC_ID",
+	[COMP_PROP_SRC_X] = "SRC_X",
+	[COMP_PROP_SRC_Y] = "SRC_Y",
+	[COMP_PROP_SRC_W] = "SRC_W",
+	[COMP_PROP_SRC_H] = "SRC_H",
+	[COMP_PROP_CRTC_X] = "CRTC_X",
+	[COMP_PROP_CRTC_Y] = "CRTC_Y",
+	[COMP_PROP_CRTC_W] = "CRTC_W",
+	[COMP_PROP_CRTC_H] = "CRTC_H",
+};
+
+long long comp_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* Property ids of a plane, and its type */
+static int plane_props(int fd, __u32 id, struct comp_plane *plane,
+		       __u64 *type)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	int i, k, found = 0;
+
+	props = drmModeObjectGetProperties(fd, id, DRM_MODE_OBJECT_PLANE);
+	if (!props)
+		return -ENOENT;
+
+	memset(plane, 0, sizeof(*plane));
+	plane->id = id;
+	*type = DRM_PLANE_TYPE_OVERLAY;
+	for (i = 0; i < props->count_props; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
+		if (!strcmp(prop->name, "type"))
+			*type = props->prop_values[i];
+		for (k = 0; k < COMP_PROP_NUM; k++) {
+			if (!strcmp(prop->name, prop_name[k])) {
+				plane->prop[k] = prop->prop_id;
+				found++;
+			}
+		}
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+	return found == COMP_PROP_NUM ? 0 : -ENOENT;
+}
+
+static int find_pipe(struct compositor *comp)
+{
+	drmModeRes *res;
+	int i;
+
+	res = drmModeGetResources(comp->out.fd);
+	if (!res)
+		return -errno;
+	comp->pipe = -1;
+	for (i = 0; i < res->count_crtcs; i++)
+		if (res->crtcs[i] == comp->out.crtc_id)
+			comp->pipe = i;
+	drmModeFreeResources(res);
+	return comp->pipe < 0 ? -ENODEV : 0;
+}
+
+/* The CRTC's primary plane, and the overlays nobody else is using */
+static void find_planes(struct compositor *comp)
+{
+	drmModePlaneRes *res;
+	drmModePlane *plane;
+	struct comp_plane p;
+	bool ours;
+	__u64 type;
+	int i;
+
+	res = drmModeGetPlaneResources(comp->out.fd);
+	if (!res)
+		return;
+
+	for (i = 0; i < res->count_planes; i++) {
+		plane = drmModeGetPlane(comp->out.fd, res->planes[i]);
+		if (!plane)
+			continue;
+		ours = plane->crtc_id == comp->out.crtc_id;
+		if (!(plane->possible_crtcs & (1 << comp->pipe)) ||
+		    (plane->crtc_id && !ours) ||
+		    plane_props(comp->out.fd, plane->plane_id, &p, &type) < 0) {
+			drmModeFreePlane(plane);
+			continue;
+		}
+		if (type == DRM_PLANE_TYPE_PRIMARY) {
+			if (ours || !comp->primary.id)
+				comp->primary = p;
+		} else if (type == DRM_PLANE_TYPE_OVERLAY &&
+			   comp->nr_overlay < COMP_MAX_PLANES) {
+			comp->overlay[comp->nr_overlay++] = plane->plane_id;
+		}
+		drmModeFreePlane(plane);
+	}
+	drmModeFreePlaneResources(res);
+}
+
+static void copy_tiles(struct compositor *comp)
+{
+	const struct comp_tile *t;
+	__u32 r, end;
+	int i;
+
+	while ((i = __atomic_fetch_add(&comp->next_tile, 1,
+				       __ATOMIC_RELAXED)) < comp->nr_tiles) {
+		for (t = comp->job; i >= t->tiles; t++)
+			i -= t->tiles;
+		r = i * TILE_ROWS;
+		end = r + TILE_ROWS < t->rows ? r + TILE_ROWS : t->rows;
+		for (; r < end; r++)
+			memcpy(t->dst + (size_t)r * t->dst_pitch,
+			       t->src + (size_t)r * t->src_pitch, t->bytes);
+	}
+}
+
+static void *comp_worker(void *arg)
+{
+	struct compositor *comp = arg;
+	unsigned long gen = 0;
+
+	pthread_mutex_lock(&comp->pool_lock);
+	while (1) {
+		while (comp->gen == gen && !comp->exit)
+			pthread_cond_wait(&comp->pool_cond, &comp->pool_lock);
+		if (comp->exit)
+			break;
+		gen = comp->gen;
+		pthread_mutex_unlock(&comp->pool_lock);
+
+		copy_tiles(comp);
+
+		pthread_mutex_lock(&comp->pool_lock);
+		if (!--comp->busy)
+			pthread_cond_signal(&comp->pool_done);
+	}
+	pthread_mutex_unlock(&comp->pool_lock);
+	return NULL;
+}
+
+/* Copy every tile of comp->job, the calling thread included */
+static void run_copy(struct compositor *comp)
+{
+	pthread_mutex_lock(&comp->pool_lock);
+	comp->next_tile = 0;
+	comp->busy = comp->threads - 1;
+	comp->gen++;
+	pthread_cond_broadcast(&comp->pool_cond);
+	pthread_mutex_unlock(&comp->pool_lock);
+
+	copy_tiles(comp);
+
+	pthread_mutex_lock(&comp->pool_lock);
+	while (comp->busy)
+		pthread_cond_wait(&comp->pool_done, &comp->pool_lock);
+	pthread_mutex_unlock(&comp->pool_lock);
+}
+
+int comp_init(struct compositor *comp, const struct comp_output *out,
+	      int threads, bool planes, int max_age_us)
+{
+	int ret;
+
+	memset(comp, 0, sizeof(*comp));
+	comp->out = *out;
+	comp->max_age = max_age_us;
+	pthread_mutex_init(&comp->lock, NULL);
+	pthread_cond_init(&comp->cond, NULL);
+	pthread_mutex_init(&comp->pool_lock, NULL);
+	pthread_cond_init(&comp->pool_cond, NULL);
+	pthread_cond_init(&comp->pool_done, NULL);
+
+	ret = find_pipe(comp);
+	if (ret < 0)
+		return ret;
+
+	/* Atomic modesetting also lists the primary and cursor planes */
+	if (planes && !drmSetClientCap(out->fd, DRM_CLIENT_CAP_ATOMIC, 1)) {
+		find_planes(comp);
+		comp->atomic = comp->primary.id != 0;
+	}
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	if (threads > COMP_MAX_THREADS)
+		threads = COMP_MAX_THREADS;
+	for (comp->threads = 1; comp->threads < threads; comp->threads++)
+		if (pthread_create(&comp->tid[comp->threads], NULL,
+				   comp_worker, comp))
+			break;
+
+	printf("compositor: CRTC %u (pipe %d), %s, %d overlay planes, "
+	       "%d copy threads\n", out->crtc_id, comp->pipe,
+	       comp->atomic ? "atomic" : "page flip", comp->nr_overlay,
+	       comp->threads);
+	return 0;
+}
+
+static void release_fbs(struct compositor *comp, struct comp_channel *c)
+{
+	struct drm_gem_close gclose;
+	int i;
+
+	for (i = 0; i < c->src.nr_buffer; i++) {
+		if (c->fb_id[i])
+			drmModeRmFB(comp->out.fd, c->fb_id[i]);
+		if (c->handle[i]) {
+			memset(&gclose, 0, sizeof(gclose));
+			gclose.handle = c->handle[i];
+			drmIoctl(comp->out.fd, DRM_IOCTL_GEM_CLOSE, &gclose);
+		}
+		c->fb_id[i] = 0;
+		c->handle[i] = 0;
+	}
+}
+
+/* Wrap the capture buffers in framebuffers, no copy involved */
+static int import_buffers(struct compositor *comp, struct comp_channel *c)
+{
+	__u32 handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+	int i;
+
+	for (i = 0; i < c->src.nr_buffer; i++) {
+		if (c->src.dmabuf[i] < 0 ||
+		    drmPrimeFDToHandle(comp->out.fd, c->src.dmabuf[i],
+				       &c->handle[i]))
+			goto err;
+		handles[0] = c->handle[i];
+		pitches[0] = c->src.pitch;
+		if (drmModeAddFB2(comp->out.fd, c->src.width, c->src.height,
+				  c->src.fourcc, handles, pitches, offsets,
+				  &c->fb_id[i], 0))
+			goto err;
+	}
+	return 0;
+
+err:
+	release_fbs(comp, c);
+	return -1;
+}
+
+/* Show fb on the plane, or take the plane down for fb 0 */
+static void plane_set(drmModeAtomicReq *req, const struct comp_plane *p,
+		      __u32 crtc_id, __u32 fb, const struct comp_channel *c)
+{
+	drmModeAtomicAddProperty(req, p->id, p->prop[COMP_PROP_FB_ID], fb);
+	drmModeAtomicAddProperty(req, p->id, p->prop[COMP_PROP_CRTC_ID],
+				 fb ? crtc_id : 0);
+	if (!fb)
+		return;
+	/* no scaling, vkms and most overlays cannot */
+	drmModeAtomicAddProperty(req, p->id, p->prop[COMP_PROP_SRC_X], 0);
+	drmModeAtomicAddProperty(req, p->id, p->prop[COMP_PROP_SRC_Y], 0);
+	drmModeAtomicAddProperty(req, p->id, p->prop[COMP_PROP_SRC_W],
+				 (__u64)c->w << 16);
+	drmModeAtomicAddProperty(req, p->id, p->prop[COMP_PROP_SRC_H],
+				 (__u64)c->h << 16);
+	drmModeAtomicAddProperty(req, p->id, p->prop[COMP_PROP_CRTC_X],
+				 c->src.x);
+	drmModeAtomicAddProperty(req, p->id, p->prop[COMP_PROP_CRTC_Y],
+				 c->src.y);
+	drmModeAtomicAddProperty(req, p->id, p->prop[COMP_PROP_CRTC_W], c->w);
+	drmModeAtomicAddProperty(req, p->id, p->prop[COMP_PROP_CRTC_H], c->h);
+}
+
+/* First free overlay the driver accepts the source on */
+static void attach_plane(struct compositor *comp, struct comp_channel *c)
+{
+	drmModeAtomicReq *req;
+	drmModePlane *plane;
+	bool format;
+	__u64 type;
+	int i, j, ret;
+
+	if (!c->src.fourcc || import_buffers(comp, c) < 0)
+		return;
+
+	for (i = 0; i < comp->nr_overlay; i++) {
+		if (comp->overlay_used[i])
+			continue;
+		plane = drmModeGetPlane(comp->out.fd, comp->overlay[i]);
+		if (!plane)
+			continue;
+		format = false;
+		for (j = 0; j < plane->count_formats; j++)
+			if (plane->formats[j] == c->src.fourcc)
+				format = true;
+		drmModeFreePlane(plane);
+		if (!format || plane_props(comp->out.fd, comp->overlay[i],
+					   &c->plane, &type) < 0)
+			continue;
+
+		req = drmModeAtomicAlloc();
+		if (!req)
+			break;
+		plane_set(req, &c->plane, comp->out.crtc_id, c->fb_id[0], c);
+		ret = drmModeAtomicCommit(comp->out.fd, req,
+					  DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+		drmModeAtomicFree(req);
+		if (!ret) {
+			comp->overlay_used[i] = true;
+			return;
+		}
+	}
+	memset(&c->plane, 0, sizeof(c->plane));
+	release_fbs(comp, c);
+}
+
+int comp_add_source(struct compositor *comp, const struct comp_source *src)
+{
+	struct comp_channel *c;
+
+	if (comp->nr_ch >= COMP_MAX_SOURCES ||
+	    src->nr_buffer > COMP_MAX_BUFFERS || src->x < 0 || src->y < 0)
+		return -EINVAL;
+
+	c = &comp->ch[comp->nr_ch];
+	memset(c, 0, sizeof(*c));
+	c->src = *src;
+	c->pending.index = -1;
+	c->shown.index = -1;
+	c->retired.index = -1;
+
+	/* Crop to the area given to the source, then to the screen */
+	c->w = src->width;
+	c->h = src->height;
+	if (src->max_w && c->w > src->max_w)
+		c->w = src->max_w;
+	if (src->max_h && c->h > src->max_h)
+		c->h = src->max_h;
+	c->w = src->x >= comp->out.width ? 0 :
+	       c->w < comp->out.width - src->x ? c->w :
+	       comp->out.width - src->x;
+	c->h = src->y >= comp->out.height ? 0 :
+	       c->h < comp->out.height - src->y ? c->h :
+	       comp->out.height - src->y;
+
+	if (comp->atomic && c->w && c->h)
+		attach_plane(comp, c);
+
+	if (c->plane.id)
+		printf("source %d: %ux%u at (%d,%d), overlay plane %u\n",
+		       comp->nr_ch, c->w, c->h, src->x, src->y, c->plane.id);
+	else
+		printf("source %d: %ux%u at (%d,%d), copied\n",
+		       comp->nr_ch, c->w, c->h, src->x, src->y);
+	return comp->nr_ch++;
+}
+
+void comp_post(struct compositor *comp, int ch, int index, long long ts)
+{
+	struct comp_channel *c = &comp->ch[ch];
+	int old = -1;
+
+	pthread_mutex_lock(&comp->lock);
+	if (c->pending.index >= 0) {
+		old = c->pending.index;
+		c->superseded++;
+	}
+	c->pending.index = index;
+	c->pending.ts = ts;
+	c->pending.seq = ++c->seq;
+	c->last = comp_now_us();
+	if (!c->posted++)
+		c->first = c->last;
+	pthread_cond_signal(&comp->cond);
+	pthread_mutex_unlock(&comp->lock);
+
+	if (old >= 0)
+		c->src.release(c->src.arg, old);
+}
+
+void comp_source_done(struct compositor *comp, int ch)
+{
+	pthread_mutex_lock(&comp->lock);
+	comp->ch[ch].done = true;
+	pthread_cond_signal(&comp->cond);
+	pthread_mutex_unlock(&comp->lock);
+}
+
+static void flip_handler(int fd, unsigned int sequence, unsigned int tv_sec,
+			 unsigned int tv_usec, void *data)
+{
+	struct compositor *comp = data;
+
+	comp->flip_pending = false;
+}
+
+static int wait_flip(struct compositor *comp)
+{
+	drmEventContext evctx;
+	struct pollfd pfd;
+	int ret;
+
+	memset(&evctx, 0, sizeof(evctx));
+	evctx.version = 2;
+	evctx.page_flip_handler = flip_handler;
+	pfd.fd = comp->out.fd;
+	pfd.events = POLLIN;
+
+	while (comp->flip_pending) {
+		ret = poll(&pfd, 1, 1000);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			printf("compositor: flip did not complete\n");
+			comp->flip_pending = false;
+			return -ETIMEDOUT;
+		}
+		drmHandleEvent(comp->out.fd, &evctx);
+	}
+	return 0;
+}
+
+static int commit(struct compositor *comp, int back, bool primary)
+{
+	struct comp_channel *c;
+	drmModeAtomicReq *req;
+	int i, ret;
+
+	if (!comp->atomic) {
+		ret = drmModePageFlip(comp->out.fd, comp->out.crtc_id,
+				      comp->out.buf[back].fb_id,
+				      DRM_MODE_PAGE_FLIP_EVENT, comp);
+	} else {
+		req = drmModeAtomicAlloc();
+		if (!req)
+			return -ENOMEM;
+		if (primary)
+			drmModeAtomicAddProperty(req, comp->primary.id,
+				comp->primary.prop[COMP_PROP_FB_ID],
+				comp->out.buf[back].fb_id);
+		for (i = 0; i < comp->nr_ch; i++) {
+			c = &comp->ch[i];
+			if (c->dirty)
+				plane_set(req, &c->plane, comp->out.crtc_id,
+					  c->fb_id[c->shown.index], c);
+		}
+		ret = drmModeAtomicCommit(comp->out.fd, req,
+					  DRM_MODE_PAGE_FLIP_EVENT |
+					  DRM_MODE_ATOMIC_NONBLOCK, comp);
+		drmModeAtomicFree(req);
+	}
+	if (ret) {
+		ret = -errno;
+		printf("compositor: flip failed: %s\n", strerror(-ret));
+		return ret;
+	}
+	comp->flips++;
+	comp->flip_pending = true;
+	return wait_flip(comp);
+}
+
+/* Put the frames just taken from the capture threads on screen */
+static int comp_round(struct compositor *comp, const struct comp_frame *fresh)
+{
+	int back = comp->out.front ^ 1;
+	struct comp_channel *c;
+	struct comp_tile *t;
+	bool planes = false;
+	long long now, age;
+	int i, ret;
+
+	comp->rounds++;
+	now = comp_now_us();
+	for (i = 0; i < comp->nr_ch; i++) {
+		c = &comp->ch[i];
+		c->dirty = false;
+		if (fresh[i].index < 0)
+			continue;
+		age = now - fresh[i].ts;
+		if (!c->w || !c->h ||
+		    (comp->max_age && age > comp->max_age)) {
+			if (c->w && c->h)
+				c->stale++;
+			c->src.release(c->src.arg, fresh[i].index);
+			continue;
+		}
+		c->age_sum += age;
+		if (age > c->age_max)
+			c->age_max = age;
+		c->retired = c->shown;
+		c->shown = fresh[i];
+		c->displayed++;
+		if (c->plane.id) {
+			c->dirty = true;
+			planes = true;
+		}
+	}
+
+	/* Copy what the back buffer does not hold yet */
+	comp->nr_job = 0;
+	comp->nr_tiles = 0;
+	for (i = 0; i < comp->nr_ch; i++) {
+		c = &comp->ch[i];
+		if (c->plane.id || c->shown.index < 0 ||
+		    c->in_buf[back] == c->shown.seq)
+			continue;
+		t = &comp->job[comp->nr_job++];
+		t->src = c->src.map[c->shown.index];
+		t->src_pitch = c->src.pitch;
+		t->dst = (__u8 *)comp->out.buf[back].map +
+			 (size_t)c->src.y * comp->out.buf[back].pitch +
+			 (size_t)c->src.x * comp->out.cpp;
+		t->dst_pitch = comp->out.buf[back].pitch;
+		t->bytes = c->w * comp->out.cpp;
+		if (t->bytes > c->src.pitch)
+			t->bytes = c->src.pitch;
+		t->rows = c->h;
+		t->tiles = (t->rows + TILE_ROWS - 1) / TILE_ROWS;
+		comp->nr_tiles += t->tiles;
+		c->in_buf[back] = c->shown.seq;
+	}
+	if (comp->nr_job) {
+		now = comp_now_us();
+		run_copy(comp);
+		comp->copy_us += comp_now_us() - now;
+		comp->copies++;
+	}
+
+	/* A copied frame is free once its successor is in the back buffer */
+	for (i = 0; i < comp->nr_ch; i++) {
+		c = &comp->ch[i];
+		if (!c->plane.id && c->retired.index >= 0) {
+			c->src.release(c->src.arg, c->retired.index);
+			c->retired.index = -1;
+		}
+	}
+
+	if (!comp->nr_job && !planes)
+		return 0;
+	ret = commit(comp, back, comp->nr_job > 0);
+	if (ret < 0)
+		return ret;
+	if (comp->nr_job)
+		comp->out.front = back;
+
+	/* and a plane's frame once the flip replaced it */
+	for (i = 0; i < comp->nr_ch; i++) {
+		c = &comp->ch[i];
+		if (c->plane.id && c->retired.index >= 0) {
+			c->src.release(c->src.arg, c->retired.index);
+			c->retired.index = -1;
+		}
+	}
+	return 0;
+}
+
+int comp_run(struct compositor *comp, const volatile bool *quit)
+{
+	struct comp_frame fresh[COMP_MAX_SOURCES];
+	struct timespec ts;
+	bool any, done;
+	int i, ret = 0;
+
+	comp->start = comp_now_us();
+	while (!*quit) {
+		pthread_mutex_lock(&comp->lock);
+		while (1) {
+			any = false;
+			done = true;
+			for (i = 0; i < comp->nr_ch; i++) {
+				if (comp->ch[i].pending.index >= 0)
+					any = true;
+				if (!comp->ch[i].done)
+					done = false;
+			}
+			if (any || done || *quit)
+				break;
+			/* wake up now and then to see *quit */
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 100000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&comp->cond, &comp->lock, &ts);
+		}
+		for (i = 0; i < comp->nr_ch; i++) {
+			fresh[i] = comp->ch[i].pending;
+			comp->ch[i].pending.index = -1;
+		}
+		pthread_mutex_unlock(&comp->lock);
+
+		if (!any)
+			break;
+		ret = comp_round(comp, fresh);
+		if (ret < 0)
+			break;
+	}
+	comp->end = comp_now_us();
+	return ret;
+}
+
+void comp_report(const struct compositor *comp)
+{
+	const struct comp_channel *c;
+	double secs = (comp->end - comp->start) / 1e6;
+	double fps;
+	int i;
+
+	if (secs <= 0)
+		secs = 1e-6;
+	printf("\ncompositor: %lu flips in %.2f s = %.1f fps\n", comp->flips,
+	       secs, comp->flips / secs);
+	if (comp->copies)
+		printf("copy: %.0f us per flip with %d threads\n",
+		       (double)comp->copy_us / comp->copies, comp->threads);
+
+	printf("%6s %10s %8s %8s %8s %8s %10s %6s %16s\n", "source", "size",
+	       "path", "frames", "fps", "shown", "superseded", "stale",
+	       "age mean/max ms");
+	for (i = 0; i < comp->nr_ch; i++) {
+		c = &comp->ch[i];
+		fps = c->last > c->first ?
+		      (c->posted - 1) * 1e6 / (c->last - c->first) : 0;
+		printf("%6d %5ux%-4u %8s %8lu %8.1f %8lu %10lu %6lu %8.1f/%-7.1f\n",
+		       i, c->w, c->h, c->plane.id ? "plane" : "copy",
+		       c->posted, fps, c->displayed,
+		       c->superseded, c->stale,
+		       c->displayed ? c->age_sum / 1000.0 / c->displayed : 0,
+		       c->age_max / 1000.0);
+	}
+}
+
+void comp_fini(struct compositor *comp)
+{
+	drmModeAtomicReq *req = NULL;
+	bool planes = false;
+	int i;
+
+	pthread_mutex_lock(&comp->pool_lock);
+	comp->exit = true;
+	pthread_cond_broadcast(&comp->pool_cond);
+	pthread_mutex_unlock(&comp->pool_lock);
+	for (i = 1; i < comp->threads; i++)
+		pthread_join(comp->tid[i], NULL);
+
+	if (comp->flip_pending)
+		wait_flip(comp);
+
+	/* Planes off before their framebuffers go */
+	if (comp->atomic)
+		req = drmModeAtomicAlloc();
+	for (i = 0; req && i < comp->nr_ch; i++) {
+		if (comp->ch[i].plane.id) {
+			plane_set(req, &comp->ch[i].plane, 0, 0, &comp->ch[i]);
+			planes = true;
+		}
+	}
+	if (planes)
+		drmModeAtomicCommit(comp->out.fd, req, 0, NULL);
+	drmModeAtomicFree(req);
+
+	for (i = 0; i < comp->nr_ch; i++)
+		release_fbs(comp, &comp->ch[i]);
+
+	pthread_mutex_destroy(&comp->lock);
+	pthread_cond_destroy(&comp->cond);
+	pthread_mutex_destroy(&comp->pool_lock);
+	pthread_cond_destroy(&comp->pool_cond);
+	pthread_cond_destroy(&comp->pool_done);
+}
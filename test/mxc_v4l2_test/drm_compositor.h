@@ -0,0 +1,191 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file drm_compositor.h
+ *
+ * @brief Multi-source DRM compositor for camera preview
+ *
+ * Capture threads post frames as they arrive; the compositor shows the
+ * newest frame of every source on the next flip.  A source whose buffers
+ * can be imported as DRM framebuffers gets an overlay plane of its own and
+ * is never copied; the others are copied into the primary double buffer
+ * by a pool of threads, a band of rows at a time.  A frame replaced by a
+ * newer one before it was shown, or older than the age limit when its turn
+ * comes, is handed straight back instead of holding up the other sources.
+ */
+
+#ifndef DRM_COMPOSITOR_H
+#define DRM_COMPOSITOR_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <linux/types.h>
+
+#define COMP_MAX_SOURCES	8
+#define COMP_MAX_BUFFERS	8
+#define COMP_MAX_PLANES		16
+#define COMP_MAX_THREADS	16
+
+enum {
+	COMP_PROP_FB_ID,
+	COMP_PROP_CRTC_ID,
+	COMP_PROP_SRC_X,
+	COMP_PROP_SRC_Y,
+	COMP_PROP_SRC_W,
+	COMP_PROP_SRC_H,
+	COMP_PROP_CRTC_X,
+	COMP_PROP_CRTC_Y,
+	COMP_PROP_CRTC_W,
+	COMP_PROP_CRTC_H,
+	COMP_PROP_NUM,
+};
+
+/* Screen set up and scanning out by the caller */
+struct comp_output {
+	int fd;
+	__u32 crtc_id;
+	__u32 width;
+	__u32 height;
+	__u32 cpp;			/* bytes per pixel */
+	struct {
+		void *map;
+		__u32 fb_id;
+		__u32 pitch;
+	} buf[2];
+	int front;			/* buffer on screen */
+};
+
+struct comp_source {
+	__u32 fourcc;			/* DRM_FORMAT_*, 0 if there is none */
+	__u32 width;
+	__u32 height;
+	__u32 pitch;
+	__s32 x;			/* top left corner on screen */
+	__s32 y;
+	__u32 max_w;			/* screen area given to the source */
+	__u32 max_h;
+	int nr_buffer;
+	void *map[COMP_MAX_BUFFERS];	/* CPU view, for the copy path */
+	int dmabuf[COMP_MAX_BUFFERS];	/* -1 when not exported */
+	/* give a frame back to the capture side */
+	void (*release)(void *arg, int index);
+	void *arg;
+};
+
+struct comp_frame {
+	int index;			/* buffer, -1 for none */
+	long long ts;			/* capture time, us, CLOCK_MONOTONIC */
+	unsigned long seq;
+};
+
+struct comp_plane {
+	__u32 id;
+	__u32 prop[COMP_PROP_NUM];
+};
+
+struct comp_channel {
+	struct comp_source src;
+	__u32 w, h;			/* visible part */
+	struct comp_plane plane;	/* id 0: copied into the primary */
+	__u32 fb_id[COMP_MAX_BUFFERS];
+	__u32 handle[COMP_MAX_BUFFERS];
+	struct comp_frame pending;	/* newest frame, not shown yet */
+	struct comp_frame shown;	/* kept until a newer one replaces it */
+	struct comp_frame retired;	/* on screen until the next flip */
+	unsigned long in_buf[2];	/* seq copied into each primary buffer */
+	unsigned long seq;
+	bool dirty;			/* plane gets a new frame this flip */
+	bool done;
+
+	long long first;		/* first and last frame posted */
+	long long last;
+	unsigned long posted;
+	unsigned long displayed;
+	unsigned long superseded;	/* replaced before their turn */
+	unsigned long stale;		/* older than the age limit */
+	long long age_sum;
+	long long age_max;
+};
+
+struct comp_tile {
+	const __u8 *src;
+	__u8 *dst;
+	__u32 src_pitch;
+	__u32 dst_pitch;
+	__u32 bytes;			/* per row */
+	__u32 rows;
+	int tiles;
+};
+
+struct compositor {
+	struct comp_output out;
+	struct comp_channel ch[COMP_MAX_SOURCES];
+	int nr_ch;
+	int max_age;			/* us, 0 for no limit */
+
+	bool atomic;
+	int pipe;
+	struct comp_plane primary;
+	__u32 overlay[COMP_MAX_PLANES];
+	bool overlay_used[COMP_MAX_PLANES];
+	int nr_overlay;
+	bool flip_pending;
+
+	pthread_mutex_t lock;		/* pending frames */
+	pthread_cond_t cond;
+
+	/* copy workers, the compositing thread makes one more */
+	int threads;
+	pthread_t tid[COMP_MAX_THREADS];
+	pthread_mutex_t pool_lock;
+	pthread_cond_t pool_cond;
+	pthread_cond_t pool_done;
+	unsigned long gen;
+	int busy;
+	bool exit;
+	struct comp_tile job[COMP_MAX_SOURCES];
+	int nr_job;
+	int nr_tiles;
+	int next_tile;
+
+	unsigned long rounds;
+	unsigned long flips;
+	unsigned long copies;
+	long long copy_us;
+	long long start;
+	long long end;
+};
+
+/*
+ * Take over a screen.  threads <= 0 uses every online CPU for copies;
+ * planes enables overlay planes where the driver has them.
+ */
+int comp_init(struct compositor *comp, const struct comp_output *out,
+	      int threads, bool planes, int max_age_us);
+/* Returns the source number for comp_post(), or a negative errno value */
+int comp_add_source(struct compositor *comp, const struct comp_source *src);
+/* From the capture threads */
+void comp_post(struct compositor *comp, int ch, int index, long long ts);
+void comp_source_done(struct compositor *comp, int ch);
+/* Composite until every source is done or *quit is set */
+int comp_run(struct compositor *comp, const volatile bool *quit);
+void comp_report(const struct compositor *comp);
+/* Take the planes down; comp->out.front tells which buffer is shown */
+void comp_fini(struct compositor *comp);
+
+long long comp_now_us(void);
+
+#endif
@@ -37,15 +37,18 @@
 
 #include <drm/drm.h>
 #include <drm/drm_mode.h>
+#include <drm/drm_fourcc.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <linux/videodev2.h>
 
 #include "../../include/soc_check.h"
+#include "drm_compositor.h"
 
 /* Helper Macro */
 #define NUM_PLANES				3
-#define TEST_BUFFER_NUM			3
+/* one on screen, one retiring, one waiting, one capturing */
+#define TEST_BUFFER_NUM			4
 #define NUM_SENSORS				8
 #define NUM_CARDS				8
 #define DEFAULT					4
@@ -133,6 +136,11 @@ struct video_channel {
 	__u32 out_width;
 	__u32 out_height;
 
+	/* what the driver really gave */
+	__u32 cap_width;
+	__u32 cap_height;
+	__u32 bytesperline;
+
 	char save_file_name[100];
 	char v4l_dev_name[100];
 
@@ -142,6 +150,13 @@ struct video_channel {
 
 	struct testbuffer buffers[TEST_BUFFER_NUM];
 	__u32 nr_buffer;
+	long long cur_ts;
+
+	/* compositor path */
+	int dmabuf[TEST_BUFFER_NUM];
+	struct compositor *comp;
+	int comp_id;
+	pthread_t tid;
 
 	struct timeval tv1;
 	struct timeval tv2;
@@ -188,6 +203,11 @@ static bool g_cap_hfilp;
 static bool g_cap_vfilp;
 static int32_t g_cap_alpha;
 
+static bool g_serial;
+static bool g_no_plane;
+static int32_t g_comp_threads;
+static int32_t g_max_age_ms;
+
 /*
  *
  */
@@ -239,6 +259,11 @@ static void global_vars_init(void)
 	g_cap_hfilp = false;
 	g_cap_vfilp = false;
 	g_cap_alpha = 0;
+
+	g_serial = false;
+	g_no_plane = false;
+	g_comp_threads = 0;
+	g_max_age_ms = -1;
 }
 
 static void print_help(const char *name)
@@ -260,6 +285,10 @@ static void print_help(const char *name)
 		   " -hflip <num> enable horizontal flip, num: 0->disable or 1->enable\n"
 		   " -vflip <num> enable vertical flip, num: 0->disable or 1->enable\n"
 		   " -alpha <num> enable and set global alpha for camera, num equal to 0~255\n"
+		   " -serial copy every camera on the main thread, the old playback loop\n"
+		   " -noplane never put a camera on an overlay plane, always copy\n"
+		   " -threads <num> copy threads, default one per CPU\n"
+		   " -age <ms> drop frames older than this, default two frame periods, 0 never\n"
 	       "example:\n"
 	       "./mx8_cap -cam 1        capture data from video0 and playback\n"
 	       "./mx8_cap -cam 3        capture data from video0/1 and playback\n"
@@ -424,6 +453,14 @@ static int parse_cmdline(int argc, const char *argv[])
 			g_cap_vfilp = atoi(argv[++i]);
 		} else if (strcmp(argv[i], "-alpha") == 0) {
 			g_cap_alpha = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-serial") == 0) {
+			g_serial = true;
+		} else if (strcmp(argv[i], "-noplane") == 0) {
+			g_no_plane = true;
+		} else if (strcmp(argv[i], "-threads") == 0) {
+			g_comp_threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-age") == 0) {
+			g_max_age_ms = atoi(argv[++i]);
 		} else {
 			print_help(argv[0]);
 			return -1;
@@ -1051,6 +1088,9 @@ static void fill_video_channel(struct video_channel *video_ch,
 				      fmt->fmt.pix_mp.plane_fmt[j].sizeimage;
 		}
 	}
+	video_ch->cap_width = fmt->fmt.pix_mp.width;
+	video_ch->cap_height = fmt->fmt.pix_mp.height;
+	video_ch->bytesperline = fmt->fmt.pix_mp.plane_fmt[0].bytesperline;
 	video_ch->on = 1;
 }
 
@@ -1363,6 +1403,12 @@ static int dqueue_buffer(int buf_id, struct video_channel *video_ch)
 	}
 	video_ch->frame_num++;
 	video_ch->cur_buf_id = buf.index;
+	if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+	    V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+		video_ch->cur_ts = buf.timestamp.tv_sec * 1000000LL +
+				   buf.timestamp.tv_usec;
+	else
+		video_ch->cur_ts = comp_now_us();
 
 	setbuf(stdout, NULL);
 	printf(" %c",
@@ -1705,6 +1751,223 @@ static int redraw(struct media_dev *media)
 	return 0;
 }
 
+static __u32 to_drm_fourcc(__u32 fourcc)
+{
+	switch (fourcc) {
+	case V4L2_PIX_FMT_XBGR32:
+		return DRM_FORMAT_XRGB8888;
+	case V4L2_PIX_FMT_ABGR32:
+		return DRM_FORMAT_ARGB8888;
+	case V4L2_PIX_FMT_XRGB32:
+		return DRM_FORMAT_BGRX8888;
+	case V4L2_PIX_FMT_ARGB32:
+		return DRM_FORMAT_BGRA8888;
+	case V4L2_PIX_FMT_RGB565:
+		return DRM_FORMAT_RGB565;
+	case V4L2_PIX_FMT_YUYV:
+		return DRM_FORMAT_YUYV;
+	default:
+		return 0;
+	}
+}
+
+/* dma-buf of every capture buffer, for DRM to scan out directly */
+static void export_buffers(struct video_channel *video_ch)
+{
+	struct v4l2_exportbuffer expbuf;
+	int i;
+
+	for (i = 0; i < TEST_BUFFER_NUM; i++) {
+		video_ch->dmabuf[i] = -1;
+		if (g_no_plane || g_num_planes != 1 ||
+		    video_ch->mem_type != V4L2_MEMORY_MMAP)
+			continue;
+
+		memset(&expbuf, 0, sizeof(expbuf));
+		expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+		expbuf.index = i;
+		expbuf.plane = 0;
+		expbuf.flags = O_RDWR | O_CLOEXEC;
+		if (ioctl(video_ch->v4l_fd, VIDIOC_EXPBUF, &expbuf) < 0) {
+			v4l2_dbg("buffer[%d] VIDIOC_EXPBUF fail\n", i);
+			continue;
+		}
+		video_ch->dmabuf[i] = expbuf.fd;
+	}
+}
+
+static void close_exported_buffers(struct video_channel *video_ch)
+{
+	int i;
+
+	for (i = 0; i < TEST_BUFFER_NUM; i++) {
+		if (video_ch->dmabuf[i] >= 0)
+			close(video_ch->dmabuf[i]);
+		video_ch->dmabuf[i] = -1;
+	}
+}
+
+static void release_frame(void *arg, int index)
+{
+	queue_buffer(index, arg);
+}
+
+/* Hand every frame to the compositor, which gives them back when done */
+static void *capture_thread(void *arg)
+{
+	struct video_channel *video_ch = arg;
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = video_ch->v4l_fd;
+	pfd.events = POLLIN;
+	while (video_ch->frame_num < g_num_frames && !quitflag) {
+		ret = poll(&pfd, 1, 100);
+		if (ret < 0 && errno != EINTR)
+			break;
+		if (ret <= 0)
+			continue;
+		if (dqueue_buffer(video_ch->cur_buf_id, video_ch) < 0)
+			break;
+		comp_post(video_ch->comp, video_ch->comp_id,
+			  video_ch->cur_buf_id, video_ch->cur_ts);
+	}
+	comp_source_done(video_ch->comp, video_ch->comp_id);
+	return NULL;
+}
+
+static int add_comp_source(struct compositor *comp, struct drm_device *drm,
+			   struct video_channel *video_ch)
+{
+	struct drm_buffer *buf = &drm->buffers[0];
+	struct comp_source src;
+	int j, ret;
+
+	memset(&src, 0, sizeof(src));
+	src.fourcc = to_drm_fourcc(video_ch->cap_fmt);
+	src.width = video_ch->cap_width;
+	src.height = video_ch->cap_height;
+	src.pitch = video_ch->bytesperline ? video_ch->bytesperline :
+		    video_ch->cap_width * drm->bytes_per_pixel;
+
+	/* same layout as display_on_screen(): one camera in the middle */
+	src.x = video_ch->x_offset;
+	src.y = video_ch->y_offset;
+	if (g_cam_num == 1) {
+		if (buf->width > src.width)
+			src.x += (buf->width - src.width) >> 1;
+		if (buf->height > src.height)
+			src.y += (buf->height - src.height) >> 1;
+	} else {
+		src.max_w = video_ch->out_width;
+		src.max_h = video_ch->out_height;
+	}
+
+	src.nr_buffer = TEST_BUFFER_NUM;
+	for (j = 0; j < TEST_BUFFER_NUM; j++) {
+		src.map[j] = video_ch->buffers[j].planes[0].start;
+		src.dmabuf[j] = video_ch->dmabuf[j];
+	}
+	src.release = release_frame;
+	src.arg = video_ch;
+
+	ret = comp_add_source(comp, &src);
+	if (ret < 0)
+		return ret;
+	video_ch->comp = comp;
+	video_ch->comp_id = ret;
+	return 0;
+}
+
+/*
+ * Playback with a capture thread per camera.  Cameras go on overlay planes
+ * straight from their own buffers when the display can, the rest are copied
+ * by several threads, and a slow camera never holds up the others.
+ */
+static int redraw_composited(struct media_dev *media)
+{
+	struct video_channel *video_ch = media->v4l2_dev->video_ch;
+	struct drm_device *drm = media->drm_dev;
+	struct compositor comp;
+	struct comp_output out;
+	bool started[NUM_SENSORS];
+	int i, ret, max_age;
+
+	memset(&out, 0, sizeof(out));
+	out.fd = drm->drm_fd;
+	out.crtc_id = drm->crtc_id;
+	out.width = drm->buffers[0].width;
+	out.height = drm->buffers[0].height;
+	out.cpp = drm->bytes_per_pixel;
+	for (i = 0; i < 2; i++) {
+		out.buf[i].map = drm->buffers[i].fb_base;
+		out.buf[i].fb_id = drm->buffers[i].buf_id;
+		out.buf[i].pitch = drm->buffers[i].stride;
+	}
+	out.front = drm->front_buf;
+
+	if (g_max_age_ms >= 0)
+		max_age = g_max_age_ms * 1000;
+	else
+		max_age = 2000000 / (g_camera_framerate ? g_camera_framerate : 30);
+
+	ret = comp_init(&comp, &out, g_comp_threads, !g_no_plane, max_age);
+	if (ret < 0) {
+		v4l2_err("compositor init fail\n");
+		return ret;
+	}
+
+	memset(started, 0, sizeof(started));
+	for (i = 0; i < NUM_SENSORS; i++)
+		if (video_ch[i].on)
+			export_buffers(&video_ch[i]);
+	for (i = 0; i < NUM_SENSORS; i++) {
+		if (!video_ch[i].on)
+			continue;
+		ret = add_comp_source(&comp, drm, &video_ch[i]);
+		if (ret < 0) {
+			v4l2_err("channel[%d] add to compositor fail\n", i);
+			goto fini;
+		}
+	}
+
+	for (i = 0; i < NUM_SENSORS; i++) {
+		if (!video_ch[i].on)
+			continue;
+		gettimeofday(&video_ch[i].tv1, NULL);
+		if (pthread_create(&video_ch[i].tid, NULL, capture_thread,
+				   &video_ch[i])) {
+			v4l2_err("channel[%d] capture thread fail\n", i);
+			quitflag = true;
+			ret = -1;
+			break;
+		}
+		started[i] = true;
+	}
+
+	if (!ret)
+		ret = comp_run(&comp, &quitflag);
+	if (ret < 0)
+		quitflag = true;
+
+	for (i = 0; i < NUM_SENSORS; i++) {
+		if (started[i]) {
+			pthread_join(video_ch[i].tid, NULL);
+			gettimeofday(&video_ch[i].tv2, NULL);
+		}
+	}
+	printf("\n");
+	comp_report(&comp);
+
+fini:
+	comp_fini(&comp);
+	drm->front_buf = comp.out.front;
+	for (i = 0; i < NUM_SENSORS; i++)
+		if (video_ch[i].on)
+			close_exported_buffers(&video_ch[i]);
+	return ret < 0 ? -1 : 0;
+}
+
 static void close_v4l2_device(struct v4l2_device *v4l2)
 {
 	struct video_channel *video_ch = v4l2->video_ch;
@@ -1728,6 +1991,28 @@ static void media_device_close(struct media_dev *media)
 	close_v4l2_device(v4l2);
 }
 
+/* vivid stands in for the cameras on any SoC, or on a PC with vkms */
+static bool cameras_are_vivid(void)
+{
+	struct v4l2_capability cap;
+	bool vivid = g_cam != 0;
+	int i, fd;
+
+	for (i = 0; i < NUM_SENSORS && vivid; i++) {
+		if (!((g_cam >> i) & 0x01))
+			continue;
+		fd = open(g_v4l_device[i], O_RDWR, 0);
+		if (fd < 0)
+			return false;
+		memset(&cap, 0, sizeof(cap));
+		if (ioctl(fd, VIDIOC_QUERYCAP, &cap) < 0 ||
+		    strcmp((char *)cap.driver, "vivid"))
+			vivid = false;
+		close(fd);
+	}
+	return vivid;
+}
+
 /*
  * Main function
  */
@@ -1737,12 +2022,6 @@ int main(int argc, const char *argv[])
 	char *soc_list[] = { "i.MX8QM", "i.MX8QXP", "i.MX8MN", " " };
 	int ret;
 
-	ret = soc_version_check(soc_list);
-	if (ret == 0) {
-		v4l2_err("not supported on current soc\n");
-		return 0;
-	}
-
 	global_vars_init();
 
 	pthread_t sigtid;
@@ -1757,6 +2036,11 @@ int main(int argc, const char *argv[])
 		return ret;
 	}
 
+	if (!soc_version_check(soc_list) && !cameras_are_vivid()) {
+		v4l2_err("not supported on current soc\n");
+		return 0;
+	}
+
 	ret = media_device_alloc(&media);
 	if (ret < 0) {
 		v4l2_err("No enough memory\n");
@@ -1775,7 +2059,10 @@ int main(int argc, const char *argv[])
 	if (ret < 0)
 		goto cleanup;
 
-	ret = redraw(&media);
+	if (!g_saved_to_file && !g_serial)
+		ret = redraw_composited(&media);
+	else
+		ret = redraw(&media);
 	if (ret < 0)
 		goto stop;
 
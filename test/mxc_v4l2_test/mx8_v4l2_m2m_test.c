@@ -29,6 +29,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/epoll.h>
 #include <linux/v4l2-common.h>
 #include <linux/v4l2-controls.h>
 #include <linux/v4l2-dv-timings.h>
@@ -56,8 +59,10 @@ do {                                      \
 #define v4l2_err(fmt, args...)   \
 	    v4l2_printf(ERR_LEVEL, "\x1B[31m"fmt"\e[0m", ##args)
 
-#define TEST_BUFFER_NUM_IN		1
-#define TEST_BUFFER_NUM_OUT		3
+#define MAX_BUFFER_NUM			32
+#define MAX_PLANE_NUM			3
+#define MAX_SWEEP_NUM			8
+#define DEFAULT_FRAMES			300
 
 #define TEST_WIDTH		640
 #define TEST_HEIGHT		480
@@ -74,7 +79,7 @@ struct mxc_buffer {
 	__u32 length;
 	size_t offset;
 
-	struct plane_buffer planes[3];
+	struct plane_buffer planes[MAX_PLANE_NUM];
 };
 
 struct rect {
@@ -90,19 +95,41 @@ struct mxc_m2m_device {
 	struct rect src;
 	struct rect dst;
 
+	/* vim2m and older drivers only have the single planar API */
+	bool mplane;
+	__u32 in_type;
+	__u32 out_type;
+
 	int in_num_planes;
 	int o_num_planes;
+	__u32 in_sizeimage[MAX_PLANE_NUM];
+	size_t in_frame_size;
+
+	int in_num_buffers;
+	int out_num_buffers;
 
 	int in_frame_num;
 	int out_frame_num;
 
 	int in_cur_buf_id;
 	int out_cur_buf_id;
+	unsigned long out_cur_seq;	/* from the copied timestamp */
 
 	int frames;
+	int file_frames;
+	int epoll_fd;
 
-	struct mxc_buffer in_buffers[TEST_BUFFER_NUM_IN];
-	struct mxc_buffer out_buffers[TEST_BUFFER_NUM_OUT];
+	struct mxc_buffer in_buffers[MAX_BUFFER_NUM];
+	struct mxc_buffer out_buffers[MAX_BUFFER_NUM];
+};
+
+/* One run at a given number of jobs in flight */
+struct m2m_stats {
+	int depth;
+	int frames;
+	long long usec;
+	long long *latency;	/* us from QBUF to DQBUF, per frame */
+	long long lat_sum;
 };
 
 static sigset_t sigset_v;
@@ -123,6 +150,11 @@ static bool g_cap_hfilp;
 static bool g_cap_vfilp;
 static bool g_performance_test = false;
 static int32_t g_cap_alpha;
+static int g_depth = 1;
+static bool g_sweep;
+static bool g_pattern;
+static bool g_discard;
+static int g_frames;
 
 /*
  *
@@ -169,11 +201,20 @@ static void print_usage(char *name)
 		   " -hflip <num> enable horizontal flip, num: 0->disable or 1->enable\n"
 		   " -vflip <num> enable vertical flip, num: 0->disable or 1->enable\n"
 		   " -alpha <num> enable and set global alpha for camera, num equal to 0~255\n"
+		   " -p            : performance test, input is read once and output is not saved\n"
+		   " -depth <num>  : jobs in flight, 1~%d, default 1\n"
+		   " -sweep        : run at depth 1, 2, 4, ... up to -depth and compare throughput\n"
+		   " -pattern      : generate the input instead of reading -i\n"
+		   " -discard      : do not save the output\n"
+		   " -n <frames>   : frames per run, default the whole input file or %d with -pattern,\n"
+		   "                 the input file is read again from the start if it is shorter\n"
 		   "examples:\n"
 		   "\t %s\n"
 		   "\t %s -i 0.rgb32 -iw 1280 -ih 800 -ifmt \"XR24\" "
-		   "-o out.dat -ow 1280 -oh 800 -ofmt \"NV12\"\n",
-		   name, name, name, name, name);
+		   "-o out.dat -ow 1280 -oh 800 -ofmt \"NV12\"\n"
+		   "\t %s -pattern -discard -n 500 -depth 8 -sweep\n",
+		   name, name, name, MAX_BUFFER_NUM, DEFAULT_FRAMES,
+		   name, name, name);
 }
 
 static __u32 to_fourcc(char fmt[])
@@ -202,6 +243,9 @@ static __u32 to_fourcc(char fmt[])
 		fourcc = V4L2_PIX_FMT_XBGR32;
 	else if (!strcmp(fmt, "AR24"))
 		fourcc = V4L2_PIX_FMT_ABGR32;
+	else if (strlen(fmt) == 4)
+		/* any other fourcc as is, e.g. FWHT for vicodec */
+		fourcc = v4l2_fourcc(fmt[0], fmt[1], fmt[2], fmt[3]);
 	else {
 		v4l2_err("Not support format, set default to XR24\n");
 		fourcc = V4L2_PIX_FMT_XBGR32;
@@ -209,8 +253,9 @@ static __u32 to_fourcc(char fmt[])
 	return fourcc;
 }
 
-static void show_device_cap_list(int fd_v4l)
+static void show_device_cap_list(struct mxc_m2m_device *m2m_dev)
 {
+	int fd_v4l = m2m_dev->fd;
 	struct v4l2_fmtdesc fmtdesc;
 	struct v4l2_frmivalenum frmival;
 	struct v4l2_frmsizeenum frmsize;
@@ -219,7 +264,7 @@ static void show_device_cap_list(int fd_v4l)
 
 	/* Show capture device */
 	fmtdesc.index = 0;
-	fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	fmtdesc.type = m2m_dev->out_type;
 	while (ioctl(fd_v4l, VIDIOC_ENUM_FMT, &fmtdesc) >= 0) {
 		v4l2_info("support output pixelformat %.4s\n",
 					(char *)&fmtdesc.pixelformat);
@@ -251,7 +296,7 @@ static void show_device_cap_list(int fd_v4l)
 
 	/* Show out device */
 	fmtdesc.index = 0;
-	fmtdesc.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	fmtdesc.type = m2m_dev->in_type;
 	while (ioctl(fd_v4l, VIDIOC_ENUM_FMT, &fmtdesc) >= 0) {
 		v4l2_info("support input pixelformat %.4s\n",
 					(char *)&fmtdesc.pixelformat);
@@ -318,6 +363,20 @@ static int parse_cmdline(int argc, char *argv[])
 			g_cap_alpha = atoi(argv[++i]);
 		} else if (strcmp(argv[i], "-p") == 0) {
 			g_performance_test = true;
+		} else if (strcmp(argv[i], "-depth") == 0) {
+			g_depth = atoi(argv[++i]);
+			if (g_depth < 1 || g_depth > MAX_BUFFER_NUM) {
+				v4l2_err("depth should be 1~%d\n", MAX_BUFFER_NUM);
+				return -1;
+			}
+		} else if (strcmp(argv[i], "-sweep") == 0) {
+			g_sweep = true;
+		} else if (strcmp(argv[i], "-pattern") == 0) {
+			g_pattern = true;
+		} else if (strcmp(argv[i], "-discard") == 0) {
+			g_discard = true;
+		} else if (strcmp(argv[i], "-n") == 0) {
+			g_frames = atoi(argv[++i]);
 		} else if (strcmp(argv[i], "-h") == 0) {
 			print_usage(argv[0]);
 			return -1;
@@ -331,7 +390,7 @@ static int parse_cmdline(int argc, char *argv[])
 
 static int get_bpp(char format[])
 {
-	__u32 bpp;
+	__u32 bpp = 0;
 	__u32 fourcc = to_fourcc(format);
 
 	switch(fourcc) {
@@ -353,7 +412,8 @@ static int get_bpp(char format[])
 		bpp = 2;
 		break;
 	default:
-		v4l2_err("Not support format\n");
+		/* compressed or unknown, the driver gives the size */
+		break;
 	}
 	return bpp;
 }
@@ -368,6 +428,9 @@ static int check_input_parameters(struct mxc_m2m_device *m2m_dev)
 		return -1;
 	}
 
+	if (g_pattern)
+		return 0;
+
 	fseek(m2m_dev->in_file, 0, SEEK_END);
 	filesize = ftell(m2m_dev->in_file);
 	fseek(m2m_dev->in_file, 0, SEEK_SET);
@@ -384,6 +447,7 @@ static int check_device_cap(struct mxc_m2m_device *m2m_dev)
 {
 	struct v4l2_capability capabilities;
 	int fd = m2m_dev->fd;
+	__u32 caps;
 
 	memset(&capabilities, 0, sizeof(capabilities));
 	if (ioctl(fd, VIDIOC_QUERYCAP, &capabilities) < 0) {
@@ -391,46 +455,62 @@ static int check_device_cap(struct mxc_m2m_device *m2m_dev)
 		return -1;
 	}
 
-	if (!(capabilities.capabilities & V4L2_CAP_VIDEO_M2M_MPLANE)) {
+	caps = capabilities.capabilities;
+	if (caps & V4L2_CAP_DEVICE_CAPS)
+		caps = capabilities.device_caps;
+
+	if (caps & V4L2_CAP_VIDEO_M2M_MPLANE) {
+		m2m_dev->mplane = true;
+		m2m_dev->in_type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+		m2m_dev->out_type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	} else if (caps & V4L2_CAP_VIDEO_M2M) {
+		m2m_dev->mplane = false;
+		m2m_dev->in_type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		m2m_dev->out_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	} else {
 		v4l2_err("The device does not handle memory to memory video capture.\n");
 		return -1;
 	}
+	v4l2_info("driver %s, %s planar API\n", capabilities.driver,
+		  m2m_dev->mplane ? "multi" : "single");
 
 	return 0;
 }
 
-static void calculate_frames_of_infile(FILE *f, struct mxc_m2m_device *m2m_dev)
+/* The virtual drivers run anywhere, not only on the SoCs listed in main */
+static bool is_virtual_device(void)
 {
-	int frames;
-	long filesize;
-
-	fseek(f, 0, SEEK_END);
-	filesize = ftell(f);
-	fseek(f, 0, SEEK_SET);
-
-	frames = filesize / (m2m_dev->src.width * m2m_dev->src.height * get_bpp(in_format));
+	struct v4l2_capability cap;
+	bool ret = false;
+	int fd;
 
-	m2m_dev->frames = frames;
-	v4l2_info("Input file size is = %lu, frames is = %d\n", filesize, frames);
+	fd = open(dev_name, O_RDWR | O_NONBLOCK, 0);
+	if (fd < 0)
+		return false;
+	memset(&cap, 0, sizeof(cap));
+	if (ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0)
+		ret = !strcmp((char *)cap.driver, "vim2m") ||
+		      !strcmp((char *)cap.driver, "vicodec");
+	close(fd);
+	return ret;
 }
 
-static int get_fps(struct timeval *start, struct timeval *end, int frame)
+static long long get_time_us(void)
 {
-	int fps;
-	int time;
-
-	time = (int)((end->tv_sec - start->tv_sec) * 1000000 + (end->tv_usec - start->tv_usec));
-	fps = (frame * 1000000) / time;
+	struct timespec ts;
 
-	return fps;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
 }
 
 static int mxc_m2m_open(struct mxc_m2m_device *m2m_dev)
 {
+	struct epoll_event ev;
 	int fd;
-	FILE *in, *out;
+	FILE *in = NULL, *out = NULL;
 
-	fd = open(dev_name, O_RDWR, 0);
+	/* both queues are dequeued from one loop, never block in DQBUF */
+	fd = open(dev_name, O_RDWR | O_NONBLOCK, 0);
 	if (fd < 0) {
 		v4l2_err("Open %s fail\n", dev_name);
 		return -1;
@@ -442,28 +522,49 @@ static int mxc_m2m_open(struct mxc_m2m_device *m2m_dev)
 		return 0;
 	}
 
-	in = fopen(in_file_name, "rb");
-	if (in == NULL) {
-		v4l2_err("Open %s fail\n", in_file_name);
+	m2m_dev->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (m2m_dev->epoll_fd < 0) {
+		v4l2_err("epoll_create1 fail\n");
 		close(fd);
 		return -1;
 	}
-	v4l2_info("Open \"%s\" success\n", in_file_name);
-	calculate_frames_of_infile(in, m2m_dev);
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLERR;
+	ev.data.fd = fd;
+	if (epoll_ctl(m2m_dev->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		v4l2_err("epoll_ctl add %s fail\n", dev_name);
+		goto err;
+	}
 
-	out = fopen(out_file_name, "wb");
-	if (out == NULL) {
-		v4l2_err("Open \"%s\" fail\n", out_file_name);
-		fclose(in);
-		close(fd);
-		return -1;
+	if (!g_pattern) {
+		in = fopen(in_file_name, "rb");
+		if (in == NULL) {
+			v4l2_err("Open %s fail\n", in_file_name);
+			goto err;
+		}
+		v4l2_info("Open \"%s\" success\n", in_file_name);
+	}
+
+	if (!g_discard) {
+		out = fopen(out_file_name, "wb");
+		if (out == NULL) {
+			v4l2_err("Open \"%s\" fail\n", out_file_name);
+			goto err;
+		}
+		v4l2_info("Open \"%s\" success\n", out_file_name);
 	}
-	v4l2_info("Open \"%s\" success\n", out_file_name);
 
 	m2m_dev->fd = fd;
 	m2m_dev->in_file = in;
 	m2m_dev->out_file = out;
 	return 0;
+
+err:
+	if (in)
+		fclose(in);
+	close(m2m_dev->epoll_fd);
+	close(fd);
+	return -1;
 }
 
 static void mxc_m2m_close(struct mxc_m2m_device *m2m_dev)
@@ -471,8 +572,37 @@ static void mxc_m2m_close(struct mxc_m2m_device *m2m_dev)
 	close(m2m_dev->fd);
 	if (show_device_cap)
 		return;
-	fclose(m2m_dev->in_file);
-	fclose(m2m_dev->out_file);
+	close(m2m_dev->epoll_fd);
+	if (m2m_dev->in_file)
+		fclose(m2m_dev->in_file);
+	if (m2m_dev->out_file)
+		fclose(m2m_dev->out_file);
+}
+
+/* Whole frames in the input file, now that the driver gave the frame size */
+static int count_input_frames(struct mxc_m2m_device *m2m_dev)
+{
+	long filesize;
+
+	if (g_pattern) {
+		m2m_dev->frames = g_frames > 0 ? g_frames : DEFAULT_FRAMES;
+		return 0;
+	}
+
+	fseek(m2m_dev->in_file, 0, SEEK_END);
+	filesize = ftell(m2m_dev->in_file);
+	fseek(m2m_dev->in_file, 0, SEEK_SET);
+
+	m2m_dev->file_frames = filesize / m2m_dev->in_frame_size;
+	if (m2m_dev->file_frames == 0) {
+		v4l2_err("input file is smaller than one %zu bytes frame\n",
+			 m2m_dev->in_frame_size);
+		return -1;
+	}
+	m2m_dev->frames = g_frames > 0 ? g_frames : m2m_dev->file_frames;
+	v4l2_info("Input file size is = %lu, frames is = %d\n", filesize,
+		  m2m_dev->file_frames);
+	return 0;
 }
 
 static int fill_in_buffer(int buf_id, struct mxc_m2m_device *m2m_dev)
@@ -480,18 +610,44 @@ static int fill_in_buffer(int buf_id, struct mxc_m2m_device *m2m_dev)
 	size_t rsize;
 	int j;
 
+	/* -n longer than the file: start over */
+	if (m2m_dev->in_frame_num > 0 &&
+	    m2m_dev->in_frame_num % m2m_dev->file_frames == 0)
+		fseek(m2m_dev->in_file, 0, SEEK_SET);
+
 	for (j = 0; j < m2m_dev->in_num_planes; j++) {
 		rsize = fread(m2m_dev->in_buffers[buf_id].planes[j].start,
-					m2m_dev->in_buffers[buf_id].planes[j].length,
+					m2m_dev->in_sizeimage[j],
 					1, m2m_dev->in_file);
 		if (rsize < 1) {
 			v4l2_err("No more data read from input file\n");
 			return -1;
 		}
 	}
+	m2m_dev->in_frame_num++;
 	return 0;
 }
 
+/*
+ * A different picture in every buffer, so that a driver handing back the
+ * wrong buffer shows up in the output.
+ */
+static void fill_pattern(int buf_id, struct mxc_m2m_device *m2m_dev)
+{
+	struct plane_buffer *plane;
+	__u32 line, i;
+	int j;
+
+	line = m2m_dev->in_sizeimage[0] / m2m_dev->src.height;
+	if (line == 0)
+		line = 1;
+	for (j = 0; j < m2m_dev->in_num_planes; j++) {
+		plane = &m2m_dev->in_buffers[buf_id].planes[j];
+		for (i = 0; i < m2m_dev->in_sizeimage[j]; i++)
+			((__u8 *)plane->start)[i] = i % line + i / line + buf_id * 16;
+	}
+}
+
 static int save_to_file(struct mxc_m2m_device *m2m_dev)
 {
 	size_t wsize;
@@ -499,8 +655,11 @@ static int save_to_file(struct mxc_m2m_device *m2m_dev)
 	int j;
 
 	for (j = 0; j < m2m_dev->o_num_planes; j++) {
+		/* bytesused, a codec's output is shorter than the buffer */
+		if (m2m_dev->out_buffers[buf_id].planes[j].plane_size == 0)
+			continue;
 		wsize = fwrite(m2m_dev->out_buffers[buf_id].planes[j].start,
-					   m2m_dev->out_buffers[buf_id].planes[j].length,
+					   m2m_dev->out_buffers[buf_id].planes[j].plane_size,
 					   1, m2m_dev->out_file);
 		if (wsize < 1) {
 			v4l2_err("No more device space for output file\n");
@@ -510,151 +669,207 @@ static int save_to_file(struct mxc_m2m_device *m2m_dev)
 	return 0;
 }
 
-static int mxc_m2m_prepare(struct mxc_m2m_device *m2m_dev)
+static int set_format(struct mxc_m2m_device *m2m_dev, __u32 type,
+		      char *format, struct rect *r)
+{
+	struct v4l2_format fmt;
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = type;
+	if (m2m_dev->mplane) {
+		fmt.fmt.pix_mp.pixelformat = to_fourcc(format);
+		fmt.fmt.pix_mp.width = r->width;
+		fmt.fmt.pix_mp.height = r->height;
+	} else {
+		fmt.fmt.pix.pixelformat = to_fourcc(format);
+		fmt.fmt.pix.width = r->width;
+		fmt.fmt.pix.height = r->height;
+	}
+	return ioctl(m2m_dev->fd, VIDIOC_S_FMT, &fmt);
+}
+
+/* Returns the number of planes, sizeimage of each in sizes */
+static int get_format(struct mxc_m2m_device *m2m_dev, __u32 type,
+		      const char *name, __u32 sizes[])
+{
+	struct v4l2_format fmt;
+	int i, num_planes;
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = type;
+	if (ioctl(m2m_dev->fd, VIDIOC_G_FMT, &fmt) < 0) {
+		v4l2_err("%s VIDIOC_G_FMT fail\n", name);
+		return -1;
+	}
+
+	if (!m2m_dev->mplane) {
+		v4l2_info("%s: w/h=(%d,%d) pixelformat=%.4s num_planes=1\n",
+			  name, fmt.fmt.pix.width, fmt.fmt.pix.height,
+			  (char *)&fmt.fmt.pix.pixelformat);
+		v4l2_info("\t plane[0]: bytesperline=%d sizeimage=%d\n",
+			  fmt.fmt.pix.bytesperline, fmt.fmt.pix.sizeimage);
+		sizes[0] = fmt.fmt.pix.sizeimage;
+		return 1;
+	}
+
+	v4l2_info("%s: w/h=(%d,%d) pixelformat=%.4s num_planes=%d\n",
+			  name,
+			  fmt.fmt.pix_mp.width,
+			  fmt.fmt.pix_mp.height,
+			  (char *)&fmt.fmt.pix_mp.pixelformat,
+			  fmt.fmt.pix_mp.num_planes);
+	num_planes = fmt.fmt.pix_mp.num_planes;
+	if (num_planes > MAX_PLANE_NUM) {
+		v4l2_err("%s: %d planes, at most %d supported\n", name,
+			 num_planes, MAX_PLANE_NUM);
+		return -1;
+	}
+	for (i = 0; i < num_planes; i++) {
+		v4l2_info("\t plane[%d]: bytesperline=%d sizeimage=%d\n", i,
+			  fmt.fmt.pix_mp.plane_fmt[i].bytesperline,
+			  fmt.fmt.pix_mp.plane_fmt[i].sizeimage);
+		sizes[i] = fmt.fmt.pix_mp.plane_fmt[i].sizeimage;
+	}
+	return num_planes;
+}
+
+/*
+ * vim2m and vicodec lack some of these controls; only fail when the user
+ * asked for something other than the default.
+ */
+static int set_ctrl(int fd, __u32 id, int value, const char *name)
 {
-	struct v4l2_format in_fmt;
-	struct v4l2_format out_fmt;
 	struct v4l2_control ctrl;
+
+	memset(&ctrl, 0, sizeof(ctrl));
+	ctrl.id = id;
+	ctrl.value = value;
+	if (ioctl(fd, VIDIOC_S_CTRL, &ctrl) < 0) {
+		if (value == 0) {
+			v4l2_dbg("no %s control, ignored\n", name);
+			return 0;
+		}
+		v4l2_err("VIDIOC_S_CTRL set %s failed\n", name);
+		return -1;
+	}
+	return 0;
+}
+
+static int mxc_m2m_prepare(struct mxc_m2m_device *m2m_dev)
+{
+	__u32 sizes[MAX_PLANE_NUM];
 	int i, fd = m2m_dev->fd;
 	int ret;
 
-	memset(&in_fmt, 0, sizeof(in_fmt));
-	in_fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-	in_fmt.fmt.pix_mp.pixelformat = to_fourcc(in_format);
-	in_fmt.fmt.pix_mp.width = m2m_dev->src.width;
-	in_fmt.fmt.pix_mp.height = m2m_dev->src.height;
-	ret = ioctl(fd, VIDIOC_S_FMT, &in_fmt);
+	ret = set_format(m2m_dev, m2m_dev->in_type, in_format, &m2m_dev->src);
 	if (ret < 0) {
 		v4l2_err("in VIDIOC_S_FMT fail\n");
 		return ret;
 	}
 
-	memset(&out_fmt, 0, sizeof(out_fmt));
-	out_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-	out_fmt.fmt.pix_mp.pixelformat = to_fourcc(out_format);
-	out_fmt.fmt.pix_mp.width = m2m_dev->dst.width;
-	out_fmt.fmt.pix_mp.height = m2m_dev->dst.height;
-	ret = ioctl(fd, VIDIOC_S_FMT, &out_fmt);
+	ret = set_format(m2m_dev, m2m_dev->out_type, out_format, &m2m_dev->dst);
 	if (ret < 0) {
 		v4l2_err("out VIDIOC_S_FMT fail\n");
 		return ret;
 	}
 
 	/* IN G_FMT */
-	memset(&in_fmt, 0, sizeof(in_fmt));
-	in_fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-	ret = ioctl(fd, VIDIOC_G_FMT, &in_fmt);
-	if (ret < 0) {
-		v4l2_err("in VIDIOC_G_FMT fail\n");
+	ret = get_format(m2m_dev, m2m_dev->in_type, "in", m2m_dev->in_sizeimage);
+	if (ret < 0)
 		return ret;
-	}
-	v4l2_info("in: w/h=(%d,%d) pixelformat=%.4s num_planes=%d\n",
-			  in_fmt.fmt.pix_mp.width,
-			  in_fmt.fmt.pix_mp.height,
-			  (char *)&in_fmt.fmt.pix_mp.pixelformat,
-			  in_fmt.fmt.pix_mp.num_planes);
-	for (i = 0; i < in_fmt.fmt.pix_mp.num_planes; i++) {
-		v4l2_info("\t plane[%d]: bytesperline=%d sizeimage=%d\n", i,
-			  in_fmt.fmt.pix_mp.plane_fmt[i].bytesperline,
-			  in_fmt.fmt.pix_mp.plane_fmt[i].sizeimage);
-	}
-	m2m_dev->in_num_planes = in_fmt.fmt.pix_mp.num_planes;
+	m2m_dev->in_num_planes = ret;
+	m2m_dev->in_frame_size = 0;
+	for (i = 0; i < m2m_dev->in_num_planes; i++)
+		m2m_dev->in_frame_size += m2m_dev->in_sizeimage[i];
 
-	memset(&out_fmt, 0, sizeof(out_fmt));
-	out_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-	ret = ioctl(fd, VIDIOC_G_FMT, &out_fmt);
-	if (ret < 0) {
-		v4l2_err("out VIDIOC_G_FMT fail\n");
+	ret = get_format(m2m_dev, m2m_dev->out_type, "out", sizes);
+	if (ret < 0)
 		return ret;
-	}
-	v4l2_info("out: w/h=(%d,%d) pixelformat=%.4s num_planes=%d\n",
-			  out_fmt.fmt.pix_mp.width,
-			  out_fmt.fmt.pix_mp.height,
-			  (char *)&out_fmt.fmt.pix_mp.pixelformat,
-			  out_fmt.fmt.pix_mp.num_planes);
-	for (i = 0; i < out_fmt.fmt.pix_mp.num_planes; i++) {
-		v4l2_info("\t plane[%d]: bytesperline=%d sizeimage=%d\n", i,
-				  out_fmt.fmt.pix_mp.plane_fmt[i].bytesperline,
-				  out_fmt.fmt.pix_mp.plane_fmt[i].sizeimage);
-	}
-	m2m_dev->o_num_planes = out_fmt.fmt.pix_mp.num_planes;
+	m2m_dev->o_num_planes = ret;
 
-	memset(&ctrl, 0, sizeof(ctrl));
-	ctrl.id = V4L2_CID_HFLIP;
-	ctrl.value = (g_cap_hfilp > 0) ? 1 : 0;
-	ret = ioctl(fd, VIDIOC_S_CTRL, &ctrl);
-	if (ret < 0) {
-		v4l2_err("VIDIOC_S_CTRL set hflip failed\n");
+	ret = set_ctrl(fd, V4L2_CID_HFLIP, (g_cap_hfilp > 0) ? 1 : 0, "hflip");
+	if (ret < 0)
 		return ret;
-	}
 
-	memset(&ctrl, 0, sizeof(ctrl));
-	ctrl.id = V4L2_CID_VFLIP;
-	ctrl.value = (g_cap_vfilp > 0) ? 1 : 0;
-	ret = ioctl(fd, VIDIOC_S_CTRL, &ctrl);
-	if (ret < 0) {
-		v4l2_err("VIDIOC_S_CTRL set vflip failed\n");
+	ret = set_ctrl(fd, V4L2_CID_VFLIP, (g_cap_vfilp > 0) ? 1 : 0, "vflip");
+	if (ret < 0)
 		return ret;
-	}
 
-	memset(&ctrl, 0, sizeof(ctrl));
-	ctrl.id = V4L2_CID_ALPHA_COMPONENT;
-	ctrl.value = g_cap_alpha;
-	ret = ioctl(fd, VIDIOC_S_CTRL, &ctrl);
-	if (ret < 0) {
-		v4l2_err("VIDIOC_S_CTRL set alpha failed\n");
+	ret = set_ctrl(fd, V4L2_CID_ALPHA_COMPONENT, g_cap_alpha, "alpha");
+	if (ret < 0)
 		return ret;
-	}
 
 	return 0;
 }
 
-static int query_in_buffer(struct mxc_m2m_device *m2m_dev)
+/* A v4l2_buffer for either queue, in whichever planar API the driver has */
+static void init_buffer(struct mxc_m2m_device *m2m_dev, struct v4l2_buffer *buf,
+			struct v4l2_plane *planes, __u32 type, int index)
 {
-	struct v4l2_buffer bufferin;
-	struct v4l2_plane *planes;
-	int i, fd = m2m_dev->fd;
+	memset(buf, 0, sizeof(*buf));
+	buf->type = type;
+	buf->memory = V4L2_MEMORY_MMAP;
+	buf->index = index;
+	if (m2m_dev->mplane) {
+		memset(planes, 0, MAX_PLANE_NUM * sizeof(*planes));
+		buf->m.planes = planes;
+		buf->length = type == m2m_dev->in_type ?
+				m2m_dev->in_num_planes : m2m_dev->o_num_planes;
+	}
+}
 
-	planes = malloc(m2m_dev->in_num_planes * sizeof(*planes));
-	if (!planes) {
-		v4l2_err("alloc %d planes fail\n", m2m_dev->in_num_planes);
-		return -1;
+/* Plane j of a queried or dequeued buffer as the multi planar API has it */
+static void get_plane(struct mxc_m2m_device *m2m_dev, struct v4l2_buffer *buf,
+		      int j, __u32 *length, size_t *offset, __u32 *bytesused)
+{
+	if (m2m_dev->mplane) {
+		*length = buf->m.planes[j].length;
+		*offset = buf->m.planes[j].m.mem_offset;
+		*bytesused = buf->m.planes[j].bytesused;
+	} else {
+		*length = buf->length;
+		*offset = buf->m.offset;
+		*bytesused = buf->bytesused;
 	}
+}
+
+static int query_in_buffer(struct mxc_m2m_device *m2m_dev)
+{
+	struct v4l2_buffer bufferin;
+	struct v4l2_plane planes[MAX_PLANE_NUM];
+	struct plane_buffer *plane;
+	__u32 bytesused;
+	int i, j, fd = m2m_dev->fd;
 
 	/* Query Buffer for IN */
-	for (i = 0; i < TEST_BUFFER_NUM_IN; i++) {
-		memset(&bufferin, 0, sizeof(bufferin));
-		memset(planes, 0, m2m_dev->in_num_planes * sizeof(*planes));
-		bufferin.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-		bufferin.memory = V4L2_MEMORY_MMAP;
-		bufferin.m.planes = planes;
-		bufferin.length = m2m_dev->in_num_planes;
-		bufferin.index = i;
+	for (i = 0; i < m2m_dev->in_num_buffers; i++) {
+		init_buffer(m2m_dev, &bufferin, planes, m2m_dev->in_type, i);
 		if (ioctl(fd, VIDIOC_QUERYBUF, &bufferin) < 0) {
 			v4l2_err("query buffer[%d] info fail\n", i);
-			free(planes);
 			return -1;
 		}
 
-		for (int j = 0; j < m2m_dev->in_num_planes; j++) {
-			m2m_dev->in_buffers[i].planes[j].length = bufferin.m.planes[j].length;
-			m2m_dev->in_buffers[i].planes[j].offset =
-							(size_t)bufferin.m.planes[j].m.mem_offset;
-			m2m_dev->in_buffers[i].planes[j].start = mmap(NULL,
-						bufferin.m.planes[j].length,
-						PROT_READ | PROT_WRITE, MAP_SHARED,
-						fd, (size_t)bufferin.m.planes[j].m.mem_offset);
+		for (j = 0; j < m2m_dev->in_num_planes; j++) {
+			plane = &m2m_dev->in_buffers[i].planes[j];
+			get_plane(m2m_dev, &bufferin, j, &plane->length,
+				  &plane->offset, &bytesused);
+			plane->start = mmap(NULL, plane->length,
+					    PROT_READ | PROT_WRITE, MAP_SHARED,
+					    fd, plane->offset);
+			if (plane->start == MAP_FAILED) {
+				v4l2_err("in buffer[%d] plane[%d] mmap fail\n", i, j);
+				return -1;
+			}
 
 			v4l2_dbg("in buffer[%d]->planes[%d]:"
 					 "startAddr=0x%p, offset=0x%x, buf_size=%d\n",
 					 i, j,
-					 (unsigned int *)m2m_dev->in_buffers[i].planes[j].start,
-					 (unsigned int)m2m_dev->in_buffers[i].planes[j].offset,
-					 m2m_dev->in_buffers[i].planes[j].length);
+					 (unsigned int *)plane->start,
+					 (unsigned int)plane->offset,
+					 plane->length);
 		}
 	}
 
-	free(planes);
 	return 0;
 }
 
@@ -662,7 +877,7 @@ static void unmap_in_buffer(struct mxc_m2m_device *m2m_dev)
 {
 	int i, j;
 
-	for (i = 0; i < TEST_BUFFER_NUM_IN; i++) {
+	for (i = 0; i < m2m_dev->in_num_buffers; i++) {
 		for (j = 0; j < m2m_dev->in_num_planes; j++) {
 			if (m2m_dev->in_buffers[i].planes[j].start != MAP_FAILED &&
 				m2m_dev->in_buffers[i].planes[j].start > 0)
@@ -676,7 +891,7 @@ static void unmap_out_buffer(struct mxc_m2m_device *m2m_dev)
 {
 	int i, j;
 
-	for (i = 0; i < TEST_BUFFER_NUM_OUT; i++) {
+	for (i = 0; i < m2m_dev->out_num_buffers; i++) {
 		for (j = 0; j < m2m_dev->o_num_planes; j++) {
 			if (m2m_dev->out_buffers[i].planes[j].start != MAP_FAILED &&
 				m2m_dev->out_buffers[i].planes[j].start > 0)
@@ -689,66 +904,63 @@ static void unmap_out_buffer(struct mxc_m2m_device *m2m_dev)
 static int query_out_buffer(struct mxc_m2m_device *m2m_dev)
 {
 	struct v4l2_buffer bufferout;
-	struct v4l2_plane *planes;
-	int i, fd = m2m_dev->fd;
-
-	planes = malloc(m2m_dev->o_num_planes * sizeof(*planes));
-	if (!planes) {
-		v4l2_err("alloc %d planes fail\n", m2m_dev->o_num_planes);
-		return -1;
-	}
-
-	/* Query Buffer for IN */
-	for (i = 0; i < TEST_BUFFER_NUM_OUT; i++) {
-		memset(&bufferout, 0, sizeof(bufferout));
-		memset(planes, 0, m2m_dev->o_num_planes * sizeof(*planes));
-		bufferout.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-		bufferout.memory = V4L2_MEMORY_MMAP;
-		bufferout.m.planes = planes;
-		bufferout.length = m2m_dev->o_num_planes;
-		bufferout.index = i;
+	struct v4l2_plane planes[MAX_PLANE_NUM];
+	struct plane_buffer *plane;
+	__u32 bytesused;
+	int i, j, fd = m2m_dev->fd;
+
+	/* Query Buffer for OUT */
+	for (i = 0; i < m2m_dev->out_num_buffers; i++) {
+		init_buffer(m2m_dev, &bufferout, planes, m2m_dev->out_type, i);
 		if (ioctl(fd, VIDIOC_QUERYBUF, &bufferout) < 0) {
 			v4l2_err("query buffer[%d] info fail\n", i);
-			free(planes);
 			return -1;
 		}
 
-		for (int j = 0; j < m2m_dev->o_num_planes; j++) {
-			m2m_dev->out_buffers[i].planes[j].length = bufferout.m.planes[j].length;
-			m2m_dev->out_buffers[i].planes[j].offset =
-							(size_t)bufferout.m.planes[j].m.mem_offset;
-			m2m_dev->out_buffers[i].planes[j].start = mmap(NULL,
-						bufferout.m.planes[j].length,
-						PROT_READ | PROT_WRITE, MAP_SHARED,
-						fd, (size_t)bufferout.m.planes[j].m.mem_offset);
+		for (j = 0; j < m2m_dev->o_num_planes; j++) {
+			plane = &m2m_dev->out_buffers[i].planes[j];
+			get_plane(m2m_dev, &bufferout, j, &plane->length,
+				  &plane->offset, &bytesused);
+			plane->start = mmap(NULL, plane->length,
+					    PROT_READ | PROT_WRITE, MAP_SHARED,
+					    fd, plane->offset);
+			if (plane->start == MAP_FAILED) {
+				v4l2_err("out buffer[%d] plane[%d] mmap fail\n", i, j);
+				return -1;
+			}
 
 			v4l2_dbg("out buffer[%d]->planes[%d]:"
 					 "startAddr=0x%p, offset=0x%x, buf_size=%d\n",
 					 i, j,
-					 (unsigned int *)m2m_dev->out_buffers[i].planes[j].start,
-					 (unsigned int)m2m_dev->out_buffers[i].planes[j].offset,
-					 m2m_dev->out_buffers[i].planes[j].length);
+					 (unsigned int *)plane->start,
+					 (unsigned int)plane->offset,
+					 plane->length);
 		}
 	}
 
-	free(planes);
 	return 0;
 }
 
-static int request_in_buffer(struct mxc_m2m_device *m2m_dev)
+static int request_in_buffer(struct mxc_m2m_device *m2m_dev, int count)
 {
 	struct v4l2_requestbuffers bufrequestin;
 	int fd = m2m_dev->fd;
 
 	memset(&bufrequestin, 0, sizeof(bufrequestin));
-	bufrequestin.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	bufrequestin.type = m2m_dev->in_type;
 	bufrequestin.memory = V4L2_MEMORY_MMAP;
-	bufrequestin.count = TEST_BUFFER_NUM_IN;
+	bufrequestin.count = count;
 	if (ioctl(fd, VIDIOC_REQBUFS, &bufrequestin) < 0) {
 		v4l2_err("VIDIOC_REQBUFS IN fail\n");
 		return -1;
 	}
 
+	/* the driver may want more, or give fewer */
+	if (bufrequestin.count < 1 || bufrequestin.count > MAX_BUFFER_NUM) {
+		v4l2_err("IN: got %d buffers\n", bufrequestin.count);
+		return -1;
+	}
+	m2m_dev->in_num_buffers = bufrequestin.count;
 	return 0;
 }
 
@@ -760,7 +972,7 @@ static void free_in_buffer(struct mxc_m2m_device *m2m_dev)
 	/* Free src buffer */
 	memset(&req, 0, sizeof(req));
 	req.count = 0;
-	req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	req.type = m2m_dev->in_type;
 	req.memory = V4L2_MEMORY_MMAP;
 	ret = ioctl(fd, VIDIOC_REQBUFS, &req);
 	if (ret < 0) {
@@ -769,20 +981,25 @@ static void free_in_buffer(struct mxc_m2m_device *m2m_dev)
 	}
 }
 
-static int request_out_buffer(struct mxc_m2m_device *m2m_dev)
+static int request_out_buffer(struct mxc_m2m_device *m2m_dev, int count)
 {
 	struct v4l2_requestbuffers bufrequestout;
 	int fd = m2m_dev->fd;
 
 	memset(&bufrequestout, 0, sizeof(bufrequestout));
-	bufrequestout.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	bufrequestout.type = m2m_dev->out_type;
 	bufrequestout.memory = V4L2_MEMORY_MMAP;
-	bufrequestout.count = TEST_BUFFER_NUM_OUT;
+	bufrequestout.count = count;
 	if (ioctl(fd, VIDIOC_REQBUFS, &bufrequestout) < 0) {
 		v4l2_err("VIDIOC_REQBUFS OUT fail\n");
 		return -1;
 	}
 
+	if (bufrequestout.count < 1 || bufrequestout.count > MAX_BUFFER_NUM) {
+		v4l2_err("OUT: got %d buffers\n", bufrequestout.count);
+		return -1;
+	}
+	m2m_dev->out_num_buffers = bufrequestout.count;
 	return 0;
 }
 
@@ -795,7 +1012,7 @@ static void free_out_buffer(struct mxc_m2m_device *m2m_dev)
 	/* Free out buffer */
 	memset(&req, 0, sizeof(req));
 	req.count = 0;
-	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	req.type = m2m_dev->out_type;
 	req.memory = V4L2_MEMORY_MMAP;
 	ret = ioctl(fd, VIDIOC_REQBUFS, &req);
 	if (ret < 0) {
@@ -804,28 +1021,34 @@ static void free_out_buffer(struct mxc_m2m_device *m2m_dev)
 	}
 }
 
-static int mxc_m2m_request_buffer(struct mxc_m2m_device *m2m_dev)
+/* One input and one output buffer for each job in flight */
+static int mxc_m2m_request_buffer(struct mxc_m2m_device *m2m_dev, int count)
 {
 	int ret;
 
-	ret = request_in_buffer(m2m_dev);
+	ret = request_in_buffer(m2m_dev, count);
 	if (ret < 0)
 		return ret;
 
-	ret = request_out_buffer(m2m_dev);
+	ret = request_out_buffer(m2m_dev, count);
 	if (ret < 0)
 		goto src;
 
 	ret = query_in_buffer(m2m_dev);
-	if (ret < 0)
+	if (ret < 0) {
+		unmap_in_buffer(m2m_dev);
 		goto dst;
+	}
 
 	ret = query_out_buffer(m2m_dev);
 	if (ret < 0) {
+		unmap_out_buffer(m2m_dev);
 		unmap_in_buffer(m2m_dev);
 		goto dst;
 	}
 
+	v4l2_info("%d in and %d out buffers\n", m2m_dev->in_num_buffers,
+		  m2m_dev->out_num_buffers);
 	return 0;
 
 dst:
@@ -835,30 +1058,30 @@ src:
 	return ret;
 }
 
-static int mxc_m2m_queue_in_buffer(int buf_id, struct mxc_m2m_device *m2m_dev)
+/*
+ * seq goes in the timestamp; m2m drivers copy it to the output buffer of
+ * the same job, which is how a result is matched to its submission.
+ */
+static int mxc_m2m_queue_in_buffer(int buf_id, unsigned long seq,
+				   struct mxc_m2m_device *m2m_dev)
 {
 	struct v4l2_buffer buf;
-	struct v4l2_plane *planes;
+	struct v4l2_plane planes[MAX_PLANE_NUM];
 	int fd = m2m_dev->fd;
 	int j;
 
-	planes = malloc(m2m_dev->in_num_planes * sizeof(*planes));
-	if (!planes) {
-		v4l2_err("alloc %d plane fail\n", m2m_dev->in_num_planes);
-		return -ENOMEM;
-	}
-
-	memset(&buf, 0, sizeof(buf));
-	buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-	buf.memory = V4L2_MEMORY_MMAP;
-	buf.m.planes = planes;
-	buf.length = m2m_dev->in_num_planes;
-	buf.index = buf_id;
+	init_buffer(m2m_dev, &buf, planes, m2m_dev->in_type, buf_id);
+	buf.timestamp.tv_sec = seq / 1000000;
+	buf.timestamp.tv_usec = seq % 1000000;
 
-	for (j = 0; j < m2m_dev->in_num_planes; j++) {
-		buf.m.planes[j].length = m2m_dev->in_buffers[buf_id].planes[j].length;
-		buf.m.planes[j].m.mem_offset = m2m_dev->in_buffers[buf_id].planes[j].offset;
-		buf.m.planes[j].bytesused = m2m_dev->in_buffers[buf_id].planes[j].length;
+	if (m2m_dev->mplane) {
+		for (j = 0; j < m2m_dev->in_num_planes; j++) {
+			buf.m.planes[j].length = m2m_dev->in_buffers[buf_id].planes[j].length;
+			buf.m.planes[j].m.mem_offset = m2m_dev->in_buffers[buf_id].planes[j].offset;
+			buf.m.planes[j].bytesused = m2m_dev->in_sizeimage[j];
+		}
+	} else {
+		buf.bytesused = m2m_dev->in_sizeimage[0];
 	}
 
 	if (ioctl(fd, VIDIOC_QBUF, &buf) < 0) {
@@ -866,34 +1089,23 @@ static int mxc_m2m_queue_in_buffer(int buf_id, struct mxc_m2m_device *m2m_dev)
 		return -1;
 	}
 
-	free(planes);
 	return 0;
 }
 
 static int mxc_m2m_queue_out_buffer(int buf_id, struct mxc_m2m_device *m2m_dev)
 {
 	struct v4l2_buffer buf;
-	struct v4l2_plane *planes;
+	struct v4l2_plane planes[MAX_PLANE_NUM];
 	int fd = m2m_dev->fd;
 	int j;
 
-	planes = malloc(m2m_dev->o_num_planes * sizeof(*planes));
-	if (!planes) {
-		v4l2_err("alloc %d plane fail\n", m2m_dev->o_num_planes);
-		return -ENOMEM;
-	}
-
-	memset(&buf, 0, sizeof(buf));
-	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-	buf.memory = V4L2_MEMORY_MMAP;
-	buf.m.planes = planes;
-	buf.length = m2m_dev->o_num_planes;
-	buf.index = buf_id;
+	init_buffer(m2m_dev, &buf, planes, m2m_dev->out_type, buf_id);
 
-	for (j = 0; j < m2m_dev->o_num_planes; j++) {
-		buf.m.planes[j].length = m2m_dev->out_buffers[buf_id].planes[j].length;
-		buf.m.planes[j].m.mem_offset = m2m_dev->out_buffers[buf_id].planes[j].offset;
-		buf.m.planes[j].bytesused = m2m_dev->out_buffers[buf_id].planes[j].length;
+	if (m2m_dev->mplane) {
+		for (j = 0; j < m2m_dev->o_num_planes; j++) {
+			buf.m.planes[j].length = m2m_dev->out_buffers[buf_id].planes[j].length;
+			buf.m.planes[j].m.mem_offset = m2m_dev->out_buffers[buf_id].planes[j].offset;
+		}
 	}
 
 	if (ioctl(fd, VIDIOC_QBUF, &buf) < 0) {
@@ -901,92 +1113,63 @@ static int mxc_m2m_queue_out_buffer(int buf_id, struct mxc_m2m_device *m2m_dev)
 		return -1;
 	}
 
-	free(planes);
 	return 0;
 }
 
+/* Returns -EAGAIN when no buffer is done */
 static int mxc_m2m_dequeue_in_buffer(struct mxc_m2m_device *m2m_dev)
 {
 	struct v4l2_buffer buf;
-	struct v4l2_plane *planes;
+	struct v4l2_plane planes[MAX_PLANE_NUM];
 	int fd = m2m_dev->fd;
 	int ret;
 
-	planes = malloc(m2m_dev->o_num_planes * sizeof(*planes));
-	if (!planes) {
-		v4l2_err("alloc %d plane fail\n", m2m_dev->o_num_planes);
-		return -ENOMEM;
-	}
-
-	memset(&buf, 0, sizeof(buf));
-	buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-	buf.memory = V4L2_MEMORY_MMAP;
-	buf.m.planes = planes;
-	buf.length = m2m_dev->in_num_planes;
+	init_buffer(m2m_dev, &buf, planes, m2m_dev->in_type, 0);
 
 	ret = ioctl(fd, VIDIOC_DQBUF, &buf);
 	if (ret < 0) {
+		if (errno == EAGAIN)
+			return -EAGAIN;
 		v4l2_err("VIDIOC_DQBUF error\n");
-		free(planes);
 		return ret;
 	}
-	m2m_dev->in_frame_num++;
 	m2m_dev->in_cur_buf_id = buf.index;
 
-	free(planes);
 	return 0;
 }
 
 static int mxc_m2m_dequeue_out_buffer(struct mxc_m2m_device *m2m_dev)
 {
 	struct v4l2_buffer buf;
-	struct v4l2_plane *planes;
+	struct v4l2_plane planes[MAX_PLANE_NUM];
+	struct plane_buffer *plane;
+	__u32 length;
+	size_t offset;
 	int fd = m2m_dev->fd;
-	int ret;
-
-	planes = malloc(m2m_dev->o_num_planes * sizeof(*planes));
-	if (!planes) {
-		v4l2_err("alloc %d plane fail\n", m2m_dev->o_num_planes);
-		return -ENOMEM;
-	}
+	int j, ret;
 
-	memset(&buf, 0, sizeof(buf));
-	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-	buf.memory = V4L2_MEMORY_MMAP;
-	buf.m.planes = planes;
-	buf.length = m2m_dev->o_num_planes;
+	init_buffer(m2m_dev, &buf, planes, m2m_dev->out_type, 0);
 
 	ret = ioctl(fd, VIDIOC_DQBUF, &buf);
 	if (ret < 0) {
+		if (errno == EAGAIN)
+			return -EAGAIN;
 		v4l2_err("VIDIOC_DQBUF error\n");
-		free(planes);
 		return ret;
 	}
 	m2m_dev->out_frame_num++;
 	m2m_dev->out_cur_buf_id = buf.index;
+	m2m_dev->out_cur_seq = buf.timestamp.tv_sec * 1000000UL +
+			       buf.timestamp.tv_usec;
 
-	free(planes);
-	return 0;
-}
-
-static int mxc_m2m_queue(struct mxc_m2m_device *m2m_dev)
-{
-	int i, ret;
-
-	for (i = 0; i < TEST_BUFFER_NUM_IN; i++) {
-		ret = mxc_m2m_queue_in_buffer(i, m2m_dev);
-		if (ret < 0)
-			return ret;
-	}
-
-	for (i = 0; i < TEST_BUFFER_NUM_OUT; i++) {
-		ret = mxc_m2m_queue_out_buffer(i, m2m_dev);
-		if (ret < 0)
-			return ret;
+	for (j = 0; j < m2m_dev->o_num_planes; j++) {
+		plane = &m2m_dev->out_buffers[buf.index].planes[j];
+		get_plane(m2m_dev, &buf, j, &length, &offset, &plane->plane_size);
 	}
 
 	return 0;
 }
+
 #if 0
 static int mxc_m2m_dequeue(struct mxc_m2m_device *m2m_dev)
 {
@@ -1008,7 +1191,7 @@ static int mxc_m2m_in_streamon(struct mxc_m2m_device *m2m_dev)
 	enum v4l2_buf_type type;
 	int ret, fd = m2m_dev->fd;
 
-	type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	type = m2m_dev->in_type;
 	ret = ioctl(fd, VIDIOC_STREAMON, &type);
 	if (ret < 0) {
 		v4l2_err("in VIDIOC_STREAMON error\n");
@@ -1024,7 +1207,7 @@ static int mxc_m2m_out_streamon(struct mxc_m2m_device *m2m_dev)
 	enum v4l2_buf_type type;
 	int ret, fd = m2m_dev->fd;
 
-	type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	type = m2m_dev->out_type;
 	ret = ioctl(fd, VIDIOC_STREAMON, &type);
 	if (ret < 0) {
 		v4l2_err("out VIDIOC_STREAMON error\n");
@@ -1056,7 +1239,7 @@ static int mxc_m2m_in_streamoff(struct mxc_m2m_device *m2m_dev)
 	int fd = m2m_dev->fd;
 	int ret;
 
-	type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	type = m2m_dev->in_type;
 	ret = ioctl(fd, VIDIOC_STREAMOFF, &type);
 	if (ret < 0) {
 		v4l2_err("in VIDIOC_STREAMOFF error\n");
@@ -1073,7 +1256,7 @@ static int mxc_m2m_out_streamoff(struct mxc_m2m_device *m2m_dev)
 	int fd = m2m_dev->fd;
 	int ret;
 
-	type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	type = m2m_dev->out_type;
 	ret = ioctl(fd, VIDIOC_STREAMOFF, &type);
 	if (ret < 0) {
 		v4l2_err("out VIDIOC_STREAMOFF error\n");
@@ -1109,47 +1292,182 @@ static void mxc_m2m_free_buffer(struct mxc_m2m_device *m2m_dev)
 	free_out_buffer(m2m_dev);
 }
 
-static int start_convert(struct mxc_m2m_device *m2m_dev)
+static int cmp_latency(const void *a, const void *b)
 {
-	int count = 0, fps;
-	int ret;
-	struct timeval start, end;
+	long long x = *(const long long *)a, y = *(const long long *)b;
 
-	memset(&start, 0, sizeof(start));
-	memset(&end, 0, sizeof(end));
+	return x < y ? -1 : x > y;
+}
 
-	gettimeofday(&start, NULL);
-	do {
-		ret = mxc_m2m_dequeue_out_buffer(m2m_dev);
-		if (ret < 0)
-			return -1;
-		ret = mxc_m2m_dequeue_in_buffer(m2m_dev);
-		if (ret < 0)
-			return -1;
+static double percentile_ms(struct m2m_stats *st, int p)
+{
+	int i = (st->frames * p + 99) / 100 - 1;
+
+	if (i < 0)
+		i = 0;
+	return st->latency[i] / 1000.0;
+}
 
-		if (!g_performance_test) {
-			ret = save_to_file(m2m_dev);
+/*
+ * Keep up to depth jobs queued, refill as the driver hands buffers back.
+ * Input buffers come back on EPOLLOUT, results on EPOLLIN; each is
+ * drained until DQBUF says EAGAIN.  Returns with every buffer dequeued,
+ * so the next run can start from a clean state without STREAMOFF.
+ */
+static int run_depth(struct mxc_m2m_device *m2m_dev, int depth,
+		     struct m2m_stats *st)
+{
+	int free_in[MAX_BUFFER_NUM], free_out[MAX_BUFFER_NUM];
+	int nfree_in = 0, nfree_out = 0;
+	int frames = m2m_dev->frames;
+	int submitted = 0, completed = 0, inflight = 0, oldest = 0;
+	long long *submit_ts, start, now;
+	struct epoll_event ev;
+	unsigned long seq;
+	bool *done;
+	int i, n, ret = 0;
+
+	for (i = m2m_dev->in_num_buffers - 1; i >= 0; i--)
+		free_in[nfree_in++] = i;
+	for (i = m2m_dev->out_num_buffers - 1; i >= 0; i--)
+		free_out[nfree_out++] = i;
+	if (depth > nfree_in)
+		depth = nfree_in;
+	if (depth > nfree_out)
+		depth = nfree_out;
+
+	memset(st, 0, sizeof(*st));
+	st->depth = depth;
+	st->latency = calloc(frames, sizeof(*st->latency));
+	submit_ts = calloc(frames, sizeof(*submit_ts));
+	done = calloc(frames, sizeof(*done));
+	if (!st->latency || !submit_ts || !done) {
+		v4l2_err("alloc statistics for %d frames fail\n", frames);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	start = get_time_us();
+	while (completed < frames) {
+		while (!quitflag && inflight < depth && submitted < frames &&
+		       nfree_in > 0 && nfree_out > 0) {
+			int in = free_in[--nfree_in];
+			int out = free_out[--nfree_out];
+
+			if (!g_performance_test && !g_pattern) {
+				ret = fill_in_buffer(in, m2m_dev);
+				if (ret < 0)
+					goto out;
+			}
+			ret = mxc_m2m_queue_out_buffer(out, m2m_dev);
 			if (ret < 0)
-				return ret;
+				goto out;
+			submit_ts[submitted] = get_time_us();
+			ret = mxc_m2m_queue_in_buffer(in, submitted + 1, m2m_dev);
+			if (ret < 0)
+				goto out;
+			submitted++;
+			inflight++;
+		}
+		if (inflight == 0)
+			break;		/* quit */
+
+		n = epoll_wait(m2m_dev->epoll_fd, &ev, 1, 1000);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			v4l2_err("no buffer back in 1 s, %d jobs in flight\n",
+				 inflight);
+			ret = -ETIMEDOUT;
+			goto out;
 		}
 
-		if (++count < m2m_dev->frames) {
-			if (!g_performance_test)
-				fill_in_buffer(m2m_dev->in_cur_buf_id, m2m_dev);
-			mxc_m2m_queue_out_buffer(m2m_dev->out_cur_buf_id, m2m_dev);
-			mxc_m2m_queue_in_buffer(m2m_dev->in_cur_buf_id, m2m_dev);
+		while ((ret = mxc_m2m_dequeue_in_buffer(m2m_dev)) == 0)
+			free_in[nfree_in++] = m2m_dev->in_cur_buf_id;
+		if (ret != -EAGAIN)
+			goto out;
+
+		while ((ret = mxc_m2m_dequeue_out_buffer(m2m_dev)) == 0) {
+			now = get_time_us();
+			/* without a copied timestamp jobs finish in order */
+			seq = m2m_dev->out_cur_seq;
+			if (seq < 1 || seq > (unsigned long)submitted || done[seq - 1])
+				seq = oldest + 1;
+			done[seq - 1] = true;
+			while (oldest < submitted && done[oldest])
+				oldest++;
+
+			st->latency[completed] = now - submit_ts[seq - 1];
+			st->lat_sum += st->latency[completed];
+			completed++;
+			inflight--;
+
+			if (!g_performance_test && !g_discard) {
+				ret = save_to_file(m2m_dev);
+				if (ret < 0)
+					goto out;
+			}
+			free_out[nfree_out++] = m2m_dev->out_cur_buf_id;
 		}
+		if (ret != -EAGAIN)
+			goto out;
+		ret = 0;
+	}
+	st->usec = get_time_us() - start;
+	st->frames = completed;
+	qsort(st->latency, completed, sizeof(*st->latency), cmp_latency);
+
+out:
+	free(submit_ts);
+	free(done);
+	return ret;
+}
 
-	} while (count < m2m_dev->frames && !quitflag);
+static void print_stats(struct mxc_m2m_device *m2m_dev, struct m2m_stats *st,
+			int nr)
+{
+	double sec;
+	int i;
 
-	gettimeofday(&end, NULL);
+	printf("depth   frames      fps     MB/s   latency ms: mean    p50    p90    p99    max\n");
+	for (i = 0; i < nr; i++, st++) {
+		if (st->frames == 0 || st->usec == 0)
+			continue;
+		sec = st->usec / 1000000.0;
+		printf("%5d %8d %8.1f %8.1f %19.2f %6.2f %6.2f %6.2f %6.2f\n",
+		       st->depth, st->frames, st->frames / sec,
+		       st->frames * (double)m2m_dev->in_frame_size / sec / 1000000,
+		       st->lat_sum / 1000.0 / st->frames, percentile_ms(st, 50),
+		       percentile_ms(st, 90), percentile_ms(st, 99),
+		       st->latency[st->frames - 1] / 1000.0);
+	}
+}
 
-	if (g_performance_test) {
-		fps = get_fps(&start, &end, m2m_dev->frames);
-		printf(">> fps=%d(fps) <<\n", fps);
+static int start_convert(struct mxc_m2m_device *m2m_dev)
+{
+	struct m2m_stats st[MAX_SWEEP_NUM];
+	int depth, nr = 0, i;
+	int ret = 0;
+
+	for (depth = g_sweep ? 1 : g_depth; !quitflag && nr < MAX_SWEEP_NUM;
+	     depth *= 2) {
+		if (depth > g_depth)
+			depth = g_depth;
+		ret = run_depth(m2m_dev, depth, &st[nr++]);
+		if (ret < 0 || depth == g_depth)
+			break;
 	}
 
-	return 0;
+	if (ret == 0 && st[nr - 1].frames > 0) {
+		print_stats(m2m_dev, st, nr);
+		if (g_performance_test)
+			printf(">> fps=%d(fps) <<\n",
+			       (int)(st[nr - 1].frames * 1000000LL / st[nr - 1].usec));
+	}
+
+	for (i = 0; i < nr; i++)
+		free(st[i].latency);
+	return ret;
 }
 
 
@@ -1157,13 +1475,7 @@ int main(int argc, char *argv[])
 {
 	char *soc_list[] = { "i.MX8QM", "i.MX8QXP", " " };
 	struct mxc_m2m_device *m2m_dev;
-	int ret = 0;
-
-	ret = soc_version_check(soc_list);
-	if (ret == 0) {
-		v4l2_err("not supported on current soc\n");
-		return 0;
-	}
+	int i, ret = 0;
 
 	pthread_t sigtid;
 	sigemptyset(&sigset_v);
@@ -1175,7 +1487,15 @@ int main(int argc, char *argv[])
 	if (ret < 0)
 		return ret;
 
-	m2m_dev = malloc(sizeof(*m2m_dev));
+	if (!is_virtual_device()) {
+		ret = soc_version_check(soc_list);
+		if (ret == 0) {
+			v4l2_err("not supported on current soc\n");
+			return 0;
+		}
+	}
+
+	m2m_dev = calloc(1, sizeof(*m2m_dev));
 	if (!m2m_dev) {
 		v4l2_err("alloc memory for m2m device fail\n");
 		return -1;
@@ -1193,7 +1513,7 @@ int main(int argc, char *argv[])
 		goto close;
 
 	if (show_device_cap) {
-		show_device_cap_list(m2m_dev->fd);
+		show_device_cap_list(m2m_dev);
 		goto close;
 	}
 
@@ -1205,24 +1525,30 @@ int main(int argc, char *argv[])
 	if (ret < 0)
 		goto close;
 
-	ret = mxc_m2m_request_buffer(m2m_dev);
+	ret = count_input_frames(m2m_dev);
 	if (ret < 0)
 		goto close;
 
-	fill_in_buffer(0, m2m_dev);
-	ret = mxc_m2m_queue(m2m_dev);
+	ret = mxc_m2m_request_buffer(m2m_dev, g_depth);
 	if (ret < 0)
-		goto free_buf;
+		goto close;
+
+	/* -p and -pattern: every buffer is filled once, here */
+	for (i = 0; i < m2m_dev->in_num_buffers; i++) {
+		if (g_pattern)
+			fill_pattern(i, m2m_dev);
+		else if (g_performance_test)
+			fill_in_buffer(i, m2m_dev);
+	}
 
 	ret = mxc_m2m_streamon(m2m_dev);
 	if (ret < 0)
 		goto free_buf;
 
-	start_convert(m2m_dev);
+	ret = start_convert(m2m_dev);
 
-	ret = mxc_m2m_streamoff(m2m_dev);
-	if (ret < 0)
-		goto free_buf;
+	if (mxc_m2m_streamoff(m2m_dev) < 0 && ret == 0)
+		ret = -1;
 
 free_buf:
 	mxc_m2m_free_buffer(m2m_dev);
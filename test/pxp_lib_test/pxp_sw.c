@@ -0,0 +1,892 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file pxp_sw.c
+ *
+ * @brief PxP operations on the CPU
+ *
+ * Everything between the input and output formats happens on one frame of
+ * 0xAARRGGBB words, the size of the output before rotation.  YUV is BT.601
+ * video range both ways, GREY is full range luma, like the PxP defaults.
+ *
+ * The scaler is separable bilinear with 8 bit weights.  A source line is
+ * filtered horizontally once into 16 bit channels (a * (256 - f) + b * f)
+ * and kept while it is needed; the vertical pass computes
+ * ((h0 * (256 - g)) >> 8) + ((h1 * g) >> 8), rounds and drops 8 bits.
+ * That is what the SSE2 and NEON high-half multiplies give, so the vector
+ * and scalar kernels agree bit for bit.
+ *
+ * 90 and 270 degree rotation walks the output in square tiles so the
+ * source lines a tile reads stay in cache; 0 and 180 are done line by line.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/videodev2.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PXP_SW_SIMD	"sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PXP_SW_SIMD	"neon"
+#endif
+
+#include "pxp_sw.h"
+
+#ifndef V4L2_PIX_FMT_ARGB32
+#define V4L2_PIX_FMT_ARGB32	v4l2_fourcc('B', 'A', '2', '4')
+#endif
+
+#define DEFAULT_TILE	32
+
+enum {
+	LAYOUT_PACKED,		/* bpp bytes a pixel */
+	LAYOUT_YUV422,		/* Y0 U Y1 V in some order */
+	LAYOUT_PLANAR,		/* Y, U and V planes */
+	LAYOUT_SEMI,		/* Y plane, interleaved UV plane */
+};
+
+struct sw_fmt {
+	unsigned int fourcc;
+	int layout;
+	int bpp;		/* bytes a pixel in the first plane */
+	int xsub;		/* chroma subsampling */
+	int ysub;
+	int pos[3];		/* YUV422: Y0, U, V; planar: 1 if U first */
+};
+
+static const struct sw_fmt sw_fmts[] = {
+	{ V4L2_PIX_FMT_RGB565, LAYOUT_PACKED, 2, 1, 1, { 0 } },
+	{ V4L2_PIX_FMT_RGB555, LAYOUT_PACKED, 2, 1, 1, { 0 } },
+	{ V4L2_PIX_FMT_RGB24, LAYOUT_PACKED, 3, 1, 1, { 0 } },
+	{ V4L2_PIX_FMT_BGR24, LAYOUT_PACKED, 3, 1, 1, { 0 } },
+	/* 32 bit words as the PxP takes them: 0x00RRGGBB, 0xAARRGGBB */
+	{ V4L2_PIX_FMT_RGB32, LAYOUT_PACKED, 4, 1, 1, { 0 } },
+	{ V4L2_PIX_FMT_ARGB32, LAYOUT_PACKED, 4, 1, 1, { 0 } },
+	{ V4L2_PIX_FMT_GREY, LAYOUT_PACKED, 1, 1, 1, { 0 } },
+	/* 0x00YYUUVV words */
+	{ V4L2_PIX_FMT_YUV32, LAYOUT_PACKED, 4, 1, 1, { 0 } },
+	{ V4L2_PIX_FMT_UYVY, LAYOUT_YUV422, 2, 2, 1, { 1, 0, 2 } },
+	{ V4L2_PIX_FMT_YUYV, LAYOUT_YUV422, 2, 2, 1, { 0, 1, 3 } },
+	{ V4L2_PIX_FMT_YUV420, LAYOUT_PLANAR, 1, 2, 2, { 0, 1, 2 } },
+	{ V4L2_PIX_FMT_YVU420, LAYOUT_PLANAR, 1, 2, 2, { 0, 2, 1 } },
+	{ V4L2_PIX_FMT_YUV422P, LAYOUT_PLANAR, 1, 2, 1, { 0, 1, 2 } },
+	{ V4L2_PIX_FMT_NV12, LAYOUT_SEMI, 1, 2, 2, { 0 } },
+	{ V4L2_PIX_FMT_NV16, LAYOUT_SEMI, 1, 2, 1, { 0 } },
+};
+
+static int use_simd = 1;
+static int tile_size = DEFAULT_TILE;
+
+const char *pxp_sw_simd(void)
+{
+#ifdef PXP_SW_SIMD
+	return use_simd ? PXP_SW_SIMD : NULL;
+#else
+	return NULL;
+#endif
+}
+
+void pxp_sw_set_simd(int enable)
+{
+	use_simd = enable;
+}
+
+void pxp_sw_set_tile(int size)
+{
+	tile_size = size < 0 ? DEFAULT_TILE : size;
+}
+
+static const struct sw_fmt *find_fmt(unsigned int fourcc)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(sw_fmts) / sizeof(sw_fmts[0]); i++)
+		if (sw_fmts[i].fourcc == fourcc)
+			return &sw_fmts[i];
+	return NULL;
+}
+
+int pxp_sw_format_ok(unsigned int fourcc)
+{
+	return find_fmt(fourcc) != NULL;
+}
+
+/*
+ * Plane geometry
+ */
+
+struct planes {
+	unsigned char *p[3];
+	int stride[3];
+};
+
+static void get_planes(const struct pxp_sw_image *im, const struct sw_fmt *f,
+		       struct planes *pl)
+{
+	unsigned char *c1, *c2;
+
+	pl->stride[0] = im->stride ? im->stride : im->width * f->bpp;
+	pl->p[0] = im->buf;
+	pl->p[1] = pl->p[2] = NULL;
+	pl->stride[1] = pl->stride[2] = 0;
+	c1 = im->buf + pl->stride[0] * im->height;
+	if (f->layout == LAYOUT_PLANAR) {
+		pl->stride[1] = pl->stride[2] = pl->stride[0] / f->xsub;
+		c2 = c1 + pl->stride[1] * (im->height / f->ysub);
+		/* p[1] is U, p[2] is V */
+		pl->p[1] = f->pos[1] == 1 ? c1 : c2;
+		pl->p[2] = f->pos[1] == 1 ? c2 : c1;
+	} else if (f->layout == LAYOUT_SEMI) {
+		pl->stride[1] = pl->stride[0];
+		pl->p[1] = c1;
+	}
+}
+
+int pxp_sw_frame_size(unsigned int fourcc, int width, int height)
+{
+	const struct sw_fmt *f = find_fmt(fourcc);
+	int size;
+
+	if (!f)
+		return 0;
+	size = width * height * f->bpp;
+	if (f->layout == LAYOUT_PLANAR)
+		size += 2 * (width / f->xsub) * (height / f->ysub);
+	else if (f->layout == LAYOUT_SEMI)
+		size += width * (height / f->ysub);
+	return size;
+}
+
+/*
+ * Colour
+ */
+
+static inline int clip(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline unsigned int yuv_to_argb(int y, int u, int v)
+{
+	int c = 298 * (y - 16), d = u - 128, e = v - 128;
+
+	return 0xff000000 |
+	       clip((c + 409 * e + 128) >> 8) << 16 |
+	       clip((c - 100 * d - 208 * e + 128) >> 8) << 8 |
+	       clip((c + 516 * d + 128) >> 8);
+}
+
+static inline int rgb_to_y(unsigned int p)
+{
+	int r = p >> 16 & 0xff, g = p >> 8 & 0xff, b = p & 0xff;
+
+	return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline int rgb_to_u(unsigned int p)
+{
+	int r = p >> 16 & 0xff, g = p >> 8 & 0xff, b = p & 0xff;
+
+	return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline int rgb_to_v(unsigned int p)
+{
+	int r = p >> 16 & 0xff, g = p >> 8 & 0xff, b = p & 0xff;
+
+	return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+static inline int rgb_to_grey(unsigned int p)
+{
+	return (77 * (p >> 16 & 0xff) + 150 * (p >> 8 & 0xff) +
+		29 * (p & 0xff) + 128) >> 8;
+}
+
+/* x * a / 255 rounded, exact for x <= 255 * 255 */
+static inline int div255(int x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+/*
+ * Line conversion to and from 0xAARRGGBB
+ */
+
+static void unpack_line(const struct pxp_sw_image *im, const struct sw_fmt *f,
+			int x0, int y, int n, unsigned int *dst)
+{
+	struct planes pl;
+	const unsigned char *s, *u, *v;
+	unsigned int w;
+	int x, i;
+
+	get_planes(im, f, &pl);
+	s = pl.p[0] + y * pl.stride[0];
+
+	switch (f->layout) {
+	case LAYOUT_YUV422:
+		for (i = 0; i < n; i++) {
+			x = x0 + i;
+			u = s + (x & ~1) * 2;
+			dst[i] = yuv_to_argb(u[f->pos[0] + (x & 1) * 2],
+					     u[f->pos[1]], u[f->pos[2]]);
+		}
+		return;
+	case LAYOUT_PLANAR:
+		u = pl.p[1] + (y / f->ysub) * pl.stride[1];
+		v = pl.p[2] + (y / f->ysub) * pl.stride[2];
+		for (i = 0; i < n; i++) {
+			x = x0 + i;
+			dst[i] = yuv_to_argb(s[x], u[x / 2], v[x / 2]);
+		}
+		return;
+	case LAYOUT_SEMI:
+		u = pl.p[1] + (y / f->ysub) * pl.stride[1];
+		for (i = 0; i < n; i++) {
+			x = x0 + i;
+			dst[i] = yuv_to_argb(s[x], u[x & ~1], u[x | 1]);
+		}
+		return;
+	}
+
+	s += x0 * f->bpp;
+	switch (f->fourcc) {
+	case V4L2_PIX_FMT_RGB565:
+		for (i = 0; i < n; i++, s += 2) {
+			w = s[0] | s[1] << 8;
+			dst[i] = 0xff000000 |
+				 ((w >> 11) * 527 + 23) >> 6 << 16 |
+				 ((w >> 5 & 0x3f) * 259 + 33) >> 6 << 8 |
+				 ((w & 0x1f) * 527 + 23) >> 6;
+		}
+		break;
+	case V4L2_PIX_FMT_RGB555:
+		for (i = 0; i < n; i++, s += 2) {
+			w = s[0] | s[1] << 8;
+			dst[i] = 0xff000000 |
+				 ((w >> 10 & 0x1f) * 527 + 23) >> 6 << 16 |
+				 ((w >> 5 & 0x1f) * 527 + 23) >> 6 << 8 |
+				 ((w & 0x1f) * 527 + 23) >> 6;
+		}
+		break;
+	case V4L2_PIX_FMT_RGB24:
+		for (i = 0; i < n; i++, s += 3)
+			dst[i] = 0xff000000 | s[0] << 16 | s[1] << 8 | s[2];
+		break;
+	case V4L2_PIX_FMT_BGR24:
+		for (i = 0; i < n; i++, s += 3)
+			dst[i] = 0xff000000 | s[2] << 16 | s[1] << 8 | s[0];
+		break;
+	case V4L2_PIX_FMT_RGB32:
+		for (i = 0; i < n; i++, s += 4)
+			dst[i] = 0xff000000 | s[2] << 16 | s[1] << 8 | s[0];
+		break;
+	case V4L2_PIX_FMT_ARGB32:
+		for (i = 0; i < n; i++, s += 4)
+			dst[i] = (unsigned int)s[3] << 24 | s[2] << 16 |
+				 s[1] << 8 | s[0];
+		break;
+	case V4L2_PIX_FMT_GREY:
+		for (i = 0; i < n; i++)
+			dst[i] = 0xff000000 | s[i] * 0x010101;
+		break;
+	case V4L2_PIX_FMT_YUV32:
+		for (i = 0; i < n; i++, s += 4)
+			dst[i] = yuv_to_argb(s[2], s[1], s[0]);
+		break;
+	}
+}
+
+/* A whole line; chroma of 4:2:0 formats comes from the even lines */
+static void pack_line(const struct pxp_sw_image *im, const struct sw_fmt *f,
+		      int y, const unsigned int *src)
+{
+	struct planes pl;
+	unsigned char *d, *u, *v;
+	unsigned int p;
+	int n = im->width, x;
+
+	get_planes(im, f, &pl);
+	d = pl.p[0] + y * pl.stride[0];
+
+	switch (f->layout) {
+	case LAYOUT_YUV422:
+		for (x = 0; x < n; x += 2, d += 4) {
+			d[f->pos[0]] = rgb_to_y(src[x]);
+			d[f->pos[0] + 2] = rgb_to_y(src[x + 1]);
+			d[f->pos[1]] = (rgb_to_u(src[x]) +
+					rgb_to_u(src[x + 1]) + 1) >> 1;
+			d[f->pos[2]] = (rgb_to_v(src[x]) +
+					rgb_to_v(src[x + 1]) + 1) >> 1;
+		}
+		return;
+	case LAYOUT_PLANAR:
+	case LAYOUT_SEMI:
+		for (x = 0; x < n; x++)
+			d[x] = rgb_to_y(src[x]);
+		if (y % f->ysub)
+			return;
+		u = pl.p[1] + (y / f->ysub) * pl.stride[1];
+		v = f->layout == LAYOUT_PLANAR ?
+		    pl.p[2] + (y / f->ysub) * pl.stride[2] : NULL;
+		for (x = 0; x < n; x += 2) {
+			int cu = (rgb_to_u(src[x]) + rgb_to_u(src[x + 1]) + 1) >> 1;
+			int cv = (rgb_to_v(src[x]) + rgb_to_v(src[x + 1]) + 1) >> 1;
+
+			if (f->layout == LAYOUT_SEMI) {
+				u[x] = cu;
+				u[x + 1] = cv;
+			} else {
+				u[x / 2] = cu;
+				v[x / 2] = cv;
+			}
+		}
+		return;
+	}
+
+	switch (f->fourcc) {
+	case V4L2_PIX_FMT_RGB565:
+		for (x = 0; x < n; x++, d += 2) {
+			p = src[x];
+			p = (p >> 8 & 0xf800) | (p >> 5 & 0x07e0) | (p >> 3 & 0x1f);
+			d[0] = p;
+			d[1] = p >> 8;
+		}
+		break;
+	case V4L2_PIX_FMT_RGB555:
+		for (x = 0; x < n; x++, d += 2) {
+			p = src[x];
+			p = (p >> 9 & 0x7c00) | (p >> 6 & 0x03e0) | (p >> 3 & 0x1f);
+			d[0] = p;
+			d[1] = p >> 8;
+		}
+		break;
+	case V4L2_PIX_FMT_RGB24:
+		for (x = 0; x < n; x++, d += 3) {
+			d[0] = src[x] >> 16;
+			d[1] = src[x] >> 8;
+			d[2] = src[x];
+		}
+		break;
+	case V4L2_PIX_FMT_BGR24:
+		for (x = 0; x < n; x++, d += 3) {
+			d[0] = src[x];
+			d[1] = src[x] >> 8;
+			d[2] = src[x] >> 16;
+		}
+		break;
+	case V4L2_PIX_FMT_RGB32:
+	case V4L2_PIX_FMT_ARGB32:
+		for (x = 0; x < n; x++, d += 4) {
+			d[0] = src[x];
+			d[1] = src[x] >> 8;
+			d[2] = src[x] >> 16;
+			d[3] = f->fourcc == V4L2_PIX_FMT_RGB32 ? 0 : src[x] >> 24;
+		}
+		break;
+	case V4L2_PIX_FMT_GREY:
+		for (x = 0; x < n; x++)
+			d[x] = rgb_to_grey(src[x]);
+		break;
+	case V4L2_PIX_FMT_YUV32:
+		for (x = 0; x < n; x++, d += 4) {
+			d[0] = rgb_to_v(src[x]);
+			d[1] = rgb_to_u(src[x]);
+			d[2] = rgb_to_y(src[x]);
+			d[3] = 0;
+		}
+		break;
+	}
+}
+
+/*
+ * Bilinear scaler
+ */
+
+struct scaler {
+	int sw, dw;
+	int *x0;		/* per output column: left source pixel */
+	unsigned char *fx;	/* and the weight of the right one */
+	unsigned int *line;	/* unpacked source line */
+	unsigned short *h[2];	/* filtered source lines, by row parity */
+	int hy[2];
+};
+
+/* Source position of output pixel centre i, in 1/256 */
+static void scale_pos(int i, int sn, int dn, int *p0, int *f)
+{
+	long long pos = ((2LL * i + 1) * sn * 256) / (2 * dn) - 128;
+
+	if (pos < 0)
+		pos = 0;
+	*p0 = pos >> 8;
+	*f = pos & 0xff;
+	if (*p0 >= sn - 1) {
+		*p0 = sn - 1;
+		*f = 0;
+	}
+}
+
+static void scaler_free(struct scaler *sc)
+{
+	free(sc->x0);
+	free(sc->fx);
+	free(sc->line);
+	free(sc->h[0]);
+	free(sc->h[1]);
+}
+
+static int scaler_init(struct scaler *sc, int sw, int dw)
+{
+	int i, f;
+
+	memset(sc, 0, sizeof(*sc));
+	sc->sw = sw;
+	sc->dw = dw;
+	sc->x0 = malloc(dw * sizeof(int));
+	sc->fx = malloc(dw);
+	sc->line = malloc(sw * sizeof(unsigned int));
+	/* room for the vector loop to read whole registers */
+	sc->h[0] = malloc((dw * 4 + 8) * sizeof(unsigned short));
+	sc->h[1] = malloc((dw * 4 + 8) * sizeof(unsigned short));
+	if (!sc->x0 || !sc->fx || !sc->line || !sc->h[0] || !sc->h[1]) {
+		scaler_free(sc);
+		return -ENOMEM;
+	}
+	for (i = 0; i < dw; i++) {
+		scale_pos(i, sw, dw, &sc->x0[i], &f);
+		sc->fx[i] = f;
+	}
+	sc->hy[0] = sc->hy[1] = -1;
+	return 0;
+}
+
+static void hfilter(const struct scaler *sc, unsigned short *h)
+{
+	const unsigned int *s = sc->line;
+	unsigned int a, b;
+	int i, c, f;
+
+	for (i = 0; i < sc->dw; i++, h += 4) {
+		f = sc->fx[i];
+		a = s[sc->x0[i]];
+		b = f ? s[sc->x0[i] + 1] : a;
+		for (c = 0; c < 4; c++)
+			h[c] = (a >> (c * 8) & 0xff) * (256 - f) +
+			       (b >> (c * 8) & 0xff) * f;
+	}
+}
+
+static void vfilter_c(const unsigned short *h0, const unsigned short *h1,
+		      int g, unsigned char *d, int i, int n)
+{
+	unsigned int t;
+
+	for (; i < n; i++) {
+		t = ((h0[i] * (256 - g)) >> 8) + ((h1[i] * g) >> 8);
+		d[i] = (t + 128) >> 8;
+	}
+}
+
+#ifdef PXP_SW_SIMD
+/* Channels done, a multiple of 8 */
+static int vfilter_simd(const unsigned short *h0, const unsigned short *h1,
+			int g, unsigned char *d, int n)
+{
+	int i;
+#if defined(__SSE2__)
+	__m128i w0 = _mm_set1_epi16((short)((256 - g) << 8));
+	__m128i w1 = _mm_set1_epi16((short)(g << 8));
+	__m128i r = _mm_set1_epi16(128);
+	__m128i a, b, t;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = _mm_loadu_si128((const __m128i *)(h0 + i));
+		if (g) {
+			b = _mm_loadu_si128((const __m128i *)(h1 + i));
+			t = _mm_add_epi16(_mm_mulhi_epu16(a, w0),
+					  _mm_mulhi_epu16(b, w1));
+		} else {
+			t = a;
+		}
+		t = _mm_srli_epi16(_mm_add_epi16(t, r), 8);
+		_mm_storel_epi64((__m128i *)(d + i), _mm_packus_epi16(t, t));
+	}
+#else
+	uint16x4_t w0 = vdup_n_u16(256 - g), w1 = vdup_n_u16(g);
+	uint16x8_t a, b, t;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = vld1q_u16(h0 + i);
+		b = vld1q_u16(h1 + i);
+		t = vcombine_u16(
+			vshrn_n_u32(vmull_u16(vget_low_u16(a), w0), 8),
+			vshrn_n_u32(vmull_u16(vget_high_u16(a), w0), 8));
+		t = vaddq_u16(t, vcombine_u16(
+			vshrn_n_u32(vmull_u16(vget_low_u16(b), w1), 8),
+			vshrn_n_u32(vmull_u16(vget_high_u16(b), w1), 8)));
+		vst1_u8(d + i, vmovn_u16(vrshrq_n_u16(t, 8)));
+	}
+#endif
+	return i;
+}
+#endif
+
+static void vfilter(const unsigned short *h0, const unsigned short *h1,
+		    int g, unsigned int *dst, int pixels)
+{
+	unsigned char *d = (unsigned char *)dst;
+	int i = 0, n = pixels * 4;
+
+#ifdef PXP_SW_SIMD
+	if (use_simd)
+		i = vfilter_simd(h0, h1, g, d, n);
+#endif
+	vfilter_c(h0, h1, g, d, i, n);
+}
+
+/* Source line y of the crop, filtered */
+static unsigned short *scaler_line(struct scaler *sc,
+				   const struct pxp_sw_image *im,
+				   const struct sw_fmt *f,
+				   const struct pxp_sw_rect *sr, int y)
+{
+	int slot = y & 1;
+
+	if (sc->hy[slot] != y) {
+		unpack_line(im, f, sr->left, sr->top + y, sr->width, sc->line);
+		hfilter(sc, sc->h[slot]);
+		sc->hy[slot] = y;
+	}
+	return sc->h[slot];
+}
+
+/*
+ * Pipeline stages
+ */
+
+struct job {
+	const struct pxp_sw_task *t;
+	const struct sw_fmt *s0_fmt;
+	const struct sw_fmt *ol_fmt;
+	const struct sw_fmt *out_fmt;
+	struct pxp_sw_rect sr;
+	struct pxp_sw_rect dr;
+	int lw, lh;		/* the frame before rotation */
+	unsigned int *frame;
+	unsigned int *line;	/* scratch line, the widest needed */
+};
+
+static int prepare(const struct pxp_sw_task *t, struct job *j)
+{
+	const struct pxp_sw_image *ims[3] = { &t->s0, &t->out, &t->ol };
+	const struct sw_fmt *f;
+	int i;
+
+	memset(j, 0, sizeof(*j));
+	j->t = t;
+	for (i = 0; i < (t->ol_enable ? 3 : 2); i++) {
+		f = find_fmt(ims[i]->fourcc);
+		if (!f || !ims[i]->buf || ims[i]->width <= 0 ||
+		    ims[i]->height <= 0)
+			return -EINVAL;
+		/* chroma is shared by pixel pairs */
+		if (ims[i]->width % f->xsub || ims[i]->height % f->ysub)
+			return -EINVAL;
+		if (ims[i]->stride && ims[i]->stride < ims[i]->width * f->bpp)
+			return -EINVAL;
+		if (i == 0)
+			j->s0_fmt = f;
+		else if (i == 1)
+			j->out_fmt = f;
+		else
+			j->ol_fmt = f;
+	}
+	if (t->rotate != 0 && t->rotate != 90 && t->rotate != 180 &&
+	    t->rotate != 270)
+		return -EINVAL;
+	if (t->ol_enable && (t->alpha_mode < PXP_SW_ALPHA_EMBEDDED ||
+			     t->alpha_mode > PXP_SW_ALPHA_MULTIPLY ||
+			     t->global_alpha < 0 || t->global_alpha > 255))
+		return -EINVAL;
+
+	if (t->rotate % 180) {
+		j->lw = t->out.height;
+		j->lh = t->out.width;
+	} else {
+		j->lw = t->out.width;
+		j->lh = t->out.height;
+	}
+
+	j->sr = t->srect;
+	if (!j->sr.width || !j->sr.height) {
+		j->sr.left = j->sr.top = 0;
+		j->sr.width = t->s0.width;
+		j->sr.height = t->s0.height;
+	}
+	j->dr = t->drect;
+	if (!j->dr.width || !j->dr.height) {
+		j->dr.left = j->dr.top = 0;
+		j->dr.width = j->lw;
+		j->dr.height = j->lh;
+	}
+	if (j->sr.left < 0 || j->sr.top < 0 || j->sr.width <= 0 ||
+	    j->sr.height <= 0 || j->sr.left + j->sr.width > t->s0.width ||
+	    j->sr.top + j->sr.height > t->s0.height)
+		return -EINVAL;
+	/* crops of subsampled formats start on a chroma sample */
+	if (j->sr.left % j->s0_fmt->xsub)
+		return -EINVAL;
+	if (j->dr.left < 0 || j->dr.top < 0 || j->dr.width <= 0 ||
+	    j->dr.height <= 0 || j->dr.left + j->dr.width > j->lw ||
+	    j->dr.top + j->dr.height > j->lh)
+		return -EINVAL;
+	return 0;
+}
+
+int pxp_sw_check(const struct pxp_sw_task *t)
+{
+	struct job j;
+
+	return prepare(t, &j);
+}
+
+static int draw_s0(struct job *j)
+{
+	const struct pxp_sw_task *t = j->t;
+	struct scaler sc;
+	unsigned short *h0, *h1;
+	unsigned int *d, bg = 0xff000000 | t->bgcolor;
+	int x, y, y0, g, ret;
+
+	if (j->dr.width != j->lw || j->dr.height != j->lh)
+		for (x = 0; x < j->lw * j->lh; x++)
+			j->frame[x] = bg;
+
+	if (j->sr.width == j->dr.width && j->sr.height == j->dr.height) {
+		for (y = 0; y < j->dr.height; y++)
+			unpack_line(&t->s0, j->s0_fmt, j->sr.left,
+				    j->sr.top + y, j->sr.width,
+				    j->frame + (j->dr.top + y) * j->lw +
+				    j->dr.left);
+	} else {
+		ret = scaler_init(&sc, j->sr.width, j->dr.width);
+		if (ret < 0)
+			return ret;
+		for (y = 0; y < j->dr.height; y++) {
+			scale_pos(y, j->sr.height, j->dr.height, &y0, &g);
+			h0 = scaler_line(&sc, &t->s0, j->s0_fmt, &j->sr, y0);
+			h1 = g ? scaler_line(&sc, &t->s0, j->s0_fmt, &j->sr,
+					     y0 + 1) : h0;
+			vfilter(h0, h1, g, j->frame + (j->dr.top + y) * j->lw +
+				j->dr.left, j->dr.width);
+		}
+		scaler_free(&sc);
+	}
+
+	if (!t->s0_colorkey_enable)
+		return 0;
+	for (y = 0; y < j->dr.height; y++) {
+		d = j->frame + (j->dr.top + y) * j->lw + j->dr.left;
+		for (x = 0; x < j->dr.width; x++)
+			if ((d[x] & 0xffffff) == (t->s0_colorkey & 0xffffff))
+				d[x] = bg;
+	}
+	return 0;
+}
+
+static void draw_ol(struct job *j)
+{
+	const struct pxp_sw_task *t = j->t;
+	unsigned int *d, s, *line = j->line;
+	int x0, x1, y, i, a, c, v;
+
+	x0 = t->ol_left < 0 ? -t->ol_left : 0;
+	x1 = t->ol.width;
+	if (t->ol_left + x1 > j->lw)
+		x1 = j->lw - t->ol_left;
+	if (x1 <= x0)
+		return;
+
+	for (y = 0; y < t->ol.height; y++) {
+		if (t->ol_top + y < 0 || t->ol_top + y >= j->lh)
+			continue;
+		unpack_line(&t->ol, j->ol_fmt, x0, y, x1 - x0, line);
+		d = j->frame + (t->ol_top + y) * j->lw + t->ol_left + x0;
+		for (i = 0; i < x1 - x0; i++) {
+			s = line[i];
+			if (t->ol_colorkey_enable &&
+			    (s & 0xffffff) == (t->ol_colorkey & 0xffffff))
+				continue;
+			a = s >> 24;
+			if (t->alpha_mode == PXP_SW_ALPHA_OVERRIDE)
+				a = t->global_alpha;
+			else if (t->alpha_mode == PXP_SW_ALPHA_MULTIPLY)
+				a = div255(a * t->global_alpha);
+			v = 0xff000000;
+			for (c = 0; c < 24; c += 8)
+				v |= div255((s >> c & 0xff) * a +
+					    (d[i] >> c & 0xff) * (255 - a)) << c;
+			d[i] = v;
+		}
+	}
+}
+
+/* 90 and 270: out (x, y) comes from frame (lx(y), ly(x)) */
+static int rotate_frame(struct job *j, unsigned int *r)
+{
+	const struct pxp_sw_task *t = j->t;
+	int ow = j->lh, oh = j->lw;
+	int xrev = (t->rotate == 270) ^ !!t->hflip;
+	int yrev = (t->rotate == 90) ^ !!t->vflip;
+	int tile = tile_size ? tile_size : ow > oh ? ow : oh;
+	const unsigned int **rows;
+	unsigned int *d;
+	int tx, ty, x, y, xe, ye, lx;
+
+	rows = malloc(ow * sizeof(*rows));
+	if (!rows)
+		return -ENOMEM;
+	for (x = 0; x < ow; x++)
+		rows[x] = j->frame + (yrev ? j->lh - 1 - x : x) * j->lw;
+
+	for (ty = 0; ty < oh; ty += tile) {
+		ye = ty + tile < oh ? ty + tile : oh;
+		for (tx = 0; tx < ow; tx += tile) {
+			xe = tx + tile < ow ? tx + tile : ow;
+			for (y = ty; y < ye; y++) {
+				lx = xrev ? j->lw - 1 - y : y;
+				d = r + y * ow;
+				for (x = tx; x < xe; x++)
+					d[x] = rows[x][lx];
+			}
+		}
+	}
+	free(rows);
+	return 0;
+}
+
+static int write_out(struct job *j)
+{
+	const struct pxp_sw_task *t = j->t;
+	int hrev = !!t->hflip ^ (t->rotate == 180);
+	int vrev = !!t->vflip ^ (t->rotate == 180);
+	const unsigned int *s;
+	unsigned int *r;
+	int x, y, ret;
+
+	if (t->rotate % 180) {
+		r = malloc(t->out.width * t->out.height * sizeof(*r));
+		if (!r)
+			return -ENOMEM;
+		ret = rotate_frame(j, r);
+		if (ret == 0)
+			for (y = 0; y < t->out.height; y++)
+				pack_line(&t->out, j->out_fmt, y,
+					  r + y * t->out.width);
+		free(r);
+		return ret;
+	}
+
+	for (y = 0; y < j->lh; y++) {
+		s = j->frame + (vrev ? j->lh - 1 - y : y) * j->lw;
+		if (hrev) {
+			for (x = 0; x < j->lw; x++)
+				j->line[x] = s[j->lw - 1 - x];
+			s = j->line;
+		}
+		pack_line(&t->out, j->out_fmt, y, s);
+	}
+	return 0;
+}
+
+int pxp_sw_run(const struct pxp_sw_task *t)
+{
+	struct job j;
+	int ret, n;
+
+	ret = prepare(t, &j);
+	if (ret < 0)
+		return ret;
+
+	n = j.lw;
+	if (t->ol_enable && t->ol.width > n)
+		n = t->ol.width;
+	j.frame = malloc(j.lw * j.lh * sizeof(*j.frame));
+	j.line = malloc(n * sizeof(*j.line));
+	if (!j.frame || !j.line) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = draw_s0(&j);
+	if (ret < 0)
+		goto out;
+	if (t->ol_enable)
+		draw_ol(&j);
+	ret = write_out(&j);
+out:
+	free(j.line);
+	free(j.frame);
+	return ret;
+}
+
+int pxp_sw_compare(const struct pxp_sw_image *a, const struct pxp_sw_image *b,
+		   int tol, int *max_diff)
+{
+	const struct sw_fmt *fa = find_fmt(a->fourcc);
+	const struct sw_fmt *fb = find_fmt(b->fourcc);
+	unsigned int *la, *lb;
+	int x, y, c, d, bad = 0;
+
+	*max_diff = 0;
+	if (!fa || !fb || a->width != b->width || a->height != b->height)
+		return -EINVAL;
+	la = malloc(a->width * sizeof(*la));
+	lb = malloc(a->width * sizeof(*lb));
+	if (!la || !lb) {
+		free(la);
+		free(lb);
+		return -ENOMEM;
+	}
+
+	for (y = 0; y < a->height; y++) {
+		unpack_line(a, fa, 0, y, a->width, la);
+		unpack_line(b, fb, 0, y, b->width, lb);
+		for (x = 0; x < a->width; x++) {
+			for (c = 0, d = 0; c < 24; c += 8) {
+				int e = (int)(la[x] >> c & 0xff) -
+					(int)(lb[x] >> c & 0xff);
+
+				if (e < 0)
+					e = -e;
+				if (e > d)
+					d = e;
+			}
+			if (d > *max_diff)
+				*max_diff = d;
+			bad += d > tol;
+		}
+	}
+	free(la);
+	free(lb);
+	return bad;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file pxp_sw.h
+ *
+ * @brief PxP operations on the CPU
+ *
+ * A reference for what pxp_test and pxp_v4l2_test ask of the PxP, and a
+ * fallback on parts without one.  One task runs the PxP pipeline: the S0
+ * (PS) crop is converted to RGB, scaled bilinearly into its place in the
+ * output, colour keyed against the background colour, the overlay (AS) is
+ * blended on top, and the result is flipped, rotated and converted to the
+ * output format.  Formats are V4L2 fourccs (the PXP_PIX_FMT_* values).
+ */
+
+#ifndef PXP_SW_H
+#define PXP_SW_H
+
+struct pxp_sw_rect {
+	int left;
+	int top;
+	int width;
+	int height;
+};
+
+struct pxp_sw_image {
+	unsigned int fourcc;
+	int width;
+	int height;
+	/* bytes per line of the first plane, 0 for packed lines */
+	int stride;
+	/* planes follow each other, chroma lines are half or all of stride */
+	unsigned char *buf;
+};
+
+enum pxp_sw_alpha_mode {
+	PXP_SW_ALPHA_EMBEDDED = 0,	/* the overlay's own alpha */
+	PXP_SW_ALPHA_OVERRIDE = 1,	/* global alpha */
+	PXP_SW_ALPHA_MULTIPLY = 2,	/* own alpha times global alpha */
+};
+
+struct pxp_sw_task {
+	struct pxp_sw_image s0;
+	struct pxp_sw_rect srect;	/* S0 crop, width 0 for all of it */
+	/*
+	 * Where the crop lands in the output before rotation, width 0 for
+	 * all of it; a different size scales it.
+	 */
+	struct pxp_sw_rect drect;
+	unsigned int bgcolor;		/* 0xRRGGBB around drect */
+	int s0_colorkey_enable;		/* S0 pixels equal to the key */
+	unsigned int s0_colorkey;	/* show the background, 0xRRGGBB */
+
+	int ol_enable;
+	struct pxp_sw_image ol;
+	int ol_left;			/* placement, before rotation */
+	int ol_top;
+	int alpha_mode;
+	int global_alpha;
+	int ol_colorkey_enable;		/* overlay pixels equal to the key */
+	unsigned int ol_colorkey;	/* are transparent, 0xRRGGBB */
+
+	int rotate;			/* 0, 90, 180 or 270 clockwise */
+	int hflip;			/* before rotation */
+	int vflip;
+	struct pxp_sw_image out;	/* width x height after rotation */
+};
+
+/* Bytes of a width x height frame with packed lines, 0 if unknown */
+int pxp_sw_frame_size(unsigned int fourcc, int width, int height);
+/* Whether the format is supported */
+int pxp_sw_format_ok(unsigned int fourcc);
+
+/* 0 if the task can run, otherwise a negative errno value */
+int pxp_sw_check(const struct pxp_sw_task *t);
+int pxp_sw_run(const struct pxp_sw_task *t);
+
+/*
+ * Compare two images of the same size in RGB, so packed and subsampled
+ * formats compare by colour.  Returns the number of pixels with a channel
+ * more than tol apart, or a negative errno value; *max_diff gets the
+ * largest channel difference.
+ */
+int pxp_sw_compare(const struct pxp_sw_image *a, const struct pxp_sw_image *b,
+		   int tol, int *max_diff);
+
+/* Name of the vector unit used by the scaler, NULL if none */
+const char *pxp_sw_simd(void);
+/* Force the scalar scaler (0) or allow the vector one (1) */
+void pxp_sw_set_simd(int enable);
+/* Rotation tile edge in pixels, 0 to rotate line by line */
+void pxp_sw_set_tile(int size);
+
+#endif
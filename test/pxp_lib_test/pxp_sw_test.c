@@ -0,0 +1,550 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * @file pxp_sw_test.c
+ *
+ * @brief Software PxP benchmark and reference
+ *
+ * Without -i, times each PxP operation on a generated picture, once with
+ * the scalar scaler and line by line rotation and once with the vector
+ * scaler and tiled rotation, and checks the two agree bit for bit.  With
+ * -i, runs one PxP task on a raw image, as pxp_test or pxp_v4l2_test would
+ * set it up, and can write the result or compare it with what the PxP
+ * produced.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <linux/videodev2.h>
+
+#include "pxp_sw.h"
+
+#define TFAIL -1
+#define TPASS 0
+
+#ifndef V4L2_PIX_FMT_ARGB32
+#define V4L2_PIX_FMT_ARGB32	v4l2_fourcc('B', 'A', '2', '4')
+#endif
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+enum {
+	OP_CSC_OUT,
+	OP_CSC_IN,
+	OP_SCALE_DOWN,
+	OP_SCALE_UP,
+	OP_ROT90,
+	OP_ROT270_FLIP,
+	OP_ROT180,
+	OP_BLEND,
+	OP_COLORKEY,
+};
+
+static const struct {
+	int op;
+	const char *name;
+} bench_ops[] = {
+	{ OP_CSC_OUT, "csc RGB565->UYVY" },
+	{ OP_CSC_IN, "csc I420->RGB565" },
+	{ OP_SCALE_DOWN, "scale 3/4 RGB565" },
+	{ OP_SCALE_UP, "scale 3/2 RGB565" },
+	{ OP_ROT90, "rotate 90 RGB32" },
+	{ OP_ROT270_FLIP, "rotate 270 hflip" },
+	{ OP_ROT180, "rotate 180 RGB565" },
+	{ OP_BLEND, "overlay ARGB32" },
+	{ OP_COLORKEY, "colour key S0" },
+};
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static unsigned int to_fourcc(const char *s)
+{
+	if (strlen(s) != 4)
+		return 0;
+	return v4l2_fourcc(s[0], s[1], s[2], s[3]);
+}
+
+static int alloc_image(struct pxp_sw_image *im, unsigned int fourcc,
+		       int width, int height)
+{
+	int size = pxp_sw_frame_size(fourcc, width, height);
+
+	memset(im, 0, sizeof(*im));
+	im->fourcc = fourcc;
+	im->width = width;
+	im->height = height;
+	im->buf = size ? calloc(1, size) : NULL;
+	return im->buf ? size : -1;
+}
+
+/* Colour bars with a gradient and a keyed square in the middle */
+static void make_picture(struct pxp_sw_image *im, unsigned int key)
+{
+	unsigned short *p = (unsigned short *)im->buf;
+	unsigned int r, g, b;
+	int x, y;
+
+	for (y = 0; y < im->height; y++) {
+		for (x = 0; x < im->width; x++) {
+			r = (x * 8 / im->width) & 1 ? 255 : x * 255 / im->width;
+			g = (x * 8 / im->width) & 2 ? 255 : y * 255 / im->height;
+			b = (x * 8 / im->width) & 4 ? 255 : (x ^ y) & 0xff;
+			if (abs(x - im->width / 2) < im->width / 8 &&
+			    abs(y - im->height / 2) < im->height / 8) {
+				r = key >> 16 & 0xff;
+				g = key >> 8 & 0xff;
+				b = key & 0xff;
+			}
+			*p++ = (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+		}
+	}
+}
+
+/* A half transparent ramp, fully transparent at the left */
+static void make_overlay(struct pxp_sw_image *im)
+{
+	unsigned char *p = im->buf;
+	int x, y;
+
+	for (y = 0; y < im->height; y++)
+		for (x = 0; x < im->width; x++, p += 4) {
+			p[0] = y * 255 / im->height;
+			p[1] = 0x80;
+			p[2] = 255 - y * 255 / im->height;
+			p[3] = x * 255 / im->width;
+		}
+}
+
+static int run_timed(const struct pxp_sw_task *t, int iterations,
+		     double *best)
+{
+	double t0, ms;
+	int i, ret;
+
+	for (i = 0; i < iterations; i++) {
+		t0 = now_ms();
+		ret = pxp_sw_run(t);
+		ms = now_ms() - t0;
+		if (ret < 0)
+			return ret;
+		if (!i || ms < *best)
+			*best = ms;
+	}
+	return 0;
+}
+
+static int setup_op(int op, struct pxp_sw_task *t, struct pxp_sw_image *s0,
+		    struct pxp_sw_image *i420, struct pxp_sw_image *ol)
+{
+	int w = s0->width, h = s0->height;
+	unsigned int fourcc = V4L2_PIX_FMT_RGB565;
+
+	memset(t, 0, sizeof(*t));
+	t->s0 = *s0;
+	t->out.width = w;
+	t->out.height = h;
+
+	switch (op) {
+	case OP_CSC_OUT:
+		fourcc = V4L2_PIX_FMT_UYVY;
+		break;
+	case OP_CSC_IN:
+		t->s0 = *i420;
+		break;
+	case OP_SCALE_DOWN:
+		t->out.width = w * 3 / 4 & ~1;
+		t->out.height = h * 3 / 4 & ~1;
+		break;
+	case OP_SCALE_UP:
+		t->out.width = w * 3 / 2 & ~1;
+		t->out.height = h * 3 / 2 & ~1;
+		break;
+	case OP_ROT90:
+		fourcc = V4L2_PIX_FMT_RGB32;
+		t->rotate = 90;
+		t->out.width = h;
+		t->out.height = w;
+		break;
+	case OP_ROT270_FLIP:
+		fourcc = V4L2_PIX_FMT_RGB32;
+		t->rotate = 270;
+		t->hflip = 1;
+		t->out.width = h;
+		t->out.height = w;
+		break;
+	case OP_ROT180:
+		t->rotate = 180;
+		break;
+	case OP_BLEND:
+		t->ol_enable = 1;
+		t->ol = *ol;
+		t->alpha_mode = PXP_SW_ALPHA_EMBEDDED;
+		break;
+	case OP_COLORKEY:
+		t->s0_colorkey_enable = 1;
+		t->s0_colorkey = 0x00ff00;
+		t->bgcolor = 0x000080;
+		break;
+	}
+	t->out.fourcc = fourcc;
+	return alloc_image(&t->out, fourcc, t->out.width, t->out.height);
+}
+
+static int benchmark(int iterations, int width, int height)
+{
+	struct pxp_sw_image s0, i420, ol, ref;
+	struct pxp_sw_task t;
+	unsigned char *out;
+	const char *simd = pxp_sw_simd();
+	double t_ref, t_fast;
+	int i, size, exact, ret = TPASS;
+
+	if (alloc_image(&s0, V4L2_PIX_FMT_RGB565, width, height) < 0 ||
+	    alloc_image(&i420, V4L2_PIX_FMT_YUV420, width, height) < 0 ||
+	    alloc_image(&ol, V4L2_PIX_FMT_ARGB32, width, height) < 0) {
+		printf("Out of memory\n");
+		return TFAIL;
+	}
+	make_picture(&s0, 0x00ff00);
+	make_overlay(&ol);
+	memset(&t, 0, sizeof(t));
+	t.s0 = s0;
+	t.out = i420;
+	if (pxp_sw_run(&t) < 0) {
+		printf("Can not make the I420 picture\n");
+		return TFAIL;
+	}
+
+	printf("%dx%d, reference: scalar scaler, line by line rotation; "
+		"tested: %s scaler, tiled rotation; best of %d\n\n", width,
+		height, simd ? simd : "scalar", iterations);
+	printf("%-18s %10s %10s %10s %8s %6s\n", "operation", "ref ms", "ms",
+		"Mpix/s", "speedup", "exact");
+
+	for (i = 0; i < (int)ARRAY_SIZE(bench_ops); i++) {
+		size = setup_op(bench_ops[i].op, &t, &s0, &i420, &ol);
+		if (size < 0 || alloc_image(&ref, t.out.fourcc, t.out.width,
+					    t.out.height) < 0) {
+			printf("Out of memory\n");
+			return TFAIL;
+		}
+		out = t.out.buf;
+
+		pxp_sw_set_simd(0);
+		pxp_sw_set_tile(0);
+		t.out.buf = ref.buf;
+		if (run_timed(&t, iterations, &t_ref) < 0)
+			goto fail;
+
+		pxp_sw_set_simd(1);
+		pxp_sw_set_tile(-1);
+		t.out.buf = out;
+		if (run_timed(&t, iterations, &t_fast) < 0)
+			goto fail;
+
+		exact = !memcmp(ref.buf, out, size);
+		printf("%-18s %10.2f %10.2f %10.1f %7.2fx %6s\n",
+			bench_ops[i].name, t_ref, t_fast,
+			(double)t.out.width * t.out.height / t_fast / 1000.0,
+			t_ref / t_fast, exact ? "yes" : "NO");
+		if (!exact)
+			ret = TFAIL;
+		free(ref.buf);
+		free(out);
+	}
+
+	free(s0.buf);
+	free(i420.buf);
+	free(ol.buf);
+	return ret;
+
+fail:
+	printf("%s failed\n", bench_ops[i].name);
+	return TFAIL;
+}
+
+static unsigned char *read_file(const char *name, int size)
+{
+	unsigned char *buf;
+	FILE *fp;
+
+	fp = fopen(name, "rb");
+	if (!fp) {
+		printf("Can not open %s: %s\n", name, strerror(errno));
+		return NULL;
+	}
+	buf = malloc(size);
+	if (buf && fread(buf, 1, size, fp) != (size_t)size) {
+		printf("%s is shorter than one frame (%d bytes)\n", name, size);
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fp);
+	return buf;
+}
+
+static int convert(struct pxp_sw_task *t, const char *in, const char *ol,
+		   const char *out, const char *ref, int tol, int iterations)
+{
+	struct pxp_sw_image r;
+	double ms = 0;
+	int size, bad, max_diff, ret = TFAIL;
+	FILE *fp;
+
+	t->s0.buf = read_file(in, pxp_sw_frame_size(t->s0.fourcc,
+			t->s0.width, t->s0.height));
+	if (!t->s0.buf)
+		return TFAIL;
+	if (t->ol_enable) {
+		t->ol.buf = read_file(ol, pxp_sw_frame_size(t->ol.fourcc,
+				t->ol.width, t->ol.height));
+		if (!t->ol.buf)
+			goto out;
+	}
+	size = alloc_image(&t->out, t->out.fourcc, t->out.width,
+			   t->out.height);
+	if (size < 0) {
+		printf("Out of memory\n");
+		goto out;
+	}
+	if (pxp_sw_check(t) < 0) {
+		printf("The PxP task is not valid\n");
+		goto out;
+	}
+	if (run_timed(t, iterations, &ms) < 0) {
+		printf("The PxP task failed\n");
+		goto out;
+	}
+	printf("%dx%d -> %dx%d in %.2f ms\n", t->s0.width, t->s0.height,
+		t->out.width, t->out.height, ms);
+
+	if (out) {
+		fp = fopen(out, "wb");
+		if (!fp || fwrite(t->out.buf, 1, size, fp) != (size_t)size) {
+			printf("Can not write %s\n", out);
+			if (fp)
+				fclose(fp);
+			goto out;
+		}
+		fclose(fp);
+	}
+
+	ret = TPASS;
+	if (ref) {
+		r = t->out;
+		r.buf = read_file(ref, size);
+		if (!r.buf) {
+			ret = TFAIL;
+			goto out;
+		}
+		bad = pxp_sw_compare(&t->out, &r, tol, &max_diff);
+		printf("%s: %d pixels off by more than %d, largest difference "
+			"%d\n", ref, bad, tol, max_diff);
+		if (bad)
+			ret = TFAIL;
+		free(r.buf);
+	}
+out:
+	free(t->s0.buf);
+	free(t->ol.buf);
+	free(t->out.buf);
+	return ret;
+}
+
+static void usage(char *app)
+{
+	printf("Software PxP benchmark and reference.\n");
+	printf("Usage: %s [-n iterations] [-W width -H height]\n", app);
+	printf("       %s -i s0.raw -W width -H height [options]\n", app);
+	printf("\t-i\t  Run one task on a raw S0 image instead of "
+		"benchmarking\n");
+	printf("\t-f\t  S0 fourcc (default RGBP)\n");
+	printf("\t-c\t  S0 crop left,top,width,height\n");
+	printf("\t-O\t  Output fourcc (default the S0 one)\n");
+	printf("\t-s\t  Output width,height after rotation (default the "
+		"crop)\n");
+	printf("\t-d\t  S0 place in the output before rotation, "
+		"left,top,width,height\n");
+	printf("\t-r\t  Rotation, 0, 90, 180 or 270\n");
+	printf("\t-x -y\t  Flip horizontally, vertically (before rotation)\n");
+	printf("\t-g\t  Background colour 0xRRGGBB\n");
+	printf("\t-k\t  S0 colour key 0xRRGGBB\n");
+	printf("\t-l\t  Overlay file,width,height,fourcc,left,top\n");
+	printf("\t-a\t  Overlay global alpha 0-255\n");
+	printf("\t-m\t  Alpha mode: 0 overlay alpha, 1 global, 2 both "
+		"(default 1 with -a, else 0)\n");
+	printf("\t-K\t  Overlay colour key 0xRRGGBB\n");
+	printf("\t-o\t  Write the output image\n");
+	printf("\t-C\t  Compare with a raw image, e.g. the PxP output\n");
+	printf("\t-T\t  Tolerance per colour channel for -C (default 2)\n");
+	printf("\t-n\t  Iterations, best is reported (default 3)\n");
+}
+
+static int parse_rect(const char *s, struct pxp_sw_rect *r)
+{
+	return sscanf(s, "%d,%d,%d,%d", &r->left, &r->top, &r->width,
+		      &r->height) == 4 ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *in = NULL, *out = NULL, *ref = NULL;
+	char ol_file[256] = "", fourcc[5];
+	struct pxp_sw_task t;
+	int iterations = 3, width = 0, height = 0, tol = 2;
+	int out_w = 0, out_h = 0, alpha_mode = -1, rt;
+
+	memset(&t, 0, sizeof(t));
+	t.s0.fourcc = V4L2_PIX_FMT_RGB565;
+
+	while ((rt = getopt(argc, argv,
+			"hi:f:c:O:s:d:r:xyg:k:l:a:m:K:o:C:T:n:W:H:")) >= 0) {
+		switch (rt) {
+		case 'i':
+			in = optarg;
+			break;
+		case 'f':
+			t.s0.fourcc = to_fourcc(optarg);
+			break;
+		case 'c':
+			if (parse_rect(optarg, &t.srect) < 0)
+				goto bad;
+			break;
+		case 'O':
+			t.out.fourcc = to_fourcc(optarg);
+			break;
+		case 's':
+			if (sscanf(optarg, "%d,%d", &out_w, &out_h) != 2)
+				goto bad;
+			break;
+		case 'd':
+			if (parse_rect(optarg, &t.drect) < 0)
+				goto bad;
+			break;
+		case 'r':
+			t.rotate = atoi(optarg);
+			break;
+		case 'x':
+			t.hflip = 1;
+			break;
+		case 'y':
+			t.vflip = 1;
+			break;
+		case 'g':
+			t.bgcolor = strtoul(optarg, NULL, 16);
+			break;
+		case 'k':
+			t.s0_colorkey_enable = 1;
+			t.s0_colorkey = strtoul(optarg, NULL, 16);
+			break;
+		case 'l':
+			memset(fourcc, 0, sizeof(fourcc));
+			if (sscanf(optarg, "%255[^,],%d,%d,%4[^,],%d,%d",
+				   ol_file, &t.ol.width, &t.ol.height, fourcc,
+				   &t.ol_left, &t.ol_top) != 6)
+				goto bad;
+			t.ol.fourcc = to_fourcc(fourcc);
+			t.ol_enable = 1;
+			break;
+		case 'a':
+			t.global_alpha = atoi(optarg);
+			if (alpha_mode < 0)
+				alpha_mode = PXP_SW_ALPHA_OVERRIDE;
+			break;
+		case 'm':
+			alpha_mode = atoi(optarg);
+			break;
+		case 'K':
+			t.ol_colorkey_enable = 1;
+			t.ol_colorkey = strtoul(optarg, NULL, 16);
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'C':
+			ref = optarg;
+			break;
+		case 'T':
+			tol = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'W':
+			width = atoi(optarg);
+			break;
+		case 'H':
+			height = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return rt == 'h' ? TPASS : TFAIL;
+		}
+	}
+
+	if (iterations < 1)
+		iterations = 1;
+	if (width < 0 || height < 0 || !width != !height)
+		goto bad;
+
+	if (!in)
+		return benchmark(iterations, width ? width : 1024,
+				 height ? height : 768);
+
+	if (!width) {
+		printf("-i needs -W and -H\n");
+		return TFAIL;
+	}
+	t.s0.width = width;
+	t.s0.height = height;
+	if (!t.out.fourcc)
+		t.out.fourcc = t.s0.fourcc;
+	if (!pxp_sw_format_ok(t.s0.fourcc) || !pxp_sw_format_ok(t.out.fourcc) ||
+	    (t.ol_enable && !pxp_sw_format_ok(t.ol.fourcc))) {
+		printf("Unsupported format\n");
+		return TFAIL;
+	}
+	t.alpha_mode = alpha_mode < 0 ? PXP_SW_ALPHA_EMBEDDED : alpha_mode;
+	if (!out_w) {
+		out_w = t.srect.width ? t.srect.width : width;
+		out_h = t.srect.height ? t.srect.height : height;
+		if (t.rotate % 180) {
+			rt = out_w;
+			out_w = out_h;
+			out_h = rt;
+		}
+	}
+	t.out.width = out_w;
+	t.out.height = out_h;
+
+	return convert(&t, in, ol_file, out, ref, tol, iterations);
+
+bad:
+	usage(argv[0]);
+	return TFAIL;
+}
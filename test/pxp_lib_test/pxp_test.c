@@ -33,6 +33,7 @@
 
 #include "pxp_lib.h"
 #include "pxp_test.h"
+#include "pxp_sw.h"
 #include "fsl_logo_480x360.h"
 
 #include "../../include/test_utils.h"
@@ -57,7 +58,8 @@ char *usage = "Usage: ./pxp_test.out "\
 	       "  -v <vertical flip> \n "\
 	       "  -l <left position for display> \n "\
 	       "  -t <top position for display> \n "\
-	       "  -i <pixel inversion> \n ";
+	       "  -i <pixel inversion> \n "\
+	       "  -c <check the output against the software PxP> \n ";
 
 #define WAVEFORM_MODE_INIT	0x0	/* Screen goes to white (clears) */
 #define WAVEFORM_MODE_DU	0x1	/* Grey->white/grey->black */
@@ -96,7 +98,7 @@ static struct input_argument input_arg[NR_INSTANCE];
 static int instance;
 
 static char *mainopts = "HI:";
-static char *options = "o:r:h:v:l:t:i:";
+static char *options = "o:r:h:v:l:t:i:c";
 
 int parse_main_args(int argc, char *argv[])
 {
@@ -155,6 +157,9 @@ int parse_args(int argc, char *argv[], int i)
 		case 'i':
 			input_arg[i].cmd.pixel_inversion = 1;
 			break;
+		case 'c':
+			input_arg[i].cmd.check = 1;
+			break;
 		case -1:
 			break;
 		default:
@@ -223,6 +228,52 @@ static void update_to_display(int left, int top, int width, int height, int wave
 	}
 }
 
+/* Run the same task on the CPU and compare, 2 grey levels of tolerance */
+static int check_output(struct cmd_line *cmdl, unsigned char *out)
+{
+	struct pxp_sw_task t;
+	struct pxp_sw_image hw;
+	int ret, max_diff;
+
+	if (cmdl->pixel_inversion) {
+		dbg(DBG_INFO, "no software LUT, output not checked\n");
+		return 0;
+	}
+
+	memset(&t, 0, sizeof(t));
+	t.s0.fourcc = PXP_PIX_FMT_RGB565;
+	t.s0.width = WIDTH;
+	t.s0.height = HEIGHT;
+	t.s0.buf = (unsigned char *)fb_480x360_2;
+	t.rotate = cmdl->rot_angle;
+	t.hflip = cmdl->hflip;
+	t.vflip = cmdl->vflip;
+	t.out.fourcc = PXP_PIX_FMT_GREY;
+	t.out.width = t.rotate % 180 ? HEIGHT : WIDTH;
+	t.out.height = t.rotate % 180 ? WIDTH : HEIGHT;
+	t.out.buf = malloc(WIDTH * HEIGHT);
+	if (!t.out.buf)
+		return -1;
+
+	ret = pxp_sw_run(&t);
+	if (ret < 0) {
+		dbg(DBG_ERR, "software PxP can not run this task\n");
+		goto out;
+	}
+	hw = t.out;
+	hw.buf = out;
+	ret = pxp_sw_compare(&t.out, &hw, 2, &max_diff);
+	if (ret) {
+		dbg(DBG_ERR, "%d pixels differ from the software PxP, "
+			"largest difference %d\n", ret, max_diff);
+		ret = -1;
+	} else
+		dbg(DBG_INFO, "output matches the software PxP\n");
+out:
+	free(t.out.buf);
+	return ret;
+}
+
 int pxp_test(void *arg)
 {
 	struct pxp_config_data *pxp_conf = NULL;
@@ -402,6 +453,12 @@ int pxp_test(void *arg)
 		goto err3;
 	}
 
+	if (cmdl->check) {
+		ret = check_output(cmdl, (unsigned char *)mem_o.virt_uaddr);
+		if (ret < 0)
+			goto err3;
+	}
+
 	if (cmdl->dst_scheme != PATH_FILE) {
 		var.bits_per_pixel = 8;
 		var.xres = 800;
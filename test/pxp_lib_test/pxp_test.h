@@ -32,6 +32,7 @@ struct cmd_line {
 	int left;
 	int top;
 	int pixel_inversion;
+	int check;
 };
 
 void get_arg(char *buf, int *argc, char *argv[]);
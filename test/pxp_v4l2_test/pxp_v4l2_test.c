@@ -45,6 +45,7 @@
 #include "../../include/soc_check.h"
 
 #include "../../include/test_utils.h"
+#include "../pxp_lib_test/pxp_sw.h"
 
 #define MAX_V4L2_DEVICE_NR     64
 
@@ -82,6 +83,9 @@ struct pxp_control {
 	struct v4l2_rect dst;
 	int wait;
 	int screen_w, screen_h;
+	struct v4l2_rect crop;
+	int check;
+	unsigned char *last_s0;		/* last frame queued, for -c */
 };
 
 struct pxp_video_format {
@@ -156,7 +160,7 @@ static struct pxp_video_format pxp_video_formats[] = {
 static void usage(char *bin)
 {
 	printf
-	    ("Usage: %s [-a <n>] [-k 0xHHHHHHHH] [-o <outfile>] [-sx <width>] [-sy <height>] [-hf] [-vf] [-r <D>] [-res <x>:<y>] [-w <n>] [-dst ...] [-f <fmt>] <s0_in> <s1_in>\n",
+	    ("Usage: %s [-a <n>] [-k 0xHHHHHHHH] [-o <outfile>] [-sx <width>] [-sy <height>] [-hf] [-vf] [-r <D>] [-res <x>:<y>] [-w <n>] [-dst ...] [-f <fmt>] [-c] <s0_in> <s1_in>\n",
 	     bin);
 }
 
@@ -168,6 +172,7 @@ static void help(char *bin)
 
 	printf("\nPossible options:\n");
 	printf("\t-a n\t\tset global alpha\n");
+	printf("\t-c    \tcheck the last frame against the software PxP\n");
 	printf("\t-h    \tprint help information\n");
 	printf("\t-hf   \tflip image horizontally\n");
 	printf("\t-k 0xHHHHHHHH   \tSet colorkey\n");
@@ -298,7 +303,7 @@ static struct pxp_control *pxp_init(int argc, char **argv)
 	pxp->fmt_idx = 3;	/* YUV420 */
 	pxp->wait = 1;
 
-	static const char *opt_string = "a:hk:o:ir:w:f:?";
+	static const char *opt_string = "a:chk:o:ir:w:f:?";
 
 	static const struct option long_opts[] = {
 		{"dst", required_argument, NULL, PXP_DST},
@@ -343,6 +348,9 @@ static struct pxp_control *pxp_init(int argc, char **argv)
 			pxp->global_alpha = 1;
 			pxp->global_alpha_val = atoi(optarg);
 			break;
+		case 'c':
+			pxp->check = 1;
+			break;
 		case 'h':
 			usage(argv[0]);
 			goto error;
@@ -610,6 +618,7 @@ static int pxp_config_windows(struct pxp_control *pxp)
 	}
 	printf("crop.c.l/t/w/h = %d/%d/%d/%d\n", crop.c.left,
 	       crop.c.top, crop.c.width, crop.c.height);
+	pxp->crop = crop.c;
 	if (ioctl(pxp->vfd, VIDIOC_S_CROP, &crop) < 0) {
 		perror("VIDIOC_S_CROP");
 		return 1;
@@ -692,6 +701,15 @@ static int pxp_start(struct pxp_control *pxp)
 		return 1;
 	}
 
+	if (pxp->check) {
+		pxp->last_s0 = malloc(s0_size);
+		if (!pxp->last_s0) {
+			perror("failed to allocate the check buffer");
+			close(fd);
+			return 1;
+		}
+	}
+
 	printf("PxP processing: start...\n");
 
 	gettimeofday(&tv_start, NULL);
@@ -727,6 +745,9 @@ static int pxp_start(struct pxp_control *pxp)
 			ret = -1;
 			break;
 		}
+		if (pxp->check)
+			memcpy(pxp->last_s0, pxp->buffers[buf.index].start,
+			       s0_size);
 		if (i == 2) {
 			int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
 			if (ioctl(pxp->vfd, VIDIOC_STREAMON, &type) < 0) {
@@ -767,6 +788,130 @@ static int pxp_stop(struct pxp_control *pxp)
 	return 0;
 }
 
+/*
+ * Run the last frame through the software PxP as the driver set it up:
+ * S0 scaled into the crop window over a black background, with its
+ * 0xFFFFEE colour key, under the framebuffer as the overlay, and compare
+ * that with the virtual output buffer.
+ */
+static int pxp_check_output(struct pxp_control *pxp)
+{
+	struct fb_var_screeninfo var;
+	struct pxp_sw_task t;
+	struct pxp_sw_image hw;
+	unsigned char *fb = MAP_FAILED, *out_buf = MAP_FAILED;
+	size_t fb_size = 0;
+	int ffd = -1, mfd = -1;
+	int ret = 1, n, max_diff;
+
+	memset(&t, 0, sizeof(t));
+	if (pxp->rotate % 180) {
+		printf("Output not checked: the crop window is not known "
+		       "before rotation\n");
+		return 0;
+	}
+
+	if ((ffd = open("/dev/fb0", O_RDWR, 0)) < 0) {
+		perror("fb device open failed");
+		goto out;
+	}
+	if (ioctl(ffd, FBIOGET_VSCREENINFO, &var)) {
+		perror("FBIOGET_VSCREENINFO");
+		goto out;
+	}
+	switch (var.bits_per_pixel) {
+	case 16:
+		t.out.fourcc = V4L2_PIX_FMT_RGB565;
+		break;
+	case 24:
+		t.out.fourcc = V4L2_PIX_FMT_RGB24;
+		break;
+	case 32:
+		t.out.fourcc = V4L2_PIX_FMT_RGB32;
+		break;
+	default:
+		printf("Output not checked: %d bpp framebuffer\n",
+		       var.bits_per_pixel);
+		ret = 0;
+		goto out;
+	}
+	fb_size = var.xres * var.yres * (var.bits_per_pixel >> 3);
+
+	fb = mmap(NULL, fb_size, PROT_READ, MAP_SHARED, ffd, 0);
+	if (fb == MAP_FAILED) {
+		perror("failed to mmap fb");
+		goto out;
+	}
+	if ((mfd = open("/dev/mem", O_RDWR, 0)) < 0) {
+		perror("mem device open failed");
+		goto out;
+	}
+	out_buf = mmap(NULL, fb_size, PROT_READ, MAP_SHARED, mfd,
+		       pxp->out_addr);
+	if (out_buf == MAP_FAILED) {
+		perror("failed to mmap output buffer");
+		goto out;
+	}
+
+	t.s0.fourcc = pxp_video_formats[pxp->fmt_idx].fourcc;
+	t.s0.width = pxp->s0.width;
+	t.s0.height = pxp->s0.height;
+	t.s0.buf = pxp->last_s0;
+	t.drect.left = pxp->crop.left;
+	t.drect.top = pxp->crop.top;
+	t.drect.width = pxp->crop.width;
+	t.drect.height = pxp->crop.height;
+	t.s0_colorkey_enable = 1;
+	t.s0_colorkey = 0xFFFFEE;
+	t.ol_enable = 1;
+	t.ol.fourcc = t.out.fourcc;
+	t.ol.width = var.xres;
+	t.ol.height = var.yres;
+	t.ol.buf = fb;
+	t.alpha_mode = pxp->global_alpha ? PXP_SW_ALPHA_OVERRIDE :
+					   PXP_SW_ALPHA_EMBEDDED;
+	t.global_alpha = pxp->global_alpha_val;
+	t.ol_colorkey_enable = pxp->colorkey;
+	t.ol_colorkey = pxp->colorkey_val;
+	t.hflip = pxp->hflip;
+	t.vflip = pxp->vflip;
+	t.rotate = pxp->rotate;
+	t.out.width = var.xres;
+	t.out.height = var.yres;
+	t.out.buf = malloc(fb_size);
+	if (!t.out.buf) {
+		perror("failed to allocate the check buffer");
+		goto out;
+	}
+
+	if (pxp_sw_run(&t) < 0) {
+		printf("The software PxP can not run this task\n");
+		goto out;
+	}
+	hw = t.out;
+	hw.buf = out_buf;
+	n = pxp_sw_compare(&t.out, &hw, 2, &max_diff);
+	if (n) {
+		printf("%d pixels differ from the software PxP, "
+		       "largest difference %d\n", n, max_diff);
+		goto out;
+	}
+	printf("Output matches the software PxP\n");
+	ret = 0;
+
+out:
+	free(t.out.buf);
+	if (out_buf != MAP_FAILED)
+		munmap(out_buf, fb_size);
+	if (fb != MAP_FAILED)
+		munmap(fb, fb_size);
+	if (mfd >= 0)
+		close(mfd);
+	if (ffd >= 0)
+		close(ffd);
+	return ret;
+}
+
 static int pxp_write_outfile(struct pxp_control *pxp)
 {
 	int fd, ffd, mfd;
@@ -834,6 +979,7 @@ static void pxp_cleanup(struct pxp_control *pxp)
 	close(pxp->vfd);
 	if (pxp->outfile)
 		free(pxp->outfile);
+	free(pxp->last_s0);
 	free(pxp->buffers);
 	free(pxp);
 }
@@ -886,6 +1032,9 @@ int main(int argc, char **argv)
 	if (pxp_stop(pxp))
 		return 1;
 
+	if (pxp->check && pxp_check_output(pxp))
+		return 1;
+
 	if (pxp->outfile_state)
 		if (pxp_write_outfile(pxp))
 			return 1;
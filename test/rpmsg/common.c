@@ -19,11 +19,16 @@
 struct termios ti;
 
 int init(void)
+{
+	printf("Starting tests!\r\n");
+	return init_dev("/dev/ttyRPMSG");
+}
+
+int init_dev(const char *dev)
 {
 	int fd;
 
-	printf("Starting tests!\r\n");
-	fd = open("/dev/ttyRPMSG", O_RDWR | O_NOCTTY);
+	fd = open(dev, O_RDWR | O_NOCTTY);
 	if (fd < 0) {
 		printf("error %d\r\n", fd);
 		return -1;
@@ -62,6 +67,34 @@ int pattern_cmp(char *buffer, char pattern, int len)
 	return 0;
 }
 
+/*
+ * Word-wise pattern of a sequence numbered message: every word differs
+ * between messages and within one, so a dropped, repeated or reordered
+ * message is caught as well as corrupted data.
+ */
+static inline uint32_t pattern_word(uint32_t seq, int i)
+{
+	return seq * 0x9E3779B1 + i;
+}
+
+void pattern_fill_words(uint32_t *buffer, uint32_t seq, int words)
+{
+	int i;
+
+	for (i = 0; i < words; i++)
+		buffer[i] = pattern_word(seq, i);
+}
+
+int pattern_cmp_words(const uint32_t *buffer, uint32_t seq, int words)
+{
+	int i;
+
+	for (i = 0; i < words; i++)
+		if (buffer[i] != pattern_word(seq, i))
+			return -1;
+	return 0;
+}
+
 int tc_send(int fd, int test_case, int step, int transfer_count, int data_len)
 {
 	int result = 0, i;
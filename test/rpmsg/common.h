@@ -12,12 +12,23 @@
 #ifndef __COMMON_H__
 #define __COMMON_H__
 
+#include <stdint.h>
+
+/* payload of one rpmsg buffer: 512 bytes less the rpmsg header */
+#define RPMSG_MTU 496
+
 int init(void);
 
+int init_dev(const char *dev);
+
 void deinit(int fd);
 
 int pattern_cmp(char *buffer, char pattern, int len);
 
+void pattern_fill_words(uint32_t *buffer, uint32_t seq, int words);
+
+int pattern_cmp_words(const uint32_t *buffer, uint32_t seq, int words);
+
 int tc_send(int fd, int test_case, int step, int transfer_count, int data_len);
 
 int tc_receive(int fd, int test_case, int step, int transfer_count,
@@ -0,0 +1,527 @@
+/*
+ * Copyright (C) 2016 Freescale Semiconductor, Inc.
+ *
+ * The code contained herein is licensed under the GNU General Public
+ * License. You may obtain a copy of the GNU General Public License
+ * Version 2 or later at the following locations:
+ *
+ * http://www.opensource.org/licenses/gpl-license.html
+ * http://www.gnu.org/copyleft/gpl.html
+ */
+
+/*
+ * rpmsg throughput and latency benchmark against the echo application
+ * on the remote core. Messages carry a sequence number, their length
+ * and send time, followed by a word-wise pattern. In ping-pong mode one
+ * message is in flight at a time; in stream mode up to a window of
+ * messages is kept in flight.
+ *
+ * On a host a pty or a socketpair stands in for /dev/ttyRPMSG, with an
+ * echo thread as the remote core. That thread stamps its receive time
+ * into the message, so one-way latency is measured; the remote core
+ * does not, and one-way latency is then half the round trip.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "common.h"
+
+#define BENCH_TIMEOUT_MS	2000
+#define BENCH_LIST_MAX		16
+#define HIST_BUCKETS		24	/* log2 microseconds */
+
+struct msg_hdr {
+	uint32_t seq;
+	uint32_t len;
+	uint64_t tx_ns;		/* sender clock */
+	uint64_t echo_ns;	/* stand-in echo clock, 0 from the remote core */
+};
+
+#define HDR_WORDS	(sizeof(struct msg_hdr) / 4)
+
+enum bench_mode {
+	MODE_PINGPONG,
+	MODE_STREAM,
+};
+
+static const char *mode_names[] = { "pingpong", "stream" };
+
+/* reassembles messages from a byte stream; tty reads may merge or split */
+struct msg_reader {
+	int fd;
+	unsigned char *buf;
+	int size;
+	int used;
+	int start;
+};
+
+struct echo_peer {
+	int fd;
+	volatile int stop;
+};
+
+struct lat_stats {
+	double *us;
+	int count;
+	unsigned int hist[HIST_BUCKETS];
+};
+
+static int bench_count = 1000;
+static int bench_hist = 1;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int write_all(int fd, const void *buf, int len)
+{
+	const unsigned char *p = buf;
+	int n, done = 0;
+
+	while (done < len) {
+		n = write(fd, p + done, len - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		done += n;
+	}
+
+	return 0;
+}
+
+static int reader_init(struct msg_reader *r, int fd, int size)
+{
+	r->fd = fd;
+	r->size = size;
+	r->used = 0;
+	r->start = 0;
+	r->buf = malloc(size);
+	return r->buf ? 0 : -1;
+}
+
+/*
+ * Copy the next complete message to msg (RPMSG_MTU bytes, 8 byte
+ * aligned) and return its length, or -1 if none arrived within the
+ * timeout or the stream is broken.
+ */
+static int reader_next(struct msg_reader *r, void *msg, int timeout_ms)
+{
+	struct msg_hdr hdr;
+	struct pollfd pfd;
+	int n;
+
+	for (;;) {
+		if (r->used - r->start >= (int)sizeof(hdr)) {
+			memcpy(&hdr, r->buf + r->start, sizeof(hdr));
+			if (hdr.len < sizeof(hdr) || hdr.len > RPMSG_MTU)
+				return -1;
+			if (r->used - r->start >= (int)hdr.len) {
+				memcpy(msg, r->buf + r->start, hdr.len);
+				r->start += hdr.len;
+				return hdr.len;
+			}
+		}
+
+		/* keep the partial message at the start */
+		if (r->start) {
+			memmove(r->buf, r->buf + r->start, r->used - r->start);
+			r->used -= r->start;
+			r->start = 0;
+		}
+
+		pfd.fd = r->fd;
+		pfd.events = POLLIN;
+		n = poll(&pfd, 1, timeout_ms);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+
+		n = read(r->fd, r->buf + r->used, r->size - r->used);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		r->used += n;
+	}
+}
+
+/* discard what is still in flight after a failed run */
+static void reader_drain(struct msg_reader *r)
+{
+	struct pollfd pfd;
+	unsigned char buf[RPMSG_MTU];
+
+	pfd.fd = r->fd;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 200) > 0)
+		if (read(r->fd, buf, sizeof(buf)) <= 0)
+			break;
+	r->used = 0;
+	r->start = 0;
+}
+
+static void *echo_thread(void *arg)
+{
+	struct echo_peer *peer = arg;
+	struct msg_reader r;
+	uint64_t msg[RPMSG_MTU / 8];
+	struct msg_hdr *hdr = (struct msg_hdr *)msg;
+	int len;
+
+	if (reader_init(&r, peer->fd, RPMSG_MTU * 64) < 0)
+		return NULL;
+
+	while (!peer->stop) {
+		len = reader_next(&r, msg, 100);
+		if (len < 0)
+			continue;
+		hdr->echo_ns = now_ns();
+		if (write_all(peer->fd, msg, len) < 0)
+			break;
+	}
+
+	free(r.buf);
+	return NULL;
+}
+
+static int open_standin(const char *kind, int *fd, int *peer_fd)
+{
+	struct termios ti;
+	int sv[2], master;
+
+	if (strcmp(kind, "socketpair") == 0) {
+		/* keeps message boundaries like an rpmsg endpoint */
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+			perror("socketpair");
+			return -1;
+		}
+		*fd = sv[0];
+		*peer_fd = sv[1];
+		return 0;
+	}
+
+	if (strcmp(kind, "pty") != 0) {
+		printf("Unknown stand-in %s\r\n", kind);
+		return -1;
+	}
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+		perror("pty");
+		return -1;
+	}
+	*fd = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (*fd < 0 || tcgetattr(*fd, &ti) < 0) {
+		perror("pty slave");
+		close(master);
+		return -1;
+	}
+	/* the same raw mode init() puts /dev/ttyRPMSG in */
+	cfmakeraw(&ti);
+	tcsetattr(*fd, TCSANOW, &ti);
+	*peer_fd = master;
+	return 0;
+}
+
+static void lat_add(struct lat_stats *s, double us)
+{
+	int b = 0;
+
+	s->us[s->count++] = us;
+	while (b < HIST_BUCKETS - 1 && us >= (double)(1 << b))
+		b++;
+	s->hist[b]++;
+}
+
+static int double_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double lat_pct(struct lat_stats *s, int pct10)
+{
+	if (s->count == 0)
+		return 0;
+	return s->us[(s->count - 1) * pct10 / 1000];
+}
+
+static void lat_print_hist(const char *name, struct lat_stats *s)
+{
+	unsigned int max = 0;
+	int b, lo = HIST_BUCKETS, hi = 0, bar;
+
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		if (!s->hist[b])
+			continue;
+		if (b < lo)
+			lo = b;
+		hi = b;
+		if (s->hist[b] > max)
+			max = s->hist[b];
+	}
+	if (max == 0)
+		return;
+
+	printf("  %s latency histogram (us):\r\n", name);
+	for (b = lo; b <= hi; b++) {
+		bar = s->hist[b] * 40 / max;
+		printf("  %7u - %-7u %8u %.*s\r\n",
+			b ? 1 << (b - 1) : 0, 1 << b, s->hist[b], bar,
+			"########################################");
+	}
+}
+
+static int run_config(int fd, enum bench_mode mode, int size, int window)
+{
+	struct msg_reader r;
+	struct msg_hdr *hdr;
+	struct lat_stats rtt, out, back;
+	uint64_t msg[RPMSG_MTU / 8], echo[RPMSG_MTU / 8];
+	uint64_t start, rx_ns;
+	uint32_t sent = 0, received = 0;
+	int words = size / 4, errors = 0, one_way = 1, ret = 0;
+	double elapsed;
+
+	memset(&rtt, 0, sizeof(rtt));
+	memset(&out, 0, sizeof(out));
+	memset(&back, 0, sizeof(back));
+	rtt.us = calloc(bench_count, sizeof(double));
+	out.us = calloc(bench_count, sizeof(double));
+	back.us = calloc(bench_count, sizeof(double));
+	r.buf = NULL;
+	if (!rtt.us || !out.us || !back.us ||
+	    reader_init(&r, fd, (window + 1) * RPMSG_MTU) < 0) {
+		printf("Out of memory\r\n");
+		ret = -1;
+		goto out;
+	}
+
+	if (mode == MODE_PINGPONG)
+		window = 1;
+
+	start = now_ns();
+	while (received < (uint32_t)bench_count) {
+		/* fill the window */
+		while (sent < (uint32_t)bench_count && sent - received < (uint32_t)window) {
+			pattern_fill_words((uint32_t *)msg + HDR_WORDS, sent,
+					   words - HDR_WORDS);
+			hdr = (struct msg_hdr *)msg;
+			hdr->seq = sent;
+			hdr->len = size;
+			hdr->echo_ns = 0;
+			hdr->tx_ns = now_ns();
+			if (write_all(fd, msg, size) < 0) {
+				printf("Sending message %u was unsuccessful.\r\n", sent);
+				ret = -1;
+				goto out;
+			}
+			sent++;
+		}
+
+		if (reader_next(&r, echo, BENCH_TIMEOUT_MS) < 0) {
+			printf("No echo for message %u.\r\n", received);
+			reader_drain(&r);
+			ret = -1;
+			goto out;
+		}
+		rx_ns = now_ns();
+		hdr = (struct msg_hdr *)echo;
+
+		if (hdr->seq != received || hdr->len != (uint32_t)size ||
+		    pattern_cmp_words((uint32_t *)hdr + HDR_WORDS, hdr->seq,
+				      words - HDR_WORDS)) {
+			if (errors++ < 10)
+				printf("Received bad message %u (seq %u, len %u).\r\n",
+					received, hdr->seq, hdr->len);
+		}
+
+		lat_add(&rtt, (rx_ns - hdr->tx_ns) / 1000.0);
+		if (hdr->echo_ns) {
+			lat_add(&out, (hdr->echo_ns - hdr->tx_ns) / 1000.0);
+			lat_add(&back, (rx_ns - hdr->echo_ns) / 1000.0);
+		} else {
+			one_way = 0;
+		}
+		received++;
+	}
+	elapsed = (now_ns() - start) / 1e9;
+
+	qsort(rtt.us, rtt.count, sizeof(double), double_cmp);
+	qsort(out.us, out.count, sizeof(double), double_cmp);
+	printf("%-8s %5d %6d %10.0f %8.3f %9.1f %9.1f %9.1f %9.1f %9.1f %6d\r\n",
+		mode_names[mode], size, window, received / elapsed,
+		received * (double)size / elapsed / 1e6,
+		lat_pct(&rtt, 500), lat_pct(&rtt, 990), lat_pct(&rtt, 1000),
+		one_way ? lat_pct(&out, 500) : lat_pct(&rtt, 500) / 2,
+		one_way ? lat_pct(&out, 990) : lat_pct(&rtt, 990) / 2,
+		errors);
+
+	if (bench_hist) {
+		lat_print_hist("round trip", &rtt);
+		if (one_way) {
+			lat_print_hist("one-way out", &out);
+			lat_print_hist("one-way back", &back);
+		}
+	}
+	if (errors)
+		ret = -1;
+
+out:
+	free(r.buf);
+	free(rtt.us);
+	free(out.us);
+	free(back.us);
+	return ret;
+}
+
+static int parse_list(const char *arg, int *values)
+{
+	char *copy = strdup(arg), *tok, *save;
+	int n = 0;
+
+	for (tok = strtok_r(copy, ",", &save); tok && n < BENCH_LIST_MAX;
+	     tok = strtok_r(NULL, ",", &save))
+		values[n++] = atoi(tok);
+
+	free(copy);
+	return n;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\r\n"
+		"-d, --dev PATH         rpmsg tty (default /dev/ttyRPMSG)\r\n"
+		"-s, --standin KIND     pty or socketpair with an echo thread instead\r\n"
+		"-z, --size LIST        message sizes, %d to %d bytes, multiple of 4\r\n"
+		"                       (default 32,128,%d)\r\n"
+		"-m, --mode LIST        pingpong,stream (default both)\r\n"
+		"-w, --window LIST      messages in flight in stream mode (default 4,16)\r\n"
+		"-n, --count N          messages per configuration (default 1000)\r\n"
+		"-q, --no-histogram     summary lines only\r\n",
+		name, (int)sizeof(struct msg_hdr), RPMSG_MTU, RPMSG_MTU);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{ "dev", required_argument, NULL, 'd' },
+		{ "standin", required_argument, NULL, 's' },
+		{ "size", required_argument, NULL, 'z' },
+		{ "mode", required_argument, NULL, 'm' },
+		{ "window", required_argument, NULL, 'w' },
+		{ "count", required_argument, NULL, 'n' },
+		{ "no-histogram", no_argument, NULL, 'q' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	int sizes[BENCH_LIST_MAX] = { 32, 128, RPMSG_MTU };
+	int windows[BENCH_LIST_MAX] = { 4, 16 };
+	int nsizes = 3, nwindows = 2, modes = 3;
+	const char *dev = "/dev/ttyRPMSG", *standin = NULL;
+	struct echo_peer peer;
+	pthread_t tid;
+	int fd, i, w, m, opt, result = 0;
+
+	while ((opt = getopt_long(argc, argv, "d:s:z:m:w:n:qh",
+				  long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 's':
+			standin = optarg;
+			break;
+		case 'z':
+			nsizes = parse_list(optarg, sizes);
+			break;
+		case 'm':
+			modes = (strstr(optarg, "pingpong") ? 1 : 0) |
+				(strstr(optarg, "stream") ? 2 : 0);
+			break;
+		case 'w':
+			nwindows = parse_list(optarg, windows);
+			break;
+		case 'n':
+			bench_count = atoi(optarg);
+			break;
+		case 'q':
+			bench_hist = 0;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+
+	for (i = 0; i < nsizes; i++)
+		if (sizes[i] < (int)sizeof(struct msg_hdr) ||
+		    sizes[i] > RPMSG_MTU || sizes[i] % 4) {
+			usage(argv[0]);
+			return -1;
+		}
+	for (i = 0; i < nwindows; i++)
+		if (windows[i] < 1) {
+			usage(argv[0]);
+			return -1;
+		}
+	if (bench_count < 1 || modes == 0 || nsizes < 1 || nwindows < 1) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if (standin) {
+		if (open_standin(standin, &fd, &peer.fd) < 0)
+			return -1;
+		peer.stop = 0;
+		if (pthread_create(&tid, NULL, echo_thread, &peer)) {
+			printf("Create echo thread failed\r\n");
+			return -1;
+		}
+		printf("%s stand-in for /dev/ttyRPMSG\r\n", standin);
+	} else {
+		fd = init_dev(dev);
+		if (fd < 0)
+			return fd;
+		printf("%s, one-way latency is half the round trip\r\n", dev);
+	}
+
+	printf("%-8s %5s %6s %10s %8s %9s %9s %9s %9s %9s %6s\r\n",
+		"mode", "size", "window", "msgs/s", "MB/s", "rtt p50", "rtt p99",
+		"rtt max", "1way p50", "1way p99", "errors");
+
+	for (m = 0; m < 2; m++) {
+		if (!(modes & (1 << m)))
+			continue;
+		for (i = 0; i < nsizes; i++)
+			for (w = 0; w < (m == MODE_PINGPONG ? 1 : nwindows); w++)
+				if (run_config(fd, m, sizes[i], windows[w]) < 0)
+					result = -1;
+	}
+
+	if (standin) {
+		peer.stop = 1;
+		pthread_join(tid, NULL);
+		close(peer.fd);
+	}
+	deinit(fd);
+	return result;
+}